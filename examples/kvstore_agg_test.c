@@ -0,0 +1,324 @@
+// Incrementally maintained aggregates test
+// Checks per-mailbox status rows against full scans through inserts,
+// updates, moves and deletes, and compares O(1) status reads with scanning.
+// Usage: kvstore_agg_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record definition
+// ------------------------
+
+#define FLAG_SEEN    0x1
+#define FLAG_FLAGGED 0x2
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    char *subject;
+    uint64_t size;
+    uint32_t flags;
+    uint64_t thread_id;
+};
+
+SERIALISE(message_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(subject, charptr),
+    SERIALISE_FIELD(size, uint64_t),
+    SERIALISE_FIELD(flags, uint32_t),
+    SERIALISE_FIELD(thread_id, uint64_t)
+)
+
+SERIALISE_DECLARE_KEYS(message_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_thread:", by_thread,
+    SERIALISE_FIELD(thread_id, uint64_t),
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_AGGREGATE(message_record, "mbox_stat:", mailbox_status,
+    (KV_AGG_COUNT(messages),
+     KV_AGG_SUM(total_size, size),
+     KV_AGG_COUNT_IF(unseen, flags, FLAG_SEEN, 0),
+     KV_AGG_COUNT_IF(flagged, flags, FLAG_FLAGGED, FLAG_FLAGGED)),
+    SERIALISE_FIELD(mailbox_id, uint32_t)
+)
+
+SERIALISE_AGGREGATE(message_record, "thread_stat:", thread_status,
+    (KV_AGG_COUNT(messages),
+     KV_AGG_SUM(total_size, size)),
+    SERIALISE_FIELD(thread_id, uint64_t)
+)
+
+SERIALISE_FINALIZE_AGGREGATES(message_record, mailbox_status, thread_status)
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_thread, "msg_thread:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+#define MAILBOXES 8
+
+static void make_message(struct message_record *msg, uint32_t mailbox_id,
+                         uint32_t uid, char *subject) {
+    memset(msg, 0, sizeof(*msg));
+    msg->mailbox_id = mailbox_id;
+    msg->uid = uid;
+    msg->subject = subject;
+    msg->size = 500 + (uid * 7919) % 20000;
+    msg->flags = (uid % 4 == 0 ? 0 : FLAG_SEEN) | (uid % 10 == 0 ? FLAG_FLAGGED : 0);
+    msg->thread_id = uid % 50;
+}
+
+// Ground truth: scan every message of the mailbox
+static void scan_status(kvstore_txn_t *txn, uint32_t mailbox_id,
+                        struct message_record_mailbox_status *st) {
+    memset(st, 0, sizeof(*st));
+    struct message_record_pk start = { .mailbox_id = mailbox_id, .uid = 0 };
+    kvstore_cursor_t *cur = kvstore_cursor_message_record_pk(txn, &start);
+
+    kvstore_val_t k, v;
+    while (cur && kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK) {
+        if (k.size < 4 || memcmp(k.data, "msg:", 4) != 0) break;
+
+        struct message_record rec;
+        deserialise_message_record((char*)v.data, &rec);
+        free(rec.subject);
+        if (rec.mailbox_id != mailbox_id) break;
+
+        st->messages++;
+        st->total_size += (int64_t)rec.size;
+        if (!(rec.flags & FLAG_SEEN)) st->unseen++;
+        if (rec.flags & FLAG_FLAGGED) st->flagged++;
+
+        if (kvstore_cursor_next(cur) != KVSTORE_OK) break;
+    }
+    kvstore_cursor_close(cur);
+}
+
+static void check_all(kvstore_t *db) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    int64_t messages = 0, bytes = 0;
+    for (uint32_t mbox = 0; mbox < MAILBOXES; mbox++) {
+        struct message_record_mailbox_status_key key = { .mailbox_id = mbox };
+        struct message_record_mailbox_status agg, ref;
+        int rc = kvstore_get_message_record_mailbox_status(txn, &key, &agg);
+        assert(rc == KVSTORE_OK || rc == KVSTORE_NOTFOUND);
+        scan_status(txn, mbox, &ref);
+        assert(memcmp(&agg, &ref, sizeof(agg)) == 0);
+        messages += agg.messages;
+        bytes += agg.total_size;
+    }
+
+    // Thread rows partition the same messages differently
+    for (uint64_t thread = 0; thread < 50; thread++) {
+        struct message_record_thread_status_key key = { .thread_id = thread };
+        struct message_record_thread_status agg;
+        kvstore_get_message_record_thread_status(txn, &key, &agg);
+        messages -= agg.messages;
+        bytes -= agg.total_size;
+    }
+    assert(messages == 0 && bytes == 0);
+    kvstore_txn_commit(txn);
+}
+
+// Read-modify-write through the key buffer, as application code would
+static int update_message(kvstore_txn_t *txn, uint32_t mailbox_id, uint32_t uid,
+                          void (*change)(struct message_record *msg)) {
+    struct message_record_pk pk = { .mailbox_id = mailbox_id, .uid = uid };
+    struct message_record msg = {0};
+    kvstore_key_buf_t key_buf = KVSTORE_KEY_BUF_INIT;
+
+    int rc = kvstore_get_message_record(txn, &pk, &msg, &key_buf);
+    if (rc == KVSTORE_OK) {
+        change(&msg);
+        rc = kvstore_put_message_record_with_all_indices(txn, &msg, &key_buf);
+    }
+    free(msg.subject);
+    kvstore_key_buf_free(&key_buf);
+    return rc;
+}
+
+static int delete_message(kvstore_txn_t *txn, uint32_t mailbox_id, uint32_t uid) {
+    struct message_record_pk pk = { .mailbox_id = mailbox_id, .uid = uid };
+    struct message_record msg = {0};
+    kvstore_key_buf_t key_buf = KVSTORE_KEY_BUF_INIT;
+
+    int rc = kvstore_get_message_record(txn, &pk, &msg, &key_buf);
+    if (rc == KVSTORE_OK) rc = kvstore_del_message_record_with_all_indices(txn, &key_buf);
+    free(msg.subject);
+    kvstore_key_buf_free(&key_buf);
+    return rc;
+}
+
+static void mark_seen(struct message_record *msg) { msg->flags |= FLAG_SEEN; }
+static void toggle_flag(struct message_record *msg) { msg->flags ^= FLAG_FLAGGED; }
+static void grow(struct message_record *msg) { msg->size += 1000; }
+static void move_mailbox(struct message_record *msg) {
+    msg->mailbox_id = (msg->mailbox_id + 1) % MAILBOXES;
+    msg->uid += 1000000;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 8000;
+
+    printf("=== Aggregate Maintenance Test ===\n\n");
+
+    kvstore_t *db = kvstore_open_mem();
+
+    // TEST 1: Inserts build the status rows
+    printf("Test 1: Inserting %u messages...\n", records);
+    {
+        char subject[64];
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        for (uint32_t uid = 1; uid <= records; uid++) {
+            struct message_record msg;
+            snprintf(subject, sizeof(subject), "Message %u", uid);
+            make_message(&msg, uid % MAILBOXES, uid, subject);
+            assert(kvstore_put_message_record_with_all_indices(txn, &msg, NULL) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        check_all(db);
+
+        txn = kvstore_txn_begin(db, true);
+        struct message_record_mailbox_status_key key = { .mailbox_id = 4 };
+        struct message_record_mailbox_status st;
+        assert(kvstore_get_message_record_mailbox_status(txn, &key, &st) == KVSTORE_OK);
+        kvstore_txn_commit(txn);
+        printf("  ✓ Mailbox 4: %lld messages, %lld bytes, %lld unseen, %lld flagged\n",
+               (long long)st.messages, (long long)st.total_size,
+               (long long)st.unseen, (long long)st.flagged);
+    }
+
+    // TEST 2: Updates adjust the rows by the old/new difference
+    printf("\nTest 2: Flag, size and mailbox changes...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        for (uint32_t uid = 4; uid <= records; uid += 8) {
+            assert(update_message(txn, uid % MAILBOXES, uid, mark_seen) == KVSTORE_OK);
+        }
+        for (uint32_t uid = 5; uid <= records; uid += 7) {
+            assert(update_message(txn, uid % MAILBOXES, uid, toggle_flag) == KVSTORE_OK);
+        }
+        for (uint32_t uid = 6; uid <= records; uid += 13) {
+            assert(update_message(txn, uid % MAILBOXES, uid, grow) == KVSTORE_OK);
+        }
+        for (uint32_t uid = 7; uid <= records; uid += 11) {
+            assert(update_message(txn, uid % MAILBOXES, uid, move_mailbox) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        check_all(db);
+        printf("  ✓ Status rows match full scans after updates\n");
+    }
+
+    // TEST 3: Deletes remove contributions, index entries and empty rows
+    printf("\nTest 3: Deleting messages...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        size_t deleted = 0;
+        for (uint32_t uid = 1; uid <= records; uid += 3) {
+            uint32_t mbox = uid % MAILBOXES;
+            int rc = delete_message(txn, mbox, uid);
+            if (rc == KVSTORE_NOTFOUND) rc = delete_message(txn, (mbox + 1) % MAILBOXES, uid + 1000000);
+            assert(rc == KVSTORE_OK);
+            deleted++;
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        check_all(db);
+
+        // Thread index entry for a deleted message is gone
+        txn = kvstore_txn_begin(db, true);
+        struct message_record_by_thread_key tk = { .thread_id = 1 % 50, .mailbox_id = 1, .uid = 1 };
+        struct message_record_pk found;
+        assert(kvstore_lookup_message_record_by_thread(txn, &tk, &found) == KVSTORE_NOTFOUND);
+        kvstore_txn_commit(txn);
+
+        // Emptying a mailbox deletes its row
+        txn = kvstore_txn_begin(db, false);
+        for (uint32_t uid = 0; uid <= records; uid += MAILBOXES) {
+            delete_message(txn, 0, uid);
+        }
+        for (uint32_t uid = 7; uid <= records; uid += 11) {
+            if ((uid % MAILBOXES + 1) % MAILBOXES == 0) delete_message(txn, 0, uid + 1000000);
+        }
+        struct message_record_mailbox_status_key key = { .mailbox_id = 0 };
+        struct message_record_mailbox_status st;
+        assert(kvstore_get_message_record_mailbox_status(txn, &key, &st) == KVSTORE_NOTFOUND);
+        assert(st.messages == 0 && st.total_size == 0);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        check_all(db);
+
+        printf("  ✓ %zu deletes applied, emptied mailbox has no status row\n", deleted);
+    }
+
+    // Benchmark: O(1) status read vs scanning the mailbox
+    printf("\nBenchmark: mailbox status for %u mailboxes\n", MAILBOXES);
+    {
+        const int rounds = 200;
+        struct timespec start;
+        int64_t check = 0;
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++) {
+            for (uint32_t mbox = 0; mbox < MAILBOXES; mbox++) {
+                struct message_record_mailbox_status st;
+                scan_status(txn, mbox, &st);
+                check += st.messages;
+            }
+        }
+        double scan_sec = elapsed_sec(&start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++) {
+            for (uint32_t mbox = 0; mbox < MAILBOXES; mbox++) {
+                struct message_record_mailbox_status_key key = { .mailbox_id = mbox };
+                struct message_record_mailbox_status st;
+                kvstore_get_message_record_mailbox_status(txn, &key, &st);
+                check -= st.messages;
+            }
+        }
+        double agg_sec = elapsed_sec(&start);
+        kvstore_txn_commit(txn);
+        assert(check == 0);
+
+        double reads = (double)rounds * MAILBOXES;
+        printf("  full scan:     %10.2f us per mailbox\n", scan_sec / reads * 1e6);
+        printf("  aggregate row: %10.2f us per mailbox (%.0fx faster)\n",
+               agg_sec / reads * 1e6, scan_sec / agg_sec);
+    }
+
+    kvstore_close(db);
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,517 @@
+// Async read test: the file backend's data file and asynchronous reads.
+// Checks the read engine in each mode, checkpoints against a memory store
+// given the same writes (tombstones, cursors, reopen, a log replayed over
+// a newer data file, transactions open across checkpoints), asynchronous
+// gets and multi-get, and split points.
+// Benchmarks random lookups on a cold data file: synchronous gets against
+// multi-get over io_uring and over the thread pool.
+// Usage: kvstore_aio_test [records] [lookups]
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE         // mincore(), in the fixture
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_file.h"
+#include "../include/kvstore_mem.h"
+#include "kvstore_file_fixture.h"
+
+// ------------------------
+// Record definitions
+// ------------------------
+
+struct mailbox_record {
+    uint32_t id;
+    uint64_t modseq;
+    char *name;
+};
+
+SERIALISE(mailbox_record,
+    SERIALISE_FIELD(id, uint32_t),
+    SERIALISE_FIELD(modseq, uint64_t),
+    SERIALISE_FIELD(name, charptr)
+)
+
+SERIALISE_DECLARE_KEYS(mailbox_record)
+
+SERIALISE_PRIMARY_KEY(mailbox_record, "mbox:",
+    SERIALISE_FIELD(id, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(mailbox_record, "mbox_name:", by_name,
+    SERIALISE_FIELD(name, charptr),
+    SERIALISE_FIELD(id, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(mailbox_record,
+    by_name, "mbox_name:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static kvstore_t* open_store(kvstore_io_mode_t mode) {
+    kvstore_file_opts_t opts = KVSTORE_FILE_OPTS_INIT;
+    opts.io_mode = mode;
+    kvstore_t *db = kvstore_open_file(dir, &opts);
+    assert(db);
+    return db;
+}
+
+// Both stores hold the same keys and values, by cursor (from a start key)
+// and by get
+static size_t compare_stores(kvstore_t *file, kvstore_t *mem, uint32_t range) {
+    kvstore_txn_t *ft = kvstore_txn_begin(file, true);
+    kvstore_txn_t *mt = kvstore_txn_begin(mem, true);
+
+    char sk[16];
+    make_key(sk, range / 3);
+    kvstore_val_t starts[2] = { { NULL, 0 }, { sk, strlen(sk) } };
+    size_t total = 0;
+    for (int s = 0; s < 2; s++) {
+        kvstore_cursor_t *fc = kvstore_cursor_open(ft, "kv", s ? &starts[s] : NULL);
+        kvstore_cursor_t *mc = kvstore_cursor_open(mt, "kv", s ? &starts[s] : NULL);
+        size_t n = 0;
+        kvstore_val_t fk, fv, mk, mv;
+        while (mc && kvstore_cursor_get(mc, &mk, &mv) == KVSTORE_OK) {
+            assert(fc && kvstore_cursor_get(fc, &fk, &fv) == KVSTORE_OK);
+            assert(fk.size == mk.size && memcmp(fk.data, mk.data, mk.size) == 0);
+            assert(fv.size == mv.size && memcmp(fv.data, mv.data, mv.size) == 0);
+            kvstore_cursor_next(mc);
+            kvstore_cursor_next(fc);
+            n++;
+        }
+        assert(!fc || kvstore_cursor_get(fc, &fk, NULL) == KVSTORE_NOTFOUND);
+        if (fc) kvstore_cursor_close(fc);
+        if (mc) kvstore_cursor_close(mc);
+        if (s == 0) total = n;
+    }
+
+    for (uint32_t i = 0; i < range; i++) {
+        char k[16];
+        make_key(k, i);
+        kvstore_val_t key = { k, strlen(k) }, fv, mv;
+        int frc = kvstore_txn_get(ft, "kv", &key, &fv);
+        int mrc = kvstore_txn_get(mt, "kv", &key, &mv);
+        assert(frc == mrc);
+        if (frc == KVSTORE_OK) assert(fv.size == mv.size && memcmp(fv.data, mv.data, mv.size) == 0);
+    }
+    kvstore_txn_commit(ft);
+    kvstore_txn_commit(mt);
+    return total;
+}
+
+typedef struct {
+    int calls;
+    int rc;
+    char val[64];
+} lookup_t;
+
+static void on_lookup(void *arg, int rc, kvstore_val_t *val) {
+    lookup_t *l = (lookup_t*)arg;
+    l->calls++;
+    l->rc = rc;
+    if (val) {
+        assert(val->size < sizeof(l->val));
+        memcpy(l->val, val->data, val->size);
+        l->val[val->size] = '\0';
+    }
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 400000;
+    uint32_t lookups = argc > 2 ? (uint32_t)atoi(argv[2]) : 4000;
+    const kvstore_io_mode_t modes[] = { KVSTORE_IO_URING, KVSTORE_IO_THREADS, KVSTORE_IO_SYNC };
+    const char *mode_names[] = { "auto", "io_uring", "threads", "sync" };
+
+    printf("=== Async Read Test ===\n\n");
+    fixture_init("aio");
+
+    // TEST 1: The engine returns every read, more than its depth, in each mode
+    printf("Test 1: Read engine...\n");
+    {
+        char file[80];
+        snprintf(file, sizeof(file), "%s/pattern", dir);
+        FILE *f = fopen(file, "wb");
+        assert(f);
+        for (uint32_t i = 0; i < 64 * 1024; i++) assert(fwrite(&i, 4, 1, f) == 1);
+        fclose(f);
+        int fd = open(file, O_RDONLY);
+        assert(fd >= 0);
+
+        bool uring = false;
+        for (int m = 0; m < 3; m++) {
+            kvstore_aio_t *aio = kvstore_aio_new(modes[m], 8, 3);
+            if (!aio) {
+                assert(modes[m] == KVSTORE_IO_URING);
+                continue;
+            }
+            if (modes[m] == KVSTORE_IO_URING) uring = true;
+            kvstore_aio_queue_t *q = kvstore_aio_queue_get(aio);
+            assert(q);
+
+            kvstore_aio_req_t reqs[100];
+            uint32_t bufs[100][16];
+            for (uint32_t i = 0; i < 100; i++) {
+                reqs[i] = (kvstore_aio_req_t){ .fd = fd, .buf = bufs[i], .len = sizeof(bufs[i]),
+                                               .off = (uint64_t)(i * 613 % 4000) * 64, .arg = &bufs[i] };
+                assert(kvstore_aio_submit(q, &reqs[i]) == KVSTORE_OK);
+            }
+            size_t got = 0;
+            while (kvstore_aio_pending(q) > 0) {
+                kvstore_aio_req_t *done[16];
+                size_t n;
+                assert(kvstore_aio_wait(q, 5, done, 16, &n) == KVSTORE_OK);
+                for (size_t i = 0; i < n; i++) {
+                    assert(done[i]->res == (ssize_t)done[i]->len);
+                    uint32_t *b = (uint32_t*)done[i]->arg;
+                    assert(b[0] == done[i]->off / 4 && b[15] == b[0] + 15);
+                }
+                got += n;
+            }
+            assert(got == 100);
+
+            // Past the end: a short read, like pread's
+            kvstore_aio_req_t tail = { .fd = fd, .buf = bufs[0], .len = 64, .off = 256 * 1024 - 8 };
+            kvstore_aio_req_t *done[1];
+            size_t n;
+            assert(kvstore_aio_submit(q, &tail) == KVSTORE_OK);
+            assert(kvstore_aio_wait(q, 1, done, 1, &n) == KVSTORE_OK && n == 1 && done[0]->res == 8);
+
+            kvstore_aio_queue_put(q);
+            assert(kvstore_aio_queue_get(aio) == q);    // Reused
+            kvstore_aio_queue_put(q);
+            kvstore_aio_free(aio);
+        }
+        close(fd);
+        unlink(file);
+        printf("  ✓ 100 scattered reads at depth 8 in io_uring%s, threads and sync modes\n",
+               uring ? "" : " (unavailable here)");
+    }
+
+    // TEST 2: Checkpoints match a memory store given the same writes
+    printf("\nTest 2: Checkpoints...\n");
+    {
+        kvstore_t *file = open_store(KVSTORE_IO_AUTO);
+        kvstore_t *mem = kvstore_open_mem();
+        const uint32_t range = 20000;
+
+        churn(file, mem, range, 30000);
+        assert(kvstore_file_checkpoint(file) == KVSTORE_OK);
+        kvstore_file_stats_t stats;
+        assert(kvstore_file_stats(file, &stats) == KVSTORE_OK);
+        assert(stats.checkpoints == 1 && stats.log_bytes == 0 && stats.data_bytes > 0);
+        size_t keys = compare_stores(file, mem, range);
+
+        // Overwrites and deletes in the memtable hide the data file's keys
+        churn(file, mem, range, 8000);
+        compare_stores(file, mem, range);
+
+        // Reopen: the log replays over the data file
+        kvstore_close(file);
+        file = open_store(KVSTORE_IO_AUTO);
+        compare_stores(file, mem, range);
+
+        // A crash between writing the data file and emptying the log
+        // replays the log over a data file that has it all already
+        char saved[80];
+        snprintf(saved, sizeof(saved), "%s/wal.saved", dir);
+        kvstore_close(file);
+        copy_file(path_wal, saved);
+        file = open_store(KVSTORE_IO_AUTO);
+        assert(kvstore_file_checkpoint(file) == KVSTORE_OK);
+        kvstore_close(file);
+        assert(rename(saved, path_wal) == 0);
+        file = open_store(KVSTORE_IO_AUTO);
+        size_t final = compare_stores(file, mem, range);
+        assert(kvstore_file_stats(file, &stats) == KVSTORE_OK);
+        assert(stats.seq == 2 && stats.log_bytes > 0);
+
+        // Generated records, through an index, from the data file alone
+        kvstore_txn_t *txn = kvstore_txn_begin(file, false);
+        for (uint32_t i = 1; i <= 300; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "Folder %03u", i);
+            struct mailbox_record rec = { .id = i, .modseq = i, .name = name };
+            assert(kvstore_put_mailbox_record_with_all_indices(txn, &rec, NULL) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        assert(kvstore_file_checkpoint(file) == KVSTORE_OK);
+        kvstore_close(file);
+        file = open_store(KVSTORE_IO_AUTO);
+        txn = kvstore_txn_begin(file, true);
+        struct mailbox_record_by_name_key nk = { .name = "Folder 123", .id = 123 };
+        struct mailbox_record_pk pk;
+        struct mailbox_record rec;
+        assert(kvstore_lookup_mailbox_record_by_name(txn, &nk, &pk) == KVSTORE_OK && pk.id == 123);
+        assert(kvstore_get_mailbox_record(txn, &pk, &rec, NULL) == KVSTORE_OK && rec.modseq == 123);
+        free(rec.name);
+        kvstore_txn_commit(txn);
+        assert(kvstore_file_stats(file, &stats) == KVSTORE_OK && stats.log_bytes == 0);
+
+        // Transactions open across a checkpoint on this thread: the reader
+        // sees the store as of the checkpoint, the first writer to commit
+        // after it is carried over, and a later one conflicts
+        kvstore_txn_t *reader = kvstore_txn_begin(file, true);
+        kvstore_txn_t *first = kvstore_txn_begin(file, false);
+        kvstore_txn_t *later = kvstore_txn_begin(file, false);
+        kvstore_val_t key = { "k", 1 }, key2 = { "j", 1 }, v1 = { "1", 1 }, v2 = { "2", 1 }, got;
+        assert(kvstore_txn_put(later, "overlap", &key, &v1) == KVSTORE_OK);
+        assert(kvstore_txn_put(first, "overlap", &key2, &v1) == KVSTORE_OK);
+        assert(kvstore_del_mailbox_record(first, &pk) == KVSTORE_OK);
+        txn = kvstore_txn_begin(file, false);
+        assert(kvstore_txn_put(txn, "overlap", &key, &v2) == KVSTORE_OK);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        assert(kvstore_file_checkpoint(file) == KVSTORE_OK);
+        txn = kvstore_txn_begin(file, false);
+        assert(kvstore_txn_get(reader, "overlap", &key, &got) == KVSTORE_OK);
+        assert(got.size == 1 && memcmp(got.data, "2", 1) == 0);
+        assert(kvstore_get_mailbox_record(reader, &pk, &rec, NULL) == KVSTORE_OK && rec.modseq == 123);
+        free(rec.name);
+        assert(kvstore_txn_commit(first) == KVSTORE_OK);
+        assert(kvstore_txn_commit(later) == KVSTORE_CONFLICT);
+        assert(kvstore_txn_commit(reader) == KVSTORE_OK);
+        assert(kvstore_get_mailbox_record(txn, &pk, &rec, NULL) == KVSTORE_NOTFOUND);
+        assert(kvstore_txn_get(txn, "overlap", &key2, &got) == KVSTORE_OK);
+        assert(kvstore_txn_get(txn, "overlap", &key, &got) == KVSTORE_OK);
+        assert(got.size == 1 && memcmp(got.data, "2", 1) == 0);
+        kvstore_txn_commit(txn);
+        kvstore_close(file);
+        file = open_store(KVSTORE_IO_AUTO);
+        txn = kvstore_txn_begin(file, true);
+        assert(kvstore_txn_get(txn, "overlap", &key2, &got) == KVSTORE_OK);
+        assert(kvstore_get_mailbox_record(txn, &pk, &rec, NULL) == KVSTORE_NOTFOUND);
+        kvstore_txn_commit(txn);
+        kvstore_close(file);
+
+        // The flusher checkpoints past checkpoint_bytes with a reader open
+        // all along, and keeps syncing commits
+        kvstore_file_opts_t opts = KVSTORE_FILE_OPTS_INIT;
+        opts.durability = KVSTORE_DURABLE_NONE;
+        opts.checkpoint_bytes = 4096;
+        file = kvstore_open_file(dir, &opts);
+        assert(file);
+        reader = kvstore_txn_begin(file, true);
+        for (uint32_t i = 0; i < 200; i++) {
+            char k[16];
+            make_key(k, i);
+            kvstore_val_t kk = { k, strlen(k) }, vv = { "0123456789abcdef0123456789abcdef", 32 };
+            txn = kvstore_txn_begin(file, false);
+            assert(kvstore_txn_put(txn, "overlap", &kk, &vv) == KVSTORE_OK);
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        }
+        double start = now_sec();
+        do {
+            assert(kvstore_file_stats(file, &stats) == KVSTORE_OK);
+        } while ((stats.checkpoints == 0 || stats.durable_seq < stats.seq) && now_sec() - start < 5);
+        assert(stats.checkpoints > 0 && stats.durable_seq == stats.seq);
+        assert(kvstore_txn_commit(reader) == KVSTORE_OK);
+
+        kvstore_close(file);
+        kvstore_close(mem);
+        reset();
+        printf("  ✓ %zu then %zu keys match through cursors and gets, after reopen and replay\n",
+               keys, final);
+        printf("  ✓ Checkpoints go ahead of open transactions, which keep their view\n");
+    }
+
+    // TEST 3: Asynchronous gets and multi-get, in each mode
+    printf("\nTest 3: Asynchronous gets...\n");
+    {
+        kvstore_t *db = open_store(KVSTORE_IO_AUTO);
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        for (uint32_t i = 0; i < 20000; i += 2) {
+            char k[16], v[32];
+            make_key(k, i);
+            snprintf(v, sizeof(v), "v%u", i);
+            kvstore_val_t key = { k, strlen(k) }, val = { v, strlen(v) };
+            assert(kvstore_txn_put(txn, "kv", &key, &val) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+        kvstore_close(db);
+
+        for (int m = 0; m < 3; m++) {
+            db = open_store(modes[m]);
+            kvstore_file_stats_t stats;
+            assert(kvstore_file_stats(db, &stats) == KVSTORE_OK);
+            if (modes[m] == KVSTORE_IO_URING && stats.io_mode != KVSTORE_IO_URING) {
+                kvstore_close(db);
+                continue;
+            }
+
+            txn = kvstore_txn_begin(db, false);
+            char k[16];
+            make_key(k, 4);
+            kvstore_val_t key = { k, strlen(k) }, val = { "mem", 3 };
+            assert(kvstore_txn_put(txn, "kv", &key, &val) == KVSTORE_OK);
+            make_key(k, 6);
+            assert(kvstore_txn_del(txn, "kv", &key) == KVSTORE_OK);
+
+            // Memtable answers at once; the data file's wait for a poll
+            lookup_t l[4] = { { 0 } };
+            uint32_t ids[4] = { 4, 6, 8, 9 };
+            for (int i = 0; i < 4; i++) {
+                make_key(k, ids[i]);
+                assert(kvstore_txn_get_async(txn, "kv", &key, on_lookup, &l[i]) == KVSTORE_OK);
+            }
+            assert(l[0].calls == 1 && l[0].rc == KVSTORE_OK && strcmp(l[0].val, "mem") == 0);
+            assert(l[1].calls == 1 && l[1].rc == KVSTORE_NOTFOUND);
+            size_t ran;
+            assert(kvstore_txn_poll(txn, 2, &ran) == KVSTORE_OK && ran == 2);
+            assert(l[2].calls == 1 && l[2].rc == KVSTORE_OK && strcmp(l[2].val, "v8") == 0);
+            assert(l[3].calls == 1 && l[3].rc == KVSTORE_NOTFOUND);
+
+            // Multi-get agrees with get, key by key
+            kvstore_val_t keys[500], vals[500];
+            int rcs[500];
+            char kbuf[500][16];
+            for (uint32_t i = 0; i < 500; i++) {
+                make_key(kbuf[i], (uint32_t)(next_rand() % 21000));
+                keys[i] = (kvstore_val_t){ kbuf[i], strlen(kbuf[i]) };
+            }
+            assert(kvstore_txn_get_many(txn, "kv", 500, keys, vals, rcs) == KVSTORE_OK);
+            for (uint32_t i = 0; i < 500; i++) {
+                kvstore_val_t v;
+                int rc = kvstore_txn_get(txn, "kv", &keys[i], &v);
+                assert(rc == rcs[i]);
+                if (rc == KVSTORE_OK) assert(v.size == vals[i].size && memcmp(v.data, vals[i].data, v.size) == 0);
+            }
+
+            // Outstanding lookups are dropped at abort
+            lookup_t dropped = { 0 };
+            make_key(k, 10);
+            assert(kvstore_txn_get_async(txn, "kv", &key, on_lookup, &dropped) == KVSTORE_OK);
+            kvstore_txn_abort(txn);
+            assert(dropped.calls == 0);
+            kvstore_close(db);
+        }
+        reset();
+        printf("  ✓ Memtable lookups at once, disk lookups on poll, 500-key multi-get matches get\n");
+    }
+
+    // TEST 4: Split points come from data file pages
+    printf("\nTest 4: Split points...\n");
+    {
+        kvstore_t *db = open_store(KVSTORE_IO_AUTO);
+        kvstore_t *mem = kvstore_open_mem();
+        churn(db, mem, 50000, 60000);
+        assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+        churn(db, mem, 50000, 5000);
+        size_t keys = compare_stores(db, mem, 50000);
+
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+        kvstore_val_t splits[7];
+        size_t n = 7;
+        assert(kvstore_txn_split_points(txn, "kv", NULL, NULL, splits, &n) == KVSTORE_OK);
+        assert(n == 7);
+        for (size_t i = 1; i < n; i++) {
+            size_t min = splits[i - 1].size < splits[i].size ? splits[i - 1].size : splits[i].size;
+            assert(memcmp(splits[i - 1].data, splits[i].data, min) < 0);
+        }
+        size_t counts[8] = { 0 };
+        assert(kvstore_scan_parallel(txn, "kv", NULL, NULL, 8, count_part, counts) == KVSTORE_OK);
+        size_t sum = 0, parts = 0;
+        for (int i = 0; i < 8; i++) {
+            sum += counts[i];
+            parts += counts[i] > 0;
+        }
+        assert(sum == keys && parts == 8);
+        kvstore_txn_commit(txn);
+        kvstore_close(db);
+        kvstore_close(mem);
+        reset();
+        printf("  ✓ %zu keys scanned in 8 parts split at page boundaries\n", keys);
+    }
+
+    // Benchmark: random lookups with the data file evicted from the page
+    // cache before each run, as if it were much larger than RAM
+    printf("\nBenchmark: %u records, %u random lookups, cold data file\n", records, lookups);
+    {
+        kvstore_t *db = open_store(KVSTORE_IO_AUTO);
+        char v[200];
+        memset(v, 'x', sizeof(v));
+        for (uint32_t done = 0; done < records; ) {
+            kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+            assert(kvstore_txn_set_durability(txn, KVSTORE_DURABLE_NONE) == KVSTORE_OK);
+            for (uint32_t i = 0; i < 50000 && done < records; i++, done++) {
+                char k[16];
+                make_key(k, done);
+                kvstore_val_t key = { k, strlen(k) }, val = { v, sizeof(v) };
+                assert(kvstore_txn_put(txn, "kv", &key, &val) == KVSTORE_OK);
+            }
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        }
+        assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+        kvstore_file_stats_t stats;
+        assert(kvstore_file_stats(db, &stats) == KVSTORE_OK);
+        kvstore_close(db);
+        printf("  data file %.1f MiB\n", (double)stats.data_bytes / (1024 * 1024));
+
+        kvstore_val_t *keys = (kvstore_val_t*)malloc(lookups * sizeof(kvstore_val_t));
+        kvstore_val_t *vals = (kvstore_val_t*)malloc(lookups * sizeof(kvstore_val_t));
+        int *rcs = (int*)malloc(lookups * sizeof(int));
+        char (*kbuf)[16] = malloc((size_t)lookups * 16);
+        assert(keys && vals && rcs && kbuf);
+        for (uint32_t i = 0; i < lookups; i++) {
+            make_key(kbuf[i], (uint32_t)(next_rand() % records));
+            keys[i] = (kvstore_val_t){ kbuf[i], strlen(kbuf[i]) };
+        }
+
+        printf("  %-22s %10s %12s\n", "method", "IOPS", "us/lookup");
+        const size_t batch = 32;
+        for (int run = 0; run < 3; run++) {
+            kvstore_io_mode_t mode = run == 0 ? KVSTORE_IO_SYNC : modes[run - 1];
+            db = open_store(mode);
+            assert(kvstore_file_stats(db, &stats) == KVSTORE_OK);
+            if (stats.io_mode != mode) {
+                kvstore_close(db);
+                continue;
+            }
+            evict_data();
+            uint64_t reads0 = stats.page_reads;
+
+            kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+            double start = now_sec();
+            if (run == 0) {
+                for (uint32_t i = 0; i < lookups; i++) {
+                    assert(kvstore_txn_get(txn, "kv", &keys[i], &vals[i]) == KVSTORE_OK);
+                }
+            } else {
+                for (uint32_t i = 0; i < lookups; i += batch) {
+                    size_t n = lookups - i < batch ? lookups - i : batch;
+                    assert(kvstore_txn_get_many(txn, "kv", n, &keys[i], &vals[i], &rcs[i]) == KVSTORE_OK);
+                }
+            }
+            double elapsed = now_sec() - start;
+            for (uint32_t i = 0; i < lookups; i++) assert(vals[i].size == sizeof(v));
+            kvstore_txn_commit(txn);
+
+            assert(kvstore_file_stats(db, &stats) == KVSTORE_OK);
+            char label[32] = "get";
+            if (run > 0) snprintf(label, sizeof(label), "get_many x%zu %s", batch, mode_names[mode]);
+            printf("  %-22s %10.0f %12.1f\n", label,
+                   (double)(stats.page_reads - reads0) / elapsed, elapsed / lookups * 1e6);
+            kvstore_close(db);
+        }
+        free(keys);
+        free(vals);
+        free(rcs);
+        free(kbuf);
+        reset();
+    }
+
+    rmdir(dir);
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,290 @@
+// Parallel apply test: a large commit to the memory backend applies its
+// write-set on several threads, sliced by table and key range. Checks that
+// the result matches a single-threaded commit for in-place updates, merges,
+// drops and several tables, that values replaced under an open transaction
+// stay readable, and benchmarks commit latency with 1-8 threads.
+// Usage: kvstore_apply_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_mem.h"
+
+// ------------------------
+// Record definitions
+// ------------------------
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    uint32_t flags;
+    uint64_t modseq;
+    uint64_t thread_id;
+    uint64_t internaldate;
+    char *subject;
+};
+
+SERIALISE(message_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(flags, uint32_t),
+    SERIALISE_FIELD(modseq, uint64_t),
+    SERIALISE_FIELD(thread_id, uint64_t),
+    SERIALISE_FIELD(internaldate, uint64_t),
+    SERIALISE_FIELD(subject, charptr)
+)
+
+SERIALISE_DECLARE_KEYS(message_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_modseq:", by_modseq,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(modseq, uint64_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_thread:", by_thread,
+    SERIALISE_FIELD(thread_id, uint64_t),
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_date:", by_date,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(internaldate, uint64_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_flags:", by_flags,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(flags, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_modseq, "msg_modseq:",
+    by_thread, "msg_thread:",
+    by_date, "msg_date:",
+    by_flags, "msg_flags:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+#define MAILBOXES 8
+
+static kvstore_t* open_store(size_t threads, size_t min_writes) {
+    kvstore_mem_opts_t opts = KVSTORE_MEM_OPTS_INIT;
+    opts.apply_threads = threads;
+    opts.parallel_min_writes = min_writes;
+    kvstore_t *db = kvstore_open_mem_opts(&opts);
+    assert(db);
+    return db;
+}
+
+static void put_message(kvstore_txn_t *txn, uint32_t i, uint64_t modseq, const char *subject) {
+    struct message_record rec = {
+        .mailbox_id = i % MAILBOXES, .uid = i + 1, .flags = i % 3, .modseq = modseq,
+        .thread_id = i / 4, .internaldate = 1700000000ull + i, .subject = (char*)subject,
+    };
+    assert(kvstore_put_message_record_with_all_indices(txn, &rec, NULL) == KVSTORE_OK);
+}
+
+// Move a record to a new modseq, replacing its old index keys
+static void bump_modseq(kvstore_txn_t *txn, uint32_t i, uint64_t modseq) {
+    struct message_record_pk pk = { i % MAILBOXES, i + 1 };
+    kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+    struct message_record rec;
+    assert(kvstore_get_message_record(txn, &pk, &rec, &kb) == KVSTORE_OK);
+    rec.modseq = modseq;
+    assert(kvstore_put_message_record_with_all_indices(txn, &rec, &kb) == KVSTORE_OK);
+    kvstore_key_buf_free(&kb);
+    free(rec.subject);
+}
+
+static void del_message(kvstore_txn_t *txn, uint32_t i) {
+    struct message_record_pk pk = { i % MAILBOXES, i + 1 };
+    kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+    struct message_record rec;
+    assert(kvstore_get_message_record(txn, &pk, &rec, &kb) == KVSTORE_OK);
+    assert(kvstore_del_message_record_with_all_indices(txn, &kb) == KVSTORE_OK);
+    kvstore_key_buf_free(&kb);
+    free(rec.subject);
+}
+
+static void put_raw(kvstore_txn_t *txn, const char *table, uint32_t i, uint32_t v) {
+    char key_buf[16], val_buf[16];
+    snprintf(key_buf, sizeof(key_buf), "k%08u", i);
+    snprintf(val_buf, sizeof(val_buf), "v%u", v);
+    kvstore_val_t key = { key_buf, strlen(key_buf) }, val = { val_buf, strlen(val_buf) };
+    assert(kvstore_txn_put(txn, table, &key, &val) == KVSTORE_OK);
+}
+
+static void load(kvstore_t *db, uint32_t n) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+    for (uint32_t i = 0; i < n; i++) {
+        put_message(txn, i, 1, "Weekly status");
+        put_raw(txn, "other", i, 0);
+        if (i % 4 == 0) put_raw(txn, "old", i, 0);
+    }
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+}
+
+// Every key and value of a table in a and b match, in order
+static size_t compare_tables(kvstore_t *a, kvstore_t *b, const char *table) {
+    kvstore_txn_t *ta = kvstore_txn_begin(a, true), *tb = kvstore_txn_begin(b, true);
+    kvstore_cursor_t *ca = kvstore_cursor_open(ta, table, NULL);
+    kvstore_cursor_t *cb = kvstore_cursor_open(tb, table, NULL);
+    assert((ca == NULL) == (cb == NULL));
+    size_t n = 0;
+    while (ca) {
+        kvstore_val_t ka, va, kb, vb;
+        int ra = kvstore_cursor_get(ca, &ka, &va), rb = kvstore_cursor_get(cb, &kb, &vb);
+        assert(ra == rb);
+        if (ra != KVSTORE_OK) break;
+        assert(ka.size == kb.size && memcmp(ka.data, kb.data, ka.size) == 0);
+        assert(va.size == vb.size && memcmp(va.data, vb.data, va.size) == 0);
+        n++;
+        kvstore_cursor_next(ca);
+        kvstore_cursor_next(cb);
+    }
+    if (ca) kvstore_cursor_close(ca);
+    if (cb) kvstore_cursor_close(cb);
+    kvstore_txn_commit(ta);
+    kvstore_txn_commit(tb);
+    return n;
+}
+
+// Rename every record: values change, no key is inserted or deleted
+static void rename_all(kvstore_t *db, uint32_t n) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+    for (uint32_t i = 0; i < n; i++) put_message(txn, i, 1, "Renamed");
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+}
+
+// New records, moved index keys, deletes, a refilled table and a new one
+static void churn(kvstore_t *db, uint32_t n) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+    for (uint32_t i = 0; i < n; i += 3) bump_modseq(txn, i, 2);
+    for (uint32_t i = 1; i < n; i += 5) del_message(txn, i);
+    for (uint32_t i = n; i < n + n / 2; i++) put_message(txn, i, 2, "New");
+    for (uint32_t i = 0; i < n; i += 2) put_raw(txn, "other", i, 1);
+    assert(kvstore_txn_drop_table(txn, "old") == KVSTORE_OK);
+    for (uint32_t i = 0; i < n; i += 8) put_raw(txn, "old", i, 2);
+    for (uint32_t i = 0; i < n / 4; i++) put_raw(txn, "fresh", i, 3);
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 50000;
+
+    printf("=== Parallel Apply Test ===\n\n");
+
+    // TEST 1: Parallel commits leave the same tables as serial ones
+    printf("Test 1: Same result as a single-threaded commit...\n");
+    {
+        const char *tables[] = { "", "other", "old", "fresh" };
+        size_t thread_counts[] = { 2, 3, 8 };
+        for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+            kvstore_t *serial = open_store(1, 0);
+            kvstore_t *parallel = open_store(thread_counts[t], 1);
+            load(serial, 3000);
+            load(parallel, 3000);
+            rename_all(serial, 3000);
+            rename_all(parallel, 3000);
+            assert(compare_tables(serial, parallel, "") == 15000);
+
+            churn(serial, 3000);
+            churn(parallel, 3000);
+            size_t keys = 0;
+            for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+                keys += compare_tables(serial, parallel, tables[i]);
+            }
+            assert(keys == (3000 - 600 + 1500) * 5 + 3000 + 375 + 750);
+            kvstore_close(serial);
+            kvstore_close(parallel);
+        }
+        printf("  ✓ In-place updates, merges, drop and new table match with 2, 3, 8 threads\n");
+    }
+
+    // TEST 2: Values replaced by a parallel commit stay valid for
+    // transactions that read them before it
+    printf("\nTest 2: Replaced values under an open transaction...\n");
+    {
+        kvstore_t *db = open_store(4, 1);
+        load(db, 2000);
+
+        kvstore_txn_t *reader = kvstore_txn_begin(db, true);
+        char key_buf[] = "k00000010";
+        kvstore_val_t key = { key_buf, 9 }, before, after;
+        assert(kvstore_txn_get(reader, "other", &key, &before) == KVSTORE_OK);
+
+        churn(db, 2000);
+        assert(before.size == 2 && memcmp(before.data, "v0", 2) == 0);
+        assert(kvstore_txn_get(reader, "other", &key, &after) == KVSTORE_OK);
+        assert(after.size == 2 && memcmp(after.data, "v1", 2) == 0);
+        kvstore_txn_commit(reader);
+        kvstore_close(db);
+        printf("  ✓ Old value readable until the transaction ends\n");
+    }
+
+    // Benchmark: commit latency of a batch that adds and reindexes records,
+    // every write in table ""
+    uint32_t batch = records / 2;
+    printf("\nBenchmark: %u records, commit of %u new + %u reindexed (%u writes)\n",
+           records, batch, batch, batch * 5 + batch * 3);
+    {
+        size_t thread_counts[] = { 1, 2, 4, 8 };
+        double base = 0;
+        printf("  %-8s %12s %8s\n", "threads", "commit ms", "speedup");
+        for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+            double best = 0;
+            for (int run = 0; run < 3; run++) {
+                kvstore_t *db = open_store(thread_counts[t], 0);
+                kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+                for (uint32_t i = 0; i < records; i++) put_message(txn, i, 1, "Weekly status");
+                assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+                txn = kvstore_txn_begin(db, false);
+                for (uint32_t i = 0; i < batch; i++) {
+                    put_message(txn, records + i, 1, "New");
+                    bump_modseq(txn, i * 2, 2);
+                }
+                kvstore_txn_stats_t stats;
+                assert(kvstore_txn_stats(txn, &stats) == KVSTORE_OK);
+                assert(stats.buffered == 8ull * batch);
+                struct timespec start;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+                double secs = elapsed_sec(&start);
+                if (run == 0 || secs < best) best = secs;
+                kvstore_close(db);
+            }
+            if (t == 0) base = best;
+            printf("  %-8zu %12.2f %7.2fx\n", thread_counts[t], best * 1e3, base / best);
+        }
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,384 @@
+// Checksum test: CRC-32C, and the file backend's page checksums.
+// Checks the hardware and table CRCs against known values and each other,
+// that pages are verified once as they are first loaded, buffered and with
+// direct I/O, that a corrupt or torn page fails the reads that need it and
+// no others, that a corrupt footer or index fails the open, and that the
+// offline verify finds what was damaged. Benchmarks the CRCs, random
+// lookups with verification on and off, and the offline verify.
+// Usage: kvstore_checksum_test [records] [lookups]
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE         // mincore(), in the fixture
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_crc.h"
+#include "../include/kvstore_file.h"
+#include "kvstore_file_fixture.h"
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static kvstore_t* open_store(bool direct, bool skip) {
+    kvstore_file_opts_t opts = KVSTORE_FILE_OPTS_INIT;
+    opts.direct_io = direct;
+    opts.cache_bytes = 64 * 1024 * 1024;
+    opts.skip_checksums = skip;
+    return kvstore_open_file(dir, &opts);
+}
+
+// Puts of keys 0..n with values of vlen bytes, checkpointed to the data file
+static void fill_store(uint32_t n, size_t vlen) {
+    kvstore_t *db = open_store(false, false);
+    assert(db);
+    char *v = (char*)malloc(vlen);
+    assert(v);
+    for (uint32_t done = 0; done < n; ) {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        assert(kvstore_txn_set_durability(txn, KVSTORE_DURABLE_NONE) == KVSTORE_OK);
+        for (uint32_t i = 0; i < 50000 && done < n; i++, done++) {
+            char k[16];
+            make_key(k, done);
+            memset(v, 'a' + (int)(done % 26), vlen);
+            kvstore_val_t key = { k, strlen(k) }, val = { v, vlen };
+            assert(kvstore_txn_put(txn, "kv", &key, &val) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+    }
+    assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+    kvstore_close(db);
+    free(v);
+}
+
+// Get key i: KVSTORE_OK only with the value fill_store() wrote
+static int get(kvstore_txn_t *txn, uint32_t i) {
+    char k[16];
+    make_key(k, i);
+    kvstore_val_t key = { k, strlen(k) }, val;
+    int rc = kvstore_txn_get(txn, "kv", &key, &val);
+    if (rc == KVSTORE_OK) assert(val.size > 0 && ((char*)val.data)[0] == 'a' + (int)(i % 26));
+    return rc;
+}
+
+// Gets of keys 0..n that fail
+static uint32_t failed_gets(kvstore_t *db, uint32_t n) {
+    uint32_t failed = 0;
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    for (uint32_t i = 0; i < n; i++) {
+        int rc = get(txn, i);
+        assert(rc == KVSTORE_OK || rc == KVSTORE_ERROR);
+        failed += rc != KVSTORE_OK;
+    }
+    kvstore_txn_commit(txn);
+    return failed;
+}
+
+// Keys a full scan returns before it ends, or fails (*failed)
+static size_t scan(kvstore_t *db, bool *failed) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "kv", NULL);
+    size_t n = 0;
+    int rc = cur ? KVSTORE_OK : KVSTORE_ERROR;
+    kvstore_val_t k;
+    while (rc == KVSTORE_OK && kvstore_cursor_get(cur, &k, NULL) == KVSTORE_OK) {
+        n++;
+        rc = kvstore_cursor_next(cur);
+    }
+    *failed = rc == KVSTORE_ERROR;
+    if (cur) kvstore_cursor_close(cur);
+    kvstore_txn_abort(txn);
+    return n;
+}
+
+// Overwrite len bytes of the data file at off with byte b
+static void damage(uint64_t off, size_t len, int b) {
+    char buf[4096];
+    assert(len <= sizeof(buf));
+    memset(buf, b, len);
+    int fd = open(path_data, O_WRONLY);
+    assert(fd >= 0 && pwrite(fd, buf, len, (off_t)off) == (ssize_t)len);
+    close(fd);
+}
+
+// Offset of a byte in the middle of a value in the page at off: fill_store()'s
+// values are runs of one letter, longer than any key
+static uint64_t value_byte(const char *path, uint64_t off) {
+    char page[4096];
+    int fd = open(path, O_RDONLY);
+    assert(fd >= 0 && pread(fd, page, sizeof(page), (off_t)off) == (ssize_t)sizeof(page));
+    close(fd);
+    size_t run = 0;
+    for (size_t i = 1; i < sizeof(page); i++) {
+        run = page[i] == page[i - 1] && page[i] >= 'a' && page[i] <= 'z' ? run + 1 : 0;
+        if (run == 50) return off + i;
+    }
+    assert(!"no value in the page");
+    return 0;
+}
+
+static uint64_t file_size(const char *path) {
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    return (uint64_t)st.st_size;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 200000;
+    uint32_t lookups = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 200000;
+
+    printf("=== KVStore Checksum Test ===\n\n");
+    fixture_init("crc");
+
+    // TEST 1: CRC-32C values, and the two implementations agree
+    printf("Test 1: CRC-32C...\n");
+    {
+        assert(kvstore_crc32c(0, "123456789", 9) == 0xe3069283u);
+        assert(kvstore_crc32c_sw(0, "123456789", 9) == 0xe3069283u);
+        assert(kvstore_crc32c(0, "", 0) == 0);
+        char zeros[32] = { 0 };
+        assert(kvstore_crc32c(0, zeros, 32) == 0x8a9136aau);
+
+        // Lengths across the three-stream block sizes, at every alignment,
+        // whole and in two pieces
+        static unsigned char buf[80000];
+        for (size_t i = 0; i < sizeof(buf); i++) buf[i] = (unsigned char)next_rand();
+        size_t checked = 0;
+        for (size_t len = 0; len + 8 < sizeof(buf); len = len * 5 / 4 + 1) {
+            for (size_t off = 0; off < 8; off++) {
+                uint32_t hw = kvstore_crc32c(0, buf + off, len);
+                assert(hw == kvstore_crc32c_sw(0, buf + off, len));
+                size_t cut = len / 3;
+                assert(hw == kvstore_crc32c(kvstore_crc32c(0, buf + off, cut), buf + off + cut, len - cut));
+                checked++;
+            }
+        }
+        printf("  ✓ Check values match; %s and table agree on %zu buffers\n",
+               kvstore_crc32c_impl(), checked);
+    }
+
+    // TEST 2: Pages are verified once, as they are first loaded
+    printf("\nTest 2: Verification on load...\n");
+    {
+        fill_store(20000, 100);
+        for (int direct = 0; direct < 2; direct++) {
+            kvstore_t *db = open_store(direct, false);
+            assert(db);
+            assert(failed_gets(db, 20000) == 0);
+            kvstore_file_stats_t stats = stats_of(db);
+            uint64_t pages = stats.pages_verified;
+            assert(pages > 0 && stats.checksum_errors == 0);
+
+            // Read again, by gets and a scan: nothing is verified twice
+            bool failed;
+            assert(failed_gets(db, 20000) == 0);
+            assert(scan(db, &failed) == 20000 && !failed);
+            stats = stats_of(db);
+            assert(stats.pages_verified == pages);
+            if (direct) assert(stats.cache.inserts == pages);
+            kvstore_close(db);
+
+            db = open_store(direct, true);
+            assert(failed_gets(db, 20000) == 0 && stats_of(db).pages_verified == 0);
+            kvstore_close(db);
+            printf("  ✓ %s: %llu pages verified once each\n", direct ? "Direct I/O" : "Buffered",
+                   (unsigned long long)pages);
+        }
+    }
+
+    // TEST 3: Damaged pages fail the reads that need them, and only those
+    printf("\nTest 3: Corrupt and torn pages...\n");
+    {
+        char saved[96];
+        snprintf(saved, sizeof(saved), "%s/saved", dir);
+        copy_file(path_data, saved);
+
+        kvstore_file_verify_t report;
+        assert(kvstore_file_verify(dir, 4, &report) == KVSTORE_OK);
+        assert(report.index_ok && report.pages > 40 && report.bad_pages == 0 &&
+               report.first_bad == UINT64_MAX);
+        uint64_t pages = report.pages;
+
+        // One flipped byte in a value, zeros over the second half of a page
+        // (a torn write), and a page of garbage
+        struct { uint64_t off; size_t len; int b; } cases[3] = {
+            { value_byte(saved, 5 * 4096), 1, 0x5a }, { 17 * 4096 + 2048, 2048, 0 },
+            { 30 * 4096, 4096, 0xee },
+        };
+        for (int c = 0; c < 3; c++) {
+            copy_file(saved, path_data);
+            damage(cases[c].off, cases[c].len, cases[c].b);
+            uint64_t page_off = cases[c].off / 4096 * 4096;
+
+            for (int threads = 1; threads <= 4; threads *= 4) {
+                assert(kvstore_file_verify(dir, (unsigned)threads, &report) == KVSTORE_ERROR);
+                assert(report.index_ok && report.pages == pages && report.bad_pages == 1 &&
+                       report.first_bad == page_off);
+            }
+
+            for (int direct = 0; direct < 2; direct++) {
+                kvstore_t *db = open_store(direct, false);
+                assert(db);
+                uint32_t failed = failed_gets(db, 20000);
+                assert(failed > 0 && failed < 100);
+                assert(stats_of(db).checksum_errors == failed);
+                bool scan_failed;
+                size_t n = scan(db, &scan_failed);
+                assert(scan_failed && n < 20000);
+
+                // Asynchronous gets fail the same keys
+                kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+                char ks[20000 / 50][16];
+                kvstore_val_t keys[20000 / 50], vals[20000 / 50];
+                int rcs[20000 / 50];
+                uint32_t async_failed = 0;
+                for (uint32_t i = 0; i < 20000; i += 20000 / 50) {
+                    for (uint32_t j = 0; j < 20000 / 50; j++) {
+                        make_key(ks[j], i + j);
+                        keys[j] = (kvstore_val_t){ ks[j], strlen(ks[j]) };
+                    }
+                    int rc = kvstore_txn_get_many(txn, "kv", 20000 / 50, keys, vals, rcs);
+                    uint32_t batch_failed = 0;
+                    for (uint32_t j = 0; j < 20000 / 50; j++) batch_failed += rcs[j] != KVSTORE_OK;
+                    assert(rc == (batch_failed ? KVSTORE_ERROR : KVSTORE_OK));
+                    async_failed += batch_failed;
+                }
+                kvstore_txn_abort(txn);
+                assert(async_failed == failed);
+                kvstore_close(db);
+            }
+            printf("  ✓ Page at %llu: the gets, asynchronous gets and scans over it fail; verify finds it\n",
+                   (unsigned long long)page_off);
+        }
+
+        // Without verification a flipped byte in a value goes unnoticed
+        copy_file(saved, path_data);
+        damage(cases[0].off, 1, 0x5a);
+        kvstore_t *db = open_store(false, true);
+        assert(db);
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+        uint32_t wrong = 0;
+        for (uint32_t i = 0; i < 20000; i++) {
+            char k[16];
+            make_key(k, i);
+            kvstore_val_t key = { k, strlen(k) }, val;
+            assert(kvstore_txn_get(txn, "kv", &key, &val) == KVSTORE_OK);
+            wrong += memchr(val.data, 0x5a, val.size) != NULL;
+        }
+        kvstore_txn_abort(txn);
+        kvstore_close(db);
+        assert(wrong == 1);
+        printf("  ✓ With skip_checksums, the flipped byte is read back as data\n");
+
+        // A damaged footer or index fails the open
+        uint64_t size = file_size(saved);
+        uint64_t offs[2] = { size - 20, size - 60 };
+        for (int i = 0; i < 2; i++) {
+            copy_file(saved, path_data);
+            damage(offs[i], 1, 0x77);
+            assert(open_store(false, false) == NULL);
+            assert(kvstore_file_verify(dir, 2, &report) == KVSTORE_ERROR && !report.index_ok);
+        }
+        copy_file(saved, path_data);
+        unlink(saved);
+        reset();
+        assert(kvstore_file_verify(dir, 2, &report) == KVSTORE_OK && report.pages == 0);
+        printf("  ✓ A damaged footer or index fails the open and the verify\n");
+    }
+
+    // Benchmark: CRCs, lookups with and without verification, and the
+    // offline verify
+    printf("\nBenchmark: %u records, %u random lookups\n", records, lookups);
+    {
+        static unsigned char page[4096];
+        for (size_t i = 0; i < sizeof(page); i++) page[i] = (unsigned char)next_rand();
+        uint32_t sink = 0;
+        for (int sw = 0; sw < 2; sw++) {
+            int n = sw ? 50000 : 500000;
+            double start = now_sec();
+            for (int i = 0; i < n; i++) {
+                sink ^= sw ? kvstore_crc32c_sw(0, page, sizeof(page)) : kvstore_crc32c(0, page, sizeof(page));
+            }
+            double ns = (now_sec() - start) * 1e9 / n;
+            printf("  crc32c %-6s: %6.0f ns per 4 KiB page, %5.1f GB/s\n",
+                   sw ? "table" : kvstore_crc32c_impl(), ns, 4096 / ns);
+        }
+        assert(sink != 1);
+
+        fill_store(records, 200);
+        printf("  data file %.1f MiB\n", (double)file_size(path_data) / (1024 * 1024));
+
+        // Lookups on a fresh open: buffered with the file cold on disk, and
+        // in the page cache (every page's first read verifies it), and
+        // direct, cold then with every page in the block cache
+        printf("  %-34s %10s %10s %10s\n", "lookups", "ops/s", "verified", "overhead");
+        const char *labels[4] = { "buffered, cold", "buffered, in page cache",
+                                  "direct, cold", "direct, in block cache" };
+        for (int mode = 0; mode < 4; mode++) {
+            double rate[2];
+            uint64_t verified = 0;
+            for (int skip = 1; skip >= 0; skip--) {
+                bool direct = mode >= 2;
+                kvstore_t *db = open_store(direct, skip);
+                assert(db);
+                if (mode == 0 || mode == 2) evict_data();
+                if (mode == 1) {
+                    int fd = open(path_data, O_RDONLY);
+                    assert(fd >= 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0);
+                    char buf[1 << 16];
+                    while (read(fd, buf, sizeof(buf)) > 0) {}
+                    close(fd);
+                }
+                if (mode == 3) {
+                    bool failed;
+                    assert(scan(db, &failed) == records && !failed);
+                }
+
+                rng = 12345;
+                uint64_t before = stats_of(db).pages_verified;
+                double start = now_sec();
+                kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+                for (uint32_t i = 0; i < lookups; i++) {
+                    if (i % 64 == 63) {
+                        kvstore_txn_commit(txn);
+                        txn = kvstore_txn_begin(db, true);
+                    }
+                    assert(get(txn, (uint32_t)(next_rand() % records)) == KVSTORE_OK);
+                }
+                kvstore_txn_commit(txn);
+                rate[skip] = lookups / (now_sec() - start);
+                if (!skip) verified = stats_of(db).pages_verified - before;
+                kvstore_close(db);
+            }
+            printf("  %-34s %10.0f %10llu %9.1f%%\n", labels[mode], rate[0],
+                   (unsigned long long)verified, (rate[1] / rate[0] - 1) * 100);
+        }
+
+        // The offline verify, cold, with one thread and several
+        kvstore_file_verify_t report;
+        for (unsigned threads = 1; threads <= 4; threads *= 4) {
+            evict_data();
+            double start = now_sec();
+            assert(kvstore_file_verify(dir, threads, &report) == KVSTORE_OK);
+            double elapsed = now_sec() - start;
+            printf("  verify, %u thread%s: %llu pages in %.2f s, %.0f MB/s\n", threads,
+                   threads > 1 ? "s" : "", (unsigned long long)report.pages, elapsed,
+                   (double)report.bytes / elapsed / 1e6);
+        }
+        reset();
+    }
+
+    rmdir(dir);
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
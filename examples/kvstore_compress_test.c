@@ -0,0 +1,455 @@
+// Compression test: the LZ codec, and the file backend's compressed pages.
+// Checks that the codec round trips data of every kind and length and
+// rejects malformed input, that a store with a codec per table returns
+// what it was given through gets, asynchronous gets and cursors, buffered
+// and with direct I/O, across checkpoints that change the codec, and that
+// checksums and the offline verify cover compressed pages. Benchmarks
+// message indexes (prefixed keys and small integers) stored as is and
+// compressed: the disk footprint, the write amplification of loading them
+// with periodic checkpoints, and random lookups, cold and cached.
+// Usage: kvstore_compress_test [messages] [lookups]
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE         // mincore(), in the fixture
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_compress.h"
+#include "../include/kvstore_file.h"
+#include "kvstore_file_fixture.h"
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    put_u32(p, (uint32_t)(v >> 32));
+    put_u32(p + 4, (uint32_t)v);
+}
+
+// Tables named "idx:..." compress, the rest don't
+static kvstore_codec_t idx_codec(const char *table, void *arg) {
+    (void)arg;
+    return strncmp(table, "idx:", 4) == 0 ? KVSTORE_CODEC_LZ : KVSTORE_CODEC_NONE;
+}
+
+static kvstore_t* open_store(bool direct, kvstore_codec_t codec, bool per_table) {
+    kvstore_file_opts_t opts = KVSTORE_FILE_OPTS_INIT;
+    opts.direct_io = direct;
+    opts.compression = codec;
+    if (per_table) opts.table_codec = idx_codec;
+    opts.checkpoint_bytes = SIZE_MAX;
+    return kvstore_open_file(dir, &opts);
+}
+
+// ------------------------
+// Message indexes
+// ------------------------
+
+// A mailbox store's indexes: by uid (mailbox, uid) to the message's small
+// fields, and by date (mailbox, date, uid) with no value. Message i is in
+// mailbox i % 64, with uids counting up in each.
+typedef struct {
+    unsigned char key[16];
+    size_t key_len;
+    unsigned char val[32];
+    size_t val_len;
+} entry_t;
+
+static void uid_entry(uint32_t i, entry_t *e) {
+    uint32_t mailbox = i % 64, uid = i / 64 + 1;
+    put_u32(e->key, mailbox);
+    put_u32(e->key + 4, uid);
+    e->key_len = 8;
+    put_u64(e->val, 1000 + i / 3);              // modseq
+    put_u32(e->val + 8, (i * 7) % 5 == 0 ? 1 : 0);      // flags
+    put_u32(e->val + 12, 2000 + (uint32_t)((i * 2654435761u) >> 20));  // size
+    put_u64(e->val + 16, 1700000000ull + i * 37ull);    // date
+    put_u32(e->val + 24, uid);                  // thread
+    put_u32(e->val + 28, 0);
+    e->val_len = 32;
+}
+
+static void date_entry(uint32_t i, entry_t *e) {
+    uint32_t mailbox = i % 64, uid = i / 64 + 1;
+    put_u32(e->key, mailbox);
+    put_u64(e->key + 4, 1700000000ull + i * 37ull);
+    put_u32(e->key + 12, uid);
+    e->key_len = 16;
+    e->val_len = 0;
+}
+
+// Put messages [from, to), in commits of 10000
+static size_t load(kvstore_t *db, uint32_t from, uint32_t to) {
+    size_t bytes = 0;
+    for (uint32_t i = from; i < to; ) {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        assert(kvstore_txn_set_durability(txn, KVSTORE_DURABLE_NONE) == KVSTORE_OK);
+        for (uint32_t end = i + 10000 < to ? i + 10000 : to; i < end; i++) {
+            entry_t e;
+            uid_entry(i, &e);
+            kvstore_val_t k = { e.key, e.key_len }, v = { e.val, e.val_len };
+            assert(kvstore_txn_put(txn, "idx:uid", &k, &v) == KVSTORE_OK);
+            bytes += e.key_len + e.val_len;
+            date_entry(i, &e);
+            k = (kvstore_val_t){ e.key, e.key_len };
+            v = (kvstore_val_t){ e.val, e.val_len };
+            assert(kvstore_txn_put(txn, "idx:date", &k, &v) == KVSTORE_OK);
+            bytes += e.key_len;
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+    }
+    return bytes;
+}
+
+// Blobs: values that won't compress
+static void blob(uint32_t i, char *k, unsigned char *v, size_t len) {
+    snprintf(k, 16, "b%07u", i);
+    uint64_t x = i * 0x9e3779b97f4a7c15ull + 1;
+    for (size_t j = 0; j < len; j++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        v[j] = (unsigned char)x;
+    }
+}
+
+// Every message's uid entry and every blob, by gets, asynchronous gets and
+// scans. Returns the failed gets.
+static uint32_t check_all(kvstore_t *db, uint32_t messages, uint32_t blobs) {
+    uint32_t failed = 0;
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    for (uint32_t i = 0; i < messages; i++) {
+        entry_t e;
+        uid_entry(i, &e);
+        kvstore_val_t k = { e.key, e.key_len }, v;
+        int rc = kvstore_txn_get(txn, "idx:uid", &k, &v);
+        assert(rc == KVSTORE_OK || rc == KVSTORE_ERROR);
+        if (rc == KVSTORE_OK) assert(v.size == e.val_len && memcmp(v.data, e.val, v.size) == 0);
+        failed += rc != KVSTORE_OK;
+    }
+    for (uint32_t i = 0; i < blobs; i++) {
+        char key[16];
+        unsigned char val[300];
+        blob(i, key, val, sizeof(val));
+        kvstore_val_t k = { key, strlen(key) }, v;
+        int rc = kvstore_txn_get(txn, "blob", &k, &v);
+        assert(rc == KVSTORE_OK || rc == KVSTORE_ERROR);
+        if (rc == KVSTORE_OK) assert(v.size == sizeof(val) && memcmp(v.data, val, v.size) == 0);
+        failed += rc != KVSTORE_OK;
+    }
+    kvstore_txn_abort(txn);
+    if (failed) return failed;
+
+    // Asynchronous gets of every 7th message, in batches
+    txn = kvstore_txn_begin(db, true);
+    entry_t es[64];
+    kvstore_val_t keys[64], vals[64];
+    int rcs[64];
+    for (uint32_t i = 0; i < messages; i += 64 * 7) {
+        size_t n = 0;
+        for (uint32_t j = i; j < messages && n < 64; j += 7, n++) {
+            uid_entry(j, &es[n]);
+            keys[n] = (kvstore_val_t){ es[n].key, es[n].key_len };
+        }
+        assert(kvstore_txn_get_many(txn, "idx:uid", n, keys, vals, rcs) == KVSTORE_OK);
+        for (size_t j = 0; j < n; j++) {
+            assert(rcs[j] == KVSTORE_OK && vals[j].size == es[j].val_len &&
+                   memcmp(vals[j].data, es[j].val, vals[j].size) == 0);
+        }
+    }
+
+    // Scans of the date index and the blobs, in key order
+    const char *tables[2] = { "idx:date", "blob" };
+    for (int t = 0; t < 2; t++) {
+        kvstore_cursor_t *cur = kvstore_cursor_open(txn, tables[t], NULL);
+        assert(cur);
+        size_t n = 0;
+        kvstore_val_t k, prev = { NULL, 0 };
+        unsigned char last[16];
+        while (kvstore_cursor_get(cur, &k, NULL) == KVSTORE_OK) {
+            assert(k.size <= sizeof(last));
+            if (prev.data) {
+                size_t min = k.size < prev.size ? k.size : prev.size;
+                int cmp = memcmp(prev.data, k.data, min);
+                assert(cmp < 0 || (cmp == 0 && prev.size < k.size));
+            }
+            memcpy(last, k.data, k.size);
+            prev = (kvstore_val_t){ last, k.size };
+            n++;
+            int rc = kvstore_cursor_next(cur);
+            assert(rc == KVSTORE_OK || rc == KVSTORE_NOTFOUND);
+        }
+        kvstore_cursor_close(cur);
+        assert(n == (t == 0 ? messages : blobs));
+    }
+    kvstore_txn_abort(txn);
+    return 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Random lookups in the uid index, each timed. Sets p50 and p99 in µs.
+static void lookups_timed(kvstore_t *db, uint32_t messages, uint32_t n, double *p50, double *p99) {
+    double *lat = (double*)malloc(n * sizeof(double));
+    assert(lat);
+    rng = 4242;
+    for (uint32_t i = 0; i < n; i++) {
+        entry_t e;
+        uid_entry((uint32_t)(next_rand() % messages), &e);
+        kvstore_val_t k = { e.key, e.key_len }, v;
+        double start = now_sec();
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+        assert(kvstore_txn_get(txn, "idx:uid", &k, &v) == KVSTORE_OK);
+        kvstore_txn_abort(txn);
+        lat[i] = (now_sec() - start) * 1e6;
+    }
+    qsort(lat, n, sizeof(double), cmp_double);
+    *p50 = lat[n / 2];
+    *p99 = lat[n * 99 / 100];
+    free(lat);
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t messages = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 400000;
+    uint32_t lookups = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 20000;
+
+    printf("=== KVStore Compression Test ===\n\n");
+    fixture_init("compress");
+
+    // TEST 1: The codec
+    printf("Test 1: LZ codec...\n");
+    {
+        static unsigned char in[70000], out[70000], comp[80000];
+        size_t checked = 0;
+        for (int kind = 0; kind < 4; kind++) {
+            for (size_t len = 0; len < sizeof(in); len = len * 3 / 2 + 1) {
+                for (size_t i = 0; i < len; i++) {
+                    in[i] = kind == 0 ? (unsigned char)next_rand()
+                          : kind == 1 ? 0
+                          : kind == 2 ? (unsigned char)("abc"[next_rand() % 3])
+                          : (unsigned char)(i / 37);
+                }
+                size_t n = kvstore_lz_compress(in, len, comp, sizeof(comp));
+                assert(n > 0 && n <= kvstore_lz_bound(len));
+                memset(out, 0xcc, len);
+                assert(kvstore_lz_decompress(comp, n, out, len) == KVSTORE_OK);
+                assert(memcmp(in, out, len) == 0);
+
+                // Asked for the wrong length, or cut short, it fails
+                if (len > 0) assert(kvstore_lz_decompress(comp, n, out, len - 1) == KVSTORE_ERROR);
+                assert(kvstore_lz_decompress(comp, n, out, len + 1) == KVSTORE_ERROR);
+                if (n > 1) assert(kvstore_lz_decompress(comp, n - 1, out, len) == KVSTORE_ERROR);
+
+                // Random bytes don't fit in less than their length; runs do
+                if (len > 64) {
+                    size_t small = kvstore_lz_compress(in, len, comp, len - len / 8);
+                    assert(kind == 0 ? small == 0 : small > 0);
+                }
+                checked++;
+            }
+        }
+        printf("  ✓ %zu buffers round trip; wrong lengths and short input fail\n", checked);
+
+        // Garbage never reads or writes out of bounds (run under ASan)
+        for (int t = 0; t < 200000; t++) {
+            size_t n = next_rand() % 48, len = next_rand() % 300;
+            for (size_t i = 0; i < n; i++) comp[i] = (unsigned char)next_rand();
+            int rc = kvstore_lz_decompress(comp, n, out, len);
+            assert(rc == KVSTORE_OK || rc == KVSTORE_ERROR);
+        }
+        printf("  ✓ 200000 random inputs decoded safely\n");
+    }
+
+    // TEST 2: A codec per table, through every read path
+    printf("\nTest 2: Compressed pages...\n");
+    uint32_t messages_small = 20000, blobs = 2000;
+    {
+        kvstore_t *db = open_store(false, KVSTORE_CODEC_NONE, true);
+        assert(db);
+        load(db, 0, messages_small);
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        for (uint32_t i = 0; i < blobs; i++) {
+            char key[16];
+            unsigned char val[300];
+            blob(i, key, val, sizeof(val));
+            kvstore_val_t k = { key, strlen(key) }, v = { val, sizeof(val) };
+            assert(kvstore_txn_put(txn, "blob", &k, &v) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+        kvstore_file_stats_t stats = stats_of(db);
+        uint64_t idx_pages = stats.compressed_pages, pages = stats.page_bytes / 4096;
+        assert(idx_pages > 0 && pages - idx_pages >= blobs / (4096 / 300));
+        assert(stats.data_bytes < stats.page_bytes);
+        printf("  ✓ idx: tables compressed, blobs not: %llu of %llu pages, %.1f -> %.1f MiB\n",
+               (unsigned long long)stats.compressed_pages,
+               (unsigned long long)(stats.page_bytes / 4096),
+               (double)stats.page_bytes / (1024 * 1024), (double)stats.data_bytes / (1024 * 1024));
+        kvstore_close(db);
+
+        for (int direct = 0; direct < 2; direct++) {
+            db = open_store(direct, KVSTORE_CODEC_NONE, true);
+            assert(db);
+            assert(check_all(db, messages_small, blobs) == 0);
+            // Twice: with direct I/O, now from the block cache
+            assert(check_all(db, messages_small, blobs) == 0);
+            if (direct) assert(stats_of(db).cache.hits > messages_small);
+            kvstore_close(db);
+        }
+        printf("  ✓ Gets, asynchronous gets and scans, buffered and direct\n");
+
+        kvstore_file_verify_t report;
+        assert(kvstore_file_verify(dir, 2, &report) == KVSTORE_OK);
+        assert(report.pages == stats.page_bytes / 4096 && report.bytes < stats.page_bytes);
+
+        // A damaged byte in the first page, of "blob", stored as is
+        int fd = open(path_data, O_RDWR);
+        assert(fd >= 0);
+        char saved[2];
+        assert(pread(fd, saved, 1, 100) == 1);
+        assert(pwrite(fd, "\xff", 1, 100) == 1);
+        assert(kvstore_file_verify(dir, 2, &report) == KVSTORE_ERROR);
+        assert(report.bad_pages == 1 && report.first_bad == 0);
+        assert(pwrite(fd, saved, 1, 100) == 1);
+        close(fd);
+        assert(kvstore_file_verify(dir, 1, &report) == KVSTORE_OK);
+
+        // Each checkpoint writes tables with the codec now chosen
+        kvstore_codec_t codecs[2] = { KVSTORE_CODEC_LZ, KVSTORE_CODEC_NONE };
+        for (int c = 0; c < 2; c++) {
+            db = open_store(c == 1, codecs[c], false);
+            assert(db);
+            txn = kvstore_txn_begin(db, false);
+            kvstore_val_t k = { "x", 1 }, v = { "y", 1 };
+            assert(kvstore_txn_put(txn, "other", &k, &v) == KVSTORE_OK);
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+            assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+            stats = stats_of(db);
+            // Of the blobs' pages only the last, part full, saves enough to
+            // be compressed; the rest are stored as they are
+            assert(stats.compressed_pages == (c == 0 ? idx_pages + 2 : 0));
+            assert(check_all(db, messages_small, blobs) == 0);
+            kvstore_close(db);
+        }
+        printf("  ✓ Checkpoints switch codecs: all compressed, then none\n");
+
+        // Verification covers compressed pages: damage one of "idx:uid",
+        // the compressed pages after the blobs' and "idx:date"'s, before
+        // the one page of "other" and the index
+        db = open_store(false, KVSTORE_CODEC_LZ, true);
+        txn = kvstore_txn_begin(db, false);
+        kvstore_val_t k = { "x", 1 }, v = { "z", 1 };
+        assert(kvstore_txn_put(txn, "other", &k, &v) == KVSTORE_OK);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+        stats = stats_of(db);
+        kvstore_close(db);
+        fd = open(path_data, O_RDWR);
+        uint64_t blob_end = (stats.page_bytes / 4096 - stats.compressed_pages - 1) * 4096;
+        off_t mid = (off_t)(blob_end + (stats.data_bytes - blob_end - 32768) * 4 / 5);
+        assert(fd >= 0 && pwrite(fd, "\x5a\xa5\x5a\xa5", 4, mid) == 4);
+        close(fd);
+        assert(kvstore_file_verify(dir, 2, &report) == KVSTORE_ERROR && report.bad_pages >= 1);
+        for (int direct = 0; direct < 2; direct++) {
+            db = open_store(direct, KVSTORE_CODEC_NONE, true);
+            assert(db);
+            uint32_t failed = check_all(db, messages_small, 0);
+            kvstore_file_stats_t s = stats_of(db);
+            assert(failed > 0 && failed < 200 && s.checksum_errors > 0);
+            kvstore_close(db);
+        }
+        printf("  ✓ A damaged compressed page fails its gets and the verify\n");
+        reset();
+    }
+
+    // Benchmark: the message indexes stored as is and compressed
+    printf("\nBenchmark: %u messages (uid and date indexes), %u random lookups\n", messages, lookups);
+    {
+        unsigned char sample[4096];
+        size_t sample_len = 0;
+        for (uint32_t i = 0; sample_len + 50 <= sizeof(sample); i++) {
+            entry_t e;
+            uid_entry(i * 64, &e);
+            memcpy(sample + sample_len, e.key, e.key_len);
+            memcpy(sample + sample_len + e.key_len, e.val, e.val_len);
+            sample_len += e.key_len + e.val_len;
+        }
+        unsigned char comp[8192], out[4096];
+        size_t clen = 0;
+        double start = now_sec();
+        for (int i = 0; i < 20000; i++) clen = kvstore_lz_compress(sample, sample_len, comp, sizeof(comp));
+        double c_ns = (now_sec() - start) * 1e9 / 20000;
+        start = now_sec();
+        for (int i = 0; i < 20000; i++) assert(kvstore_lz_decompress(comp, clen, out, sample_len) == KVSTORE_OK);
+        double d_ns = (now_sec() - start) * 1e9 / 20000;
+        printf("  codec on %zu bytes of uid entries: %zu compressed, %.1f us to compress, %.1f us to decompress\n",
+               sample_len, clen, c_ns / 1000, d_ns / 1000);
+
+        printf("  %-6s %9s %9s %6s %8s %8s | %-9s %7s %7s | %-9s %7s %7s\n", "codec", "pages MiB",
+               "file MiB", "ratio", "write amp", "ckpt s",
+               "buffered", "p50 us", "p99 us", "direct", "p50 us", "p99 us");
+        for (int c = 0; c < 2; c++) {
+            kvstore_codec_t codec = c ? KVSTORE_CODEC_LZ : KVSTORE_CODEC_NONE;
+
+            // Load with a checkpoint every fifth of the messages
+            kvstore_t *db = open_store(false, codec, false);
+            assert(db);
+            size_t logical = 0;
+            double ckpt = 0;
+            for (int part = 0; part < 5; part++) {
+                logical += load(db, messages / 5 * (uint32_t)part,
+                                part == 4 ? messages : messages / 5 * (uint32_t)(part + 1));
+                double t0 = now_sec();
+                assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+                ckpt += now_sec() - t0;
+            }
+            kvstore_file_stats_t stats = stats_of(db);
+            kvstore_close(db);
+            double amp = (double)(stats.log_written + stats.data_written) / (double)logical;
+
+            // Lookups on a fresh open with the file out of the page cache,
+            // then again with its pages cached
+            double p50[2][2], p99[2][2];
+            for (int direct = 0; direct < 2; direct++) {
+                db = open_store(direct, codec, false);
+                assert(db);
+                evict_data();
+                lookups_timed(db, messages, lookups, &p50[direct][0], &p99[direct][0]);
+                lookups_timed(db, messages, lookups, &p50[direct][1], &p99[direct][1]);
+                kvstore_close(db);
+            }
+            printf("  %-6s %9.1f %9.1f %6.2f %8.2f %8.2f | %-9s %7.1f %7.1f | %-9s %7.1f %7.1f\n",
+                   c ? "lz" : "none", (double)stats.page_bytes / (1024 * 1024),
+                   (double)stats.data_bytes / (1024 * 1024),
+                   (double)stats.page_bytes / (double)stats.data_bytes, amp, ckpt,
+                   "cold", p50[0][0], p99[0][0], "cold", p50[1][0], p99[1][0]);
+            printf("  %-6s %9s %9s %6s %8s %8s | %-9s %7.1f %7.1f | %-9s %7.1f %7.1f\n", "", "", "", "",
+                   "", "", "cached", p50[0][1], p99[0][1], "cached", p50[1][1], p99[1][1]);
+            reset();
+        }
+    }
+
+    rmdir(dir);
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
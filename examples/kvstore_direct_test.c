@@ -0,0 +1,410 @@
+// Direct I/O test: the block cache, and the file backend reading its data
+// file with O_DIRECT through it.
+// Checks the cache's CLOCK eviction and buffer pool, that a direct I/O
+// store returns what a memory store does through gets, asynchronous gets
+// and cursors, across checkpoints and reopening, that it leaves nothing of
+// the data file in the page cache, and that pages lookups keep coming back
+// to stay cached while scans pass through. Benchmarks skewed lookups over
+// datasets of 2, 5 and 10 times a memory budget, alone and beside a
+// repeated scan, buffered and with direct I/O and a cache of the budget.
+// For the buffered runs to be held to the budget too, set
+// KVSTORE_BENCH_CGROUP to a memory cgroup directory limited to it (plus
+// some 12 MiB for the rest of the process): each run joins it.
+// Usage: kvstore_direct_test [budget_mib] [lookups]
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE         // mincore(), in the fixture
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_cache.h"
+#include "../include/kvstore_file.h"
+#include "../include/kvstore_mem.h"
+#include "kvstore_file_fixture.h"
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static kvstore_t* open_store(bool direct, size_t cache_bytes) {
+    kvstore_file_opts_t opts = KVSTORE_FILE_OPTS_INIT;
+    opts.direct_io = direct;
+    opts.cache_bytes = cache_bytes;
+    kvstore_t *db = kvstore_open_file(dir, &opts);
+    assert(db);
+    return db;
+}
+
+// Every key 0..range gets the same answer from both stores, one by one and
+// in batches of asynchronous gets
+static void compare_gets(kvstore_t *db, kvstore_t *mem, uint32_t range) {
+    kvstore_txn_t *ta = kvstore_txn_begin(db, true);
+    kvstore_txn_t *tb = kvstore_txn_begin(mem, true);
+    for (uint32_t i = 0; i < range; i += 64) {
+        char ks[64][16];
+        kvstore_val_t keys[64], vals[64], want;
+        int rcs[64];
+        size_t n = range - i < 64 ? range - i : 64;
+        for (size_t j = 0; j < n; j++) {
+            make_key(ks[j], i + (uint32_t)j);
+            keys[j] = (kvstore_val_t){ ks[j], strlen(ks[j]) };
+        }
+        assert(kvstore_txn_get_many(ta, "kv", n, keys, vals, rcs) == KVSTORE_OK);
+        for (size_t j = 0; j < n; j++) {
+            kvstore_val_t got;
+            int rc = kvstore_txn_get(tb, "kv", &keys[j], &want);
+            assert(rcs[j] == rc && kvstore_txn_get(ta, "kv", &keys[j], &got) == rc);
+            if (rc == KVSTORE_OK) {
+                assert(vals[j].size == want.size && memcmp(vals[j].data, want.data, want.size) == 0);
+                assert(got.size == want.size && memcmp(got.data, want.data, want.size) == 0);
+            }
+        }
+    }
+    kvstore_txn_commit(ta);
+    kvstore_txn_commit(tb);
+}
+
+// Keys a cursor over [lo, hi) returns (hi UINT32_MAX = unbounded)
+static size_t scan(kvstore_t *db, uint32_t lo, uint32_t hi) {
+    char lk[16], hk[16];
+    make_key(lk, lo);
+    make_key(hk, hi);
+    kvstore_val_t start = { lk, strlen(lk) }, end = { hk, strlen(hk) };
+
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "kv", &start);
+    assert(cur);
+    if (hi != UINT32_MAX) assert(kvstore_cursor_set_end(cur, &end) == KVSTORE_OK);
+    size_t n = 0;
+    kvstore_val_t k;
+    while (kvstore_cursor_get(cur, &k, NULL) == KVSTORE_OK) {
+        n++;
+        kvstore_cursor_next(cur);
+    }
+    kvstore_cursor_close(cur);
+    kvstore_txn_commit(txn);
+    return n;
+}
+
+static void lookup(kvstore_t *db, uint32_t id) {
+    char k[16];
+    make_key(k, id);
+    kvstore_val_t key = { k, strlen(k) }, val;
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    assert(kvstore_txn_get(txn, "kv", &key, &val) == KVSTORE_OK);
+    kvstore_txn_commit(txn);
+}
+
+// ------------------------
+// Benchmark
+// ------------------------
+
+typedef struct {
+    kvstore_t *db;
+    uint32_t records;
+    atomic_bool stop;
+    size_t scans;
+} scanner_t;
+
+// Scan the dataset end to end until told to stop, pausing 1 ms every 256
+// keys (some 60 MB/s), as a background job would be paced
+static void* scanner(void *arg) {
+    scanner_t *s = (scanner_t*)arg;
+    struct timespec pause = { 0, 1000000 };
+    while (!atomic_load(&s->stop)) {
+        kvstore_txn_t *txn = kvstore_txn_begin(s->db, true);
+        kvstore_cursor_t *cur = kvstore_cursor_open(txn, "kv", NULL);
+        assert(cur);
+        char hk[16];
+        make_key(hk, s->records);
+        kvstore_val_t end = { hk, strlen(hk) }, k;
+        assert(kvstore_cursor_set_end(cur, &end) == KVSTORE_OK);
+        for (size_t n = 1; !atomic_load(&s->stop) &&
+                           kvstore_cursor_get(cur, &k, NULL) == KVSTORE_OK; n++) {
+            kvstore_cursor_next(cur);
+            if (n % 256 == 0) nanosleep(&pause, NULL);
+        }
+        kvstore_cursor_close(cur);
+        kvstore_txn_commit(txn);
+        s->scans++;
+    }
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Join the memory cgroup named by KVSTORE_BENCH_CGROUP, if any
+static void join_cgroup(void) {
+    const char *cg = getenv("KVSTORE_BENCH_CGROUP");
+    if (!cg || !*cg) return;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", cg);
+    FILE *f = fopen(path, "w");
+    assert(f);
+    fprintf(f, "%d\n", (int)getpid());
+    fclose(f);
+}
+
+// True in a child process, which exits when done; the parent waits for it.
+// The heap the parent has freed is first handed back, or the child's
+// mallocs would copy its pages, and the cgroup charge them.
+static bool forked(void) {
+    malloc_trim(0);
+    fflush(stdout);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) return true;
+    int status;
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return false;
+}
+
+// Lookups over keys 0..records, 90% of them to the first hot keys, after a
+// warm-up of as many; a process of its own, so each run starts cold
+static void bench_run(const char *label, bool direct, size_t budget, uint32_t records,
+                      uint32_t hot, uint32_t lookups, bool scanning) {
+    if (!forked()) return;
+    join_cgroup();
+    evict_data();
+    kvstore_t *db = open_store(direct, budget);
+    rng = 0x9e3779b97f4a7c15ull;
+    for (uint32_t i = 0; i < lookups; i++) {
+        lookup(db, next_rand() % 10 < 9 ? (uint32_t)(next_rand() % hot)
+                                        : (uint32_t)(next_rand() % records));
+    }
+
+    scanner_t s = { .db = db, .records = records, .scans = 0 };
+    atomic_init(&s.stop, false);
+    pthread_t thread;
+    if (scanning) assert(pthread_create(&thread, NULL, scanner, &s) == 0);
+
+    double *lat = (double*)malloc(lookups * sizeof(double));
+    assert(lat);
+    uint64_t before = stats_of(db).page_reads;
+    double start = now_sec();
+    for (uint32_t i = 0; i < lookups; i++) {
+        uint32_t id = next_rand() % 10 < 9 ? (uint32_t)(next_rand() % hot)
+                                           : (uint32_t)(next_rand() % records);
+        double t = now_sec();
+        lookup(db, id);
+        lat[i] = (now_sec() - t) * 1e6;
+    }
+    double elapsed = now_sec() - start;
+    kvstore_file_stats_t stats = stats_of(db);
+    if (scanning) {
+        atomic_store(&s.stop, true);
+        pthread_join(thread, NULL);
+    }
+
+    qsort(lat, lookups, sizeof(double), cmp_double);
+    printf("  %-26s %9.0f %8.1f %8.1f %8.1f %8.0f %9llu %6zu\n", label,
+           (double)lookups / elapsed, lat[lookups / 2], lat[(size_t)lookups * 99 / 100],
+           lat[(size_t)lookups * 999 / 1000], lat[lookups - 1],
+           (unsigned long long)(stats.page_reads - before), s.scans);
+    free(lat);
+    kvstore_close(db);
+    exit(0);
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    size_t budget_mib = argc > 1 ? strtoul(argv[1], NULL, 10) : 8;
+    uint32_t lookups = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 50000;
+
+    printf("=== KVStore Direct I/O Test ===\n\n");
+    fixture_init("direct");
+
+    // TEST 1: CLOCK eviction, hot and cold blocks, and the buffer pool
+    printf("Test 1: Block cache...\n");
+    {
+        kvstore_cache_t *c = kvstore_cache_new(16 * 4096, 4096);
+        assert(c && kvstore_cache_block_size(c) == 4096);
+        char block[4096], out[4096];
+        for (uint64_t id = 0; id < 16; id++) {
+            memset(block, (int)id, sizeof(block));
+            kvstore_cache_put(c, id, block, id + 100, id < 8);
+        }
+        for (uint64_t id = 0; id < 16; id++) {
+            assert(kvstore_cache_get(c, id, out, sizeof(out), false) == id + 100);
+            assert(out[0] == (char)id && out[id + 99] == (char)id);
+        }
+        assert(kvstore_cache_get(c, 99, out, sizeof(out), true) == 0);
+        assert(kvstore_cache_get(c, 15, out, 10, true) == 0);
+
+        // New blocks take the places of the cold ones first
+        for (uint64_t id = 16; id < 24; id++) kvstore_cache_put(c, id, block, 4096, false);
+        for (uint64_t id = 0; id < 24; id++) assert(kvstore_cache_contains(c, id) == (id < 8 || id >= 16));
+
+        // Blocks that don't fit aren't cached
+        char big[8192] = { 0 };
+        kvstore_cache_put(c, 100, big, sizeof(big), true);
+        assert(!kvstore_cache_contains(c, 100));
+
+        kvstore_cache_stats_t stats;
+        kvstore_cache_stats(c, &stats);
+        assert(stats.hits == 16 && stats.misses == 2 && stats.inserts == 24 &&
+               stats.evictions == 8 && stats.blocks == 16 && stats.capacity == 16);
+        kvstore_cache_clear(c);
+        for (uint64_t id = 0; id < 24; id++) assert(!kvstore_cache_contains(c, id));
+        kvstore_cache_stats(c, &stats);
+        assert(stats.blocks == 0);
+
+        // Lent buffers are aligned, whatever their size
+        void *bufs[300];
+        for (int i = 0; i < 300; i++) {
+            size_t len = i % 10 == 0 ? 3 * 4096 : 4096;
+            bufs[i] = kvstore_cache_buf_get(c, len);
+            assert(bufs[i] && (uintptr_t)bufs[i] % 4096 == 0);
+            memset(bufs[i], 1, len);
+        }
+        for (int i = 0; i < 300; i++) kvstore_cache_buf_put(c, bufs[i], i % 10 == 0 ? 3 * 4096 : 4096);
+        kvstore_cache_free(c);
+
+        // A large cache splits into shards, and still holds what it can
+        c = kvstore_cache_new(1024 * 4096, 4096);
+        assert(c);
+        for (uint64_t id = 0; id < 4096; id++) kvstore_cache_put(c, id * 7919, block, 4096, false);
+        kvstore_cache_stats(c, &stats);
+        assert(stats.capacity == 1024 && stats.blocks == 1024 && stats.evictions == 3072);
+        kvstore_cache_free(c);
+        printf("  ✓ Cold blocks go first, oversized ones are refused, buffers are aligned\n");
+    }
+
+    // TEST 2: A direct I/O store agrees with the memory backend, across
+    // checkpoints and reopening
+    printf("\nTest 2: Direct I/O reads...\n");
+    {
+        kvstore_t *db = open_store(true, 256 * 1024);
+        kvstore_t *mem = kvstore_open_mem();
+        churn(db, mem, 60000, 80000);
+        assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+        churn(db, mem, 60000, 8000);
+        compare_gets(db, mem, 60000);
+
+        size_t total = 0;
+        for (int i = 0; i < 40; i++) {
+            uint32_t lo = (uint32_t)(next_rand() % 60000);
+            uint32_t hi = lo + (uint32_t)(next_rand() % (i < 30 ? 500 : 30000));
+            total += compare_range(db, mem, lo, hi);
+        }
+
+        // The cache is dropped with the data file it caches
+        assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+        kvstore_file_stats_t stats = stats_of(db);
+        assert(stats.direct_io && stats.cache.blocks == 0 && stats.cache.capacity == 64);
+        churn(db, mem, 60000, 8000);
+        compare_gets(db, mem, 60000);
+        total += compare_range(db, mem, 0, 60000);
+        kvstore_close(db);
+
+        db = open_store(true, 256 * 1024);
+        compare_gets(db, mem, 60000);
+        total += compare_range(db, mem, 0, 60000);
+        stats = stats_of(db);
+        assert(stats.cache.inserts > 0 && stats.cache.hits > 0 && stats.readahead_pages > 0);
+        assert(stats.cache.blocks <= stats.cache.capacity);
+        assert(cached_pages() == 0);
+
+        // Buffered, the same file reads back the same
+        kvstore_close(db);
+        db = open_store(false, 0);
+        stats = stats_of(db);
+        assert(!stats.direct_io && stats.cache.capacity == 0);
+        compare_gets(db, mem, 60000);
+        kvstore_close(db);
+        kvstore_close(mem);
+        reset();
+        printf("  ✓ Gets, asynchronous gets and %zu keys of cursors match, none left in the page cache\n",
+               total);
+    }
+
+    // TEST 3: Pages lookups come back to stay cached while scans pass
+    // through a data file several times the cache
+    printf("\nTest 3: Scans beside lookups...\n");
+    {
+        kvstore_t *db = open_store(true, 1024 * 1024);
+        fill(db, 100000, 200);
+        kvstore_close(db);
+        db = open_store(true, 1024 * 1024);
+
+        for (uint32_t id = 0; id < 64; id++) lookup(db, id * 97);
+        uint64_t reads = 0;
+        for (uint32_t lo = 0; lo < 100000; lo += 500) {
+            scan(db, lo, lo + 500);
+            uint64_t before = stats_of(db).page_reads;
+            for (uint32_t id = 0; id < 64; id++) lookup(db, id * 97);
+            reads += stats_of(db).page_reads - before;
+        }
+        kvstore_file_stats_t stats = stats_of(db);
+        assert(reads == 0 && stats.cache.evictions > 0);
+
+        // Cursors closed with reads ahead in flight
+        for (int i = 0; i < 20; i++) {
+            kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+            kvstore_cursor_t *cur = kvstore_cursor_open(txn, "kv", NULL);
+            for (int n = 0; n < 400 + i * 97; n++) kvstore_cursor_next(cur);
+            kvstore_cursor_close(cur);
+            kvstore_txn_abort(txn);
+        }
+        assert(scan(db, 0, UINT32_MAX) == 100000);
+        kvstore_close(db);
+        reset();
+        printf("  ✓ 200 scans over %.1f MiB through a 1 MiB cache, no lookup reread a page\n",
+               (double)stats.data_bytes / (1024 * 1024));
+    }
+
+    // Benchmark: skewed lookups over datasets of 2-10x the budget
+    size_t budget = budget_mib * 1024 * 1024;
+    const char *cg = getenv("KVSTORE_BENCH_CGROUP");
+    printf("\nBenchmark: %zu MiB budget, %u lookups, 90%% to a hot set of budget/4\n",
+           budget_mib, lookups);
+    printf("  buffered runs %s\n", cg && *cg ? "held to the budget by the memory cgroup"
+                                            : "NOT held to the budget (no KVSTORE_BENCH_CGROUP)");
+    {
+        // Records of some 240 bytes on disk; datasets are prefixes of one file
+        uint32_t per_mib = 1024 * 1024 / 240;
+        uint32_t total = (uint32_t)(10 * budget_mib * per_mib);
+        if (forked()) {
+            kvstore_t *db = open_store(false, 0);
+            fill(db, total, 200);
+            kvstore_close(db);
+            exit(0);
+        }
+
+        printf("  %-26s %9s %8s %8s %8s %8s %9s %6s\n", "run", "ops/s", "p50 us", "p99 us",
+               "p99.9 us", "max us", "pages", "scans");
+        int sizes[] = { 2, 5, 10 };
+        for (int si = 0; si < 3; si++) {
+            uint32_t records = (uint32_t)(sizes[si] * budget_mib * per_mib);
+            uint32_t hot = (uint32_t)(budget_mib * per_mib / 4);
+            for (int scanning = 0; scanning < 2; scanning++) {
+                for (int direct = 0; direct < 2; direct++) {
+                    char label[48];
+                    snprintf(label, sizeof(label), "%dx, %s%s", sizes[si],
+                             direct ? "direct" : "buffered", scanning ? " + scan" : "");
+                    bench_run(label, direct, budget, records, hot, lookups, scanning);
+                }
+            }
+        }
+        reset();
+    }
+
+    rmdir(dir);
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
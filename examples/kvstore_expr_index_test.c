@@ -0,0 +1,340 @@
+// Expression index test: secondary keys computed by an extractor function
+// (lowercased email, truncated name, day bucket of a timestamp).
+// Compares value size and ingest against storing a lowercase copy.
+// Usage: kvstore_expr_index_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record with expression indexes
+// ------------------------
+
+struct user_record {
+    uint64_t user_id;
+    char *username;
+    char *email;
+    struct timespec created;
+};
+
+SERIALISE(user_record,
+    SERIALISE_FIELD(user_id, uint64_t),
+    SERIALISE_FIELD(username, charptr),
+    SERIALISE_FIELD(email, charptr),
+    SERIALISE_FIELD(created, timespec)
+)
+
+SERIALISE_DECLARE_KEYS(user_record)
+
+SERIALISE_PRIMARY_KEY(user_record, "user:",
+    SERIALISE_FIELD(user_id, uint64_t)
+)
+
+// Case-insensitive email
+SERIALISE_SECONDARY_KEY_EXPR(user_record, "user_email_ci:", by_email_ci, email_lower,
+    SERIALISE_FIELD(email, charptr)
+)
+
+// First three letters of the username, lowercased, then the day it joined
+SERIALISE_SECONDARY_KEY_EXPR(user_record, "user_name3_day:", by_name3_day, name3_day,
+    SERIALISE_FIELD(name3, charptr),
+    SERIALISE_FIELD(day, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(user_record,
+    by_email_ci, "user_email_ci:",
+    by_name3_day, "user_name3_day:"
+)
+
+static char* lower_dup(const char *s, size_t max) {
+    size_t n = s ? strlen(s) : 0;
+    if (n > max) n = max;
+    char *out = (char*)malloc(n + 1);
+    for (size_t i = 0; i < n; i++) out[i] = (char)tolower((unsigned char)s[i]);
+    out[n] = '\0';
+    return out;
+}
+
+static inline void email_lower(struct user_record *rec,
+                               struct user_record_by_email_ci_key *key) {
+    key->email = lower_dup(rec->email, SIZE_MAX);
+}
+
+static inline void name3_day(struct user_record *rec,
+                             struct user_record_by_name3_day_key *key) {
+    key->name3 = lower_dup(rec->username, 3);
+    key->day = (uint32_t)(rec->created.tv_sec / 86400);
+}
+
+// ------------------------
+// Baseline: lowercase copy stored in the record
+// ------------------------
+
+struct stored_user_record {
+    uint64_t user_id;
+    char *username;
+    char *email;
+    char *email_lower;
+    struct timespec created;
+};
+
+SERIALISE(stored_user_record,
+    SERIALISE_FIELD(user_id, uint64_t),
+    SERIALISE_FIELD(username, charptr),
+    SERIALISE_FIELD(email, charptr),
+    SERIALISE_FIELD(email_lower, charptr),
+    SERIALISE_FIELD(created, timespec)
+)
+
+SERIALISE_DECLARE_KEYS(stored_user_record)
+
+SERIALISE_PRIMARY_KEY(stored_user_record, "suser:",
+    SERIALISE_FIELD(user_id, uint64_t)
+)
+
+SERIALISE_SECONDARY_KEY(stored_user_record, "suser_email:", by_email_lower,
+    SERIALISE_FIELD(email_lower, charptr)
+)
+
+SERIALISE_FINALIZE_INDICES(stored_user_record,
+    by_email_lower, "suser_email:"
+)
+
+// Same record and email index as stored_user_record, but computed
+struct ci_user_record {
+    uint64_t user_id;
+    char *username;
+    char *email;
+    struct timespec created;
+};
+
+SERIALISE(ci_user_record,
+    SERIALISE_FIELD(user_id, uint64_t),
+    SERIALISE_FIELD(username, charptr),
+    SERIALISE_FIELD(email, charptr),
+    SERIALISE_FIELD(created, timespec)
+)
+
+SERIALISE_DECLARE_KEYS(ci_user_record)
+
+SERIALISE_PRIMARY_KEY(ci_user_record, "ciuser:",
+    SERIALISE_FIELD(user_id, uint64_t)
+)
+
+SERIALISE_SECONDARY_KEY_EXPR(ci_user_record, "ciuser_email:", by_email_ci, ci_email_lower,
+    SERIALISE_FIELD(email, charptr)
+)
+
+SERIALISE_FINALIZE_INDICES(ci_user_record,
+    by_email_ci, "ciuser_email:"
+)
+
+static inline void ci_email_lower(struct ci_user_record *rec,
+                                  struct ci_user_record_by_email_ci_key *key) {
+    key->email = lower_dup(rec->email, SIZE_MAX);
+}
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static void free_user(struct user_record *u) {
+    free(u->username);
+    free(u->email);
+}
+
+// Lookup keys come from the same extractor as the index
+static int find_by_email(kvstore_txn_t *txn, const char *email, uint64_t *id_out) {
+    struct user_record probe = { .email = (char*)email };
+    struct user_record_by_email_ci_key key;
+    user_record_extract_by_email_ci(&probe, &key);
+
+    struct user_record_pk pk;
+    int rc = kvstore_lookup_user_record_by_email_ci(txn, &key, &pk);
+    user_record_by_email_ci_key_release(&key);
+
+    if (rc == KVSTORE_OK) *id_out = pk.user_id;
+    return rc;
+}
+
+static size_t count_prefix(kvstore_txn_t *txn, const char *prefix) {
+    size_t prefix_len = strlen(prefix);
+    kvstore_val_t start = { (void*)prefix, prefix_len };
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+    kvstore_val_t k, v;
+    size_t n = 0;
+    while (kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK) {
+        if (k.size < prefix_len || memcmp(k.data, prefix, prefix_len) != 0) break;
+        n++;
+        kvstore_cursor_next(cur);
+    }
+    kvstore_cursor_close(cur);
+    return n;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+
+    printf("=== Expression Index Test ===\n\n");
+
+    kvstore_t *db = kvstore_open_mem();
+    assert(db != NULL);
+
+    // TEST 1: Case-insensitive lookup without a stored lowercase copy
+    printf("Test 1: Case-insensitive email lookup...\n");
+    {
+        struct user_record users[] = {
+            { 1, "Alice", "Alice@Example.COM", { 1700000000, 0 } },
+            { 2, "alfred", "alfred@example.com", { 1700000000 + 3600, 0 } },
+            { 3, "Bob", "BOB@example.com", { 1700086400, 0 } },
+        };
+
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        for (int i = 0; i < 3; i++) {
+            assert(kvstore_put_user_record_with_all_indices(txn, &users[i], NULL) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        txn = kvstore_txn_begin(db, true);
+        uint64_t id = 0;
+        assert(find_by_email(txn, "alice@example.com", &id) == KVSTORE_OK && id == 1);
+        assert(find_by_email(txn, "ALICE@EXAMPLE.COM", &id) == KVSTORE_OK && id == 1);
+        assert(find_by_email(txn, "bob@EXAMPLE.com", &id) == KVSTORE_OK && id == 3);
+        assert(find_by_email(txn, "carol@example.com", &id) == KVSTORE_NOTFOUND);
+
+        // The record keeps the email exactly as given
+        struct user_record_pk pk = { .user_id = 1 };
+        struct user_record got = {0};
+        assert(kvstore_get_user_record(txn, &pk, &got, NULL) == KVSTORE_OK);
+        assert(strcmp(got.email, "Alice@Example.COM") == 0);
+        free_user(&got);
+        kvstore_txn_commit(txn);
+        printf("  ✓ Mixed-case queries find the record, value stores original email\n");
+    }
+
+    // TEST 2: Multi-field computed key (truncated + bucketed)
+    printf("\nTest 2: Truncated name and day bucket...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+        struct user_record_by_name3_day_key start = { .name3 = "ali", .day = 0 };
+        kvstore_cursor_t *cur = kvstore_cursor_user_record_by_name3_day(txn, &start);
+
+        // "Alice" -> "ali", "alfred" -> "alf"
+        kvstore_val_t k, v;
+        assert(kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK);
+        struct user_record_pk pk;
+        deserialise_user_record_pk((char*)v.data, &pk);
+        assert(pk.user_id == 1);
+        kvstore_cursor_close(cur);
+
+        struct user_record_by_name3_day_key key = { .name3 = "alf", .day = 1700000000 / 86400 };
+        assert(kvstore_lookup_user_record_by_name3_day(txn, &key, &pk) == KVSTORE_OK);
+        assert(pk.user_id == 2);
+        key.day++;
+        assert(kvstore_lookup_user_record_by_name3_day(txn, &key, &pk) == KVSTORE_NOTFOUND);
+        kvstore_txn_commit(txn);
+        printf("  ✓ Derived fields index without being stored\n");
+    }
+
+    // TEST 3: Updates compare computed keys
+    printf("\nTest 3: Update maintenance on computed keys...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        struct user_record_pk pk = { .user_id = 3 };
+        struct user_record u = {0};
+        kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+        assert(kvstore_get_user_record(txn, &pk, &u, &kb) == KVSTORE_OK);
+
+        // Case-only change keeps the same key
+        free(u.email);
+        u.email = strdup("Bob@Example.Com");
+        assert(kvstore_put_user_record_with_all_indices(txn, &u, &kb) == KVSTORE_OK);
+        assert(count_prefix(txn, "user_email_ci:") == 3);
+
+        // Real change moves the entry; a later time on the same day keeps it
+        assert(populate_key_buf_user_record(&u, &kb) == KVSTORE_OK);
+        free(u.email);
+        u.email = strdup("Robert@Example.com");
+        u.created.tv_sec += 60;
+        assert(kvstore_put_user_record_with_all_indices(txn, &u, &kb) == KVSTORE_OK);
+
+        uint64_t id = 0;
+        assert(find_by_email(txn, "bob@example.com", &id) == KVSTORE_NOTFOUND);
+        assert(find_by_email(txn, "robert@example.com", &id) == KVSTORE_OK && id == 3);
+        assert(count_prefix(txn, "user_email_ci:") == 3);
+        assert(count_prefix(txn, "user_name3_day:") == 3);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        free_user(&u);
+        kvstore_key_buf_free(&kb);
+        printf("  ✓ Case-only edits are no-ops, real edits replace the entry\n");
+    }
+
+    kvstore_close(db);
+
+    // Benchmark: expression index vs stored lowercase copy
+    printf("\nBenchmark: %u users, case-insensitive email index\n", records);
+    {
+        char name[32], email[64], lower[64];
+        size_t bytes[2] = {0};
+        double sec[2];
+
+        for (int mode = 0; mode < 2; mode++) {
+            db = kvstore_open_mem();
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+            kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+            for (uint32_t i = 0; i < records; i++) {
+                snprintf(name, sizeof(name), "User%u", i);
+                snprintf(email, sizeof(email), "User.Number%u@Example.COM", i);
+                struct timespec created = { 1700000000 + i, 0 };
+
+                if (mode == 0) {
+                    for (size_t j = 0; j <= strlen(email); j++) {
+                        lower[j] = (char)tolower((unsigned char)email[j]);
+                    }
+                    struct stored_user_record u = { i, name, email, lower, created };
+                    bytes[mode] += serialise_stored_user_record_size(&u);
+                    assert(kvstore_put_stored_user_record_with_all_indices(txn, &u, NULL) == KVSTORE_OK);
+                } else {
+                    struct ci_user_record u = { i, name, email, created };
+                    bytes[mode] += serialise_ci_user_record_size(&u);
+                    assert(kvstore_put_ci_user_record_with_all_indices(txn, &u, NULL) == KVSTORE_OK);
+                }
+            }
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+            sec[mode] = elapsed_sec(&start);
+            kvstore_close(db);
+        }
+
+        printf("  stored copy : %5.1f bytes/value, %8.0f records/s\n",
+               (double)bytes[0] / records, records / sec[0]);
+        printf("  expression  : %5.1f bytes/value, %8.0f records/s\n",
+               (double)bytes[1] / records, records / sec[1]);
+        printf("  Values %.0f%% smaller\n", 100.0 * (1.0 - (double)bytes[1] / bytes[0]));
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
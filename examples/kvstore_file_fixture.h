@@ -0,0 +1,197 @@
+// Shared fixture for the file backend's tests
+// A store directory under /tmp and the paths of its log and data file, the
+// random numbers and keys the tests write, and helpers that fill, change
+// and compare stores or act on the data file behind the library's back.
+// Each test opens its stores itself, with its own options. Include after
+// defining _POSIX_C_SOURCE and _DEFAULT_SOURCE (for mincore()).
+
+#ifndef KVSTORE_FILE_FIXTURE_H_
+#define KVSTORE_FILE_FIXTURE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_file.h"
+
+// ------------------------
+// Store directory
+// ------------------------
+
+static char dir[64];
+static char path_wal[80], path_data[80];
+
+// Make the test's store directory, /tmp/kvstore_<name>_XXXXXX
+static inline void fixture_init(const char *name) {
+    snprintf(dir, sizeof(dir), "/tmp/kvstore_%s_XXXXXX", name);
+    assert(mkdtemp(dir));
+    snprintf(path_wal, sizeof(path_wal), "%s/wal", dir);
+    snprintf(path_data, sizeof(path_data), "%s/data", dir);
+}
+
+static inline void reset(void) {
+    unlink(path_wal);
+    unlink(path_data);
+}
+
+// Drop the data file from the page cache, as if it were bigger than RAM
+static inline void evict_data(void) {
+    int fd = open(path_data, O_RDONLY);
+    assert(fd >= 0);
+    assert(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+    close(fd);
+}
+
+// Pages of the data file in the page cache
+static inline size_t cached_pages(void) {
+    int fd = open(path_data, O_RDONLY);
+    struct stat st;
+    assert(fd >= 0 && fstat(fd, &st) == 0);
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    assert(map != MAP_FAILED);
+    size_t pagesz = (size_t)sysconf(_SC_PAGESIZE);
+    size_t n = ((size_t)st.st_size + pagesz - 1) / pagesz, cached = 0;
+    unsigned char *vec = (unsigned char*)malloc(n);
+    assert(vec && mincore(map, (size_t)st.st_size, vec) == 0);
+    for (size_t i = 0; i < n; i++) cached += vec[i] & 1;
+    free(vec);
+    munmap(map, (size_t)st.st_size);
+    close(fd);
+    return cached * (pagesz / 4096);
+}
+
+static inline void copy_file(const char *from, const char *to) {
+    int in = open(from, O_RDONLY), out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(in >= 0 && out >= 0);
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(in, buf, sizeof(buf))) > 0) assert(write(out, buf, (size_t)n) == n);
+    close(in);
+    close(out);
+}
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static inline double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng = 88172645463325252ull;
+
+static inline uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static inline void make_key(char *buf, uint32_t i) {
+    snprintf(buf, 16, "k%08u", i);
+}
+
+static inline kvstore_file_stats_t stats_of(kvstore_t *db) {
+    kvstore_file_stats_t stats;
+    assert(kvstore_file_stats(db, &stats) == KVSTORE_OK);
+    return stats;
+}
+
+static inline int count_part(size_t part, kvstore_val_t *key, kvstore_val_t *val, void *arg) {
+    (void)key; (void)val;
+    __atomic_fetch_add(&((size_t*)arg)[part], 1, __ATOMIC_RELAXED);
+    return KVSTORE_OK;
+}
+
+// ------------------------
+// Table "kv"
+// ------------------------
+
+// Puts of keys 0..n with values of vlen bytes, checkpointed to the data file
+static inline void fill(kvstore_t *db, uint32_t n, size_t vlen) {
+    char *v = (char*)malloc(vlen);
+    assert(v);
+    memset(v, 'x', vlen);
+    for (uint32_t done = 0; done < n; ) {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        assert(kvstore_txn_set_durability(txn, KVSTORE_DURABLE_NONE) == KVSTORE_OK);
+        for (uint32_t i = 0; i < 50000 && done < n; i++, done++) {
+            char k[16];
+            make_key(k, done);
+            kvstore_val_t key = { k, strlen(k) }, val = { v, vlen };
+            assert(kvstore_txn_put(txn, "kv", &key, &val) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+    }
+    assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+    free(v);
+}
+
+// Random puts and deletes on keys 0..range, applied to both stores
+static inline void churn(kvstore_t *a, kvstore_t *b, uint32_t range, uint32_t ops) {
+    kvstore_t *dbs[2] = { a, b };
+    uint64_t seed = rng;
+    for (int d = 0; d < 2; d++) {
+        rng = seed;
+        kvstore_txn_t *txn = kvstore_txn_begin(dbs[d], false);
+        for (uint32_t i = 0; i < ops; i++) {
+            char k[16], v[64];
+            uint32_t id = (uint32_t)(next_rand() % range);
+            make_key(k, id);
+            kvstore_val_t key = { k, strlen(k) };
+            if (next_rand() % 3 == 0) {
+                kvstore_txn_del(txn, "kv", &key);
+            } else {
+                int n = snprintf(v, sizeof(v), "value %u %llu", id,
+                                 (unsigned long long)(next_rand() % 1000));
+                kvstore_val_t val = { v, (size_t)n };
+                assert(kvstore_txn_put(txn, "kv", &key, &val) == KVSTORE_OK);
+            }
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+    }
+}
+
+// Both stores return the same keys and values over [lo, hi)
+static inline size_t compare_range(kvstore_t *a, kvstore_t *b, uint32_t lo, uint32_t hi) {
+    char lk[16], hk[16];
+    make_key(lk, lo);
+    make_key(hk, hi);
+    kvstore_val_t start = { lk, strlen(lk) }, end = { hk, strlen(hk) };
+
+    kvstore_txn_t *ta = kvstore_txn_begin(a, true);
+    kvstore_txn_t *tb = kvstore_txn_begin(b, true);
+    kvstore_cursor_t *ca = kvstore_cursor_open(ta, "kv", &start);
+    kvstore_cursor_t *cb = kvstore_cursor_open(tb, "kv", &start);
+    assert(ca && cb);
+    assert(kvstore_cursor_set_end(ca, &end) == KVSTORE_OK);
+    assert(kvstore_cursor_set_end(cb, &end) == KVSTORE_OK);
+
+    size_t n = 0;
+    kvstore_val_t ak, av, bk, bv;
+    while (kvstore_cursor_get(cb, &bk, &bv) == KVSTORE_OK) {
+        assert(kvstore_cursor_get(ca, &ak, &av) == KVSTORE_OK);
+        assert(ak.size == bk.size && memcmp(ak.data, bk.data, bk.size) == 0);
+        assert(av.size == bv.size && memcmp(av.data, bv.data, bv.size) == 0);
+        assert(memcmp(bk.data, hk, strlen(hk)) < 0);
+        kvstore_cursor_next(ca);
+        kvstore_cursor_next(cb);
+        n++;
+    }
+    assert(kvstore_cursor_get(ca, &ak, NULL) == KVSTORE_NOTFOUND);
+    kvstore_cursor_close(ca);
+    kvstore_cursor_close(cb);
+    kvstore_txn_commit(ta);
+    kvstore_txn_commit(tb);
+    return n;
+}
+
+#endif // KVSTORE_FILE_FIXTURE_H_
@@ -0,0 +1,364 @@
+// Full-text index test: tokenized subject terms in posting lists, searched
+// with AND and prefix queries and checked against a linear match over a
+// model of the records. Benchmarks search against scanning every record.
+// Usage: kvstore_fulltext_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record definitions
+// ------------------------
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    char *from;
+    char *subject;
+};
+
+SERIALISE(message_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(from, charptr),
+    SERIALISE_FIELD(subject, charptr)
+)
+
+SERIALISE_DECLARE_KEYS(message_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_TEXT_KEY(message_record, "msg_subj:", by_subject_term, subject)
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_subject_term, "msg_subj:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static const char *words[] = {
+    "meeting", "update", "invoice", "report", "team", "weekly", "review", "project",
+    "payment", "reminder", "schedule", "budget", "lunch", "friday", "monday", "order",
+    "shipping", "delivered", "password", "reset", "account", "security", "alert", "digest",
+    "conference", "travel", "flight", "hotel", "booking", "receipt", "contract", "draft",
+    "proposal", "feedback", "survey", "launch", "release", "notes", "bug", "fix",
+    "deploy", "server", "outage", "holiday", "party", "birthday", "welcome", "onboarding",
+    "training", "webinar", "invitation", "agenda", "minutes", "call", "followup", "question",
+    "support", "ticket", "renewal", "discount", "offer", "quarterly", "payroll", "paypal",
+};
+#define NWORDS 64
+
+static uint32_t rng_state = 12345;
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// A few words, skewed towards the start of the list, sometimes with a
+// reply marker, capitals or a ticket number (so the vocabulary keeps growing)
+static void make_subject(char *buf, size_t size) {
+    size_t len = 0;
+    uint32_t r = rng();
+    if (r % 4 == 0) len += (size_t)snprintf(buf + len, size - len, "Re: ");
+    int nwords = 2 + (int)(r >> 8) % 5;
+    for (int i = 0; i < nwords && len < size; i++) {
+        uint32_t w = (rng() % NWORDS) * (rng() % NWORDS) / NWORDS;
+        const char *word = words[w];
+        if ((r >> (12 + i)) & 1) {
+            len += (size_t)snprintf(buf + len, size - len, "%s%c%s", i ? " " : "",
+                                    word[0] - 'a' + 'A', word + 1);
+        } else {
+            len += (size_t)snprintf(buf + len, size - len, "%s%s", i ? " " : "", word);
+        }
+    }
+    if (r % 3 == 0 && len < size) {
+        snprintf(buf + len, size - len, " #%u", rng() % 5000);
+    }
+}
+
+// Linear match: every query term is a term of the subject (or prefixes one)
+static bool text_matches(const char *subject, const char *query) {
+    char qterm[KVSTORE_TERM_MAX], term[KVSTORE_TERM_MAX];
+    size_t qlen, len;
+    bool any = false;
+    while ((qlen = kvstore_next_term(&query, qterm)) > 0) {
+        bool is_prefix = *query == '*';
+        bool found = false;
+        const char *s = subject ? subject : "";
+        while (!found && (len = kvstore_next_term(&s, term)) > 0) {
+            found = is_prefix ? len >= qlen && memcmp(term, qterm, qlen) == 0
+                              : len == qlen && memcmp(term, qterm, qlen) == 0;
+        }
+        if (!found) return false;
+        any = true;
+    }
+    return any;
+}
+
+// Model: one slot per (mailbox, uid) in [0, 2) x [0, UIDS)
+#define UIDS 3000
+
+typedef struct {
+    bool present;
+    char *subject;
+} model_t;
+
+static void put_msg(kvstore_txn_t *txn, model_t *m, uint32_t mbox, uint32_t uid,
+                    const char *subject) {
+    model_t *slot = &m[mbox * UIDS + uid];
+    struct message_record rec = { mbox, uid, "sender@example.com", (char*)subject };
+
+    kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+    if (slot->present) {
+        struct message_record old = { mbox, uid, "sender@example.com", slot->subject };
+        assert(populate_key_buf_message_record(&old, &kb) == KVSTORE_OK);
+    }
+    assert(kvstore_put_message_record_with_all_indices(txn, &rec, slot->present ? &kb : NULL) == KVSTORE_OK);
+    kvstore_key_buf_free(&kb);
+
+    free(slot->subject);
+    slot->present = true;
+    slot->subject = subject ? strdup(subject) : NULL;
+}
+
+static void del_msg(kvstore_txn_t *txn, model_t *m, uint32_t mbox, uint32_t uid) {
+    model_t *slot = &m[mbox * UIDS + uid];
+    if (!slot->present) return;
+
+    struct message_record old = { mbox, uid, "sender@example.com", slot->subject };
+    kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+    assert(populate_key_buf_message_record(&old, &kb) == KVSTORE_OK);
+    assert(kvstore_del_message_record_with_all_indices(txn, &kb) == KVSTORE_OK);
+    kvstore_key_buf_free(&kb);
+
+    free(slot->subject);
+    slot->present = false;
+    slot->subject = NULL;
+}
+
+// Collected primary keys as mailbox * UIDS + uid
+typedef struct {
+    uint32_t *v;
+    size_t n, cap;
+} list_t;
+
+static void list_push(list_t *l, uint32_t v) {
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 1024;
+        l->v = (uint32_t*)realloc(l->v, l->cap * sizeof(*l->v));
+    }
+    l->v[l->n++] = v;
+}
+
+static int collect_msg(struct message_record_pk *pk, void *arg) {
+    list_push((list_t*)arg, pk->mailbox_id * UIDS + pk->uid);
+    return 0;
+}
+
+static const char *queries[] = {
+    "invoice", "INVOICE payment", "pay*", "meeting fri*", "Re: budget",
+    "release notes bug", "de*", "1*", "12* team", "p* r*", "welcome*",
+    "zzz", "invoice zzz", "", "--",
+};
+#define NQUERIES 15
+
+// Search and the linear match agree (in order) for every query
+static void check_queries(kvstore_txn_t *txn, model_t *m) {
+    for (int q = 0; q < NQUERIES; q++) {
+        list_t got = {0}, want = {0};
+        for (uint32_t s = 0; s < 2 * UIDS; s++) {
+            if (m[s].present && text_matches(m[s].subject, queries[q])) list_push(&want, s);
+        }
+
+        int rc = kvstore_search_message_record_by_subject_term(txn, queries[q], collect_msg, &got);
+        assert(rc == (want.n ? KVSTORE_OK : KVSTORE_NOTFOUND));
+        assert(got.n == want.n);
+        assert(!want.n || memcmp(got.v, want.v, want.n * sizeof(uint32_t)) == 0);
+        free(got.v);
+        free(want.v);
+    }
+}
+
+static int stop_after_three(struct message_record_pk *pk, void *arg) {
+    (void)pk;
+    return ++*(int*)arg == 3 ? 7 : 0;
+}
+
+// Linear scan baseline: decode every record and match its subject
+typedef struct {
+    const char *query;
+    size_t matches;
+} scan_ctx_t;
+
+static int scan_match(size_t part, struct message_record *rec, void *arg) {
+    scan_ctx_t *ctx = (scan_ctx_t*)arg;
+    (void)part;
+    if (text_matches(rec->subject, ctx->query)) ctx->matches++;
+    free(rec->from);
+    free(rec->subject);
+    return 0;
+}
+
+static int count_msg(struct message_record_pk *pk, void *arg) {
+    (void)pk;
+    (*(size_t*)arg)++;
+    return 0;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+
+    printf("=== Full-text Index Test ===\n\n");
+
+    // TEST 1: Tokenizer
+    printf("Test 1: Tokenizer...\n");
+    {
+        const char *want[] = { "re", "q3", "invoice", "42", "overdue", "please", "pay", "caf\xc3\xa9" };
+        const char *text = "Re: [Q3] Invoice#42 overdue -- PLEASE pay caf\xc3\xa9!";
+        char term[KVSTORE_TERM_MAX];
+        size_t len;
+        int n = 0;
+        while ((len = kvstore_next_term(&text, term)) > 0) {
+            assert(n < 8 && len == strlen(want[n]) && memcmp(term, want[n], len) == 0);
+            n++;
+        }
+        assert(n == 8);
+
+        // Long words are cut, not split
+        char word[64];
+        memset(word, 'a', 40);
+        strcpy(word + 40, " b");
+        text = word;
+        assert(kvstore_next_term(&text, term) == KVSTORE_TERM_MAX);
+        assert(kvstore_next_term(&text, term) == 1 && term[0] == 'b');
+        assert(kvstore_next_term(&text, term) == 0);
+        printf("  ✓ Lowercased ASCII words, digits and UTF-8 bytes; long words cut\n");
+    }
+
+    // TEST 2: Search against the linear match under random maintenance
+    printf("\nTest 2: Randomized search...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        model_t *m = (model_t*)calloc(2 * UIDS, sizeof(model_t));
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        char subject[256];
+
+        for (uint32_t i = 0; i < 2 * UIDS; i++) {
+            uint32_t s = (uint32_t)(((uint64_t)i * 7919) % (2 * UIDS));
+            make_subject(subject, sizeof(subject));
+            put_msg(txn, m, s / UIDS, s % UIDS, subject);
+        }
+        check_queries(txn, m);
+        printf("  ✓ %d queries match the linear scan over %u records\n", NQUERIES, 2 * UIDS);
+
+        // Subject edits only touch the terms that changed
+        for (int round = 0; round < 3; round++) {
+            for (int op = 0; op < 2000; op++) {
+                uint32_t r = rng(), s = rng() % (2 * UIDS);
+                make_subject(subject, sizeof(subject));
+                if (r % 4 == 0) del_msg(txn, m, s / UIDS, s % UIDS);
+                else if (r % 16 == 1) put_msg(txn, m, s / UIDS, s % UIDS, NULL);
+                else put_msg(txn, m, s / UIDS, s % UIDS, subject);
+            }
+            check_queries(txn, m);
+        }
+        printf("  ✓ Still match after 6000 random updates and deletes\n");
+
+        // Results come in mailbox, then uid order; fn can stop the search
+        list_t got = {0};
+        assert(kvstore_search_message_record_by_subject_term(txn, "m*", collect_msg, &got) == KVSTORE_OK);
+        bool both = false;
+        for (size_t i = 1; i < got.n; i++) {
+            assert(got.v[i - 1] < got.v[i]);
+            both |= got.v[i - 1] < UIDS && got.v[i] >= UIDS;
+        }
+        assert(both);
+        int calls = 0;
+        assert(kvstore_search_message_record_by_subject_term(txn, "m*", stop_after_three, &calls) == 7);
+        assert(calls == 3);
+        free(got.v);
+        printf("  ✓ %zu hits ranked by mailbox and uid; callback stops the search\n", got.n);
+
+        for (uint32_t s = 0; s < 2 * UIDS; s++) del_msg(txn, m, s / UIDS, s % UIDS);
+        kvstore_val_t start = { "msg_subj:", 9 }, k, v;
+        kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+        assert(kvstore_cursor_get(cur, &k, &v) != KVSTORE_OK ||
+               k.size < 9 || memcmp(k.data, "msg_subj:", 9) != 0);
+        kvstore_cursor_close(cur);
+        printf("  ✓ Deleting every record removes every term\n");
+
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        kvstore_close(db);
+        free(m);
+    }
+
+    // Benchmark: index search against decoding and matching every record
+    printf("\nBenchmark: %u subjects in 10 mailboxes\n", records);
+    {
+        kvstore_t *db = kvstore_open_mem();
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        char subject[256];
+        for (uint32_t i = 0; i < records; i++) {
+            make_subject(subject, sizeof(subject));
+            struct message_record rec = { i % 10, i / 10, "sender@example.com", subject };
+            assert(kvstore_put_message_record_with_all_indices(txn, &rec, NULL) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        const char *bench[] = { "outage", "meeting", "invoice payment", "pay*", "release notes" };
+        txn = kvstore_txn_begin(db, true);
+        printf("  %-20s %8s %12s %12s %9s\n", "query", "matches", "index us", "scan us", "speedup");
+        for (int q = 0; q < 5; q++) {
+            int reps = 20;
+            size_t hits = 0;
+            struct timespec start;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int r = 0; r < reps; r++) {
+                kvstore_search_message_record_by_subject_term(txn, bench[q], count_msg, &hits);
+            }
+            double search = elapsed_sec(&start) / reps;
+
+            scan_ctx_t ctx = { bench[q], 0 };
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            assert(kvstore_scan_parallel_message_record(txn, NULL, NULL, 1, scan_match, &ctx) == KVSTORE_OK);
+            double scan = elapsed_sec(&start);
+
+            assert(hits == ctx.matches * reps);
+            printf("  %-20s %8zu %12.0f %12.0f %8.0fx\n", bench[q], ctx.matches,
+                   search * 1e6, scan * 1e6, scan / search);
+        }
+
+        kvstore_txn_commit(txn);
+        kvstore_close(db);
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
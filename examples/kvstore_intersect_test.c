@@ -0,0 +1,371 @@
+// Index intersection test: multi-predicate queries answered by merging or
+// hashing primary key streams from several indexes before any record fetch.
+// Benchmarks against fetching one index's candidates and filtering.
+// Usage: kvstore_intersect_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record definition
+// ------------------------
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    char *sender;
+    struct timespec received;
+    uint32_t user_flags[1];
+    char *subject;
+    char *body;
+};
+
+SERIALISE(message_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(sender, charptr),
+    SERIALISE_FIELD(received, timespec),
+    SERIALISE_FIELD(user_flags, bit32, 1),
+    SERIALISE_FIELD(subject, charptr),
+    SERIALISE_FIELD(body, charptr)
+)
+
+SERIALISE_DECLARE_KEYS(message_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+// Mailbox listing in arrival order: not primary key order
+SERIALISE_SECONDARY_KEY(message_record, "msg_mbox_time:", by_mailbox_time,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(received, timespec),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+// Non-unique indexes: entries end in the primary key
+SERIALISE_MULTI_KEY(message_record, "msg_from:", by_sender,
+    KV_EACH_VALUE(sender, charptr))
+
+SERIALISE_MULTI_KEY(message_record, "msg_flag:", by_flag,
+    KV_EACH_SET_BIT(user_flags, 1))
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_mailbox_time, "msg_mbox_time:",
+    by_sender, "msg_from:",
+    by_flag, "msg_flag:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+#define MAILBOXES 10
+#define BODY_SIZE 2048
+
+// Senders with fixed shares of all messages
+static const char *sender_of(uint32_t i, char *buf, size_t len) {
+    if (i % 2 == 0) return "half@example.com";
+    if (i % 10 == 1) return "tenth@example.com";
+    if (i % 100 == 3) return "percent@example.com";
+    if (i % 1000 == 5) return "permille@example.com";
+    snprintf(buf, len, "other%u@example.com", i % 97);
+    return buf;
+}
+
+static void make_message(struct message_record *m, uint32_t i, char *sender, char *subject,
+                         char *body) {
+    memset(m, 0, sizeof(*m));
+    // Scatter so mailboxes are independent of the sender pattern
+    m->mailbox_id = ((i * 2654435761u) >> 20) % MAILBOXES;
+    m->uid = i;
+    m->sender = sender;
+    // Arrival order differs from uid order
+    m->received.tv_sec = 1700000000 + (i * 7919) % 100003;
+    m->user_flags[0] = (i % 3 == 0) ? 1u << 3 : 0;
+    m->subject = subject;
+    m->body = body;
+}
+
+static void load(kvstore_t *db, uint32_t records) {
+    char sender[64], subject[64];
+    // Typical message body: every fetch pays for it
+    char *body = (char*)malloc(BODY_SIZE + 1);
+    memset(body, 'x', BODY_SIZE);
+    body[BODY_SIZE] = '\0';
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+    for (uint32_t i = 0; i < records; i++) {
+        struct message_record m;
+        snprintf(subject, sizeof(subject), "Message %u", i);
+        make_message(&m, i, (char*)sender_of(i, sender, sizeof(sender)), subject, body);
+        assert(kvstore_put_message_record_with_all_indices(txn, &m, NULL) == KVSTORE_OK);
+    }
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+    free(body);
+}
+
+struct result {
+    uint32_t count;
+    uint32_t last_key;      // mailbox << 24 | uid of the previous match
+    bool ordered;
+    int want_mailbox;       // For fetch-and-filter; -1 for any
+    const char *want_sender;
+    bool want_flagged;
+    kvstore_txn_t *txn;
+};
+
+static int stop_after_five(struct message_record *m, void *arg) {
+    uint32_t *n = (uint32_t*)arg;
+    free(m->sender);
+    free(m->subject);
+    free(m->body);
+    return ++*n == 5 ? KVSTORE_EXISTS : 0;
+}
+
+static int on_match(struct message_record *m, void *arg) {
+    struct result *r = (struct result*)arg;
+    uint32_t key = (m->mailbox_id << 24) | m->uid;
+    if (r->count && key <= r->last_key) r->ordered = false;
+    r->last_key = key;
+    r->count++;
+    free(m->sender);
+    free(m->subject);
+    free(m->body);
+    return 0;
+}
+
+// Expected count by brute force over the generator
+static uint32_t expected(uint32_t records, int mailbox, const char *sender, bool flagged) {
+    char buf[64];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < records; i++) {
+        struct message_record m;
+        make_message(&m, i, (char*)sender_of(i, buf, sizeof(buf)), NULL, NULL);
+        if (mailbox >= 0 && m.mailbox_id != (uint32_t)mailbox) continue;
+        if (sender && strcmp(m.sender, sender) != 0) continue;
+        if (flagged && !(m.user_flags[0] & (1u << 3))) continue;
+        n++;
+    }
+    return n;
+}
+
+static uint32_t query(kvstore_txn_t *txn, int mailbox, const char *sender, bool flagged,
+                      bool *ordered) {
+    kvstore_pk_stream_t streams[3];
+    size_t n = 0;
+
+    if (mailbox >= 0) {
+        struct message_record_by_mailbox_time_key k = { .mailbox_id = (uint32_t)mailbox };
+        assert(kvstore_stream_message_record_by_mailbox_time(&streams[n++], &k, 1) == KVSTORE_OK);
+    }
+    if (sender) {
+        struct message_record_by_sender_key k = { .value = (char*)sender };
+        assert(kvstore_stream_message_record_by_sender(&streams[n++], &k) == KVSTORE_OK);
+    }
+    if (flagged) {
+        struct message_record_by_flag_key k = { .value = 3 };
+        assert(kvstore_stream_message_record_by_flag(&streams[n++], &k) == KVSTORE_OK);
+    }
+
+    struct result r = { .ordered = true };
+    int rc = kvstore_query_message_record(txn, streams, n, on_match, &r);
+    assert(rc == KVSTORE_OK || (rc == KVSTORE_NOTFOUND && r.count == 0));
+    for (size_t i = 0; i < n; i++) kvstore_pk_stream_free(&streams[i]);
+
+    if (ordered) *ordered = r.ordered;
+    return r.count;
+}
+
+// Baseline: walk one index, fetch every candidate and filter in the application
+static int filter_fetch(struct message_record_pk *pk, void *arg) {
+    struct result *r = (struct result*)arg;
+    struct message_record m = {0};
+    assert(kvstore_get_message_record(r->txn, pk, &m, NULL) == KVSTORE_OK);
+    if ((r->want_mailbox < 0 || m.mailbox_id == (uint32_t)r->want_mailbox) &&
+        strcmp(m.sender, r->want_sender) == 0 &&
+        (!r->want_flagged || (m.user_flags[0] & (1u << 3)))) {
+        r->count++;
+    }
+    free(m.sender);
+    free(m.subject);
+    free(m.body);
+    return 0;
+}
+
+static uint32_t fetch_and_filter(kvstore_txn_t *txn, int mailbox, const char *sender,
+                                 bool flagged, bool via_sender) {
+    struct result r = { .want_mailbox = mailbox, .want_sender = sender,
+                        .want_flagged = flagged, .txn = txn };
+    if (via_sender) {
+        struct message_record_by_sender_key k = { .value = (char*)sender };
+        kvstore_lookup_each_message_record_by_sender(txn, &k, filter_fetch, &r);
+        return r.count;
+    }
+    if (mailbox < 0) {
+        struct message_record_by_flag_key k = { .value = 3 };
+        kvstore_lookup_each_message_record_by_flag(txn, &k, filter_fetch, &r);
+        return r.count;
+    }
+
+    struct message_record_by_mailbox_time_key k = { .mailbox_id = (uint32_t)mailbox };
+    kvstore_cursor_t *cur = kvstore_cursor_message_record_by_mailbox_time(txn, &k);
+    kvstore_val_t key, val;
+    size_t plen = strlen("msg_mbox_time:");
+    while (kvstore_cursor_get(cur, &key, &val) == KVSTORE_OK) {
+        char *p = (char*)key.data + plen;
+        uint32_t mbox;
+        SER_READ_U32(p, mbox);
+        if (key.size < plen + 4 || mbox != (uint32_t)mailbox) break;
+
+        struct message_record_pk pk;
+        deserialise_message_record_pk((char*)val.data, &pk);
+        filter_fetch(&pk, &r);
+        kvstore_cursor_next(cur);
+    }
+    kvstore_cursor_close(cur);
+    return r.count;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static const struct { const char *sender; double share; } bench_senders[] = {
+    { "half@example.com", 0.5 },
+    { "tenth@example.com", 0.1 },
+    { "percent@example.com", 0.01 },
+    { "permille@example.com", 0.001 },
+};
+
+// One benchmark row: the baseline walks whichever index is more selective
+static void bench_row(kvstore_txn_t *txn, int mailbox, const char *sender, bool flagged,
+                      bool via_sender) {
+    int reps = 20;
+    struct timespec start;
+    uint32_t n1 = 0, n2 = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < reps; r++) n1 = fetch_and_filter(txn, mailbox, sender, flagged, via_sender);
+    double filter = elapsed_sec(&start) / reps;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < reps; r++) n2 = query(txn, mailbox, sender, flagged, NULL);
+    double inter = elapsed_sec(&start) / reps;
+
+    assert(n1 == n2);
+    printf("  %-22s %8u %12.0f %12.0f %7.1fx\n",
+           sender, n1, filter * 1e6, inter * 1e6, filter / inter);
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+
+    printf("=== Index Intersection Test ===\n\n");
+
+    kvstore_t *db = kvstore_open_mem();
+    assert(db != NULL);
+    load(db, records);
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+
+    // TEST 1: All streams in pk order: sorted merge
+    printf("Test 1: Sender AND flag (sorted merge)...\n");
+    {
+        const char *senders[] = { "half@example.com", "tenth@example.com",
+                                  "percent@example.com", "nobody@example.com" };
+        for (int i = 0; i < 4; i++) {
+            bool ordered;
+            uint32_t got = query(txn, -1, senders[i], true, &ordered);
+            assert(got == expected(records, -1, senders[i], true));
+            assert(ordered);
+        }
+        printf("  ✓ Matches brute force, results in primary key order\n");
+    }
+
+    // TEST 2: Mixed: mailbox stream is in arrival order, so it is hashed
+    printf("\nTest 2: Mailbox AND sender (hash + merge)...\n");
+    {
+        // Rare senders exhaust the merge first, common ones the mailbox
+        const char *senders[] = { "half@example.com", "tenth@example.com",
+                                  "percent@example.com", "permille@example.com" };
+        for (int mbox = 0; mbox < MAILBOXES; mbox += 3) {
+            for (int i = 0; i < 4; i++) {
+                bool ordered;
+                uint32_t got = query(txn, mbox, senders[i], false, &ordered);
+                assert(got == expected(records, mbox, senders[i], false));
+                assert(ordered);
+
+                got = query(txn, mbox, senders[i], true, &ordered);
+                assert(got == expected(records, mbox, senders[i], true));
+                assert(ordered);
+            }
+        }
+        printf("  ✓ Three-way and two-way mixed intersections match brute force\n");
+    }
+
+    // TEST 3: Only unordered streams
+    printf("\nTest 3: Single unordered stream...\n");
+    {
+        bool ordered;
+        uint32_t got = query(txn, 4, NULL, false, &ordered);
+        assert(got == expected(records, 4, NULL, false));
+        assert(ordered);
+        printf("  ✓ Mailbox stream re-sorted into primary key order (%u rows)\n", got);
+    }
+
+    // TEST 4: Callback stops the query
+    printf("\nTest 4: Early stop...\n");
+    {
+        for (int mixed = 0; mixed < 2; mixed++) {
+            struct message_record_by_mailbox_time_key mk = { .mailbox_id = 1 };
+            struct message_record_by_flag_key fk = { .value = 3 };
+            kvstore_pk_stream_t streams[2];
+            assert(kvstore_stream_message_record_by_flag(&streams[0], &fk) == KVSTORE_OK);
+            if (mixed) {
+                assert(kvstore_stream_message_record_by_mailbox_time(&streams[1], &mk, 1) == KVSTORE_OK);
+            }
+
+            uint32_t n = 0;
+            int rc = kvstore_query_message_record(txn, streams, mixed ? 2 : 1, stop_after_five, &n);
+            assert(rc == KVSTORE_EXISTS);
+            assert(n == 5);
+            for (int i = 0; i <= mixed; i++) kvstore_pk_stream_free(&streams[i]);
+        }
+        printf("  ✓ Callback result returned, no further records fetched\n");
+    }
+
+    // Benchmark: intersection vs best single index + fetch-and-filter
+    printf("\nBenchmark: sender AND flagged (33%%, both pk-ordered), %u records\n", records);
+    printf("  %-22s %8s %12s %12s %8s\n", "sender", "matches", "filter us", "intersect us", "speedup");
+    for (int c = 0; c < 4; c++) {
+        bench_row(txn, -1, bench_senders[c].sender, true, bench_senders[c].share < 1.0 / 3);
+    }
+
+    printf("\nBenchmark: mailbox 2 (10%%, arrival order) AND sender\n");
+    printf("  %-22s %8s %12s %12s %8s\n", "sender", "matches", "filter us", "intersect us", "speedup");
+    for (int c = 0; c < 4; c++) {
+        bench_row(txn, 2, bench_senders[c].sender, false,
+                  bench_senders[c].share < 1.0 / MAILBOXES);
+    }
+
+    kvstore_txn_commit(txn);
+    kvstore_close(db);
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,240 @@
+// Merge operator test: counters, flag bits and appended events changed in
+// place, through the memory backend and the generic get + put fallback.
+// Benchmarks counter increments against get, decode, modify, encode, put.
+// Usage: kvstore_merge_test [increments]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+extern const struct kvstore_ops* kvstore_mem_ops(void);
+
+// ------------------------
+// Record definitions
+// ------------------------
+
+struct event_record {
+    uint64_t at;
+    uint32_t kind;
+};
+
+SERIALISE(event_record,
+    SERIALISE_FIELD(at, uint64_t),
+    SERIALISE_FIELD(kind, uint32_t)
+)
+
+struct mailbox_record {
+    uint32_t mailbox_id;
+    uint64_t hits;
+    uint32_t flags;
+    uint32_t num_events;
+    char *name;
+    struct event_record *events;
+};
+
+SERIALISE(mailbox_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(hits, uint64_t),
+    SERIALISE_FIELD(flags, uint32_t),
+    SERIALISE_FIELD(num_events, uint32_t),
+    SERIALISE_FIELD(name, charptr),
+    SERIALISE_FIELD_PTR(events, event_record, num_events)
+)
+
+// Serialized offsets: every field before these is fixed-size
+#define OFF_HITS       4
+#define OFF_FLAGS      12
+#define OFF_NUM_EVENTS 16
+
+SERIALISE_DECLARE_KEYS(mailbox_record)
+
+SERIALISE_PRIMARY_KEY(mailbox_record, "mbox:",
+    SERIALISE_FIELD(mailbox_id, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(mailbox_record, "mbox_name:", by_name,
+    SERIALISE_FIELD(name, charptr),
+    SERIALISE_FIELD(mailbox_id, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(mailbox_record,
+    by_name, "mbox_name:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static void put_mailbox(kvstore_txn_t *txn, uint32_t id) {
+    char name[32];
+    snprintf(name, sizeof(name), "box%u", id);
+    struct mailbox_record rec = { .mailbox_id = id, .flags = 0xF0, .name = name };
+    assert(kvstore_put_mailbox_record_with_all_indices(txn, &rec, NULL) == KVSTORE_OK);
+}
+
+static struct mailbox_record get_mailbox(kvstore_txn_t *txn, uint32_t id) {
+    struct mailbox_record_pk pk = { id };
+    struct mailbox_record rec;
+    assert(kvstore_get_mailbox_record(txn, &pk, &rec, NULL) == KVSTORE_OK);
+    return rec;
+}
+
+static void free_mailbox(struct mailbox_record *rec) {
+    free(rec->name);
+    free(rec->events);
+}
+
+static kvstore_merge_t add_hits(uint64_t n) {
+    return (kvstore_merge_t){ .kind = KVSTORE_MERGE_ADD_U64, .offset = OFF_HITS, .operand = n };
+}
+
+// Merge every operator kind into mailbox 1 and check the decoded result
+static void check_merges(kvstore_t *db) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+    put_mailbox(txn, 1);
+    put_mailbox(txn, 2);
+
+    struct mailbox_record_pk pk = { 1 };
+    for (int i = 0; i < 5; i++) {
+        kvstore_merge_t op = add_hits(10);
+        assert(kvstore_merge_mailbox_record(txn, &pk, &op) == KVSTORE_OK);
+    }
+    kvstore_merge_t op = { .kind = KVSTORE_MERGE_OR_U32, .offset = OFF_FLAGS, .operand = 0x3 };
+    assert(kvstore_merge_mailbox_record(txn, &pk, &op) == KVSTORE_OK);
+    op = (kvstore_merge_t){ .kind = KVSTORE_MERGE_AND_U32, .offset = OFF_FLAGS, .operand = ~0x10u };
+    assert(kvstore_merge_mailbox_record(txn, &pk, &op) == KVSTORE_OK);
+
+    // Append two events after the variable-size name
+    for (uint32_t i = 0; i < 2; i++) {
+        struct event_record ev = { 1000 + i, 7 * i };
+        char buf[12];
+        serialise_event_record(buf, &ev);
+        op = (kvstore_merge_t){ .kind = KVSTORE_MERGE_APPEND, .offset = OFF_NUM_EVENTS,
+                                .data = { buf, sizeof(buf) } };
+        assert(kvstore_merge_mailbox_record(txn, &pk, &op) == KVSTORE_OK);
+    }
+
+    struct mailbox_record rec = get_mailbox(txn, 1);
+    assert(rec.hits == 50 && rec.flags == 0xE3 && strcmp(rec.name, "box1") == 0);
+    assert(rec.num_events == 2 && rec.events[0].at == 1000 && rec.events[1].at == 1001 &&
+           rec.events[1].kind == 7);
+    free_mailbox(&rec);
+
+    // Neighbours and the name index are untouched
+    rec = get_mailbox(txn, 2);
+    assert(rec.hits == 0 && rec.flags == 0xF0 && rec.num_events == 0);
+    free_mailbox(&rec);
+    struct mailbox_record_by_name_key nk = { "box1", 1 };
+    struct mailbox_record_pk found;
+    assert(kvstore_lookup_mailbox_record_by_name(txn, &nk, &found) == KVSTORE_OK);
+
+    // Missing records and out-of-range offsets (the value is 52 bytes)
+    pk.mailbox_id = 99;
+    op = add_hits(1);
+    assert(kvstore_merge_mailbox_record(txn, &pk, &op) == KVSTORE_NOTFOUND);
+    pk.mailbox_id = 1;
+    op.offset = 1000;
+    assert(kvstore_merge_mailbox_record(txn, &pk, &op) == KVSTORE_ERROR);
+    op = (kvstore_merge_t){ .kind = KVSTORE_MERGE_OR_U32, .offset = 50, .operand = 1 };
+    assert(kvstore_merge_mailbox_record(txn, &pk, &op) == KVSTORE_ERROR);
+
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+#define BENCH_MAILBOXES 1000
+
+// Increment hit counters round-robin; method 0 is get + put of the record
+static double bench(kvstore_t *db, int method, uint64_t n) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+    for (uint32_t i = 0; i < BENCH_MAILBOXES; i++) put_mailbox(txn, i);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t i = 0; i < n; i++) {
+        struct mailbox_record_pk pk = { (uint32_t)(i % BENCH_MAILBOXES) };
+        if (method == 0) {
+            struct mailbox_record rec;
+            assert(kvstore_get_mailbox_record(txn, &pk, &rec, NULL) == KVSTORE_OK);
+            rec.hits++;
+            assert(kvstore_put_mailbox_record(txn, &rec, NULL) == KVSTORE_OK);
+            free_mailbox(&rec);
+        } else {
+            kvstore_merge_t op = add_hits(1);
+            assert(kvstore_merge_mailbox_record(txn, &pk, &op) == KVSTORE_OK);
+        }
+    }
+    double sec = elapsed_sec(&start);
+
+    for (uint32_t i = 0; i < BENCH_MAILBOXES; i++) {
+        struct mailbox_record rec = get_mailbox(txn, i);
+        assert(rec.hits == n / BENCH_MAILBOXES + (i < n % BENCH_MAILBOXES));
+        free_mailbox(&rec);
+    }
+    kvstore_txn_commit(txn);
+    return sec;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint64_t increments = argc > 1 ? (uint64_t)atoll(argv[1]) : 200000;
+
+    printf("=== Merge Operator Test ===\n\n");
+
+    // TEST 1: In place in the memory backend
+    printf("Test 1: Memory backend...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        check_merges(db);
+        kvstore_close(db);
+        printf("  ✓ Add, OR, AND and append applied in place\n");
+    }
+
+    // TEST 2: Generic fallback for backends without ops->merge
+    printf("\nTest 2: Get + put fallback...\n");
+    struct kvstore_ops no_merge = *kvstore_mem_ops();
+    no_merge.merge = NULL;
+    {
+        kvstore_t *db = kvstore_open(NULL, &no_merge);
+        check_merges(db);
+        kvstore_close(db);
+        printf("  ✓ Same results through get and put\n");
+    }
+
+    // Benchmark: counter increments
+    printf("\nBenchmark: %llu counter increments over %d mailboxes\n",
+           (unsigned long long)increments, BENCH_MAILBOXES);
+    {
+        const char *names[] = { "get + put", "merge (fallback)", "merge (in place)" };
+        double secs[3];
+        for (int m = 0; m < 3; m++) {
+            kvstore_t *db = m == 1 ? kvstore_open(NULL, &no_merge) : kvstore_open_mem();
+            secs[m] = bench(db, m == 0 ? 0 : 1, increments);
+            kvstore_close(db);
+        }
+        printf("  %-18s %12s %14s\n", "method", "time us", "increments/s");
+        for (int m = 0; m < 3; m++) {
+            printf("  %-18s %12.0f %14.0f", names[m], secs[m] * 1e6, increments / secs[m]);
+            if (m) printf("  (%.1fx)", secs[0] / secs[m]);
+            printf("\n");
+        }
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,403 @@
+// Multi-valued index test: one entry per array element, STRUCTPTR member
+// or set bit, maintained by diffing old and new element lists.
+// Benchmarks changing one element of 1000 against a full index rewrite.
+// Usage: kvstore_multi_index_test [updates]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Customer record: indexed by every user's name and id
+// ------------------------
+
+struct user_record {
+    uint64_t user_id;
+    char *username;
+};
+
+SERIALISE(user_record,
+    SERIALISE_FIELD(user_id, uint64_t),
+    SERIALISE_FIELD(username, charptr)
+)
+
+struct customer_record {
+    uint64_t customer_id;
+    char *customer_name;
+    uint32_t num_users;
+    struct user_record *users;
+};
+
+SERIALISE(customer_record,
+    SERIALISE_FIELD(customer_id, uint64_t),
+    SERIALISE_FIELD(customer_name, charptr),
+    SERIALISE_FIELD(num_users, uint32_t),
+    SERIALISE_FIELD_PTR(users, user_record, num_users)
+)
+
+SERIALISE_DECLARE_KEYS(customer_record)
+
+SERIALISE_PRIMARY_KEY(customer_record, "cust:",
+    SERIALISE_FIELD(customer_id, uint64_t)
+)
+
+SERIALISE_MULTI_KEY(customer_record, "cust_user:", by_username,
+    KV_EACH_MEMBER(users, num_users, username, charptr))
+
+SERIALISE_MULTI_KEY(customer_record, "cust_uid:", by_user_id,
+    KV_EACH_MEMBER(users, num_users, user_id, uint64_t))
+
+SERIALISE_SECONDARY_KEY(customer_record, "cust_name:", by_name,
+    SERIALISE_FIELD(customer_name, charptr)
+)
+
+SERIALISE_FINALIZE_INDICES(customer_record,
+    by_username, "cust_user:",
+    by_user_id, "cust_uid:",
+    by_name, "cust_name:"
+)
+
+// ------------------------
+// Message record: indexed by every set flag bit and every folder
+// ------------------------
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    uint32_t user_flags[2];
+    uint32_t folders[3];
+};
+
+SERIALISE(message_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(user_flags, bit32, 2),
+    SERIALISE_FIELD(folders, uint32_t, 3)
+)
+
+SERIALISE_DECLARE_KEYS(message_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_MULTI_KEY(message_record, "msg_flag:", by_flag,
+    KV_EACH_SET_BIT(user_flags, 2))
+
+SERIALISE_MULTI_KEY(message_record, "msg_folder:", by_folder,
+    KV_EACH_ELEMENT(folders, uint32_t, 3))
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_flag, "msg_flag:",
+    by_folder, "msg_folder:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static void free_customer(struct customer_record *c) {
+    free(c->customer_name);
+    for (uint32_t i = 0; c->users && i < c->num_users; i++) {
+        free(c->users[i].username);
+    }
+    free(c->users);
+}
+
+static void make_customer(struct customer_record *c, uint64_t id, uint32_t num_users,
+                          const char *const *names) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "Customer %llu", (unsigned long long)id);
+    c->customer_id = id;
+    c->customer_name = strdup(buf);
+    c->num_users = num_users;
+    c->users = (struct user_record*)calloc(num_users, sizeof(*c->users));
+    for (uint32_t i = 0; i < num_users; i++) {
+        c->users[i].user_id = id * 10000 + i;
+        if (names) {
+            c->users[i].username = strdup(names[i]);
+        } else {
+            snprintf(buf, sizeof(buf), "user%llu.%u", (unsigned long long)id, i);
+            c->users[i].username = strdup(buf);
+        }
+    }
+}
+
+static size_t count_prefix(kvstore_txn_t *txn, const char *prefix) {
+    size_t prefix_len = strlen(prefix);
+    kvstore_val_t start = { (void*)prefix, prefix_len };
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+    kvstore_val_t k, v;
+    size_t n = 0;
+    while (kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK) {
+        if (k.size < prefix_len || memcmp(k.data, prefix, prefix_len) != 0) break;
+        n++;
+        kvstore_cursor_next(cur);
+    }
+    kvstore_cursor_close(cur);
+    return n;
+}
+
+// Owner of a username, or 0 if none
+static uint64_t owner_of(kvstore_txn_t *txn, const char *username) {
+    struct customer_record_by_username_key key = { .value = (char*)username };
+    struct customer_record_pk pk;
+    int rc = kvstore_lookup_customer_record_by_username(txn, &key, &pk);
+    assert(rc == KVSTORE_OK || rc == KVSTORE_NOTFOUND);
+    return rc == KVSTORE_OK ? pk.customer_id : 0;
+}
+
+struct collect {
+    uint32_t uids[16];
+    size_t n;
+};
+
+static int collect_uid(struct message_record_pk *pk, void *arg) {
+    struct collect *c = (struct collect*)arg;
+    c->uids[c->n++] = pk->uid;
+    return 0;
+}
+
+static size_t messages_with_flag(kvstore_txn_t *txn, uint32_t bit, struct collect *out) {
+    struct message_record_by_flag_key key = { .value = bit };
+    out->n = 0;
+    kvstore_lookup_each_message_record_by_flag(txn, &key, collect_uid, out);
+    return out->n;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t updates = argc > 1 ? (uint32_t)atoi(argv[1]) : 500;
+
+    printf("=== Multi-valued Index Test ===\n\n");
+
+    kvstore_t *db = kvstore_open_mem();
+    assert(db != NULL);
+
+    // TEST 1: Any user's name finds the customer
+    printf("Test 1: Lookup by any STRUCTPTR member value...\n");
+    {
+        const char *a_names[] = { "alice", "admin", "bob" };
+        const char *b_names[] = { "carol", "admin" };
+        struct customer_record a = {0}, b = {0};
+        make_customer(&a, 1, 3, a_names);
+        make_customer(&b, 2, 2, b_names);
+
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        assert(kvstore_put_customer_record_with_all_indices(txn, &a, NULL) == KVSTORE_OK);
+        assert(kvstore_put_customer_record_with_all_indices(txn, &b, NULL) == KVSTORE_OK);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        free_customer(&a);
+        free_customer(&b);
+
+        txn = kvstore_txn_begin(db, true);
+        assert(owner_of(txn, "alice") == 1);
+        assert(owner_of(txn, "bob") == 1);
+        assert(owner_of(txn, "carol") == 2);
+        assert(owner_of(txn, "mallory") == 0);
+
+        // Shared names get one entry per customer, in primary key order
+        struct customer_record_by_username_key key = { .value = "admin" };
+        kvstore_cursor_t *cur = kvstore_cursor_customer_record_by_username(txn, &key);
+        kvstore_val_t k, v;
+        uint64_t seen[2];
+        for (int i = 0; i < 2; i++) {
+            assert(kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK);
+            struct customer_record_pk pk;
+            deserialise_customer_record_pk((char*)v.data, &pk);
+            seen[i] = pk.customer_id;
+            kvstore_cursor_next(cur);
+        }
+        kvstore_cursor_close(cur);
+        assert(seen[0] == 1 && seen[1] == 2);
+
+        struct customer_record_by_user_id_key uid_key = { .value = 20001 };
+        struct customer_record_pk pk;
+        assert(kvstore_lookup_customer_record_by_user_id(txn, &uid_key, &pk) == KVSTORE_OK);
+        assert(pk.customer_id == 2);
+
+        assert(count_prefix(txn, "cust_user:") == 5);
+        assert(count_prefix(txn, "cust_uid:") == 5);
+        kvstore_txn_commit(txn);
+        printf("  ✓ 5 username entries for 2 customers, shared name returns both\n");
+    }
+
+    // TEST 2: Updates only move changed elements
+    printf("\nTest 2: Diff-based maintenance on update...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        struct customer_record_pk pk = { .customer_id = 1 };
+        struct customer_record c = {0};
+        kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+        assert(kvstore_get_customer_record(txn, &pk, &c, &kb) == KVSTORE_OK);
+        assert(c.num_users == 3);
+
+        // Rename bob, drop the last user slot, reorder the rest
+        free(c.users[2].username);
+        c.users[2].username = strdup("robert");
+        struct user_record tmp = c.users[0];
+        c.users[0] = c.users[2];
+        c.users[2] = tmp;
+        assert(kvstore_put_customer_record_with_all_indices(txn, &c, &kb) == KVSTORE_OK);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        txn = kvstore_txn_begin(db, true);
+        assert(owner_of(txn, "bob") == 0);
+        assert(owner_of(txn, "robert") == 1);
+        assert(owner_of(txn, "alice") == 1);
+        assert(count_prefix(txn, "cust_user:") == 5);
+        kvstore_txn_commit(txn);
+
+        // Removing a user removes just that entry
+        txn = kvstore_txn_begin(db, false);
+        assert(populate_key_buf_customer_record(&c, &kb) == KVSTORE_OK);
+        c.num_users = 2;  // Drops alice, now last
+        assert(kvstore_put_customer_record_with_all_indices(txn, &c, &kb) == KVSTORE_OK);
+        c.num_users = 3;
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        txn = kvstore_txn_begin(db, true);
+        assert(owner_of(txn, "alice") == 0);
+        assert(owner_of(txn, "admin") == 1);
+        assert(count_prefix(txn, "cust_user:") == 4);
+        assert(count_prefix(txn, "cust_uid:") == 4);
+        kvstore_txn_commit(txn);
+
+        free_customer(&c);
+        kvstore_key_buf_free(&kb);
+        printf("  ✓ Rename, reorder and removal leave exactly the right entries\n");
+    }
+
+    // TEST 3: Primary key change rewrites entries, delete removes them
+    printf("\nTest 3: Primary key change and delete...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        struct customer_record_pk pk = { .customer_id = 2 };
+        struct customer_record c = {0};
+        kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+        assert(kvstore_get_customer_record(txn, &pk, &c, &kb) == KVSTORE_OK);
+
+        c.customer_id = 7;
+        assert(kvstore_put_customer_record_with_all_indices(txn, &c, &kb) == KVSTORE_OK);
+        assert(owner_of(txn, "carol") == 7);
+        assert(count_prefix(txn, "cust_user:") == 4);
+
+        assert(populate_key_buf_customer_record(&c, &kb) == KVSTORE_OK);
+        assert(kvstore_del_customer_record_with_all_indices(txn, &kb) == KVSTORE_OK);
+        assert(owner_of(txn, "carol") == 0);
+        assert(owner_of(txn, "admin") == 1);
+        assert(count_prefix(txn, "cust_user:") == 2);
+        assert(count_prefix(txn, "cust_uid:") == 2);
+        assert(count_prefix(txn, "cust_name:") == 1);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        free_customer(&c);
+        kvstore_key_buf_free(&kb);
+        printf("  ✓ Entries follow the new primary key and vanish on delete\n");
+    }
+
+    // TEST 4: Set bits and plain array elements
+    printf("\nTest 4: Bitmap and array element sources...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        struct message_record m1 = { 1, 100, { (1u << 0) | (1u << 5), 1u << 1 }, { 7, 3, 7 } };
+        struct message_record m2 = { 1, 101, { 1u << 5, 0 }, { 3, 0, 0 } };
+        assert(kvstore_put_message_record_with_all_indices(txn, &m1, NULL) == KVSTORE_OK);
+        assert(kvstore_put_message_record_with_all_indices(txn, &m2, NULL) == KVSTORE_OK);
+
+        struct collect got;
+        assert(messages_with_flag(txn, 5, &got) == 2);
+        assert(got.uids[0] == 100 && got.uids[1] == 101);
+        assert(messages_with_flag(txn, 33, &got) == 1 && got.uids[0] == 100);
+        assert(messages_with_flag(txn, 1, &got) == 0);
+        assert(count_prefix(txn, "msg_flag:") == 4);
+
+        // Duplicate folders collapse to one entry
+        assert(count_prefix(txn, "msg_folder:") == 4);
+
+        // Clear bit 5 on m1 and set bit 6
+        kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+        assert(populate_key_buf_message_record(&m1, &kb) == KVSTORE_OK);
+        m1.user_flags[0] = (1u << 0) | (1u << 6);
+        assert(kvstore_put_message_record_with_all_indices(txn, &m1, &kb) == KVSTORE_OK);
+        assert(messages_with_flag(txn, 5, &got) == 1 && got.uids[0] == 101);
+        assert(messages_with_flag(txn, 6, &got) == 1 && got.uids[0] == 100);
+        assert(count_prefix(txn, "msg_flag:") == 4);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        kvstore_key_buf_free(&kb);
+        printf("  ✓ One entry per set bit and distinct element, updates move single bits\n");
+    }
+
+    kvstore_close(db);
+
+    // Benchmark: change one username of 1000
+    printf("\nBenchmark: %u updates changing 1 of 1000 usernames\n", updates);
+    {
+        const char *modes[] = { "full rewrite", "diff-based" };
+        double sec[2];
+
+        for (int mode = 0; mode < 2; mode++) {
+            db = kvstore_open_mem();
+            struct customer_record c = {0};
+            make_customer(&c, 42, 1000, NULL);
+
+            kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+            assert(kvstore_put_customer_record_with_all_indices(txn, &c, NULL) == KVSTORE_OK);
+            kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+            assert(populate_key_buf_customer_record(&c, &kb) == KVSTORE_OK);
+
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (uint32_t i = 0; i < updates; i++) {
+                struct user_record *u = &c.users[(i * 7919) % 1000];
+                char name[32];
+                snprintf(name, sizeof(name), "renamed%u", i);
+                free(u->username);
+                u->username = strdup(name);
+
+                if (mode == 0) {
+                    assert(kvstore_del_customer_record_with_all_indices(txn, &kb) == KVSTORE_OK);
+                    assert(kvstore_put_customer_record_with_all_indices(txn, &c, NULL) == KVSTORE_OK);
+                } else {
+                    assert(kvstore_put_customer_record_with_all_indices(txn, &c, &kb) == KVSTORE_OK);
+                }
+                assert(populate_key_buf_customer_record(&c, &kb) == KVSTORE_OK);
+            }
+            sec[mode] = elapsed_sec(&start);
+
+            assert(count_prefix(txn, "cust_user:") == 1000);
+            char last[32];
+            snprintf(last, sizeof(last), "renamed%u", updates - 1);
+            assert(owner_of(txn, last) == 42);
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+            printf("  %-12s: %8.1f us/update\n", modes[mode], sec[mode] * 1e6 / updates);
+            free_customer(&c);
+            kvstore_key_buf_free(&kb);
+            kvstore_close(db);
+        }
+        printf("  Speedup: %.1fx\n", sec[0] / sec[1]);
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,373 @@
+// Optimistic concurrency test: read-write transactions on the memory
+// backend run concurrently and validate their reads at commit. Checks key
+// and range (phantom) conflicts, values outliving a concurrent overwrite,
+// and no lost updates under kvstore_txn_run(); benchmarks throughput
+// against a single-writer lock as hot-key skew rises.
+// Usage: kvstore_occ_test [threads] [hot_percent]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record definitions
+// ------------------------
+
+struct mailbox_record {
+    uint32_t mailbox_id;
+    uint64_t modseq;
+    uint32_t exists;
+    char *name;
+};
+
+SERIALISE(mailbox_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(modseq, uint64_t),
+    SERIALISE_FIELD(exists, uint32_t),
+    SERIALISE_FIELD(name, charptr)
+)
+
+SERIALISE_DECLARE_KEYS(mailbox_record)
+
+SERIALISE_PRIMARY_KEY(mailbox_record, "mbox:",
+    SERIALISE_FIELD(mailbox_id, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(mailbox_record, "mbox_name:", by_name,
+    SERIALISE_FIELD(name, charptr),
+    SERIALISE_FIELD(mailbox_id, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(mailbox_record,
+    by_name, "mbox_name:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static void put_mailboxes(kvstore_t *db, uint32_t n) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+    for (uint32_t i = 0; i < n; i++) {
+        struct mailbox_record rec = { .mailbox_id = i, .name = "INBOX" };
+        assert(kvstore_put_mailbox_record_with_all_indices(txn, &rec, NULL) == KVSTORE_OK);
+    }
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+}
+
+// Deliver a message: bump the mailbox's counters
+static int deliver(kvstore_txn_t *txn, uint32_t mailbox_id) {
+    struct mailbox_record_pk pk = { mailbox_id };
+    struct mailbox_record rec;
+    kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+    int rc = kvstore_get_mailbox_record(txn, &pk, &rec, &kb);
+    if (rc != KVSTORE_OK) return rc;
+    rec.modseq++;
+    rec.exists++;
+    rc = kvstore_put_mailbox_record_with_all_indices(txn, &rec, &kb);
+    kvstore_key_buf_free(&kb);
+    free(rec.name);
+    return rc;
+}
+
+static uint64_t total_exists(kvstore_t *db, uint32_t n) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        struct mailbox_record_pk pk = { i };
+        struct mailbox_record rec;
+        assert(kvstore_get_mailbox_record(txn, &pk, &rec, NULL) == KVSTORE_OK);
+        total += rec.exists;
+        free(rec.name);
+    }
+    kvstore_txn_commit(txn);
+    return total;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Contention workload
+// ------------------------
+
+#define MAILBOXES    10000
+#define HOT          8          // Mailboxes that take the skewed share
+#define PER_TXN      2          // Deliveries per transaction
+#define TXNS         200        // Per thread
+#define WAIT_US      50         // I/O inside each transaction
+
+typedef struct {
+    kvstore_t *db;
+    pthread_mutex_t *writer;    // Single-writer lock, or NULL for optimistic
+    unsigned hot_percent;
+    uint64_t rng;
+    uint32_t picks[PER_TXN];
+    atomic_uint_fast64_t *attempts;
+} worker_t;
+
+static uint32_t pick(worker_t *w) {
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    uint32_t r = (uint32_t)(w->rng >> 32);
+    return r % 100 < w->hot_percent ? r % HOT : r % MAILBOXES;
+}
+
+// Read the mailboxes, wait on I/O (fetching the message, say), then write
+static int deliver_batch(kvstore_txn_t *txn, void *arg) {
+    worker_t *w = (worker_t*)arg;
+    atomic_fetch_add(w->attempts, 1);
+    struct mailbox_record recs[PER_TXN];
+    kvstore_key_buf_t kbs[PER_TXN];
+    for (size_t i = 0; i < PER_TXN; i++) {
+        struct mailbox_record_pk pk = { w->picks[i] };
+        kbs[i] = (kvstore_key_buf_t)KVSTORE_KEY_BUF_INIT;
+        assert(kvstore_get_mailbox_record(txn, &pk, &recs[i], &kbs[i]) == KVSTORE_OK);
+    }
+
+    struct timespec wait = { 0, WAIT_US * 1000 };
+    nanosleep(&wait, NULL);
+
+    int rc = KVSTORE_OK;
+    for (size_t i = 0; i < PER_TXN; i++) {
+        // The same mailbox twice: the second read saw the first write
+        if (i == 1 && w->picks[1] == w->picks[0]) {
+            if (rc == KVSTORE_OK) rc = deliver(txn, w->picks[1]);
+        } else {
+            recs[i].modseq++;
+            recs[i].exists++;
+            if (rc == KVSTORE_OK) {
+                rc = kvstore_put_mailbox_record_with_all_indices(txn, &recs[i], &kbs[i]);
+            }
+        }
+        kvstore_key_buf_free(&kbs[i]);
+        free(recs[i].name);
+    }
+    return rc;
+}
+
+static void* worker_main(void *arg) {
+    worker_t *w = (worker_t*)arg;
+    for (size_t t = 0; t < TXNS; t++) {
+        for (size_t i = 0; i < PER_TXN; i++) w->picks[i] = pick(w);
+        if (w->writer) {
+            pthread_mutex_lock(w->writer);
+            kvstore_txn_t *txn = kvstore_txn_begin(w->db, false);
+            assert(deliver_batch(txn, w) == KVSTORE_OK);
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+            pthread_mutex_unlock(w->writer);
+        } else {
+            assert(kvstore_txn_run(w->db, deliver_batch, w, 0) == KVSTORE_OK);
+        }
+    }
+    return NULL;
+}
+
+// Returns transactions per second; *retry_rate is attempts per commit
+static double run_workload(size_t nthreads, unsigned hot_percent, bool single_writer,
+                           double *retry_rate) {
+    kvstore_t *db = kvstore_open_mem();
+    put_mailboxes(db, MAILBOXES);
+
+    pthread_mutex_t writer = PTHREAD_MUTEX_INITIALIZER;
+    atomic_uint_fast64_t attempts = 0;
+    worker_t *workers = (worker_t*)calloc(nthreads, sizeof(worker_t));
+    pthread_t *threads = (pthread_t*)calloc(nthreads, sizeof(pthread_t));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < nthreads; i++) {
+        workers[i] = (worker_t){
+            .db = db, .writer = single_writer ? &writer : NULL,
+            .hot_percent = hot_percent, .rng = 0x9e3779b97f4a7c15ull * (i + 1),
+            .attempts = &attempts,
+        };
+        assert(pthread_create(&threads[i], NULL, worker_main, &workers[i]) == 0);
+    }
+    for (size_t i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+    double secs = elapsed_sec(&start);
+
+    // Every committed delivery counted exactly once
+    uint64_t commits = (uint64_t)nthreads * TXNS;
+    assert(total_exists(db, MAILBOXES) == commits * PER_TXN);
+    *retry_rate = (double)atomic_load(&attempts) / (double)commits;
+
+    free(threads);
+    free(workers);
+    kvstore_close(db);
+    return (double)commits / secs;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    size_t nthreads = argc > 1 ? (size_t)atoi(argv[1]) : 8;
+    int hot_arg = argc > 2 ? atoi(argv[2]) : -1;
+
+    printf("=== Optimistic Concurrency Test ===\n\n");
+
+    // TEST 1: A write to a key another transaction read fails its commit
+    printf("Test 1: Key conflicts...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        put_mailboxes(db, 10);
+
+        kvstore_txn_t *a = kvstore_txn_begin(db, false);
+        kvstore_txn_t *b = kvstore_txn_begin(db, false);
+        assert(deliver(a, 1) == KVSTORE_OK);
+        assert(deliver(b, 1) == KVSTORE_OK);
+        assert(kvstore_txn_commit(b) == KVSTORE_OK);
+        assert(kvstore_txn_commit(a) == KVSTORE_CONFLICT);
+        assert(total_exists(db, 10) == 1);
+
+        // Disjoint keys both commit; a blind write conflicts with nothing
+        a = kvstore_txn_begin(db, false);
+        b = kvstore_txn_begin(db, false);
+        assert(deliver(a, 2) == KVSTORE_OK);
+        assert(deliver(b, 3) == KVSTORE_OK);
+        struct mailbox_record rec = { .mailbox_id = 2, .exists = 5, .name = "Blind" };
+        kvstore_txn_t *c = kvstore_txn_begin(db, false);
+        char key_buf[] = "unrelated", val_buf[] = "v";
+        kvstore_val_t key = { key_buf, 9 }, val = { val_buf, 1 };
+        assert(kvstore_txn_put(c, "", &key, &val) == KVSTORE_OK);
+        assert(kvstore_txn_commit(a) == KVSTORE_OK);
+        assert(kvstore_txn_commit(b) == KVSTORE_OK);
+        assert(kvstore_txn_commit(c) == KVSTORE_OK);
+        assert(total_exists(db, 10) == 3);
+
+        // A read of a missing key conflicts with its creation
+        a = kvstore_txn_begin(db, false);
+        b = kvstore_txn_begin(db, false);
+        struct mailbox_record_pk pk = { 42 };
+        struct mailbox_record out;
+        assert(kvstore_get_mailbox_record(a, &pk, &out, NULL) == KVSTORE_NOTFOUND);
+        rec.mailbox_id = 42;
+        assert(kvstore_put_mailbox_record_with_all_indices(b, &rec, NULL) == KVSTORE_OK);
+        assert(kvstore_txn_commit(b) == KVSTORE_OK);
+        assert(kvstore_put_mailbox_record_with_all_indices(a, &rec, NULL) == KVSTORE_OK);
+        assert(kvstore_txn_commit(a) == KVSTORE_CONFLICT);
+        kvstore_close(db);
+        printf("  ✓ Read-modify-write race caught; disjoint and blind writes commit\n");
+    }
+
+    // TEST 2: Cursor ranges catch phantoms, up to where the cursor stopped
+    printf("\nTest 2: Range conflicts...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        char key_buf[8], val_buf[] = "x";
+        for (int i = 0; i < 10; i++) {
+            snprintf(key_buf, sizeof(key_buf), "k%02d", i);
+            kvstore_val_t key = { key_buf, 3 }, val = { val_buf, 1 };
+            assert(kvstore_txn_put(txn, "events", &key, &val) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        // Scan k01 up to k05 while another transaction inserts: past the
+        // key the cursor stopped on first, then inside the range
+        const char *inserts[] = { "k05x", "k02x" };
+        for (int phantom = 0; phantom < 2; phantom++) {
+            kvstore_txn_t *a = kvstore_txn_begin(db, false);
+            kvstore_txn_t *b = kvstore_txn_begin(db, false);
+            char start_buf[] = "k01";
+            kvstore_val_t start = { start_buf, 3 }, k;
+            kvstore_cursor_t *cur = kvstore_cursor_open(a, "events", &start);
+            size_t n = 0;
+            while (kvstore_cursor_get(cur, &k, NULL) == KVSTORE_OK &&
+                   memcmp(k.data, "k05", 3) < 0) {
+                n++;
+                kvstore_cursor_next(cur);
+            }
+            kvstore_cursor_close(cur);
+            assert(n == 4);
+
+            kvstore_val_t key = { (void*)inserts[phantom], 4 }, val = { val_buf, 1 };
+            assert(kvstore_txn_put(b, "events", &key, &val) == KVSTORE_OK);
+            assert(kvstore_txn_commit(b) == KVSTORE_OK);
+
+            char sum_buf[] = "sum";
+            kvstore_val_t sum_key = { sum_buf, 3 };
+            assert(kvstore_txn_put(a, "", &sum_key, &val) == KVSTORE_OK);
+            assert(kvstore_txn_commit(a) == (phantom ? KVSTORE_CONFLICT : KVSTORE_OK));
+        }
+        kvstore_close(db);
+        printf("  ✓ Insert inside a scanned range conflicts, past its end doesn't\n");
+    }
+
+    // TEST 3: Values read stay valid when a concurrent commit replaces them
+    printf("\nTest 3: Reads across commits...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        put_mailboxes(db, 10);
+
+        kvstore_txn_t *reader = kvstore_txn_begin(db, true);
+        char key_buf[] = "note", v1[] = "first", v2[] = "second";
+        kvstore_val_t key = { key_buf, 4 }, val = { v1, 5 }, out;
+        kvstore_txn_t *w = kvstore_txn_begin(db, false);
+        assert(kvstore_txn_put(w, "", &key, &val) == KVSTORE_OK);
+        assert(kvstore_txn_commit(w) == KVSTORE_OK);
+        assert(kvstore_txn_get(reader, "", &key, &out) == KVSTORE_OK);
+
+        for (int i = 0; i < 3; i++) {
+            w = kvstore_txn_begin(db, false);
+            val = (kvstore_val_t){ v2, 6 };
+            assert(kvstore_txn_put(w, "", &key, &val) == KVSTORE_OK);
+            assert(kvstore_txn_commit(w) == KVSTORE_OK);
+        }
+        w = kvstore_txn_begin(db, false);
+        assert(kvstore_txn_drop_table(w, "") == KVSTORE_OK);
+        assert(kvstore_txn_commit(w) == KVSTORE_OK);
+
+        assert(out.size == 5 && memcmp(out.data, "first", 5) == 0);
+        assert(kvstore_txn_get(reader, "", &key, &out) == KVSTORE_NOTFOUND);
+        kvstore_txn_commit(reader);
+        kvstore_close(db);
+        printf("  ✓ Replaced values freed only after the reader ends\n");
+    }
+
+    // TEST 4: Concurrent increments through kvstore_txn_run lose nothing
+    printf("\nTest 4: Retry on conflict...\n");
+    {
+        double retry_rate;
+        run_workload(4, 100, false, &retry_rate);
+        printf("  ✓ 4 threads on %u hot mailboxes: no lost updates, %.2f attempts per commit\n",
+               HOT, retry_rate);
+    }
+
+    // Benchmark: each transaction reads two mailboxes, waits on I/O, then
+    // writes them back; hot_percent of picks go to HOT mailboxes
+    printf("\nBenchmark: %zu threads, %d txns each, %d us wait per txn\n",
+           nthreads, TXNS, WAIT_US);
+    {
+        unsigned sweep[] = { 0, 50, 90, 99 };
+        size_t nsweep = hot_arg >= 0 ? 1 : sizeof(sweep) / sizeof(sweep[0]);
+        printf("  %-6s %16s %16s %10s %14s\n", "hot %", "single txn/s", "optimistic txn/s",
+               "speedup", "attempts/txn");
+        for (size_t i = 0; i < nsweep; i++) {
+            unsigned hot = hot_arg >= 0 ? (unsigned)hot_arg : sweep[i];
+            double unused, retry_rate;
+            double single = run_workload(nthreads, hot, true, &unused);
+            double occ = run_workload(nthreads, hot, false, &retry_rate);
+            printf("  %-6u %16.0f %16.0f %9.1fx %14.2f\n", hot, single, occ,
+                   occ / single, retry_rate);
+        }
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,326 @@
+// Partial (filtered) secondary index test
+// An "unseen by mailbox" index that only holds unseen messages, compared
+// with indexing every message on its flags. Usage: kvstore_partial_index_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+#define FLAG_SEEN 0x1
+#define MAILBOXES 16
+
+// ------------------------
+// Record with a partial index
+// ------------------------
+
+struct message_partial {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    char *subject;
+    uint64_t size;
+    uint32_t flags;
+};
+
+SERIALISE(message_partial,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(subject, charptr),
+    SERIALISE_FIELD(size, uint64_t),
+    SERIALISE_FIELD(flags, uint32_t)
+)
+
+SERIALISE_DECLARE_KEYS(message_partial)
+
+SERIALISE_PRIMARY_KEY(message_partial, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+static inline bool is_unseen(struct message_partial *rec) {
+    return !(rec->flags & FLAG_SEEN);
+}
+
+SERIALISE_SECONDARY_KEY_WHERE(message_partial, "msg_unseen:", unseen, is_unseen,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(message_partial,
+    unseen, "msg_unseen:"
+)
+
+// ------------------------
+// Same record indexing every message on flags
+// ------------------------
+
+struct message_full {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    char *subject;
+    uint64_t size;
+    uint32_t flags;
+};
+
+SERIALISE(message_full,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(subject, charptr),
+    SERIALISE_FIELD(size, uint64_t),
+    SERIALISE_FIELD(flags, uint32_t)
+)
+
+SERIALISE_DECLARE_KEYS(message_full)
+
+SERIALISE_PRIMARY_KEY(message_full, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_full, "msg_flags:", by_flags,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(flags, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(message_full,
+    by_flags, "msg_flags:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+// One message in 10 is unseen
+static uint32_t initial_flags(uint32_t uid) {
+    return uid % 10 == 0 ? 0 : FLAG_SEEN;
+}
+
+static void index_size(kvstore_t *db, const char *prefix, size_t *entries, size_t *bytes) {
+    *entries = *bytes = 0;
+    size_t plen = strlen(prefix);
+    kvstore_val_t start = { (void*)prefix, plen };
+
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+    kvstore_val_t k, v;
+    while (cur && kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK) {
+        if (k.size < plen || memcmp(k.data, prefix, plen) != 0) break;
+        (*entries)++;
+        *bytes += k.size + v.size;
+        if (kvstore_cursor_next(cur) != KVSTORE_OK) break;
+    }
+    kvstore_cursor_close(cur);
+    kvstore_txn_commit(txn);
+}
+
+// Unseen uids of a mailbox via the partial index, checked against records
+static size_t unseen_in_mailbox(kvstore_txn_t *txn, uint32_t mailbox_id) {
+    struct message_partial_unseen_key start = { .mailbox_id = mailbox_id, .uid = 0 };
+    kvstore_cursor_t *cur = kvstore_cursor_message_partial_unseen(txn, &start);
+    size_t n = 0;
+
+    kvstore_val_t k, v;
+    while (cur && kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK) {
+        if (k.size < 11 || memcmp(k.data, "msg_unseen:", 11) != 0) break;
+
+        struct message_partial_unseen_key key;
+        deserialise_message_partial_unseen((char*)k.data + 11, &key);
+        if (key.mailbox_id != mailbox_id) break;
+
+        struct message_partial_pk pk;
+        deserialise_message_partial_pk((char*)v.data, &pk);
+        struct message_partial rec;
+        assert(kvstore_get_message_partial(txn, &pk, &rec, NULL) == KVSTORE_OK);
+        assert(is_unseen(&rec) && rec.uid == key.uid);
+        free(rec.subject);
+        n++;
+
+        if (kvstore_cursor_next(cur) != KVSTORE_OK) break;
+    }
+    kvstore_cursor_close(cur);
+    return n;
+}
+
+// Index must hold exactly the unseen messages
+static void check_partial(kvstore_t *db, size_t expect_unseen) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    size_t total = 0;
+    for (uint32_t mbox = 0; mbox < MAILBOXES; mbox++) total += unseen_in_mailbox(txn, mbox);
+    kvstore_txn_commit(txn);
+
+    size_t entries, bytes;
+    index_size(db, "msg_unseen:", &entries, &bytes);
+    assert(total == expect_unseen && entries == expect_unseen);
+}
+
+static int set_flags(kvstore_txn_t *txn, uint32_t uid, uint32_t flags, const char *subject) {
+    struct message_partial_pk pk = { .mailbox_id = uid % MAILBOXES, .uid = uid };
+    struct message_partial msg = {0};
+    kvstore_key_buf_t key_buf = KVSTORE_KEY_BUF_INIT;
+
+    int rc = kvstore_get_message_partial(txn, &pk, &msg, &key_buf);
+    if (rc == KVSTORE_OK) {
+        char *old_subject = msg.subject;
+        msg.flags = flags;
+        if (subject) msg.subject = (char*)subject;
+        rc = kvstore_put_message_partial_with_all_indices(txn, &msg, &key_buf);
+        free(old_subject);
+    }
+    kvstore_key_buf_free(&key_buf);
+    return rc;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Generic workload over either record type: ingest, then update the
+// subject of every message (flags unchanged), both via the key buffer
+#define RUN_WORKLOAD(rec, db, records, ingest_sec, update_sec) do { \
+    char subject[64]; \
+    struct timespec start; \
+    clock_gettime(CLOCK_MONOTONIC, &start); \
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false); \
+    for (uint32_t uid = 1; uid <= (records); uid++) { \
+        struct rec msg = { .mailbox_id = uid % MAILBOXES, .uid = uid, \
+                           .size = 2048, .flags = initial_flags(uid) }; \
+        snprintf(subject, sizeof(subject), "Subject %u", uid); \
+        msg.subject = subject; \
+        assert(SER_CAT(kvstore_put_, SER_CAT(rec, _with_all_indices))(txn, &msg, NULL) == KVSTORE_OK); \
+    } \
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK); \
+    ingest_sec = elapsed_sec(&start); \
+    \
+    clock_gettime(CLOCK_MONOTONIC, &start); \
+    txn = kvstore_txn_begin(db, false); \
+    for (uint32_t uid = 1; uid <= (records); uid++) { \
+        struct SER_CAT(rec, _pk) pk = { .mailbox_id = uid % MAILBOXES, .uid = uid }; \
+        struct rec msg = {0}; \
+        kvstore_key_buf_t key_buf = KVSTORE_KEY_BUF_INIT; \
+        assert(SER_CAT(kvstore_get_, rec)(txn, &pk, &msg, &key_buf) == KVSTORE_OK); \
+        char *old_subject = msg.subject; \
+        msg.subject = "Re: updated"; \
+        assert(SER_CAT(kvstore_put_, SER_CAT(rec, _with_all_indices))(txn, &msg, &key_buf) == KVSTORE_OK); \
+        free(old_subject); \
+        kvstore_key_buf_free(&key_buf); \
+    } \
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK); \
+    update_sec = elapsed_sec(&start); \
+} while (0)
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+
+    printf("=== Partial Index Test ===\n\n");
+
+    kvstore_t *db = kvstore_open_mem();
+    size_t unseen = 0;
+
+    // TEST 1: Only matching records get index entries
+    printf("Test 1: Inserting 1000 messages, 10%% unseen...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        for (uint32_t uid = 1; uid <= 1000; uid++) {
+            struct message_partial msg = { .mailbox_id = uid % MAILBOXES, .uid = uid,
+                                           .subject = "Hello", .size = 100,
+                                           .flags = initial_flags(uid) };
+            assert(kvstore_put_message_partial_with_all_indices(txn, &msg, NULL) == KVSTORE_OK);
+            if (is_unseen(&msg)) unseen++;
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        check_partial(db, unseen);
+        printf("  ✓ %zu index entries for 1000 messages\n", unseen);
+    }
+
+    // TEST 2: Transitions into and out of the index
+    printf("\nTest 2: Flag transitions...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+
+        // present -> absent: read the message
+        assert(set_flags(txn, 10, FLAG_SEEN, NULL) == KVSTORE_OK);
+        assert(set_flags(txn, 20, FLAG_SEEN, NULL) == KVSTORE_OK);
+        unseen -= 2;
+
+        // absent -> present: mark as unread
+        assert(set_flags(txn, 11, 0, NULL) == KVSTORE_OK);
+        unseen++;
+
+        // absent -> absent and present -> present: subject edits only
+        assert(set_flags(txn, 12, FLAG_SEEN, "Edited") == KVSTORE_OK);
+        assert(set_flags(txn, 30, 0, "Edited") == KVSTORE_OK);
+
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        check_partial(db, unseen);
+
+        txn = kvstore_txn_begin(db, true);
+        assert(unseen_in_mailbox(txn, 11 % MAILBOXES) >= 1);
+        kvstore_txn_commit(txn);
+        printf("  ✓ Index follows seen/unseen transitions\n");
+    }
+
+    // TEST 3: Deletes skip absent entries
+    printf("\nTest 3: Deleting seen and unseen messages...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        uint32_t uids[] = { 12, 30, 40 };   // seen, unseen, unseen
+        for (size_t i = 0; i < 3; i++) {
+            struct message_partial_pk pk = { .mailbox_id = uids[i] % MAILBOXES, .uid = uids[i] };
+            struct message_partial msg = {0};
+            kvstore_key_buf_t key_buf = KVSTORE_KEY_BUF_INIT;
+            assert(kvstore_get_message_partial(txn, &pk, &msg, &key_buf) == KVSTORE_OK);
+            if (is_unseen(&msg)) unseen--;
+            assert(kvstore_del_message_partial_with_all_indices(txn, &key_buf) == KVSTORE_OK);
+            free(msg.subject);
+            kvstore_key_buf_free(&key_buf);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        check_partial(db, unseen);
+        printf("  ✓ %zu unseen messages remain indexed\n", unseen);
+    }
+
+    kvstore_close(db);
+
+    // Benchmark: full flags index vs partial unseen index
+    printf("\nBenchmark: %u messages, 10%% unseen, then %u subject updates\n",
+           records, records);
+    {
+        double full_ingest, full_update, part_ingest, part_update;
+        size_t full_entries, full_bytes, part_entries, part_bytes;
+
+        kvstore_t *full = kvstore_open_mem();
+        RUN_WORKLOAD(message_full, full, records, full_ingest, full_update);
+        index_size(full, "msg_flags:", &full_entries, &full_bytes);
+        kvstore_close(full);
+
+        kvstore_t *part = kvstore_open_mem();
+        RUN_WORKLOAD(message_partial, part, records, part_ingest, part_update);
+        index_size(part, "msg_unseen:", &part_entries, &part_bytes);
+        kvstore_close(part);
+
+        printf("  full index:    %6zu entries, %8zu bytes, ingest %8.0f/s, update %8.0f/s\n",
+               full_entries, full_bytes, records / full_ingest, records / full_update);
+        printf("  partial index: %6zu entries, %8zu bytes, ingest %8.0f/s, update %8.0f/s\n",
+               part_entries, part_bytes, records / part_ingest, records / part_update);
+        printf("  index size %.1f%% of full, ingest %.2fx, update %.2fx\n",
+               100.0 * part_bytes / full_bytes, full_ingest / part_ingest,
+               full_update / part_update);
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
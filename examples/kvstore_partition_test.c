@@ -0,0 +1,381 @@
+// Time-bucket partition test: messages routed to per-month tables with
+// their index entries, read back across buckets and expired a month at a
+// time. Benchmarks dropping a month against deleting it row by row.
+// Usage: kvstore_partition_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+extern const struct kvstore_ops* kvstore_mem_ops(void);
+
+// ------------------------
+// Record definitions
+// ------------------------
+
+// Same fields twice: partitioned by month, and one flat table
+#define MESSAGE_FIELDS \
+    SERIALISE_FIELD(mailbox_id, uint32_t), \
+    SERIALISE_FIELD(uid, uint32_t), \
+    SERIALISE_FIELD(received, timespec), \
+    SERIALISE_FIELD(subject, charptr)
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    struct timespec received;
+    char *subject;
+};
+
+struct flat_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    struct timespec received;
+    char *subject;
+};
+
+SERIALISE(message_record, MESSAGE_FIELDS)
+SERIALISE(flat_record, MESSAGE_FIELDS)
+
+SERIALISE_DECLARE_KEYS(message_record)
+SERIALISE_DECLARE_KEYS(flat_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_mbox_time:", by_mailbox_time,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(received, timespec),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_mailbox_time, "msg_mbox_time:"
+)
+
+SERIALISE_PARTITION(message_record, "msg@", received, KVSTORE_BUCKET_MONTH)
+
+SERIALISE_PRIMARY_KEY(flat_record, "fmsg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(flat_record, "fmsg_mbox_time:", by_mailbox_time,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(received, timespec),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(flat_record,
+    by_mailbox_time, "fmsg_mbox_time:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+// 2024-01-01, 2024-02-01, 2024-03-01, 2024-04-01 00:00 UTC
+#define JAN 1704067200
+#define FEB 1706745600
+#define MAR 1709251200
+#define APR 1711929600
+
+// Message i of n, spread evenly over January to March
+static struct message_record make_msg(uint32_t i, uint32_t n) {
+    struct message_record rec = {
+        .mailbox_id = i % 2,
+        .uid = i / 2,
+        .received = { JAN + (time_t)((uint64_t)i * (APR - JAN) / n), 0 },
+        .subject = "hello",
+    };
+    return rec;
+}
+
+typedef struct {
+    size_t n;
+    int last_month;
+    bool time_ordered;
+} scan_t;
+
+// Buckets come in time order (records in primary key order within each)
+static int scan_count(struct message_record *rec, void *arg) {
+    scan_t *s = (scan_t*)arg;
+    struct tm tm;
+    time_t t = rec->received.tv_sec;
+    gmtime_r(&t, &tm);
+    int month = tm.tm_year * 12 + tm.tm_mon;
+    if (s->n && month < s->last_month) s->time_ordered = false;
+    s->last_month = month;
+    s->n++;
+    free(rec->subject);
+    return KVSTORE_OK;
+}
+
+static int count_bucket(const char *table, int64_t start, int64_t end, void *arg) {
+    (void)table;
+    assert(end > start);
+    (*(size_t*)arg)++;
+    return 0;
+}
+
+// Mailbox listing through the stitched index cursor: times ascending
+static size_t list_mailbox(kvstore_txn_t *txn, uint32_t mailbox, int64_t *first) {
+    struct message_record_by_mailbox_time_key k = { .mailbox_id = mailbox };
+    size_t plen = strlen("msg_mbox_time:");
+    size_t ksz = serialise_message_record_by_mailbox_time_prefix_size(&k, 1);
+    char prefix[64], keybuf[64];
+    serialise_message_record_by_mailbox_time(keybuf, &k);
+    memcpy(prefix, "msg_mbox_time:", plen);
+    memcpy(prefix + plen, keybuf, ksz);
+
+    kvstore_bucket_cursor_t *cur = kvstore_bucket_cursor_open(txn, "msg@", prefix, plen + ksz);
+    assert(cur);
+    size_t n = 0;
+    uint64_t prev = 0;
+    kvstore_val_t key, val;
+    while (kvstore_bucket_cursor_get(cur, &key, &val) == KVSTORE_OK) {
+        struct message_record_by_mailbox_time_key got;
+        deserialise_message_record_by_mailbox_time((char*)key.data + plen, &got);
+        assert(got.mailbox_id == mailbox);
+        uint64_t t = (uint64_t)got.received.tv_sec;
+        assert(t >= prev);
+        if (!n && first) *first = (int64_t)t;
+        prev = t;
+        n++;
+        kvstore_bucket_cursor_next(cur);
+    }
+    kvstore_bucket_cursor_close(cur);
+    return n;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Fill three months, then expire January
+static void run_expiry(kvstore_t *db, const char *label) {
+    uint32_t n = 3000;
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+    for (uint32_t i = 0; i < n; i++) {
+        struct message_record rec = make_msg(i, n);
+        assert(kvstore_put_message_record_partitioned(txn, &rec, NULL) == KVSTORE_OK);
+    }
+
+    size_t buckets = 0;
+    assert(kvstore_bucket_each(txn, "msg@", count_bucket, &buckets) == KVSTORE_OK);
+    assert(buckets == 3);
+
+    scan_t s = { .time_ordered = true };
+    assert(kvstore_scan_message_record_partitioned(txn, scan_count, &s) == KVSTORE_OK);
+    assert(s.n == n && s.time_ordered);
+    int64_t first;
+    assert(list_mailbox(txn, 1, &first) == n / 2 && first < FEB);
+
+    // Expire January: one bucket goes, with its index entries
+    struct timespec feb = { FEB, 0 };
+    size_t dropped;
+    assert(kvstore_expire_message_record_before(txn, &feb, &dropped) == KVSTORE_OK);
+    assert(dropped == 1);
+
+    size_t jan = 0;
+    for (uint32_t i = 0; i < n; i++) jan += make_msg(i, n).received.tv_sec < FEB;
+    memset(&s, 0, sizeof(s));
+    s.time_ordered = true;
+    kvstore_scan_message_record_partitioned(txn, scan_count, &s);
+    assert(s.n == n - jan);
+    size_t listed = list_mailbox(txn, 0, &first) + list_mailbox(txn, 1, NULL);
+    assert(listed == n - jan && first >= FEB);
+
+    struct message_record_pk pk = { 0, 0 };
+    struct message_record got;
+    assert(kvstore_get_message_record_partitioned(txn, &pk, &got, NULL) == KVSTORE_NOTFOUND);
+
+    // Expiring again drops nothing more
+    assert(kvstore_expire_message_record_before(txn, &feb, &dropped) == KVSTORE_OK);
+    assert(dropped == 0);
+    buckets = 0;
+    kvstore_bucket_each(txn, "msg@", count_bucket, &buckets);
+    assert(buckets == 2);
+
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+    printf("  ✓ %s: expiring January drops %zu records and their index entries\n",
+           label, jan);
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 12000;
+
+    printf("=== Time-bucket Partition Test ===\n\n");
+
+    // TEST 1: Bucket boundaries and names
+    printf("Test 1: Buckets...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        char name[KVSTORE_BUCKET_NAME_MAX];
+
+        // Leap day, December and the instant before the epoch
+        assert(kvstore_bucket_table(txn, "msg@", 1709208000, KVSTORE_BUCKET_MONTH, false, name) == KVSTORE_OK);
+        assert(strcmp(name, "msg@20240201000000") == 0);
+        assert(kvstore_bucket_table(txn, "msg@", 1735689599, KVSTORE_BUCKET_MONTH, false, name) == KVSTORE_OK);
+        assert(strcmp(name, "msg@20241201000000") == 0);
+        assert(kvstore_bucket_table(txn, "msg@", -1, KVSTORE_BUCKET_MONTH, false, name) == KVSTORE_OK);
+        assert(strcmp(name, "msg@19691201000000") == 0);
+        assert(kvstore_bucket_table(txn, "msg@", FEB + 90000, KVSTORE_BUCKET_DAY, false, name) == KVSTORE_OK);
+        assert(strcmp(name, "msg@20240202000000") == 0);
+        assert(kvstore_bucket_table(txn, "msg@", FEB + 5000, 3600, false, name) == KVSTORE_OK);
+        assert(strcmp(name, "msg@20240201010000") == 0);
+
+        // Naming doesn't register; creating does, once
+        size_t buckets = 0;
+        assert(kvstore_bucket_each(txn, "msg@", count_bucket, &buckets) == KVSTORE_NOTFOUND);
+        assert(kvstore_bucket_table(txn, "msg@", FEB, KVSTORE_BUCKET_MONTH, true, name) == KVSTORE_OK);
+        assert(kvstore_bucket_table(txn, "msg@", FEB + 5, KVSTORE_BUCKET_MONTH, true, name) == KVSTORE_OK);
+        assert(kvstore_bucket_each(txn, "msg@", count_bucket, &buckets) == KVSTORE_OK);
+        assert(buckets == 1);
+
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        kvstore_close(db);
+        printf("  ✓ Calendar months, days and hours map to UTC-named tables\n");
+    }
+
+    // TEST 2: Partitioned reads and writes
+    printf("\nTest 2: Routing...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        uint32_t n = 600;
+        for (uint32_t i = 0; i < n; i++) {
+            struct message_record rec = make_msg(i, n);
+            assert(kvstore_put_message_record_partitioned(txn, &rec, NULL) == KVSTORE_OK);
+        }
+
+        // Nothing lands in table ""
+        struct message_record_pk pk = { 1, 250 };
+        struct message_record got;
+        assert(kvstore_get_message_record(txn, &pk, &got, NULL) == KVSTORE_NOTFOUND);
+
+        // Every record is found in its bucket
+        for (uint32_t i = 0; i < n; i++) {
+            struct message_record want = make_msg(i, n);
+            struct message_record_pk k = { want.mailbox_id, want.uid };
+            assert(kvstore_get_message_record_partitioned(txn, &k, &got, NULL) == KVSTORE_OK);
+            assert(got.received.tv_sec == want.received.tv_sec);
+            free(got.subject);
+        }
+
+        // Update in place, with the key buffer from a partitioned get
+        kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+        assert(kvstore_get_message_record_partitioned(txn, &pk, &got, &kb) == KVSTORE_OK);
+        free(got.subject);
+        got.subject = "updated";
+        got.received.tv_nsec = 5;
+        assert(kvstore_put_message_record_partitioned(txn, &got, &kb) == KVSTORE_OK);
+        kvstore_key_buf_free(&kb);
+        struct message_record again;
+        assert(kvstore_get_message_record_partitioned(txn, &pk, &again, NULL) == KVSTORE_OK);
+        assert(strcmp(again.subject, "updated") == 0);
+        free(again.subject);
+        assert(list_mailbox(txn, 1, NULL) == n / 2);
+
+        assert(kvstore_del_message_record_partitioned(txn, &got) == KVSTORE_OK);
+        assert(kvstore_get_message_record_partitioned(txn, &pk, &again, NULL) == KVSTORE_NOTFOUND);
+        assert(list_mailbox(txn, 1, NULL) == n / 2 - 1);
+        printf("  ✓ Records and index entries live in their bucket tables\n");
+
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        kvstore_close(db);
+    }
+
+    // TEST 3: Expiry, with and without the backend's drop_table
+    printf("\nTest 3: Expiry...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        run_expiry(db, "drop_table");
+        kvstore_close(db);
+
+        struct kvstore_ops no_drop = *kvstore_mem_ops();
+        no_drop.drop_table = NULL;
+        db = kvstore_open(":memory:", &no_drop);
+        run_expiry(db, "key-by-key fallback");
+        kvstore_close(db);
+    }
+
+    // Benchmark: expire a month by dropping its bucket vs row deletes
+    printf("\nBenchmark: %u messages over three months, expire January\n", records);
+    {
+        kvstore_t *part = kvstore_open_mem(), *flat = kvstore_open_mem();
+        kvstore_txn_t *ptxn = kvstore_txn_begin(part, false);
+        kvstore_txn_t *ftxn = kvstore_txn_begin(flat, false);
+        for (uint32_t i = 0; i < records; i++) {
+            struct message_record rec = make_msg(i, records);
+            struct flat_record frec = { rec.mailbox_id, rec.uid, rec.received, rec.subject };
+            assert(kvstore_put_message_record_partitioned(ptxn, &rec, NULL) == KVSTORE_OK);
+            assert(kvstore_put_flat_record_with_all_indices(ftxn, &frec, NULL) == KVSTORE_OK);
+        }
+
+        // Row deletes: find January through the index, delete each record
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t deleted = 0;
+        for (uint32_t mbox = 0; mbox < 2; mbox++) {
+            for (;;) {
+                struct flat_record_by_mailbox_time_key k = { .mailbox_id = mbox };
+                kvstore_cursor_t *cur = kvstore_cursor_flat_record_by_mailbox_time(ftxn, &k);
+                kvstore_val_t key, val;
+                if (kvstore_cursor_get(cur, &key, &val) != KVSTORE_OK) {
+                    kvstore_cursor_close(cur);
+                    break;
+                }
+                struct flat_record_by_mailbox_time_key got;
+                deserialise_flat_record_by_mailbox_time((char*)key.data + strlen("fmsg_mbox_time:"), &got);
+                kvstore_cursor_close(cur);
+                if (got.mailbox_id != mbox || got.received.tv_sec >= FEB) break;
+
+                struct flat_record_pk pk = { got.mailbox_id, got.uid };
+                struct flat_record rec;
+                kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+                assert(kvstore_get_flat_record(ftxn, &pk, &rec, &kb) == KVSTORE_OK);
+                assert(kvstore_del_flat_record_with_all_indices(ftxn, &kb) == KVSTORE_OK);
+                kvstore_key_buf_free(&kb);
+                free(rec.subject);
+                deleted++;
+            }
+        }
+        double rows = elapsed_sec(&start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        struct timespec feb = { FEB, 0 };
+        size_t dropped;
+        assert(kvstore_expire_message_record_before(ptxn, &feb, &dropped) == KVSTORE_OK);
+        double drop = elapsed_sec(&start);
+        assert(dropped == 1 && deleted > 0);
+
+        printf("  %-14s %10s %12s\n", "method", "records", "time us");
+        printf("  %-14s %10zu %12.0f\n", "row deletes", deleted, rows * 1e6);
+        printf("  %-14s %10zu %12.0f  (%.0fx)\n", "bucket drop", deleted, drop * 1e6, rows / drop);
+
+        kvstore_txn_commit(ptxn);
+        kvstore_txn_commit(ftxn);
+        kvstore_close(part);
+        kvstore_close(flat);
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
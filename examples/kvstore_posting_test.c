@@ -0,0 +1,413 @@
+// Posting-list index test: chunked, bit-packed primary key lists per element
+// checked against a one-entry-per-pair index over the same records.
+// Benchmarks space and scan speed of the two layouts.
+// Usage: kvstore_posting_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record definitions
+// ------------------------
+
+// Same fields twice: one record type per index layout
+#define MESSAGE_FIELDS \
+    SERIALISE_FIELD(mailbox_id, uint32_t), \
+    SERIALISE_FIELD(uid, uint32_t), \
+    SERIALISE_FIELD(to, charptr), \
+    SERIALISE_FIELD(user_flags, bit32, 1), \
+    SERIALISE_FIELD(subject, charptr)
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    char *to;
+    uint32_t user_flags[1];
+    char *subject;
+};
+
+struct pair_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    char *to;
+    uint32_t user_flags[1];
+    char *subject;
+};
+
+SERIALISE(message_record, MESSAGE_FIELDS)
+SERIALISE(pair_record, MESSAGE_FIELDS)
+
+SERIALISE_DECLARE_KEYS(message_record)
+SERIALISE_DECLARE_KEYS(pair_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_PRIMARY_KEY(pair_record, "pmsg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+// Posting lists
+SERIALISE_POSTING_KEY(message_record, "msg_to:", by_to,
+    KV_EACH_VALUE(to, charptr))
+
+SERIALISE_POSTING_KEY(message_record, "msg_flag:", by_flag,
+    KV_EACH_SET_BIT(user_flags, 1))
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_to, "msg_to:",
+    by_flag, "msg_flag:"
+)
+
+// One entry per (element, primary key)
+SERIALISE_MULTI_KEY(pair_record, "pmsg_to:", by_to,
+    KV_EACH_VALUE(to, charptr))
+
+SERIALISE_MULTI_KEY(pair_record, "pmsg_flag:", by_flag,
+    KV_EACH_SET_BIT(user_flags, 1))
+
+SERIALISE_FINALIZE_INDICES(pair_record,
+    by_to, "pmsg_to:",
+    by_flag, "pmsg_flag:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static const char *recipients[] = {
+    "team@example.com", "alice@example.com", "bob@example.com", "carol@example.com",
+};
+#define NRECIPIENTS 4
+
+// Most mail goes to the team list
+static const char *pick_to(uint32_t r) {
+    return recipients[r % 8 < 5 ? 0 : 1 + r % 3];
+}
+
+// One or two flags, all 32 in use
+static uint32_t pick_flags(uint32_t r) {
+    return (1u << (r >> 8) % 32) | ((r >> 16) % 4 == 0 ? 1u << 3 : 0);
+}
+
+static uint32_t rng_state = 12345;
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Model: one slot per (mailbox, uid) in [0, 2) x [0, UIDS)
+#define UIDS 4000
+
+typedef struct {
+    bool present;
+    const char *to;
+    uint32_t flags;
+} model_t;
+
+static void put_both(kvstore_txn_t *txn, model_t *m, uint32_t mbox, uint32_t uid,
+                     const char *to, uint32_t flags) {
+    struct message_record rec = { mbox, uid, (char*)to, { flags }, "subject" };
+    struct pair_record prec = { mbox, uid, (char*)to, { flags }, "subject" };
+    model_t *slot = &m[mbox * UIDS + uid];
+
+    kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT, pkb = KVSTORE_KEY_BUF_INIT;
+    if (slot->present) {
+        struct message_record old = { mbox, uid, (char*)slot->to, { slot->flags }, "subject" };
+        struct pair_record pold = { mbox, uid, (char*)slot->to, { slot->flags }, "subject" };
+        assert(populate_key_buf_message_record(&old, &kb) == KVSTORE_OK);
+        assert(populate_key_buf_pair_record(&pold, &pkb) == KVSTORE_OK);
+    }
+    assert(kvstore_put_message_record_with_all_indices(txn, &rec, slot->present ? &kb : NULL) == KVSTORE_OK);
+    assert(kvstore_put_pair_record_with_all_indices(txn, &prec, slot->present ? &pkb : NULL) == KVSTORE_OK);
+    kvstore_key_buf_free(&kb);
+    kvstore_key_buf_free(&pkb);
+
+    slot->present = true;
+    slot->to = to;
+    slot->flags = flags;
+}
+
+static void del_both(kvstore_txn_t *txn, model_t *m, uint32_t mbox, uint32_t uid) {
+    model_t *slot = &m[mbox * UIDS + uid];
+    if (!slot->present) return;
+
+    struct message_record old = { mbox, uid, (char*)slot->to, { slot->flags }, "subject" };
+    struct pair_record pold = { mbox, uid, (char*)slot->to, { slot->flags }, "subject" };
+    kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT, pkb = KVSTORE_KEY_BUF_INIT;
+    assert(populate_key_buf_message_record(&old, &kb) == KVSTORE_OK);
+    assert(populate_key_buf_pair_record(&pold, &pkb) == KVSTORE_OK);
+    assert(kvstore_del_message_record_with_all_indices(txn, &kb) == KVSTORE_OK);
+    assert(kvstore_del_pair_record_with_all_indices(txn, &pkb) == KVSTORE_OK);
+    kvstore_key_buf_free(&kb);
+    kvstore_key_buf_free(&pkb);
+    slot->present = false;
+}
+
+// Collected primary keys as mailbox * UIDS + uid
+typedef struct {
+    uint32_t *v;
+    size_t n, cap;
+} list_t;
+
+static void list_push(list_t *l, uint32_t v) {
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 1024;
+        l->v = (uint32_t*)realloc(l->v, l->cap * sizeof(*l->v));
+    }
+    l->v[l->n++] = v;
+}
+
+static int collect_msg(struct message_record_pk *pk, void *arg) {
+    list_push((list_t*)arg, pk->mailbox_id * UIDS + pk->uid);
+    return 0;
+}
+
+static int collect_pair(struct pair_record_pk *pk, void *arg) {
+    list_push((list_t*)arg, pk->mailbox_id * UIDS + pk->uid);
+    return 0;
+}
+
+// Posting list, pair index and model agree (in order) for every element
+static void check_all(kvstore_txn_t *txn, model_t *m) {
+    for (int e = 0; e < NRECIPIENTS + 32; e++) {
+        list_t got = {0}, pairs = {0}, want = {0};
+        for (uint32_t s = 0; s < 2 * UIDS; s++) {
+            if (!m[s].present) continue;
+            bool hit = e < NRECIPIENTS ? strcmp(m[s].to, recipients[e]) == 0
+                                       : (m[s].flags >> (e - NRECIPIENTS)) & 1;
+            if (hit) list_push(&want, s);
+        }
+
+        int rc;
+        if (e < NRECIPIENTS) {
+            struct message_record_by_to_key k = { .value = (char*)recipients[e] };
+            struct pair_record_by_to_key pk = { .value = (char*)recipients[e] };
+            rc = kvstore_lookup_each_message_record_by_to(txn, &k, collect_msg, &got);
+            kvstore_lookup_each_pair_record_by_to(txn, &pk, collect_pair, &pairs);
+        } else {
+            struct message_record_by_flag_key k = { .value = (uint32_t)(e - NRECIPIENTS) };
+            struct pair_record_by_flag_key pk = { .value = (uint32_t)(e - NRECIPIENTS) };
+            rc = kvstore_lookup_each_message_record_by_flag(txn, &k, collect_msg, &got);
+            kvstore_lookup_each_pair_record_by_flag(txn, &pk, collect_pair, &pairs);
+        }
+        assert(rc == (want.n ? KVSTORE_OK : KVSTORE_NOTFOUND));
+        assert(got.n == want.n && pairs.n == want.n);
+        assert(!want.n || memcmp(got.v, want.v, want.n * sizeof(uint32_t)) == 0);
+        assert(!want.n || memcmp(pairs.v, want.v, want.n * sizeof(uint32_t)) == 0);
+        free(got.v);
+        free(pairs.v);
+        free(want.v);
+    }
+}
+
+// Entries and bytes stored under a key prefix
+static size_t prefix_bytes(kvstore_txn_t *txn, const char *prefix, size_t *entries) {
+    size_t len = strlen(prefix), bytes = 0;
+    kvstore_val_t start = { (void*)prefix, len }, k, v;
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+    *entries = 0;
+    while (cur && kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK &&
+           k.size >= len && memcmp(k.data, prefix, len) == 0) {
+        bytes += k.size + v.size;
+        (*entries)++;
+        kvstore_cursor_next(cur);
+    }
+    kvstore_cursor_close(cur);
+    return bytes;
+}
+
+static int count_pk(kvstore_val_t *pk, void *arg) {
+    (void)pk;
+    (*(size_t*)arg)++;
+    return 0;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+
+    printf("=== Posting-list Index Test ===\n\n");
+
+    // TEST 1: Appends stay pending until enough pile up
+    printf("Test 1: Pending appends...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        model_t *m = (model_t*)calloc(2 * UIDS, sizeof(model_t));
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+
+        for (uint32_t uid = 0; uid < 10; uid++) put_both(txn, m, 0, uid, "team@example.com", 1);
+        size_t entries;
+        size_t bytes = prefix_bytes(txn, "msg_to:", &entries);
+        assert(entries == 1);
+        check_all(txn, m);
+
+        // Crossing the pending limit re-encodes in place: still one chunk
+        for (uint32_t uid = 10; uid < 200; uid++) put_both(txn, m, 0, uid, "team@example.com", 1);
+        size_t packed = prefix_bytes(txn, "msg_to:", &entries);
+        assert(entries == 1);
+        check_all(txn, m);
+        printf("  ✓ 10 keys pending in %zu bytes; 200 keys in one %zu byte chunk\n", bytes, packed);
+
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        kvstore_close(db);
+        free(m);
+    }
+
+    // TEST 2: Random inserts, updates and deletes against the pair index
+    printf("\nTest 2: Randomized maintenance...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        model_t *m = (model_t*)calloc(2 * UIDS, sizeof(model_t));
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+
+        // Fill in random order so chunks take inserts in the middle and split
+        for (uint32_t i = 0; i < 2 * UIDS; i++) {
+            uint32_t s = (uint32_t)(((uint64_t)i * 7919) % (2 * UIDS));
+            uint32_t r = rng();
+            put_both(txn, m, s / UIDS, s % UIDS, pick_to(r), pick_flags(r));
+        }
+        check_all(txn, m);
+
+        for (int round = 0; round < 3; round++) {
+            for (int op = 0; op < 3000; op++) {
+                uint32_t r = rng(), s = rng() % (2 * UIDS);
+                if (r % 4 == 0) del_both(txn, m, s / UIDS, s % UIDS);
+                else put_both(txn, m, s / UIDS, s % UIDS, pick_to(r), pick_flags(r));
+            }
+            check_all(txn, m);
+        }
+
+        size_t entries;
+        prefix_bytes(txn, "msg_to:", &entries);
+        assert(entries > NRECIPIENTS);  // The team list split
+        printf("  ✓ 9000 random ops over %u records match pairs and model (%zu chunks)\n",
+               2 * UIDS, entries);
+
+        // Primary key change moves every element
+        struct message_record_pk pk = { 0, 0 };
+        model_t *slot = &m[0];
+        if (!slot->present) put_both(txn, m, 0, 0, "alice@example.com", 3);
+        struct message_record rec = {0};
+        kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+        assert(kvstore_get_message_record(txn, &pk, &rec, &kb) == KVSTORE_OK);
+        del_both(txn, m, 1, UIDS - 1);
+        rec.mailbox_id = 1;
+        rec.uid = UIDS - 1;
+        assert(kvstore_put_message_record_with_all_indices(txn, &rec, &kb) == KVSTORE_OK);
+        kvstore_key_buf_free(&kb);
+
+        struct pair_record_pk ppk = { 0, 0 };
+        struct pair_record prec = {0};
+        assert(kvstore_get_pair_record(txn, &ppk, &prec, &kb) == KVSTORE_OK);
+        prec.mailbox_id = 1;
+        prec.uid = UIDS - 1;
+        assert(kvstore_put_pair_record_with_all_indices(txn, &prec, &kb) == KVSTORE_OK);
+        kvstore_key_buf_free(&kb);
+
+        m[2 * UIDS - 1] = m[0];
+        m[0].present = false;
+        check_all(txn, m);
+        free(rec.to);
+        free(rec.subject);
+        free(prec.to);
+        free(prec.subject);
+        printf("  ✓ Primary key change moves the record's entries\n");
+
+        // Deleting everything leaves no chunks behind
+        for (uint32_t s = 0; s < 2 * UIDS; s++) del_both(txn, m, s / UIDS, s % UIDS);
+        check_all(txn, m);
+        prefix_bytes(txn, "msg_to:", &entries);
+        size_t flag_entries;
+        prefix_bytes(txn, "msg_flag:", &flag_entries);
+        assert(entries == 0 && flag_entries == 0);
+        printf("  ✓ Deleting every record removes every chunk\n");
+
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        kvstore_close(db);
+        free(m);
+    }
+
+    // Benchmark: space and scan speed against one entry per pair
+    printf("\nBenchmark: %u messages, 62%% to team@example.com\n", records);
+    {
+        kvstore_t *db = kvstore_open_mem();
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        for (uint32_t i = 0; i < records; i++) {
+            uint32_t r = rng();
+            const char *to = pick_to(r);
+            struct message_record rec = { 1, i, (char*)to, { 1u << (r % 4) }, "subject" };
+            struct pair_record prec = { 1, i, (char*)to, { 1u << (r % 4) }, "subject" };
+            assert(kvstore_put_message_record_with_all_indices(txn, &rec, NULL) == KVSTORE_OK);
+            assert(kvstore_put_pair_record_with_all_indices(txn, &prec, NULL) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        txn = kvstore_txn_begin(db, true);
+        size_t pe, ne;
+        size_t posting = prefix_bytes(txn, "msg_to:", &pe);
+        size_t pairs = prefix_bytes(txn, "pmsg_to:", &ne);
+        printf("  %-10s %8s %10s %12s\n", "layout", "entries", "bytes", "bytes/key");
+        printf("  %-10s %8zu %10zu %12.2f\n", "pairs", ne, pairs, (double)pairs / records);
+        printf("  %-10s %8zu %10zu %12.2f  (%.0fx smaller)\n", "posting", pe, posting,
+               (double)posting / records, (double)pairs / posting);
+
+        struct message_record_by_to_key tk = { .value = "team@example.com" };
+        size_t team_len = serialise_message_record_by_to_size(&tk);
+        char *team = (char*)malloc(team_len);
+        serialise_message_record_by_to(team, &tk);
+        int reps = 20;
+        size_t n1 = 0, n2 = 0;
+        struct timespec start;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < reps; r++) {
+            kvstore_index_scan(txn, "pmsg_to:", team, team_len, count_pk, &n1);
+        }
+        double pair_scan = elapsed_sec(&start) / reps;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < reps; r++) {
+            kvstore_posting_scan(txn, "msg_to:", team, team_len, 8, count_pk, &n2);
+        }
+        double posting_scan = elapsed_sec(&start) / reps;
+
+        assert(n1 == n2 && n1 > 0);
+        n1 /= reps;
+        printf("\n  Scan team@example.com (%zu keys):\n", n1);
+        printf("  %-10s %10.0f us %8.1f M keys/s\n", "pairs", pair_scan * 1e6,
+               (double)n1 / pair_scan / 1e6);
+        printf("  %-10s %10.0f us %8.1f M keys/s  (%.1fx)\n", "posting", posting_scan * 1e6,
+               (double)n1 / posting_scan / 1e6, pair_scan / posting_scan);
+
+        free(team);
+        kvstore_txn_commit(txn);
+        kvstore_close(db);
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,267 @@
+// Read-ahead test: cursor end keys and the file backend's read ahead.
+// Checks that bounded cursors stop at their end key on the memory, file and
+// sharded backends, that the file backend's cursors read the same pages
+// with read ahead as without (none past the end key), and that cursors
+// closed mid-scan clean up. Benchmarks cold full and range scans with read
+// ahead off and with several windows, and counts the pages each leaves in
+// the page cache.
+// Usage: kvstore_readahead_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE         // mincore(), in the fixture
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_file.h"
+#include "../include/kvstore_mem.h"
+#include "../include/kvstore_shard.h"
+#include "kvstore_file_fixture.h"
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static kvstore_t* open_store(int readahead) {
+    kvstore_file_opts_t opts = KVSTORE_FILE_OPTS_INIT;
+    opts.readahead_pages = readahead;
+    kvstore_t *db = kvstore_open_file(dir, &opts);
+    assert(db);
+    return db;
+}
+
+static uint64_t page_reads(kvstore_t *db, uint64_t *ahead) {
+    kvstore_file_stats_t stats = stats_of(db);
+    if (ahead) *ahead = stats.readahead_pages;
+    return stats.page_reads;
+}
+
+// Keys a cursor over [lo, hi) returns, and their bytes (lo/hi UINT32_MAX =
+// unbounded)
+static size_t scan(kvstore_t *db, uint32_t lo, uint32_t hi, size_t *bytes) {
+    char lk[16], hk[16];
+    make_key(lk, lo);
+    make_key(hk, hi);
+    kvstore_val_t start = { lk, strlen(lk) }, end = { hk, strlen(hk) };
+
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "kv", lo == UINT32_MAX ? NULL : &start);
+    assert(cur);
+    if (hi != UINT32_MAX) assert(kvstore_cursor_set_end(cur, &end) == KVSTORE_OK);
+
+    size_t n = 0, b = 0;
+    kvstore_val_t k, v;
+    while (kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK) {
+        n++;
+        b += k.size + v.size;
+        kvstore_cursor_next(cur);
+    }
+    kvstore_cursor_close(cur);
+    kvstore_txn_commit(txn);
+    if (bytes) *bytes = b;
+    return n;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 400000;
+
+    printf("=== KVStore Read-Ahead Test ===\n\n");
+    fixture_init("ra");
+
+    // TEST 1: End keys on the memory, sharded and file backends
+    printf("Test 1: Cursor end keys...\n");
+    {
+        kvstore_t *mem = kvstore_open_mem();
+        kvstore_t *shards[3] = { kvstore_open_mem(), kvstore_open_mem(), kvstore_open_mem() };
+        kvstore_t *sharded = kvstore_shard_open(shards, 3, NULL);
+        kvstore_t *file = open_store(0);
+        assert(sharded);
+        kvstore_t *dbs[3] = { mem, sharded, file };
+        for (int d = 0; d < 3; d++) {
+            if (d < 2) {
+                kvstore_txn_t *txn = kvstore_txn_begin(dbs[d], false);
+                char v[100];
+                memset(v, 'x', sizeof(v));
+                for (uint32_t i = 0; i < 2000; i++) {
+                    char k[16];
+                    make_key(k, i);
+                    kvstore_val_t key = { k, strlen(k) }, val = { v, sizeof(v) };
+                    assert(kvstore_txn_put(txn, "kv", &key, &val) == KVSTORE_OK);
+                }
+                assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+            } else {
+                fill(file, 2000, 100);
+            }
+
+            assert(scan(dbs[d], 10, 20, NULL) == 10);
+            assert(scan(dbs[d], 10, 10, NULL) == 0);
+            assert(scan(dbs[d], 20, 10, NULL) == 0);
+            assert(scan(dbs[d], 1990, 5000, NULL) == 10);
+            assert(scan(dbs[d], UINT32_MAX, 5, NULL) == 5);
+
+            // A bound can be moved, or removed, after the cursor has reached it
+            kvstore_txn_t *txn = kvstore_txn_begin(dbs[d], true);
+            kvstore_cursor_t *cur = kvstore_cursor_open(txn, "kv", NULL);
+            char k[16];
+            make_key(k, 300);
+            kvstore_val_t end = { k, strlen(k) }, key;
+            assert(kvstore_cursor_set_end(cur, &end) == KVSTORE_OK);
+            size_t n = 0;
+            while (kvstore_cursor_get(cur, &key, NULL) == KVSTORE_OK && ++n) kvstore_cursor_next(cur);
+            assert(n == 300);
+            make_key(k, 900);
+            assert(kvstore_cursor_set_end(cur, &end) == KVSTORE_OK);
+            while (kvstore_cursor_get(cur, &key, NULL) == KVSTORE_OK && ++n) kvstore_cursor_next(cur);
+            assert(n == 900);
+            assert(kvstore_cursor_set_end(cur, NULL) == KVSTORE_OK);
+            while (kvstore_cursor_get(cur, &key, NULL) == KVSTORE_OK && ++n) kvstore_cursor_next(cur);
+            assert(n == 2000);
+            kvstore_cursor_close(cur);
+            kvstore_txn_commit(txn);
+        }
+        kvstore_close(mem);
+        kvstore_close(sharded);
+        kvstore_close(file);
+        for (int i = 0; i < 3; i++) kvstore_close(shards[i]);
+        reset();
+        printf("  ✓ Bounded scans stop at the end key, which can be moved or removed\n");
+    }
+
+    // TEST 2: Bounded file cursors agree with the memory backend, over the
+    // data file with a memtable of puts and deletes on top
+    printf("\nTest 2: Bounded file cursors...\n");
+    {
+        kvstore_t *db = open_store(0);
+        kvstore_t *mem = kvstore_open_mem();
+        churn(db, mem, 60000, 80000);
+        assert(kvstore_file_checkpoint(db) == KVSTORE_OK);
+        churn(db, mem, 60000, 8000);
+
+        size_t total = 0;
+        for (int i = 0; i < 50; i++) {
+            uint32_t lo = (uint32_t)(next_rand() % 60000);
+            uint32_t hi = lo + (uint32_t)(next_rand() % (i < 40 ? 500 : 30000));
+            total += compare_range(db, mem, lo, hi);
+        }
+        uint64_t ahead;
+        page_reads(db, &ahead);
+        assert(ahead > 0);
+        kvstore_close(db);
+        kvstore_close(mem);
+        reset();
+        printf("  ✓ 50 ranges, %zu keys, match with %llu pages read ahead\n",
+               total, (unsigned long long)ahead);
+    }
+
+    // TEST 3: Read ahead reads the pages the walk would, and none past the
+    // end key
+    printf("\nTest 3: No reads past the end...\n");
+    {
+        kvstore_t *db = open_store(0);
+        fill(db, 40000, 100);
+        kvstore_close(db);
+
+        uint32_t ranges[4][2] = {
+            { UINT32_MAX, UINT32_MAX }, { 5000, 25000 }, { 100, 350 }, { 39990, 50000 },
+        };
+        for (int r = 0; r < 4; r++) {
+            uint64_t reads[2], ahead[2];
+            size_t keys[2];
+            for (int on = 0; on < 2; on++) {
+                db = open_store(on ? 0 : -1);
+                uint64_t before = page_reads(db, NULL);
+                keys[on] = scan(db, ranges[r][0], ranges[r][1], NULL);
+                reads[on] = page_reads(db, &ahead[on]) - before;
+                kvstore_close(db);
+            }
+            assert(keys[0] == keys[1] && reads[0] == reads[1] && ahead[0] == 0);
+            if (r < 2) assert(ahead[1] > 0 && ahead[1] < reads[1]);
+        }
+
+        // A parallel scan bounds each part by the next one's start
+        db = open_store(0);
+        uint64_t before = page_reads(db, NULL);
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+        size_t counts[4] = { 0 };
+        assert(kvstore_scan_parallel(txn, "kv", NULL, NULL, 4, count_part, counts) == KVSTORE_OK);
+        kvstore_txn_commit(txn);
+        assert(counts[0] + counts[1] + counts[2] + counts[3] == 40000);
+        uint64_t parallel = page_reads(db, NULL) - before;
+        kvstore_close(db);
+        db = open_store(-1);
+        before = page_reads(db, NULL);
+        scan(db, UINT32_MAX, UINT32_MAX, NULL);
+        assert(page_reads(db, NULL) - before == parallel);
+        kvstore_close(db);
+        printf("  ✓ Full, range and parallel scans read the same %llu pages either way\n",
+               (unsigned long long)parallel);
+
+        // Closing a cursor, and its transaction, with reads still in flight
+        db = open_store(0);
+        for (int i = 0; i < 20; i++) {
+            txn = kvstore_txn_begin(db, true);
+            kvstore_cursor_t *cur = kvstore_cursor_open(txn, "kv", NULL);
+            for (int n = 0; n < 400 + i * 97; n++) kvstore_cursor_next(cur);
+            kvstore_cursor_close(cur);
+            kvstore_txn_abort(txn);
+        }
+        kvstore_close(db);
+        reset();
+        printf("  ✓ Cursors closed mid-read-ahead\n");
+    }
+
+    // Benchmark: cold scans with and without read ahead
+    printf("\nBenchmark: %u records, cold data file\n", records);
+    {
+        kvstore_t *db = open_store(0);
+        fill(db, records, 200);
+        kvstore_file_stats_t stats;
+        assert(kvstore_file_stats(db, &stats) == KVSTORE_OK);
+        kvstore_close(db);
+        printf("  data file %.1f MiB\n", (double)stats.data_bytes / (1024 * 1024));
+
+        int windows[] = { -1, 32, 0, 2048 };
+        printf("  %-28s %10s %10s %10s %10s\n", "scan", "MB/s", "pages", "ahead", "cached");
+        for (int range = 0; range < 2; range++) {
+            uint32_t lo = range ? records / 4 : UINT32_MAX;
+            uint32_t hi = range ? lo + records / 10 : UINT32_MAX;
+            for (size_t r = 0; r < sizeof(windows) / sizeof(windows[0]); r++) {
+                db = open_store(windows[r]);
+                evict_data();
+                uint64_t ahead, before = page_reads(db, NULL);
+
+                double start = now_sec();
+                size_t bytes;
+                size_t n = scan(db, lo, hi, &bytes);
+                double elapsed = now_sec() - start;
+                uint64_t reads = page_reads(db, &ahead) - before;
+                assert(n == (range ? records / 10 : records));
+
+                char label[48];
+                if (windows[r] < 0) {
+                    snprintf(label, sizeof(label), "%s, no read ahead", range ? "10% range" : "full");
+                } else {
+                    snprintf(label, sizeof(label), "%s, ahead %d pages", range ? "10% range" : "full",
+                             windows[r] ? windows[r] : 256);
+                }
+                printf("  %-28s %10.1f %10llu %10llu %10zu\n", label,
+                       (double)bytes / elapsed / 1e6, (unsigned long long)reads,
+                       (unsigned long long)ahead, cached_pages());
+                kvstore_close(db);
+            }
+        }
+        reset();
+    }
+
+    rmdir(dir);
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
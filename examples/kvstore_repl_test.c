@@ -0,0 +1,369 @@
+// Log-shipping replication test: primary and follower in two processes
+// Verifies the follower converges to the primary, also after concurrent
+// commits to the same keys, that a batch failing to apply consumes no
+// frames, and reports sustained replication throughput. Usage: kvstore_repl_test [records] [batch]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_repl.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record definition
+// ------------------------
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    char *subject;
+    char *sender;
+    uint64_t size;
+    uint32_t flags;
+    uint64_t thread_id;
+};
+
+SERIALISE(message_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(subject, charptr),
+    SERIALISE_FIELD(sender, charptr),
+    SERIALISE_FIELD(size, uint64_t),
+    SERIALISE_FIELD(flags, uint32_t),
+    SERIALISE_FIELD(thread_id, uint64_t)
+)
+
+SERIALISE_DECLARE_KEYS(message_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_thread:", by_thread,
+    SERIALISE_FIELD(thread_id, uint64_t)
+)
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_thread, "msg_thread:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+// Content summary exchanged between processes to check convergence
+struct db_summary {
+    uint64_t entries;
+    uint64_t hash;
+    kvstore_repl_stats_t stats;
+};
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static void summarise(kvstore_t *db, struct db_summary *sum) {
+    memset(sum, 0, sizeof(*sum));
+    sum->hash = 1469598103934665603ull;
+
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", NULL);
+
+    kvstore_val_t k, v;
+    while (cur && kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK) {
+        sum->hash = fnv1a(sum->hash, k.data, k.size);
+        sum->hash = fnv1a(sum->hash, v.data, v.size);
+        sum->entries++;
+        if (kvstore_cursor_next(cur) != KVSTORE_OK) break;
+    }
+
+    kvstore_cursor_close(cur);
+    kvstore_txn_commit(txn);
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void make_message(struct message_record *msg, uint32_t mailbox_id,
+                         uint32_t uid, const char *subject, const char *sender) {
+    memset(msg, 0, sizeof(*msg));
+    msg->mailbox_id = mailbox_id;
+    msg->uid = uid;
+    msg->subject = (char*)subject;
+    msg->sender = (char*)sender;
+    msg->size = 1024 + uid;
+    msg->flags = uid & 0x7;
+    msg->thread_id = ((uint64_t)mailbox_id << 32) | uid;
+}
+
+// ------------------------
+// Follower process
+// ------------------------
+
+static int run_follower(int stream_fd, int result_fd) {
+    kvstore_t *db = kvstore_open_mem();
+    kvstore_repl_follower_t *f = kvstore_repl_follower_new(db, stream_fd, 0);
+
+    int rc = kvstore_repl_follower_run(f);
+
+    struct db_summary sum;
+    summarise(db, &sum);
+    kvstore_repl_follower_stats(f, &sum.stats);
+
+    ssize_t n = write(result_fd, &sum, sizeof(sum));
+
+    kvstore_repl_follower_free(f);
+    kvstore_close(db);
+    return (rc == KVSTORE_OK && n == (ssize_t)sizeof(sum)) ? 0 : 1;
+}
+
+// Commits rounds of writes to the same 8 keys as the other writers: the
+// follower holds the last of them only if frames ship in commit order
+struct shared_writer {
+    kvstore_t *db;
+    int id;
+};
+
+static void* shared_writer(void *arg) {
+    struct shared_writer *w = (struct shared_writer*)arg;
+    for (uint32_t round = 0; round < 500; round++) {
+        int rc;
+        do {
+            kvstore_txn_t *txn = kvstore_txn_begin(w->db, false);
+            for (uint32_t k = 0; k < 8; k++) {
+                char key[16], val[32];
+                int vn = snprintf(val, sizeof(val), "writer %d round %u", w->id, round);
+                kvstore_val_t kv = { key, (size_t)snprintf(key, sizeof(key), "shared:%u", k) };
+                kvstore_val_t vv = { val, (size_t)vn };
+                assert(kvstore_txn_put(txn, "", &kv, &vv) == KVSTORE_OK);
+            }
+            rc = kvstore_txn_commit(txn);
+        } while (rc == KVSTORE_CONFLICT);
+        assert(rc == KVSTORE_OK);
+    }
+    return NULL;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+    uint32_t batch = argc > 2 ? (uint32_t)atoi(argv[2]) : 100;
+
+    printf("=== Replication Test ===\n\n");
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int sv[2], res[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    assert(pipe(res) == 0);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        close(sv[0]);
+        close(res[0]);
+        _exit(run_follower(sv[1], res[1]));
+    }
+    close(sv[1]);
+    close(res[1]);
+
+    kvstore_t *inner = kvstore_open_mem();
+    kvstore_t *db = kvstore_repl_primary_open(inner, sv[0]);
+    assert(db != NULL);
+
+    // TEST 1: Inserts, an index-changing update and a delete are shipped
+    printf("Test 1: Replicating inserts, update and delete...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        struct message_record msg;
+
+        make_message(&msg, 1, 1, "Hello", "alice@example.com");
+        assert(kvstore_put_message_record_with_all_indices(txn, &msg, NULL) == KVSTORE_OK);
+        make_message(&msg, 1, 2, "Re: Hello", "bob@example.com");
+        assert(kvstore_put_message_record_with_all_indices(txn, &msg, NULL) == KVSTORE_OK);
+        make_message(&msg, 1, 3, "Lunch", "carol@example.com");
+        assert(kvstore_put_message_record_with_all_indices(txn, &msg, NULL) == KVSTORE_OK);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        // Move message (1, 2) to another thread: index entry is replaced
+        txn = kvstore_txn_begin(db, false);
+        struct message_record_pk pk = { .mailbox_id = 1, .uid = 2 };
+        struct message_record cur = {0};
+        kvstore_key_buf_t key_buf = KVSTORE_KEY_BUF_INIT;
+        assert(kvstore_get_message_record(txn, &pk, &cur, &key_buf) == KVSTORE_OK);
+        cur.thread_id = 42;
+        assert(kvstore_put_message_record_with_all_indices(txn, &cur, &key_buf) == KVSTORE_OK);
+        kvstore_key_buf_free(&key_buf);
+        free(cur.subject);
+        free(cur.sender);
+
+        pk.uid = 3;
+        assert(kvstore_del_message_record(txn, &pk) == KVSTORE_OK);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        // Read-only transactions ship nothing
+        txn = kvstore_txn_begin(db, true);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        assert(kvstore_repl_primary_seq(db) == 2);
+        printf("  ✓ Shipped %llu commits\n",
+               (unsigned long long)kvstore_repl_primary_seq(db));
+    }
+
+    // TEST 2: Sustained replication throughput
+    printf("\nTest 2: Replicating %u records in batches of %u...\n", records, batch);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    {
+        char subject[64];
+        for (uint32_t i = 0; i < records; i += batch) {
+            kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+            for (uint32_t j = i; j < i + batch && j < records; j++) {
+                struct message_record msg;
+                snprintf(subject, sizeof(subject), "Message number %u", j);
+                make_message(&msg, 2 + j / 10000, j, subject, "bulk@example.com");
+                assert(kvstore_put_message_record_with_all_indices(txn, &msg, NULL) == KVSTORE_OK);
+            }
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        }
+    }
+    double ship_sec = elapsed_sec(&start);
+
+    // TEST 3: Concurrent commits reach the log in commit order
+    printf("\nTest 3: Concurrent commits to the same keys...\n");
+    {
+        uint64_t seq = kvstore_repl_primary_seq(db);
+        pthread_t threads[4];
+        struct shared_writer writers[4];
+        for (int i = 0; i < 4; i++) {
+            writers[i] = (struct shared_writer){ db, i };
+            assert(pthread_create(&threads[i], NULL, shared_writer, &writers[i]) == 0);
+        }
+        for (int i = 0; i < 4; i++) pthread_join(threads[i], NULL);
+        assert(kvstore_repl_primary_seq(db) == seq + 4 * 500);
+
+        // A table name the op header can't hold is refused, not shipped
+        char *table = (char*)malloc(70000);
+        memset(table, 't', 69999);
+        table[69999] = '\0';
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        kvstore_val_t k = { "k", 1 }, v = { "v", 1 };
+        assert(kvstore_txn_put(txn, table, &k, &v) == KVSTORE_ERROR);
+        kvstore_txn_abort(txn);
+        free(table);
+        printf("  ✓ 4 writers, 2000 commits shipped with consecutive seqs\n");
+        printf("  ✓ An oversize table name is refused\n");
+    }
+    uint64_t primary_seq = kvstore_repl_primary_seq(db);
+
+    // Closing the stream lets the follower finish and report
+    kvstore_close(db);
+    close(sv[0]);
+
+    struct db_summary remote;
+    assert(read(res[0], &remote, sizeof(remote)) == (ssize_t)sizeof(remote));
+    double total_sec = elapsed_sec(&start);
+
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // TEST 4: Follower converged to the primary
+    printf("\nTest 4: Verifying follower contents...\n");
+    {
+        struct db_summary local;
+        summarise(inner, &local);
+
+        assert(remote.stats.applied_seq == primary_seq);
+        assert(remote.entries == local.entries);
+        assert(remote.hash == local.hash);
+        printf("  ✓ Follower matches primary: %llu entries, applied seq %llu\n",
+               (unsigned long long)remote.entries,
+               (unsigned long long)remote.stats.applied_seq);
+    }
+
+    // TEST 5: A good frame followed by one with an unknown op type
+    printf("\nTest 5: A batch that fails to apply consumes nothing...\n");
+    {
+        int pfd[2];
+        assert(pipe(pfd) == 0);
+        kvstore_t *src = kvstore_open_mem();
+        kvstore_t *pdb = kvstore_repl_primary_open(src, pfd[1]);
+        kvstore_txn_t *txn = kvstore_txn_begin(pdb, false);
+        kvstore_val_t k = { "k", 1 }, v = { "v", 1 };
+        assert(kvstore_txn_put(txn, "", &k, &v) == KVSTORE_OK);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        char bad[KVSTORE_REPL_FRAME_HDR + KVSTORE_REPL_OP_HDR + 1], *p = bad;
+        SER_WRITE_U32(p, sizeof(bad) - 4);
+        SER_WRITE_U64(p, 2);
+        SER_WRITE_U64(p, 0);
+        SER_WRITE_U32(p, 1);
+        SER_WRITE_U8(p, 9);
+        SER_WRITE_U16(p, 0);
+        SER_WRITE_U32(p, 1);
+        SER_WRITE_U32(p, 0);
+        *p = 'x';
+        assert(write(pfd[1], bad, sizeof(bad)) == (ssize_t)sizeof(bad));
+        close(pfd[1]);
+
+        kvstore_t *copy = kvstore_open_mem();
+        kvstore_repl_follower_t *f = kvstore_repl_follower_new(copy, pfd[0], 0);
+        kvstore_repl_stats_t stats;
+        for (int i = 0; i < 2; i++) {
+            assert(kvstore_repl_follower_poll(f, 1000, NULL) == KVSTORE_ERROR);
+            kvstore_repl_follower_stats(f, &stats);
+            assert(stats.applied_seq == 0 && stats.received_seq == 0);
+        }
+        txn = kvstore_txn_begin(copy, true);
+        assert(kvstore_txn_get(txn, "", &k, &v) == KVSTORE_NOTFOUND);
+        kvstore_txn_commit(txn);
+
+        kvstore_repl_follower_free(f);
+        close(pfd[0]);
+        kvstore_close(copy);
+        kvstore_close(pdb);
+        kvstore_close(src);
+        printf("  ✓ Failed batch rolled back and left in the stream\n");
+    }
+
+    printf("\nBenchmark:\n");
+    printf("  primary commit:     %.0f records/s (%.3f s)\n", records / ship_sec, ship_sec);
+    printf("  end-to-end applied: %.0f records/s, %.1f MB/s of log (%.3f s)\n",
+           records / total_sec, remote.stats.applied_bytes / total_sec / 1e6, total_sec);
+    printf("  follower batches:   %llu for %llu commits (%llu ops)\n",
+           (unsigned long long)remote.stats.batches,
+           (unsigned long long)remote.stats.applied_commits,
+           (unsigned long long)remote.stats.applied_ops);
+    printf("  follower lag:       last %.3f ms, max %.3f ms\n",
+           remote.stats.lag_ns / 1e6, remote.stats.max_lag_ns / 1e6);
+
+    close(res[0]);
+    kvstore_close(inner);
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
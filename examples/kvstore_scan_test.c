@@ -0,0 +1,343 @@
+// Parallel range scan test: partitioned cursors over one read transaction
+// Checks partitioned scans against a serial cursor and reports scan
+// throughput by thread count. Usage: kvstore_scan_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_shard.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record definition
+// ------------------------
+
+#define FLAG_SEEN 0x1
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    char *subject;
+    uint64_t size;
+    uint32_t flags;
+};
+
+SERIALISE(message_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(subject, charptr),
+    SERIALISE_FIELD(size, uint64_t),
+    SERIALISE_FIELD(flags, uint32_t)
+)
+
+SERIALISE_DECLARE_KEYS(message_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_flags:", by_flags,
+    SERIALISE_FIELD(flags, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_flags, "msg_flags:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+#define MAX_THREADS 8
+#define MAILBOXES 100
+
+// Per-partition accumulators, padded so workers don't share cache lines
+struct totals {
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t size;
+    uint64_t unseen;
+    uint64_t last_key;      // Ordering check within a partition
+    char pad[24];
+};
+
+static void make_message(struct message_record *msg, uint32_t mailbox_id,
+                         uint32_t uid, char *subject) {
+    memset(msg, 0, sizeof(*msg));
+    msg->mailbox_id = mailbox_id;
+    msg->uid = uid;
+    msg->subject = subject;
+    msg->size = 1024 + (uid * 37) % 65536;
+    msg->flags = (uid % 3 == 0) ? 0 : FLAG_SEEN;
+}
+
+// Records are loaded in key order so the sorted-array backend appends
+static void load(kvstore_t *db, uint32_t records) {
+    char subject[64];
+    uint32_t per_mailbox = (records + MAILBOXES - 1) / MAILBOXES;
+    uint32_t n = 0;
+
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+    for (uint32_t mbox = 0; mbox < MAILBOXES && n < records; mbox++) {
+        for (uint32_t uid = 1; uid <= per_mailbox && n < records; uid++, n++) {
+            struct message_record msg;
+            snprintf(subject, sizeof(subject), "Quarterly report draft %u/%u", mbox, uid);
+            make_message(&msg, mbox, uid, subject);
+            assert(kvstore_put_message_record(txn, &msg, NULL) == KVSTORE_OK);
+        }
+    }
+
+    // Entries under other prefixes must stay outside "msg:" range scans
+    char mbox_key[] = "mbox:inbox";
+    kvstore_val_t k = { mbox_key, sizeof(mbox_key) - 1 };
+    kvstore_val_t v = { "x", 1 };
+    assert(kvstore_txn_put(txn, "", &k, &v) == KVSTORE_OK);
+    for (uint32_t uid = 1; uid <= 50; uid++) {
+        struct message_record msg;
+        make_message(&msg, 0, uid, "indexed");
+        assert(kvstore_put_message_record_with_all_indices(txn, &msg, NULL) == KVSTORE_OK);
+    }
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+}
+
+static uint64_t key_order(kvstore_val_t *key) {
+    // "msg:" + mailbox_id + uid, both big-endian
+    char *p = (char*)key->data + 4;
+    uint32_t mbox, uid;
+    SER_READ_U32(p, mbox);
+    SER_READ_U32(p, uid);
+    return ((uint64_t)mbox << 32) | uid;
+}
+
+static int raw_cb(size_t part, kvstore_val_t *key, kvstore_val_t *val, void *arg) {
+    struct totals *t = &((struct totals*)arg)[part];
+    uint64_t order = key_order(key);
+    assert(t->records == 0 || order > t->last_key);
+    t->last_key = order;
+    t->records++;
+    t->bytes += key->size + val->size;
+    return KVSTORE_OK;
+}
+
+static int record_cb(size_t part, struct message_record *rec, void *arg) {
+    struct totals *t = &((struct totals*)arg)[part];
+    t->records++;
+    t->size += rec->size;
+    if (!(rec->flags & FLAG_SEEN)) t->unseen++;
+    free(rec->subject);
+    return KVSTORE_OK;
+}
+
+static int stop_cb(size_t part, kvstore_val_t *key, kvstore_val_t *val, void *arg) {
+    (void)key;
+    (void)val;
+    struct totals *t = &((struct totals*)arg)[part];
+    return ++t->records == 10 ? KVSTORE_EXISTS : KVSTORE_OK;
+}
+
+static void sum_totals(struct totals *parts, struct totals *sum) {
+    memset(sum, 0, sizeof(*sum));
+    for (int i = 0; i < MAX_THREADS; i++) {
+        sum->records += parts[i].records;
+        sum->bytes += parts[i].bytes;
+        sum->size += parts[i].size;
+        sum->unseen += parts[i].unseen;
+    }
+}
+
+// Reference totals over the "msg:" range with a single plain cursor
+static void serial_totals(kvstore_t *db, struct totals *ref) {
+    memset(ref, 0, sizeof(*ref));
+    kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+    kvstore_cursor_t *cur = kvstore_cursor_message_record_pk(txn, NULL);
+
+    kvstore_val_t k, v;
+    while (cur && kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK) {
+        if (k.size < 4 || memcmp(k.data, "msg:", 4) != 0) break;
+
+        struct message_record rec;
+        deserialise_message_record((char*)v.data, &rec);
+        ref->records++;
+        ref->bytes += k.size + v.size;
+        ref->size += rec.size;
+        if (!(rec.flags & FLAG_SEEN)) ref->unseen++;
+        free(rec.subject);
+
+        if (kvstore_cursor_next(cur) != KVSTORE_OK) break;
+    }
+
+    kvstore_cursor_close(cur);
+    kvstore_txn_commit(txn);
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 200000;
+
+    printf("=== Parallel Scan Test ===\n\n");
+
+    kvstore_t *db = kvstore_open_mem();
+    load(db, records);
+
+    struct totals ref;
+    serial_totals(db, &ref);
+    assert(ref.records == records);
+
+    char lo_buf[] = "msg:", hi_buf[] = "msg;";
+    kvstore_val_t lo = { lo_buf, 4 }, hi = { hi_buf, 4 };
+
+    // TEST 1: Raw partitions cover the range exactly once, in order
+    printf("Test 1: Raw key/value scan with 1-%d threads...\n", MAX_THREADS);
+    {
+        for (size_t nthreads = 1; nthreads <= MAX_THREADS; nthreads++) {
+            struct totals parts[MAX_THREADS], sum;
+            memset(parts, 0, sizeof(parts));
+
+            kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+            assert(kvstore_scan_parallel(txn, "", &lo, &hi, nthreads,
+                                         raw_cb, parts) == KVSTORE_OK);
+            kvstore_txn_commit(txn);
+
+            sum_totals(parts, &sum);
+            assert(sum.records == ref.records && sum.bytes == ref.bytes);
+            for (size_t i = 0; i < nthreads; i++) {
+                assert(parts[i].records >= records / nthreads - 1);
+            }
+        }
+        printf("  ✓ %llu entries, partitions balanced and disjoint\n",
+               (unsigned long long)ref.records);
+    }
+
+    // TEST 2: Decoded records, whole table and a bounded key range
+    printf("\nTest 2: Decoded record scan...\n");
+    {
+        struct totals parts[MAX_THREADS], sum;
+        memset(parts, 0, sizeof(parts));
+
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+        assert(kvstore_scan_parallel_message_record(txn, NULL, NULL, 4,
+                                                    record_cb, parts) == KVSTORE_OK);
+        sum_totals(parts, &sum);
+        assert(sum.records == ref.records);
+        assert(sum.size == ref.size && sum.unseen == ref.unseen);
+
+        // Mailboxes 10..19 only
+        struct message_record_pk start = { .mailbox_id = 10, .uid = 0 };
+        struct message_record_pk end = { .mailbox_id = 20, .uid = 0 };
+        memset(parts, 0, sizeof(parts));
+        assert(kvstore_scan_parallel_message_record(txn, &start, &end, 4,
+                                                    record_cb, parts) == KVSTORE_OK);
+        sum_totals(parts, &sum);
+        assert(sum.records == 10 * ((records + MAILBOXES - 1) / MAILBOXES));
+        kvstore_txn_commit(txn);
+
+        printf("  ✓ Totals match serial scan (size %llu, unseen %llu)\n",
+               (unsigned long long)ref.size, (unsigned long long)ref.unseen);
+        printf("  ✓ Bounded scan returned %llu records for 10 mailboxes\n",
+               (unsigned long long)sum.records);
+    }
+
+    // TEST 3: A callback error stops every partition
+    printf("\nTest 3: Early stop...\n");
+    {
+        struct totals parts[MAX_THREADS];
+        memset(parts, 0, sizeof(parts));
+
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+        assert(kvstore_scan_parallel(txn, "", &lo, &hi, 4, stop_cb, parts) == KVSTORE_EXISTS);
+        assert(kvstore_scan_parallel(txn, "no_such_table", NULL, NULL, 4,
+                                     stop_cb, parts) == KVSTORE_OK);
+        kvstore_txn_commit(txn);
+        for (int i = 0; i < 4; i++) assert(parts[i].records <= 10);
+
+        txn = kvstore_txn_begin(db, false);
+        assert(kvstore_scan_parallel(txn, "", &lo, &hi, 4, stop_cb, parts) == KVSTORE_ERROR);
+        kvstore_txn_abort(txn);
+        printf("  ✓ Callback result returned, missing table scans nothing, read-write refused\n");
+    }
+
+    // TEST 4: Split points merged across a sharded store
+    printf("\nTest 4: Parallel scan over shards...\n");
+    {
+        kvstore_t *shards[4];
+        for (int i = 0; i < 4; i++) shards[i] = kvstore_open_mem();
+        kvstore_shard_opts_t opts = KVSTORE_SHARD_OPTS_INIT;
+        opts.route_len = 4;
+        kvstore_t *sdb = kvstore_shard_open(shards, 4, &opts);
+        load(sdb, 20000);
+
+        struct totals parts[MAX_THREADS], sum;
+        memset(parts, 0, sizeof(parts));
+        kvstore_txn_t *txn = kvstore_txn_begin(sdb, true);
+        assert(kvstore_scan_parallel_message_record(txn, NULL, NULL, 4,
+                                                    record_cb, parts) == KVSTORE_OK);
+        kvstore_txn_commit(txn);
+
+        sum_totals(parts, &sum);
+        assert(sum.records == 20000);
+        size_t used = 0;
+        for (int i = 0; i < 4; i++) used += parts[i].records > 0;
+        assert(used > 1);
+
+        kvstore_close(sdb);
+        for (int i = 0; i < 4; i++) kvstore_close(shards[i]);
+        printf("  ✓ %llu records across %zu partitions\n",
+               (unsigned long long)sum.records, used);
+    }
+
+    // Benchmark: scan throughput by thread count
+    printf("\nBenchmark: scan of %u records (%.1f MB), 5 passes each\n",
+           records, ref.bytes / 1e6);
+    double raw_base = 0, rec_base = 0;
+    for (size_t nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+        struct totals parts[MAX_THREADS];
+        struct timespec start;
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int pass = 0; pass < 5; pass++) {
+            memset(parts, 0, sizeof(parts));
+            kvstore_scan_parallel(txn, "", &lo, &hi, nthreads, raw_cb, parts);
+        }
+        double raw_sec = elapsed_sec(&start) / 5;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int pass = 0; pass < 5; pass++) {
+            memset(parts, 0, sizeof(parts));
+            kvstore_scan_parallel_message_record(txn, NULL, NULL, nthreads, record_cb, parts);
+        }
+        double rec_sec = elapsed_sec(&start) / 5;
+        kvstore_txn_commit(txn);
+
+        if (nthreads == 1) {
+            raw_base = raw_sec;
+            rec_base = rec_sec;
+        }
+        printf("  %zu thread%s: raw %6.2f GB/s (%.2fx), decoded %6.2f M records/s (%.2fx)\n",
+               nthreads, nthreads == 1 ? " " : "s",
+               ref.bytes / raw_sec / 1e9, raw_base / raw_sec,
+               records / rec_sec / 1e6, rec_base / rec_sec);
+    }
+
+    kvstore_close(db);
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
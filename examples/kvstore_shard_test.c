@@ -0,0 +1,274 @@
+// Sharded KV store test: routing, buffered writes, merged cursors
+// Compares a sharded store against a single store and reports ingest
+// throughput by shard count. Usage: kvstore_shard_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_shard.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record definition
+// ------------------------
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    char *subject;
+    struct timespec received;
+    uint64_t size;
+    uint64_t thread_id;
+};
+
+SERIALISE(message_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(subject, charptr),
+    SERIALISE_FIELD(received, timespec),
+    SERIALISE_FIELD(size, uint64_t),
+    SERIALISE_FIELD(thread_id, uint64_t)
+)
+
+SERIALISE_DECLARE_KEYS(message_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_mbox_time:", by_mailbox_time,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(received, timespec)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_thread:", by_thread,
+    SERIALISE_FIELD(thread_id, uint64_t)
+)
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_mailbox_time, "msg_mbox_time:",
+    by_thread, "msg_thread:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+#define MAX_SHARDS 8
+
+static void make_message(struct message_record *msg, uint32_t mailbox_id,
+                         uint32_t uid, char *subject) {
+    memset(msg, 0, sizeof(*msg));
+    msg->mailbox_id = mailbox_id;
+    msg->uid = uid;
+    msg->subject = subject;
+    msg->received.tv_sec = 1700000000 + uid;
+    msg->size = 512 + uid % 4096;
+    msg->thread_id = ((uint64_t)mailbox_id << 32) | uid;
+}
+
+static void ingest(kvstore_t *db, uint32_t records, uint32_t batch, uint32_t mailboxes) {
+    char subject[64];
+    for (uint32_t i = 0; i < records; i += batch) {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        for (uint32_t j = i; j < i + batch && j < records; j++) {
+            struct message_record msg;
+            snprintf(subject, sizeof(subject), "Subject %u", j);
+            make_message(&msg, j % mailboxes, j, subject);
+            assert(kvstore_put_message_record_with_all_indices(txn, &msg, NULL) == KVSTORE_OK);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+    }
+}
+
+// Key of a prefixed primary/secondary entry built the same way the macros do
+static kvstore_val_t prefixed(char *buf, const char *prefix, uint32_t mailbox_id, uint32_t uid) {
+    size_t plen = strlen(prefix);
+    memcpy(buf, prefix, plen);
+    char *p = buf + plen;
+    SER_WRITE_U32(p, mailbox_id);
+    SER_WRITE_U32(p, uid);
+    return (kvstore_val_t){ buf, (size_t)(p - buf) };
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+
+    printf("=== Sharded KV Store Test ===\n\n");
+
+    kvstore_t *shards[MAX_SHARDS];
+    for (int i = 0; i < 4; i++) shards[i] = kvstore_open_mem();
+
+    // Route on the 4-byte mailbox_id that follows every key prefix
+    kvstore_shard_opts_t opts = KVSTORE_SHARD_OPTS_INIT;
+    opts.route_len = 4;
+    kvstore_t *db = kvstore_shard_open(shards, 4, &opts);
+    kvstore_t *ref = kvstore_open_mem();
+    assert(db != NULL);
+
+    // TEST 1: Mailbox-scoped keys land on the same shard
+    printf("Test 1: Routing by mailbox_id...\n");
+    {
+        char a[64], b[64];
+        size_t used[4] = {0};
+        for (uint32_t mbox = 0; mbox < 64; mbox++) {
+            kvstore_val_t pk = prefixed(a, "msg:", mbox, 7);
+            kvstore_val_t sk = prefixed(b, "msg_mbox_time:", mbox, 99);
+            size_t shard = kvstore_shard_route(db, "", &pk);
+            assert(shard == kvstore_shard_route(db, "", &sk));
+            used[shard]++;
+        }
+        for (int i = 0; i < 4; i++) assert(used[i] > 0);
+        printf("  ✓ Records and mailbox indexes are co-located\n");
+    }
+
+    // TEST 2: Reads see buffered writes before commit
+    printf("\nTest 2: Read-your-writes and updates inside a transaction...\n");
+    {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        struct message_record msg;
+        make_message(&msg, 3, 1, "Hello");
+        assert(kvstore_put_message_record_with_all_indices(txn, &msg, NULL) == KVSTORE_OK);
+
+        struct message_record_pk pk = { .mailbox_id = 3, .uid = 1 };
+        struct message_record got = {0};
+        kvstore_key_buf_t key_buf = KVSTORE_KEY_BUF_INIT;
+        assert(kvstore_get_message_record(txn, &pk, &got, &key_buf) == KVSTORE_OK);
+        assert(strcmp(got.subject, "Hello") == 0);
+
+        // Change an indexed field: old thread entry goes, new one appears
+        got.thread_id = 4242;
+        assert(kvstore_put_message_record_with_all_indices(txn, &got, &key_buf) == KVSTORE_OK);
+        free(got.subject);
+        kvstore_key_buf_free(&key_buf);
+
+        struct message_record_by_thread_key tk = { .thread_id = ((uint64_t)3 << 32) | 1 };
+        struct message_record_pk found;
+        assert(kvstore_lookup_message_record_by_thread(txn, &tk, &found) == KVSTORE_NOTFOUND);
+        tk.thread_id = 4242;
+        assert(kvstore_lookup_message_record_by_thread(txn, &tk, &found) == KVSTORE_OK);
+        assert(found.mailbox_id == 3 && found.uid == 1);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        txn = kvstore_txn_begin(db, false);
+        assert(kvstore_del_message_record(txn, &pk) == KVSTORE_OK);
+        assert(kvstore_del_message_record(txn, &pk) == KVSTORE_NOTFOUND);
+        kvstore_txn_abort(txn);
+
+        txn = kvstore_txn_begin(db, true);
+        assert(kvstore_get_message_record(txn, &pk, &got, NULL) == KVSTORE_OK);
+        assert(got.thread_id == 4242);
+        free(got.subject);
+        kvstore_txn_commit(txn);
+
+        txn = kvstore_txn_begin(db, false);
+        assert(kvstore_del_message_record(txn, &pk) == KVSTORE_OK);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        // A buffered value stays valid while later writes grow the buffer
+        char a[64], b[64];
+        kvstore_val_t ka = prefixed(a, "raw:", 3, 1);
+        kvstore_val_t kb = prefixed(b, "raw:", 3, 2);
+        static char big[8192];
+        memset(big, 'x', sizeof(big));
+        kvstore_val_t va = { "first", 5 }, vb = { big, sizeof(big) }, got_a;
+
+        txn = kvstore_txn_begin(db, false);
+        assert(kvstore_txn_put(txn, "", &ka, &va) == KVSTORE_OK);
+        assert(kvstore_txn_get(txn, "", &ka, &got_a) == KVSTORE_OK);
+        assert(kvstore_txn_put(txn, "", &kb, &vb) == KVSTORE_OK);
+        kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", NULL);
+        kvstore_cursor_close(cur);
+        assert(kvstore_txn_put(txn, "", &kb, &va) == KVSTORE_OK);
+        assert(got_a.size == 5 && memcmp(got_a.data, "first", 5) == 0);
+        kvstore_txn_abort(txn);
+        printf("  ✓ Buffered writes visible, index change applied, abort discarded\n");
+    }
+
+    // TEST 3: Merged scan across shards matches a single store
+    printf("\nTest 3: Merged cursor across shards...\n");
+    {
+        // Fresh shards so the stores hold exactly the same data
+        kvstore_close(db);
+        for (int i = 0; i < 4; i++) {
+            kvstore_close(shards[i]);
+            shards[i] = kvstore_open_mem();
+        }
+        db = kvstore_shard_open(shards, 4, &opts);
+
+        ingest(db, 2000, 250, 10);
+        ingest(ref, 2000, 250, 10);
+
+        kvstore_txn_t *t1 = kvstore_txn_begin(db, true);
+        kvstore_txn_t *t2 = kvstore_txn_begin(ref, true);
+        kvstore_cursor_t *c1 = kvstore_cursor_open(t1, "", NULL);
+        kvstore_cursor_t *c2 = kvstore_cursor_open(t2, "", NULL);
+
+        size_t n = 0;
+        kvstore_val_t k1, v1, k2, v2;
+        for (;;) {
+            int r1 = kvstore_cursor_get(c1, &k1, &v1);
+            int r2 = kvstore_cursor_get(c2, &k2, &v2);
+            assert((r1 == KVSTORE_OK) == (r2 == KVSTORE_OK));
+            if (r1 != KVSTORE_OK) break;
+
+            assert(k1.size == k2.size && memcmp(k1.data, k2.data, k1.size) == 0);
+            assert(v1.size == v2.size && memcmp(v1.data, v2.data, v1.size) == 0);
+            n++;
+
+            kvstore_cursor_next(c1);
+            kvstore_cursor_next(c2);
+        }
+        assert(n == 3 * 2000);
+
+        kvstore_cursor_close(c1);
+        kvstore_cursor_close(c2);
+        kvstore_txn_commit(t1);
+        kvstore_txn_commit(t2);
+        printf("  ✓ Merged scan returned %zu entries in global key order\n", n);
+    }
+
+    kvstore_close(db);
+    kvstore_close(ref);
+    for (int i = 0; i < 4; i++) kvstore_close(shards[i]);
+
+    // Benchmark: ingest scaling with shard count
+    printf("\nBenchmark: ingest of %u records (3 entries each), batches of 1000\n", records);
+    double base = 0;
+    for (size_t nshards = 1; nshards <= MAX_SHARDS; nshards *= 2) {
+        for (size_t i = 0; i < nshards; i++) shards[i] = kvstore_open_mem();
+        kvstore_t *sdb = kvstore_shard_open(shards, nshards, &opts);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ingest(sdb, records, 1000, 1000);
+        double sec = elapsed_sec(&start);
+        if (nshards == 1) base = sec;
+
+        printf("  %zu shard%s: %9.0f records/s  (%.2fx)\n",
+               nshards, nshards == 1 ? " " : "s", records / sec, base / sec);
+
+        kvstore_close(sdb);
+        for (size_t i = 0; i < nshards; i++) kvstore_close(shards[i]);
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,628 @@
+// Tiered storage test: a memory store over a file store behind one handle.
+// Checks a tiered store against a memory store given the same random
+// writes, gets and scans while ranges move both ways; that ranges gets
+// keep going to the cold store for are copied in, and then answer misses
+// alone; that idle ranges, and the least recently used past the hot
+// store's budget, move out; that closing leaves everything in the file
+// store; and writers, a scanner and the migration thread together.
+// Benchmarks gets and rewrites with mailboxes picked from a Zipf
+// distribution: the file store alone, tiered, and a memory store.
+// Usage: kvstore_tier_test [mailboxes] [ops]
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE         // mincore(), in the fixture
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_file.h"
+#include "../include/kvstore_mem.h"
+#include "../include/kvstore_tier.h"
+#include "kvstore_file_fixture.h"
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static void sleep_ms(unsigned ms) {
+    struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+static kvstore_t* open_cold(bool direct, size_t cache_bytes) {
+    kvstore_file_opts_t opts = KVSTORE_FILE_OPTS_INIT;
+    opts.durability = KVSTORE_DURABLE_NONE;
+    opts.direct_io = direct;
+    opts.cache_bytes = cache_bytes;
+    kvstore_t *db = kvstore_open_file(dir, &opts);
+    assert(db);
+    return db;
+}
+
+static kvstore_tier_stats_t tier_stats_of(kvstore_t *db) {
+    kvstore_tier_stats_t stats;
+    assert(kvstore_tier_stats(db, &stats) == KVSTORE_OK);
+    return stats;
+}
+
+// "msg:", mailbox and uid, big-endian: a mailbox is a range with
+// prefix_len 4
+static kvstore_val_t msg_key(unsigned char *buf, uint32_t mailbox, uint32_t uid) {
+    memcpy(buf, "msg:", 4);
+    for (int i = 0; i < 4; i++) {
+        buf[4 + i] = (unsigned char)(mailbox >> (24 - 8 * i));
+        buf[8 + i] = (unsigned char)(uid >> (24 - 8 * i));
+    }
+    return (kvstore_val_t){ buf, 12 };
+}
+
+// A message's value: its size and a version, so rewrites differ
+static size_t msg_val(char *buf, size_t size, uint32_t mailbox, uint32_t uid, uint32_t version) {
+    int n = snprintf(buf, size, "mailbox %u uid %u version %u ", mailbox, uid, version);
+    size_t len = 48 + (mailbox * 7 + uid * 13 + version) % 96;
+    if (len > size) len = size;
+    for (size_t i = (size_t)n; i < len; i++) buf[i] = (char)('a' + (i + uid) % 26);
+    return len;
+}
+
+static void put_msg(kvstore_txn_t *txn, uint32_t mailbox, uint32_t uid, uint32_t version) {
+    unsigned char kb[12];
+    char vb[160];
+    kvstore_val_t k = msg_key(kb, mailbox, uid);
+    kvstore_val_t v = { vb, msg_val(vb, sizeof(vb), mailbox, uid, version) };
+    assert(kvstore_txn_put(txn, "", &k, &v) == KVSTORE_OK);
+}
+
+// Every key and value of table, in order, the same in both stores. With
+// mailbox set, that mailbox's alone, through a bounded cursor.
+static size_t compare_scan(kvstore_t *db, kvstore_t *ref, const char *table,
+                           bool one, uint32_t mailbox) {
+    kvstore_txn_t *ta = kvstore_txn_begin(db, true), *tb = kvstore_txn_begin(ref, true);
+    unsigned char start[12], end[12];
+    kvstore_val_t s = msg_key(start, mailbox, 0), e = msg_key(end, mailbox + 1, 0);
+    kvstore_cursor_t *a = kvstore_cursor_open(ta, table, one ? &s : NULL);
+    kvstore_cursor_t *b = kvstore_cursor_open(tb, table, one ? &s : NULL);
+    if (one) {
+        assert(!a || kvstore_cursor_set_end(a, &e) == KVSTORE_OK);
+        assert(!b || kvstore_cursor_set_end(b, &e) == KVSTORE_OK);
+    }
+
+    size_t n = 0;
+    for (;;) {
+        kvstore_val_t ka, va, kb, vb;
+        int ra = a ? kvstore_cursor_get(a, &ka, &va) : KVSTORE_NOTFOUND;
+        int rb = b ? kvstore_cursor_get(b, &kb, &vb) : KVSTORE_NOTFOUND;
+        assert(ra == rb);
+        if (ra != KVSTORE_OK) break;
+        assert(ka.size == kb.size && memcmp(ka.data, kb.data, ka.size) == 0);
+        assert(va.size == vb.size && memcmp(va.data, vb.data, va.size) == 0);
+        kvstore_cursor_next(a);
+        kvstore_cursor_next(b);
+        n++;
+    }
+    kvstore_cursor_close(a);
+    kvstore_cursor_close(b);
+    kvstore_txn_abort(ta);
+    kvstore_txn_abort(tb);
+    return n;
+}
+
+// Wait up to 5 s for the migration thread to bring cond about
+#define WAIT_FOR(db, stats, cond) do { \
+    for (int waited_ = 0; waited_ < 500; waited_++) { \
+        stats = tier_stats_of(db); \
+        if (cond) break; \
+        sleep_ms(10); \
+    } \
+    stats = tier_stats_of(db); \
+    assert(cond); \
+} while (0)
+
+// ------------------------
+// Concurrent writers
+// ------------------------
+
+typedef struct {
+    kvstore_t *db;
+    uint32_t first_mailbox;
+    uint32_t rounds;
+    atomic_bool *stop;
+} worker_t;
+
+// Rewrites its 8 mailboxes' 32 messages, round after round
+static void* writer_main(void *arg) {
+    worker_t *w = (worker_t*)arg;
+    for (uint32_t round = 1; round <= w->rounds; round++) {
+        for (uint32_t m = 0; m < 8; m++) {
+            kvstore_txn_t *txn = kvstore_txn_begin(w->db, false);
+            for (uint32_t uid = 0; uid < 32; uid++) put_msg(txn, w->first_mailbox + m, uid, round);
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        }
+    }
+    return NULL;
+}
+
+// Scans the writers' 16 mailboxes until told to stop: keys in order, each
+// mailbox's messages all there
+static void* scanner_main(void *arg) {
+    worker_t *w = (worker_t*)arg;
+    while (!atomic_load(w->stop)) {
+        kvstore_txn_t *txn = kvstore_txn_begin(w->db, true);
+        unsigned char start[12], end[12];
+        kvstore_val_t s = msg_key(start, w->first_mailbox, 0), e = msg_key(end, w->first_mailbox + 16, 0);
+        kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &s);
+        assert(!cur || kvstore_cursor_set_end(cur, &e) == KVSTORE_OK);
+        unsigned char prev[12];
+        size_t n = 0;
+        kvstore_val_t k;
+        while (cur && kvstore_cursor_get(cur, &k, NULL) == KVSTORE_OK) {
+            assert(k.size == 12 && (n == 0 || memcmp(prev, k.data, 12) < 0));
+            memcpy(prev, k.data, 12);
+            kvstore_cursor_next(cur);
+            n++;
+        }
+        kvstore_cursor_close(cur);
+        kvstore_txn_abort(txn);
+        assert(n == 0 || n % 32 == 0);
+    }
+    return NULL;
+}
+
+// ------------------------
+// Benchmark
+// ------------------------
+
+typedef struct {
+    double *cdf;                // Of the mailboxes' ranks
+    uint32_t *mailbox;          // At each rank
+    uint32_t count;
+} zipf_t;
+
+// Zipf with s = 1: the mailbox at rank i is picked in proportion to 1/i
+static void zipf_init(zipf_t *z, uint32_t count) {
+    z->cdf = (double*)malloc(count * sizeof(double));
+    z->mailbox = (uint32_t*)malloc(count * sizeof(uint32_t));
+    assert(z->cdf && z->mailbox);
+    double sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += 1.0 / (double)(i + 1);
+        z->cdf[i] = sum;
+        z->mailbox[i] = i;
+    }
+    for (uint32_t i = 0; i < count; i++) z->cdf[i] /= sum;
+
+    // The busiest mailboxes are scattered through the key space
+    for (uint32_t i = count - 1; i > 0; i--) {
+        uint32_t j = (uint32_t)(next_rand() % (i + 1)), t = z->mailbox[i];
+        z->mailbox[i] = z->mailbox[j];
+        z->mailbox[j] = t;
+    }
+    z->count = count;
+}
+
+static uint32_t zipf_next(zipf_t *z) {
+    double u = (double)(next_rand() >> 11) / 9007199254740992.0;
+    uint32_t lo = 0, hi = z->count - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (z->cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return z->mailbox[lo];
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef struct {
+    double ops_per_sec;
+    double p50, p99, mean;      // Of gets, in µs
+} bench_result_t;
+
+// ops operations: nine in ten a get of one of a mailbox's messages, the
+// rest a rewrite of one, as when its flags change. The first quarter
+// warms up; the rest are measured.
+static bench_result_t run_ops(kvstore_t *db, zipf_t *z, uint32_t per_mailbox, uint32_t ops,
+                              void (*warmed)(kvstore_t *db, void *arg), void *arg) {
+    uint32_t warm = ops / 4, measured = 0;
+    double *lat = (double*)malloc(ops * sizeof(double));
+    assert(lat);
+    double start = 0, sum = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        if (i == warm) {
+            if (warmed) warmed(db, arg);
+            start = now_sec();
+        }
+        uint32_t mailbox = zipf_next(z);
+        unsigned char kb[12];
+        if (next_rand() % 10 == 0) {
+            kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+            assert(kvstore_txn_set_durability(txn, KVSTORE_DURABLE_NONE) == KVSTORE_OK);
+            put_msg(txn, mailbox, (uint32_t)(next_rand() % per_mailbox), i);
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+            continue;
+        }
+        kvstore_val_t k = msg_key(kb, mailbox, (uint32_t)(next_rand() % per_mailbox)), v;
+        double t0 = now_sec();
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+        assert(kvstore_txn_get(txn, "", &k, &v) == KVSTORE_OK);
+        kvstore_txn_abort(txn);
+        if (i >= warm) {
+            lat[measured] = (now_sec() - t0) * 1e6;
+            sum += lat[measured++];
+        }
+    }
+    bench_result_t r;
+    r.ops_per_sec = (double)(ops - warm) / (now_sec() - start);
+    qsort(lat, measured, sizeof(double), cmp_double);
+    r.p50 = lat[measured / 2];
+    r.p99 = lat[measured * 99 / 100];
+    r.mean = sum / measured;
+    free(lat);
+    return r;
+}
+
+static void tier_warmed(kvstore_t *db, void *arg) {
+    *(kvstore_tier_stats_t*)arg = tier_stats_of(db);
+}
+
+static void file_warmed(kvstore_t *db, void *arg) {
+    assert(kvstore_file_stats(db, (kvstore_file_stats_t*)arg) == KVSTORE_OK);
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t mailboxes = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 2000;
+    uint32_t ops = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 400000;
+
+    printf("=== Tiered Storage Test ===\n\n");
+    fixture_init("tier");
+
+    kvstore_tier_opts_t opts = KVSTORE_TIER_OPTS_INIT;
+    opts.prefix_len = 4;
+
+    // TEST 1: The same as a memory store while ranges move both ways
+    printf("Test 1: Random writes, gets and scans while ranges move...\n");
+    kvstore_t *hot = kvstore_open_mem(), *cold = open_cold(false, 0), *ref = kvstore_open_mem();
+    {
+        opts.hot_bytes = 16384;
+        opts.idle_ms = 20;
+        opts.interval_ms = 5;
+        opts.promote_gets = 1;
+        kvstore_t *db = kvstore_tier_open(hot, cold, &opts);
+        assert(db);
+
+        uint32_t version = 0, retries = 0;
+        for (int round = 0; round < 40; round++) {
+            // A commit that read a key as it moved sees KVSTORE_CONFLICT:
+            // the round is done again, the same
+            uint64_t seed = rng;
+            uint32_t first_version = version;
+            kvstore_txn_t *ta, *tb;
+            int rc;
+            do {
+                rng = seed;
+                version = first_version;
+                ta = kvstore_txn_begin(db, false);
+                tb = kvstore_txn_begin(ref, false);
+                for (int op = 0; op < 300; op++) {
+                    uint32_t mailbox = (uint32_t)(next_rand() % 24), uid = (uint32_t)(next_rand() % 48);
+                    unsigned char kb[12];
+                    kvstore_val_t k = msg_key(kb, mailbox, uid), va, vb;
+                    uint64_t what = next_rand() % 10;
+                    if (what < 5) {
+                        version++;
+                        put_msg(ta, mailbox, uid, version);
+                        put_msg(tb, mailbox, uid, version);
+                    } else if (what < 7) {
+                        rc = kvstore_txn_del(tb, "", &k);
+                        assert(kvstore_txn_del(ta, "", &k) == rc);
+                    } else {
+                        rc = kvstore_txn_get(tb, "", &k, &vb);
+                        assert(kvstore_txn_get(ta, "", &k, &va) == rc);
+                        if (rc == KVSTORE_OK) assert(va.size == vb.size && memcmp(va.data, vb.data, va.size) == 0);
+                    }
+                }
+                // A table whose keys have no ':', and one key in it
+                kvstore_val_t k = { "flags", 5 }, v = { &round, sizeof(round) };
+                assert(kvstore_txn_put(ta, "meta", &k, &v) == KVSTORE_OK);
+                assert(kvstore_txn_put(tb, "meta", &k, &v) == KVSTORE_OK);
+                rc = kvstore_txn_commit(ta);
+                assert(rc == KVSTORE_OK || rc == KVSTORE_CONFLICT);
+                if (rc == KVSTORE_CONFLICT) {
+                    kvstore_txn_abort(tb);
+                    retries++;
+                }
+            } while (rc == KVSTORE_CONFLICT);
+            assert(kvstore_txn_commit(tb) == KVSTORE_OK);
+
+            compare_scan(db, ref, "", false, 0);
+            compare_scan(db, ref, "", true, (uint32_t)round % 24);
+            compare_scan(db, ref, "meta", false, 0);
+            if (round % 10 == 9) assert(kvstore_tier_flush(db) == KVSTORE_OK);
+            if (round % 4 == 3) sleep_ms(30);
+        }
+        kvstore_tier_stats_t stats = tier_stats_of(db);
+        assert(stats.promotions > 0 && stats.demotions > 0 && stats.migration_errors == 0);
+        assert(stats.keys_promoted > 0 && stats.keys_demoted > 0);
+        printf("  ✓ Matches a memory store: %llu ranges copied in (%llu keys), %llu moved out (%llu keys)\n",
+               (unsigned long long)stats.promotions, (unsigned long long)stats.keys_promoted,
+               (unsigned long long)stats.demotions, (unsigned long long)stats.keys_demoted);
+        printf("  ✓ %u of 40 rounds done again after a conflict with a move\n", retries);
+
+        // Closing moves everything out, and the file store has it all as
+        // it is, through a reopen
+        kvstore_close(db);
+        kvstore_close(cold);
+        cold = open_cold(false, 0);
+        size_t n = compare_scan(cold, ref, "", false, 0);
+        compare_scan(cold, ref, "meta", false, 0);
+        kvstore_txn_t *txn = kvstore_txn_begin(hot, true);
+        kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", NULL);
+        assert(!cur || kvstore_cursor_get(cur, NULL, NULL) == KVSTORE_NOTFOUND);
+        kvstore_cursor_close(cur);
+        kvstore_txn_abort(txn);
+        printf("  ✓ Close leaves all %zu messages in the file store, none in memory\n", n);
+    }
+
+    // TEST 2: A range gets keep going to the cold store for is copied in
+    printf("\nTest 2: Copying a range in...\n");
+    {
+        opts.hot_bytes = 0;
+        opts.idle_ms = 60000;
+        opts.interval_ms = 5;
+        opts.promote_gets = 2;
+        kvstore_t *db = kvstore_tier_open(hot, cold, &opts);
+        assert(db);
+
+        kvstore_txn_t *txn = kvstore_txn_begin(db, true);
+        unsigned char kb[12];
+        kvstore_val_t k = msg_key(kb, 7, 0), v;
+        for (uint32_t uid = 0; uid < 48; uid++) {
+            k = msg_key(kb, 7, uid);
+            if (kvstore_txn_get(txn, "", &k, &v) == KVSTORE_OK) break;
+        }
+        kvstore_txn_abort(txn);
+        kvstore_tier_stats_t stats = tier_stats_of(db);
+        assert(stats.resident_ranges == 0 && stats.hot_gets == 0);
+
+        // Another get from the cold store queues the mailbox
+        txn = kvstore_txn_begin(db, true);
+        assert(kvstore_txn_get(txn, "", &k, &v) == KVSTORE_OK);
+        kvstore_txn_abort(txn);
+        WAIT_FOR(db, stats, stats.resident_ranges == 1 && stats.promotions == 1);
+        size_t in_mailbox = compare_scan(db, ref, "", true, 7);
+        assert(stats.keys_promoted == in_mailbox);
+
+        // Every get in it is the memory store's now, misses too: the file
+        // store reads no page for them
+        kvstore_file_stats_t before, after;
+        assert(kvstore_file_stats(cold, &before) == KVSTORE_OK);
+        uint64_t hot_gets = stats.hot_gets;
+        txn = kvstore_txn_begin(db, true);
+        kvstore_txn_t *rtxn = kvstore_txn_begin(ref, true);
+        for (uint32_t uid = 0; uid < 64; uid++) {
+            k = msg_key(kb, 7, uid);
+            kvstore_val_t rv;
+            int rc = kvstore_txn_get(rtxn, "", &k, &rv);
+            assert(kvstore_txn_get(txn, "", &k, &v) == rc);
+            if (rc == KVSTORE_OK) assert(v.size == rv.size && memcmp(v.data, rv.data, v.size) == 0);
+        }
+        kvstore_txn_abort(txn);
+        kvstore_txn_abort(rtxn);
+        assert(kvstore_file_stats(cold, &after) == KVSTORE_OK);
+        stats = tier_stats_of(db);
+        assert(stats.hot_gets == hot_gets + 64 && after.page_reads == before.page_reads);
+        printf("  ✓ Two cold gets copy in the mailbox's %zu messages; its 64 gets then read no page\n",
+               in_mailbox);
+
+        // A scan passes through ranges without copying them in
+        compare_scan(db, ref, "", false, 0);
+        assert(tier_stats_of(db).promotions == 1);
+        printf("  ✓ A scan copies nothing in\n");
+        kvstore_close(db);
+    }
+
+    // TEST 3: Idle ranges move out, and past the budget the least recent
+    printf("\nTest 3: Moving ranges out...\n");
+    {
+        opts.hot_bytes = 0;
+        opts.idle_ms = 50;
+        opts.interval_ms = 5;
+        kvstore_t *db = kvstore_tier_open(hot, cold, &opts);
+        assert(db);
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        kvstore_txn_t *rtxn = kvstore_txn_begin(ref, false);
+        for (uint32_t uid = 0; uid < 32; uid++) {
+            put_msg(txn, 900, uid, 1);
+            put_msg(rtxn, 900, uid, 1);
+        }
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        assert(kvstore_txn_commit(rtxn) == KVSTORE_OK);
+        kvstore_tier_stats_t stats = tier_stats_of(db);
+        assert(stats.hot_bytes > 0);
+        WAIT_FOR(db, stats, stats.hot_bytes == 0 && stats.keys_demoted == 32);
+        assert(compare_scan(cold, ref, "", true, 900) == 32);
+        printf("  ✓ An idle mailbox's 32 messages move to the file store\n");
+        kvstore_close(db);
+
+        opts.hot_bytes = 32768;
+        opts.idle_ms = 60000;
+        db = kvstore_tier_open(hot, cold, &opts);
+        assert(db);
+        for (uint32_t m = 0; m < 100; m++) {
+            txn = kvstore_txn_begin(db, false);
+            rtxn = kvstore_txn_begin(ref, false);
+            for (uint32_t uid = 0; uid < 20; uid++) {
+                put_msg(txn, 1000 + m, uid, 2);
+                put_msg(rtxn, 1000 + m, uid, 2);
+            }
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+            assert(kvstore_txn_commit(rtxn) == KVSTORE_OK);
+            sleep_ms(2);    // Each mailbox used at its own millisecond
+        }
+        WAIT_FOR(db, stats, stats.hot_bytes <= opts.hot_bytes);
+        assert(stats.demotions > 0 && stats.hot_bytes > 0);
+
+        // The last mailbox written is the last to go
+        txn = kvstore_txn_begin(cold, true);
+        unsigned char kb[12];
+        kvstore_val_t k = msg_key(kb, 1000, 0), v;
+        assert(kvstore_txn_get(txn, "", &k, &v) == KVSTORE_OK);
+        k = msg_key(kb, 1099, 0);
+        assert(kvstore_txn_get(txn, "", &k, &v) == KVSTORE_NOTFOUND);
+        kvstore_txn_abort(txn);
+        compare_scan(db, ref, "", false, 0);
+        printf("  ✓ Past a 32 KiB budget the oldest mailboxes move out: %.1f KiB left\n",
+               (double)stats.hot_bytes / 1024);
+        kvstore_close(db);
+    }
+
+    // TEST 4: Writers and a scanner while ranges move
+    printf("\nTest 4: Concurrent writers and scans...\n");
+    {
+        opts.hot_bytes = 16384;
+        opts.idle_ms = 1;
+        opts.interval_ms = 1;
+        opts.promote_gets = 1;
+        kvstore_t *db = kvstore_tier_open(hot, cold, &opts);
+        assert(db);
+
+        // Each writer's mailboxes start full, so scans see whole mailboxes
+        for (uint32_t m = 2000; m < 2016; m++) {
+            kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+            for (uint32_t uid = 0; uid < 32; uid++) put_msg(txn, m, uid, 0);
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        }
+        atomic_bool stop = false;
+        worker_t workers[3] = {
+            { db, 2000, 40, &stop }, { db, 2008, 40, &stop }, { db, 2000, 0, &stop },
+        };
+        pthread_t threads[3];
+        assert(pthread_create(&threads[0], NULL, writer_main, &workers[0]) == 0);
+        assert(pthread_create(&threads[1], NULL, writer_main, &workers[1]) == 0);
+        assert(pthread_create(&threads[2], NULL, scanner_main, &workers[2]) == 0);
+        pthread_join(threads[0], NULL);
+        pthread_join(threads[1], NULL);
+        atomic_store(&stop, true);
+        pthread_join(threads[2], NULL);
+
+        kvstore_txn_t *rtxn = kvstore_txn_begin(ref, false);
+        for (uint32_t m = 2000; m < 2016; m++) {
+            for (uint32_t uid = 0; uid < 32; uid++) put_msg(rtxn, m, uid, 40);
+        }
+        assert(kvstore_txn_commit(rtxn) == KVSTORE_OK);
+        compare_scan(db, ref, "", false, 0);
+        kvstore_tier_stats_t stats = tier_stats_of(db);
+        assert(stats.migration_errors == 0);
+        printf("  ✓ Two writers' last versions all there, %llu ranges moved out meanwhile\n",
+               (unsigned long long)stats.demotions);
+        kvstore_close(db);
+    }
+    kvstore_close(cold);
+    kvstore_close(hot);
+    kvstore_close(ref);
+    reset();
+
+    // Benchmark: gets and rewrites with Zipf-distributed mailboxes
+    uint32_t per_mailbox = 50;
+    printf("\nBenchmark: %u mailboxes of %u messages, %u ops (9 gets : 1 rewrite), "
+           "mailboxes Zipf s=1\n", mailboxes, per_mailbox, ops);
+    {
+        // The messages, checkpointed into the data file
+        cold = open_cold(false, 0);
+        for (uint32_t m = 0; m < mailboxes; m++) {
+            kvstore_txn_t *txn = kvstore_txn_begin(cold, false);
+            for (uint32_t uid = 0; uid < per_mailbox; uid++) put_msg(txn, m, uid, 0);
+            assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        }
+        assert(kvstore_file_checkpoint(cold) == KVSTORE_OK);
+        kvstore_file_stats_t fstats;
+        assert(kvstore_file_stats(cold, &fstats) == KVSTORE_OK);
+        kvstore_close(cold);
+        printf("  data file %.1f MiB; the file store reads it with direct I/O\n",
+               (double)fstats.data_bytes / (1024 * 1024));
+
+        printf("  %-18s %9s %7s %7s %7s | %8s %8s %6s %6s\n", "store", "ops/s", "p50 us",
+               "p99 us", "mean us", "hit", "hot MiB", "in", "out");
+        size_t budgets[2] = { (size_t)1 << 20, (size_t)4 << 20 };
+        for (int config = 0; config < 5; config++) {
+            rng = 1234;
+            zipf_t z;
+            zipf_init(&z, mailboxes);
+            char name[32];
+            bench_result_t r;
+
+            if (config < 2) {
+                // The file store alone, with a block cache of the budget
+                size_t budget = budgets[config];
+                cold = open_cold(true, budget);
+                kvstore_file_stats_t warm, end;
+                r = run_ops(cold, &z, per_mailbox, ops, file_warmed, &warm);
+                assert(kvstore_file_stats(cold, &end) == KVSTORE_OK);
+                uint64_t hits = end.cache.hits - warm.cache.hits;
+                uint64_t misses = end.cache.misses - warm.cache.misses;
+                snprintf(name, sizeof(name), "file, %zu MiB cache", budget >> 20);
+                printf("  %-18s %9.0f %7.1f %7.1f %7.1f | %7.1f%% %8s %6s %6s\n", name,
+                       r.ops_per_sec, r.p50, r.p99, r.mean,
+                       100.0 * (double)hits / (double)(hits + misses ? hits + misses : 1), "", "", "");
+                kvstore_close(cold);
+            } else if (config < 4) {
+                // Tiered, with a hot store of the budget over the file
+                // store and a 1 MiB block cache
+                size_t budget = budgets[config - 2];
+                hot = kvstore_open_mem();
+                cold = open_cold(true, (size_t)1 << 20);
+                kvstore_tier_opts_t bopts = KVSTORE_TIER_OPTS_INIT;
+                bopts.prefix_len = 4;
+                bopts.hot_bytes = budget;
+                bopts.interval_ms = 10;
+                kvstore_t *db = kvstore_tier_open(hot, cold, &bopts);
+                assert(db);
+                kvstore_tier_stats_t warm;
+                r = run_ops(db, &z, per_mailbox, ops, tier_warmed, &warm);
+                kvstore_tier_stats_t end = tier_stats_of(db);
+                assert(end.migration_errors == 0);
+                snprintf(name, sizeof(name), "tier, %zu MiB hot", budget >> 20);
+                printf("  %-18s %9.0f %7.1f %7.1f %7.1f | %7.1f%% %8.2f %6llu %6llu\n", name,
+                       r.ops_per_sec, r.p50, r.p99, r.mean,
+                       100.0 * (double)(end.hot_gets - warm.hot_gets) / (double)(end.gets - warm.gets),
+                       (double)end.hot_bytes / (1024 * 1024),
+                       (unsigned long long)(end.promotions - warm.promotions),
+                       (unsigned long long)(end.demotions - warm.demotions));
+                kvstore_close(db);
+                kvstore_close(cold);
+                kvstore_close(hot);
+            } else {
+                // Everything in memory
+                kvstore_t *db = kvstore_open_mem();
+                for (uint32_t m = 0; m < mailboxes; m++) {
+                    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+                    for (uint32_t uid = 0; uid < per_mailbox; uid++) put_msg(txn, m, uid, 0);
+                    assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+                }
+                r = run_ops(db, &z, per_mailbox, ops, NULL, NULL);
+                printf("  %-18s %9.0f %7.1f %7.1f %7.1f | %7.1f%% %8s %6s %6s\n", "memory",
+                       r.ops_per_sec, r.p50, r.p99, r.mean, 100.0, "", "", "");
+                kvstore_close(db);
+            }
+            free(z.cdf);
+            free(z.mailbox);
+        }
+        reset();
+    }
+
+    rmdir(dir);
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
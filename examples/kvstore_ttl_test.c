@@ -0,0 +1,322 @@
+// Expiry test: a deadline index on session records and the incremental
+// sweeper deleting expired sessions with their secondary entries.
+// Benchmarks the sweeper against a scan-and-delete job.
+// Usage: kvstore_ttl_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record definitions
+// ------------------------
+
+struct session_record {
+    uint64_t session_id;
+    char *user;
+    struct timespec expires;    // Zero: never
+    uint32_t hits;
+};
+
+SERIALISE(session_record,
+    SERIALISE_FIELD(session_id, uint64_t),
+    SERIALISE_FIELD(user, charptr),
+    SERIALISE_FIELD(expires, timespec),
+    SERIALISE_FIELD(hits, uint32_t)
+)
+
+SERIALISE_DECLARE_KEYS(session_record)
+
+SERIALISE_PRIMARY_KEY(session_record, "sess:",
+    SERIALISE_FIELD(session_id, uint64_t)
+)
+
+SERIALISE_MULTI_KEY(session_record, "sess_user:", by_user,
+    KV_EACH_VALUE(user, charptr))
+
+SERIALISE_EXPIRY_KEY(session_record, "sess_exp:", by_expiry, expires)
+
+SERIALISE_FINALIZE_INDICES(session_record,
+    by_user, "sess_user:",
+    by_expiry, "sess_exp:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+#define T0 1700000000
+
+static const char *users[] = { "alice", "bob", "carol", "dave" };
+
+// Session i expires at T0 + i seconds, except every tenth never does
+static struct session_record make_session(uint64_t i) {
+    struct session_record rec = {
+        .session_id = i,
+        .user = (char*)users[i % 4],
+        .expires = { i % 10 == 9 ? 0 : T0 + (time_t)i, 0 },
+        .hits = 1,
+    };
+    return rec;
+}
+
+static void put_sessions(kvstore_txn_t *txn, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        struct session_record rec = make_session(i);
+        assert(kvstore_put_session_record_with_all_indices(txn, &rec, NULL) == KVSTORE_OK);
+    }
+}
+
+typedef struct {
+    size_t n;
+    int64_t last;
+    bool ordered;
+} expired_t;
+
+// Expired records arrive earliest deadline first
+static int on_expired(struct session_record *rec, void *arg) {
+    expired_t *e = (expired_t*)arg;
+    if (e->n && rec->expires.tv_sec < e->last) e->ordered = false;
+    e->last = rec->expires.tv_sec;
+    e->n++;
+    free(rec->user);
+    return KVSTORE_OK;
+}
+
+static int free_expired(struct session_record *rec, void *arg) {
+    (void)arg;
+    free(rec->user);
+    return KVSTORE_OK;
+}
+
+static int count_pk(struct session_record_pk *pk, void *arg) {
+    (void)pk;
+    (*(size_t*)arg)++;
+    return 0;
+}
+
+static size_t user_sessions(kvstore_txn_t *txn, const char *user) {
+    struct session_record_by_user_key k = { .value = (char*)user };
+    size_t n = 0;
+    kvstore_lookup_each_session_record_by_user(txn, &k, count_pk, &n);
+    return n;
+}
+
+static bool present(kvstore_txn_t *txn, uint64_t id) {
+    struct session_record_pk pk = { id };
+    struct session_record rec;
+    if (kvstore_get_session_record(txn, &pk, &rec, NULL) != KVSTORE_OK) return false;
+    free(rec.user);
+    return true;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint64_t records = argc > 1 ? (uint64_t)atoll(argv[1]) : 20000;
+
+    printf("=== Expiry Test ===\n\n");
+
+    // TEST 1: Sweep everything due, with its index entries
+    printf("Test 1: Sweep...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        put_sessions(txn, 1000);
+
+        kvstore_sweep_stats_t stats = {0};
+        expired_t e = { .ordered = true };
+        struct timespec now = { T0 + 99, 0 };
+        assert(kvstore_sweep_session_record_by_expiry(txn, &now, 1000, on_expired, &e, &stats) == KVSTORE_OK);
+
+        // Deadlines 0..99 are due, except the never-expiring tenth
+        assert(e.n == 90 && e.ordered && stats.expired == 90);
+        for (uint64_t i = 0; i < 1000; i++) {
+            assert(present(txn, i) == (i >= 100 || i % 10 == 9));
+        }
+        size_t left = 0;
+        for (int u = 0; u < 4; u++) left += user_sessions(txn, users[u]);
+        assert(left == 910);
+
+        // Nothing more is due at the same time
+        assert(kvstore_sweep_session_record_by_expiry(txn, &now, 1000, on_expired, &e, &stats) == KVSTORE_OK);
+        assert(e.n == 90 && stats.sweeps == 2);
+        printf("  ✓ 90 due sessions deleted in deadline order with their user entries\n");
+
+        // Refreshing moves the deadline; clearing it stops expiry
+        struct session_record_pk pk = { 150 };
+        struct session_record rec;
+        kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+        assert(kvstore_get_session_record(txn, &pk, &rec, &kb) == KVSTORE_OK);
+        rec.expires.tv_sec = T0 + 5000;
+        assert(kvstore_put_session_record_with_all_indices(txn, &rec, &kb) == KVSTORE_OK);
+        kvstore_key_buf_free(&kb);
+        free(rec.user);
+
+        pk.session_id = 151;
+        assert(kvstore_get_session_record(txn, &pk, &rec, &kb) == KVSTORE_OK);
+        rec.expires.tv_sec = 0;
+        assert(kvstore_put_session_record_with_all_indices(txn, &rec, &kb) == KVSTORE_OK);
+        kvstore_key_buf_free(&kb);
+        free(rec.user);
+
+        now.tv_sec = T0 + 200;
+        assert(kvstore_sweep_session_record_by_expiry(txn, &now, 1000, free_expired, NULL, &stats) == KVSTORE_OK);
+        assert(present(txn, 150) && present(txn, 151) && !present(txn, 152));
+
+        now.tv_sec = T0 + 100000;
+        assert(kvstore_sweep_session_record_by_expiry(txn, &now, 1000, free_expired, NULL, &stats) == KVSTORE_OK);
+        assert(!present(txn, 150) && present(txn, 151));
+        left = 0;
+        for (int u = 0; u < 4; u++) left += user_sessions(txn, users[u]);
+        assert(left == 101);    // 100 never-expiring, plus the cleared one
+        printf("  ✓ Refreshed deadlines move; zero deadlines never expire\n");
+
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        kvstore_close(db);
+    }
+
+    // TEST 2: Bounded work per call
+    printf("\nTest 2: Bounded sweeps...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        put_sessions(txn, 1000);
+
+        kvstore_sweep_stats_t stats = {0};
+        expired_t e = { .ordered = true };
+        struct timespec now = { T0 + 499, 0 };
+        int calls = 0, rc;
+        do {
+            size_t before = e.n;
+            rc = kvstore_sweep_session_record_by_expiry(txn, &now, 64, on_expired, &e, &stats);
+            assert(rc == KVSTORE_OK || rc == KVSTORE_EXISTS);
+            assert(e.n - before <= 64);
+            calls++;
+        } while (rc == KVSTORE_EXISTS);
+
+        assert(e.n == 450 && e.ordered);
+        assert(calls == 8 && stats.backlog == 7 && stats.sweeps == 8);
+        double per_busy;
+        assert(kvstore_sweep_rate(&stats, &per_busy) > 0 && per_busy > 0);
+        printf("  ✓ 450 sessions in %d calls of at most 64 (%.0f expired/s while sweeping)\n",
+               calls, per_busy);
+
+        // A record deleted without its indexes leaves an orphaned deadline
+        // entry; the sweep removes it and carries on past it
+        struct session_record_pk pk = { 600 };
+        assert(kvstore_del_session_record(txn, &pk) == KVSTORE_OK);
+        size_t before = e.n;
+        now.tv_sec = T0 + 700;
+        assert(kvstore_sweep_session_record_by_expiry(txn, &now, 1000, on_expired, &e, &stats) == KVSTORE_OK);
+        assert(e.n - before == 180 && stats.orphans == 1);
+        assert(kvstore_sweep_session_record_by_expiry(txn, &now, 1000, on_expired, &e, &stats) == KVSTORE_OK);
+        assert(e.n - before == 180 && stats.orphans == 1);
+        printf("  ✓ Orphaned deadline entry dropped, sweep continued past it\n");
+
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        kvstore_close(db);
+    }
+
+    // Benchmark: sweeper vs a scan-and-delete job, run as 10 ticks that
+    // each find 1% of the sessions due
+    printf("\nBenchmark: %llu sessions, 10 ticks of 1%% expiring\n", (unsigned long long)records);
+    {
+        kvstore_t *swept = kvstore_open_mem(), *scanned = kvstore_open_mem();
+        kvstore_txn_t *stxn = kvstore_txn_begin(swept, false);
+        kvstore_txn_t *ctxn = kvstore_txn_begin(scanned, false);
+        put_sessions(stxn, records);
+        put_sessions(ctxn, records);
+        uint64_t *ids = (uint64_t*)malloc(records * sizeof(uint64_t));
+        kvstore_sweep_stats_t stats = {0};
+        expired_t e = { .ordered = true };
+        size_t scanned_n = 0;
+        double scan = 0, sweep = 0, scan_before = 0, sweep_before = 0;
+
+        // Tick 11 repeats tick 10: nothing is due
+        for (uint64_t tick = 1; tick <= 11; tick++) {
+            struct timespec now = { T0 + (time_t)((tick > 10 ? 10 : tick) * records / 100) - 1, 0 };
+            if (tick == 11) {
+                scan_before = scan;
+                sweep_before = sweep;
+            }
+
+            // Scan job: decode every session, delete the expired ones
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            size_t nids = 0;
+            kvstore_cursor_t *cur = kvstore_cursor_session_record_pk(ctxn, NULL);
+            kvstore_val_t k, v;
+            while (kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK &&
+                   k.size > 5 && memcmp(k.data, "sess:", 5) == 0) {
+                struct session_record rec;
+                deserialise_session_record((char*)v.data, &rec);
+                bool expired = (rec.expires.tv_sec || rec.expires.tv_nsec) &&
+                               rec.expires.tv_sec <= now.tv_sec;
+                if (expired) ids[nids++] = rec.session_id;
+                free(rec.user);
+                kvstore_cursor_next(cur);
+            }
+            kvstore_cursor_close(cur);
+            for (size_t i = 0; i < nids; i++) {
+                struct session_record_pk pk = { ids[i] };
+                struct session_record rec;
+                kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+                assert(kvstore_get_session_record(ctxn, &pk, &rec, &kb) == KVSTORE_OK);
+                assert(kvstore_del_session_record_with_all_indices(ctxn, &kb) == KVSTORE_OK);
+                kvstore_key_buf_free(&kb);
+                free(rec.user);
+            }
+            scanned_n += nids;
+            scan += elapsed_sec(&start);
+
+            // Sweeper, in batches of 256
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            while (kvstore_sweep_session_record_by_expiry(stxn, &now, 256, on_expired, &e, &stats) == KVSTORE_EXISTS) {
+            }
+            sweep += elapsed_sec(&start);
+        }
+        free(ids);
+        double idle_scan = scan - scan_before, idle_sweep = sweep - sweep_before;
+        scan = scan_before;
+        sweep = sweep_before;
+
+        size_t due = 0;
+        for (uint64_t i = 0; i < records / 10; i++) due += i % 10 != 9;
+        assert(scanned_n == due && e.n == due && e.ordered);
+
+        double per_busy;
+        kvstore_sweep_rate(&stats, &per_busy);
+        printf("  %-14s %10s %12s %14s\n", "method", "expired", "time us", "expired/s");
+        printf("  %-14s %10zu %12.0f %14.0f\n", "scan + delete", scanned_n, scan * 1e6,
+               scanned_n / scan);
+        printf("  %-14s %10zu %12.0f %14.0f  (%.1fx, %llu calls)\n", "sweeper", e.n,
+               sweep * 1e6, per_busy, scan / sweep, (unsigned long long)stats.sweeps);
+        printf("  idle tick: scan %.0f us, sweeper %.1f us (%.0fx)\n", idle_scan * 1e6,
+               idle_sweep * 1e6, idle_scan / idle_sweep);
+
+        kvstore_txn_commit(stxn);
+        kvstore_txn_commit(ctxn);
+        kvstore_close(swept);
+        kvstore_close(scanned);
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -0,0 +1,267 @@
+// Write-set test: the memory backend buffers writes in the transaction,
+// collapses repeated writes to a key and cancels put-then-delete pairs, so
+// commit applies only the final state. Checks reads and cursors through the
+// write-set, abort, and the issued/applied counters, and benchmarks a sync
+// batch touching every record twice.
+// Usage: kvstore_writeset_test [records]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "../include/kvstore.h"
+#include "../include/kvstore_backend.h"
+
+extern kvstore_t* kvstore_open_mem(void);
+
+// ------------------------
+// Record definitions
+// ------------------------
+
+#define FLAG_SEEN    0x1
+#define FLAG_FLAGGED 0x2
+
+struct message_record {
+    uint32_t mailbox_id;
+    uint32_t uid;
+    uint32_t flags;
+    uint64_t modseq;
+    uint64_t thread_id;
+    char *subject;
+};
+
+SERIALISE(message_record,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t),
+    SERIALISE_FIELD(flags, uint32_t),
+    SERIALISE_FIELD(modseq, uint64_t),
+    SERIALISE_FIELD(thread_id, uint64_t),
+    SERIALISE_FIELD(subject, charptr)
+)
+
+SERIALISE_DECLARE_KEYS(message_record)
+
+SERIALISE_PRIMARY_KEY(message_record, "msg:",
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_modseq:", by_modseq,
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(modseq, uint64_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_SECONDARY_KEY(message_record, "msg_thread:", by_thread,
+    SERIALISE_FIELD(thread_id, uint64_t),
+    SERIALISE_FIELD(mailbox_id, uint32_t),
+    SERIALISE_FIELD(uid, uint32_t)
+)
+
+SERIALISE_FINALIZE_INDICES(message_record,
+    by_modseq, "msg_modseq:",
+    by_thread, "msg_thread:"
+)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+#define MAILBOXES 4
+
+static void put_messages(kvstore_t *db, uint32_t n) {
+    kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+    for (uint32_t i = 0; i < n; i++) {
+        struct message_record rec = {
+            .mailbox_id = i % MAILBOXES, .uid = i + 1, .modseq = 1,
+            .thread_id = i / 3, .subject = "Weekly status",
+        };
+        assert(kvstore_put_message_record_with_all_indices(txn, &rec, NULL) == KVSTORE_OK);
+    }
+    assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+}
+
+// Sync-style update: change the flags, bump the modseq, write it back
+static void touch(kvstore_txn_t *txn, uint32_t i, uint32_t set_flags, uint64_t modseq) {
+    struct message_record_pk pk = { i % MAILBOXES, i + 1 };
+    struct message_record rec;
+    kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+    assert(kvstore_get_message_record(txn, &pk, &rec, &kb) == KVSTORE_OK);
+    rec.flags |= set_flags;
+    rec.modseq = modseq;
+    assert(kvstore_put_message_record_with_all_indices(txn, &rec, &kb) == KVSTORE_OK);
+    kvstore_key_buf_free(&kb);
+    free(rec.subject);
+}
+
+static size_t count_prefix(kvstore_txn_t *txn, const char *prefix) {
+    kvstore_val_t start = { (void*)prefix, strlen(prefix) }, k;
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+    size_t n = 0;
+    while (cur && kvstore_cursor_get(cur, &k, NULL) == KVSTORE_OK &&
+           k.size >= start.size && memcmp(k.data, prefix, start.size) == 0) {
+        n++;
+        kvstore_cursor_next(cur);
+    }
+    if (cur) kvstore_cursor_close(cur);
+    return n;
+}
+
+static double elapsed_sec(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start->tv_sec) +
+           (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// ------------------------
+// Main test
+// ------------------------
+
+int main(int argc, char **argv) {
+    uint32_t records = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+
+    printf("=== Write-set Test ===\n\n");
+
+    // TEST 1: Repeated writes to one record collapse
+    printf("Test 1: Coalescing...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        put_messages(db, 100);
+
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        touch(txn, 7, FLAG_SEEN, 2);
+        touch(txn, 7, FLAG_FLAGGED, 3);
+        touch(txn, 7, 0, 4);
+
+        // Each touch: primary put, old modseq entry deleted, new one put
+        kvstore_txn_stats_t stats;
+        assert(kvstore_txn_stats(txn, &stats) == KVSTORE_OK);
+        assert(stats.issued == 9 && stats.buffered == 5 && stats.applied == 3);
+        printf("  ✓ 3 updates: %llu writes issued, %llu applied\n",
+               (unsigned long long)stats.issued, (unsigned long long)stats.applied);
+
+        // Put then delete of a new key cancels; rewriting a value is a no-op
+        char key_buf[] = "scratch", val_buf[] = "v";
+        kvstore_val_t key = { key_buf, 7 }, val = { val_buf, 1 };
+        assert(kvstore_txn_put(txn, "", &key, &val) == KVSTORE_OK);
+        assert(kvstore_txn_del(txn, "", &key) == KVSTORE_OK);
+        assert(kvstore_txn_del(txn, "", &key) == KVSTORE_NOTFOUND);
+        touch(txn, 8, 0, 1);
+        assert(kvstore_txn_stats(txn, &stats) == KVSTORE_OK);
+        assert(stats.issued == 12 && stats.applied == 3);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+
+        txn = kvstore_txn_begin(db, true);
+        struct message_record_pk pk = { 7 % MAILBOXES, 8 };
+        struct message_record rec;
+        assert(kvstore_get_message_record(txn, &pk, &rec, NULL) == KVSTORE_OK);
+        assert(rec.flags == (FLAG_SEEN | FLAG_FLAGGED) && rec.modseq == 4);
+        free(rec.subject);
+        assert(count_prefix(txn, "msg_modseq:") == 100);
+        assert(kvstore_txn_get(txn, "", &key, &val) == KVSTORE_NOTFOUND);
+        kvstore_txn_commit(txn);
+        kvstore_close(db);
+        printf("  ✓ Put-then-delete cancelled, unchanged rewrite skipped\n");
+    }
+
+    // TEST 2: Reads and cursors see the write-set; abort discards it
+    printf("\nTest 2: Reads through the write-set...\n");
+    {
+        kvstore_t *db = kvstore_open_mem();
+        put_messages(db, 100);
+
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        kvstore_txn_t *other = kvstore_txn_begin(db, true);
+        for (uint32_t i = 0; i < 100; i += 2) {
+            struct message_record_pk pk = { i % MAILBOXES, i + 1 };
+            kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT;
+            struct message_record rec;
+            assert(kvstore_get_message_record(txn, &pk, &rec, &kb) == KVSTORE_OK);
+            assert(kvstore_del_message_record_with_all_indices(txn, &kb) == KVSTORE_OK);
+            kvstore_key_buf_free(&kb);
+            free(rec.subject);
+        }
+        struct message_record extra = { .mailbox_id = 9, .uid = 1, .subject = "New" };
+        assert(kvstore_put_message_record_with_all_indices(txn, &extra, NULL) == KVSTORE_OK);
+
+        assert(count_prefix(txn, "msg:") == 51);
+        assert(count_prefix(txn, "msg_thread:") == 51);
+        assert(count_prefix(other, "msg:") == 100);
+
+        // Writes while a cursor is open: it re-seeks past its current key
+        char prefix[] = "msg:";
+        kvstore_val_t start = { prefix, 4 }, k;
+        kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+        size_t seen = 0;
+        while (kvstore_cursor_get(cur, &k, NULL) == KVSTORE_OK &&
+               k.size >= 4 && memcmp(k.data, "msg:", 4) == 0) {
+            if (seen == 10) {
+                struct message_record_pk pk = { 1, 2 };
+                assert(kvstore_del_message_record(txn, &pk) == KVSTORE_OK);
+            }
+            seen++;
+            kvstore_cursor_next(cur);
+        }
+        kvstore_cursor_close(cur);
+        assert(seen == 51);    // (1, 2) was already behind the cursor
+        kvstore_txn_commit(other);
+        kvstore_txn_abort(txn);
+
+        txn = kvstore_txn_begin(db, true);
+        assert(count_prefix(txn, "msg:") == 100 && count_prefix(txn, "msg_thread:") == 100);
+        kvstore_txn_commit(txn);
+        kvstore_close(db);
+        printf("  ✓ Own writes visible, other transactions and abort unaffected\n");
+    }
+
+    // Benchmark: a sync batch touching every record twice, as one
+    // transaction versus one transaction per update
+    printf("\nBenchmark: %u records, 2 updates each\n", records);
+    {
+        kvstore_t *db = kvstore_open_mem();
+        put_messages(db, records);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint32_t i = 0; i < records; i++) {
+            for (uint32_t n = 0; n < 2; n++) {
+                kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+                touch(txn, i, n ? FLAG_FLAGGED : FLAG_SEEN, 2 + n);
+                assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+            }
+        }
+        double single = elapsed_sec(&start);
+        kvstore_close(db);
+
+        db = kvstore_open_mem();
+        put_messages(db, records);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        for (uint32_t i = 0; i < records; i++) {
+            touch(txn, i, FLAG_SEEN, 2);
+            touch(txn, i, FLAG_FLAGGED, 3);
+        }
+        kvstore_txn_stats_t stats;
+        assert(kvstore_txn_stats(txn, &stats) == KVSTORE_OK);
+        assert(stats.issued == 6ull * records && stats.applied == 3ull * records);
+        assert(kvstore_txn_commit(txn) == KVSTORE_OK);
+        double batch = elapsed_sec(&start);
+
+        txn = kvstore_txn_begin(db, true);
+        assert(count_prefix(txn, "msg_modseq:") == records);
+        kvstore_txn_commit(txn);
+        kvstore_close(db);
+
+        printf("  %-20s %12s %10s %10s\n", "method", "time us", "issued", "applied");
+        printf("  %-20s %12.0f %10u %10u\n", "txn per update", single * 1e6,
+               6 * records, 6 * records);
+        printf("  %-20s %12.0f %10llu %10llu  (%.1fx)\n", "one batch txn", batch * 1e6,
+               (unsigned long long)stats.issued, (unsigned long long)stats.applied,
+               single / batch);
+    }
+
+    printf("\n=== All tests passed! ===\n");
+    return 0;
+}
@@ -46,6 +46,7 @@ typedef struct {
 #define KVSTORE_NOTFOUND  1
 #define KVSTORE_EXISTS    2
 #define KVSTORE_ERROR    -1
+#define KVSTORE_CONFLICT -2   // Commit lost to a concurrent one: retry
 
 // Free key buffer
 static inline void kvstore_key_buf_free(kvstore_key_buf_t *kb) {
@@ -124,6 +125,7 @@ static inline void kvstore_key_buf_free(kvstore_key_buf_t *kb) {
 size_t SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, SER_CAT(key_suffix, _size))))( \
     struct SER_CAT(rec_type, SER_CAT(_, key_type)) *key) { \
     size_t _sz = 0; \
+    (void)key; \
     FOR_EACH(KV_ITEM_SIZE, __VA_ARGS__); \
     return _sz; \
 } \
@@ -199,6 +201,151 @@ int kvstore_cursor_get(kvstore_cursor_t *cur, kvstore_val_t *key_out,
 int kvstore_cursor_next(kvstore_cursor_t *cur);
 void kvstore_cursor_close(kvstore_cursor_t *cur);
 
+// Stop the cursor before end (a copy is kept; NULL removes the bound): once
+// it reaches a key >= end, kvstore_cursor_get() returns KVSTORE_NOTFOUND.
+// Backends that read ahead of a cursor don't read past end.
+int kvstore_cursor_set_end(kvstore_cursor_t *cur, kvstore_val_t *end);
+
+// Remove a table and every key in it: one step where the backend supports
+// it, otherwise key by key. KVSTORE_NOTFOUND if the table doesn't exist.
+int kvstore_txn_drop_table(kvstore_txn_t *txn, const char *table);
+
+// Send this transaction's operations on table "" (which all generated code
+// uses) to another table until routed back; NULL restores "". Returns the
+// previous route.
+const char* kvstore_txn_route(kvstore_txn_t *txn, const char *table);
+
+// Merge operators: change part of a stored value without reading it.
+// Offsets are into the serialized value, where integers are big-endian (as
+// SERIALISE writes them); a field's offset is fixed while every field
+// before it is fixed-size. Merges bypass index and aggregate maintenance,
+// so only use them on fields that no key, index or aggregate reads.
+typedef enum {
+    KVSTORE_MERGE_ADD_U64,  // Add operand to the u64 at offset (wraps)
+    KVSTORE_MERGE_OR_U32,   // OR operand into the u32 at offset
+    KVSTORE_MERGE_AND_U32,  // AND operand into the u32 at offset
+    KVSTORE_MERGE_APPEND,   // Append data to the value and add 1 to the u32
+                            // element count at offset (array must be last)
+} kvstore_merge_kind_t;
+
+typedef struct {
+    kvstore_merge_kind_t kind;
+    size_t offset;
+    uint64_t operand;
+    kvstore_val_t data;     // APPEND: one encoded element
+} kvstore_merge_t;
+
+// Apply op to the stored value at key: in place where the backend supports
+// it, otherwise by get and put. KVSTORE_NOTFOUND if there is no value,
+// KVSTORE_ERROR if the offset is out of range.
+int kvstore_txn_merge(kvstore_txn_t *txn, const char *table, kvstore_val_t *key,
+                      const kvstore_merge_t *op);
+
+// Apply op to the size bytes at val, which must have room for op->data
+// (for backends). Returns the new size, or 0 if the offset is out of range.
+size_t kvstore_merge_apply(const kvstore_merge_t *op, void *val, size_t size);
+
+// Write-set counters of a transaction, for backends that buffer writes
+// until commit. Repeated writes to a key collapse into the last one, and
+// commit skips deletes of keys it never saw committed and puts of the
+// value already there.
+typedef struct {
+    uint64_t issued;    // put, del, merge and drop calls
+    uint64_t buffered;  // Distinct keys in the write-set
+    uint64_t applied;   // Writes commit would apply now
+} kvstore_txn_stats_t;
+
+// KVSTORE_NOTFOUND if the backend doesn't buffer writes
+int kvstore_txn_stats(kvstore_txn_t *txn, kvstore_txn_stats_t *out);
+
+// Savepoints within a write transaction. Rolling back to one undoes every
+// write made since (including drops and merges) without aborting, and keeps
+// it set for reuse; savepoints taken after it are discarded. Releasing one
+// keeps its writes and forgets it and any later ones. Savepoints nest, so
+// a batch can wrap each record in savepoint/rollback_to or release.
+// KVSTORE_NOTFOUND if the backend doesn't support them, KVSTORE_ERROR for
+// a savepoint that was already released or rolled past.
+typedef struct {
+    size_t id;
+} kvstore_savepoint_t;
+
+int kvstore_txn_savepoint(kvstore_txn_t *txn, kvstore_savepoint_t *sp);
+int kvstore_txn_rollback_to(kvstore_txn_t *txn, const kvstore_savepoint_t *sp);
+int kvstore_txn_release(kvstore_txn_t *txn, const kvstore_savepoint_t *sp);
+
+// Concurrent read-write transactions, where the backend allows them,
+// commit optimistically: commit returns KVSTORE_CONFLICT, having rolled the
+// transaction back, if another transaction committed a write to a key or
+// cursor range it read since it began. kvstore_txn_run() runs fn in a
+// read-write transaction and commits it, starting over on conflict up to
+// max_attempts times (0 = until it commits). fn must have no effects
+// outside the transaction; anything but KVSTORE_OK from it aborts and is
+// returned.
+typedef int (*kvstore_txn_fn)(kvstore_txn_t *txn, void *arg);
+
+int kvstore_txn_run(kvstore_t *db, kvstore_txn_fn fn, void *arg, unsigned max_attempts);
+
+// How durable a commit is when kvstore_txn_commit() returns, for backends
+// that keep a log (others ignore it). Commits are numbered in log order, and
+// a commit is durable once it and every commit before it are fsynced.
+typedef enum {
+    KVSTORE_DURABLE_DEFAULT = 0,    // The store's configured level
+    KVSTORE_DURABLE_SYNC,           // Written and fsynced
+    KVSTORE_DURABLE_ASYNC,          // Written; fsynced by a background flusher
+    KVSTORE_DURABLE_NONE,           // Buffered; written and fsynced by the flusher
+} kvstore_durability_t;
+
+// Set the durability of this transaction's commit
+int kvstore_txn_set_durability(kvstore_txn_t *txn, kvstore_durability_t level);
+
+// Commit, and set *seq_out to the commit's log sequence number (0 if
+// nothing was logged), to pass to kvstore_wait_durable()
+int kvstore_txn_commit_seq(kvstore_txn_t *txn, uint64_t *seq_out);
+
+// Block until commit seq is durable, flushing it now rather than waiting
+// for the flusher. KVSTORE_OK at once for backends without a log.
+int kvstore_wait_durable(kvstore_t *db, uint64_t seq);
+
+// Asynchronous gets, so one thread can keep many disk reads in flight. A
+// lookup that needs the disk is queued, and fn runs from kvstore_txn_poll()
+// once its read completes; lookups answered from memory, and every lookup
+// on backends without asynchronous reads, run fn before
+// kvstore_txn_get_async() returns. fn gets val NULL unless rc is
+// KVSTORE_OK, and val stays valid as a kvstore_txn_get() value would.
+// Lookups outstanding at commit or abort are dropped without running fn.
+typedef void (*kvstore_get_fn)(void *arg, int rc, kvstore_val_t *val);
+
+int kvstore_txn_get_async(kvstore_txn_t *txn, const char *table, kvstore_val_t *key,
+                          kvstore_get_fn fn, void *arg);
+
+// Start queued lookups and run the callbacks of completed ones, waiting
+// until at least min have run or none are outstanding (0 = don't wait).
+// Sets *ran (may be NULL) to the number run.
+int kvstore_txn_poll(kvstore_txn_t *txn, size_t min, size_t *ran);
+
+// Look up n keys together, their disk reads in flight at once. Sets
+// rcs_out[i] to KVSTORE_OK or KVSTORE_NOTFOUND, and vals_out[i] for the
+// keys found. KVSTORE_ERROR if any lookup failed; if polling itself failed,
+// some lookups may be left outstanding, so abort rather than poll again.
+int kvstore_txn_get_many(kvstore_txn_t *txn, const char *table, size_t n,
+                         kvstore_val_t *keys, kvstore_val_t *vals_out, int *rcs_out);
+
+// Parallel scan callback: part identifies the partition (0 .. nthreads-1),
+// so per-partition accumulators need no locking. Return KVSTORE_OK to
+// continue; any other value stops all partitions and is returned.
+typedef int (*kvstore_scan_fn)(size_t part, kvstore_val_t *key,
+                               kvstore_val_t *val, void *arg);
+
+// Scan [start, end) of a table with up to nthreads concurrent cursors
+// (start/end NULL = unbounded). The range is split at backend-provided
+// split points; keys are visited in order within each partition only.
+// KVSTORE_ERROR unless txn is read-only. The partitions share txn rather
+// than a snapshot, so a commit made during the scan may be seen by some
+// partitions and not others; quiesce writers for a consistent result.
+int kvstore_scan_parallel(kvstore_txn_t *txn, const char *table,
+                          kvstore_val_t *start, kvstore_val_t *end,
+                          size_t nthreads, kvstore_scan_fn fn, void *arg);
+
 // ------------------------
 // Primary key macro
 // ------------------------
@@ -223,6 +370,11 @@ void kvstore_cursor_close(kvstore_cursor_t *cur);
 // Generate primary table operations
 #define KV_PRIMARY_OPS(rec_type, prefix, ...) \
 \
+/* Key prefix of the primary table */ \
+static inline const char* SER_CAT(rec_type, _pk_prefix)(void) { \
+    return prefix; \
+} \
+\
 /* PUT: Store record with key change detection */ \
 static inline int SER_CAT(kvstore_put_, rec_type)( \
     kvstore_txn_t *txn, struct rec_type *rec, kvstore_key_buf_t *old_keys) { \
@@ -278,8 +430,7 @@ static inline int SER_CAT(kvstore_put_, rec_type)( \
     int rc = kvstore_txn_put(txn, "", &key, &val); \
     if (rc != KVSTORE_OK) return rc; \
     \
-    /* Note: Secondary index updates handled by their _internal functions */ \
-    /* Called from user code or generated helper */ \
+    /* Secondary indexes are maintained by kvstore_put_<rec>_with_all_indices */ \
     \
     return KVSTORE_OK; \
 } \
@@ -313,7 +464,7 @@ static inline int SER_CAT(kvstore_get_, rec_type)( \
     /* If key_buf provided, populate all keys for change detection */ \
     /* NOTE: Requires SERIALISE_FINALIZE_INDICES to be called to define populate_key_buf_* */ \
     if (key_buf) { \
-        SER_CAT(populate_key_buf_, rec_type)(result, key_buf); \
+        return SER_CAT(populate_key_buf_, rec_type)(result, key_buf); \
     } \
     \
     return KVSTORE_OK; \
@@ -339,6 +490,35 @@ static inline int SER_CAT(kvstore_del_, rec_type)( \
     return kvstore_txn_del(txn, "", &k); \
 } \
 \
+/* MERGE: Change part of a record without reading it (see kvstore_merge_t) */ \
+static inline int SER_CAT(kvstore_merge_, rec_type)( \
+    kvstore_txn_t *txn, struct SER_CAT(rec_type, _pk) *key, const kvstore_merge_t *op) { \
+    \
+    size_t key_sz = SER_CAT(serialise_, SER_CAT(rec_type, _pk_size))(key); \
+    size_t prefix_len = strlen(prefix); \
+    size_t prefixed_sz = prefix_len + key_sz; \
+    char *prefixed_buf = (char*)alloca(prefixed_sz); \
+    memcpy(prefixed_buf, prefix, prefix_len); \
+    SER_CAT(serialise_, SER_CAT(rec_type, _pk))(prefixed_buf + prefix_len, key); \
+    \
+    kvstore_val_t k = { prefixed_buf, prefixed_sz }; \
+    return kvstore_txn_merge(txn, "", &k, op); \
+} \
+\
+/* INTERNAL DELETE: Remove primary entry by serialized key */ \
+static inline int SER_CAT(kvstore_del_, SER_CAT(rec_type, _internal))( \
+    kvstore_txn_t *txn, char *pk_buf, size_t pk_sz) { \
+    \
+    size_t prefix_len = strlen(prefix); \
+    size_t prefixed_sz = prefix_len + pk_sz; \
+    char *prefixed_buf = (char*)alloca(prefixed_sz); \
+    memcpy(prefixed_buf, prefix, prefix_len); \
+    memcpy(prefixed_buf + prefix_len, pk_buf, pk_sz); \
+    \
+    kvstore_val_t k = { prefixed_buf, prefixed_sz }; \
+    return kvstore_txn_del(txn, "", &k); \
+} \
+\
 /* CURSOR: Iterate primary key table */ \
 static inline kvstore_cursor_t* SER_CAT(kvstore_cursor_, SER_CAT(rec_type, _pk))( \
     kvstore_txn_t *txn, struct SER_CAT(rec_type, _pk) *start_key) { \
@@ -368,6 +548,86 @@ static inline kvstore_cursor_t* SER_CAT(kvstore_cursor_, SER_CAT(rec_type, _pk))
     } \
     \
     return kvstore_cursor_open(txn, "", &start); \
+} \
+\
+/* PARALLEL SCAN: Decode records in [start_key, end_key) on nthreads */ \
+struct SER_CAT(rec_type, _scan_ctx) { \
+    int (*fn)(size_t part, struct rec_type *rec, void *arg); \
+    void *arg; \
+}; \
+\
+static inline int SER_CAT(rec_type, _scan_decode)( \
+    size_t part, kvstore_val_t *key, kvstore_val_t *val, void *arg) { \
+    struct SER_CAT(rec_type, _scan_ctx) *ctx = (struct SER_CAT(rec_type, _scan_ctx)*)arg; \
+    (void)key; \
+    struct rec_type rec; \
+    memset(&rec, 0, sizeof(rec)); \
+    SER_CAT(deserialise_, rec_type)((char*)val->data, &rec); \
+    /* Callback owns any allocated fields, as with kvstore_get_* */ \
+    return ctx->fn(part, &rec, ctx->arg); \
+} \
+\
+static inline int SER_CAT(kvstore_scan_parallel_, rec_type)( \
+    kvstore_txn_t *txn, struct SER_CAT(rec_type, _pk) *start_key, \
+    struct SER_CAT(rec_type, _pk) *end_key, size_t nthreads, \
+    int (*fn)(size_t part, struct rec_type *rec, void *arg), void *arg) { \
+    \
+    size_t prefix_len = strlen(prefix); \
+    kvstore_val_t bounds[2] = {{0}}; \
+    struct SER_CAT(rec_type, _pk) *keys[2] = { start_key, end_key }; \
+    \
+    for (int b = 0; b < 2; b++) { \
+        size_t key_sz = keys[b] ? SER_CAT(serialise_, SER_CAT(rec_type, _pk_size))(keys[b]) : 0; \
+        char *buf = (char*)alloca(prefix_len + key_sz); \
+        memcpy(buf, prefix, prefix_len); \
+        if (keys[b]) { \
+            SER_CAT(serialise_, SER_CAT(rec_type, _pk))(buf + prefix_len, keys[b]); \
+        } else if (b == 1 && prefix_len) { \
+            /* No end key: stop at the first key past this prefix */ \
+            buf[prefix_len - 1]++; \
+        } \
+        bounds[b].data = buf; \
+        bounds[b].size = prefix_len + key_sz; \
+    } \
+    \
+    struct SER_CAT(rec_type, _scan_ctx) ctx = { fn, arg }; \
+    return kvstore_scan_parallel(txn, "", &bounds[0], \
+                                 (end_key || prefix_len) ? &bounds[1] : NULL, \
+                                 nthreads, SER_CAT(rec_type, _scan_decode), &ctx); \
+} \
+\
+/* QUERY: Fetch the records whose primary keys are in every stream */ \
+struct SER_CAT(rec_type, _query_ctx) { \
+    kvstore_txn_t *txn; \
+    int (*fn)(struct rec_type *rec, void *arg); \
+    void *arg; \
+}; \
+\
+static inline int SER_CAT(rec_type, _query_fetch)(kvstore_val_t *pk, void *arg) { \
+    struct SER_CAT(rec_type, _query_ctx) *ctx = (struct SER_CAT(rec_type, _query_ctx)*)arg; \
+    size_t prefix_len = strlen(prefix); \
+    char *buf = (char*)alloca(prefix_len + pk->size); \
+    memcpy(buf, prefix, prefix_len); \
+    memcpy(buf + prefix_len, pk->data, pk->size); \
+    \
+    kvstore_val_t k = { buf, prefix_len + pk->size }; \
+    kvstore_val_t v = {0}; \
+    int rc = kvstore_txn_get(ctx->txn, "", &k, &v); \
+    if (rc == KVSTORE_NOTFOUND) return KVSTORE_OK; \
+    if (rc != KVSTORE_OK) return rc; \
+    \
+    struct rec_type rec; \
+    memset(&rec, 0, sizeof(rec)); \
+    SER_CAT(deserialise_, rec_type)((char*)v.data, &rec); \
+    /* Callback owns any allocated fields, as with kvstore_get_* */ \
+    return ctx->fn(&rec, ctx->arg); \
+} \
+\
+static inline int SER_CAT(kvstore_query_, rec_type)( \
+    kvstore_txn_t *txn, kvstore_pk_stream_t *streams, size_t nstreams, \
+    int (*fn)(struct rec_type *rec, void *arg), void *arg) { \
+    struct SER_CAT(rec_type, _query_ctx) ctx = { txn, fn, arg }; \
+    return kvstore_intersect(txn, streams, nstreams, SER_CAT(rec_type, _query_fetch), &ctx); \
 }
 
 // ------------------------
@@ -375,6 +635,62 @@ static inline kvstore_cursor_t* SER_CAT(kvstore_cursor_, SER_CAT(rec_type, _pk))
 // ------------------------
 
 #define SERIALISE_SECONDARY_KEY(rec_type, prefix, index_name, ...) \
+    KV_SECONDARY_KEY_IMPL(rec_type, prefix, index_name, KV_SK_ALWAYS, __VA_ARGS__)
+
+// Partial index: only records for which predicate(rec) is true get an entry.
+// Usage: SERIALISE_SECONDARY_KEY_WHERE(message_record, "msg_unseen:",
+//            unseen, is_unseen, SERIALISE_FIELD(mailbox_id, uint32_t), ...)
+// where: static inline bool is_unseen(struct message_record *rec);
+#define SERIALISE_SECONDARY_KEY_WHERE(rec_type, prefix, index_name, predicate, ...) \
+    KV_SECONDARY_KEY_IMPL(rec_type, prefix, index_name, predicate, __VA_ARGS__)
+
+// Expression index: extractor computes the key fields from the record, so
+// derived keys need not be stored in it. The fields name the key struct
+// members and need not exist in the record.
+// Usage: SERIALISE_SECONDARY_KEY_EXPR(user_record, "user_email_ci:",
+//            by_email_ci, email_lower, SERIALISE_FIELD(email, charptr))
+// then define, after the macro (which declares it):
+//   static inline void email_lower(struct user_record *rec,
+//                                  struct user_record_by_email_ci_key *key);
+// charptr key fields set by the extractor are owned by the index and are
+// released with free() once serialised. Custom types need KV_FREE_<tag>.
+#define SERIALISE_SECONDARY_KEY_EXPR(rec_type, prefix, index_name, extractor, ...) \
+    KV_SECONDARY_KEY_STRUCT(rec_type, index_name, __VA_ARGS__) \
+    \
+    static inline void extractor(struct rec_type *rec, \
+        struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) *key); \
+    static inline void SER_CAT(rec_type, SER_CAT(_extract_, index_name))( \
+        struct rec_type *rec, \
+        struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) *key) { \
+        extractor(rec, key); \
+    } \
+    \
+    KV_SECONDARY_KEY_COMMON(rec_type, prefix, index_name, KV_SK_ALWAYS, OWNED, __VA_ARGS__)
+
+#define KV_SK_ALWAYS(rec) ((void)(rec), true)
+
+// Old-keys buffer length for a secondary key the record has no entry for
+#define KV_SK_ABSENT UINT32_MAX
+
+// Name of a per-index function or type: rec_type_index_name<suffix>
+#define KV_SK_FN(rec_type, index_name, suffix) \
+    SER_CAT(rec_type, SER_CAT(_, SER_CAT(index_name, suffix)))
+
+// Put (val non-NULL) or delete the index entry prefix + key + suffix
+int kvstore_index_entry(kvstore_txn_t *txn, const char *prefix,
+                        const char *key, size_t key_len,
+                        const char *suffix, size_t suffix_len,
+                        const char *val, size_t val_len);
+
+#define KV_SECONDARY_KEY_IMPL(rec_type, prefix, index_name, predicate, ...) \
+    KV_SECONDARY_KEY_STRUCT(rec_type, index_name, __VA_ARGS__) \
+    \
+    /* Generate extractor */ \
+    KV_GENERATE_EXTRACTOR_SK(rec_type, index_name, __VA_ARGS__) \
+    \
+    KV_SECONDARY_KEY_COMMON(rec_type, prefix, index_name, predicate, BORROWED, __VA_ARGS__)
+
+#define KV_SECONDARY_KEY_STRUCT(rec_type, index_name, ...) \
     /* Generate struct rec_type_index_name_key */ \
     KV_GENERATE_STRUCT(SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)), \
                        __VA_ARGS__) \
@@ -382,11 +698,60 @@ static inline kvstore_cursor_t* SER_CAT(kvstore_cursor_, SER_CAT(rec_type, _pk))
     /* Generate serialization functions */ \
     KV_SERIALISE_KEY(rec_type, index_name, SER_CAT(index_name, _key), __VA_ARGS__) \
     \
-    /* Generate extractor */ \
-    KV_GENERATE_EXTRACTOR_SK(rec_type, index_name, __VA_ARGS__) \
+    /* Serialized size of the first nfields fields, for prefix matches */ \
+    static inline size_t SER_CAT(serialise_, KV_SK_FN(rec_type, index_name, _prefix_size))( \
+        struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) *key, size_t nfields) { \
+        size_t _sz = 0, _n = 0; \
+        (void)key; \
+        FOR_EACH(KV_ITEM_PREFIX_SIZE, __VA_ARGS__); \
+        return _sz; \
+    }
+
+#define KV_ITEM_PREFIX_SIZE(t) if (_n++ < nfields) KV_ITEM_SIZE(t)
+
+// ownership: BORROWED keys point into the record, OWNED keys are freed
+#define KV_SECONDARY_KEY_COMMON(rec_type, prefix, index_name, predicate, ownership, ...) \
+    /* Generate membership test */ \
+    static inline bool SER_CAT(rec_type, SER_CAT(_, SER_CAT(index_name, _includes)))( \
+        struct rec_type *rec) { \
+        return predicate(rec); \
+    } \
+    \
+    /* Release an extracted key once serialised */ \
+    static inline void KV_SK_FN(rec_type, index_name, _key_release)( \
+        struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) *key) { \
+        (void)key; \
+        SER_CAT(KV_KEY_RELEASE_, ownership)(__VA_ARGS__) \
+    } \
     \
     /* Generate KV operations */ \
-    KV_SECONDARY_OPS(rec_type, prefix, index_name, __VA_ARGS__)
+    KV_SECONDARY_OPS(rec_type, prefix, index_name, __VA_ARGS__) \
+    \
+    /* Generate maintenance hooks for SERIALISE_FINALIZE_INDICES */ \
+    KV_SECONDARY_MAINT(rec_type, index_name)
+
+#define KV_KEY_RELEASE_BORROWED(...)
+#define KV_KEY_RELEASE_OWNED(...) FOR_EACH(KV_KEY_FREE, __VA_ARGS__)
+
+#define KV_KEY_FREE(t) KV_KEY_FREE_I t
+#define KV_KEY_FREE_I(kind, ...) SER_CAT(KV_KEY_FREE_, kind)(__VA_ARGS__)
+#define KV_KEY_FREE_SCALAR(name, type) SER_CAT(KV_FREE_, SER_MAP(type))(key->name)
+#define KV_KEY_FREE_ARRAY(name, type, count) \
+    for (size_t _i = 0; _i < (size_t)(count); _i++) { \
+        SER_CAT(KV_FREE_, SER_MAP(type))(key->name[_i]); \
+    }
+
+#define KV_FREE_u8(v)       ((void)0)
+#define KV_FREE_u16(v)      ((void)0)
+#define KV_FREE_u32(v)      ((void)0)
+#define KV_FREE_u64(v)      ((void)0)
+#define KV_FREE_i8(v)       ((void)0)
+#define KV_FREE_i16(v)      ((void)0)
+#define KV_FREE_i32(v)      ((void)0)
+#define KV_FREE_i64(v)      ((void)0)
+#define KV_FREE_size(v)     ((void)0)
+#define KV_FREE_timespec(v) ((void)0)
+#define KV_FREE_charptr(v)  free(v)
 
 // Generate extractor for secondary key
 #define KV_GENERATE_EXTRACTOR_SK(rec_type, index_name, ...) \
@@ -461,96 +826,831 @@ static inline kvstore_cursor_t* SER_CAT(kvstore_cursor_, SER_CAT(rec_type, SER_C
     return kvstore_cursor_open(txn, "", &start); \
 } \
 \
-/* INTERNAL PUT: Add/update secondary index entry */ \
-static inline int SER_CAT(kvstore_put_, SER_CAT(rec_type, SER_CAT(_, SER_CAT(index_name, _internal))))( \
-    kvstore_txn_t *txn, struct rec_type *rec, char *pk_buf, size_t pk_sz, const char *sk_prefix) { \
-    \
-    /* Extract and serialize secondary key */ \
-    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) sk; \
-    SER_CAT(rec_type, SER_CAT(_extract_, index_name))(rec, &sk); \
-    size_t sk_sz = SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, SER_CAT(index_name, _size))))(&sk); \
+/* STREAM: Primary keys of entries whose first nfields key fields match */ \
+/* (in index order; set stream->pk_ordered if that is primary key order) */ \
+static inline int SER_CAT(kvstore_stream_, SER_CAT(rec_type, SER_CAT(_, index_name)))( \
+    kvstore_pk_stream_t *stream, \
+    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) *key, size_t nfields) { \
+    size_t sk_sz = SER_CAT(serialise_, KV_SK_FN(rec_type, index_name, _size))(key); \
     char *sk_buf = (char*)alloca(sk_sz); \
-    SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, index_name)))(sk_buf, &sk); \
+    SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, index_name)))(sk_buf, key); \
+    return kvstore_pk_stream_init(stream, prefix, sk_buf, \
+        SER_CAT(serialise_, KV_SK_FN(rec_type, index_name, _prefix_size))(key, nfields), \
+        false, false); \
+}
+
+// Index maintenance used by SERIALISE_FINALIZE_INDICES. Every index kind
+// generates the same functions over its own _state struct:
+//   _prepare(rec, st)  compute the record's entry data (st->sz bytes)
+//   _write(p, st)      append [len:4][data] to a key buffer
+//   _update(txn, st, old, old_len, pk, pk_sz, old_pk, old_pk_sz, prefix)
+//                      move the index from the old key buffer data to st
+//   _remove(txn, old, old_len, old_pk, old_pk_sz, prefix)
+//   _release(st)
+#define KV_SECONDARY_MAINT(rec_type, index_name) \
+\
+struct KV_SK_FN(rec_type, index_name, _state) { \
+    bool present; \
+    size_t sz; \
+    char *buf; \
+    char inline_buf[64]; \
+}; \
+\
+static inline int KV_SK_FN(rec_type, index_name, _prepare)( \
+    struct rec_type *rec, struct KV_SK_FN(rec_type, index_name, _state) *st) { \
+    st->buf = st->inline_buf; \
+    st->sz = 0; \
+    st->present = KV_SK_FN(rec_type, index_name, _includes)(rec); \
+    if (!st->present) return KVSTORE_OK; \
     \
-    /* Prepend prefix to secondary key */ \
-    size_t prefix_len = strlen(sk_prefix); \
-    size_t prefixed_sz = prefix_len + sk_sz; \
-    char *prefixed_buf = (char*)alloca(prefixed_sz); \
-    memcpy(prefixed_buf, sk_prefix, prefix_len); \
-    memcpy(prefixed_buf + prefix_len, sk_buf, sk_sz); \
+    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) key; \
+    SER_CAT(rec_type, SER_CAT(_extract_, index_name))(rec, &key); \
+    st->sz = SER_CAT(serialise_, KV_SK_FN(rec_type, index_name, _size))(&key); \
+    if (st->sz > sizeof(st->inline_buf) && !(st->buf = (char*)malloc(st->sz))) { \
+        KV_SK_FN(rec_type, index_name, _key_release)(&key); \
+        st->buf = st->inline_buf; \
+        st->present = false; \
+        st->sz = 0; \
+        return KVSTORE_ERROR; \
+    } \
+    SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, index_name)))(st->buf, &key); \
+    KV_SK_FN(rec_type, index_name, _key_release)(&key); \
+    return KVSTORE_OK; \
+} \
+\
+static inline char* KV_SK_FN(rec_type, index_name, _write)( \
+    char *p, struct KV_SK_FN(rec_type, index_name, _state) *st) { \
+    uint32_t len = st->present ? (uint32_t)st->sz : KV_SK_ABSENT; \
+    memcpy(p, &len, 4); \
+    p += 4; \
+    if (st->present) { \
+        memcpy(p, st->buf, st->sz); \
+        p += st->sz; \
+    } \
+    return p; \
+} \
+\
+/* Entry transitions: absent -> present inserts, present -> absent deletes, */ \
+/* absent -> absent and unchanged key + primary key are no-ops */ \
+static inline int KV_SK_FN(rec_type, index_name, _update)( \
+    kvstore_txn_t *txn, struct KV_SK_FN(rec_type, index_name, _state) *st, \
+    char *old, uint32_t old_len, char *pk_buf, size_t pk_sz, \
+    char *old_pk, size_t old_pk_sz, const char *sk_prefix) { \
     \
-    /* Store: prefixed_secondary_key -> primary_key (using empty table name) */ \
-    kvstore_val_t k = { prefixed_buf, prefixed_sz }; \
-    kvstore_val_t v = { pk_buf, pk_sz }; \
+    bool same = false; \
+    if (old_len != KV_SK_ABSENT) { \
+        if (st->present && old_len == st->sz && memcmp(old, st->buf, st->sz) == 0) { \
+            same = (old_pk_sz == pk_sz && memcmp(old_pk, pk_buf, pk_sz) == 0); \
+        } else { \
+            int rc = kvstore_index_entry(txn, sk_prefix, old, old_len, NULL, 0, NULL, 0); \
+            if (rc != KVSTORE_OK && rc != KVSTORE_NOTFOUND) return rc; \
+        } \
+    } \
+    if (!st->present || same) return KVSTORE_OK; \
+    return kvstore_index_entry(txn, sk_prefix, st->buf, st->sz, NULL, 0, pk_buf, pk_sz); \
+} \
+\
+static inline int KV_SK_FN(rec_type, index_name, _remove)( \
+    kvstore_txn_t *txn, char *old, uint32_t old_len, \
+    char *old_pk, size_t old_pk_sz, const char *sk_prefix) { \
+    (void)old_pk; \
+    (void)old_pk_sz; \
+    if (old_len == KV_SK_ABSENT) return KVSTORE_OK; \
+    int rc = kvstore_index_entry(txn, sk_prefix, old, old_len, NULL, 0, NULL, 0); \
+    return rc == KVSTORE_NOTFOUND ? KVSTORE_OK : rc; \
+} \
+\
+static inline void KV_SK_FN(rec_type, index_name, _release)( \
+    struct KV_SK_FN(rec_type, index_name, _state) *st) { \
+    if (st->buf != st->inline_buf) free(st->buf); \
+}
+
+// ------------------------
+// Multi-valued secondary key macro
+// ------------------------
+
+// One index entry per element instead of one per record. Sources:
+//   KV_EACH_ELEMENT(field, type, count)               array elements
+//   KV_EACH_MEMBER(field, count_field, member, type)  a member of each
+//                                                     struct in a STRUCTPTR
+//   KV_EACH_SET_BIT(field, words)                     bit numbers set in a
+//                                                     uint32_t bitmap array
+//   KV_EACH_VALUE(field, type)                        a scalar field, giving a
+//                                                     non-unique index
+// Usage:
+//   SERIALISE_MULTI_KEY(customer_record, "cust_user:", by_username,
+//       KV_EACH_MEMBER(users, num_users, username, charptr))
+// Entries are prefix + element + primary key -> primary key, so records
+// sharing an element don't collide. The key buffer keeps the record's sorted
+// element list, and updates only touch elements that were added or removed.
+#define KV_EACH_ELEMENT(field, type, count)              (ELEMENT, field, type, count)
+#define KV_EACH_MEMBER(field, count_field, member, type) (MEMBER, field, count_field, member, type)
+#define KV_EACH_SET_BIT(field, words)                    (SET_BIT, field, words)
+#define KV_EACH_VALUE(field, type)                       (VALUE, field, type)
+#define KV_EACH_TOKEN(field)                             (TOKEN, field)
+#define KV_EACH_DEADLINE(field)                          (DEADLINE, field)
+
+// Element list built by _prepare: [len:4][element] entries
+typedef struct {
+    char *data;
+    size_t len;     // Bytes used
+    size_t cap;
+    size_t count;   // Elements
+    int rc;         // KVSTORE_ERROR after a failed allocation
+} kvstore_elems_t;
+
+// Reserve len bytes for the next element; NULL on allocation failure
+char* kvstore_elems_push(kvstore_elems_t *e, size_t len);
+
+// Sort elements and drop duplicates
+int kvstore_elems_finish(kvstore_elems_t *e);
+
+// Longest term kept by the tokenizer; longer words are cut to this
+#define KVSTORE_TERM_MAX 32
+
+// Read the next term of the text at *p into term (KVSTORE_TERM_MAX bytes)
+// and advance *p past it. Terms are runs of ASCII letters and digits,
+// lowercased, and non-ASCII bytes (so UTF-8 words stay whole). Returns the
+// term length, or 0 at the end of the text.
+size_t kvstore_next_term(const char **p, char *term);
+
+// Push every term of text (NULL is empty) as an element: term bytes + NUL
+void kvstore_tokenize(kvstore_elems_t *e, const char *text);
+
+// Walk the difference between two sorted element lists in element order,
+// calling fn for each removed (add == false) or added element. replace_all
+// treats every old element as removed and every current one as added.
+int kvstore_elems_diff(const char *cur, size_t cur_len,
+                       const char *old, size_t old_len, bool replace_all,
+                       int (*fn)(const char *elem, size_t elem_len, bool add, void *arg),
+                       void *arg);
+
+// Apply the difference between two sorted element lists to the index at
+// prefix. Every old entry moves if the primary key changed.
+int kvstore_elems_apply(kvstore_txn_t *txn, const char *prefix,
+                        const char *cur, size_t cur_len,
+                        const char *old, size_t old_len,
+                        const char *pk, size_t pk_len,
+                        const char *old_pk, size_t old_pk_len);
+
+// Call fn with the primary key of every entry at prefix + key, stopping
+// when fn returns non-zero. Returns that value, KVSTORE_OK, or
+// KVSTORE_NOTFOUND if there were no entries.
+int kvstore_index_scan(kvstore_txn_t *txn, const char *prefix,
+                       const char *key, size_t key_len,
+                       int (*fn)(kvstore_val_t *pk, void *arg), void *arg);
+
+#define KV_MULTI_TYPE(src) KV_MULTI_TYPE_I src
+#define KV_MULTI_TYPE_I(kind, ...) SER_CAT(KV_MULTI_TYPE_, kind)(__VA_ARGS__)
+#define KV_MULTI_TYPE_ELEMENT(field, type, count) type
+#define KV_MULTI_TYPE_MEMBER(field, count_field, member, type) type
+#define KV_MULTI_TYPE_SET_BIT(field, words) uint32_t
+#define KV_MULTI_TYPE_VALUE(field, type) type
+#define KV_MULTI_TYPE_DEADLINE(field) timespec
+
+#define KV_MULTI_PUSH(type, v) do { \
+    char *_e = kvstore_elems_push(&st->elems, TYPE_SIZEOF(SER_MAP(type), (v))); \
+    if (_e) TYPE_ENC(SER_MAP(type), _e, (v)); \
+} while (0)
+
+#define KV_MULTI_EMIT(src) KV_MULTI_EMIT_I src
+#define KV_MULTI_EMIT_I(kind, ...) SER_CAT(KV_MULTI_EMIT_, kind)(__VA_ARGS__)
+
+#define KV_MULTI_EMIT_ELEMENT(field, type, count) \
+    for (size_t _i = 0; _i < (size_t)(count); _i++) { \
+        KV_MULTI_PUSH(type, rec->field[_i]); \
+    }
+
+#define KV_MULTI_EMIT_MEMBER(field, count_field, member, type) \
+    for (size_t _i = 0; rec->field && _i < (size_t)rec->count_field; _i++) { \
+        KV_MULTI_PUSH(type, rec->field[_i].member); \
+    }
+
+#define KV_MULTI_EMIT_SET_BIT(field, words) \
+    for (size_t _w = 0; _w < (size_t)(words); _w++) { \
+        for (uint32_t _bits = rec->field[_w]; _bits; _bits &= _bits - 1) { \
+            uint32_t _bit = (uint32_t)(_w * 32 + __builtin_ctz(_bits)); \
+            KV_MULTI_PUSH(uint32_t, _bit); \
+        } \
+    }
+
+#define KV_MULTI_EMIT_VALUE(field, type) \
+    KV_MULTI_PUSH(type, rec->field);
+
+// A timespec field, left out of the index while zero (never expires)
+#define KV_MULTI_EMIT_DEADLINE(field) \
+    if (rec->field.tv_sec || rec->field.tv_nsec) { \
+        KV_MULTI_PUSH(timespec, rec->field); \
+    }
+
+// Terms are not serialized charptr values, so KV_EACH_TOKEN has no
+// KV_MULTI_TYPE and only works with SERIALISE_TEXT_KEY
+#define KV_MULTI_EMIT_TOKEN(field) \
+    kvstore_tokenize(&st->elems, rec->field);
+
+// Shared by element-keyed index kinds: key struct, lookups and maintenance
+// hooks. The kind defines <rec>_<index>_scan(txn, key, key_len, fn, arg)
+// and passes the function applying element list changes.
+#define KV_ELEMENT_KEY_COMMON(rec_type, prefix, index_name, source, apply_fn) \
+\
+/* Key struct holds one element: struct rec_type_index_name_key { value } */ \
+KV_GENERATE_STRUCT(SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)), \
+                   SERIALISE_FIELD(value, KV_MULTI_TYPE(source))) \
+KV_SERIALISE_KEY(rec_type, index_name, SER_CAT(index_name, _key), \
+                 SERIALISE_FIELD(value, KV_MULTI_TYPE(source))) \
+\
+/* LOOKUP EACH: Element -> every primary key holding it */ \
+KV_ELEMENT_KEY_DECODE(rec_type, index_name) \
+\
+static inline int SER_CAT(kvstore_lookup_each_, SER_CAT(rec_type, SER_CAT(_, index_name)))( \
+    kvstore_txn_t *txn, \
+    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) *sec_key, \
+    int (*fn)(struct SER_CAT(rec_type, _pk) *pk, void *arg), void *arg) { \
+    \
+    size_t sk_sz = SER_CAT(serialise_, KV_SK_FN(rec_type, index_name, _size))(sec_key); \
+    char *sk_buf = (char*)alloca(sk_sz); \
+    SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, index_name)))(sk_buf, sec_key); \
     \
-    return kvstore_txn_put(txn, "", &k, &v); \
+    struct KV_SK_FN(rec_type, index_name, _each_ctx) ctx = { fn, arg }; \
+    return KV_SK_FN(rec_type, index_name, _scan)(txn, sk_buf, sk_sz, \
+        KV_SK_FN(rec_type, index_name, _each_decode), &ctx); \
+} \
+\
+/* LOOKUP: Element -> first primary key holding it */ \
+static inline int KV_SK_FN(rec_type, index_name, _first)( \
+    struct SER_CAT(rec_type, _pk) *pk, void *arg) { \
+    *(struct SER_CAT(rec_type, _pk)*)arg = *pk; \
+    return KVSTORE_EXISTS; \
+} \
+\
+static inline int SER_CAT(kvstore_lookup_, SER_CAT(rec_type, SER_CAT(_, index_name)))( \
+    kvstore_txn_t *txn, \
+    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) *sec_key, \
+    struct SER_CAT(rec_type, _pk) *pri_key_out) { \
+    int rc = SER_CAT(kvstore_lookup_each_, SER_CAT(rec_type, SER_CAT(_, index_name)))( \
+        txn, sec_key, KV_SK_FN(rec_type, index_name, _first), pri_key_out); \
+    return rc == KVSTORE_EXISTS ? KVSTORE_OK : rc; \
+} \
+\
+KV_ELEMENT_KEY_HOOKS(rec_type, index_name, source, apply_fn)
+
+// Decode serialized primary keys for a typed callback
+#define KV_ELEMENT_KEY_DECODE(rec_type, index_name) \
+struct KV_SK_FN(rec_type, index_name, _each_ctx) { \
+    int (*fn)(struct SER_CAT(rec_type, _pk) *pk, void *arg); \
+    void *arg; \
+}; \
+\
+static inline int KV_SK_FN(rec_type, index_name, _each_decode)(kvstore_val_t *pk, void *arg) { \
+    struct KV_SK_FN(rec_type, index_name, _each_ctx) *ctx = \
+        (struct KV_SK_FN(rec_type, index_name, _each_ctx)*)arg; \
+    struct SER_CAT(rec_type, _pk) key; \
+    SER_CAT(deserialise_, SER_CAT(rec_type, _pk))((char*)pk->data, &key); \
+    return ctx->fn(&key, ctx->arg); \
+}
+
+// Maintenance hooks: the key buffer data is the sorted element list
+#define KV_ELEMENT_KEY_HOOKS(rec_type, index_name, source, apply_fn) \
+struct KV_SK_FN(rec_type, index_name, _state) { \
+    kvstore_elems_t elems; \
+    size_t sz; \
+}; \
+\
+static inline int KV_SK_FN(rec_type, index_name, _prepare)( \
+    struct rec_type *rec, struct KV_SK_FN(rec_type, index_name, _state) *st) { \
+    memset(&st->elems, 0, sizeof(st->elems)); \
+    KV_MULTI_EMIT(source) \
+    int rc = kvstore_elems_finish(&st->elems); \
+    st->sz = st->elems.len; \
+    return rc; \
+} \
+\
+static inline char* KV_SK_FN(rec_type, index_name, _write)( \
+    char *p, struct KV_SK_FN(rec_type, index_name, _state) *st) { \
+    uint32_t len = (uint32_t)st->sz; \
+    memcpy(p, &len, 4); \
+    p += 4; \
+    if (st->sz) memcpy(p, st->elems.data, st->sz); \
+    return p + st->sz; \
+} \
+\
+static inline int KV_SK_FN(rec_type, index_name, _update)( \
+    kvstore_txn_t *txn, struct KV_SK_FN(rec_type, index_name, _state) *st, \
+    char *old, uint32_t old_len, char *pk_buf, size_t pk_sz, \
+    char *old_pk, size_t old_pk_sz, const char *sk_prefix) { \
+    return apply_fn(txn, sk_prefix, st->elems.data, st->sz, \
+                    old, old_len == KV_SK_ABSENT ? 0 : old_len, \
+                    pk_buf, pk_sz, old_pk, old_pk_sz); \
+} \
+\
+static inline int KV_SK_FN(rec_type, index_name, _remove)( \
+    kvstore_txn_t *txn, char *old, uint32_t old_len, \
+    char *old_pk, size_t old_pk_sz, const char *sk_prefix) { \
+    return apply_fn(txn, sk_prefix, NULL, 0, \
+                    old, old_len == KV_SK_ABSENT ? 0 : old_len, \
+                    old_pk, old_pk_sz, old_pk, old_pk_sz); \
+} \
+\
+static inline void KV_SK_FN(rec_type, index_name, _release)( \
+    struct KV_SK_FN(rec_type, index_name, _state) *st) { \
+    free(st->elems.data); \
+}
+
+#define SERIALISE_MULTI_KEY(rec_type, prefix, index_name, source) \
+\
+static inline int KV_SK_FN(rec_type, index_name, _scan)( \
+    kvstore_txn_t *txn, const char *sk, size_t sk_len, \
+    int (*fn)(kvstore_val_t *pk, void *arg), void *arg) { \
+    return kvstore_index_scan(txn, prefix, sk, sk_len, fn, arg); \
 } \
 \
-/* INTERNAL DELETE: Remove secondary index entry */ \
-static inline int SER_CAT(kvstore_del_, SER_CAT(rec_type, SER_CAT(_, SER_CAT(index_name, _internal))))( \
-    kvstore_txn_t *txn, char *sk_buf, size_t sk_sz, const char *sk_prefix) { \
+KV_ELEMENT_KEY_COMMON(rec_type, prefix, index_name, source, kvstore_elems_apply) \
+\
+/* CURSOR: Iterate entries from an element (keys carry the primary key) */ \
+static inline kvstore_cursor_t* SER_CAT(kvstore_cursor_, SER_CAT(rec_type, SER_CAT(_, index_name)))( \
+    kvstore_txn_t *txn, \
+    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) *start_key) { \
     \
-    /* Prepend prefix to secondary key */ \
-    size_t prefix_len = strlen(sk_prefix); \
-    size_t prefixed_sz = prefix_len + sk_sz; \
-    char *prefixed_buf = (char*)alloca(prefixed_sz); \
-    memcpy(prefixed_buf, sk_prefix, prefix_len); \
-    memcpy(prefixed_buf + prefix_len, sk_buf, sk_sz); \
+    size_t prefix_len = strlen(prefix); \
+    size_t key_sz = start_key ? \
+        SER_CAT(serialise_, KV_SK_FN(rec_type, index_name, _size))(start_key) : 0; \
+    char *buf = (char*)alloca(prefix_len + key_sz); \
+    memcpy(buf, prefix, prefix_len); \
+    if (start_key) { \
+        SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, index_name)))(buf + prefix_len, start_key); \
+    } \
     \
-    kvstore_val_t k = { prefixed_buf, prefixed_sz }; \
-    return kvstore_txn_del(txn, "", &k); \
+    kvstore_val_t start = { buf, prefix_len + key_sz }; \
+    return kvstore_cursor_open(txn, "", &start); \
+} \
+\
+/* STREAM: Primary keys holding an element, in primary key order */ \
+static inline int SER_CAT(kvstore_stream_, SER_CAT(rec_type, SER_CAT(_, index_name)))( \
+    kvstore_pk_stream_t *stream, \
+    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(index_name, _key)) *key) { \
+    size_t sk_sz = SER_CAT(serialise_, KV_SK_FN(rec_type, index_name, _size))(key); \
+    char *sk_buf = (char*)alloca(sk_sz); \
+    SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, index_name)))(sk_buf, key); \
+    return kvstore_pk_stream_init(stream, prefix, sk_buf, sk_sz, true, true); \
 }
 
 // ------------------------
-// Index finalization macro - generates helper functions
+// Expiry key macro
 // ------------------------
 
-// Helper macros for iterating over secondary keys
-#define KV_POPULATE_SK_SIZE(rec_type, sk_name) \
-    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(sk_name, _key)) SER_CAT(sk_, sk_name); \
-    SER_CAT(rec_type, SER_CAT(_extract_, sk_name))(rec, &SER_CAT(sk_, sk_name)); \
-    size_t SER_CAT(sk_, SER_CAT(sk_name, _sz)) = \
-        SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, SER_CAT(sk_name, _size))))(&SER_CAT(sk_, sk_name)); \
-    total += 4 + SER_CAT(sk_, SER_CAT(sk_name, _sz));
+// Deadline index over a timespec field, plus an incremental sweeper that
+// deletes expired records with all their index entries. A zero deadline
+// never expires.
+// Usage:
+//   SERIALISE_EXPIRY_KEY(session_record, "sess_exp:", by_expiry, expires)
+//   (and by_expiry, "sess_exp:" in SERIALISE_FINALIZE_INDICES)
+// Generates kvstore_sweep_<rec>_<index>(txn, now, max, fn, arg, stats),
+// which deletes up to max records whose deadline is at or before now,
+// earliest first. Each deleted record is then passed to fn, which owns any
+// allocated fields as with kvstore_get_* (NULL only for records without
+// allocated fields). Returns KVSTORE_EXISTS if more expired records
+// remain, otherwise KVSTORE_OK.
+
+// Sweeper counters, accumulated across calls (zero-initialise)
+typedef struct {
+    uint64_t expired;   // Records deleted
+    uint64_t orphans;   // Deadline entries without a record, deleted
+    uint64_t sweeps;    // Calls
+    uint64_t backlog;   // Calls that stopped at max with more due
+    double busy_sec;    // Time spent in calls
+    double first;       // Monotonic clock at the first call (seconds)
+} kvstore_sweep_stats_t;
+
+// Records expired per second of wall time since the first sweep; with
+// per_busy_sec, also per second spent sweeping
+double kvstore_sweep_rate(const kvstore_sweep_stats_t *s, double *per_busy_sec);
+
+// Sweep the deadline index at prefix: call expire with the primary key of
+// up to max entries whose deadline (the bound_len bytes after prefix) is at
+// most bound, earliest first, counting into stats (may be NULL). An entry
+// whose expire returns KVSTORE_NOTFOUND has no record left and is deleted.
+// Returns KVSTORE_EXISTS if more were due, or the first failing expire
+// result.
+int kvstore_expiry_sweep(kvstore_txn_t *txn, const char *prefix,
+                         const char *bound, size_t bound_len, size_t max,
+                         int (*expire)(kvstore_val_t *pk, void *arg), void *arg,
+                         kvstore_sweep_stats_t *stats);
+
+#define SERIALISE_EXPIRY_KEY(rec_type, prefix, index_name, field) \
+\
+SERIALISE_MULTI_KEY(rec_type, prefix, index_name, KV_EACH_DEADLINE(field)) \
+\
+/* Defined by SERIALISE_FINALIZE_INDICES */ \
+static inline int SER_CAT(kvstore_del_, SER_CAT(rec_type, _with_all_indices))( \
+    kvstore_txn_t *txn, kvstore_key_buf_t *old_keys); \
+\
+/* SWEEP: Delete records whose deadline has passed */ \
+struct KV_SK_FN(rec_type, index_name, _sweep_ctx) { \
+    kvstore_txn_t *txn; \
+    int (*fn)(struct rec_type *rec, void *arg); \
+    void *arg; \
+}; \
+\
+static inline int KV_SK_FN(rec_type, index_name, _expire)(kvstore_val_t *pk, void *arg) { \
+    struct KV_SK_FN(rec_type, index_name, _sweep_ctx) *ctx = \
+        (struct KV_SK_FN(rec_type, index_name, _sweep_ctx)*)arg; \
+    struct SER_CAT(rec_type, _pk) key; \
+    SER_CAT(deserialise_, SER_CAT(rec_type, _pk))((char*)pk->data, &key); \
+    \
+    struct rec_type rec; \
+    memset(&rec, 0, sizeof(rec)); \
+    kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT; \
+    int rc = SER_CAT(kvstore_get_, rec_type)(ctx->txn, &key, &rec, &kb); \
+    if (rc != KVSTORE_OK) return rc; \
+    rc = SER_CAT(kvstore_del_, SER_CAT(rec_type, _with_all_indices))(ctx->txn, &kb); \
+    kvstore_key_buf_free(&kb); \
+    if (rc == KVSTORE_OK && ctx->fn) rc = ctx->fn(&rec, ctx->arg); \
+    return rc; \
+} \
+\
+static inline int SER_CAT(kvstore_sweep_, SER_CAT(rec_type, SER_CAT(_, index_name)))( \
+    kvstore_txn_t *txn, const struct timespec *now, size_t max, \
+    int (*fn)(struct rec_type *rec, void *arg), void *arg, \
+    kvstore_sweep_stats_t *stats) { \
+    char bound[8], *p = bound; \
+    TYPE_ENC(SER_MAP(timespec), p, *now); \
+    (void)p; \
+    struct KV_SK_FN(rec_type, index_name, _sweep_ctx) ctx = { txn, fn, arg }; \
+    return kvstore_expiry_sweep(txn, prefix, bound, sizeof(bound), max, \
+                                KV_SK_FN(rec_type, index_name, _expire), &ctx, stats); \
+}
 
-#define KV_POPULATE_SK_DATA(rec_type, sk_name) \
-    len = (uint32_t)SER_CAT(sk_, SER_CAT(sk_name, _sz)); \
-    memcpy(p, &len, 4); p += 4; \
-    SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, sk_name)))(p, &SER_CAT(sk_, sk_name)); \
-    p += SER_CAT(sk_, SER_CAT(sk_name, _sz));
+// ------------------------
+// Posting-list key macro
+// ------------------------
+
+// Like SERIALISE_MULTI_KEY, but each element's primary keys are stored as
+// chunked, delta + bit-packed lists instead of one entry per pair. Suits
+// elements shared by many records (a recipient on 100k messages). The
+// serialized primary key must be fixed-size and at most 8 bytes (e.g.
+// two uint32_t fields); it is packed as a big-endian integer.
+// Usage:
+//   SERIALISE_POSTING_KEY(message_record, "msg_rcpt:", by_recipient,
+//       KV_EACH_MEMBER(recipients, num_recipients, addr, charptr))
+// Generates the key struct, kvstore_lookup_<rec>_<index>() and
+// kvstore_lookup_each_<rec>_<index>() (in primary key order).
+
+// Apply element list changes as posting list inserts and removals
+int kvstore_posting_apply(kvstore_txn_t *txn, const char *prefix,
+                          const char *cur, size_t cur_len,
+                          const char *old, size_t old_len,
+                          const char *pk, size_t pk_len,
+                          const char *old_pk, size_t old_pk_len);
+
+// Call fn with every primary key (pk_len bytes) in the posting list of
+// prefix + key, in order. Same returns as kvstore_index_scan().
+int kvstore_posting_scan(kvstore_txn_t *txn, const char *prefix,
+                         const char *key, size_t key_len, size_t pk_len,
+                         int (*fn)(kvstore_val_t *pk, void *arg), void *arg);
+
+#define SERIALISE_POSTING_KEY(rec_type, prefix, index_name, source) \
+\
+static inline int KV_SK_FN(rec_type, index_name, _scan)( \
+    kvstore_txn_t *txn, const char *sk, size_t sk_len, \
+    int (*fn)(kvstore_val_t *pk, void *arg), void *arg) { \
+    struct SER_CAT(rec_type, _pk) zero; \
+    memset(&zero, 0, sizeof(zero)); \
+    size_t pk_len = SER_CAT(serialise_, SER_CAT(rec_type, _pk_size))(&zero); \
+    return kvstore_posting_scan(txn, prefix, sk, sk_len, pk_len, fn, arg); \
+} \
+\
+KV_ELEMENT_KEY_COMMON(rec_type, prefix, index_name, source, kvstore_posting_apply)
+
+// ------------------------
+// Full-text key macro
+// ------------------------
+
+// Inverted index over the terms of a charptr field (see kvstore_next_term),
+// stored as posting lists. Terms are stored as their bytes + NUL rather than
+// as serialized strings, so all terms starting with a prefix are adjacent.
+// The serialized primary key has the posting list limits (at most 8 bytes).
+// Usage:
+//   SERIALISE_TEXT_KEY(message_record, "msg_subj:", by_subject_term, subject)
+// Generates kvstore_search_<rec>_<index>(txn, query, fn, arg): query terms
+// are ANDed, and a term ending in '*' matches every term it prefixes
+// ("invoice pay*"). fn gets the matching primary keys in primary key order.
+
+// Call fn with the primary key (pk_len bytes) of every record holding all
+// terms of query in the text index at prefix, in order. Returns
+// KVSTORE_NOTFOUND if nothing matched (or query has no terms), or the first
+// non-zero fn result.
+int kvstore_text_search(kvstore_txn_t *txn, const char *prefix,
+                        const char *query, size_t pk_len,
+                        int (*fn)(kvstore_val_t *pk, void *arg), void *arg);
+
+#define SERIALISE_TEXT_KEY(rec_type, prefix, index_name, field) \
+\
+KV_ELEMENT_KEY_DECODE(rec_type, index_name) \
+KV_ELEMENT_KEY_HOOKS(rec_type, index_name, KV_EACH_TOKEN(field), kvstore_posting_apply) \
+\
+/* SEARCH: Query terms -> primary keys of records holding all of them */ \
+static inline int SER_CAT(kvstore_search_, SER_CAT(rec_type, SER_CAT(_, index_name)))( \
+    kvstore_txn_t *txn, const char *query, \
+    int (*fn)(struct SER_CAT(rec_type, _pk) *pk, void *arg), void *arg) { \
+    struct SER_CAT(rec_type, _pk) zero; \
+    memset(&zero, 0, sizeof(zero)); \
+    size_t pk_len = SER_CAT(serialise_, SER_CAT(rec_type, _pk_size))(&zero); \
+    struct KV_SK_FN(rec_type, index_name, _each_ctx) ctx = { fn, arg }; \
+    return kvstore_text_search(txn, prefix, query, pk_len, \
+        KV_SK_FN(rec_type, index_name, _each_decode), &ctx); \
+}
+
+// ------------------------
+// Index intersection
+// ------------------------
+
+// Primary keys stored under one index key prefix (an equality match)
+typedef struct {
+    char *key;          // Index prefix + serialized key bytes (malloc'd)
+    size_t key_len;
+    bool pk_ordered;    // Entries arrive in primary key order
+    bool pk_suffix;     // Entry keys are key + primary key (seekable)
+} kvstore_pk_stream_t;
+
+int kvstore_pk_stream_init(kvstore_pk_stream_t *s, const char *prefix,
+                           const char *key, size_t key_len,
+                           bool pk_ordered, bool pk_suffix);
+void kvstore_pk_stream_free(kvstore_pk_stream_t *s);
+
+// Call fn, in primary key order, for each primary key present in all n
+// streams. Ordered streams are merged with seeks; unordered ones are hashed
+// and probed. List the most selective unordered stream first: it races the
+// merged ordered streams and the shorter of the two is held in memory.
+// Returns KVSTORE_NOTFOUND if nothing matched, or the first non-zero fn
+// result.
+int kvstore_intersect(kvstore_txn_t *txn, kvstore_pk_stream_t *streams, size_t n,
+                      int (*fn)(kvstore_val_t *pk, void *arg), void *arg);
+
+// ------------------------
+// Aggregate macro
+// ------------------------
+
+// Aggregate columns (all stored as int64_t)
+#define KV_AGG_COUNT(name)                        (COUNT, name)
+#define KV_AGG_SUM(name, field)                   (SUM, name, field)
+#define KV_AGG_COUNT_IF(name, field, mask, value) (COUNT_IF, name, field, mask, value)
 
-#define KV_PUT_SK_WITH_CHANGE_DETECT(rec_type, sk_name, sk_idx, sk_prefix) \
-    char *SER_CAT(new_sk_, SER_CAT(sk_name, _buf)) = (char*)alloca(SER_CAT(sk_, SER_CAT(sk_name, _sz))); \
-    SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, sk_name)))(SER_CAT(new_sk_, SER_CAT(sk_name, _buf)), \
-                                                                  &SER_CAT(sk_, sk_name)); \
+#define KV_UNPAREN(...) __VA_ARGS__
+
+#define KV_AGG_DECL(t) KV_AGG_DECL_I t
+#define KV_AGG_DECL_I(kind, name, ...) int64_t name
+
+// Contribution of one record to a column
+#define KV_AGG_VAL(t) KV_AGG_VAL_I t
+#define KV_AGG_VAL_I(kind, ...) SER_CAT(KV_AGG_VAL_, kind)(__VA_ARGS__)
+#define KV_AGG_VAL_COUNT(name) 1
+#define KV_AGG_VAL_SUM(name, field) (int64_t)rec->field
+#define KV_AGG_VAL_COUNT_IF(name, field, mask, value) (((rec->field) & (mask)) == (value))
+
+#define KV_AGG_ENC(t) SER_WRITE_U64(p, (uint64_t)(KV_AGG_VAL(t)))
+
+#define KV_AGG_DEC(t) KV_AGG_DEC_I t
+#define KV_AGG_DEC_I(kind, name, ...) SER_READ_U64(p, out->name)
+
+// Add n int64 deltas (negated if sign < 0) to the row at prefix + group.
+// Rows that return to all zeros are deleted.
+int kvstore_agg_update(kvstore_txn_t *txn, const char *prefix,
+                       const char *group, size_t group_len,
+                       const int64_t *delta, size_t n, int sign);
+
+// Hooks connecting SERIALISE_FINALIZE_AGGREGATES to the index helpers.
+// Contributions travel in the key buffer after the secondary keys.
+typedef struct {
+    size_t (*size)(void *rec);
+    char* (*encode)(char *p, void *rec);
+    int (*apply)(kvstore_txn_t *txn, char *new_data, char *old_data);
+} kvstore_agg_hooks_t;
+
+// Usage:
+//   SERIALISE_AGGREGATE(message_record, "mbox_stat:", mailbox_status,
+//       (KV_AGG_COUNT(messages),
+//        KV_AGG_SUM(total_size, size),
+//        KV_AGG_COUNT_IF(unseen, flags, FLAG_SEEN, 0)),
+//       SERIALISE_FIELD(mailbox_id, uint32_t))
+//
+// Generates struct message_record_mailbox_status (one int64_t per column),
+// struct message_record_mailbox_status_key (the group fields) and
+// kvstore_get_message_record_mailbox_status(). Rows are maintained by
+// kvstore_put/del_<rec>_with_all_indices once listed in
+// SERIALISE_FINALIZE_AGGREGATES.
+#define SERIALISE_AGGREGATE(rec_type, prefix, agg_name, aggs, ...) \
+    /* Generate struct rec_type_agg_name_key */ \
+    KV_GENERATE_STRUCT(SER_CAT(SER_CAT(rec_type, _), SER_CAT(agg_name, _key)), \
+                       __VA_ARGS__) \
     \
-    if (old_keys && old_keys->buf) { \
-        bool SER_CAT(sk_, SER_CAT(sk_name, _changed)) = \
-            (old_sk_lens[sk_idx] != SER_CAT(sk_, SER_CAT(sk_name, _sz)) || \
-             memcmp(old_sk_bufs[sk_idx], SER_CAT(new_sk_, SER_CAT(sk_name, _buf)), \
-                    SER_CAT(sk_, SER_CAT(sk_name, _sz))) != 0); \
-        if (SER_CAT(sk_, SER_CAT(sk_name, _changed))) { \
-            SER_CAT(kvstore_del_, SER_CAT(rec_type, SER_CAT(_, SER_CAT(sk_name, _internal))))( \
-                txn, old_sk_bufs[sk_idx], old_sk_lens[sk_idx], sk_prefix); \
-        } \
+    /* Generate struct rec_type_agg_name */ \
+    struct SER_CAT(rec_type, SER_CAT(_, agg_name)) { \
+        FOR_EACH(KV_AGG_DECL, KV_UNPAREN aggs) \
+    }; \
+    \
+    /* Generate group key serialization and extractor */ \
+    KV_SERIALISE_KEY(rec_type, agg_name, SER_CAT(agg_name, _key), __VA_ARGS__) \
+    KV_GENERATE_EXTRACTOR_SK(rec_type, agg_name, __VA_ARGS__) \
+    \
+    /* Generate maintenance and lookup */ \
+    KV_AGGREGATE_OPS(rec_type, prefix, agg_name, aggs)
+
+#define KV_AGG_NCOLS(rec_type, agg_name) \
+    (sizeof(struct SER_CAT(rec_type, SER_CAT(_, agg_name))) / sizeof(int64_t))
+
+#define KV_AGGREGATE_OPS(rec_type, prefix, agg_name, aggs) \
+\
+/* CONTRIBUTION SIZE: [group_len:4][group][column:8]... */ \
+static inline size_t SER_CAT(rec_type, SER_CAT(_, SER_CAT(agg_name, _contrib_size)))( \
+    struct rec_type *rec) { \
+    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(agg_name, _key)) gk; \
+    SER_CAT(rec_type, SER_CAT(_extract_, agg_name))(rec, &gk); \
+    return 4 + SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, SER_CAT(agg_name, _size))))(&gk) + \
+           8 * KV_AGG_NCOLS(rec_type, agg_name); \
+} \
+\
+/* CONTRIBUTION ENCODE: group key and this record's column values */ \
+static inline char* SER_CAT(rec_type, SER_CAT(_, SER_CAT(agg_name, _contrib_encode)))( \
+    char *p, struct rec_type *rec) { \
+    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(agg_name, _key)) gk; \
+    SER_CAT(rec_type, SER_CAT(_extract_, agg_name))(rec, &gk); \
+    uint32_t len = (uint32_t)SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, SER_CAT(agg_name, _size))))(&gk); \
+    memcpy(p, &len, 4); p += 4; \
+    p = SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, agg_name)))(p, &gk); \
+    FOR_EACH(KV_AGG_ENC, KV_UNPAREN aggs) \
+    return p; \
+} \
+\
+/* CONTRIBUTION APPLY: add new and subtract old (either may be NULL); */ \
+/* advances both cursors past this aggregate */ \
+static inline int SER_CAT(rec_type, SER_CAT(_, SER_CAT(agg_name, _contrib_apply)))( \
+    kvstore_txn_t *txn, char **new_p, char **old_p) { \
+    \
+    enum { ncols = KV_AGG_NCOLS(rec_type, agg_name) }; \
+    char *groups[2] = {0}; \
+    uint32_t group_lens[2] = {0}; \
+    int64_t vals[2][ncols]; \
+    char **cursors[2] = { new_p, old_p }; \
+    \
+    for (int side = 0; side < 2; side++) { \
+        char *p = *cursors[side]; \
+        if (!p) continue; \
+        memcpy(&group_lens[side], p, 4); p += 4; \
+        groups[side] = p; p += group_lens[side]; \
+        for (size_t c = 0; c < ncols; c++) SER_READ_U64(p, vals[side][c]); \
+        *cursors[side] = p; \
+    } \
+    \
+    /* Same group on both sides: one net delta */ \
+    if (groups[0] && groups[1] && group_lens[0] == group_lens[1] && \
+        memcmp(groups[0], groups[1], group_lens[0]) == 0) { \
+        for (size_t c = 0; c < ncols; c++) vals[0][c] -= vals[1][c]; \
+        groups[1] = NULL; \
+    } \
+    \
+    int rc; \
+    if (groups[0]) { \
+        rc = kvstore_agg_update(txn, prefix, groups[0], group_lens[0], vals[0], ncols, 1); \
+        if (rc != KVSTORE_OK) return rc; \
+    } \
+    if (groups[1]) { \
+        rc = kvstore_agg_update(txn, prefix, groups[1], group_lens[1], vals[1], ncols, -1); \
+        if (rc != KVSTORE_OK) return rc; \
     } \
+    return KVSTORE_OK; \
+} \
+\
+/* GET: Read aggregate row in O(1); NOTFOUND (all zeros) if no records */ \
+static inline int SER_CAT(kvstore_get_, SER_CAT(rec_type, SER_CAT(_, agg_name)))( \
+    kvstore_txn_t *txn, \
+    struct SER_CAT(SER_CAT(rec_type, _), SER_CAT(agg_name, _key)) *group_key, \
+    struct SER_CAT(rec_type, SER_CAT(_, agg_name)) *out) { \
+    \
+    memset(out, 0, sizeof(*out)); \
+    \
+    size_t gk_sz = SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, SER_CAT(agg_name, _size))))(group_key); \
+    size_t prefix_len = strlen(prefix); \
+    char *key_buf = (char*)alloca(prefix_len + gk_sz); \
+    memcpy(key_buf, prefix, prefix_len); \
+    SER_CAT(serialise_, SER_CAT(rec_type, SER_CAT(_, agg_name)))(key_buf + prefix_len, group_key); \
     \
-    rc = SER_CAT(kvstore_put_, SER_CAT(rec_type, SER_CAT(_, SER_CAT(sk_name, _internal))))( \
-        txn, rec, pk_buf, pk_sz, sk_prefix); \
+    kvstore_val_t k = { key_buf, prefix_len + gk_sz }; \
+    kvstore_val_t v = {0}; \
+    int rc = kvstore_txn_get(txn, "", &k, &v); \
+    if (rc != KVSTORE_OK) return rc; \
+    if (v.size != sizeof(*out)) return KVSTORE_ERROR; \
+    \
+    char *p = (char*)v.data; \
+    FOR_EACH(KV_AGG_DEC, KV_UNPAREN aggs) \
+    return KVSTORE_OK; \
+}
+
+// Wire aggregates into the index helpers
+// Usage: SERIALISE_FINALIZE_AGGREGATES(record_type, agg1, agg2, ...)
+#define KV_AGG_HOOK_SIZE(rec_type, agg_name) \
+    total += SER_CAT(rec_type, SER_CAT(_, SER_CAT(agg_name, _contrib_size)))(rec);
+
+#define KV_AGG_HOOK_ENCODE(rec_type, agg_name) \
+    p = SER_CAT(rec_type, SER_CAT(_, SER_CAT(agg_name, _contrib_encode)))(p, rec);
+
+#define KV_AGG_HOOK_APPLY(rec_type, agg_name) \
+    rc = SER_CAT(rec_type, SER_CAT(_, SER_CAT(agg_name, _contrib_apply)))(txn, &new_data, &old_data); \
     if (rc != KVSTORE_OK) return rc;
 
+// <rec>_agg_hooks is NULL until SERIALISE_FINALIZE_AGGREGATES points it at
+// the record's table. C completes a tentative definition; C++ has no
+// tentative definitions, so it starts NULL and is assigned during static
+// initialisation.
+#ifdef __cplusplus
+#define KV_AGG_HOOKS_DECLARE(rec_type) \
+    static const kvstore_agg_hooks_t *SER_CAT(rec_type, _agg_hooks) = NULL;
+#define KV_AGG_HOOKS_SET(rec_type) \
+    static const bool SER_CAT(rec_type, _agg_hooks_set) = \
+        (SER_CAT(rec_type, _agg_hooks) = &SER_CAT(rec_type, _agg_hooks_def), true);
+#else
+#define KV_AGG_HOOKS_DECLARE(rec_type) \
+    static const kvstore_agg_hooks_t *const SER_CAT(rec_type, _agg_hooks);
+#define KV_AGG_HOOKS_SET(rec_type) \
+    static const kvstore_agg_hooks_t *const SER_CAT(rec_type, _agg_hooks) = \
+        &SER_CAT(rec_type, _agg_hooks_def);
+#endif
+
+#define SERIALISE_FINALIZE_AGGREGATES(rec_type, ...) \
+\
+static inline size_t SER_CAT(rec_type, _agg_size)(void *r) { \
+    struct rec_type *rec = (struct rec_type*)r; \
+    size_t total = 0; \
+    KV_FINALIZE_FOR_EACH(KV_AGG_HOOK_SIZE, rec_type, __VA_ARGS__) \
+    return total; \
+} \
+\
+static inline char* SER_CAT(rec_type, _agg_encode)(char *p, void *r) { \
+    struct rec_type *rec = (struct rec_type*)r; \
+    KV_FINALIZE_FOR_EACH(KV_AGG_HOOK_ENCODE, rec_type, __VA_ARGS__) \
+    return p; \
+} \
+\
+static inline int SER_CAT(rec_type, _agg_apply)( \
+    kvstore_txn_t *txn, char *new_data, char *old_data) { \
+    int rc; \
+    KV_FINALIZE_FOR_EACH(KV_AGG_HOOK_APPLY, rec_type, __VA_ARGS__) \
+    return KVSTORE_OK; \
+} \
+\
+static const kvstore_agg_hooks_t SER_CAT(rec_type, _agg_hooks_def) = { \
+    SER_CAT(rec_type, _agg_size), \
+    SER_CAT(rec_type, _agg_encode), \
+    SER_CAT(rec_type, _agg_apply), \
+}; \
+KV_AGG_HOOKS_SET(rec_type)
+
+// ------------------------
+// Index finalization macro - generates helper functions
+// ------------------------
+
+// Helper macros for iterating over secondary keys (see KV_SECONDARY_MAINT)
+#define KV_SK_PREPARE(rec_type, sk_name) \
+    struct KV_SK_FN(rec_type, sk_name, _state) SER_CAT(st_, sk_name); \
+    if (KV_SK_FN(rec_type, sk_name, _prepare)(rec, &SER_CAT(st_, sk_name)) != KVSTORE_OK) { \
+        rc = KVSTORE_ERROR; \
+    } \
+    total += 4 + SER_CAT(st_, sk_name).sz;
+
+#define KV_SK_WRITE(rec_type, sk_name) \
+    p = KV_SK_FN(rec_type, sk_name, _write)(p, &SER_CAT(st_, sk_name));
+
+#define KV_SK_RELEASE(rec_type, sk_name) \
+    KV_SK_FN(rec_type, sk_name, _release)(&SER_CAT(st_, sk_name));
+
+#define KV_SK_UPDATE(rec_type, sk_name, sk_idx, sk_prefix) \
+    if (rc == KVSTORE_OK) { \
+        rc = KV_SK_FN(rec_type, sk_name, _update)(txn, &SER_CAT(st_, sk_name), \
+            old_sk_bufs[sk_idx], old_sk_lens[sk_idx], pk_buf, pk_sz, \
+            old_pk_buf, old_pk_len, sk_prefix); \
+    }
+
+#define KV_SK_REMOVE(rec_type, sk_name, sk_idx, sk_prefix) \
+    if (rc == KVSTORE_OK) { \
+        rc = KV_SK_FN(rec_type, sk_name, _remove)(txn, \
+            old_sk_bufs[sk_idx], old_sk_lens[sk_idx], pk_buf, pk_len, sk_prefix); \
+    }
+
 // Forward declaration for populate_key_buf function
 // Must be called BEFORE SERIALISE_PRIMARY_KEY to enable automatic key_buf population
+// Also declares the aggregate hooks, which stay NULL unless
+// SERIALISE_FINALIZE_AGGREGATES defines them
 #define SERIALISE_DECLARE_KEYS(rec_type) \
-    static inline void SER_CAT(populate_key_buf_, rec_type)(struct rec_type *rec, kvstore_key_buf_t *key_buf);
+    static inline int SER_CAT(populate_key_buf_, rec_type)(struct rec_type *rec, kvstore_key_buf_t *key_buf); \
+    KV_AGG_HOOKS_DECLARE(rec_type)
 
 // Generate populate_key_buf and put_with_all_indices functions
 // Usage: SERIALISE_FINALIZE_INDICES(record_type, sk1, "prefix1", sk2, "prefix2", ...)
 // Arguments must be pairs of (index_name, prefix_string)
 #define SERIALISE_FINALIZE_INDICES(rec_type, ...) \
 \
-/* Generate populate_key_buf function */ \
-static inline void SER_CAT(populate_key_buf_, rec_type)( \
+/* Generate populate_key_buf function; on error key_buf is left unchanged, */ \
+/* as recording a failed index as absent would orphan its entry */ \
+static inline int SER_CAT(populate_key_buf_, rec_type)( \
     struct rec_type *rec, kvstore_key_buf_t *key_buf) { \
     \
     /* Extract primary key */ \
@@ -559,13 +1659,27 @@ static inline void SER_CAT(populate_key_buf_, rec_type)( \
     size_t pk_sz = SER_CAT(serialise_, SER_CAT(rec_type, _pk_size))(&pk); \
     \
     /* Extract all secondary keys and calculate total size */ \
+    int rc = KVSTORE_OK; \
     size_t total = 4 + pk_sz; \
-    KV_FINALIZE_FOR_EACH_PAIR(KV_POPULATE_SK_SIZE, rec_type, __VA_ARGS__) \
+    KV_FINALIZE_FOR_EACH_PAIR(KV_SK_PREPARE, rec_type, __VA_ARGS__) \
+    \
+    /* Aggregate contributions follow the secondary keys */ \
+    const kvstore_agg_hooks_t *agg = SER_CAT(rec_type, _agg_hooks); \
+    if (agg) total += agg->size(rec); \
     \
     /* Allocate buffer */ \
-    if (!key_buf->buf || key_buf->size < total) { \
-        key_buf->buf = (char*)realloc(key_buf->buf, total); \
-        key_buf->size = total; \
+    if (rc == KVSTORE_OK && (!key_buf->buf || key_buf->size < total)) { \
+        char *buf = (char*)realloc(key_buf->buf, total); \
+        if (buf) { \
+            key_buf->buf = buf; \
+            key_buf->size = total; \
+        } else { \
+            rc = KVSTORE_ERROR; \
+        } \
+    } \
+    if (rc != KVSTORE_OK) { \
+        KV_FINALIZE_FOR_EACH_PAIR(KV_SK_RELEASE, rec_type, __VA_ARGS__) \
+        return rc; \
     } \
     \
     /* Serialize all keys into buffer */ \
@@ -578,7 +1692,11 @@ static inline void SER_CAT(populate_key_buf_, rec_type)( \
     SER_CAT(serialise_, SER_CAT(rec_type, _pk))(p, &pk); p += pk_sz; \
     \
     /* Secondary keys */ \
-    KV_FINALIZE_FOR_EACH_PAIR(KV_POPULATE_SK_DATA, rec_type, __VA_ARGS__) \
+    KV_FINALIZE_FOR_EACH_PAIR(KV_SK_WRITE, rec_type, __VA_ARGS__) \
+    KV_FINALIZE_FOR_EACH_PAIR(KV_SK_RELEASE, rec_type, __VA_ARGS__) \
+    \
+    if (agg) agg->encode(p, rec); \
+    return KVSTORE_OK; \
 } \
 \
 /* Generate put_with_all_indices function */ \
@@ -600,18 +1718,25 @@ static inline int SER_CAT(kvstore_put_, SER_CAT(rec_type, _with_all_indices))( \
     \
     /* Extract all secondary keys */ \
     size_t total = 0; \
-    KV_FINALIZE_FOR_EACH_PAIR(KV_POPULATE_SK_SIZE, rec_type, __VA_ARGS__) \
+    KV_FINALIZE_FOR_EACH_PAIR(KV_SK_PREPARE, rec_type, __VA_ARGS__) \
+    (void)total; \
     \
     /* Parse old keys if updating (count is half of args since we have pairs) */ \
     char *old_sk_bufs[KV_COUNT_ARGS(__VA_ARGS__) / 2]; \
     uint32_t old_sk_lens[KV_COUNT_ARGS(__VA_ARGS__) / 2]; \
+    char *old_pk_buf = NULL; \
+    uint32_t old_pk_len = 0; \
+    char *old_agg = NULL; \
     \
+    for (size_t i = 0; i < KV_COUNT_ARGS(__VA_ARGS__) / 2; i++) { \
+        old_sk_bufs[i] = NULL; \
+        old_sk_lens[i] = KV_SK_ABSENT; \
+    } \
     if (old_keys && old_keys->buf) { \
         char *p = old_keys->buf; \
         \
-        /* Skip primary key */ \
-        uint32_t old_pk_len; \
         memcpy(&old_pk_len, p, 4); \
+        old_pk_buf = p + 4; \
         p += 4 + old_pk_len; \
         \
         /* Extract old secondary keys */ \
@@ -619,12 +1744,59 @@ static inline int SER_CAT(kvstore_put_, SER_CAT(rec_type, _with_all_indices))( \
             memcpy(&old_sk_lens[i], p, 4); \
             p += 4; \
             old_sk_bufs[i] = p; \
-            p += old_sk_lens[i]; \
+            if (old_sk_lens[i] != KV_SK_ABSENT) p += old_sk_lens[i]; \
         } \
+        old_agg = p; \
+    } \
+    \
+    /* Update each secondary index from its old entries */ \
+    KV_FINALIZE_INDEXED_FOR_EACH_PAIR(KV_SK_UPDATE, rec_type, __VA_ARGS__) \
+    KV_FINALIZE_FOR_EACH_PAIR(KV_SK_RELEASE, rec_type, __VA_ARGS__) \
+    if (rc != KVSTORE_OK) return rc; \
+    \
+    /* Move aggregate contributions from the old to the new record */ \
+    const kvstore_agg_hooks_t *agg = SER_CAT(rec_type, _agg_hooks); \
+    if (agg) { \
+        char *new_agg = (char*)alloca(agg->size(rec)); \
+        agg->encode(new_agg, rec); \
+        rc = agg->apply(txn, new_agg, old_agg); \
+        if (rc != KVSTORE_OK) return rc; \
+    } \
+    \
+    return KVSTORE_OK; \
+} \
+\
+/* Generate del_with_all_indices: old_keys from kvstore_get_* names the */ \
+/* primary entry, every index entry and the aggregate contributions */ \
+static inline int SER_CAT(kvstore_del_, SER_CAT(rec_type, _with_all_indices))( \
+    kvstore_txn_t *txn, kvstore_key_buf_t *old_keys) { \
+    \
+    if (!old_keys || !old_keys->buf) return KVSTORE_ERROR; \
+    \
+    char *p = old_keys->buf; \
+    uint32_t pk_len; \
+    memcpy(&pk_len, p, 4); \
+    char *pk_buf = p + 4; \
+    int rc = SER_CAT(kvstore_del_, SER_CAT(rec_type, _internal))(txn, pk_buf, pk_len); \
+    if (rc != KVSTORE_OK) return rc; \
+    p += 4 + pk_len; \
+    \
+    char *old_sk_bufs[KV_COUNT_ARGS(__VA_ARGS__) / 2]; \
+    uint32_t old_sk_lens[KV_COUNT_ARGS(__VA_ARGS__) / 2]; \
+    for (size_t i = 0; i < KV_COUNT_ARGS(__VA_ARGS__) / 2; i++) { \
+        memcpy(&old_sk_lens[i], p, 4); \
+        p += 4; \
+        old_sk_bufs[i] = p; \
+        if (old_sk_lens[i] != KV_SK_ABSENT) p += old_sk_lens[i]; \
     } \
+    KV_FINALIZE_INDEXED_FOR_EACH_PAIR(KV_SK_REMOVE, rec_type, __VA_ARGS__) \
+    if (rc != KVSTORE_OK) return rc; \
     \
-    /* Update each secondary index with change detection */ \
-    KV_FINALIZE_INDEXED_FOR_EACH_PAIR(KV_PUT_SK_WITH_CHANGE_DETECT, rec_type, __VA_ARGS__) \
+    const kvstore_agg_hooks_t *agg = SER_CAT(rec_type, _agg_hooks); \
+    if (agg) { \
+        rc = agg->apply(txn, NULL, p); \
+        if (rc != KVSTORE_OK) return rc; \
+    } \
     \
     return KVSTORE_OK; \
 }
@@ -718,6 +1890,146 @@ static inline int SER_CAT(kvstore_put_, SER_CAT(rec_type, _with_all_indices))( \
 #define KV_IFEP_7(M, rt, idx, X1, P1, ...) M(rt, X1, idx, P1) KV_IFEP_6(M, rt, idx+1, __VA_ARGS__)
 #define KV_IFEP_8(M, rt, idx, X1, P1, ...) M(rt, X1, idx, P1) KV_IFEP_7(M, rt, idx+1, __VA_ARGS__)
 
+// ------------------------
+// Time-bucket partition macro
+// ------------------------
+
+// Routes each record, with its secondary entries and aggregates, to the
+// table of the time bucket holding a timespec field, so whole buckets can be
+// dropped at once. Bucket widths are seconds or KVSTORE_BUCKET_MONTH (UTC
+// calendar months). Bucket tables are named table_prefix + the bucket's UTC
+// start as "YYYYMMDDhhmmss" and are listed in table "" under "kv_bucket:".
+// Usage (after SERIALISE_FINALIZE_INDICES):
+//   SERIALISE_PARTITION(message_record, "msg@", received, KVSTORE_BUCKET_MONTH)
+// Generates kvstore_put/get/del_<rec>_partitioned(), a stitched record scan
+// kvstore_scan_<rec>_partitioned() and kvstore_expire_<rec>_before(). The
+// field must not change on update: delete and put again to move a record.
+// Indexes are per bucket: read them through kvstore_bucket_cursor_open().
+
+#define KVSTORE_BUCKET_MONTH 0
+#define KVSTORE_BUCKET_DAY 86400
+
+// Longest bucket table name (table_prefix is at most 48 bytes)
+#define KVSTORE_BUCKET_NAME_MAX 64
+
+// Name the table of the bucket holding time sec. With create, the bucket is
+// registered if new.
+int kvstore_bucket_table(kvstore_txn_t *txn, const char *table_prefix,
+                         int64_t sec, int64_t width, bool create, char *name_out);
+
+// Call fn with each registered bucket of table_prefix in time order, its
+// table and [start, end) in seconds, stopping when fn returns non-zero.
+// Returns that value, KVSTORE_OK, or KVSTORE_NOTFOUND if there are none.
+int kvstore_bucket_each(kvstore_txn_t *txn, const char *table_prefix,
+                        int (*fn)(const char *table, int64_t start, int64_t end, void *arg),
+                        void *arg);
+
+// Drop every bucket ending at or before sec, counting them in *dropped
+// (may be NULL)
+int kvstore_bucket_drop_before(kvstore_txn_t *txn, const char *table_prefix,
+                               int64_t sec, size_t *dropped);
+
+// Cursor over the keys starting with key_prefix in every bucket, bucket by
+// bucket in time order (key order within each bucket)
+typedef struct kvstore_bucket_cursor kvstore_bucket_cursor_t;
+
+kvstore_bucket_cursor_t* kvstore_bucket_cursor_open(kvstore_txn_t *txn, const char *table_prefix,
+                                                    const void *key_prefix, size_t key_prefix_len);
+// KVSTORE_NOTFOUND past the last key
+int kvstore_bucket_cursor_get(kvstore_bucket_cursor_t *cur, kvstore_val_t *key_out,
+                              kvstore_val_t *val_out);
+int kvstore_bucket_cursor_next(kvstore_bucket_cursor_t *cur);
+void kvstore_bucket_cursor_close(kvstore_bucket_cursor_t *cur);
+
+#define SERIALISE_PARTITION(rec_type, table_prefix, field, width) \
+\
+/* PUT: Store the record in its bucket (registering the bucket) */ \
+static inline int SER_CAT(kvstore_put_, SER_CAT(rec_type, _partitioned))( \
+    kvstore_txn_t *txn, struct rec_type *rec, kvstore_key_buf_t *old_keys) { \
+    char table[KVSTORE_BUCKET_NAME_MAX]; \
+    int rc = kvstore_bucket_table(txn, table_prefix, (int64_t)rec->field.tv_sec, \
+                                  width, true, table); \
+    if (rc != KVSTORE_OK) return rc; \
+    const char *saved = kvstore_txn_route(txn, table); \
+    rc = SER_CAT(kvstore_put_, SER_CAT(rec_type, _with_all_indices))(txn, rec, old_keys); \
+    kvstore_txn_route(txn, saved); \
+    return rc; \
+} \
+\
+/* DELETE: Remove the record (as last stored) from its bucket */ \
+static inline int SER_CAT(kvstore_del_, SER_CAT(rec_type, _partitioned))( \
+    kvstore_txn_t *txn, struct rec_type *rec) { \
+    char table[KVSTORE_BUCKET_NAME_MAX]; \
+    int rc = kvstore_bucket_table(txn, table_prefix, (int64_t)rec->field.tv_sec, \
+                                  width, false, table); \
+    if (rc != KVSTORE_OK) return rc; \
+    kvstore_key_buf_t kb = KVSTORE_KEY_BUF_INIT; \
+    rc = SER_CAT(populate_key_buf_, rec_type)(rec, &kb); \
+    if (rc != KVSTORE_OK) return rc; \
+    const char *saved = kvstore_txn_route(txn, table); \
+    rc = SER_CAT(kvstore_del_, SER_CAT(rec_type, _with_all_indices))(txn, &kb); \
+    kvstore_txn_route(txn, saved); \
+    kvstore_key_buf_free(&kb); \
+    return rc; \
+} \
+\
+/* GET: Fetch by primary key from whichever bucket holds it */ \
+struct SER_CAT(rec_type, _part_get_ctx) { \
+    kvstore_txn_t *txn; \
+    struct SER_CAT(rec_type, _pk) *key; \
+    struct rec_type *result; \
+    kvstore_key_buf_t *key_buf; \
+}; \
+\
+static inline int SER_CAT(rec_type, _part_get)(const char *table, int64_t start, \
+                                               int64_t end, void *arg) { \
+    struct SER_CAT(rec_type, _part_get_ctx) *ctx = \
+        (struct SER_CAT(rec_type, _part_get_ctx)*)arg; \
+    (void)start; \
+    (void)end; \
+    const char *saved = kvstore_txn_route(ctx->txn, table); \
+    int rc = SER_CAT(kvstore_get_, rec_type)(ctx->txn, ctx->key, ctx->result, ctx->key_buf); \
+    kvstore_txn_route(ctx->txn, saved); \
+    return rc == KVSTORE_OK ? KVSTORE_EXISTS : rc == KVSTORE_NOTFOUND ? KVSTORE_OK : rc; \
+} \
+\
+static inline int SER_CAT(kvstore_get_, SER_CAT(rec_type, _partitioned))( \
+    kvstore_txn_t *txn, struct SER_CAT(rec_type, _pk) *key, \
+    struct rec_type *result, kvstore_key_buf_t *key_buf) { \
+    struct SER_CAT(rec_type, _part_get_ctx) ctx = { txn, key, result, key_buf }; \
+    int rc = kvstore_bucket_each(txn, table_prefix, SER_CAT(rec_type, _part_get), &ctx); \
+    if (rc == KVSTORE_EXISTS) return KVSTORE_OK; \
+    return rc == KVSTORE_OK ? KVSTORE_NOTFOUND : rc; \
+} \
+\
+/* SCAN: Every record, bucket by bucket in time order */ \
+static inline int SER_CAT(kvstore_scan_, SER_CAT(rec_type, _partitioned))( \
+    kvstore_txn_t *txn, int (*fn)(struct rec_type *rec, void *arg), void *arg) { \
+    const char *prefix = SER_CAT(rec_type, _pk_prefix)(); \
+    kvstore_bucket_cursor_t *cur = \
+        kvstore_bucket_cursor_open(txn, table_prefix, prefix, strlen(prefix)); \
+    if (!cur) return KVSTORE_ERROR; \
+    \
+    int rc = KVSTORE_OK; \
+    kvstore_val_t k, v; \
+    while (rc == KVSTORE_OK && kvstore_bucket_cursor_get(cur, &k, &v) == KVSTORE_OK) { \
+        struct rec_type rec; \
+        memset(&rec, 0, sizeof(rec)); \
+        SER_CAT(deserialise_, rec_type)((char*)v.data, &rec); \
+        /* Callback owns any allocated fields, as with kvstore_get_* */ \
+        rc = fn(&rec, arg); \
+        if (rc == KVSTORE_OK) kvstore_bucket_cursor_next(cur); \
+    } \
+    kvstore_bucket_cursor_close(cur); \
+    return rc; \
+} \
+\
+/* EXPIRE: Drop every bucket entirely before a time */ \
+static inline int SER_CAT(kvstore_expire_, SER_CAT(rec_type, _before))( \
+    kvstore_txn_t *txn, const struct timespec *before, size_t *dropped) { \
+    return kvstore_bucket_drop_before(txn, table_prefix, (int64_t)before->tv_sec, dropped); \
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,89 @@
+// Asynchronous reads for on-disk backends
+// Callers queue preads and collect them as they complete, so one thread can
+// keep many disk reads in flight. Reads go through io_uring where the
+// kernel allows it, and otherwise through a pool of threads calling pread.
+
+#ifndef KVSTORE_AIO_H_
+#define KVSTORE_AIO_H_
+
+#include "kvstore.h"
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ------------------------
+// Configuration
+// ------------------------
+
+typedef enum {
+    KVSTORE_IO_AUTO = 0,    // io_uring if available, else THREADS
+    KVSTORE_IO_URING,       // One io_uring per queue; fails where unsupported
+    KVSTORE_IO_THREADS,     // A shared pool of threads calling pread
+    KVSTORE_IO_SYNC,        // pread on the submitting thread
+} kvstore_io_mode_t;
+
+// ------------------------
+// Requests
+// ------------------------
+
+// A read of len bytes at off into buf. The caller owns the request and its
+// buffer until the request comes back from kvstore_aio_wait().
+typedef struct kvstore_aio_req {
+    int fd;
+    void *buf;
+    size_t len;
+    uint64_t off;
+    ssize_t res;                    // Bytes read, or -errno
+    void *arg;                      // The caller's
+    struct kvstore_aio_req *next;   // Internal
+    struct kvstore_aio_queue *queue;
+} kvstore_aio_req_t;
+
+// The engine holds the thread pool and recycles queues. A queue belongs to
+// one thread at a time: it submits reads and waits for them on it.
+typedef struct kvstore_aio kvstore_aio_t;
+typedef struct kvstore_aio_queue kvstore_aio_queue_t;
+
+// ------------------------
+// API
+// ------------------------
+
+// depth bounds the reads a queue has in flight at once (0 selects 64); more
+// wait in the queue until earlier ones complete. threads sizes the pool
+// (0 selects 4). NULL if mode is KVSTORE_IO_URING and io_uring is
+// unavailable.
+kvstore_aio_t* kvstore_aio_new(kvstore_io_mode_t mode, unsigned depth, unsigned threads);
+
+// Every queue must have been put back
+void kvstore_aio_free(kvstore_aio_t *aio);
+
+// The mode in use: never KVSTORE_IO_AUTO
+kvstore_io_mode_t kvstore_aio_mode(kvstore_aio_t *aio);
+
+// Take a queue, reusing one put back earlier if there is one
+kvstore_aio_queue_t* kvstore_aio_queue_get(kvstore_aio_t *aio);
+
+// Give a queue back, first waiting out any reads still in flight
+void kvstore_aio_queue_put(kvstore_aio_queue_t *q);
+
+// Queue a read. It starts by the next kvstore_aio_wait() at the latest:
+// io_uring hands everything queued to the kernel there in one system call,
+// while the pool picks reads up at once while the queue has room in flight.
+// A wait with min 0 starts queued reads without blocking.
+int kvstore_aio_submit(kvstore_aio_queue_t *q, kvstore_aio_req_t *req);
+
+// Reads submitted and not yet returned by kvstore_aio_wait()
+size_t kvstore_aio_pending(kvstore_aio_queue_t *q);
+
+// Return up to max completed reads in done, waiting until at least min have
+// completed (or none are pending). Sets *ndone.
+int kvstore_aio_wait(kvstore_aio_queue_t *q, size_t min,
+                     kvstore_aio_req_t **done, size_t max, size_t *ndone);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KVSTORE_AIO_H_
@@ -25,6 +25,9 @@ struct kvstore_txn {
     kvstore_t *db;
     void *backend_txn;
     bool read_only;
+    const char *route;  // Table that table "" resolves to (NULL = "")
+    kvstore_durability_t durability;
+    uint64_t commit_seq;    // Set by txn_commit: log sequence, or 0
 };
 
 // Cursor handle
@@ -33,6 +36,8 @@ struct kvstore_cursor {
     void *backend_cursor;
     char *table;
     bool valid;
+    bool bounded;           // Set by kvstore_cursor_set_end()
+    kvstore_val_t end;      // Exclusive: keys from here on aren't returned
 };
 
 // Backend operations vtable
@@ -43,7 +48,7 @@ struct kvstore_ops {
 
     // Transaction management
     int (*txn_begin)(kvstore_t *db, kvstore_txn_t *txn, bool read_only);
-    int (*txn_commit)(kvstore_txn_t *txn);
+    int (*txn_commit)(kvstore_txn_t *txn);      // May return KVSTORE_CONFLICT
     void (*txn_abort)(kvstore_txn_t *txn);
 
     // KV operations
@@ -61,6 +66,50 @@ struct kvstore_ops {
                       kvstore_val_t *key_out, kvstore_val_t *val_out);
     int (*cursor_next)(kvstore_cursor_t *cur);
     void (*cursor_close)(kvstore_cursor_t *cur);
+
+    // Optional: pick up to *nsplits keys dividing [start, end) into roughly
+    // equal parts (start/end NULL = unbounded). Keys must be strictly
+    // increasing and stay valid until the transaction ends. Sets *nsplits to
+    // the number returned; backends without it are scanned on one thread.
+    int (*split_points)(kvstore_txn_t *txn, const char *table,
+                        kvstore_val_t *start, kvstore_val_t *end,
+                        kvstore_val_t *splits_out, size_t *nsplits);
+
+    // Optional: remove a table and all its keys in one step. Without it,
+    // kvstore_txn_drop_table() deletes the keys one by one.
+    int (*drop_table)(kvstore_txn_t *txn, const char *table);
+
+    // Optional: apply a merge operator to the value at key, in place or
+    // deferred to later reads. Without it, kvstore_txn_merge() gets the
+    // value, applies the operator (kvstore_merge_apply()) and puts it back.
+    int (*merge)(kvstore_txn_t *txn, const char *table,
+                 kvstore_val_t *key, const kvstore_merge_t *op);
+
+    // Optional: write-set counters, for backends that buffer writes
+    int (*txn_stats)(kvstore_txn_t *txn, kvstore_txn_stats_t *out);
+
+    // Optional: savepoints. savepoint() sets *id (0 for the oldest still
+    // set); rollback_to() undoes the writes made since savepoint id, which
+    // stays set, and drops any later ones; release() forgets savepoint id
+    // and any later ones, keeping their writes.
+    int (*savepoint)(kvstore_txn_t *txn, size_t *id);
+    int (*rollback_to)(kvstore_txn_t *txn, size_t id);
+    int (*release)(kvstore_txn_t *txn, size_t id);
+
+    // Optional: block until log sequence seq is fsynced
+    int (*wait_durable)(kvstore_t *db, uint64_t seq);
+
+    // Optional: asynchronous gets (see kvstore_txn_get_async()). get_async
+    // answers a lookup at once or queues it; poll runs completed ones.
+    // Without them, lookups are synchronous gets.
+    int (*get_async)(kvstore_txn_t *txn, const char *table, kvstore_val_t *key,
+                     kvstore_get_fn fn, void *arg);
+    int (*poll)(kvstore_txn_t *txn, size_t min, size_t *ran);
+
+    // Optional: hear of a cursor's end key (NULL = none), so reads ahead of
+    // the cursor stop there. The generic layer hides keys from end on
+    // whether or not the backend has it.
+    int (*cursor_bound)(kvstore_cursor_t *cur, kvstore_val_t *end);
 };
 
 // ------------------------
@@ -93,6 +142,50 @@ int kvstore_cursor_get(kvstore_cursor_t *cur, kvstore_val_t *key_out,
                        kvstore_val_t *val_out);
 int kvstore_cursor_next(kvstore_cursor_t *cur);
 void kvstore_cursor_close(kvstore_cursor_t *cur);
+int kvstore_cursor_set_end(kvstore_cursor_t *cur, kvstore_val_t *end);
+
+// Drop a table (see kvstore.h)
+int kvstore_txn_drop_table(kvstore_txn_t *txn, const char *table);
+
+// Route table "" to another table (see kvstore.h)
+const char* kvstore_txn_route(kvstore_txn_t *txn, const char *table);
+
+// Merge operator (see kvstore.h)
+int kvstore_txn_merge(kvstore_txn_t *txn, const char *table, kvstore_val_t *key,
+                      const kvstore_merge_t *op);
+
+// Write-set counters (see kvstore.h)
+int kvstore_txn_stats(kvstore_txn_t *txn, kvstore_txn_stats_t *out);
+
+// Savepoints (see kvstore.h)
+int kvstore_txn_savepoint(kvstore_txn_t *txn, kvstore_savepoint_t *sp);
+int kvstore_txn_rollback_to(kvstore_txn_t *txn, const kvstore_savepoint_t *sp);
+int kvstore_txn_release(kvstore_txn_t *txn, const kvstore_savepoint_t *sp);
+
+// Durability (see kvstore.h)
+int kvstore_txn_set_durability(kvstore_txn_t *txn, kvstore_durability_t level);
+int kvstore_txn_commit_seq(kvstore_txn_t *txn, uint64_t *seq_out);
+int kvstore_wait_durable(kvstore_t *db, uint64_t seq);
+
+// Asynchronous gets (see kvstore.h)
+int kvstore_txn_get_async(kvstore_txn_t *txn, const char *table, kvstore_val_t *key,
+                          kvstore_get_fn fn, void *arg);
+int kvstore_txn_poll(kvstore_txn_t *txn, size_t min, size_t *ran);
+int kvstore_txn_get_many(kvstore_txn_t *txn, const char *table, size_t n,
+                         kvstore_val_t *keys, kvstore_val_t *vals_out, int *rcs_out);
+
+// Run a transaction, retrying on conflict (see kvstore.h)
+int kvstore_txn_run(kvstore_t *db, kvstore_txn_fn fn, void *arg, unsigned max_attempts);
+
+// Split points for parallel scans (KVSTORE_NOTFOUND if unsupported)
+int kvstore_txn_split_points(kvstore_txn_t *txn, const char *table,
+                             kvstore_val_t *start, kvstore_val_t *end,
+                             kvstore_val_t *splits_out, size_t *nsplits);
+
+// Parallel range scan (see kvstore.h)
+int kvstore_scan_parallel(kvstore_txn_t *txn, const char *table,
+                          kvstore_val_t *start, kvstore_val_t *end,
+                          size_t nthreads, kvstore_scan_fn fn, void *arg);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,68 @@
+// Block cache for on-disk backends
+// A fixed budget of aligned blocks, shared by every thread and evicted by
+// CLOCK. Blocks are copied in and out under a shard's lock, so callers
+// never hold a reference into the cache. The cache also lends out aligned
+// buffers, as reads with O_DIRECT need.
+
+#ifndef KVSTORE_CACHE_H_
+#define KVSTORE_CACHE_H_
+
+#include "kvstore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct kvstore_cache kvstore_cache_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    size_t blocks;          // Blocks held
+    size_t capacity;        // Blocks it can hold
+} kvstore_cache_stats_t;
+
+// ------------------------
+// API
+// ------------------------
+
+// Room for bytes / block_size blocks (at least one) of block_size bytes
+// each, a power of two. NULL on failure.
+kvstore_cache_t* kvstore_cache_new(size_t bytes, size_t block_size);
+
+// Every lent buffer must have been put back
+void kvstore_cache_free(kvstore_cache_t *c);
+
+size_t kvstore_cache_block_size(kvstore_cache_t *c);
+
+// Copy block id into buf, which has room for cap bytes. Returns its length,
+// or 0 if it isn't cached (or is longer than cap). hot marks it recently
+// used, which a scan passing through shouldn't.
+size_t kvstore_cache_get(kvstore_cache_t *c, uint64_t id, void *buf, size_t cap, bool hot);
+
+// Whether block id is cached, without counting a hit or a miss
+bool kvstore_cache_contains(kvstore_cache_t *c, uint64_t id);
+
+// Cache len bytes as block id, replacing any copy. Blocks longer than the
+// block size aren't cached. A cold block (as read ahead) goes at the first
+// turn of the clock unless it is read before then; a hot one survives one
+// turn.
+void kvstore_cache_put(kvstore_cache_t *c, uint64_t id, const void *data, size_t len, bool hot);
+
+// Drop every block
+void kvstore_cache_clear(kvstore_cache_t *c);
+
+void kvstore_cache_stats(kvstore_cache_t *c, kvstore_cache_stats_t *out);
+
+// A buffer of at least len bytes aligned to the block size, from the pool
+// when len fits in a block. NULL on failure.
+void* kvstore_cache_buf_get(kvstore_cache_t *c, size_t len);
+void kvstore_cache_buf_put(kvstore_cache_t *c, void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KVSTORE_CACHE_H_
@@ -0,0 +1,42 @@
+// Page compression
+// A byte-oriented LZ77 codec in the manner of LZ4: no entropy coding, so
+// both directions run at memory speeds, and a page's sorted keys, with
+// their shared prefixes and repeated length headers, are what it finds
+// best. Decompression checks every length and offset against its buffers,
+// so malformed input fails rather than reading or writing out of bounds.
+
+#ifndef KVSTORE_COMPRESS_H_
+#define KVSTORE_COMPRESS_H_
+
+#include "kvstore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    KVSTORE_CODEC_NONE = 0,
+    KVSTORE_CODEC_LZ = 1,
+} kvstore_codec_t;
+
+// ------------------------
+// API
+// ------------------------
+
+// Most bytes kvstore_lz_compress() can need for len bytes of input
+size_t kvstore_lz_bound(size_t len);
+
+// Compress len bytes of src into dst, which has room for cap bytes.
+// Returns the compressed length, or 0 if it doesn't fit in cap: a cap
+// below len asks for compression that pays.
+size_t kvstore_lz_compress(const void *src, size_t len, void *dst, size_t cap);
+
+// Decompress clen bytes of src into exactly len bytes at dst. KVSTORE_ERROR
+// if src is malformed or doesn't come to len bytes.
+int kvstore_lz_decompress(const void *src, size_t clen, void *dst, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KVSTORE_COMPRESS_H_
@@ -0,0 +1,34 @@
+// CRC-32C checksums
+// The Castagnoli CRC, as iSCSI, ext4 and Btrfs use: it has the best error
+// detection of the common 32-bit CRCs at page sizes, and x86 computes it
+// in hardware (SSE4.2). Without the instruction, a table is used.
+
+#ifndef KVSTORE_CRC_H_
+#define KVSTORE_CRC_H_
+
+#include "kvstore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ------------------------
+// API
+// ------------------------
+
+// Extend crc (0 to start) over len bytes of data. A checksum of data split
+// in pieces equals the checksum of the whole: crc32c(crc32c(0, a), b) is
+// crc32c(0, ab).
+uint32_t kvstore_crc32c(uint32_t crc, const void *data, size_t len);
+
+// The same, always with the table
+uint32_t kvstore_crc32c_sw(uint32_t crc, const void *data, size_t len);
+
+// Which kvstore_crc32c() uses: "sse4.2" or "table"
+const char* kvstore_crc32c_impl(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KVSTORE_CRC_H_
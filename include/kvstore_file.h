@@ -0,0 +1,173 @@
+// File-backed KV store
+// Keeps its data in a file of sorted pages, read as needed, with the writes
+// since that file was written held in a memtable (the memory backend) and
+// logged to a write-ahead log, replayed on open. Checkpoints fold the
+// memtable into a new data file and empty the log. Commits choose how
+// durable they are on return: fsynced, written, or only buffered.
+
+#ifndef KVSTORE_FILE_H_
+#define KVSTORE_FILE_H_
+
+#include "kvstore_backend.h"
+#include "kvstore_aio.h"
+#include "kvstore_cache.h"
+#include "kvstore_compress.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ------------------------
+// Configuration
+// ------------------------
+
+// The log is <path>/wal, in the replication frame format (kvstore_repl.h),
+// one frame per read-write commit. A torn frame at the end, left by a crash
+// mid-write, is cut off on open.
+//
+// Commits at KVSTORE_DURABLE_SYNC share fsyncs: one commit writes and
+// fsyncs everything logged so far while the others wait for it. Commits at
+// ASYNC and NONE return sooner, and the flusher thread writes and fsyncs
+// what they logged every flush_interval_ms. Commits lost in a crash are
+// always the newest ones.
+//
+// The data file is <path>/data: 4 KiB pages of sorted entries, table by
+// table, then an index of each page's first key, which is held in memory.
+// Every page, the index and the footer carry a CRC-32C (kvstore_crc.h). A
+// page is verified when first loaded into a cache, and a torn or corrupt
+// one fails its read with KVSTORE_ERROR; the index and footer are verified
+// on open. kvstore_file_verify() checks a whole data file offline.
+// A get the memtable can't answer reads one page. A checkpoint merges the
+// memtable into a new data file, renamed over the old one, then empties
+// the log; the flusher runs one when the log passes checkpoint_bytes.
+// Commits wait while a checkpoint runs; nothing else does. A transaction
+// begun before it reads the store as of the checkpoint, and one that wrote
+// fails its commit with KVSTORE_CONFLICT if others committed after it.
+//
+// kvstore_txn_get_async() and kvstore_txn_get_many() read pages through
+// the asynchronous read engine (kvstore_aio.h), each transaction with its
+// own queue of up to io_depth reads in flight.
+//
+// A cursor that moves on from page to page has the kernel read the next
+// pages ahead: two pages at first, doubling with each page up to
+// readahead_pages. With an end key set (kvstore_cursor_set_end()) it reads
+// no page past the end. The kernel's own read ahead is turned off for the
+// data file, as it would read past the end.
+//
+// With direct_io, the data file is read with O_DIRECT, past the kernel's
+// page cache, and pages are cached in a block cache (kvstore_cache.h) of
+// cache_bytes instead: the only cache of them, and the store's whole
+// budget for one. Lookups mark their pages recently used; pages cursors
+// read, and read ahead, go first when it is full. Memory use is then fixed
+// by configuration rather than left to the kernel, and a scan can't push
+// out the pages lookups keep coming back to.
+//
+// With compression, checkpoints compress each page (kvstore_compress.h)
+// where that saves an eighth of it, and pack compressed pages end to end.
+// Pages are decompressed as they are read: the block cache holds them
+// decompressed, so its hits cost nothing more, while without direct_io
+// the page cache holds them as stored, and every read decompresses. The
+// codec can be chosen per table, and takes effect as the next checkpoint
+// rewrites the table.
+typedef struct {
+    // Level for transactions that don't set one (0 selects SYNC)
+    kvstore_durability_t durability;
+
+    // How often the flusher runs (0 selects the default of 10 ms)
+    unsigned flush_interval_ms;
+
+    // Log size that triggers a checkpoint (0 selects the default of 64 MiB)
+    size_t checkpoint_bytes;
+
+    // Asynchronous reads: how, how many in flight per transaction (0
+    // selects 64), and the pool size in KVSTORE_IO_THREADS mode (0 selects 4)
+    kvstore_io_mode_t io_mode;
+    unsigned io_depth;
+    unsigned io_threads;
+
+    // Most pages a cursor reads ahead (0 selects 256, or 1 MiB; negative
+    // turns read ahead off)
+    int readahead_pages;
+
+    // Read the data file with O_DIRECT, through a block cache of
+    // cache_bytes (0 selects 64 MiB)
+    bool direct_io;
+    size_t cache_bytes;
+
+    // Don't verify page checksums on read (pages are still written with
+    // them)
+    bool skip_checksums;
+
+    // Codec for data file pages
+    kvstore_codec_t compression;
+
+    // Optional override: the codec for each table's pages
+    kvstore_codec_t (*table_codec)(const char *table, void *arg);
+    void *table_codec_arg;
+} kvstore_file_opts_t;
+
+#define KVSTORE_FILE_OPTS_INIT { .durability = KVSTORE_DURABLE_SYNC, .flush_interval_ms = 0, \
+                                 .checkpoint_bytes = 0, .io_mode = KVSTORE_IO_AUTO, \
+                                 .io_depth = 0, .io_threads = 0, .readahead_pages = 0, \
+                                 .direct_io = false, .cache_bytes = 0, .skip_checksums = false, \
+                                 .compression = KVSTORE_CODEC_NONE, .table_codec = NULL, \
+                                 .table_codec_arg = NULL }
+
+typedef struct {
+    uint64_t seq;           // Last commit logged
+    uint64_t written_seq;   // Last commit written to the log file
+    uint64_t durable_seq;   // Last commit fsynced
+    uint64_t syncs;         // fsyncs of the log
+    uint64_t log_bytes;     // Size of the log file
+    uint64_t checkpoints;
+    uint64_t data_bytes;    // Size of the data file
+    uint64_t page_bytes;    // Its pages, decompressed
+    uint64_t compressed_pages;  // Its pages stored compressed
+    uint64_t log_written;   // Bytes written to the log, in all
+    uint64_t data_written;  // Bytes checkpoints wrote to data files, in all
+    uint64_t page_reads;    // Pages read from the data file
+    uint64_t readahead_pages;   // Pages cursors had read ahead
+    uint64_t pages_verified;    // Page checksums checked
+    uint64_t checksum_errors;   // Pages that failed their check
+    kvstore_io_mode_t io_mode;  // How asynchronous reads are done
+    bool direct_io;
+    kvstore_cache_stats_t cache;    // The block cache, with direct_io
+} kvstore_file_stats_t;
+
+// ------------------------
+// API
+// ------------------------
+
+// Open the store in directory path, creating it if needed, and replay its
+// log. opts may be NULL for defaults.
+kvstore_t* kvstore_open_file(const char *path, const kvstore_file_opts_t *opts);
+
+// The backend's vtable, for kvstore_open() with default options
+const struct kvstore_ops* kvstore_file_ops(void);
+
+// KVSTORE_ERROR if db isn't a file store
+int kvstore_file_stats(kvstore_t *db, kvstore_file_stats_t *out);
+
+// Checkpoint now. Transactions open on any thread carry on, as above.
+int kvstore_file_checkpoint(kvstore_t *db);
+
+typedef struct {
+    bool index_ok;          // Footer and index intact (else nothing more checked)
+    uint64_t pages;
+    uint64_t bytes;         // Of pages, as stored
+    uint64_t bad_pages;     // Checksum, header or first key wrong, or unreadable
+    uint64_t first_bad;     // File offset of the first bad page (UINT64_MAX: none)
+} kvstore_file_verify_t;
+
+// Check every page of the data file of the store in directory path with
+// threads threads (0 selects one per CPU), reading it directly rather than
+// through a store. KVSTORE_OK if all is intact, or there is no data file.
+// Meant for stores that aren't open, but safe on ones that are: a
+// checkpoint replaces the file by rename, and the old one is checked.
+int kvstore_file_verify(const char *path, unsigned threads, kvstore_file_verify_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KVSTORE_FILE_H_
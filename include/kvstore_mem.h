@@ -0,0 +1,53 @@
+// In-memory KV store backend
+// Sorted arrays per table, with buffered writes, optimistic concurrency and
+// per-table latches. Large commits can apply on several threads.
+
+#ifndef KVSTORE_MEM_H_
+#define KVSTORE_MEM_H_
+
+#include "kvstore_backend.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ------------------------
+// Configuration
+// ------------------------
+
+// A commit with at least parallel_min_writes buffered writes applies them on
+// apply_threads threads. Its write-set is cut into one slice per thread, by
+// table and then by key range. So the primary and index keys that generated
+// code writes into table "" are spread across the threads too. Smaller
+// commits apply on the committing thread alone, since starting the workers
+// would cost more than it saves.
+typedef struct {
+    // Threads applying a commit, the committing one included (0 or 1
+    // keeps every commit single-threaded)
+    size_t apply_threads;
+
+    // Minimum buffered writes before a commit fans out (0 selects the
+    // default of 4096)
+    size_t parallel_min_writes;
+} kvstore_mem_opts_t;
+
+#define KVSTORE_MEM_OPTS_INIT { .apply_threads = 1, .parallel_min_writes = 0 }
+
+// ------------------------
+// API
+// ------------------------
+
+// Open an empty in-memory store with default options
+kvstore_t* kvstore_open_mem(void);
+
+// Open an empty in-memory store. opts may be NULL for defaults.
+kvstore_t* kvstore_open_mem_opts(const kvstore_mem_opts_t *opts);
+
+// The backend's vtable, for wrapping it
+const struct kvstore_ops* kvstore_mem_ops(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KVSTORE_MEM_H_
@@ -0,0 +1,91 @@
+// Log-shipping replication for KV stores
+// A primary wrapper ships every committed transaction's writes as a framed
+// commit log over a pipe or socket; a follower applies them in batches.
+
+#ifndef KVSTORE_REPL_H_
+#define KVSTORE_REPL_H_
+
+#include "kvstore_backend.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ------------------------
+// Commit log frame format
+// ------------------------
+//
+// Every committed read-write transaction becomes one frame (integers are
+// big-endian, written with the SER_WRITE_* helpers):
+//
+//   [frame_len:4][seq:8][commit_ns:8][op_count:4] op...
+//
+// where frame_len counts the bytes after itself and each op is
+//
+//   [type:1][table_len:2][key_len:4][val_len:4][table][key][val]
+//
+// type is KVSTORE_REPL_OP_PUT or KVSTORE_REPL_OP_DEL (val_len is 0 for DEL).
+// commit_ns is CLOCK_REALTIME at primary commit, used for follower lag.
+
+#define KVSTORE_REPL_OP_PUT 1
+#define KVSTORE_REPL_OP_DEL 2
+
+#define KVSTORE_REPL_FRAME_HDR  24  // frame_len + seq + commit_ns + op_count
+#define KVSTORE_REPL_OP_HDR     11  // type + table_len + key_len + val_len
+
+// ------------------------
+// Primary
+// ------------------------
+
+// Wrap an open database so every committed read-write transaction is shipped
+// to fd. The returned handle is used exactly like the inner one and is closed
+// with kvstore_close(); the inner database and fd stay owned by the caller.
+// Writes to a closed pipe raise SIGPIPE unless the caller ignores it.
+kvstore_t* kvstore_repl_primary_open(kvstore_t *inner, int fd);
+
+// Sequence number of the last shipped commit (0 before the first)
+uint64_t kvstore_repl_primary_seq(kvstore_t *db);
+
+// ------------------------
+// Follower
+// ------------------------
+
+typedef struct kvstore_repl_follower kvstore_repl_follower_t;
+
+typedef struct {
+    uint64_t applied_seq;       // Last primary commit applied locally
+    uint64_t received_seq;      // Last primary commit consumed from the stream
+    uint64_t applied_commits;   // Primary commits applied
+    uint64_t applied_ops;       // Individual puts/deletes applied
+    uint64_t applied_bytes;     // Frame bytes applied
+    uint64_t batches;           // Follower transactions committed
+    uint64_t lag_ns;            // Primary commit to follower commit delay, oldest commit of last batch
+    uint64_t max_lag_ns;        // Largest lag_ns seen so far
+} kvstore_repl_stats_t;
+
+// Create a follower applying frames read from fd into db.
+// max_batch bounds how many primary commits are grouped into one follower
+// transaction (0 selects the default of 256).
+kvstore_repl_follower_t* kvstore_repl_follower_new(kvstore_t *db, int fd,
+                                                   size_t max_batch);
+void kvstore_repl_follower_free(kvstore_repl_follower_t *f);
+
+// Wait up to timeout_ms (-1 blocks) for data, then read and apply every
+// complete frame that is available; *applied (optional) receives the number
+// of primary commits applied. Returns KVSTORE_OK (also on timeout),
+// KVSTORE_NOTFOUND once the primary closed the stream and everything was
+// applied, or KVSTORE_ERROR on I/O, framing or apply failure.
+int kvstore_repl_follower_poll(kvstore_repl_follower_t *f, int timeout_ms,
+                               size_t *applied);
+
+// Apply frames until the primary closes the stream
+int kvstore_repl_follower_run(kvstore_repl_follower_t *f);
+
+void kvstore_repl_follower_stats(kvstore_repl_follower_t *f,
+                                 kvstore_repl_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KVSTORE_REPL_H_
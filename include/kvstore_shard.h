@@ -0,0 +1,63 @@
+// Hash-partitioned sharding over N independent KV stores
+// Routes each key to one inner store by hashing a configurable slice of the
+// key, commits touched shards in parallel and merges cursors across shards.
+
+#ifndef KVSTORE_SHARD_H_
+#define KVSTORE_SHARD_H_
+
+#include "kvstore_backend.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ------------------------
+// Configuration
+// ------------------------
+
+// Routing hashes part of each key. By default the slice starts right after
+// the key's table prefix (everything up to and including the first ':') and
+// is route_len bytes long, so route_len = 4 with keys that begin with a
+// uint32_t mailbox_id keeps a message and its mailbox-scoped indexes together.
+typedef struct {
+    // Bytes hashed after the key prefix; 0 hashes the whole remainder
+    size_t route_len;
+
+    // Optional override: set *route_out to the bytes to hash for this key
+    void (*route_key)(const char *table, const kvstore_val_t *key,
+                      kvstore_val_t *route_out, void *arg);
+    void *route_arg;
+
+    // Minimum number of touched shards before commit fans out to threads
+    // (0 selects the default of 2; SIZE_MAX keeps commits single-threaded)
+    size_t parallel_min_shards;
+} kvstore_shard_opts_t;
+
+#define KVSTORE_SHARD_OPTS_INIT { .route_len = 0, .route_key = NULL, \
+                                  .route_arg = NULL, .parallel_min_shards = 0 }
+
+// ------------------------
+// API
+// ------------------------
+
+// Open a sharded view over nshards already-open stores. The returned handle
+// is used like any kvstore_t and closed with kvstore_close(); the inner
+// stores stay owned by the caller. opts may be NULL for defaults.
+//
+// Writes are buffered per shard until commit (reads see them), then every
+// touched shard applies and commits its writes, in parallel when enough
+// shards were touched. Opening a cursor in a write transaction applies the
+// buffered writes first so the merged scan sees them. Shards commit
+// independently: a failure on one shard does not undo the others.
+kvstore_t* kvstore_shard_open(kvstore_t **shards, size_t nshards,
+                              const kvstore_shard_opts_t *opts);
+
+// Shard index a key routes to (useful for partitioning ingest threads)
+size_t kvstore_shard_route(kvstore_t *db, const char *table,
+                           const kvstore_val_t *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KVSTORE_SHARD_H_
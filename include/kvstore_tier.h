@@ -0,0 +1,106 @@
+// Tiered storage over two KV stores
+// Keeps recently used key ranges in a hot store (a memory store) and moves
+// ranges that go cold to a cold store (a file store) in the background,
+// behind one kvstore_t whose gets and cursors see both as one.
+
+#ifndef KVSTORE_TIER_H_
+#define KVSTORE_TIER_H_
+
+#include "kvstore_backend.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ------------------------
+// Configuration
+// ------------------------
+
+// Data moves between the stores a range at a time. A range is the keys of
+// a table that share a prefix: by default the key's table prefix (up to
+// and including the first ':') and the prefix_len bytes after it, so
+// prefix_len = 4 with keys that begin with a uint32_t mailbox_id makes a
+// mailbox and its mailbox-scoped indexes a range each.
+//
+// Writes go to the hot store. A get looks there first, then in the cold
+// store; a range whose gets keep going to the cold store is copied in
+// whole while the hot store has room, after which its misses don't touch
+// the cold store either. Ranges
+// idle for idle_ms, and the least recently used while the hot store holds
+// more than hot_bytes, move out to the cold store.
+typedef struct {
+    // Bytes after the key prefix that name a key's range (0: the key
+    // prefix alone)
+    size_t prefix_len;
+
+    // Optional override: the length of the prefix of key that names its
+    // range
+    size_t (*range_len)(const char *table, const kvstore_val_t *key, void *arg);
+    void *range_arg;
+
+    // Keys and values the hot store holds before ranges move out (0
+    // selects the default of 64 MiB)
+    size_t hot_bytes;
+
+    // How long a range goes unused before it moves out (0 selects the
+    // default of 30 s)
+    unsigned idle_ms;
+
+    // How often the migration thread runs (0 selects the default of 100 ms)
+    unsigned interval_ms;
+
+    // Gets answered by the cold store before a range is copied into the
+    // hot one (0 selects the default of 2)
+    unsigned promote_gets;
+} kvstore_tier_opts_t;
+
+#define KVSTORE_TIER_OPTS_INIT { .prefix_len = 0, .range_len = NULL, .range_arg = NULL, \
+                                 .hot_bytes = 0, .idle_ms = 0, .interval_ms = 0, \
+                                 .promote_gets = 0 }
+
+typedef struct {
+    uint64_t gets;
+    uint64_t hot_gets;          // Answered by the hot store alone
+    uint64_t promotions;        // Ranges copied into the hot store
+    uint64_t demotions;         // Ranges moved out to the cold store
+    uint64_t keys_promoted;
+    uint64_t keys_demoted;
+    uint64_t migration_errors;  // Moves that failed, to be tried again
+    uint64_t hot_bytes;         // Estimate: keys and values written, less those moved out
+    uint64_t ranges;            // Ranges tracked
+    uint64_t resident_ranges;   // Ranges wholly in the hot store
+} kvstore_tier_stats_t;
+
+// ------------------------
+// API
+// ------------------------
+
+// Open a tiered view over two already-open stores, which stay owned by the
+// caller. The hot store must start empty and be used only through the
+// tier: it holds values tagged with whether they are deletes. The returned
+// handle is used like any kvstore_t and closed with kvstore_close(), which
+// first moves every range to the cold store. opts may be NULL for
+// defaults.
+//
+// Transactions commit to the hot store alone, so their writes are as
+// durable as the hot store until their range moves out: a memory store
+// loses them in a crash. kvstore_tier_flush() moves everything out at
+// once. Moves pass over ranges that open transactions have used, but
+// commit to each store like any other writer: a transaction that first
+// uses a range after it moved can see KVSTORE_CONFLICT, as can one that
+// scanned across a range as it was copied in.
+kvstore_t* kvstore_tier_open(kvstore_t *hot, kvstore_t *cold,
+                             const kvstore_tier_opts_t *opts);
+
+// Move every range to the cold store now. Don't call it with a cursor
+// open on this thread.
+int kvstore_tier_flush(kvstore_t *db);
+
+// KVSTORE_ERROR if db isn't a tiered store
+int kvstore_tier_stats(kvstore_t *db, kvstore_tier_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KVSTORE_TIER_H_
@@ -1,7 +1,13 @@
 // Generic KV store implementation (calls through vtable)
 
+#define _POSIX_C_SOURCE 200809L
 #include "../include/kvstore_backend.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 // ------------------------
 // Database lifecycle
@@ -61,6 +67,16 @@ int kvstore_txn_commit(kvstore_txn_t *txn) {
     return rc;
 }
 
+int kvstore_txn_commit_seq(kvstore_txn_t *txn, uint64_t *seq_out) {
+    if (!txn || !txn->db || !seq_out) return KVSTORE_ERROR;
+
+    int rc = txn->db->ops->txn_commit(txn);
+    *seq_out = rc == KVSTORE_OK ? txn->commit_seq : 0;
+    free(txn);
+
+    return rc;
+}
+
 void kvstore_txn_abort(kvstore_txn_t *txn) {
     if (!txn || !txn->db) return;
 
@@ -68,32 +84,272 @@ void kvstore_txn_abort(kvstore_txn_t *txn) {
     free(txn);
 }
 
+int kvstore_txn_stats(kvstore_txn_t *txn, kvstore_txn_stats_t *out) {
+    if (!txn || !txn->db || !out) return KVSTORE_ERROR;
+    if (!txn->db->ops->txn_stats) return KVSTORE_NOTFOUND;
+    return txn->db->ops->txn_stats(txn, out);
+}
+
+int kvstore_txn_savepoint(kvstore_txn_t *txn, kvstore_savepoint_t *sp) {
+    if (!txn || !txn->db || !sp || txn->read_only) return KVSTORE_ERROR;
+    if (!txn->db->ops->savepoint) return KVSTORE_NOTFOUND;
+    return txn->db->ops->savepoint(txn, &sp->id);
+}
+
+int kvstore_txn_rollback_to(kvstore_txn_t *txn, const kvstore_savepoint_t *sp) {
+    if (!txn || !txn->db || !sp) return KVSTORE_ERROR;
+    if (!txn->db->ops->rollback_to) return KVSTORE_NOTFOUND;
+    return txn->db->ops->rollback_to(txn, sp->id);
+}
+
+int kvstore_txn_release(kvstore_txn_t *txn, const kvstore_savepoint_t *sp) {
+    if (!txn || !txn->db || !sp) return KVSTORE_ERROR;
+    if (!txn->db->ops->release) return KVSTORE_NOTFOUND;
+    return txn->db->ops->release(txn, sp->id);
+}
+
+int kvstore_txn_set_durability(kvstore_txn_t *txn, kvstore_durability_t level) {
+    if (!txn || txn->read_only || level < KVSTORE_DURABLE_DEFAULT || level > KVSTORE_DURABLE_NONE) {
+        return KVSTORE_ERROR;
+    }
+    txn->durability = level;
+    return KVSTORE_OK;
+}
+
+int kvstore_wait_durable(kvstore_t *db, uint64_t seq) {
+    if (!db) return KVSTORE_ERROR;
+    if (!db->ops->wait_durable || seq == 0) return KVSTORE_OK;
+    return db->ops->wait_durable(db, seq);
+}
+
+int kvstore_txn_run(kvstore_t *db, kvstore_txn_fn fn, void *arg, unsigned max_attempts) {
+    if (!db || !fn) return KVSTORE_ERROR;
+
+    for (unsigned attempt = 1; ; attempt++) {
+        kvstore_txn_t *txn = kvstore_txn_begin(db, false);
+        if (!txn) return KVSTORE_ERROR;
+
+        int rc = fn(txn, arg);
+        if (rc != KVSTORE_OK) {
+            kvstore_txn_abort(txn);
+            return rc;
+        }
+        rc = kvstore_txn_commit(txn);
+        if (rc != KVSTORE_CONFLICT || attempt == max_attempts) return rc;
+
+        // Let the transaction that won finish before trying again
+        sched_yield();
+    }
+}
+
 // ------------------------
 // KV operations
 // ------------------------
 
+const char* kvstore_txn_route(kvstore_txn_t *txn, const char *table) {
+    const char *prev = txn->route;
+    txn->route = table && table[0] ? table : NULL;
+    return prev;
+}
+
+static const char* routed(kvstore_txn_t *txn, const char *table) {
+    return txn->route && table && !table[0] ? txn->route : table;
+}
+
 int kvstore_txn_put(kvstore_txn_t *txn, const char *table,
                     kvstore_val_t *key, kvstore_val_t *val) {
     if (!txn || !txn->db || !txn->db->ops->put) return KVSTORE_ERROR;
-    return txn->db->ops->put(txn, table, key, val);
+    return txn->db->ops->put(txn, routed(txn, table), key, val);
 }
 
 int kvstore_txn_get(kvstore_txn_t *txn, const char *table,
                     kvstore_val_t *key, kvstore_val_t *val_out) {
     if (!txn || !txn->db || !txn->db->ops->get) return KVSTORE_ERROR;
-    return txn->db->ops->get(txn, table, key, val_out);
+    return txn->db->ops->get(txn, routed(txn, table), key, val_out);
 }
 
 int kvstore_txn_del(kvstore_txn_t *txn, const char *table,
                     kvstore_val_t *key) {
     if (!txn || !txn->db || !txn->db->ops->del) return KVSTORE_ERROR;
-    return txn->db->ops->del(txn, table, key);
+    return txn->db->ops->del(txn, routed(txn, table), key);
+}
+
+int kvstore_txn_get_async(kvstore_txn_t *txn, const char *table, kvstore_val_t *key,
+                          kvstore_get_fn fn, void *arg) {
+    if (!txn || !txn->db || !fn) return KVSTORE_ERROR;
+    table = routed(txn, table);
+    if (txn->db->ops->get_async) return txn->db->ops->get_async(txn, table, key, fn, arg);
+
+    if (!txn->db->ops->get) return KVSTORE_ERROR;
+    kvstore_val_t val;
+    int rc = txn->db->ops->get(txn, table, key, &val);
+    if (rc == KVSTORE_ERROR) return rc;
+    fn(arg, rc, rc == KVSTORE_OK ? &val : NULL);
+    return KVSTORE_OK;
+}
+
+int kvstore_txn_poll(kvstore_txn_t *txn, size_t min, size_t *ran) {
+    if (!txn || !txn->db) return KVSTORE_ERROR;
+    if (txn->db->ops->poll) return txn->db->ops->poll(txn, min, ran);
+    if (ran) *ran = 0;
+    return KVSTORE_OK;
+}
+
+typedef struct {
+    kvstore_val_t *val;
+    int *rc;
+    size_t *left;
+} get_many_slot_t;
+
+static void get_many_done(void *arg, int rc, kvstore_val_t *val) {
+    get_many_slot_t *slot = (get_many_slot_t*)arg;
+    *slot->rc = rc;
+    if (val) *slot->val = *val;
+    (*slot->left)--;
+}
+
+int kvstore_txn_get_many(kvstore_txn_t *txn, const char *table, size_t n,
+                         kvstore_val_t *keys, kvstore_val_t *vals_out, int *rcs_out) {
+    if (!txn || (n > 0 && (!keys || !vals_out || !rcs_out))) return KVSTORE_ERROR;
+    if (n == 0) return KVSTORE_OK;
+
+    get_many_slot_t *slots = (get_many_slot_t*)malloc(n * sizeof(get_many_slot_t));
+    if (!slots) return KVSTORE_ERROR;
+
+    size_t left = n;
+    int rc = KVSTORE_OK;
+    for (size_t i = 0; i < n; i++) {
+        slots[i] = (get_many_slot_t){ &vals_out[i], &rcs_out[i], &left };
+        rcs_out[i] = KVSTORE_ERROR;
+        if (kvstore_txn_get_async(txn, table, &keys[i], get_many_done, &slots[i]) != KVSTORE_OK) {
+            left--;
+            rc = KVSTORE_ERROR;
+        }
+    }
+
+    // Callbacks of lookups queued before this call may run here too
+    while (left > 0) {
+        size_t ran;
+        if (kvstore_txn_poll(txn, left, &ran) != KVSTORE_OK || ran == 0) {
+            rc = KVSTORE_ERROR;
+            break;
+        }
+    }
+    free(slots);
+
+    for (size_t i = 0; rc == KVSTORE_OK && i < n; i++) {
+        if (rcs_out[i] == KVSTORE_ERROR) rc = KVSTORE_ERROR;
+    }
+    return rc;
+}
+
+#define DROP_BATCH 256
+
+int kvstore_txn_drop_table(kvstore_txn_t *txn, const char *table) {
+    if (!txn || !txn->db || !table) return KVSTORE_ERROR;
+    table = routed(txn, table);
+    if (txn->db->ops->drop_table) return txn->db->ops->drop_table(txn, table);
+
+    // Fallback: copy out a batch of keys, delete them, repeat
+    kvstore_val_t keys[DROP_BATCH];
+    bool found = false;
+    int rc = KVSTORE_OK;
+    for (;;) {
+        kvstore_cursor_t *cur = kvstore_cursor_open(txn, table, NULL);
+        size_t n = 0;
+        kvstore_val_t k;
+        while (cur && n < DROP_BATCH && kvstore_cursor_get(cur, &k, NULL) == KVSTORE_OK) {
+            keys[n].data = malloc(k.size);
+            if (!keys[n].data) {
+                rc = KVSTORE_ERROR;
+                break;
+            }
+            memcpy(keys[n].data, k.data, k.size);
+            keys[n++].size = k.size;
+            kvstore_cursor_next(cur);
+        }
+        if (cur) kvstore_cursor_close(cur);
+
+        for (size_t i = 0; i < n; i++) {
+            if (rc == KVSTORE_OK && txn->db->ops->del(txn, table, &keys[i]) == KVSTORE_ERROR) {
+                rc = KVSTORE_ERROR;
+            }
+            free(keys[i].data);
+        }
+        found |= n > 0;
+        if (rc != KVSTORE_OK || n < DROP_BATCH) break;
+    }
+    if (rc == KVSTORE_OK && !found) return KVSTORE_NOTFOUND;
+    return rc;
+}
+
+static uint64_t load_be(const char *p, size_t n) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++) v = v << 8 | (uint8_t)p[i];
+    return v;
+}
+
+static void store_be(char *p, size_t n, uint64_t v) {
+    for (size_t i = n; i-- > 0; v >>= 8) p[i] = (char)(uint8_t)v;
+}
+
+size_t kvstore_merge_apply(const kvstore_merge_t *op, void *val, size_t size) {
+    char *p = (char*)val + op->offset;
+    size_t width = op->kind == KVSTORE_MERGE_ADD_U64 ? 8 : 4;
+    if (op->offset > size || size - op->offset < width) return 0;
+
+    switch (op->kind) {
+    case KVSTORE_MERGE_ADD_U64:
+        store_be(p, 8, load_be(p, 8) + op->operand);
+        return size;
+    case KVSTORE_MERGE_OR_U32:
+        store_be(p, 4, load_be(p, 4) | (uint32_t)op->operand);
+        return size;
+    case KVSTORE_MERGE_AND_U32:
+        store_be(p, 4, load_be(p, 4) & (uint32_t)op->operand);
+        return size;
+    case KVSTORE_MERGE_APPEND:
+        store_be(p, 4, (uint32_t)(load_be(p, 4) + 1));
+        if (op->data.size) memcpy((char*)val + size, op->data.data, op->data.size);
+        return size + op->data.size;
+    }
+    return 0;
+}
+
+int kvstore_txn_merge(kvstore_txn_t *txn, const char *table, kvstore_val_t *key,
+                      const kvstore_merge_t *op) {
+    if (!txn || !txn->db || !op) return KVSTORE_ERROR;
+    table = routed(txn, table);
+    if (txn->db->ops->merge) return txn->db->ops->merge(txn, table, key, op);
+
+    // Fallback: read, apply to a copy, write back
+    kvstore_val_t val;
+    int rc = txn->db->ops->get(txn, table, key, &val);
+    if (rc != KVSTORE_OK) return rc;
+    size_t extra = op->kind == KVSTORE_MERGE_APPEND ? op->data.size : 0;
+    char *buf = (char*)malloc(val.size + extra + 1);
+    if (!buf) return KVSTORE_ERROR;
+    memcpy(buf, val.data, val.size);
+
+    kvstore_val_t merged = { buf, kvstore_merge_apply(op, buf, val.size) };
+    rc = merged.size ? txn->db->ops->put(txn, table, key, &merged) : KVSTORE_ERROR;
+    free(buf);
+    return rc;
 }
 
 // ------------------------
 // Cursor operations
 // ------------------------
 
+static int compare_vals(const kvstore_val_t *a, const kvstore_val_t *b) {
+    size_t min_size = a->size < b->size ? a->size : b->size;
+    int cmp = memcmp(a->data, b->data, min_size);
+    if (cmp != 0) return cmp;
+    if (a->size < b->size) return -1;
+    if (a->size > b->size) return 1;
+    return 0;
+}
+
 kvstore_cursor_t* kvstore_cursor_open(kvstore_txn_t *txn, const char *table,
                                       kvstore_val_t *start_key) {
     if (!txn || !txn->db || !txn->db->ops->cursor_open) return NULL;
@@ -103,7 +359,7 @@ kvstore_cursor_t* kvstore_cursor_open(kvstore_txn_t *txn, const char *table,
 
     cur->txn = txn;
 
-    if (txn->db->ops->cursor_open(txn, cur, table, start_key) != KVSTORE_OK) {
+    if (txn->db->ops->cursor_open(txn, cur, routed(txn, table), start_key) != KVSTORE_OK) {
         free(cur);
         return NULL;
     }
@@ -114,7 +370,14 @@ kvstore_cursor_t* kvstore_cursor_open(kvstore_txn_t *txn, const char *table,
 int kvstore_cursor_get(kvstore_cursor_t *cur, kvstore_val_t *key_out,
                        kvstore_val_t *val_out) {
     if (!cur || !cur->txn || !cur->txn->db) return KVSTORE_ERROR;
-    return cur->txn->db->ops->cursor_get(cur, key_out, val_out);
+    if (!cur->bounded) return cur->txn->db->ops->cursor_get(cur, key_out, val_out);
+
+    kvstore_val_t key;
+    int rc = cur->txn->db->ops->cursor_get(cur, &key, val_out);
+    if (rc != KVSTORE_OK) return rc;
+    if (compare_vals(&key, &cur->end) >= 0) return KVSTORE_NOTFOUND;
+    if (key_out) *key_out = key;
+    return KVSTORE_OK;
 }
 
 int kvstore_cursor_next(kvstore_cursor_t *cur) {
@@ -129,9 +392,1031 @@ void kvstore_cursor_close(kvstore_cursor_t *cur) {
         cur->txn->db->ops->cursor_close(cur);
     }
 
+    free(cur->end.data);
     free(cur);
 }
 
+int kvstore_cursor_set_end(kvstore_cursor_t *cur, kvstore_val_t *end) {
+    if (!cur || !cur->txn || !cur->txn->db) return KVSTORE_ERROR;
+
+    void *copy = NULL;
+    if (end) {
+        copy = malloc(end->size ? end->size : 1);
+        if (!copy) return KVSTORE_ERROR;
+        if (end->size) memcpy(copy, end->data, end->size);
+    }
+    free(cur->end.data);
+    cur->end.data = copy;
+    cur->end.size = end ? end->size : 0;
+    cur->bounded = end != NULL;
+
+    if (!cur->txn->db->ops->cursor_bound) return KVSTORE_OK;
+    return cur->txn->db->ops->cursor_bound(cur, end ? &cur->end : NULL);
+}
+
+// ------------------------
+// Index entries
+// ------------------------
+
+int kvstore_index_entry(kvstore_txn_t *txn, const char *prefix,
+                        const char *key, size_t key_len,
+                        const char *suffix, size_t suffix_len,
+                        const char *val, size_t val_len) {
+    size_t prefix_len = strlen(prefix);
+    size_t total = prefix_len + key_len + suffix_len;
+    char stack_buf[256];
+    char *buf = total <= sizeof(stack_buf) ? stack_buf : (char*)malloc(total);
+    if (!buf) return KVSTORE_ERROR;
+
+    memcpy(buf, prefix, prefix_len);
+    if (key_len) memcpy(buf + prefix_len, key, key_len);
+    if (suffix_len) memcpy(buf + prefix_len + key_len, suffix, suffix_len);
+
+    kvstore_val_t k = { buf, total };
+    int rc;
+    if (val) {
+        kvstore_val_t v = { (void*)val, val_len };
+        rc = kvstore_txn_put(txn, "", &k, &v);
+    } else {
+        rc = kvstore_txn_del(txn, "", &k);
+    }
+
+    if (buf != stack_buf) free(buf);
+    return rc;
+}
+
+// End cur at the first key past every key starting with prefix: the prefix
+// with its last byte below 0xff incremented and the rest cut off. A prefix
+// of all 0xff bytes has no such key and leaves the cursor unbounded.
+static int prefix_bound(kvstore_cursor_t *cur, const kvstore_val_t *prefix) {
+    const unsigned char *p = (const unsigned char*)prefix->data;
+    size_t len = prefix->size;
+    while (len > 0 && p[len - 1] == 0xff) len--;
+    if (len == 0) return KVSTORE_OK;
+
+    char stack_buf[256];
+    char *end = len <= sizeof(stack_buf) ? stack_buf : (char*)malloc(len);
+    if (!end) return KVSTORE_ERROR;
+    memcpy(end, p, len);
+    end[len - 1] = (char)(p[len - 1] + 1);
+
+    kvstore_val_t bound = { end, len };
+    int rc = kvstore_cursor_set_end(cur, &bound);
+    if (end != stack_buf) free(end);
+    return rc;
+}
+
+int kvstore_index_scan(kvstore_txn_t *txn, const char *prefix,
+                       const char *key, size_t key_len,
+                       int (*fn)(kvstore_val_t *pk, void *arg), void *arg) {
+    size_t prefix_len = strlen(prefix);
+    size_t total = prefix_len + key_len;
+    char stack_buf[256];
+    char *buf = total <= sizeof(stack_buf) ? stack_buf : (char*)malloc(total);
+    if (!buf) return KVSTORE_ERROR;
+
+    memcpy(buf, prefix, prefix_len);
+    if (key_len) memcpy(buf + prefix_len, key, key_len);
+
+    kvstore_val_t start = { buf, total };
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+    if (!cur || prefix_bound(cur, &start) != KVSTORE_OK) {
+        kvstore_cursor_close(cur);
+        if (buf != stack_buf) free(buf);
+        return KVSTORE_ERROR;
+    }
+
+    int rc = KVSTORE_NOTFOUND;
+    kvstore_val_t k, v;
+    while (kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK) {
+        if (k.size < total || memcmp(k.data, buf, total) != 0) break;
+        rc = KVSTORE_OK;
+
+        int stop = fn(&v, arg);
+        if (stop) {
+            rc = stop;
+            break;
+        }
+        if (kvstore_cursor_next(cur) != KVSTORE_OK) break;
+    }
+
+    kvstore_cursor_close(cur);
+    if (buf != stack_buf) free(buf);
+    return rc;
+}
+
+// ------------------------
+// Multi-valued index elements
+// ------------------------
+
+char* kvstore_elems_push(kvstore_elems_t *e, size_t len) {
+    if (e->rc != KVSTORE_OK) return NULL;
+
+    if (e->len + 4 + len > e->cap) {
+        size_t cap = e->cap ? e->cap * 2 : 256;
+        while (cap < e->len + 4 + len) cap *= 2;
+        char *data = (char*)realloc(e->data, cap);
+        if (!data) {
+            e->rc = KVSTORE_ERROR;
+            return NULL;
+        }
+        e->data = data;
+        e->cap = cap;
+    }
+
+    uint32_t elem_len = (uint32_t)len;
+    memcpy(e->data + e->len, &elem_len, 4);
+    char *p = e->data + e->len + 4;
+    e->len += 4 + len;
+    e->count++;
+    return p;
+}
+
+static size_t elem_size(const char *elem) {
+    uint32_t len;
+    memcpy(&len, elem, 4);
+    return 4 + (size_t)len;
+}
+
+static int compare_elems(const char *a, const char *b) {
+    uint32_t a_len, b_len;
+    memcpy(&a_len, a, 4);
+    memcpy(&b_len, b, 4);
+    int c = memcmp(a + 4, b + 4, a_len < b_len ? a_len : b_len);
+    if (c) return c;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+static int compare_elem_ptrs(const void *a, const void *b) {
+    return compare_elems(*(const char* const*)a, *(const char* const*)b);
+}
+
+int kvstore_elems_finish(kvstore_elems_t *e) {
+    if (e->rc != KVSTORE_OK) return e->rc;
+
+    // Bitmaps and sorted arrays arrive in order: nothing to do
+    bool sorted = true;
+    const char *prev = NULL;
+    for (size_t off = 0; off < e->len; off += elem_size(e->data + off)) {
+        if (prev && compare_elems(prev, e->data + off) >= 0) {
+            sorted = false;
+            break;
+        }
+        prev = e->data + off;
+    }
+    if (sorted) return KVSTORE_OK;
+
+    const char **ptrs = (const char**)malloc(e->count * sizeof(*ptrs));
+    char *data = (char*)malloc(e->len);
+    if (!ptrs || !data) {
+        free(ptrs);
+        free(data);
+        return e->rc = KVSTORE_ERROR;
+    }
+
+    size_t n = 0;
+    for (size_t off = 0; off < e->len; off += elem_size(e->data + off)) {
+        ptrs[n++] = e->data + off;
+    }
+    qsort(ptrs, n, sizeof(*ptrs), compare_elem_ptrs);
+
+    size_t len = 0, count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i && compare_elems(ptrs[i - 1], ptrs[i]) == 0) continue;
+        size_t sz = elem_size(ptrs[i]);
+        memcpy(data + len, ptrs[i], sz);
+        len += sz;
+        count++;
+    }
+
+    free(ptrs);
+    free(e->data);
+    e->data = data;
+    e->cap = e->len;
+    e->len = len;
+    e->count = count;
+    return KVSTORE_OK;
+}
+
+static bool term_byte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+size_t kvstore_next_term(const char **p, char *term) {
+    const unsigned char *s = (const unsigned char*)*p;
+    while (*s && !term_byte(*s)) s++;
+
+    size_t len = 0;
+    for (; term_byte(*s); s++) {
+        if (len == KVSTORE_TERM_MAX) continue;
+        term[len++] = (char)((*s >= 'A' && *s <= 'Z') ? *s + ('a' - 'A') : *s);
+    }
+    *p = (const char*)s;
+    return len;
+}
+
+void kvstore_tokenize(kvstore_elems_t *e, const char *text) {
+    char term[KVSTORE_TERM_MAX];
+    size_t len;
+    if (!text) return;
+    while ((len = kvstore_next_term(&text, term)) > 0) {
+        char *elem = kvstore_elems_push(e, len + 1);
+        if (!elem) return;
+        memcpy(elem, term, len);
+        elem[len] = '\0';
+    }
+}
+
+int kvstore_elems_diff(const char *cur, size_t cur_len,
+                       const char *old, size_t old_len, bool replace_all,
+                       int (*fn)(const char *elem, size_t elem_len, bool add, void *arg),
+                       void *arg) {
+    size_t i = 0, j = 0;
+    int rc = KVSTORE_OK;
+    while (rc == KVSTORE_OK && (i < old_len || j < cur_len)) {
+        int c;
+        if (i >= old_len) c = 1;
+        else if (j >= cur_len || replace_all) c = -1;
+        else c = compare_elems(old + i, cur + j);
+
+        if (c < 0) {
+            size_t sz = elem_size(old + i);
+            rc = fn(old + i + 4, sz - 4, false, arg);
+            i += sz;
+        } else if (c > 0) {
+            size_t sz = elem_size(cur + j);
+            rc = fn(cur + j + 4, sz - 4, true, arg);
+            j += sz;
+        } else {
+            i += elem_size(old + i);
+            j += elem_size(cur + j);
+        }
+    }
+    return rc;
+}
+
+typedef struct {
+    kvstore_txn_t *txn;
+    const char *prefix;
+    const char *pk, *old_pk;
+    size_t pk_len, old_pk_len;
+} elems_apply_t;
+
+static int elems_apply_entry(const char *elem, size_t elem_len, bool add, void *arg) {
+    elems_apply_t *a = (elems_apply_t*)arg;
+    if (add) {
+        return kvstore_index_entry(a->txn, a->prefix, elem, elem_len,
+                                   a->pk, a->pk_len, a->pk, a->pk_len);
+    }
+    int rc = kvstore_index_entry(a->txn, a->prefix, elem, elem_len,
+                                 a->old_pk, a->old_pk_len, NULL, 0);
+    return rc == KVSTORE_NOTFOUND ? KVSTORE_OK : rc;
+}
+
+int kvstore_elems_apply(kvstore_txn_t *txn, const char *prefix,
+                        const char *cur, size_t cur_len,
+                        const char *old, size_t old_len,
+                        const char *pk, size_t pk_len,
+                        const char *old_pk, size_t old_pk_len) {
+    // Entry keys embed the primary key, so a moved record rewrites them all
+    bool moved = !old_pk || old_pk_len != pk_len || memcmp(old_pk, pk, pk_len) != 0;
+    elems_apply_t a = { txn, prefix, pk, old_pk, pk_len, old_pk_len };
+    return kvstore_elems_diff(cur, cur_len, old, old_len, moved, elems_apply_entry, &a);
+}
+
+// ------------------------
+// Expiry
+// ------------------------
+
+static double monotonic_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+double kvstore_sweep_rate(const kvstore_sweep_stats_t *s, double *per_busy_sec) {
+    double wall = s->sweeps ? monotonic_sec() - s->first : 0;
+    if (per_busy_sec) *per_busy_sec = s->busy_sec > 0 ? (double)s->expired / s->busy_sec : 0;
+    return wall > 0 ? (double)s->expired / wall : 0;
+}
+
+int kvstore_expiry_sweep(kvstore_txn_t *txn, const char *prefix,
+                         const char *bound, size_t bound_len, size_t max,
+                         int (*expire)(kvstore_val_t *pk, void *arg), void *arg,
+                         kvstore_sweep_stats_t *stats) {
+    double start = monotonic_sec();
+    size_t prefix_len = strlen(prefix);
+    kvstore_val_t first = { (void*)prefix, prefix_len };
+
+    // Copy out the due entries (index key, then primary key) first:
+    // deleting moves the cursor
+    kvstore_elems_t pks = {0};
+    bool more = false;
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &first);
+    kvstore_val_t k, v;
+    while (cur && kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK &&
+           k.size >= prefix_len + bound_len && memcmp(k.data, prefix, prefix_len) == 0 &&
+           memcmp((char*)k.data + prefix_len, bound, bound_len) <= 0) {
+        if (pks.count == 2 * max) {
+            more = true;
+            break;
+        }
+        char *ik = kvstore_elems_push(&pks, k.size);
+        if (!ik) break;
+        memcpy(ik, k.data, k.size);
+        char *pk = kvstore_elems_push(&pks, v.size);
+        if (!pk) break;
+        memcpy(pk, v.data, v.size);
+        kvstore_cursor_next(cur);
+    }
+    if (cur) kvstore_cursor_close(cur);
+
+    int rc = pks.rc;
+    size_t expired = 0, orphans = 0;
+    for (size_t off = 0; rc == KVSTORE_OK && off < pks.len; ) {
+        uint32_t len;
+        memcpy(&len, pks.data + off, 4);
+        kvstore_val_t ik = { pks.data + off + 4, len };
+        off += 4 + len;
+        memcpy(&len, pks.data + off, 4);
+        kvstore_val_t pk = { pks.data + off + 4, len };
+        off += 4 + len;
+
+        rc = expire(&pk, arg);
+        if (rc == KVSTORE_OK) {
+            expired++;
+        } else if (rc == KVSTORE_NOTFOUND) {
+            // The record is gone but its deadline entry was left behind;
+            // drop it, or every later sweep would stop here
+            rc = kvstore_txn_del(txn, "", &ik);
+            if (rc == KVSTORE_OK) orphans++;
+        }
+    }
+    free(pks.data);
+
+    if (stats) {
+        if (!stats->sweeps) stats->first = start;
+        stats->sweeps++;
+        stats->expired += expired;
+        stats->orphans += orphans;
+        stats->backlog += more;
+        stats->busy_sec += monotonic_sec() - start;
+    }
+    if (rc != KVSTORE_OK) return rc;
+    return more ? KVSTORE_EXISTS : KVSTORE_OK;
+}
+
+// ------------------------
+// Aggregates
+// ------------------------
+
+int kvstore_agg_update(kvstore_txn_t *txn, const char *prefix,
+                       const char *group, size_t group_len,
+                       const int64_t *delta, size_t n, int sign) {
+    bool zero = true;
+    for (size_t i = 0; i < n; i++) {
+        if (delta[i]) zero = false;
+    }
+    if (zero) return KVSTORE_OK;
+
+    size_t prefix_len = strlen(prefix);
+    char *key_buf = (char*)malloc(prefix_len + group_len + n * 8);
+    if (!key_buf) return KVSTORE_ERROR;
+    memcpy(key_buf, prefix, prefix_len);
+    memcpy(key_buf + prefix_len, group, group_len);
+    char *val_buf = key_buf + prefix_len + group_len;
+
+    kvstore_val_t key = { key_buf, prefix_len + group_len };
+    kvstore_val_t cur = {0};
+    int rc = kvstore_txn_get(txn, "", &key, &cur);
+    if (rc == KVSTORE_OK && cur.size != n * 8) rc = KVSTORE_ERROR;
+    if (rc != KVSTORE_OK && rc != KVSTORE_NOTFOUND) {
+        free(key_buf);
+        return rc;
+    }
+    bool exists = (rc == KVSTORE_OK);
+
+    // Sum into a fresh buffer: cur.data may be backend storage
+    char *in = (char*)cur.data;
+    char *out = val_buf;
+    zero = true;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v = 0;
+        if (exists) SER_READ_U64(in, v);
+        v += sign < 0 ? -(uint64_t)delta[i] : (uint64_t)delta[i];
+        if (v) zero = false;
+        SER_WRITE_U64(out, v);
+    }
+
+    if (zero) {
+        rc = exists ? kvstore_txn_del(txn, "", &key) : KVSTORE_OK;
+    } else {
+        kvstore_val_t val = { val_buf, n * 8 };
+        rc = kvstore_txn_put(txn, "", &key, &val);
+    }
+
+    free(key_buf);
+    return rc;
+}
+
+// ------------------------
+// Parallel scan
+// ------------------------
+
+int kvstore_txn_split_points(kvstore_txn_t *txn, const char *table,
+                             kvstore_val_t *start, kvstore_val_t *end,
+                             kvstore_val_t *splits_out, size_t *nsplits) {
+    if (!txn || !txn->db || !nsplits) return KVSTORE_ERROR;
+    if (!txn->db->ops->split_points) {
+        *nsplits = 0;
+        return KVSTORE_NOTFOUND;
+    }
+    return txn->db->ops->split_points(txn, routed(txn, table), start, end,
+                                      splits_out, nsplits);
+}
+
+typedef struct {
+    kvstore_txn_t *txn;
+    const char *table;
+    kvstore_scan_fn fn;
+    void *arg;
+    atomic_int stop;
+} scan_shared_t;
+
+typedef struct {
+    scan_shared_t *shared;
+    size_t part;
+    kvstore_val_t *lo;      // Inclusive, NULL = table start
+    kvstore_val_t *hi;      // Exclusive, NULL = table end
+    int rc;
+} scan_part_t;
+
+static void* scan_worker(void *arg) {
+    scan_part_t *sp = (scan_part_t*)arg;
+    scan_shared_t *sh = sp->shared;
+
+    // A missing table opens no cursor and contributes nothing
+    kvstore_cursor_t *cur = kvstore_cursor_open(sh->txn, sh->table, sp->lo);
+    if (!cur) return NULL;
+    if (sp->hi && kvstore_cursor_set_end(cur, sp->hi) != KVSTORE_OK) {
+        sp->rc = KVSTORE_ERROR;
+        atomic_store(&sh->stop, 1);
+        kvstore_cursor_close(cur);
+        return NULL;
+    }
+
+    kvstore_val_t k, v;
+    while (kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK) {
+        if (sp->hi && compare_vals(&k, sp->hi) >= 0) break;
+        if (atomic_load_explicit(&sh->stop, memory_order_relaxed)) break;
+
+        int rc = sh->fn(sp->part, &k, &v, sh->arg);
+        if (rc != KVSTORE_OK) {
+            sp->rc = rc;
+            atomic_store(&sh->stop, 1);
+            break;
+        }
+        if (kvstore_cursor_next(cur) != KVSTORE_OK) break;
+    }
+
+    kvstore_cursor_close(cur);
+    return NULL;
+}
+
+int kvstore_scan_parallel(kvstore_txn_t *txn, const char *table,
+                          kvstore_val_t *start, kvstore_val_t *end,
+                          size_t nthreads, kvstore_scan_fn fn, void *arg) {
+    // Cursors on a read-write transaction would race its write set
+    if (!txn || !txn->db || !table || !fn || !txn->read_only) return KVSTORE_ERROR;
+    if (nthreads == 0) nthreads = 1;
+
+    kvstore_val_t *splits = (kvstore_val_t*)calloc(nthreads, sizeof(kvstore_val_t));
+    scan_part_t *parts = (scan_part_t*)calloc(nthreads, sizeof(scan_part_t));
+    pthread_t *threads = (pthread_t*)calloc(nthreads, sizeof(pthread_t));
+    bool *started = (bool*)calloc(nthreads, sizeof(bool));
+    if (!splits || !parts || !threads || !started) {
+        free(splits);
+        free(parts);
+        free(threads);
+        free(started);
+        return KVSTORE_ERROR;
+    }
+
+    // Fewer split points than requested just means fewer partitions
+    size_t nsplits = nthreads - 1;
+    if (nsplits == 0 ||
+        kvstore_txn_split_points(txn, table, start, end, splits, &nsplits) != KVSTORE_OK) {
+        nsplits = 0;
+    }
+
+    scan_shared_t shared = { .txn = txn, .table = table, .fn = fn, .arg = arg };
+    atomic_init(&shared.stop, 0);
+
+    size_t nparts = nsplits + 1;
+    for (size_t i = 0; i < nparts; i++) {
+        parts[i].shared = &shared;
+        parts[i].part = i;
+        parts[i].lo = i == 0 ? start : &splits[i - 1];
+        parts[i].hi = i == nsplits ? end : &splits[i];
+        parts[i].rc = KVSTORE_OK;
+    }
+
+    // Partition 0 runs on the calling thread; inline fallback if create fails
+    for (size_t i = 1; i < nparts; i++) {
+        if (pthread_create(&threads[i], NULL, scan_worker, &parts[i]) == 0) {
+            started[i] = true;
+        }
+    }
+    scan_worker(&parts[0]);
+
+    int rc = KVSTORE_OK;
+    for (size_t i = 1; i < nparts; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            scan_worker(&parts[i]);
+        }
+    }
+    for (size_t i = 0; i < nparts; i++) {
+        if (parts[i].rc != KVSTORE_OK) {
+            rc = parts[i].rc;
+            break;
+        }
+    }
+
+    free(splits);
+    free(parts);
+    free(threads);
+    free(started);
+    return rc;
+}
+
+// ------------------------
+// Index intersection
+// ------------------------
+
+int kvstore_pk_stream_init(kvstore_pk_stream_t *s, const char *prefix,
+                           const char *key, size_t key_len,
+                           bool pk_ordered, bool pk_suffix) {
+    size_t prefix_len = strlen(prefix);
+    s->key = (char*)malloc(prefix_len + key_len);
+    if (!s->key) return KVSTORE_ERROR;
+
+    memcpy(s->key, prefix, prefix_len);
+    if (key_len) memcpy(s->key + prefix_len, key, key_len);
+    s->key_len = prefix_len + key_len;
+    s->pk_ordered = pk_ordered;
+    s->pk_suffix = pk_suffix;
+    return KVSTORE_OK;
+}
+
+void kvstore_pk_stream_free(kvstore_pk_stream_t *s) {
+    if (!s) return;
+    free(s->key);
+    s->key = NULL;
+    s->key_len = 0;
+}
+
+// Position of one stream: pk is the current entry's value
+typedef struct {
+    kvstore_txn_t *txn;
+    kvstore_pk_stream_t *stream;
+    kvstore_cursor_t *cur;
+    kvstore_val_t pk;
+    char *seek_buf;
+    size_t seek_cap;
+} stream_iter_t;
+
+// Load the entry under the cursor; NOTFOUND once past the stream's range
+static int iter_load(stream_iter_t *it) {
+    kvstore_val_t k;
+    if (kvstore_cursor_get(it->cur, &k, &it->pk) != KVSTORE_OK) return KVSTORE_NOTFOUND;
+    if (k.size < it->stream->key_len ||
+        memcmp(k.data, it->stream->key, it->stream->key_len) != 0) {
+        return KVSTORE_NOTFOUND;
+    }
+    return KVSTORE_OK;
+}
+
+static int iter_open(stream_iter_t *it, const char *start, size_t start_len) {
+    kvstore_val_t k = { (void*)start, start_len };
+    it->cur = kvstore_cursor_open(it->txn, "", &k);
+    if (!it->cur) return KVSTORE_ERROR;
+    return iter_load(it);
+}
+
+static int iter_next(stream_iter_t *it) {
+    if (kvstore_cursor_next(it->cur) != KVSTORE_OK) return KVSTORE_NOTFOUND;
+    return iter_load(it);
+}
+
+// Advance to the first pk >= target. Short gaps are stepped over; longer
+// ones reposition the cursor when the stream's keys end in the pk.
+static int iter_seek(stream_iter_t *it, const kvstore_val_t *target) {
+    for (int steps = 0; compare_vals(&it->pk, target) < 0; steps++) {
+        if (steps == 8 && it->stream->pk_suffix) {
+            size_t len = it->stream->key_len + target->size;
+            if (len > it->seek_cap) {
+                char *buf = (char*)realloc(it->seek_buf, len);
+                if (!buf) return KVSTORE_ERROR;
+                it->seek_buf = buf;
+                it->seek_cap = len;
+            }
+            memcpy(it->seek_buf, it->stream->key, it->stream->key_len);
+            memcpy(it->seek_buf + it->stream->key_len, target->data, target->size);
+            kvstore_cursor_close(it->cur);
+            return iter_open(it, it->seek_buf, len);
+        }
+        int rc = iter_next(it);
+        if (rc != KVSTORE_OK) return rc;
+    }
+    return KVSTORE_OK;
+}
+
+// Set of pks in insertion order, each with a count of the streams that hit
+// it. Open addressing over indexes into the item array.
+typedef struct {
+    size_t off;         // Into arena
+    size_t len;
+    size_t hits;
+} pk_item_t;
+
+typedef struct {
+    uint64_t hash;
+    size_t item;        // SIZE_MAX marks an empty slot
+} pk_slot_t;
+
+typedef struct {
+    pk_slot_t *slots;
+    size_t cap;         // Power of two
+    pk_item_t *items;
+    size_t count, items_cap;
+    char *arena;
+    size_t arena_len, arena_cap;
+} pk_set_t;
+
+static uint64_t hash_bytes(const void *data, size_t len) {
+    // FNV-1a
+    const unsigned char *p = (const unsigned char*)data;
+    uint64_t h = 1469598103934665603ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static pk_slot_t* pk_set_find(pk_set_t *set, const void *data, size_t len, uint64_t h) {
+    for (size_t i = h & (set->cap - 1); ; i = (i + 1) & (set->cap - 1)) {
+        pk_slot_t *slot = &set->slots[i];
+        if (slot->item == SIZE_MAX) return slot;
+        pk_item_t *item = &set->items[slot->item];
+        if (slot->hash == h && item->len == len &&
+            memcmp(set->arena + item->off, data, len) == 0) {
+            return slot;
+        }
+    }
+}
+
+static int pk_set_grow(pk_set_t *set) {
+    size_t cap = set->cap ? set->cap * 2 : 1024;
+    pk_slot_t *slots = (pk_slot_t*)malloc(cap * sizeof(*slots));
+    if (!slots) return KVSTORE_ERROR;
+    for (size_t i = 0; i < cap; i++) slots[i].item = SIZE_MAX;
+
+    // Hashes are distinct per item, so rehash by position alone
+    for (size_t i = 0; i < set->cap; i++) {
+        if (set->slots[i].item == SIZE_MAX) continue;
+        size_t j = set->slots[i].hash & (cap - 1);
+        while (slots[j].item != SIZE_MAX) j = (j + 1) & (cap - 1);
+        slots[j] = set->slots[i];
+    }
+    free(set->slots);
+    set->slots = slots;
+    set->cap = cap;
+    return KVSTORE_OK;
+}
+
+static int pk_set_add(pk_set_t *set, const kvstore_val_t *pk) {
+    if ((set->count + 1) * 4 > set->cap * 3 && pk_set_grow(set) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+    uint64_t h = hash_bytes(pk->data, pk->size);
+    pk_slot_t *slot = pk_set_find(set, pk->data, pk->size, h);
+    if (slot->item != SIZE_MAX) return KVSTORE_OK;
+
+    if (set->count == set->items_cap) {
+        size_t cap = set->items_cap ? set->items_cap * 2 : 256;
+        pk_item_t *items = (pk_item_t*)realloc(set->items, cap * sizeof(*items));
+        if (!items) return KVSTORE_ERROR;
+        set->items = items;
+        set->items_cap = cap;
+    }
+    if (set->arena_len + pk->size > set->arena_cap) {
+        size_t cap = set->arena_cap ? set->arena_cap * 2 : 4096;
+        while (cap < set->arena_len + pk->size) cap *= 2;
+        char *arena = (char*)realloc(set->arena, cap);
+        if (!arena) return KVSTORE_ERROR;
+        set->arena = arena;
+        set->arena_cap = cap;
+    }
+    memcpy(set->arena + set->arena_len, pk->data, pk->size);
+    set->items[set->count] = (pk_item_t){ set->arena_len, pk->size, 0 };
+    *slot = (pk_slot_t){ h, set->count };
+    set->arena_len += pk->size;
+    set->count++;
+    return KVSTORE_OK;
+}
+
+static pk_item_t* pk_set_get(pk_set_t *set, const kvstore_val_t *pk) {
+    if (!set->cap) return NULL;
+    pk_slot_t *slot = pk_set_find(set, pk->data, pk->size, hash_bytes(pk->data, pk->size));
+    return slot->item == SIZE_MAX ? NULL : &set->items[slot->item];
+}
+
+static void pk_set_free(pk_set_t *set) {
+    free(set->slots);
+    free(set->items);
+    free(set->arena);
+}
+
+// Sort entry: the first 8 bytes big-endian decide most comparisons
+typedef struct {
+    uint64_t head;
+    kvstore_val_t pk;
+} pk_sorted_t;
+
+static int compare_sorted(const void *a, const void *b) {
+    const pk_sorted_t *x = (const pk_sorted_t*)a, *y = (const pk_sorted_t*)b;
+    if (x->head != y->head) return x->head < y->head ? -1 : 1;
+    return compare_vals(&x->pk, &y->pk);
+}
+
+// Leapfrog join of pk-ordered streams
+static int leapfrog(stream_iter_t *its, size_t n,
+                    int (*fn)(kvstore_val_t *pk, void *arg), void *arg,
+                    size_t *matches) {
+    char *target_buf = NULL;
+    size_t target_cap = 0;
+    kvstore_val_t target;
+    int rc = KVSTORE_OK;
+
+    for (size_t i = 0; i < n; i++) {
+        rc = iter_open(&its[i], its[i].stream->key, its[i].stream->key_len);
+        if (rc != KVSTORE_OK) goto done;
+    }
+
+    for (;;) {
+        // Copy the target: the cursor it came from is about to move
+        kvstore_val_t *lead = &its[0].pk;
+        for (size_t i = 1; i < n; i++) {
+            if (compare_vals(&its[i].pk, lead) > 0) lead = &its[i].pk;
+        }
+        if (lead->size > target_cap) {
+            char *buf = (char*)realloc(target_buf, lead->size);
+            if (!buf) {
+                rc = KVSTORE_ERROR;
+                goto done;
+            }
+            target_buf = buf;
+            target_cap = lead->size;
+        }
+        memcpy(target_buf, lead->data, lead->size);
+        target.data = target_buf;
+        target.size = lead->size;
+
+        bool aligned = true;
+        for (size_t i = 0; i < n; i++) {
+            rc = iter_seek(&its[i], &target);
+            if (rc != KVSTORE_OK) goto done;
+            if (compare_vals(&its[i].pk, &target) != 0) {
+                aligned = false;
+                break;
+            }
+        }
+        if (!aligned) continue;
+
+        (*matches)++;
+        int stop = fn(&target, arg);
+        if (stop) {
+            rc = stop;
+            goto done;
+        }
+        rc = iter_next(&its[0]);
+        if (rc != KVSTORE_OK) goto done;
+    }
+
+done:
+    free(target_buf);
+    return rc == KVSTORE_NOTFOUND ? KVSTORE_OK : rc;
+}
+
+// Probe pk-ordered streams with sorted candidates. Candidates only move
+// forward, so each stream is walked or re-sought at most once.
+static int probe_ordered(stream_iter_t *its, size_t n,
+                         const pk_sorted_t *cands, size_t ncands,
+                         int (*fn)(kvstore_val_t *pk, void *arg), void *arg,
+                         size_t *matches) {
+    int rc = KVSTORE_OK;
+    for (size_t i = 0; i < n; i++) {
+        if (its[i].cur) kvstore_cursor_close(its[i].cur);
+        rc = iter_open(&its[i], its[i].stream->key, its[i].stream->key_len);
+        if (rc != KVSTORE_OK) goto done;
+    }
+
+    for (size_t c = 0; c < ncands; c++) {
+        kvstore_val_t pk = cands[c].pk;
+        bool found = true;
+        for (size_t i = 0; i < n && found; i++) {
+            rc = iter_seek(&its[i], &pk);
+            if (rc != KVSTORE_OK) goto done;
+            found = compare_vals(&its[i].pk, &pk) == 0;
+        }
+        if (!found) continue;
+
+        (*matches)++;
+        rc = fn(&pk, arg);
+        if (rc) goto done;
+    }
+
+done:
+    return rc == KVSTORE_NOTFOUND ? KVSTORE_OK : rc;
+}
+
+// Count hits from streams first..n-1 against the set. A pk survives stream
+// i only if it survived every earlier one (hits == i - base).
+static int count_hits(stream_iter_t *its, size_t n, size_t first, size_t base,
+                      pk_set_t *set) {
+    for (size_t i = first; i < n; i++) {
+        int rc = iter_open(&its[i], its[i].stream->key, its[i].stream->key_len);
+        while (rc == KVSTORE_OK) {
+            pk_item_t *item = pk_set_get(set, &its[i].pk);
+            if (item && item->hits == i - base) item->hits++;
+            rc = iter_next(&its[i]);
+        }
+        if (rc != KVSTORE_NOTFOUND) return rc;
+    }
+    return KVSTORE_OK;
+}
+
+// Items with the given hit count, sorted by pk
+static int sort_survivors(pk_set_t *set, size_t hits, pk_sorted_t **out, size_t *nout) {
+    *out = NULL;
+    *nout = 0;
+    if (!set->count) return KVSTORE_OK;
+
+    pk_sorted_t *sorted = (pk_sorted_t*)malloc(set->count * sizeof(*sorted));
+    if (!sorted) return KVSTORE_ERROR;
+
+    size_t n = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        pk_item_t *item = &set->items[i];
+        if (item->hits != hits) continue;
+        const unsigned char *p = (const unsigned char*)set->arena + item->off;
+        pk_sorted_t *e = &sorted[n++];
+        e->head = 0;
+        for (size_t b = 0; b < 8; b++) {
+            e->head = (e->head << 8) | (b < item->len ? p[b] : 0);
+        }
+        e->pk.data = (void*)p;
+        e->pk.size = item->len;
+    }
+    if (n) qsort(sorted, n, sizeof(*sorted), compare_sorted);
+    *out = sorted;
+    *nout = n;
+    return KVSTORE_OK;
+}
+
+// Mixed join: the merged ordered streams race the first unordered stream,
+// and whichever runs out first is the (smaller) side that gets hashed
+typedef struct {
+    pk_set_t merged;    // Leapfrog output, in pk order
+    pk_set_t first;     // Entries of the first unordered stream
+    stream_iter_t *it;
+    int state;          // KVSTORE_OK while the unordered stream has entries
+} race_t;
+
+static int race_step(kvstore_val_t *pk, void *arg) {
+    race_t *r = (race_t*)arg;
+    if (pk_set_add(&r->merged, pk) != KVSTORE_OK) return KVSTORE_ERROR;
+    if (pk_set_add(&r->first, &r->it->pk) != KVSTORE_OK) return KVSTORE_ERROR;
+    r->state = iter_next(r->it);
+    if (r->state == KVSTORE_NOTFOUND) return KVSTORE_EXISTS;
+    return r->state;
+}
+
+static int intersect_mixed(stream_iter_t *its, size_t nordered, size_t n,
+                           int (*fn)(kvstore_val_t *pk, void *arg), void *arg,
+                           size_t *matches) {
+    race_t race = { .it = &its[nordered] };
+    pk_sorted_t *sorted = NULL;
+    size_t nsorted = 0, merged = 0;
+
+    race.state = iter_open(race.it, race.it->stream->key, race.it->stream->key_len);
+    int rc = race.state == KVSTORE_OK ?
+        leapfrog(its, nordered, race_step, &race, &merged) : race.state;
+
+    if (rc == KVSTORE_OK) {
+        // Merge finished first: the unordered streams vote on its output
+        for (size_t i = 0; i < race.first.count; i++) {
+            pk_item_t *item = &race.first.items[i];
+            kvstore_val_t pk = { race.first.arena + item->off, item->len };
+            pk_item_t *hit = pk_set_get(&race.merged, &pk);
+            if (hit) hit->hits = 1;
+        }
+        while (race.state == KVSTORE_OK) {
+            pk_item_t *hit = pk_set_get(&race.merged, &race.it->pk);
+            if (hit) hit->hits = 1;
+            race.state = iter_next(race.it);
+        }
+        rc = race.state == KVSTORE_NOTFOUND ?
+            count_hits(its, n, nordered + 1, nordered, &race.merged) : race.state;
+
+        for (size_t i = 0; rc == KVSTORE_OK && i < race.merged.count; i++) {
+            pk_item_t *item = &race.merged.items[i];
+            if (item->hits != n - nordered) continue;
+            kvstore_val_t pk = { race.merged.arena + item->off, item->len };
+            (*matches)++;
+            rc = fn(&pk, arg);
+        }
+    } else if (rc == KVSTORE_EXISTS) {
+        // Unordered stream finished first: filter it by the other unordered
+        // streams, then seek the ordered ones to each survivor
+        rc = count_hits(its, n, nordered + 1, nordered + 1, &race.first);
+        if (rc == KVSTORE_OK) {
+            rc = sort_survivors(&race.first, n - nordered - 1, &sorted, &nsorted);
+        }
+        if (rc == KVSTORE_OK) {
+            rc = probe_ordered(its, nordered, sorted, nsorted, fn, arg, matches);
+        }
+    } else if (rc == KVSTORE_NOTFOUND) {
+        rc = KVSTORE_OK;    // Unordered stream empty
+    }
+
+    free(sorted);
+    pk_set_free(&race.merged);
+    pk_set_free(&race.first);
+    return rc;
+}
+
+int kvstore_intersect(kvstore_txn_t *txn, kvstore_pk_stream_t *streams, size_t n,
+                      int (*fn)(kvstore_val_t *pk, void *arg), void *arg) {
+    if (!txn || !streams || !n || !fn) return KVSTORE_ERROR;
+
+    stream_iter_t *its = (stream_iter_t*)calloc(n, sizeof(*its));
+    if (!its) return KVSTORE_ERROR;
+
+    // Ordered streams first
+    size_t nordered = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (streams[i].pk_ordered) nordered++;
+    }
+    size_t o = 0, u = nordered;
+    for (size_t i = 0; i < n; i++) {
+        size_t at = streams[i].pk_ordered ? o++ : u++;
+        its[at].txn = txn;
+        its[at].stream = &streams[i];
+    }
+
+    size_t matches = 0;
+    int rc = KVSTORE_OK;
+
+    if (nordered == n) {
+        rc = leapfrog(its, n, fn, arg, &matches);
+    } else if (nordered) {
+        rc = intersect_mixed(its, nordered, n, fn, arg, &matches);
+    } else {
+        // Hash the first stream, count hits from the rest, sort survivors
+        pk_set_t set = {0};
+        pk_sorted_t *sorted = NULL;
+        size_t nsorted = 0;
+
+        rc = iter_open(&its[0], its[0].stream->key, its[0].stream->key_len);
+        while (rc == KVSTORE_OK) {
+            rc = pk_set_add(&set, &its[0].pk);
+            if (rc == KVSTORE_OK) rc = iter_next(&its[0]);
+        }
+        if (rc == KVSTORE_NOTFOUND) rc = count_hits(its, n, 1, 1, &set);
+        if (rc == KVSTORE_OK) rc = sort_survivors(&set, n - 1, &sorted, &nsorted);
+        for (size_t i = 0; rc == KVSTORE_OK && i < nsorted; i++) {
+            matches++;
+            rc = fn(&sorted[i].pk, arg);
+        }
+        free(sorted);
+        pk_set_free(&set);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (its[i].cur) kvstore_cursor_close(its[i].cur);
+        free(its[i].seek_buf);
+    }
+    free(its);
+
+    if (rc == KVSTORE_OK && matches == 0) return KVSTORE_NOTFOUND;
+    return rc;
+}
+
 // Forward declaration from kvstore_mem.c
 extern const struct kvstore_ops* kvstore_mem_ops(void);
 
@@ -0,0 +1,463 @@
+// Asynchronous reads: io_uring rings, or a pread thread pool
+
+#define _GNU_SOURCE
+#include "../include/kvstore_aio.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define AIO_DEFAULT_DEPTH   64
+#define AIO_DEFAULT_THREADS 4
+
+// ------------------------
+// Data structures
+// ------------------------
+
+// The kernel's submission and completion rings, mapped into our memory
+typedef struct {
+    int fd;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;           // NULL when it shares sq_map
+    size_t cq_map_len;
+    size_t sqes_len;
+    unsigned to_submit;     // In the ring, not yet taken by the kernel
+} aio_ring_t;
+
+// Reads queue on waiting until there is room in flight (depth), then go to
+// the ring or the pool. Completed ones collect on done until waited for.
+// lock guards done and inflight, which pool threads update.
+struct kvstore_aio_queue {
+    kvstore_aio_t *aio;
+    kvstore_aio_queue_t *next_free;
+    kvstore_aio_req_t *waiting;
+    kvstore_aio_req_t *waiting_tail;
+    size_t pending;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    kvstore_aio_req_t *done;
+    kvstore_aio_req_t *done_tail;
+    size_t ndone;
+    size_t inflight;
+    aio_ring_t ring;
+};
+
+struct kvstore_aio {
+    kvstore_io_mode_t mode;
+    unsigned depth;
+    pthread_mutex_t lock;   // Guards the work list and the free queues
+    pthread_cond_t work_cond;
+    kvstore_aio_req_t *work;
+    kvstore_aio_req_t *work_tail;
+    kvstore_aio_queue_t *free_queues;
+    bool stop;
+    pthread_t *threads;
+    unsigned nthreads;
+};
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static ssize_t read_full(kvstore_aio_req_t *req) {
+    size_t got = 0;
+    while (got < req->len) {
+        ssize_t n = pread(req->fd, (char*)req->buf + got, req->len - got, (off_t)(req->off + got));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+static void list_push(kvstore_aio_req_t **head, kvstore_aio_req_t **tail,
+                      kvstore_aio_req_t *req) {
+    req->next = NULL;
+    if (*tail) (*tail)->next = req;
+    else *head = req;
+    *tail = req;
+}
+
+static kvstore_aio_req_t* list_pop(kvstore_aio_req_t **head, kvstore_aio_req_t **tail) {
+    kvstore_aio_req_t *req = *head;
+    if (req) {
+        *head = req->next;
+        if (!*head) *tail = NULL;
+    }
+    return req;
+}
+
+// Call with q->lock held
+static void complete(kvstore_aio_queue_t *q, kvstore_aio_req_t *req) {
+    list_push(&q->done, &q->done_tail, req);
+    q->ndone++;
+}
+
+// ------------------------
+// io_uring
+// ------------------------
+
+static void ring_close(aio_ring_t *r) {
+    if (r->sqes) munmap(r->sqes, r->sqes_len);
+    if (r->cq_map) munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_len);
+    if (r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+static int ring_open(aio_ring_t *r, unsigned depth) {
+    memset(r, 0, sizeof(*r));
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+    if (r->fd < 0) {
+        r->fd = -1;
+        return KVSTORE_ERROR;
+    }
+
+    // IORING_OP_READ arrived with this feature (Linux 5.6)
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        ring_close(r);
+        return KVSTORE_ERROR;
+    }
+
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && r->cq_map_len > r->sq_map_len) r->sq_map_len = r->cq_map_len;
+
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        r->sq_map = NULL;
+        ring_close(r);
+        return KVSTORE_ERROR;
+    }
+    char *cq = (char*)r->sq_map;
+    if (!single) {
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            r->cq_map = NULL;
+            ring_close(r);
+            return KVSTORE_ERROR;
+        }
+        cq = (char*)r->cq_map;
+    }
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        ring_close(r);
+        return KVSTORE_ERROR;
+    }
+
+    char *sq = (char*)r->sq_map;
+    r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    r->cq_head = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return KVSTORE_OK;
+}
+
+// Move waiting reads into free submission slots
+static void ring_fill(kvstore_aio_queue_t *q) {
+    aio_ring_t *r = &q->ring;
+    unsigned tail = *r->sq_tail;
+    unsigned added = 0;
+
+    while (q->waiting && q->inflight < q->aio->depth) {
+        kvstore_aio_req_t *req = list_pop(&q->waiting, &q->waiting_tail);
+        unsigned idx = tail & r->sq_mask;
+        struct io_uring_sqe *sqe = &r->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = req->fd;
+        sqe->addr = (uint64_t)(uintptr_t)req->buf;
+        sqe->len = (uint32_t)req->len;
+        sqe->off = req->off;
+        sqe->user_data = (uint64_t)(uintptr_t)req;
+        r->sq_array[idx] = idx;
+        tail++;
+        added++;
+        q->inflight++;
+    }
+    if (added) {
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+        r->to_submit += added;
+    }
+}
+
+// Move completions off the ring. Call with q->lock held.
+static void ring_reap(kvstore_aio_queue_t *q) {
+    aio_ring_t *r = &q->ring;
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+        kvstore_aio_req_t *req = (kvstore_aio_req_t*)(uintptr_t)cqe->user_data;
+        req->res = cqe->res;
+        if (req->res > 0 && (size_t)req->res < req->len) {
+            // The kernel may cut a read short; finish it as the pool would
+            kvstore_aio_req_t rest = *req;
+            rest.buf = (char*)req->buf + req->res;
+            rest.len = req->len - (size_t)req->res;
+            rest.off = req->off + (uint64_t)req->res;
+            ssize_t n = read_full(&rest);
+            req->res = n < 0 ? n : req->res + n;
+        }
+        complete(q, req);
+        q->inflight--;
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int ring_wait(kvstore_aio_queue_t *q, size_t min) {
+    aio_ring_t *r = &q->ring;
+    for (;;) {
+        ring_fill(q);
+        ring_reap(q);
+        bool enough = q->ndone >= min;
+        if (enough && r->to_submit == 0) break;
+
+        unsigned wait = enough ? 0 : 1;
+        long n = syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait,
+                         wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            return KVSTORE_ERROR;
+        }
+        r->to_submit -= (unsigned)n;
+    }
+    return KVSTORE_OK;
+}
+
+// ------------------------
+// Thread pool
+// ------------------------
+
+static void* pool_main(void *arg) {
+    kvstore_aio_t *aio = (kvstore_aio_t*)arg;
+
+    pthread_mutex_lock(&aio->lock);
+    for (;;) {
+        while (!aio->work && !aio->stop) pthread_cond_wait(&aio->work_cond, &aio->lock);
+        kvstore_aio_req_t *req = list_pop(&aio->work, &aio->work_tail);
+        if (!req) break;
+        pthread_mutex_unlock(&aio->lock);
+
+        req->res = read_full(req);
+
+        kvstore_aio_queue_t *q = req->queue;
+        pthread_mutex_lock(&q->lock);
+        complete(q, req);
+        q->inflight--;
+        pthread_cond_signal(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+
+        pthread_mutex_lock(&aio->lock);
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return NULL;
+}
+
+// Hand waiting reads to the pool. Call with q->lock held.
+static void pool_fill(kvstore_aio_queue_t *q) {
+    kvstore_aio_t *aio = q->aio;
+    if (!q->waiting || q->inflight >= aio->depth) return;
+
+    pthread_mutex_lock(&aio->lock);
+    while (q->waiting && q->inflight < aio->depth) {
+        list_push(&aio->work, &aio->work_tail, list_pop(&q->waiting, &q->waiting_tail));
+        q->inflight++;
+        pthread_cond_signal(&aio->work_cond);
+    }
+    pthread_mutex_unlock(&aio->lock);
+}
+
+// ------------------------
+// API
+// ------------------------
+
+kvstore_aio_t* kvstore_aio_new(kvstore_io_mode_t mode, unsigned depth, unsigned threads) {
+    kvstore_aio_t *aio = (kvstore_aio_t*)calloc(1, sizeof(kvstore_aio_t));
+    if (!aio) return NULL;
+    aio->depth = depth ? depth : AIO_DEFAULT_DEPTH;
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->work_cond, NULL);
+
+    if (mode == KVSTORE_IO_AUTO || mode == KVSTORE_IO_URING) {
+        aio_ring_t probe;
+        if (ring_open(&probe, aio->depth) == KVSTORE_OK) {
+            ring_close(&probe);
+            mode = KVSTORE_IO_URING;
+        } else if (mode == KVSTORE_IO_URING) {
+            kvstore_aio_free(aio);
+            return NULL;
+        } else {
+            mode = KVSTORE_IO_THREADS;
+        }
+    }
+    aio->mode = mode;
+
+    if (mode == KVSTORE_IO_THREADS) {
+        unsigned n = threads ? threads : AIO_DEFAULT_THREADS;
+        aio->threads = (pthread_t*)calloc(n, sizeof(pthread_t));
+        if (!aio->threads) {
+            kvstore_aio_free(aio);
+            return NULL;
+        }
+        while (aio->nthreads < n &&
+               pthread_create(&aio->threads[aio->nthreads], NULL, pool_main, aio) == 0) {
+            aio->nthreads++;
+        }
+        if (aio->nthreads == 0) {
+            kvstore_aio_free(aio);
+            return NULL;
+        }
+    }
+    return aio;
+}
+
+static void queue_free(kvstore_aio_queue_t *q) {
+    if (q->aio->mode == KVSTORE_IO_URING) ring_close(&q->ring);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->cond);
+    free(q);
+}
+
+void kvstore_aio_free(kvstore_aio_t *aio) {
+    if (!aio) return;
+
+    pthread_mutex_lock(&aio->lock);
+    aio->stop = true;
+    pthread_cond_broadcast(&aio->work_cond);
+    pthread_mutex_unlock(&aio->lock);
+    for (unsigned i = 0; i < aio->nthreads; i++) pthread_join(aio->threads[i], NULL);
+    free(aio->threads);
+
+    while (aio->free_queues) {
+        kvstore_aio_queue_t *q = aio->free_queues;
+        aio->free_queues = q->next_free;
+        queue_free(q);
+    }
+    pthread_mutex_destroy(&aio->lock);
+    pthread_cond_destroy(&aio->work_cond);
+    free(aio);
+}
+
+kvstore_io_mode_t kvstore_aio_mode(kvstore_aio_t *aio) {
+    return aio->mode;
+}
+
+kvstore_aio_queue_t* kvstore_aio_queue_get(kvstore_aio_t *aio) {
+    pthread_mutex_lock(&aio->lock);
+    kvstore_aio_queue_t *q = aio->free_queues;
+    if (q) aio->free_queues = q->next_free;
+    pthread_mutex_unlock(&aio->lock);
+    if (q) return q;
+
+    q = (kvstore_aio_queue_t*)calloc(1, sizeof(kvstore_aio_queue_t));
+    if (!q) return NULL;
+    q->aio = aio;
+    q->ring.fd = -1;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    if (aio->mode == KVSTORE_IO_URING && ring_open(&q->ring, aio->depth) != KVSTORE_OK) {
+        queue_free(q);
+        return NULL;
+    }
+    return q;
+}
+
+void kvstore_aio_queue_put(kvstore_aio_queue_t *q) {
+    if (!q) return;
+
+    kvstore_aio_req_t *done[64];
+    size_t n;
+    while (q->pending > 0 && kvstore_aio_wait(q, 1, done, 64, &n) == KVSTORE_OK) {
+    }
+
+    kvstore_aio_t *aio = q->aio;
+    pthread_mutex_lock(&aio->lock);
+    q->next_free = aio->free_queues;
+    aio->free_queues = q;
+    pthread_mutex_unlock(&aio->lock);
+}
+
+int kvstore_aio_submit(kvstore_aio_queue_t *q, kvstore_aio_req_t *req) {
+    if (!q || !req) return KVSTORE_ERROR;
+    req->queue = q;
+    req->res = 0;
+
+    pthread_mutex_lock(&q->lock);
+    q->pending++;
+    if (q->aio->mode == KVSTORE_IO_SYNC) {
+        pthread_mutex_unlock(&q->lock);
+        req->res = read_full(req);
+        pthread_mutex_lock(&q->lock);
+        complete(q, req);
+    } else {
+        list_push(&q->waiting, &q->waiting_tail, req);
+        if (q->aio->mode == KVSTORE_IO_THREADS) pool_fill(q);
+        else ring_fill(q);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return KVSTORE_OK;
+}
+
+size_t kvstore_aio_pending(kvstore_aio_queue_t *q) {
+    return q ? q->pending : 0;
+}
+
+int kvstore_aio_wait(kvstore_aio_queue_t *q, size_t min,
+                     kvstore_aio_req_t **done, size_t max, size_t *ndone) {
+    if (!q || (max > 0 && !done)) return KVSTORE_ERROR;
+    if (min > max) min = max;
+    if (min > q->pending) min = q->pending;
+
+    int rc = KVSTORE_OK;
+    pthread_mutex_lock(&q->lock);
+    if (q->aio->mode == KVSTORE_IO_URING) {
+        rc = ring_wait(q, min);
+    } else if (q->aio->mode == KVSTORE_IO_THREADS) {
+        for (;;) {
+            pool_fill(q);
+            if (q->ndone >= min) break;
+            pthread_cond_wait(&q->cond, &q->lock);
+        }
+    }
+
+    size_t n = 0;
+    while (n < max && q->done) {
+        done[n++] = list_pop(&q->done, &q->done_tail);
+    }
+    q->ndone -= n;
+    q->pending -= n;
+    pthread_mutex_unlock(&q->lock);
+
+    if (ndone) *ndone = n;
+    return rc;
+}
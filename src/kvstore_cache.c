@@ -0,0 +1,281 @@
+// Block cache: CLOCK over a slab of aligned blocks, in shards
+
+#define _POSIX_C_SOURCE 200809L
+#include "../include/kvstore_cache.h"
+#include <pthread.h>
+#include <string.h>
+
+#define CACHE_SHARDS        16
+#define CACHE_POOL_KEEP     256     // Idle buffers the pool holds on to
+
+// ------------------------
+// Data structures
+// ------------------------
+
+typedef struct {
+    uint64_t id;
+    uint32_t len;
+    int32_t next;           // In its hash chain, -1 at the end
+    bool used;
+    bool ref;               // Read since the clock hand last passed
+} cache_frame_t;
+
+// Frames index into the shard's slice of the slab. Chains of frames hang
+// off buckets by block id.
+typedef struct {
+    pthread_mutex_t lock;
+    char *data;
+    cache_frame_t *frames;
+    size_t nframes;
+    int32_t *buckets;
+    size_t bucket_mask;
+    size_t hand;
+    size_t used;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+} cache_shard_t;
+
+typedef struct cache_buf {
+    struct cache_buf *next;
+} cache_buf_t;
+
+struct kvstore_cache {
+    size_t block;
+    char *slab;
+    cache_shard_t shards[CACHE_SHARDS];
+    size_t nshards;
+    pthread_mutex_t pool_lock;
+    cache_buf_t *pool;
+    size_t pool_len;
+};
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static uint64_t hash_id(uint64_t id) {
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdull;
+    id ^= id >> 33;
+    return id;
+}
+
+static cache_shard_t* shard_for(kvstore_cache_t *c, uint64_t h) {
+    return &c->shards[h % c->nshards];
+}
+
+static int32_t* chain_for(cache_shard_t *s, uint64_t h) {
+    return &s->buckets[(h / CACHE_SHARDS) & s->bucket_mask];
+}
+
+static int32_t shard_find(cache_shard_t *s, uint64_t h, uint64_t id) {
+    for (int32_t f = *chain_for(s, h); f >= 0; f = s->frames[f].next) {
+        if (s->frames[f].id == id) return f;
+    }
+    return -1;
+}
+
+static void shard_unlink(cache_shard_t *s, int32_t f) {
+    int32_t *p = chain_for(s, hash_id(s->frames[f].id));
+    while (*p != f) p = &s->frames[*p].next;
+    *p = s->frames[f].next;
+    s->frames[f].used = false;
+    s->used--;
+}
+
+// A free frame, evicting the first unreferenced one the hand comes to
+static int32_t shard_victim(cache_shard_t *s) {
+    for (;;) {
+        cache_frame_t *fr = &s->frames[s->hand];
+        int32_t f = (int32_t)s->hand;
+        s->hand = (s->hand + 1) % s->nframes;
+        if (!fr->used) return f;
+        if (fr->ref) {
+            fr->ref = false;
+            continue;
+        }
+        shard_unlink(s, f);
+        s->evictions++;
+        return f;
+    }
+}
+
+// ------------------------
+// API
+// ------------------------
+
+kvstore_cache_t* kvstore_cache_new(size_t bytes, size_t block_size) {
+    if (block_size == 0 || (block_size & (block_size - 1)) != 0) return NULL;
+
+    kvstore_cache_t *c = (kvstore_cache_t*)calloc(1, sizeof(kvstore_cache_t));
+    if (!c) return NULL;
+    c->block = block_size;
+    pthread_mutex_init(&c->pool_lock, NULL);
+
+    // Small caches keep to one shard, so eviction sees every block
+    size_t blocks = bytes / block_size;
+    if (blocks == 0) blocks = 1;
+    c->nshards = blocks >= CACHE_SHARDS * 4 ? CACHE_SHARDS : 1;
+    if (posix_memalign((void**)&c->slab, block_size, blocks * block_size) != 0) {
+        free(c);
+        return NULL;
+    }
+
+    size_t per = blocks / c->nshards, first = 0;
+    for (size_t i = 0; i < c->nshards; i++) {
+        cache_shard_t *s = &c->shards[i];
+        size_t n = i + 1 == c->nshards ? blocks - first : per;
+        size_t nb = 1;
+        while (nb < n) nb <<= 1;
+        pthread_mutex_init(&s->lock, NULL);
+        s->data = c->slab + first * block_size;
+        s->nframes = n;
+        s->frames = (cache_frame_t*)calloc(n, sizeof(cache_frame_t));
+        s->buckets = (int32_t*)malloc(nb * sizeof(int32_t));
+        s->bucket_mask = nb - 1;
+        if (!s->frames || !s->buckets) {
+            c->nshards = i + 1;
+            kvstore_cache_free(c);
+            return NULL;
+        }
+        memset(s->buckets, 0xff, nb * sizeof(int32_t));
+        first += n;
+    }
+    return c;
+}
+
+void kvstore_cache_free(kvstore_cache_t *c) {
+    if (!c) return;
+    for (size_t i = 0; i < c->nshards; i++) {
+        pthread_mutex_destroy(&c->shards[i].lock);
+        free(c->shards[i].frames);
+        free(c->shards[i].buckets);
+    }
+    while (c->pool) {
+        cache_buf_t *b = c->pool;
+        c->pool = b->next;
+        free(b);
+    }
+    pthread_mutex_destroy(&c->pool_lock);
+    free(c->slab);
+    free(c);
+}
+
+size_t kvstore_cache_block_size(kvstore_cache_t *c) {
+    return c->block;
+}
+
+size_t kvstore_cache_get(kvstore_cache_t *c, uint64_t id, void *buf, size_t cap, bool hot) {
+    uint64_t h = hash_id(id);
+    cache_shard_t *s = shard_for(c, h);
+    size_t len = 0;
+
+    pthread_mutex_lock(&s->lock);
+    int32_t f = shard_find(s, h, id);
+    if (f >= 0 && s->frames[f].len <= cap) {
+        len = s->frames[f].len;
+        memcpy(buf, s->data + (size_t)f * c->block, len);
+        s->frames[f].ref = s->frames[f].ref || hot;
+        s->hits++;
+    } else {
+        s->misses++;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return len;
+}
+
+bool kvstore_cache_contains(kvstore_cache_t *c, uint64_t id) {
+    uint64_t h = hash_id(id);
+    cache_shard_t *s = shard_for(c, h);
+    pthread_mutex_lock(&s->lock);
+    bool found = shard_find(s, h, id) >= 0;
+    pthread_mutex_unlock(&s->lock);
+    return found;
+}
+
+void kvstore_cache_put(kvstore_cache_t *c, uint64_t id, const void *data, size_t len, bool hot) {
+    if (len > c->block) return;
+    uint64_t h = hash_id(id);
+    cache_shard_t *s = shard_for(c, h);
+
+    pthread_mutex_lock(&s->lock);
+    int32_t f = shard_find(s, h, id);
+    if (f < 0) {
+        f = shard_victim(s);
+        cache_frame_t *fr = &s->frames[f];
+        fr->id = id;
+        fr->used = true;
+        fr->ref = false;
+        int32_t *chain = chain_for(s, h);
+        fr->next = *chain;
+        *chain = f;
+        s->used++;
+        s->inserts++;
+    }
+    memcpy(s->data + (size_t)f * c->block, data, len);
+    s->frames[f].len = (uint32_t)len;
+    s->frames[f].ref = s->frames[f].ref || hot;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void kvstore_cache_clear(kvstore_cache_t *c) {
+    for (size_t i = 0; i < c->nshards; i++) {
+        cache_shard_t *s = &c->shards[i];
+        pthread_mutex_lock(&s->lock);
+        for (size_t f = 0; f < s->nframes; f++) s->frames[f].used = false;
+        memset(s->buckets, 0xff, (s->bucket_mask + 1) * sizeof(int32_t));
+        s->used = 0;
+        s->hand = 0;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+void kvstore_cache_stats(kvstore_cache_t *c, kvstore_cache_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (size_t i = 0; i < c->nshards; i++) {
+        cache_shard_t *s = &c->shards[i];
+        pthread_mutex_lock(&s->lock);
+        out->hits += s->hits;
+        out->misses += s->misses;
+        out->inserts += s->inserts;
+        out->evictions += s->evictions;
+        out->blocks += s->used;
+        out->capacity += s->nframes;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+void* kvstore_cache_buf_get(kvstore_cache_t *c, size_t len) {
+    if (len <= c->block) {
+        pthread_mutex_lock(&c->pool_lock);
+        cache_buf_t *b = c->pool;
+        if (b) {
+            c->pool = b->next;
+            c->pool_len--;
+        }
+        pthread_mutex_unlock(&c->pool_lock);
+        if (b) return b;
+        len = c->block;
+    }
+
+    void *buf;
+    return posix_memalign(&buf, c->block, len) == 0 ? buf : NULL;
+}
+
+void kvstore_cache_buf_put(kvstore_cache_t *c, void *buf, size_t len) {
+    if (!buf) return;
+    if (len <= c->block) {
+        pthread_mutex_lock(&c->pool_lock);
+        if (c->pool_len < CACHE_POOL_KEEP) {
+            cache_buf_t *b = (cache_buf_t*)buf;
+            b->next = c->pool;
+            c->pool = b;
+            c->pool_len++;
+            buf = NULL;
+        }
+        pthread_mutex_unlock(&c->pool_lock);
+    }
+    free(buf);
+}
@@ -0,0 +1,190 @@
+// Page compression: an LZ77 codec of byte-aligned sequences
+//
+// A sequence is a token byte, its literals, then a match: the token's high
+// four bits count the literals and its low four bits the match's length
+// less LZ_MIN_MATCH, either going on in extra bytes when 15 (each adds up
+// to 255, and one below 255 ends it). The literals follow the literal
+// count; the match is a u16 little-endian offset back into the output,
+// then the match length's extra bytes. The last sequence is literals
+// alone, and ends the input.
+
+#include "../include/kvstore_compress.h"
+#include <string.h>
+
+#define LZ_MIN_MATCH    4
+#define LZ_MAX_OFFSET   65535
+#define LZ_HASH_BITS    12
+#define LZ_SKIP         6       // The search step grows every 2^LZ_SKIP misses
+
+static uint32_t load_u32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t load_u64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// ------------------------
+// Compression
+// ------------------------
+
+// The extra bytes of a count of 15 or more
+static unsigned char* lz_put_length(unsigned char *op, unsigned char *oend, size_t n) {
+    for (n -= 15; n >= 255; n -= 255) {
+        if (op == oend) return NULL;
+        *op++ = 255;
+    }
+    if (op == oend) return NULL;
+    *op++ = (unsigned char)n;
+    return op;
+}
+
+// Literals then a match of mlen bytes at off, or the literals alone (mlen
+// 0) to end. NULL if it doesn't fit.
+static unsigned char* lz_put_sequence(unsigned char *op, unsigned char *oend,
+                                      const unsigned char *lit, size_t nlit,
+                                      size_t off, size_t mlen) {
+    size_t m = mlen ? mlen - LZ_MIN_MATCH : 0;
+    if (op == oend) return NULL;
+    *op++ = (unsigned char)((nlit < 15 ? nlit : 15) << 4 | (m < 15 ? m : 15));
+    if (nlit >= 15 && !(op = lz_put_length(op, oend, nlit))) return NULL;
+    if ((size_t)(oend - op) < nlit) return NULL;
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen == 0) return op;
+
+    if (oend - op < 2) return NULL;
+    *op++ = (unsigned char)(off & 0xff);
+    *op++ = (unsigned char)(off >> 8);
+    if (m >= 15 && !(op = lz_put_length(op, oend, m))) return NULL;
+    return op;
+}
+
+size_t kvstore_lz_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+// Greedy: a hash of the four bytes at each position finds the last place
+// they were seen, which a match needs. Misses in a row step further, so
+// data that won't compress is passed over quickly.
+size_t kvstore_lz_compress(const void *src, size_t len, void *dst, size_t cap) {
+    const unsigned char *base = (const unsigned char*)src, *iend = base + len;
+    const unsigned char *ip = base + 1, *anchor = base;
+    const unsigned char *mlimit = len > LZ_MIN_MATCH ? iend - LZ_MIN_MATCH : base;
+    unsigned char *op = (unsigned char*)dst, *oend = op + cap;
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    if (len > UINT32_MAX) return 0;
+
+    unsigned misses = 0;
+    while (ip <= mlimit) {
+        uint32_t v = load_u32(ip);
+        uint32_t h = lz_hash(v);
+        const unsigned char *ref = base + table[h];
+        table[h] = (uint32_t)(ip - base);
+        if (ip - ref > LZ_MAX_OFFSET || load_u32(ref) != v) {
+            ip += 1 + (misses++ >> LZ_SKIP);
+            continue;
+        }
+        misses = 0;
+
+        // Take in matching bytes before it that were to be literals, and
+        // all that match after
+        while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        const unsigned char *end = ip + LZ_MIN_MATCH, *q = ref + LZ_MIN_MATCH;
+        uint64_t diff = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // Eight bytes a step: the first that differs is the lowest set
+        while (iend - end >= 8 && !(diff = load_u64(end) ^ load_u64(q))) {
+            end += 8;
+            q += 8;
+        }
+#endif
+        if (diff) {
+            end += __builtin_ctzll(diff) / 8;
+        } else {
+            while (end < iend && *end == *q) {
+                end++;
+                q++;
+            }
+        }
+        op = lz_put_sequence(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - ref),
+                             (size_t)(end - ip));
+        if (!op) return 0;
+
+        // A position near the match's end, for the next one to find
+        if (end - 2 <= mlimit) table[lz_hash(load_u32(end - 2))] = (uint32_t)(end - 2 - base);
+        ip = anchor = end;
+    }
+    op = lz_put_sequence(op, oend, anchor, (size_t)(iend - anchor), 0, 0);
+    return op ? (size_t)(op - (unsigned char*)dst) : 0;
+}
+
+// ------------------------
+// Decompression
+// ------------------------
+
+static int lz_get_length(const unsigned char **ip, const unsigned char *iend, size_t *n) {
+    unsigned b;
+    do {
+        if (*ip == iend) return KVSTORE_ERROR;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return KVSTORE_OK;
+}
+
+int kvstore_lz_decompress(const void *src, size_t clen, void *dst, size_t len) {
+    const unsigned char *ip = (const unsigned char*)src, *iend = ip + clen;
+    unsigned char *out = (unsigned char*)dst, *op = out, *oend = out + len;
+
+    for (;;) {
+        if (ip == iend) return KVSTORE_ERROR;
+        unsigned token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && lz_get_length(&ip, iend, &nlit) != KVSTORE_OK) return KVSTORE_ERROR;
+        if ((size_t)(iend - ip) < nlit || (size_t)(oend - op) < nlit) return KVSTORE_ERROR;
+        // Short runs are copied 16 bytes at once where both buffers have
+        // room; the bytes past them are overwritten next
+        if (nlit <= 16 && iend - ip >= 16 && oend - op >= 16) memcpy(op, ip, 16);
+        else memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if (ip == iend) return op == oend ? KVSTORE_OK : KVSTORE_ERROR;
+
+        if (iend - ip < 2) return KVSTORE_ERROR;
+        size_t off = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && lz_get_length(&ip, iend, &mlen) != KVSTORE_OK) return KVSTORE_ERROR;
+        mlen += LZ_MIN_MATCH;
+        if (off == 0 || off > (size_t)(op - out) || (size_t)(oend - op) < mlen) {
+            return KVSTORE_ERROR;
+        }
+
+        // A match may overlap the bytes it produces: a run of one byte
+        // repeated is an offset of one
+        const unsigned char *ref = op - off;
+        if (off >= 8 && (size_t)(oend - op) >= mlen + 8) {
+            for (size_t i = 0; i < mlen; i += 8) memcpy(op + i, ref + i, 8);
+        } else if (off >= mlen) {
+            memcpy(op, ref, mlen);
+        } else if (off == 1) {
+            memset(op, *ref, mlen);
+        } else {
+            for (size_t i = 0; i < mlen; i++) op[i] = ref[i];
+        }
+        op += mlen;
+    }
+}
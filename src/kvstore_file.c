@@ -0,0 +1,2382 @@
+// File-backed KV store: a data file of sorted pages, a memtable of the
+// writes since it was written, and a write-ahead log of those writes
+
+#define _GNU_SOURCE             // O_DIRECT
+#include "../include/kvstore_file.h"
+#include "../include/kvstore_crc.h"
+#include "../include/kvstore_mem.h"
+#include "../include/kvstore_repl.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FILE_FLUSH_INTERVAL_MS  10
+#define FILE_CHECKPOINT_BYTES   (64 * 1024 * 1024)
+#define FILE_PAGE_SIZE          4096
+#define FILE_PAGE_HDR           12      // u32 entry count, u32 bytes used, u32 CRC-32C
+#define FILE_ENTRY_HDR          6       // u16 key length, u32 value length
+#define FILE_FOOTER             40
+#define FILE_MAGIC              0x4b56534547303033ull   // "KVSEG003"
+#define FILE_ARENA_CHUNK        (64 * 1024)
+#define FILE_WRITE_CHUNK        (1024 * 1024)
+#define FILE_POLL_BATCH         64
+#define FILE_READAHEAD          256     // Pages, by default
+#define FILE_CACHE_BYTES        (64 * 1024 * 1024)      // Block cache, by default
+#define FILE_VERIFY_CHUNK       256     // Pages a verify thread takes at a time
+#define FILE_EXTENT             (96 * 1024)     // Most read ahead in one direct read,
+                                                // kept below malloc's mmap threshold
+
+// Memtable values start with a tag, so a delete can hide a key in the data
+// file until the next checkpoint
+#define FILE_TAG_TOMBSTONE      0
+#define FILE_TAG_VALUE          1
+
+// ------------------------
+// Data structures
+// ------------------------
+
+typedef struct {
+    const char *first;      // First key on the page
+    uint16_t first_len;
+    uint8_t codec;          // KVSTORE_CODEC_NONE if stored as is
+    uint32_t len;           // Bytes as a page, a multiple of FILE_PAGE_SIZE
+    uint32_t disk_len;      // Bytes on disk: len, or fewer compressed
+    uint64_t off;
+} seg_page_t;
+
+typedef struct {
+    const char *name;
+    kvstore_codec_t codec;
+    size_t first_page;
+    size_t npages;
+    uint64_t keys;
+} seg_table_t;
+
+// The data file, as written by a checkpoint: pages of sorted entries, table
+// by table in name order, then an index of each page's first key, then a
+// footer. The index is held in memory and pages are read as needed.
+typedef struct {
+    int fd;
+    char *index;            // As read: names and first keys point into it
+    seg_table_t *tables;
+    size_t ntables;
+    seg_page_t *pages;
+    size_t npages;
+    uint64_t seq;           // Last commit it includes
+    uint64_t bytes;
+    uint64_t page_bytes;    // Of pages, decompressed
+    uint64_t compressed;    // Pages stored compressed
+    atomic_uint_least64_t *verified;    // Buffered: a bit per page checksummed
+    uint64_t cache_base;    // Block cache id of page 0, past every earlier file's
+} seg_t;
+
+// A data file and the memtable of the writes since it. Transactions pin the
+// generation current when they begin, and read it to the end; the last to
+// let go of a generation a checkpoint replaced frees it.
+typedef struct {
+    kvstore_t *mem;
+    seg_t *seg;             // NULL before the first checkpoint
+    size_t refs;            // Transactions, and one while current
+    uint64_t last_seq;      // Once replaced: the last commit to mem
+} file_gen_t;
+
+// log_lock guards the buffer and the sequence numbers. commit_lock is held
+// from the memory commit to the frame's append, so log order is commit
+// order. One thread at a time writes the log (flushing), with log_lock
+// released: others append meanwhile, and sync commits wait on log_cond for
+// it to finish, then flush whatever is left themselves.
+//
+// A checkpoint holds commit_lock while it writes the memtable out, so it
+// stays as written, then swaps in the next generation under gen_lock.
+// Transactions never wait for it: one that began before it reads the old
+// generation, and its writes are carried into the new one at commit, or
+// fail with KVSTORE_CONFLICT if others have committed since.
+typedef struct {
+    char *path;
+    int fd;
+    kvstore_durability_t durability;
+    unsigned flush_interval_ms;
+    size_t checkpoint_bytes;
+    pthread_mutex_t commit_lock;
+    pthread_mutex_t log_lock;
+    pthread_cond_t log_cond;
+    char *buf;              // Frames logged but not yet written
+    size_t len;
+    size_t cap;
+    char *spare;            // The other buffer, swapped in while writing
+    size_t spare_cap;
+    uint64_t seq;
+    uint64_t written_seq;
+    uint64_t durable_seq;
+    uint64_t syncs;
+    uint64_t log_bytes;
+    uint64_t checkpoints;
+    uint64_t data_bytes;
+    uint64_t page_bytes;
+    uint64_t compressed_pages;
+    uint64_t log_written;
+    uint64_t data_written;
+    bool flushing;
+    bool failed;            // A log write failed: commits fail from now on
+    bool replaying;         // Opening: commits aren't logged again
+    pthread_cond_t flusher_cond;
+    bool stop;
+    bool flusher_started;
+    pthread_t flusher;
+    pthread_mutex_t gen_lock;
+    file_gen_t *gen;
+    kvstore_aio_t *aio;
+    kvstore_cache_t *cache; // Direct I/O: the only cache of data file pages
+    unsigned readahead;     // Most pages a cursor reads ahead (0: none)
+    bool verify;            // Check page checksums
+    kvstore_codec_t codec;  // For tables table_codec doesn't choose for
+    kvstore_codec_t (*table_codec)(const char *table, void *arg);
+    void *table_codec_arg;
+    atomic_uint_least64_t page_reads;
+    atomic_uint_least64_t readahead_pages;
+    atomic_uint_least64_t pages_verified;
+    atomic_uint_least64_t checksum_errors;
+    pthread_mutex_t tables_lock;
+    char **tables;          // Tables written since the checkpoint, sorted
+    size_t ntables;
+    size_t tables_cap;
+} file_db_t;
+
+// Log position at a savepoint, to cut the frame back to on rollback
+typedef struct {
+    size_t len;
+    uint32_t ops;
+} file_mark_t;
+
+// Values read from the data file are copied here, to last the transaction
+typedef struct file_chunk {
+    struct file_chunk *next;
+    size_t used;
+    size_t cap;
+    char data[];
+} file_chunk_t;
+
+typedef struct {
+    file_gen_t *gen;
+    kvstore_txn_t *inner;   // On gen->mem
+    char *log;              // Frame being built: header space + ops
+    size_t len;
+    size_t cap;
+    uint32_t ops;
+    file_mark_t *marks;     // By savepoint id
+    size_t mark_count;
+    size_t mark_cap;
+    char *val;              // Tagged value being put
+    size_t val_cap;
+    char *page;             // Page read by a synchronous get
+    size_t page_cap;
+    file_chunk_t *arena;
+    kvstore_aio_queue_t *queue;     // Taken at the first asynchronous get
+} file_txn_t;
+
+// An asynchronous get waiting for its page
+typedef struct {
+    kvstore_aio_req_t req;
+    size_t page;
+    kvstore_get_fn fn;
+    void *arg;
+    size_t key_len;
+    char key[];
+} file_lookup_t;
+
+// Adjacent pages a cursor reads ahead into the block cache, in one read
+typedef struct file_extent {
+    kvstore_aio_req_t req;
+    struct file_extent *next;
+    size_t page;
+    size_t npages;
+} file_extent_t;
+
+// Cursors merge the memtable's cursor with a walk through the data file's
+// pages. The memtable wins on equal keys, and its tombstones hide keys.
+//
+// Once the walk moves on from page to page, the cursor reads the pages
+// after the current one ahead, and finds each in a cache when it gets
+// there: the kernel's page cache (POSIX_FADV_WILLNEED), or with direct I/O
+// the block cache, through asynchronous reads of up to FILE_EXTENT bytes.
+// The window doubles with each page up to fdb->readahead, and never passes
+// end_page, so a bounded scan reads no page beyond its range.
+typedef struct {
+    file_db_t *fdb;
+    kvstore_cursor_t *mem;      // NULL if the memtable lacks the table
+    const seg_t *seg;
+    const seg_table_t *table;   // NULL if the data file lacks it
+    size_t page;                // Page loaded, by index in seg->pages
+    char *buf;
+    size_t cap;
+    uint32_t count;
+    uint32_t idx;
+    bool seg_valid;
+    kvstore_val_t seg_key;
+    kvstore_val_t seg_val;
+    bool valid;
+    bool from_mem;              // Current entry is the memtable's
+    bool at_end;                // The walk stopped at end_page, short of the table's end
+    size_t end_page;            // Pages from here on hold only keys past the end
+    unsigned run;               // Pages moved on to since the seek
+    size_t ahead;               // Pages before this one have been read ahead
+    kvstore_aio_queue_t *queue; // Direct I/O: taken at the first read ahead
+    file_extent_t *extents;     // Reads ahead in flight
+} file_cursor_t;
+
+// ------------------------
+// Transaction frames
+// ------------------------
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int frame_reserve(file_txn_t *ftxn, size_t extra) {
+    if (ftxn->len + extra <= ftxn->cap) return KVSTORE_OK;
+
+    size_t cap = ftxn->cap ? ftxn->cap : 4096;
+    while (cap < ftxn->len + extra) cap *= 2;
+
+    char *log = (char*)realloc(ftxn->log, cap);
+    if (!log) return KVSTORE_ERROR;
+    ftxn->log = log;
+    ftxn->cap = cap;
+    return KVSTORE_OK;
+}
+
+static int frame_append(file_txn_t *ftxn, uint8_t type, const char *table,
+                        kvstore_val_t *key, kvstore_val_t *val) {
+    size_t table_len = strlen(table);
+    size_t val_len = val ? val->size : 0;
+
+    if (frame_reserve(ftxn, KVSTORE_REPL_OP_HDR + table_len + key->size + val_len) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+
+    char *p = ftxn->log + ftxn->len;
+    SER_WRITE_U8(p, type);
+    SER_WRITE_U16(p, table_len);
+    SER_WRITE_U32(p, key->size);
+    SER_WRITE_U32(p, val_len);
+    memcpy(p, table, table_len); p += table_len;
+    memcpy(p, key->data, key->size); p += key->size;
+    if (val_len) { memcpy(p, val->data, val_len); p += val_len; }
+
+    ftxn->len = (size_t)(p - ftxn->log);
+    ftxn->ops++;
+    return KVSTORE_OK;
+}
+
+// ------------------------
+// Log
+// ------------------------
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return KVSTORE_ERROR;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return KVSTORE_OK;
+}
+
+// Append a committed frame to the buffer and number it. Call with
+// commit_lock held.
+static int log_append(file_db_t *fdb, file_txn_t *ftxn, uint64_t *seq_out) {
+    pthread_mutex_lock(&fdb->log_lock);
+    if (fdb->len + ftxn->len > fdb->cap) {
+        size_t cap = fdb->cap ? fdb->cap : 64 * 1024;
+        while (cap < fdb->len + ftxn->len) cap *= 2;
+        char *buf = (char*)realloc(fdb->buf, cap);
+        if (!buf) {
+            // The memory commit has happened and can't be logged
+            fdb->failed = true;
+            pthread_mutex_unlock(&fdb->log_lock);
+            return KVSTORE_ERROR;
+        }
+        fdb->buf = buf;
+        fdb->cap = cap;
+    }
+
+    char *p = ftxn->log;
+    SER_WRITE_U32(p, ftxn->len - 4);
+    SER_WRITE_U64(p, ++fdb->seq);
+    SER_WRITE_U64(p, now_ns());
+    SER_WRITE_U32(p, ftxn->ops);
+    memcpy(fdb->buf + fdb->len, ftxn->log, ftxn->len);
+    fdb->len += ftxn->len;
+    *seq_out = fdb->seq;
+    pthread_mutex_unlock(&fdb->log_lock);
+    return KVSTORE_OK;
+}
+
+// Make sure commit seq is written to the log file, and fsynced if sync
+static int log_flush(file_db_t *fdb, uint64_t seq, bool sync) {
+    int rc = KVSTORE_OK;
+    pthread_mutex_lock(&fdb->log_lock);
+    for (;;) {
+        if (fdb->written_seq >= seq && (!sync || fdb->durable_seq >= seq)) break;
+        if (fdb->failed) {
+            rc = KVSTORE_ERROR;
+            break;
+        }
+        if (fdb->flushing) {
+            pthread_cond_wait(&fdb->log_cond, &fdb->log_lock);
+            continue;
+        }
+
+        // Take everything logged so far, leaving the spare for appends
+        char *buf = fdb->buf;
+        size_t len = fdb->len, cap = fdb->cap;
+        uint64_t upto = fdb->seq;
+        fdb->buf = fdb->spare;
+        fdb->cap = fdb->spare_cap;
+        fdb->len = 0;
+        fdb->flushing = true;
+        pthread_mutex_unlock(&fdb->log_lock);
+
+        int wrc = write_all(fdb->fd, buf, len);
+        if (wrc == KVSTORE_OK && sync && fdatasync(fdb->fd) != 0) wrc = KVSTORE_ERROR;
+
+        pthread_mutex_lock(&fdb->log_lock);
+        fdb->spare = buf;
+        fdb->spare_cap = cap;
+        fdb->flushing = false;
+        if (wrc != KVSTORE_OK) {
+            fdb->failed = true;
+        } else {
+            fdb->written_seq = upto;
+            fdb->log_bytes += len;
+            fdb->log_written += len;
+            if (sync) {
+                fdb->durable_seq = upto;
+                fdb->syncs++;
+            }
+        }
+        pthread_cond_broadcast(&fdb->log_cond);
+    }
+    pthread_mutex_unlock(&fdb->log_lock);
+    return rc;
+}
+
+static int checkpoint(file_db_t *fdb);
+
+// Write and fsync whatever ASYNC and NONE commits left, every interval, and
+// checkpoint once the log has grown past checkpoint_bytes
+static void* flusher_main(void *arg) {
+    file_db_t *fdb = (file_db_t*)arg;
+
+    pthread_mutex_lock(&fdb->log_lock);
+    while (!fdb->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t ns = (uint64_t)deadline.tv_nsec + (uint64_t)fdb->flush_interval_ms * 1000000ull;
+        deadline.tv_sec += (time_t)(ns / 1000000000ull);
+        deadline.tv_nsec = (long)(ns % 1000000000ull);
+        pthread_cond_timedwait(&fdb->flusher_cond, &fdb->log_lock, &deadline);
+        if (fdb->stop || fdb->failed) continue;
+
+        if (fdb->durable_seq != fdb->seq) {
+            uint64_t seq = fdb->seq;
+            pthread_mutex_unlock(&fdb->log_lock);
+            log_flush(fdb, seq, true);
+            pthread_mutex_lock(&fdb->log_lock);
+        }
+        if (fdb->checkpoint_bytes && fdb->log_bytes >= fdb->checkpoint_bytes) {
+            pthread_mutex_unlock(&fdb->log_lock);
+            int rc = checkpoint(fdb);
+            pthread_mutex_lock(&fdb->log_lock);
+
+            // Likely to fail again (a full disk): leave it to explicit calls
+            if (rc != KVSTORE_OK) fdb->checkpoint_bytes = 0;
+        }
+    }
+    pthread_mutex_unlock(&fdb->log_lock);
+    return NULL;
+}
+
+// ------------------------
+// Pages
+// ------------------------
+
+static int key_cmp(const void *k1, size_t s1, const void *k2, size_t s2) {
+    size_t min_size = s1 < s2 ? s1 : s2;
+    int cmp = memcmp(k1, k2, min_size);
+    if (cmp != 0) return cmp;
+    if (s1 < s2) return -1;
+    if (s1 > s2) return 1;
+    return 0;
+}
+
+static int read_at(int fd, void *buf, size_t len, uint64_t off) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = pread(fd, (char*)buf + got, len - got, (off_t)(off + got));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return KVSTORE_ERROR;
+        }
+        if (n == 0) return KVSTORE_ERROR;
+        got += (size_t)n;
+    }
+    return KVSTORE_OK;
+}
+
+// A page's CRC-32C covers all of it but the CRC itself
+static uint32_t page_crc(const char *page, size_t len) {
+    return kvstore_crc32c(kvstore_crc32c(0, page, 8), page + FILE_PAGE_HDR, len - FILE_PAGE_HDR);
+}
+
+static bool page_crc_ok(const char *page, size_t len) {
+    const char *p = page + 8;
+    uint32_t crc;
+    if (len < FILE_PAGE_HDR) return false;
+    SER_READ_U32(p, crc);
+    return page_crc(page, len) == crc;
+}
+
+// A page is its header, then a u32 offset per entry, then the entries
+// (u16 key length, u32 value length, key, value) in key order, then zeros
+// up to its length. Returns the entry count, or KVSTORE_ERROR.
+static int page_check(const char *page, size_t len, uint32_t *count) {
+    if (len < FILE_PAGE_HDR) return KVSTORE_ERROR;
+    const char *p = page;
+    uint32_t n, used;
+    SER_READ_U32(p, n);
+    SER_READ_U32(p, used);
+    if (used > len || FILE_PAGE_HDR + (uint64_t)n * 4 > used) return KVSTORE_ERROR;
+    *count = n;
+    return KVSTORE_OK;
+}
+
+// Entry i of a checked page
+static int page_entry(const char *page, uint32_t i,
+                      kvstore_val_t *key, kvstore_val_t *val) {
+    const char *p = page + 4;
+    uint32_t used, off;
+    SER_READ_U32(p, used);
+    p = page + FILE_PAGE_HDR + (size_t)i * 4;
+    SER_READ_U32(p, off);
+    if ((uint64_t)off + FILE_ENTRY_HDR > used) return KVSTORE_ERROR;
+
+    p = page + off;
+    uint16_t key_len;
+    uint32_t val_len;
+    SER_READ_U16(p, key_len);
+    SER_READ_U32(p, val_len);
+    if ((uint64_t)off + FILE_ENTRY_HDR + key_len + val_len > used) return KVSTORE_ERROR;
+
+    key->data = (void*)p;
+    key->size = key_len;
+    if (val) {
+        val->data = (void*)(p + key_len);
+        val->size = val_len;
+    }
+    return KVSTORE_OK;
+}
+
+// Index of the first entry >= key (count if none)
+static int page_seek(const char *page, uint32_t count, const kvstore_val_t *key,
+                     uint32_t *idx_out) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        kvstore_val_t k;
+        if (page_entry(page, mid, &k, NULL) != KVSTORE_OK) return KVSTORE_ERROR;
+        if (key_cmp(k.data, k.size, key->data, key->size) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *idx_out = lo;
+    return KVSTORE_OK;
+}
+
+// ------------------------
+// Data file
+// ------------------------
+
+static void seg_free(seg_t *seg) {
+    if (!seg) return;
+    if (seg->fd >= 0) close(seg->fd);
+    free(seg->index);
+    free(seg->tables);
+    free(seg->pages);
+    free((void*)seg->verified);
+    free(seg);
+}
+
+// Parse the index: u32 table count, then per table its u16 name length,
+// name, NUL, u8 codec, u64 key count, u32 page count, and per page its u64
+// offset, u32 length, u32 length on disk, u16 first key length and first
+// key. Its CRC-32C is in the footer.
+static int seg_parse(seg_t *seg, size_t index_len) {
+    const char *p = seg->index, *end = seg->index + index_len;
+#define SEG_NEED(n) do { if ((size_t)(end - p) < (size_t)(n)) return KVSTORE_ERROR; } while (0)
+
+    uint32_t ntables;
+    SEG_NEED(4);
+    SER_READ_U32(p, ntables);
+    if (ntables > index_len) return KVSTORE_ERROR;
+    seg->tables = (seg_table_t*)calloc(ntables ? ntables : 1, sizeof(seg_table_t));
+    if (!seg->tables) return KVSTORE_ERROR;
+
+    size_t page_cap = 0;
+    for (uint32_t i = 0; i < ntables; i++) {
+        seg_table_t *t = &seg->tables[i];
+        uint16_t name_len;
+        uint8_t codec;
+        uint32_t npages;
+        SEG_NEED(2);
+        SER_READ_U16(p, name_len);
+        SEG_NEED((size_t)name_len + 1 + 1 + 8 + 4);
+        t->name = p;
+        if (p[name_len] != '\0') return KVSTORE_ERROR;
+        p += name_len + 1;
+        SER_READ_U8(p, codec);
+        if (codec > KVSTORE_CODEC_LZ) return KVSTORE_ERROR;
+        t->codec = (kvstore_codec_t)codec;
+        SER_READ_U64(p, t->keys);
+        SER_READ_U32(p, npages);
+        if (i > 0 && strcmp(seg->tables[i - 1].name, t->name) >= 0) return KVSTORE_ERROR;
+
+        t->first_page = seg->npages;
+        t->npages = npages;
+        if (seg->npages + npages > page_cap) {
+            size_t cap = page_cap ? page_cap * 2 : 64;
+            while (cap < seg->npages + npages) cap *= 2;
+            seg_page_t *pages = (seg_page_t*)realloc(seg->pages, cap * sizeof(seg_page_t));
+            if (!pages) return KVSTORE_ERROR;
+            seg->pages = pages;
+            page_cap = cap;
+        }
+        for (uint32_t j = 0; j < npages; j++) {
+            seg_page_t *pg = &seg->pages[seg->npages++];
+            SEG_NEED(8 + 4 + 4 + 2);
+            SER_READ_U64(p, pg->off);
+            SER_READ_U32(p, pg->len);
+            SER_READ_U32(p, pg->disk_len);
+            SER_READ_U16(p, pg->first_len);
+            SEG_NEED(pg->first_len);
+            pg->first = p;
+            p += pg->first_len;
+            if (pg->len == 0 || pg->disk_len < FILE_PAGE_HDR || pg->disk_len > pg->len ||
+                (pg->disk_len < pg->len && t->codec == KVSTORE_CODEC_NONE)) {
+                return KVSTORE_ERROR;
+            }
+            pg->codec = pg->disk_len < pg->len ? (uint8_t)t->codec : KVSTORE_CODEC_NONE;
+            seg->page_bytes += pg->len;
+            if (pg->codec != KVSTORE_CODEC_NONE) seg->compressed++;
+        }
+    }
+    seg->ntables = ntables;
+#undef SEG_NEED
+    return p == end ? KVSTORE_OK : KVSTORE_ERROR;
+}
+
+// Open the data file at path: *out is NULL if there is none yet. With
+// direct set, pages are then read with O_DIRECT, past the page cache.
+static int seg_load(const char *path, bool direct, seg_t **out) {
+    *out = NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return errno == ENOENT ? KVSTORE_OK : KVSTORE_ERROR;
+
+    seg_t *seg = (seg_t*)calloc(1, sizeof(seg_t));
+    if (!seg) {
+        close(fd);
+        return KVSTORE_ERROR;
+    }
+    seg->fd = fd;
+    // Cursors ask for read ahead themselves, up to their end key. The
+    // kernel's own would go past it, and waste a random lookup's I/O.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+    struct stat st;
+    char footer[FILE_FOOTER];
+    if (fstat(fd, &st) != 0 || st.st_size < FILE_FOOTER ||
+        read_at(fd, footer, FILE_FOOTER, (uint64_t)st.st_size - FILE_FOOTER) != KVSTORE_OK) {
+        seg_free(seg);
+        return KVSTORE_ERROR;
+    }
+
+    // The footer: u64 index offset and length, u64 sequence, the index's
+    // CRC-32C, the CRC-32C of the footer up to here, u64 magic
+    const char *p = footer;
+    uint64_t index_off, index_len, magic;
+    uint32_t index_crc, footer_crc;
+    SER_READ_U64(p, index_off);
+    SER_READ_U64(p, index_len);
+    SER_READ_U64(p, seg->seq);
+    SER_READ_U32(p, index_crc);
+    SER_READ_U32(p, footer_crc);
+    SER_READ_U64(p, magic);
+    if (magic != FILE_MAGIC || footer_crc != kvstore_crc32c(0, footer, 28) ||
+        index_off + index_len + FILE_FOOTER != (uint64_t)st.st_size) {
+        seg_free(seg);
+        return KVSTORE_ERROR;
+    }
+
+    seg->index = (char*)malloc(index_len ? index_len : 1);
+    if (!seg->index || read_at(fd, seg->index, index_len, index_off) != KVSTORE_OK ||
+        kvstore_crc32c(0, seg->index, index_len) != index_crc ||
+        seg_parse(seg, index_len) != KVSTORE_OK) {
+        seg_free(seg);
+        return KVSTORE_ERROR;
+    }
+    seg->bytes = (uint64_t)st.st_size;
+    if (!direct) {
+        seg->verified = (atomic_uint_least64_t*)calloc(seg->npages / 64 + 1,
+                                                       sizeof(atomic_uint_least64_t));
+        if (!seg->verified) {
+            seg_free(seg);
+            return KVSTORE_ERROR;
+        }
+    }
+
+    // The footer and index came through the page cache: drop them from it
+    if (direct) {
+        int dfd = open(path, O_RDONLY | O_DIRECT);
+        if (dfd < 0) {
+            seg_free(seg);
+            return KVSTORE_ERROR;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+        seg->fd = dfd;
+    }
+    *out = seg;
+    return KVSTORE_OK;
+}
+
+static const seg_table_t* seg_table(const seg_t *seg, const char *name) {
+    if (!seg) return NULL;
+    size_t lo = 0, hi = seg->ntables;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(seg->tables[mid].name, name);
+        if (cmp == 0) return &seg->tables[mid];
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+// The table's last page whose first key is <= key, or SIZE_MAX if key comes
+// before them all
+static size_t seg_page_for(const seg_t *seg, const seg_table_t *t, const kvstore_val_t *key) {
+    size_t lo = t->first_page, hi = t->first_page + t->npages;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const seg_page_t *pg = &seg->pages[mid];
+        if (key_cmp(pg->first, pg->first_len, key->data, key->size) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo == t->first_page ? SIZE_MAX : lo - 1;
+}
+
+// Block cache id of page idx
+static uint64_t page_id(const seg_t *seg, size_t idx) {
+    return seg->cache_base + idx;
+}
+
+static void gen_free(file_gen_t *gen) {
+    if (!gen) return;
+    if (gen->mem) kvstore_close(gen->mem);
+    seg_free(gen->seg);
+    free(gen);
+}
+
+static file_gen_t* gen_pin(file_db_t *fdb) {
+    pthread_mutex_lock(&fdb->gen_lock);
+    file_gen_t *gen = fdb->gen;
+    gen->refs++;
+    pthread_mutex_unlock(&fdb->gen_lock);
+    return gen;
+}
+
+static void gen_unpin(file_db_t *fdb, file_gen_t *gen) {
+    pthread_mutex_lock(&fdb->gen_lock);
+    bool last = --gen->refs == 0;
+    pthread_mutex_unlock(&fdb->gen_lock);
+    if (last) gen_free(gen);
+}
+
+// Buffers to read the data file into: aligned ones, from the block cache's
+// pool, for direct I/O
+static void* io_buf_get(file_db_t *fdb, size_t len) {
+    return fdb->cache ? kvstore_cache_buf_get(fdb->cache, len) : malloc(len);
+}
+
+static void io_buf_put(file_db_t *fdb, void *buf, size_t len) {
+    if (fdb->cache) kvstore_cache_buf_put(fdb->cache, buf, len);
+    else free(buf);
+}
+
+// A compressed page on disk is a header like a page's (u32 bytes used of
+// the page, u32 compressed length, u32 CRC-32C), then the page's used
+// bytes compressed. Decompress it into page, with room for pg->len bytes.
+static int page_inflate(const seg_page_t *pg, const char *disk, char *page) {
+    const char *p = disk;
+    uint32_t used, clen;
+    SER_READ_U32(p, used);
+    SER_READ_U32(p, clen);
+    if (used < FILE_PAGE_HDR || used > pg->len || (uint64_t)FILE_PAGE_HDR + clen != pg->disk_len ||
+        kvstore_lz_decompress(disk + FILE_PAGE_HDR, clen, page, used) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+    memset(page + used, 0, pg->len - used);
+    return KVSTORE_OK;
+}
+
+// Check page idx, just read from the data file into disk, and put it in
+// page, with room for its length: decompressed, or copied unless page is
+// disk. Its checksum, of the bytes on disk, is verified the first time it
+// is loaded into a cache. With direct I/O that is the block cache, and
+// pages are verified on their way in. Otherwise it is the page cache:
+// pages are verified on their first read since the file was opened, and a
+// bit per page remembers it.
+static int page_load(file_db_t *fdb, const seg_t *seg, size_t idx,
+                     const char *disk, char *page, uint32_t *count) {
+    const seg_page_t *pg = &seg->pages[idx];
+    uint64_t bit = 1ull << (idx % 64);
+    if (fdb->verify && !(seg->verified &&
+                         (atomic_load_explicit(&seg->verified[idx / 64], memory_order_relaxed) & bit))) {
+        if (!page_crc_ok(disk, pg->disk_len)) {
+            atomic_fetch_add(&fdb->checksum_errors, 1);
+            return KVSTORE_ERROR;
+        }
+        atomic_fetch_add(&fdb->pages_verified, 1);
+        if (seg->verified) atomic_fetch_or(&seg->verified[idx / 64], bit);
+    }
+    if (pg->codec != KVSTORE_CODEC_NONE) {
+        if (page_inflate(pg, disk, page) != KVSTORE_OK) return KVSTORE_ERROR;
+    } else if (page != disk) {
+        memcpy(page, disk, pg->len);
+    }
+    return page_check(page, pg->len, count);
+}
+
+// The bytes to read for a page: its own, or with direct I/O the blocks
+// they lie in. Sets *off to where to read from, and returns the length.
+static size_t page_span(const file_db_t *fdb, const seg_page_t *pg, uint64_t *off) {
+    if (!fdb->cache) {
+        *off = pg->off;
+        return pg->disk_len;
+    }
+    *off = pg->off / FILE_PAGE_SIZE * FILE_PAGE_SIZE;
+    uint64_t end = (pg->off + pg->disk_len + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE * FILE_PAGE_SIZE;
+    return (size_t)(end - *off);
+}
+
+// Read page idx into *buf, growing it as needed, and check it. With direct
+// I/O the block cache is tried first, and a page read is checked before it
+// goes in; hot marks it recently used, which a scan passing through
+// shouldn't.
+static int seg_read_page(file_db_t *fdb, const seg_t *seg, size_t idx, bool hot,
+                         char **buf, size_t *cap, uint32_t *count) {
+    const seg_page_t *pg = &seg->pages[idx];
+    if (*cap < pg->len) {
+        char *b = (char*)realloc(*buf, pg->len);
+        if (!b) return KVSTORE_ERROR;
+        *buf = b;
+        *cap = pg->len;
+    }
+    if (fdb->cache && kvstore_cache_get(fdb->cache, page_id(seg, idx), *buf, pg->len, hot) == pg->len) {
+        return page_check(*buf, pg->len, count);
+    }
+
+    // A page stored as is, read without direct I/O, goes straight to *buf
+    uint64_t off;
+    size_t span = page_span(fdb, pg, &off);
+    bool in_place = !fdb->cache && pg->codec == KVSTORE_CODEC_NONE;
+    char *io = in_place ? *buf : (char*)io_buf_get(fdb, span);
+    if (!io) return KVSTORE_ERROR;
+    int rc = read_at(seg->fd, io, span, off);
+    if (rc == KVSTORE_OK) {
+        atomic_fetch_add(&fdb->page_reads, 1);
+        rc = page_load(fdb, seg, idx, io + (pg->off - off), *buf, count);
+    }
+    if (rc == KVSTORE_OK && fdb->cache) {
+        kvstore_cache_put(fdb->cache, page_id(seg, idx), *buf, pg->len, hot);
+    }
+    if (!in_place) io_buf_put(fdb, io, span);
+    return rc;
+}
+
+// ------------------------
+// Transaction values
+// ------------------------
+
+static void* arena_copy(file_txn_t *ftxn, const void *data, size_t len) {
+    file_chunk_t *c = ftxn->arena;
+    if (!c || c->cap - c->used < len) {
+        size_t cap = len > FILE_ARENA_CHUNK ? len : FILE_ARENA_CHUNK;
+        c = (file_chunk_t*)malloc(sizeof(file_chunk_t) + cap);
+        if (!c) return NULL;
+        c->next = ftxn->arena;
+        c->used = 0;
+        c->cap = cap;
+        ftxn->arena = c;
+    }
+    void *p = c->data + c->used;
+    memcpy(p, data, len);
+    c->used += len;
+    return p;
+}
+
+// Strip a memtable value's tag: KVSTORE_NOTFOUND for a tombstone
+static int mem_value(const kvstore_val_t *tagged, kvstore_val_t *val_out) {
+    if (tagged->size == 0) return KVSTORE_ERROR;
+    if (((const uint8_t*)tagged->data)[0] == FILE_TAG_TOMBSTONE) return KVSTORE_NOTFOUND;
+    if (val_out) {
+        val_out->data = (char*)tagged->data + 1;
+        val_out->size = tagged->size - 1;
+    }
+    return KVSTORE_OK;
+}
+
+// Find key on a checked page, copying its value out (val_out may be NULL)
+static int page_lookup(file_txn_t *ftxn, const char *page, uint32_t count,
+                       const kvstore_val_t *key, kvstore_val_t *val_out) {
+    uint32_t idx;
+    kvstore_val_t k, v;
+    if (page_seek(page, count, key, &idx) != KVSTORE_OK) return KVSTORE_ERROR;
+    if (idx == count) return KVSTORE_NOTFOUND;
+    if (page_entry(page, idx, &k, &v) != KVSTORE_OK) return KVSTORE_ERROR;
+    if (key_cmp(k.data, k.size, key->data, key->size) != 0) return KVSTORE_NOTFOUND;
+
+    if (val_out) {
+        val_out->data = v.size ? arena_copy(ftxn, v.data, v.size) : (void*)"";
+        if (!val_out->data) return KVSTORE_ERROR;
+        val_out->size = v.size;
+    }
+    return KVSTORE_OK;
+}
+
+// Look key up in the data file, reading its page on this thread
+static int seg_get(file_db_t *fdb, file_txn_t *ftxn, const char *table,
+                   const kvstore_val_t *key, kvstore_val_t *val_out) {
+    const seg_t *seg = ftxn->gen->seg;
+    const seg_table_t *t = seg_table(seg, table);
+    size_t idx = t ? seg_page_for(seg, t, key) : SIZE_MAX;
+    if (idx == SIZE_MAX) return KVSTORE_NOTFOUND;
+
+    uint32_t count;
+    if (seg_read_page(fdb, seg, idx, true, &ftxn->page, &ftxn->page_cap, &count) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+    return page_lookup(ftxn, ftxn->page, count, key, val_out);
+}
+
+// Note a table written since the checkpoint, which must visit it
+static int note_table(file_db_t *fdb, const char *table) {
+    int rc = KVSTORE_OK;
+    pthread_mutex_lock(&fdb->tables_lock);
+    size_t lo = 0, hi = fdb->ntables;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(fdb->tables[mid], table);
+        if (cmp == 0) {
+            pthread_mutex_unlock(&fdb->tables_lock);
+            return KVSTORE_OK;
+        }
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (fdb->ntables == fdb->tables_cap) {
+        size_t cap = fdb->tables_cap ? fdb->tables_cap * 2 : 16;
+        char **tables = (char**)realloc(fdb->tables, cap * sizeof(char*));
+        if (!tables) rc = KVSTORE_ERROR;
+        else {
+            fdb->tables = tables;
+            fdb->tables_cap = cap;
+        }
+    }
+    char *name = rc == KVSTORE_OK ? strdup(table) : NULL;
+    if (name) {
+        memmove(&fdb->tables[lo + 1], &fdb->tables[lo], (fdb->ntables - lo) * sizeof(char*));
+        fdb->tables[lo] = name;
+        fdb->ntables++;
+    } else {
+        rc = KVSTORE_ERROR;
+    }
+    pthread_mutex_unlock(&fdb->tables_lock);
+    return rc;
+}
+
+// ------------------------
+// Cursors
+// ------------------------
+
+static int scur_entry(file_cursor_t *fc) {
+    return page_entry(fc->buf, fc->idx, &fc->seg_key, &fc->seg_val);
+}
+
+// Put the pages of completed reads ahead in the block cache, waiting for
+// min reads to complete
+static int ahead_reap(file_cursor_t *fc, size_t min) {
+    file_db_t *fdb = fc->fdb;
+    size_t n;
+    do {
+        kvstore_aio_req_t *done[FILE_POLL_BATCH];
+        if (kvstore_aio_wait(fc->queue, min, done, FILE_POLL_BATCH, &n) != KVSTORE_OK) {
+            return KVSTORE_ERROR;
+        }
+        for (size_t i = 0; i < n; i++) {
+            file_extent_t *e = (file_extent_t*)done[i]->arg;
+            file_extent_t **p = &fc->extents;
+            while (*p != e) p = &(*p)->next;
+            *p = e->next;
+
+            // A page that fails its check is left out, to fail when read
+            for (size_t pi = 0; done[i]->res == (ssize_t)done[i]->len && pi < e->npages; pi++) {
+                const seg_page_t *pg = &fc->seg->pages[e->page + pi];
+                char *disk = (char*)e->req.buf + (pg->off - e->req.off);
+                char *page = pg->codec == KVSTORE_CODEC_NONE ? disk : (char*)io_buf_get(fdb, pg->len);
+                uint32_t count;
+                if (page && page_load(fdb, fc->seg, e->page + pi, disk, page, &count) == KVSTORE_OK) {
+                    kvstore_cache_put(fdb->cache, page_id(fc->seg, e->page + pi), page, pg->len, false);
+                }
+                if (page && page != disk) io_buf_put(fdb, page, pg->len);
+            }
+            io_buf_put(fdb, e->req.buf, e->req.len);
+            free(e);
+        }
+        min = min > n ? min - n : 0;
+    } while (n == FILE_POLL_BATCH || (min > 0 && n > 0));
+    return KVSTORE_OK;
+}
+
+// Wait for any read ahead of page to complete
+static int ahead_await(file_cursor_t *fc, size_t page) {
+    if (!fc->queue) return KVSTORE_OK;
+    if (ahead_reap(fc, 0) != KVSTORE_OK) return KVSTORE_ERROR;
+    for (;;) {
+        const file_extent_t *e = fc->extents;
+        while (e && (page < e->page || page >= e->page + e->npages)) e = e->next;
+        if (!e) return KVSTORE_OK;
+        if (ahead_reap(fc, 1) != KVSTORE_OK) return KVSTORE_ERROR;
+    }
+}
+
+// Direct I/O: read pages [from, to) that aren't cached yet, adjacent ones
+// together. A failure only loses the read ahead.
+static void ahead_direct(file_cursor_t *fc, size_t from, size_t to) {
+    file_db_t *fdb = fc->fdb;
+    if (!fc->queue && !(fc->queue = kvstore_aio_queue_get(fdb->aio))) return;
+
+    size_t p = from;
+    while (p < to) {
+        if (kvstore_cache_contains(fdb->cache, page_id(fc->seg, p))) {
+            p++;
+            continue;
+        }
+        // The blocks the pages lie in: compressed pages share them
+        const seg_page_t *first = &fc->seg->pages[p];
+        uint64_t off;
+        size_t n = 1, len = page_span(fdb, first, &off);
+        while (p + n < to && !kvstore_cache_contains(fdb->cache, page_id(fc->seg, p + n))) {
+            uint64_t next_off;
+            size_t next_len = page_span(fdb, &fc->seg->pages[p + n], &next_off);
+            if (next_off + next_len - off > FILE_EXTENT) break;
+            len = (size_t)(next_off + next_len - off);
+            n++;
+        }
+
+        file_extent_t *e = (file_extent_t*)calloc(1, sizeof(file_extent_t));
+        void *buf = e ? io_buf_get(fdb, len) : NULL;
+        if (!buf) {
+            free(e);
+            return;
+        }
+        e->req.fd = fc->seg->fd;
+        e->req.buf = buf;
+        e->req.len = len;
+        e->req.off = off;
+        e->req.arg = e;
+        e->page = p;
+        e->npages = n;
+        if (kvstore_aio_submit(fc->queue, &e->req) != KVSTORE_OK) {
+            io_buf_put(fdb, buf, len);
+            free(e);
+            return;
+        }
+        e->next = fc->extents;
+        fc->extents = e;
+        atomic_fetch_add(&fdb->page_reads, n);
+        atomic_fetch_add(&fdb->readahead_pages, n);
+        p += n;
+    }
+
+    // Start them now rather than when the cursor next needs one
+    ahead_reap(fc, 0);
+}
+
+// Keep the window the cursor's run of pages has earned read ahead, topping
+// it up once half of it has been used, so each hint covers many pages. A
+// cursor that moved on only once may have been seeking, so it waits for a
+// second page before reading ahead.
+static void scur_ahead(file_cursor_t *fc) {
+    file_db_t *fdb = fc->fdb;
+    if (fdb->readahead == 0 || fc->run < 2) return;
+
+    size_t window = fc->run > 16 ? fdb->readahead : (size_t)1 << (fc->run - 1);
+    if (window > fdb->readahead) window = fdb->readahead;
+    size_t from = fc->ahead > fc->page + 1 ? fc->ahead : fc->page + 1;
+    size_t to = fc->page + 1 + window;
+    if (to > fc->end_page) to = fc->end_page;
+    if (from >= to || (from > fc->page + 1 && to - from < window / 2)) return;
+
+    fc->ahead = to;
+    if (fdb->cache) {
+        ahead_direct(fc, from, to);
+        return;
+    }
+
+    // A table's pages are adjacent in the file
+    const seg_page_t *first = &fc->seg->pages[from], *last = &fc->seg->pages[to - 1];
+    posix_fadvise(fc->seg->fd, (off_t)first->off, (off_t)(last->off + last->disk_len - first->off),
+                  POSIX_FADV_WILLNEED);
+    atomic_fetch_add(&fdb->readahead_pages, to - from);
+}
+
+static int scur_load(file_cursor_t *fc, size_t page) {
+    fc->page = page;
+    fc->idx = 0;
+    scur_ahead(fc);
+    if (ahead_await(fc, page) != KVSTORE_OK ||
+        seg_read_page(fc->fdb, fc->seg, page, false, &fc->buf, &fc->cap, &fc->count) != KVSTORE_OK ||
+        fc->count == 0) {
+        fc->seg_valid = false;
+        return KVSTORE_ERROR;
+    }
+    fc->seg_valid = true;
+    return scur_entry(fc);
+}
+
+static int scur_next(file_cursor_t *fc) {
+    if (!fc->seg_valid) return KVSTORE_OK;
+    if (++fc->idx < fc->count) return scur_entry(fc);
+
+    if (fc->page + 1 < fc->end_page) {
+        fc->run++;
+        return scur_load(fc, fc->page + 1);
+    }
+    fc->seg_valid = false;
+    fc->at_end = fc->page + 1 < fc->table->first_page + fc->table->npages;
+    return KVSTORE_OK;
+}
+
+static int scur_seek(file_cursor_t *fc, const kvstore_val_t *start) {
+    fc->seg_valid = false;
+    fc->run = 0;
+    if (!fc->table || fc->table->npages == 0) return KVSTORE_OK;
+
+    size_t page = start ? seg_page_for(fc->seg, fc->table, start) : SIZE_MAX;
+    if (page == SIZE_MAX) return scur_load(fc, fc->table->first_page);
+
+    int rc = scur_load(fc, page);
+    if (rc != KVSTORE_OK) return rc;
+    if (page_seek(fc->buf, fc->count, start, &fc->idx) != KVSTORE_OK) return KVSTORE_ERROR;
+    if (fc->idx < fc->count) return scur_entry(fc);
+
+    // Every key on the page is smaller: the next page starts above start
+    fc->idx = fc->count - 1;
+    return scur_next(fc);
+}
+
+// Move to the smaller of the two cursors' keys, skipping tombstones
+static int fcur_settle(file_cursor_t *fc) {
+    for (;;) {
+        kvstore_val_t mk, mv;
+        bool mem_valid = fc->mem && kvstore_cursor_get(fc->mem, &mk, &mv) == KVSTORE_OK;
+        if (!mem_valid && !fc->seg_valid) {
+            fc->valid = false;
+            return KVSTORE_OK;
+        }
+
+        int cmp = !mem_valid ? 1 : !fc->seg_valid ? -1
+                : key_cmp(mk.data, mk.size, fc->seg_key.data, fc->seg_key.size);
+        if (cmp > 0) {
+            fc->from_mem = false;
+            fc->valid = true;
+            return KVSTORE_OK;
+        }
+
+        if (cmp == 0 && scur_next(fc) != KVSTORE_OK) return KVSTORE_ERROR;
+        int rc = mem_value(&mv, NULL);
+        if (rc == KVSTORE_OK) {
+            fc->from_mem = true;
+            fc->valid = true;
+            return KVSTORE_OK;
+        }
+        if (rc != KVSTORE_NOTFOUND) return rc;
+        kvstore_cursor_next(fc->mem);
+    }
+}
+
+static int fcur_open(file_cursor_t *fc, file_db_t *fdb, const file_gen_t *gen,
+                     kvstore_txn_t *inner, const char *table, const kvstore_val_t *start) {
+    memset(fc, 0, sizeof(*fc));
+    fc->fdb = fdb;
+    fc->seg = gen->seg;
+    fc->table = seg_table(gen->seg, table);
+    if (fc->table) fc->end_page = fc->table->first_page + fc->table->npages;
+    fc->mem = kvstore_cursor_open(inner, table, (kvstore_val_t*)start);
+    if (!fc->mem && !fc->table) return KVSTORE_NOTFOUND;
+
+    if (scur_seek(fc, start) != KVSTORE_OK) return KVSTORE_ERROR;
+    return fcur_settle(fc);
+}
+
+static int fcur_get(file_cursor_t *fc, kvstore_val_t *key_out, kvstore_val_t *val_out) {
+    if (!fc->valid) return KVSTORE_NOTFOUND;
+    if (!fc->from_mem) {
+        if (key_out) *key_out = fc->seg_key;
+        if (val_out) *val_out = fc->seg_val;
+        return KVSTORE_OK;
+    }
+
+    kvstore_val_t mv;
+    int rc = kvstore_cursor_get(fc->mem, key_out, &mv);
+    if (rc != KVSTORE_OK) return rc;
+    return mem_value(&mv, val_out);
+}
+
+static int fcur_next(file_cursor_t *fc) {
+    if (!fc->valid) return KVSTORE_NOTFOUND;
+    if (fc->from_mem) kvstore_cursor_next(fc->mem);
+    else if (scur_next(fc) != KVSTORE_OK) return KVSTORE_ERROR;
+    return fcur_settle(fc);
+}
+
+// Pages holding only keys >= end are left unread, by read ahead or by
+// the walk itself. The memtable's cursor needs no bound: the generic layer
+// hides its keys from end on. A walk the old end stopped goes on if the
+// new one is further.
+static int fcur_bound(file_cursor_t *fc, const kvstore_val_t *end) {
+    if (!fc->table) return KVSTORE_OK;
+    fc->end_page = fc->table->first_page + fc->table->npages;
+    if (end) {
+        size_t p = seg_page_for(fc->seg, fc->table, end);
+        if (p == SIZE_MAX) {
+            fc->end_page = fc->table->first_page;
+        } else {
+            const seg_page_t *pg = &fc->seg->pages[p];
+            fc->end_page = key_cmp(pg->first, pg->first_len, end->data, end->size) == 0 ? p : p + 1;
+        }
+    }
+
+    if (!fc->at_end || fc->page + 1 >= fc->end_page) return KVSTORE_OK;
+    fc->at_end = false;
+    if (scur_load(fc, fc->page + 1) != KVSTORE_OK) return KVSTORE_ERROR;
+    return fcur_settle(fc);
+}
+
+static void fcur_close(file_cursor_t *fc) {
+    if (fc->mem) kvstore_cursor_close(fc->mem);
+    // Reads ahead still in flight land in the cache, unless they fail
+    if (fc->queue) {
+        while (kvstore_aio_pending(fc->queue) > 0 && ahead_reap(fc, 1) == KVSTORE_OK) {}
+        kvstore_aio_queue_put(fc->queue);
+    }
+    while (fc->extents) {
+        file_extent_t *e = fc->extents;
+        fc->extents = e->next;
+        io_buf_put(fc->fdb, e->req.buf, e->req.len);
+        free(e);
+    }
+    fc->queue = NULL;
+    free(fc->buf);
+    fc->mem = NULL;
+    fc->buf = NULL;
+}
+
+// ------------------------
+// Checkpoint
+// ------------------------
+
+// Writes a data file: entries go into the page being built, pages into a
+// buffer flushed in large writes, and their first keys into the index.
+// Pages stored as is start on a block boundary, for direct I/O, and
+// compressed ones are packed end to end.
+typedef struct {
+    int fd;
+    uint64_t off;           // File offset of out
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+    char *entries;          // The page's entries, offsets filled in on close
+    size_t entries_len;
+    size_t entries_cap;
+    uint32_t *offsets;
+    uint32_t count;
+    size_t offsets_cap;
+    kvstore_codec_t codec;  // The table's
+    char *page;             // A page to compress
+    size_t page_cap;
+    char *index;
+    size_t index_len;
+    size_t index_cap;
+    uint32_t ntables;
+    size_t table_at;        // Index position of the table being written
+    uint64_t table_keys;
+    uint32_t table_pages;
+    uint64_t bytes;         // Written so far
+} ckpt_writer_t;
+
+static int grow(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap) return KVSTORE_OK;
+    size_t c = *cap ? *cap : 4096;
+    while (c < need) c *= 2;
+    char *b = (char*)realloc(*buf, c);
+    if (!b) return KVSTORE_ERROR;
+    *buf = b;
+    *cap = c;
+    return KVSTORE_OK;
+}
+
+static int writer_flush(ckpt_writer_t *w) {
+    if (write_all(w->fd, w->out, w->out_len) != KVSTORE_OK) return KVSTORE_ERROR;
+    w->off += w->out_len;
+    w->bytes += w->out_len;
+    w->out_len = 0;
+    return KVSTORE_OK;
+}
+
+// Zeros in out up to the next block boundary
+static size_t writer_pad(const ckpt_writer_t *w) {
+    return (size_t)((FILE_PAGE_SIZE - (w->off + w->out_len) % FILE_PAGE_SIZE) % FILE_PAGE_SIZE);
+}
+
+static int writer_close_page(ckpt_writer_t *w) {
+    if (w->count == 0) return KVSTORE_OK;
+
+    size_t head = FILE_PAGE_HDR + (size_t)w->count * 4;
+    size_t used = head + w->entries_len;
+    size_t len = (used + FILE_PAGE_SIZE - 1) / FILE_PAGE_SIZE * FILE_PAGE_SIZE;
+    size_t pad = writer_pad(w);
+    const char *first = w->entries + FILE_ENTRY_HDR;
+    uint16_t first_len;
+    const char *q = w->entries;
+    SER_READ_U16(q, first_len);
+
+    bool compress = w->codec == KVSTORE_CODEC_LZ;
+    if (grow(&w->out, &w->out_cap, w->out_len + pad + len) != KVSTORE_OK ||
+        grow(&w->index, &w->index_cap, w->index_len + 18 + first_len) != KVSTORE_OK ||
+        (compress && grow(&w->page, &w->page_cap, len) != KVSTORE_OK)) {
+        return KVSTORE_ERROR;
+    }
+
+    // Build the page in place, unless it is to be compressed from a copy
+    char *at = w->out + w->out_len;
+    char *page = compress ? w->page : at + pad, *p = page;
+    SER_WRITE_U32(p, w->count);
+    SER_WRITE_U32(p, used);
+    SER_WRITE_U32(p, 0);
+    for (uint32_t i = 0; i < w->count; i++) SER_WRITE_U32(p, head + w->offsets[i]);
+    memcpy(p, w->entries, w->entries_len);
+    p += w->entries_len;
+    memset(p, 0, len - used);
+
+    // Compressed, it must save an eighth of the page
+    size_t clen = compress ? kvstore_lz_compress(page, used, at + FILE_PAGE_HDR,
+                                                 len - len / 8 - FILE_PAGE_HDR) : 0;
+    size_t disk_len = len;
+    if (clen) {
+        p = at;
+        SER_WRITE_U32(p, used);
+        SER_WRITE_U32(p, clen);
+        disk_len = FILE_PAGE_HDR + clen;
+        pad = 0;
+        page = at;
+    } else {
+        memset(at, 0, pad);
+        if (compress) memcpy(at + pad, page, len);
+        page = at + pad;
+    }
+    p = page + 8;
+    SER_WRITE_U32(p, page_crc(page, disk_len));
+
+    char *ix = w->index + w->index_len;
+    SER_WRITE_U64(ix, w->off + w->out_len + pad);
+    SER_WRITE_U32(ix, len);
+    SER_WRITE_U32(ix, disk_len);
+    SER_WRITE_U16(ix, first_len);
+    memcpy(ix, first, first_len);
+    w->index_len += 18 + first_len;
+
+    w->out_len += pad + disk_len;
+    w->table_pages++;
+    w->count = 0;
+    w->entries_len = 0;
+    return w->out_len >= FILE_WRITE_CHUNK ? writer_flush(w) : KVSTORE_OK;
+}
+
+static int writer_add(ckpt_writer_t *w, const kvstore_val_t *key, const kvstore_val_t *val) {
+    size_t entry = FILE_ENTRY_HDR + key->size + val->size;
+    if (w->count > 0 &&
+        FILE_PAGE_HDR + ((size_t)w->count + 1) * 4 + w->entries_len + entry > FILE_PAGE_SIZE &&
+        writer_close_page(w) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+
+    if (w->count == w->offsets_cap) {
+        size_t cap = w->offsets_cap ? w->offsets_cap * 2 : 128;
+        uint32_t *offsets = (uint32_t*)realloc(w->offsets, cap * sizeof(uint32_t));
+        if (!offsets) return KVSTORE_ERROR;
+        w->offsets = offsets;
+        w->offsets_cap = cap;
+    }
+    if (grow(&w->entries, &w->entries_cap, w->entries_len + entry) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+
+    w->offsets[w->count++] = (uint32_t)w->entries_len;
+    char *p = w->entries + w->entries_len;
+    SER_WRITE_U16(p, key->size);
+    SER_WRITE_U32(p, val->size);
+    memcpy(p, key->data, key->size);
+    p += key->size;
+    if (val->size) memcpy(p, val->data, val->size);
+    w->entries_len += entry;
+    w->table_keys++;
+    return KVSTORE_OK;
+}
+
+static int writer_begin_table(ckpt_writer_t *w, const char *name, kvstore_codec_t codec) {
+    size_t name_len = strlen(name);
+    if (grow(&w->index, &w->index_cap, w->index_len + 2 + name_len + 1 + 1 + 12) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+    w->table_at = w->index_len;
+    char *p = w->index + w->index_len;
+    SER_WRITE_U16(p, name_len);
+    memcpy(p, name, name_len + 1);
+    p += name_len + 1;
+    SER_WRITE_U8(p, codec);
+    w->index_len += 2 + name_len + 1 + 1 + 12;  // Counts filled in at the end
+    w->codec = codec;
+    w->table_keys = 0;
+    w->table_pages = 0;
+    return KVSTORE_OK;
+}
+
+static int writer_end_table(ckpt_writer_t *w) {
+    if (writer_close_page(w) != KVSTORE_OK) return KVSTORE_ERROR;
+    if (w->table_keys == 0) {
+        w->index_len = w->table_at;
+        return KVSTORE_OK;
+    }
+
+    char *p = w->index + w->table_at;
+    uint16_t name_len;
+    SER_READ_U16(p, name_len);
+    p += name_len + 1 + 1;
+    SER_WRITE_U64(p, w->table_keys);
+    SER_WRITE_U32(p, w->table_pages);
+    w->ntables++;
+    return KVSTORE_OK;
+}
+
+static int writer_finish(ckpt_writer_t *w, uint64_t seq) {
+    char *p = w->index;
+    SER_WRITE_U32(p, w->ntables);
+
+    // The index starts on a block boundary, so direct reads of the blocks a
+    // compressed page lies in stay within the file
+    size_t pad = writer_pad(w);
+    if (grow(&w->out, &w->out_cap, w->out_len + pad + w->index_len + FILE_FOOTER) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+    memset(w->out + w->out_len, 0, pad);
+    w->out_len += pad;
+    uint64_t index_off = w->off + w->out_len;
+    memcpy(w->out + w->out_len, w->index, w->index_len);
+    w->out_len += w->index_len;
+    char *footer = w->out + w->out_len;
+    p = footer;
+    SER_WRITE_U64(p, index_off);
+    SER_WRITE_U64(p, w->index_len);
+    SER_WRITE_U64(p, seq);
+    SER_WRITE_U32(p, kvstore_crc32c(0, w->index, w->index_len));
+    SER_WRITE_U32(p, kvstore_crc32c(0, footer, 28));
+    SER_WRITE_U64(p, FILE_MAGIC);
+    w->out_len += FILE_FOOTER;
+    return writer_flush(w);
+}
+
+// The codec a table's pages are written with
+static kvstore_codec_t table_codec(const file_db_t *fdb, const char *table) {
+    kvstore_codec_t codec = fdb->table_codec ? fdb->table_codec(table, fdb->table_codec_arg)
+                                             : fdb->codec;
+    return codec == KVSTORE_CODEC_LZ ? codec : KVSTORE_CODEC_NONE;
+}
+
+// Merge table into the writer: the data file's keys overlaid with the
+// memtable's
+static int ckpt_table(file_db_t *fdb, kvstore_txn_t *inner, ckpt_writer_t *w, const char *table) {
+    if (writer_begin_table(w, table, table_codec(fdb, table)) != KVSTORE_OK) return KVSTORE_ERROR;
+
+    file_cursor_t fc;
+    int rc = fcur_open(&fc, fdb, fdb->gen, inner, table, NULL);
+    if (rc == KVSTORE_NOTFOUND) rc = KVSTORE_OK;
+    while (rc == KVSTORE_OK && fc.valid) {
+        kvstore_val_t k, v;
+        rc = fcur_get(&fc, &k, &v);
+        if (rc == KVSTORE_OK) rc = writer_add(w, &k, &v);
+        if (rc == KVSTORE_OK) rc = fcur_next(&fc);
+    }
+    fcur_close(&fc);
+    return rc == KVSTORE_OK ? writer_end_table(w) : KVSTORE_ERROR;
+}
+
+static int sync_dir(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return KVSTORE_ERROR;
+    int rc = fsync(fd) == 0 ? KVSTORE_OK : KVSTORE_ERROR;
+    close(fd);
+    return rc;
+}
+
+// Write the data file and the memtable, through seq, into a new data file,
+// switch to a generation of it with an empty memtable, and empty the log.
+// A crash before the log is emptied replays it over the new file, which is
+// harmless: every write in it is in the file already. Call with commit_lock
+// held.
+static int checkpoint_write(file_db_t *fdb, uint64_t seq, char **tables, size_t ntables) {
+    if (log_flush(fdb, seq, true) != KVSTORE_OK) return KVSTORE_ERROR;
+
+    char data[PATH_MAX], tmp[PATH_MAX];
+    snprintf(data, sizeof(data), "%s/data", fdb->path);
+    snprintf(tmp, sizeof(tmp), "%s/data.tmp", fdb->path);
+
+    ckpt_writer_t w;
+    memset(&w, 0, sizeof(w));
+    w.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    kvstore_txn_t *inner = kvstore_txn_begin(fdb->gen->mem, true);
+    int rc = w.fd >= 0 && inner ? KVSTORE_OK : KVSTORE_ERROR;
+    w.index_len = 4;    // Table count, filled in at the end
+    if (rc == KVSTORE_OK) rc = grow(&w.index, &w.index_cap, w.index_len);
+
+    // Tables from both, in name order
+    const seg_t *seg = fdb->gen->seg;
+    size_t i = 0, j = 0, nseg = seg ? seg->ntables : 0;
+    while (rc == KVSTORE_OK && (i < nseg || j < ntables)) {
+        int cmp = i == nseg ? 1 : j == ntables ? -1 : strcmp(seg->tables[i].name, tables[j]);
+        const char *name = cmp <= 0 ? seg->tables[i].name : tables[j];
+        rc = ckpt_table(fdb, inner, &w, name);
+        if (cmp <= 0) i++;
+        if (cmp >= 0) j++;
+    }
+    if (inner) kvstore_txn_abort(inner);
+
+    if (rc == KVSTORE_OK) rc = writer_finish(&w, seq);
+    if (rc == KVSTORE_OK && fdatasync(w.fd) != 0) rc = KVSTORE_ERROR;
+    // Direct I/O: the pages just written are clean, and not to be cached twice
+    if (rc == KVSTORE_OK && fdb->cache) posix_fadvise(w.fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (w.fd >= 0 && close(w.fd) != 0) rc = KVSTORE_ERROR;
+    free(w.out);
+    free(w.entries);
+    free(w.offsets);
+    free(w.page);
+    free(w.index);
+
+    seg_t *next = NULL;
+    if (rc == KVSTORE_OK && (rename(tmp, data) != 0 || sync_dir(fdb->path) != KVSTORE_OK)) {
+        rc = KVSTORE_ERROR;
+    }
+    if (rc != KVSTORE_OK) {
+        unlink(tmp);
+        return rc;
+    }
+
+    // The new file is in place: from here on failures can't go back
+    file_gen_t *old = fdb->gen, *gen = (file_gen_t*)calloc(1, sizeof(file_gen_t));
+    if (gen) gen->mem = kvstore_open_mem();
+    if (seg_load(data, fdb->cache != NULL, &next) != KVSTORE_OK || !next || !gen || !gen->mem) {
+        gen_free(gen);
+        seg_free(next);
+        fdb->failed = true;
+        return KVSTORE_ERROR;
+    }
+    next->cache_base = old->seg ? old->seg->cache_base + old->seg->npages : 0;
+    gen->seg = next;
+    gen->refs = 1;
+    old->last_seq = seq;
+    pthread_mutex_lock(&fdb->gen_lock);
+    fdb->gen = gen;
+    pthread_mutex_unlock(&fdb->gen_lock);
+    gen_unpin(fdb, old);
+    if (fdb->cache) kvstore_cache_clear(fdb->cache);
+
+    pthread_mutex_lock(&fdb->log_lock);
+    if (ftruncate(fdb->fd, 0) != 0 || fdatasync(fdb->fd) != 0) {
+        fdb->failed = true;
+        rc = KVSTORE_ERROR;
+    } else {
+        fdb->log_bytes = 0;
+    }
+    fdb->checkpoints++;
+    fdb->data_bytes = next->bytes;
+    fdb->page_bytes = next->page_bytes;
+    fdb->compressed_pages = next->compressed;
+    fdb->data_written += w.bytes;
+    pthread_mutex_unlock(&fdb->log_lock);
+    return rc;
+}
+
+// Holding commit_lock keeps the memtable as it is while it's written out.
+// Commits wait meanwhile, so none go unsynced while the flusher is busy
+// here; transactions carry on with everything else.
+static int checkpoint(file_db_t *fdb) {
+    pthread_mutex_lock(&fdb->commit_lock);
+    pthread_mutex_lock(&fdb->log_lock);
+    uint64_t seq = fdb->seq;
+    pthread_mutex_unlock(&fdb->log_lock);
+
+    // Take the tables written since the last checkpoint: any noted from here
+    // on are by transactions that can't commit to this memtable
+    pthread_mutex_lock(&fdb->tables_lock);
+    char **tables = fdb->tables;
+    size_t ntables = fdb->ntables;
+    fdb->tables = NULL;
+    fdb->ntables = fdb->tables_cap = 0;
+    pthread_mutex_unlock(&fdb->tables_lock);
+
+    int rc = ntables ? checkpoint_write(fdb, seq, tables, ntables) : KVSTORE_OK;
+    for (size_t t = 0; t < ntables; t++) {
+        // A checkpoint that failed still needs them next time
+        if (rc != KVSTORE_OK && note_table(fdb, tables[t]) != KVSTORE_OK) fdb->failed = true;
+        free(tables[t]);
+    }
+    free(tables);
+    pthread_mutex_unlock(&fdb->commit_lock);
+    return rc;
+}
+
+// ------------------------
+// Verification
+// ------------------------
+
+typedef struct {
+    const seg_t *seg;
+    atomic_size_t next;     // First page of the next chunk to take
+    pthread_mutex_t lock;
+    kvstore_file_verify_t *out;
+} verify_job_t;
+
+// Page idx, read into disk, has its checksum, decompresses (into *buf) if
+// compressed, and has a sound header and the first key the index has for it
+static bool verify_page(const seg_t *seg, size_t idx, char *disk, char **buf, size_t *cap) {
+    const seg_page_t *pg = &seg->pages[idx];
+    char *page = disk;
+    uint32_t count;
+    kvstore_val_t key;
+    if (!page_crc_ok(disk, pg->disk_len)) return false;
+    if (pg->codec != KVSTORE_CODEC_NONE) {
+        if (grow(buf, cap, pg->len) != KVSTORE_OK || page_inflate(pg, disk, *buf) != KVSTORE_OK) {
+            return false;
+        }
+        page = *buf;
+    }
+    return page_check(page, pg->len, &count) == KVSTORE_OK &&
+           count > 0 && page_entry(page, 0, &key, NULL) == KVSTORE_OK &&
+           key.size == pg->first_len && memcmp(key.data, pg->first, key.size) == 0;
+}
+
+// Take chunks of adjacent pages, read each in one go, and check its pages.
+// The chunks are dropped from the page cache after, as a store wouldn't
+// want them there.
+static void* verify_worker(void *arg) {
+    verify_job_t *job = (verify_job_t*)arg;
+    const seg_t *seg = job->seg;
+    char *buf = NULL, *page = NULL;
+    size_t cap = 0, page_cap = 0;
+    uint64_t bad = 0, first_bad = UINT64_MAX;
+
+    for (;;) {
+        size_t from = atomic_fetch_add(&job->next, FILE_VERIFY_CHUNK);
+        if (from >= seg->npages) break;
+        size_t to = from + FILE_VERIFY_CHUNK < seg->npages ? from + FILE_VERIFY_CHUNK : seg->npages;
+        uint64_t off = seg->pages[from].off;
+        size_t len = (size_t)(seg->pages[to - 1].off + seg->pages[to - 1].disk_len - off);
+        bool read = grow(&buf, &cap, len) == KVSTORE_OK &&
+                    read_at(seg->fd, buf, len, off) == KVSTORE_OK;
+        posix_fadvise(seg->fd, (off_t)off, (off_t)len, POSIX_FADV_DONTNEED);
+
+        for (size_t i = from; i < to; i++) {
+            if (read && verify_page(seg, i, buf + (seg->pages[i].off - off), &page, &page_cap)) continue;
+            bad++;
+            if (seg->pages[i].off < first_bad) first_bad = seg->pages[i].off;
+        }
+    }
+    free(buf);
+    free(page);
+
+    pthread_mutex_lock(&job->lock);
+    job->out->bad_pages += bad;
+    if (first_bad < job->out->first_bad) job->out->first_bad = first_bad;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+// ------------------------
+// Opening
+// ------------------------
+
+// Cut off a torn frame at the end of the log, then replay it through db
+// into the memtable. Frames the data file already has replay harmlessly.
+static int log_replay(kvstore_t *db, file_db_t *fdb) {
+    struct stat st;
+    if (fstat(fdb->fd, &st) != 0) return KVSTORE_ERROR;
+
+    off_t end = 0;
+    char hdr[4];
+    while (end + KVSTORE_REPL_FRAME_HDR <= st.st_size &&
+           pread(fdb->fd, hdr, sizeof(hdr), end) == (ssize_t)sizeof(hdr)) {
+        const char *p = hdr;
+        uint32_t frame_len;
+        SER_READ_U32(p, frame_len);
+        if (frame_len < KVSTORE_REPL_FRAME_HDR - 4 || end + 4 + (off_t)frame_len > st.st_size) break;
+        end += 4 + (off_t)frame_len;
+    }
+    if (end < st.st_size && ftruncate(fdb->fd, end) != 0) return KVSTORE_ERROR;
+    fdb->log_bytes = (uint64_t)end;
+    if (end == 0) return KVSTORE_OK;
+
+    if (lseek(fdb->fd, 0, SEEK_SET) != 0) return KVSTORE_ERROR;
+    kvstore_repl_follower_t *f = kvstore_repl_follower_new(db, fdb->fd, 0);
+    if (!f) return KVSTORE_ERROR;
+    fdb->replaying = true;
+    int rc = kvstore_repl_follower_run(f);
+    fdb->replaying = false;
+    kvstore_repl_stats_t stats;
+    kvstore_repl_follower_stats(f, &stats);
+    kvstore_repl_follower_free(f);
+
+    if (stats.applied_seq > fdb->seq) {
+        fdb->seq = fdb->written_seq = fdb->durable_seq = stats.applied_seq;
+    }
+    return rc;
+}
+
+// ------------------------
+// Backend operations
+// ------------------------
+
+static void file_free(file_db_t *fdb) {
+    gen_free(fdb->gen);
+    if (fdb->fd >= 0) close(fdb->fd);
+    kvstore_aio_free(fdb->aio);
+    kvstore_cache_free(fdb->cache);
+    pthread_mutex_destroy(&fdb->commit_lock);
+    pthread_mutex_destroy(&fdb->log_lock);
+    pthread_cond_destroy(&fdb->log_cond);
+    pthread_cond_destroy(&fdb->flusher_cond);
+    pthread_mutex_destroy(&fdb->gen_lock);
+    pthread_mutex_destroy(&fdb->tables_lock);
+    for (size_t i = 0; i < fdb->ntables; i++) free(fdb->tables[i]);
+    free(fdb->tables);
+    free(fdb->buf);
+    free(fdb->spare);
+    free(fdb->path);
+    free(fdb);
+}
+
+static int file_start(kvstore_t *db, const char *path, const kvstore_file_opts_t *opts) {
+    file_db_t *fdb = (file_db_t*)calloc(1, sizeof(file_db_t));
+    if (!fdb) return KVSTORE_ERROR;
+    fdb->fd = -1;
+    pthread_mutex_init(&fdb->commit_lock, NULL);
+    pthread_mutex_init(&fdb->log_lock, NULL);
+    pthread_cond_init(&fdb->log_cond, NULL);
+    pthread_cond_init(&fdb->flusher_cond, NULL);
+    pthread_mutex_init(&fdb->gen_lock, NULL);
+    pthread_mutex_init(&fdb->tables_lock, NULL);
+    atomic_init(&fdb->page_reads, 0);
+    atomic_init(&fdb->readahead_pages, 0);
+    atomic_init(&fdb->pages_verified, 0);
+    atomic_init(&fdb->checksum_errors, 0);
+    fdb->verify = !(opts && opts->skip_checksums);
+    if (opts) {
+        fdb->codec = opts->compression;
+        fdb->table_codec = opts->table_codec;
+        fdb->table_codec_arg = opts->table_codec_arg;
+    }
+    fdb->durability = opts && opts->durability ? opts->durability : KVSTORE_DURABLE_SYNC;
+    fdb->flush_interval_ms = opts && opts->flush_interval_ms ? opts->flush_interval_ms
+                                                             : FILE_FLUSH_INTERVAL_MS;
+    fdb->checkpoint_bytes = opts && opts->checkpoint_bytes ? opts->checkpoint_bytes
+                                                           : FILE_CHECKPOINT_BYTES;
+    int readahead = opts ? opts->readahead_pages : 0;
+    fdb->readahead = readahead < 0 ? 0 : readahead > 0 ? (unsigned)readahead : FILE_READAHEAD;
+
+    char wal[PATH_MAX], data[PATH_MAX];
+    if (!path || (mkdir(path, 0755) != 0 && errno != EEXIST) ||
+        snprintf(wal, sizeof(wal), "%s/wal", path) >= (int)sizeof(wal) ||
+        snprintf(data, sizeof(data), "%s/data.tmp", path) >= (int)sizeof(data)) {
+        file_free(fdb);
+        return KVSTORE_ERROR;
+    }
+    snprintf(data, sizeof(data), "%s/data", path);
+    fdb->path = strdup(path);
+    fdb->gen = (file_gen_t*)calloc(1, sizeof(file_gen_t));
+    if (fdb->gen) {
+        fdb->gen->mem = kvstore_open_mem();
+        fdb->gen->refs = 1;
+    }
+    fdb->aio = kvstore_aio_new(opts ? opts->io_mode : KVSTORE_IO_AUTO,
+                               opts ? opts->io_depth : 0, opts ? opts->io_threads : 0);
+    bool direct = opts && opts->direct_io;
+    if (direct) {
+        fdb->cache = kvstore_cache_new(opts->cache_bytes ? opts->cache_bytes : FILE_CACHE_BYTES,
+                                       FILE_PAGE_SIZE);
+    }
+    fdb->fd = open(wal, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (!fdb->path || !fdb->gen || !fdb->gen->mem || !fdb->aio || (direct && !fdb->cache) ||
+        fdb->fd < 0 || seg_load(data, direct, &fdb->gen->seg) != KVSTORE_OK) {
+        file_free(fdb);
+        return KVSTORE_ERROR;
+    }
+    const seg_t *seg = fdb->gen->seg;
+    if (seg) {
+        fdb->seq = fdb->written_seq = fdb->durable_seq = seg->seq;
+        fdb->data_bytes = seg->bytes;
+        fdb->page_bytes = seg->page_bytes;
+        fdb->compressed_pages = seg->compressed;
+    }
+
+    db->backend_handle = fdb;
+    if (log_replay(db, fdb) != KVSTORE_OK ||
+        pthread_create(&fdb->flusher, NULL, flusher_main, fdb) != 0) {
+        db->backend_handle = NULL;
+        file_free(fdb);
+        return KVSTORE_ERROR;
+    }
+    fdb->flusher_started = true;
+    return KVSTORE_OK;
+}
+
+static int file_open(kvstore_t *db, const char *path) {
+    return file_start(db, path, NULL);
+}
+
+static void file_close(kvstore_t *db) {
+    file_db_t *fdb = (file_db_t*)db->backend_handle;
+    if (!fdb) return;
+
+    pthread_mutex_lock(&fdb->log_lock);
+    fdb->stop = true;
+    pthread_cond_signal(&fdb->flusher_cond);
+    uint64_t seq = fdb->seq;
+    pthread_mutex_unlock(&fdb->log_lock);
+    if (fdb->flusher_started) pthread_join(fdb->flusher, NULL);
+
+    log_flush(fdb, seq, true);
+    file_free(fdb);
+    db->backend_handle = NULL;
+}
+
+static int file_txn_begin(kvstore_t *db, kvstore_txn_t *txn, bool read_only) {
+    file_db_t *fdb = (file_db_t*)db->backend_handle;
+
+    file_txn_t *ftxn = (file_txn_t*)calloc(1, sizeof(file_txn_t));
+    if (!ftxn) return KVSTORE_ERROR;
+
+    ftxn->gen = gen_pin(fdb);
+    ftxn->inner = kvstore_txn_begin(ftxn->gen->mem, read_only);
+    if (!ftxn->inner) {
+        gen_unpin(fdb, ftxn->gen);
+        free(ftxn);
+        return KVSTORE_ERROR;
+    }
+
+    // Leave room for the frame header, filled in at commit
+    ftxn->len = KVSTORE_REPL_FRAME_HDR;
+
+    txn->backend_txn = ftxn;
+    return KVSTORE_OK;
+}
+
+static void file_txn_free(kvstore_txn_t *txn) {
+    file_db_t *fdb = (file_db_t*)txn->db->backend_handle;
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+
+    // Outstanding lookups are dropped without their callbacks
+    if (ftxn->queue) {
+        kvstore_aio_req_t *done[FILE_POLL_BATCH];
+        size_t n;
+        while (kvstore_aio_pending(ftxn->queue) > 0 &&
+               kvstore_aio_wait(ftxn->queue, 1, done, FILE_POLL_BATCH, &n) == KVSTORE_OK) {
+            for (size_t i = 0; i < n; i++) {
+                io_buf_put(fdb, done[i]->buf, done[i]->len);
+                free(done[i]->arg);
+            }
+        }
+        kvstore_aio_queue_put(ftxn->queue);
+    }
+    while (ftxn->arena) {
+        file_chunk_t *next = ftxn->arena->next;
+        free(ftxn->arena);
+        ftxn->arena = next;
+    }
+    free(ftxn->log);
+    free(ftxn->marks);
+    free(ftxn->val);
+    free(ftxn->page);
+    gen_unpin(fdb, ftxn->gen);
+    free(ftxn);
+    txn->backend_txn = NULL;
+}
+
+static int mem_put(file_txn_t *ftxn, const char *table, kvstore_val_t *key,
+                   uint8_t tag, kvstore_val_t *val);
+
+// Put the writes in ftxn's frame into the current memtable, after a
+// checkpoint replaced the one it began on. Call with commit_lock held.
+static int frame_redo(file_db_t *fdb, file_txn_t *ftxn) {
+    ftxn->inner = kvstore_txn_begin(fdb->gen->mem, false);
+    if (!ftxn->inner) return KVSTORE_ERROR;
+
+    int rc = KVSTORE_OK;
+    char *table = NULL;
+    size_t table_cap = 0;
+    const char *p = ftxn->log + KVSTORE_REPL_FRAME_HDR;
+    for (uint32_t i = 0; rc == KVSTORE_OK && i < ftxn->ops; i++) {
+        uint8_t type;
+        uint16_t table_len;
+        uint32_t key_len, val_len;
+        SER_READ_U8(p, type);
+        SER_READ_U16(p, table_len);
+        SER_READ_U32(p, key_len);
+        SER_READ_U32(p, val_len);
+        rc = grow(&table, &table_cap, (size_t)table_len + 1);
+        if (rc != KVSTORE_OK) break;
+        memcpy(table, p, table_len);
+        table[table_len] = '\0';
+        p += table_len;
+
+        kvstore_val_t key = { (void*)p, key_len };
+        p += key_len;
+        kvstore_val_t val = { (void*)p, val_len };
+        p += val_len;
+        rc = note_table(fdb, table);
+        if (rc != KVSTORE_OK) break;
+        rc = type == KVSTORE_REPL_OP_PUT ? mem_put(ftxn, table, &key, FILE_TAG_VALUE, &val)
+                                         : mem_put(ftxn, table, &key, FILE_TAG_TOMBSTONE, NULL);
+    }
+    free(table);
+
+    if (rc == KVSTORE_OK) rc = kvstore_txn_commit(ftxn->inner);
+    else kvstore_txn_abort(ftxn->inner);
+    ftxn->inner = NULL;
+    return rc;
+}
+
+static int file_txn_commit(kvstore_txn_t *txn) {
+    file_db_t *fdb = (file_db_t*)txn->db->backend_handle;
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn) return KVSTORE_ERROR;
+
+    if (ftxn->ops == 0) {
+        int rc = kvstore_txn_commit(ftxn->inner);
+        ftxn->inner = NULL;
+        file_txn_free(txn);
+        return rc;
+    }
+
+    int rc;
+    uint64_t seq = 0;
+    pthread_mutex_lock(&fdb->commit_lock);
+    if (fdb->failed) {
+        kvstore_txn_abort(ftxn->inner);
+        rc = KVSTORE_ERROR;
+    } else if (ftxn->gen != fdb->gen && ftxn->gen->last_seq != fdb->seq) {
+        // A checkpoint has written out the memtable it would commit to, and
+        // commits since can't be checked against it
+        kvstore_txn_abort(ftxn->inner);
+        rc = KVSTORE_CONFLICT;
+    } else {
+        // The memory commit checks for conflicts with every commit since
+        // this began: if a checkpoint has replaced its memtable, the writes
+        // then go into the current one
+        rc = kvstore_txn_commit(ftxn->inner);
+        ftxn->inner = NULL;
+        if (rc == KVSTORE_OK && ftxn->gen != fdb->gen) rc = frame_redo(fdb, ftxn);
+        if (rc == KVSTORE_OK) rc = log_append(fdb, ftxn, &seq);
+    }
+    pthread_mutex_unlock(&fdb->commit_lock);
+    ftxn->inner = NULL;
+    file_txn_free(txn);
+
+    if (rc == KVSTORE_OK) {
+        txn->commit_seq = seq;
+        kvstore_durability_t level = txn->durability ? txn->durability : fdb->durability;
+        if (level == KVSTORE_DURABLE_SYNC) rc = log_flush(fdb, seq, true);
+        else if (level == KVSTORE_DURABLE_ASYNC) rc = log_flush(fdb, seq, false);
+    }
+    return rc;
+}
+
+static void file_txn_abort(kvstore_txn_t *txn) {
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn) return;
+
+    kvstore_txn_abort(ftxn->inner);
+    file_txn_free(txn);
+}
+
+// Put a tagged value into the memtable
+static int mem_put(file_txn_t *ftxn, const char *table, kvstore_val_t *key,
+                   uint8_t tag, kvstore_val_t *val) {
+    size_t size = 1 + (val ? val->size : 0);
+    if (size > ftxn->val_cap) {
+        char *buf = (char*)realloc(ftxn->val, size);
+        if (!buf) return KVSTORE_ERROR;
+        ftxn->val = buf;
+        ftxn->val_cap = size;
+    }
+    ftxn->val[0] = (char)tag;
+    if (val && val->size) memcpy(ftxn->val + 1, val->data, val->size);
+
+    kvstore_val_t tagged = { ftxn->val, size };
+    return kvstore_txn_put(ftxn->inner, table, key, &tagged);
+}
+
+static int file_put(kvstore_txn_t *txn, const char *table,
+                    kvstore_val_t *key, kvstore_val_t *val) {
+    file_db_t *fdb = (file_db_t*)txn->db->backend_handle;
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn || key->size > UINT16_MAX || val->size > UINT32_MAX) return KVSTORE_ERROR;
+
+    int rc = note_table(fdb, table);
+    if (rc == KVSTORE_OK) rc = mem_put(ftxn, table, key, FILE_TAG_VALUE, val);
+    if (rc != KVSTORE_OK) return rc;
+
+    return fdb->replaying ? KVSTORE_OK
+                          : frame_append(ftxn, KVSTORE_REPL_OP_PUT, table, key, val);
+}
+
+static int file_get(kvstore_txn_t *txn, const char *table,
+                    kvstore_val_t *key, kvstore_val_t *val_out) {
+    file_db_t *fdb = (file_db_t*)txn->db->backend_handle;
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn) return KVSTORE_ERROR;
+
+    kvstore_val_t tagged;
+    int rc = kvstore_txn_get(ftxn->inner, table, key, &tagged);
+    if (rc == KVSTORE_OK) return mem_value(&tagged, val_out);
+    if (rc != KVSTORE_NOTFOUND) return rc;
+    return seg_get(fdb, ftxn, table, key, val_out);
+}
+
+static int file_del(kvstore_txn_t *txn, const char *table,
+                    kvstore_val_t *key) {
+    file_db_t *fdb = (file_db_t*)txn->db->backend_handle;
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn) return KVSTORE_ERROR;
+
+    int rc = file_get(txn, table, key, NULL);
+    if (rc != KVSTORE_OK) return rc;
+
+    rc = note_table(fdb, table);
+    if (rc == KVSTORE_OK) rc = mem_put(ftxn, table, key, FILE_TAG_TOMBSTONE, NULL);
+    if (rc != KVSTORE_OK) return rc;
+
+    return fdb->replaying ? KVSTORE_OK
+                          : frame_append(ftxn, KVSTORE_REPL_OP_DEL, table, key, NULL);
+}
+
+// Lookups the memtable answers complete at once; the rest queue a read of
+// their page, searched when it completes
+static int file_get_async(kvstore_txn_t *txn, const char *table, kvstore_val_t *key,
+                          kvstore_get_fn fn, void *arg) {
+    file_db_t *fdb = (file_db_t*)txn->db->backend_handle;
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn) return KVSTORE_ERROR;
+
+    kvstore_val_t val;
+    int rc = kvstore_txn_get(ftxn->inner, table, key, &val);
+    if (rc == KVSTORE_OK) {
+        rc = mem_value(&val, &val);
+        if (rc == KVSTORE_ERROR) return rc;
+        fn(arg, rc, rc == KVSTORE_OK ? &val : NULL);
+        return KVSTORE_OK;
+    }
+    if (rc != KVSTORE_NOTFOUND) return rc;
+
+    const seg_t *seg = ftxn->gen->seg;
+    const seg_table_t *t = seg_table(seg, table);
+    size_t idx = t ? seg_page_for(seg, t, key) : SIZE_MAX;
+    if (idx == SIZE_MAX) {
+        fn(arg, KVSTORE_NOTFOUND, NULL);
+        return KVSTORE_OK;
+    }
+
+    // Direct I/O: a cached page needs no read
+    const seg_page_t *pg = &seg->pages[idx];
+    if (fdb->cache && kvstore_cache_contains(fdb->cache, page_id(seg, idx))) {
+        rc = seg_get(fdb, ftxn, table, key, &val);
+        if (rc == KVSTORE_ERROR) return rc;
+        fn(arg, rc, rc == KVSTORE_OK ? &val : NULL);
+        return KVSTORE_OK;
+    }
+
+    if (!ftxn->queue && !(ftxn->queue = kvstore_aio_queue_get(fdb->aio))) return KVSTORE_ERROR;
+    uint64_t off;
+    size_t span = page_span(fdb, pg, &off);
+    file_lookup_t *lk = (file_lookup_t*)malloc(sizeof(file_lookup_t) + key->size);
+    void *buf = lk ? io_buf_get(fdb, span) : NULL;
+    if (!buf) {
+        free(lk);
+        return KVSTORE_ERROR;
+    }
+    memset(&lk->req, 0, sizeof(lk->req));
+    lk->req.fd = seg->fd;
+    lk->req.buf = buf;
+    lk->req.len = span;
+    lk->req.off = off;
+    lk->req.arg = lk;
+    lk->page = idx;
+    lk->fn = fn;
+    lk->arg = arg;
+    lk->key_len = key->size;
+    memcpy(lk->key, key->data, key->size);
+    return kvstore_aio_submit(ftxn->queue, &lk->req);
+}
+
+static int file_poll(kvstore_txn_t *txn, size_t min, size_t *ran) {
+    file_db_t *fdb = (file_db_t*)txn->db->backend_handle;
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn) return KVSTORE_ERROR;
+
+    const seg_t *seg = ftxn->gen->seg;
+    size_t total = 0, n;
+    do {
+        kvstore_aio_req_t *done[FILE_POLL_BATCH];
+        size_t want = min > total ? min - total : 0;
+        n = 0;
+        if (ftxn->queue &&
+            kvstore_aio_wait(ftxn->queue, want, done, FILE_POLL_BATCH, &n) != KVSTORE_OK) {
+            return KVSTORE_ERROR;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            file_lookup_t *lk = (file_lookup_t*)done[i]->arg;
+            kvstore_val_t key = { lk->key, lk->key_len }, val;
+            const seg_page_t *pg = &seg->pages[lk->page];
+            char *disk = (char*)done[i]->buf + (pg->off - done[i]->off);
+            uint32_t count;
+            int rc = KVSTORE_ERROR;
+
+            // A compressed page is decompressed where synchronous gets put
+            // theirs
+            char *page = disk;
+            if (pg->codec != KVSTORE_CODEC_NONE) {
+                page = grow(&ftxn->page, &ftxn->page_cap, pg->len) == KVSTORE_OK ? ftxn->page : NULL;
+            }
+            if (done[i]->res == (ssize_t)done[i]->len && page &&
+                page_load(fdb, seg, lk->page, disk, page, &count) == KVSTORE_OK) {
+                atomic_fetch_add(&fdb->page_reads, 1);
+                if (fdb->cache) {
+                    kvstore_cache_put(fdb->cache, page_id(seg, lk->page), page, pg->len, true);
+                }
+                rc = page_lookup(ftxn, page, count, &key, &val);
+            }
+            io_buf_put(fdb, done[i]->buf, done[i]->len);
+            lk->fn(lk->arg, rc, rc == KVSTORE_OK ? &val : NULL);
+            free(lk);
+        }
+        total += n;
+    } while (n > 0 && (total < min || n == FILE_POLL_BATCH));
+
+    if (ran) *ran = total;
+    return KVSTORE_OK;
+}
+
+static int file_cursor_open(kvstore_txn_t *txn, kvstore_cursor_t *cur,
+                            const char *table, kvstore_val_t *start_key) {
+    file_db_t *fdb = (file_db_t*)txn->db->backend_handle;
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn) return KVSTORE_ERROR;
+
+    file_cursor_t *fc = (file_cursor_t*)malloc(sizeof(file_cursor_t));
+    if (!fc) return KVSTORE_ERROR;
+    int rc = fcur_open(fc, fdb, ftxn->gen, ftxn->inner, table, start_key);
+    if (rc != KVSTORE_OK) {
+        fcur_close(fc);
+        free(fc);
+        return rc;
+    }
+
+    cur->backend_cursor = fc;
+    cur->valid = fc->valid;
+    return KVSTORE_OK;
+}
+
+static int file_cursor_get(kvstore_cursor_t *cur,
+                           kvstore_val_t *key_out, kvstore_val_t *val_out) {
+    return fcur_get((file_cursor_t*)cur->backend_cursor, key_out, val_out);
+}
+
+static int file_cursor_next(kvstore_cursor_t *cur) {
+    file_cursor_t *fc = (file_cursor_t*)cur->backend_cursor;
+    int rc = fcur_next(fc);
+    cur->valid = fc->valid;
+    return rc;
+}
+
+static int file_cursor_bound(kvstore_cursor_t *cur, kvstore_val_t *end) {
+    file_cursor_t *fc = (file_cursor_t*)cur->backend_cursor;
+    int rc = fcur_bound(fc, end);
+    cur->valid = fc->valid;
+    return rc;
+}
+
+static void file_cursor_close(kvstore_cursor_t *cur) {
+    file_cursor_t *fc = (file_cursor_t*)cur->backend_cursor;
+    fcur_close(fc);
+    free(fc);
+    cur->backend_cursor = NULL;
+    cur->valid = false;
+}
+
+// Split at the first keys of evenly spaced data file pages; tables that are
+// all in the memtable split as it does
+static int file_split_points(kvstore_txn_t *txn, const char *table,
+                             kvstore_val_t *start, kvstore_val_t *end,
+                             kvstore_val_t *splits_out, size_t *nsplits) {
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn) return KVSTORE_ERROR;
+
+    const seg_t *seg = ftxn->gen->seg;
+    const seg_table_t *t = seg_table(seg, table);
+    if (!t || t->npages < 2) {
+        return kvstore_txn_split_points(ftxn->inner, table, start, end, splits_out, nsplits);
+    }
+
+    // Candidates: pages starting strictly inside (start, end)
+    size_t lo = t->first_page + 1, hi = t->first_page + t->npages;
+    if (start) {
+        size_t p = seg_page_for(seg, t, start);
+        if (p != SIZE_MAX && p + 1 > lo) lo = p + 1;
+    }
+    if (end) {
+        size_t p = seg_page_for(seg, t, end);
+        if (p == SIZE_MAX) hi = lo;
+        else if (p + 1 < hi) hi = p + 1;
+        if (hi > lo && key_cmp(seg->pages[hi - 1].first, seg->pages[hi - 1].first_len,
+                               end->data, end->size) >= 0) {
+            hi--;
+        }
+    }
+
+    size_t avail = hi > lo ? hi - lo : 0;
+    size_t want = *nsplits < avail ? *nsplits : avail;
+    size_t n = 0, last = SIZE_MAX;
+    for (size_t i = 0; i < want; i++) {
+        size_t idx = lo + (i + 1) * avail / (want + 1);
+        if (idx == last || idx >= hi) continue;
+        splits_out[n].data = (void*)seg->pages[idx].first;
+        splits_out[n].size = seg->pages[idx].first_len;
+        n++;
+        last = idx;
+    }
+    *nsplits = n;
+    return KVSTORE_OK;
+}
+
+static int file_txn_stats(kvstore_txn_t *txn, kvstore_txn_stats_t *out) {
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn) return KVSTORE_ERROR;
+    return kvstore_txn_stats(ftxn->inner, out);
+}
+
+// Savepoints are the memory backend's; the frame is cut back alongside
+static int file_savepoint(kvstore_txn_t *txn, size_t *id) {
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn) return KVSTORE_ERROR;
+
+    kvstore_savepoint_t sp;
+    int rc = kvstore_txn_savepoint(ftxn->inner, &sp);
+    if (rc != KVSTORE_OK) return rc;
+    if (sp.id >= ftxn->mark_cap) {
+        size_t cap = ftxn->mark_cap ? ftxn->mark_cap * 2 : 8;
+        while (cap <= sp.id) cap *= 2;
+        file_mark_t *marks = (file_mark_t*)realloc(ftxn->marks, cap * sizeof(file_mark_t));
+        if (!marks) {
+            kvstore_txn_release(ftxn->inner, &sp);
+            return KVSTORE_ERROR;
+        }
+        ftxn->marks = marks;
+        ftxn->mark_cap = cap;
+    }
+    ftxn->marks[sp.id] = (file_mark_t){ ftxn->len, ftxn->ops };
+    ftxn->mark_count = sp.id + 1;
+    *id = sp.id;
+    return KVSTORE_OK;
+}
+
+static int file_rollback_to(kvstore_txn_t *txn, size_t id) {
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn || id >= ftxn->mark_count) return KVSTORE_ERROR;
+
+    kvstore_savepoint_t sp = { id };
+    int rc = kvstore_txn_rollback_to(ftxn->inner, &sp);
+    if (rc != KVSTORE_OK) return rc;
+    ftxn->len = ftxn->marks[id].len;
+    ftxn->ops = ftxn->marks[id].ops;
+    ftxn->mark_count = id + 1;
+    return KVSTORE_OK;
+}
+
+static int file_release(kvstore_txn_t *txn, size_t id) {
+    file_txn_t *ftxn = (file_txn_t*)txn->backend_txn;
+    if (!ftxn || id >= ftxn->mark_count) return KVSTORE_ERROR;
+
+    kvstore_savepoint_t sp = { id };
+    int rc = kvstore_txn_release(ftxn->inner, &sp);
+    if (rc != KVSTORE_OK) return rc;
+    ftxn->mark_count = id;
+    return KVSTORE_OK;
+}
+
+static int file_wait_durable(kvstore_t *db, uint64_t seq) {
+    file_db_t *fdb = (file_db_t*)db->backend_handle;
+
+    pthread_mutex_lock(&fdb->log_lock);
+    bool logged = seq <= fdb->seq;
+    pthread_mutex_unlock(&fdb->log_lock);
+    if (!logged) return KVSTORE_ERROR;
+    return log_flush(fdb, seq, true);
+}
+
+// ------------------------
+// Ops vtable
+// ------------------------
+
+static const struct kvstore_ops file_ops = {
+    .open = file_open,
+    .close = file_close,
+    .txn_begin = file_txn_begin,
+    .txn_commit = file_txn_commit,
+    .txn_abort = file_txn_abort,
+    .put = file_put,
+    .get = file_get,
+    .del = file_del,
+    .get_async = file_get_async,
+    .poll = file_poll,
+    .cursor_open = file_cursor_open,
+    .cursor_get = file_cursor_get,
+    .cursor_next = file_cursor_next,
+    .cursor_close = file_cursor_close,
+    .cursor_bound = file_cursor_bound,
+    .split_points = file_split_points,
+    .txn_stats = file_txn_stats,
+    .savepoint = file_savepoint,
+    .rollback_to = file_rollback_to,
+    .release = file_release,
+    .wait_durable = file_wait_durable,
+};
+
+const struct kvstore_ops* kvstore_file_ops(void) {
+    return &file_ops;
+}
+
+kvstore_t* kvstore_open_file(const char *path, const kvstore_file_opts_t *opts) {
+    kvstore_t *db = (kvstore_t*)calloc(1, sizeof(kvstore_t));
+    if (!db) return NULL;
+
+    db->ops = &file_ops;
+    if (file_start(db, path, opts) != KVSTORE_OK) {
+        free(db);
+        return NULL;
+    }
+    return db;
+}
+
+int kvstore_file_stats(kvstore_t *db, kvstore_file_stats_t *out) {
+    if (!db || !out || db->ops != &file_ops) return KVSTORE_ERROR;
+    file_db_t *fdb = (file_db_t*)db->backend_handle;
+
+    pthread_mutex_lock(&fdb->log_lock);
+    out->seq = fdb->seq;
+    out->written_seq = fdb->written_seq;
+    out->durable_seq = fdb->durable_seq;
+    out->syncs = fdb->syncs;
+    out->log_bytes = fdb->log_bytes;
+    out->checkpoints = fdb->checkpoints;
+    out->data_bytes = fdb->data_bytes;
+    out->page_bytes = fdb->page_bytes;
+    out->compressed_pages = fdb->compressed_pages;
+    out->log_written = fdb->log_written;
+    out->data_written = fdb->data_written;
+    pthread_mutex_unlock(&fdb->log_lock);
+    out->page_reads = atomic_load(&fdb->page_reads);
+    out->readahead_pages = atomic_load(&fdb->readahead_pages);
+    out->pages_verified = atomic_load(&fdb->pages_verified);
+    out->checksum_errors = atomic_load(&fdb->checksum_errors);
+    out->io_mode = kvstore_aio_mode(fdb->aio);
+    out->direct_io = fdb->cache != NULL;
+    if (fdb->cache) kvstore_cache_stats(fdb->cache, &out->cache);
+    else memset(&out->cache, 0, sizeof(out->cache));
+    return KVSTORE_OK;
+}
+
+int kvstore_file_checkpoint(kvstore_t *db) {
+    if (!db || db->ops != &file_ops) return KVSTORE_ERROR;
+    return checkpoint((file_db_t*)db->backend_handle);
+}
+
+int kvstore_file_verify(const char *path, unsigned threads, kvstore_file_verify_t *out) {
+    if (!path || !out) return KVSTORE_ERROR;
+    memset(out, 0, sizeof(*out));
+    out->first_bad = UINT64_MAX;
+
+    char data[PATH_MAX];
+    if (snprintf(data, sizeof(data), "%s/data", path) >= (int)sizeof(data)) return KVSTORE_ERROR;
+    seg_t *seg;
+    if (seg_load(data, false, &seg) != KVSTORE_OK) return KVSTORE_ERROR;
+    out->index_ok = true;
+    if (!seg) return KVSTORE_OK;
+    posix_fadvise(seg->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    out->pages = seg->npages;
+    for (size_t i = 0; i < seg->npages; i++) out->bytes += seg->pages[i].disk_len;
+
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    size_t chunks = seg->npages / FILE_VERIFY_CHUNK + 1;
+    if (threads > chunks) threads = (unsigned)chunks;
+
+    verify_job_t job = { .seg = seg, .out = out };
+    atomic_init(&job.next, 0);
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_t *tids = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    unsigned started = 0;
+    while (tids && started < threads &&
+           pthread_create(&tids[started], NULL, verify_worker, &job) == 0) {
+        started++;
+    }
+    if (started == 0) verify_worker(&job);
+    for (unsigned i = 0; i < started; i++) pthread_join(tids[i], NULL);
+    free(tids);
+    pthread_mutex_destroy(&job.lock);
+    seg_free(seg);
+    return out->bad_pages == 0 ? KVSTORE_OK : KVSTORE_ERROR;
+}
@@ -2,7 +2,9 @@
 // Not production-ready - uses simple sorted arrays
 
 #define _POSIX_C_SOURCE 200809L
-#include "../include/kvstore_backend.h"
+#include "../include/kvstore_mem.h"
+#include <pthread.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <sys/types.h>
 
@@ -17,29 +19,164 @@ typedef struct {
     size_t val_size;
 } kv_pair_t;
 
+// Readers latch a table shared; commits latch the tables they write
+// exclusively, so commits to different tables don't block each other or
+// readers elsewhere
 typedef struct {
     char *name;
     kv_pair_t *pairs;
     size_t count;
     size_t capacity;
+    pthread_rwlock_t latch;
+    uint64_t version;   // Bumped by every commit that changes it
 } kv_table_t;
 
+// Keys one table's write-set held at commit, sorted
 typedef struct {
-    kv_table_t *tables;
+    char *name;
+    kvstore_val_t *keys;
+    size_t count;
+    bool dropped;
+} mem_commit_table_t;
+
+// A commit, kept while transactions that began before it are open: they
+// validate their reads against its keys, and may still hold pointers to
+// the keys and values it replaced, which are freed with it
+typedef struct mem_commit {
+    struct mem_commit *next;
+    uint64_t seq;
+    mem_commit_table_t *tables;
+    size_t table_count;
+    void **retired;
+    atomic_size_t retired_count;
+} mem_commit_t;
+
+// dir_lock guards the list of tables: every operation holds it shared
+// while it uses a table, and only commits that create or remove tables
+// hold it exclusively. txn_lock guards the commit sequence, the open
+// transactions and the commit records.
+typedef struct {
+    kv_table_t **tables;
     size_t table_count;
     size_t table_capacity;
+    pthread_rwlock_t dir_lock;
+    uint64_t dir_version;           // Bumped when tables are created or removed
+    pthread_mutex_t txn_lock;
+    uint64_t seq;                   // Commits applied
+    struct mem_txn *active;         // Open transactions
+    size_t active_count;
+    mem_commit_t *commits;          // Oldest first
+    mem_commit_t *commits_tail;
+    size_t apply_threads;           // See kvstore_mem_opts_t
+    size_t parallel_min_writes;
 } mem_db_t;
 
+// A buffered write, kept in the transaction's log until commit or abort.
+// A NULL val deletes the key; a NULL key records a drop_table, with val
+// pointing to the mem_dropped_t it replaced.
+typedef struct {
+    size_t pending;     // Index of the table's write-set in mem_txn_t
+    size_t prev;        // Write to the same key this one replaced, or NO_WRITE
+    void *key;
+    size_t key_size;
+    void *val;
+    size_t val_size;
+} mem_write_t;
+
+#define NO_WRITE ((size_t)-1)
+
+// Write-set of a table before a drop, to restore on rollback
+typedef struct {
+    size_t *slots;
+    size_t count;
+    size_t capacity;
+    bool dropped;
+} mem_dropped_t;
+
+// A key or range of a table read from committed state, as offsets into
+// mem_txn_t.read_keys
+typedef struct {
+    size_t start;       // NO_KEY: from the first key
+    size_t start_size;
+    size_t end;         // Inclusive; NO_KEY: to the last key
+    size_t end_size;
+} mem_read_t;
+
+#define NO_KEY ((size_t)-1)
+
+// Read set of one table
 typedef struct {
+    char *name;
+    mem_read_t *reads;
+    size_t count;
+    size_t capacity;
+} mem_read_set_t;
+
+// Write-set of one table: the latest write to each key, in key order
+typedef struct {
+    char *name;
+    size_t *slots;      // Log indices
+    size_t count;
+    size_t capacity;
+    bool dropped;       // Drop the table's committed keys first
+} mem_pending_t;
+
+// Writes are buffered in the transaction, so reads through it see them and
+// nothing reaches the tables until commit, which applies only the final
+// state of each key. A savepoint is a log position: writes before the
+// newest one are never changed in place, so rolling back only has to undo
+// the log entries after it.
+//
+// Concurrency is optimistic: read-write transactions record the keys and
+// cursor ranges they read from committed tables, and commit fails with
+// KVSTORE_CONFLICT if a transaction that committed since this one began
+// wrote into any of them.
+typedef struct mem_txn {
     mem_db_t *db;
     bool committed;
-    // Simple implementation: changes go directly to DB
-    // Real implementation would buffer changes
+    bool read_only;
+    bool read_failed;   // A read couldn't be recorded: commit fails
+    uint64_t begin_seq; // Commits applied when it began
+    struct mem_txn *prev_active;
+    struct mem_txn *next_active;
+    mem_read_set_t *read_sets;
+    size_t read_set_count;
+    size_t read_set_capacity;
+    char *read_keys;
+    size_t read_keys_size;
+    size_t read_keys_capacity;
+    mem_write_t *log;
+    size_t log_count;
+    size_t log_capacity;
+    mem_pending_t *pending;
+    size_t pending_count;
+    size_t pending_capacity;
+    uint64_t issued;    // put, del and merge calls
+    uint64_t version;   // Bumped by every write, so cursors know to re-seek
+    size_t *savepoints; // Log positions, oldest first
+    size_t savepoint_count;
+    size_t savepoint_capacity;
 } mem_txn_t;
 
+#define NO_PENDING ((size_t)-1)
+#define MOVED ((uint64_t)-1)
+
 typedef struct {
-    kv_table_t *table;
-    size_t index;
+    mem_txn_t *txn;
+    kv_table_t *table;  // Committed keys, or NULL
+    size_t pending;     // Write-set, or NO_PENDING
+    size_t index;       // Next committed key
+    size_t pindex;      // Next buffered write
+    bool from_pending;  // Current key is the buffered write at pindex
+    bool shadows;       // ... replacing the committed key at index
+    uint64_t version;
+    uint64_t dir_version;
+    uint64_t table_version; // Of table when positioned; MOVED after a lookup
+    size_t read_set;    // Range this cursor records, or NO_KEY
+    size_t read;
+    void *key;          // Copy of the current key, to re-seek after writes
+    size_t key_size;
+    size_t key_capacity;
 } mem_cursor_t;
 
 // ------------------------
@@ -57,33 +194,69 @@ static int compare_keys(const void *k1, size_t s1, const void *k2, size_t s2) {
 
 static kv_table_t* find_table(mem_db_t *db, const char *name) {
     for (size_t i = 0; i < db->table_count; i++) {
-        if (strcmp(db->tables[i].name, name) == 0) {
-            return &db->tables[i];
+        if (strcmp(db->tables[i]->name, name) == 0) {
+            return db->tables[i];
         }
     }
     return NULL;
 }
 
+// With dir_lock held exclusively
 static kv_table_t* get_or_create_table(mem_db_t *db, const char *name) {
     kv_table_t *table = find_table(db, name);
     if (table) return table;
 
     // Create new table
     if (db->table_count >= db->table_capacity) {
-        db->table_capacity = db->table_capacity ? db->table_capacity * 2 : 8;
-        db->tables = (kv_table_t*)realloc(db->tables,
-                                          db->table_capacity * sizeof(kv_table_t));
+        size_t cap = db->table_capacity ? db->table_capacity * 2 : 8;
+        kv_table_t **grown = (kv_table_t**)realloc(db->tables, cap * sizeof(kv_table_t*));
+        if (!grown) return NULL;
+        db->tables = grown;
+        db->table_capacity = cap;
     }
 
-    table = &db->tables[db->table_count++];
+    table = (kv_table_t*)calloc(1, sizeof(kv_table_t));
+    if (!table) return NULL;
     table->name = strdup(name);
-    table->pairs = NULL;
-    table->count = 0;
-    table->capacity = 0;
+    if (!table->name) {
+        free(table);
+        return NULL;
+    }
+    pthread_rwlock_init(&table->latch, NULL);
+    db->tables[db->table_count++] = table;
+    db->dir_version++;
+
+    return table;
+}
 
+// With dir_lock held exclusively; the table's pairs are already gone
+static void remove_table(mem_db_t *db, kv_table_t *table) {
+    for (size_t i = 0; i < db->table_count; i++) {
+        if (db->tables[i] == table) {
+            db->tables[i] = db->tables[--db->table_count];
+            break;
+        }
+    }
+    pthread_rwlock_destroy(&table->latch);
+    free(table->name);
+    free(table);
+    db->dir_version++;
+}
+
+// Look a table up and latch it shared for a read. The directory stays
+// locked shared until read_done(), so the table can't be removed meanwhile.
+static kv_table_t* read_table(mem_db_t *db, const char *name) {
+    pthread_rwlock_rdlock(&db->dir_lock);
+    kv_table_t *table = find_table(db, name);
+    if (table) pthread_rwlock_rdlock(&table->latch);
     return table;
 }
 
+static void read_done(mem_db_t *db, kv_table_t *table) {
+    if (table) pthread_rwlock_unlock(&table->latch);
+    pthread_rwlock_unlock(&db->dir_lock);
+}
+
 static ssize_t find_key_index(kv_table_t *table, const void *key, size_t key_size) {
     // Binary search
     ssize_t left = 0;
@@ -120,6 +293,852 @@ static ssize_t find_insert_pos(kv_table_t *table, const void *key, size_t key_si
     return left;
 }
 
+// First committed key after key
+static size_t find_after(kv_table_t *table, const void *key, size_t key_size) {
+    size_t pos = (size_t)find_insert_pos(table, key, key_size);
+    if (pos < table->count &&
+        compare_keys(key, key_size, table->pairs[pos].key, table->pairs[pos].key_size) == 0) {
+        pos++;
+    }
+    return pos;
+}
+
+static void free_table_pairs(kv_table_t *table) {
+    for (size_t i = 0; i < table->count; i++) {
+        free(table->pairs[i].key);
+        free(table->pairs[i].val);
+    }
+    free(table->pairs);
+    table->pairs = NULL;
+    table->count = 0;
+    table->capacity = 0;
+}
+
+// ------------------------
+// Write-set
+// ------------------------
+
+static mem_pending_t* find_pending(mem_txn_t *mtxn, const char *name) {
+    for (size_t i = 0; i < mtxn->pending_count; i++) {
+        if (strcmp(mtxn->pending[i].name, name) == 0) return &mtxn->pending[i];
+    }
+    return NULL;
+}
+
+static mem_pending_t* get_or_create_pending(mem_txn_t *mtxn, const char *name) {
+    mem_pending_t *p = find_pending(mtxn, name);
+    if (p) return p;
+
+    if (mtxn->pending_count == mtxn->pending_capacity) {
+        size_t cap = mtxn->pending_capacity ? mtxn->pending_capacity * 2 : 8;
+        mem_pending_t *grown = (mem_pending_t*)realloc(mtxn->pending, cap * sizeof(*grown));
+        if (!grown) return NULL;
+        mtxn->pending = grown;
+        mtxn->pending_capacity = cap;
+    }
+    p = &mtxn->pending[mtxn->pending_count];
+    memset(p, 0, sizeof(*p));
+    p->name = strdup(name);
+    if (!p->name) return NULL;
+    mtxn->pending_count++;
+    return p;
+}
+
+static mem_write_t* slot_write(mem_txn_t *mtxn, mem_pending_t *p, size_t pos) {
+    return &mtxn->log[p->slots[pos]];
+}
+
+// Position of key in the write-set, or where it would go
+static size_t pending_search(mem_txn_t *mtxn, mem_pending_t *p,
+                             const void *key, size_t key_size, bool *found) {
+    size_t left = 0, right = p->count;
+    *found = false;
+    while (left < right) {
+        size_t mid = left + (right - left) / 2;
+        mem_write_t *w = slot_write(mtxn, p, mid);
+        int cmp = compare_keys(key, key_size, w->key, w->key_size);
+        if (cmp == 0) {
+            *found = true;
+            return mid;
+        }
+        if (cmp < 0) right = mid;
+        else left = mid + 1;
+    }
+    return left;
+}
+
+// Buffered write to key, if any
+static mem_write_t* pending_write(mem_txn_t *mtxn, mem_pending_t *p,
+                                  const void *key, size_t key_size) {
+    if (!p) return NULL;
+    bool found;
+    size_t pos = pending_search(mtxn, p, key, key_size, &found);
+    return found ? slot_write(mtxn, p, pos) : NULL;
+}
+
+// Committed value of key in a table read_table() latched, as this
+// transaction sees it
+static kv_pair_t* committed_pair(mem_pending_t *p, kv_table_t *table,
+                                 const void *key, size_t key_size) {
+    if (p && p->dropped) return NULL;
+    if (!table) return NULL;
+    ssize_t idx = find_key_index(table, key, key_size);
+    return idx < 0 ? NULL : &table->pairs[idx];
+}
+
+// Writes at or after this log position may be changed in place
+static size_t savepoint_mark(mem_txn_t *mtxn) {
+    return mtxn->savepoint_count ? mtxn->savepoints[mtxn->savepoint_count - 1] : 0;
+}
+
+// New zeroed log entry (invalidates pointers into the log)
+static mem_write_t* log_append(mem_txn_t *mtxn) {
+    if (mtxn->log_count == mtxn->log_capacity) {
+        size_t cap = mtxn->log_capacity ? mtxn->log_capacity * 2 : 64;
+        mem_write_t *grown = (mem_write_t*)realloc(mtxn->log, cap * sizeof(*grown));
+        if (!grown) return NULL;
+        mtxn->log = grown;
+        mtxn->log_capacity = cap;
+    }
+    mem_write_t *w = &mtxn->log[mtxn->log_count++];
+    memset(w, 0, sizeof(*w));
+    return w;
+}
+
+// Record a write (val NULL to delete), replacing any earlier write to the
+// same key since the last savepoint. Returns the buffered write, whose
+// value is a copy of val with extra bytes of room.
+static mem_write_t* buffer_write(mem_txn_t *mtxn, const char *table_name,
+                                 kvstore_val_t *key, kvstore_val_t *val, size_t extra) {
+    mem_pending_t *p = get_or_create_pending(mtxn, table_name);
+    if (!p) return NULL;
+
+    void *copy = NULL;
+    if (val) {
+        copy = malloc(val->size + extra ? val->size + extra : 1);
+        if (!copy) return NULL;
+        if (val->size) memcpy(copy, val->data, val->size);
+    }
+
+    bool found;
+    size_t pos = pending_search(mtxn, p, key->data, key->size, &found);
+    size_t prev = found ? p->slots[pos] : NO_WRITE;
+    mem_write_t *w;
+    if (found && prev >= savepoint_mark(mtxn)) {
+        // Coalesce: only the latest write to a key is kept
+        w = &mtxn->log[prev];
+        free(w->val);
+    } else {
+        if (!found && p->count == p->capacity) {
+            size_t cap = p->capacity ? p->capacity * 2 : 16;
+            size_t *grown = (size_t*)realloc(p->slots, cap * sizeof(size_t));
+            if (!grown) {
+                free(copy);
+                return NULL;
+            }
+            p->slots = grown;
+            p->capacity = cap;
+        }
+        void *key_copy = malloc(key->size ? key->size : 1);
+        w = key_copy ? log_append(mtxn) : NULL;
+        if (!w) {
+            free(key_copy);
+            free(copy);
+            return NULL;
+        }
+        memcpy(key_copy, key->data, key->size);
+        w->key = key_copy;
+        w->key_size = key->size;
+        w->pending = (size_t)(p - mtxn->pending);
+        w->prev = prev;
+
+        // Replace the earlier write, which a rollback may bring back
+        if (found) {
+            p->slots[pos] = mtxn->log_count - 1;
+        } else {
+            memmove(&p->slots[pos + 1], &p->slots[pos], (p->count - pos) * sizeof(size_t));
+            p->slots[pos] = mtxn->log_count - 1;
+            p->count++;
+        }
+    }
+    w->val = copy;
+    w->val_size = val ? val->size : 0;
+    mtxn->issued++;
+    mtxn->version++;
+    return w;
+}
+
+// Undo the log entries from mark on, newest first
+static void rollback_log(mem_txn_t *mtxn, size_t mark) {
+    while (mtxn->log_count > mark) {
+        mem_write_t *w = &mtxn->log[--mtxn->log_count];
+        mem_pending_t *p = &mtxn->pending[w->pending];
+
+        if (!w->key) {
+            mem_dropped_t *d = (mem_dropped_t*)w->val;
+            free(p->slots);
+            p->slots = d->slots;
+            p->count = d->count;
+            p->capacity = d->capacity;
+            p->dropped = d->dropped;
+            free(d);
+            continue;
+        }
+
+        bool found;
+        size_t pos = pending_search(mtxn, p, w->key, w->key_size, &found);
+        if (w->prev != NO_WRITE) {
+            p->slots[pos] = w->prev;
+        } else {
+            memmove(&p->slots[pos], &p->slots[pos + 1], (p->count - pos - 1) * sizeof(size_t));
+            p->count--;
+        }
+        free(w->key);
+        free(w->val);
+    }
+    mtxn->version++;
+}
+
+static void free_write_set(mem_txn_t *mtxn) {
+    for (size_t i = 0; i < mtxn->log_count; i++) {
+        if (!mtxn->log[i].key && mtxn->log[i].val) {
+            free(((mem_dropped_t*)mtxn->log[i].val)->slots);
+        }
+        free(mtxn->log[i].key);
+        free(mtxn->log[i].val);
+    }
+    free(mtxn->log);
+    free(mtxn->savepoints);
+    mtxn->savepoints = NULL;
+    mtxn->savepoint_count = mtxn->savepoint_capacity = 0;
+    for (size_t i = 0; i < mtxn->pending_count; i++) {
+        free(mtxn->pending[i].slots);
+        free(mtxn->pending[i].name);
+    }
+    free(mtxn->pending);
+    mtxn->log = NULL;
+    mtxn->pending = NULL;
+    mtxn->log_count = mtxn->log_capacity = 0;
+    mtxn->pending_count = mtxn->pending_capacity = 0;
+}
+
+// Whether committing w would change the table
+static bool write_applies(mem_write_t *w, kv_pair_t *pair) {
+    if (!w->val) return pair != NULL;
+    return !pair || pair->val_size != w->val_size ||
+           memcmp(pair->val, w->val, w->val_size) != 0;
+}
+
+// Below this many inserts and deletes, apply them one by one; above it,
+// merge the write-set into the table in one pass
+#define MERGE_THRESHOLD 8
+
+// Buffered writes a commit needs before it applies on several threads,
+// unless kvstore_mem_opts_t says otherwise
+#define PARALLEL_MIN_WRITES 4096
+
+// Free a key or value a commit replaced, or hand it to the commit record
+// when other transactions may still hold pointers to it. Apply workers
+// retire into the same record concurrently.
+static void retire(mem_commit_t *c, void *ptr) {
+    if (c) c->retired[atomic_fetch_add_explicit(&c->retired_count, 1, memory_order_relaxed)] = ptr;
+    else free(ptr);
+}
+
+static void discard_pairs(kv_table_t *table, mem_commit_t *c) {
+    for (size_t i = 0; i < table->count; i++) {
+        retire(c, table->pairs[i].key);
+        retire(c, table->pairs[i].val);
+    }
+    free(table->pairs);
+    table->pairs = NULL;
+    table->count = 0;
+    table->capacity = 0;
+}
+
+// A run of one table's write-set [lo, hi), applied by one worker. Commit
+// makes two passes over the slices: locate_slice() finds where each write
+// lands and counts inserts and deletes without changing the table, then
+// apply_slice() either replaces values in place, or merges the slice with
+// the committed pairs [tlo, thi) into its own region of the new array.
+typedef struct {
+    mem_txn_t *mtxn;
+    mem_pending_t *p;
+    kv_table_t *table;
+    mem_commit_t *record;
+    size_t *pos;            // Insert position of each of the table's writes
+    size_t lo, hi;
+    size_t tlo, thi;
+    size_t structural;      // Inserts and deletes among the slice's writes
+    size_t structural_at[MERGE_THRESHOLD];
+    kv_pair_t *out;         // Merge region, or NULL to apply in place
+    size_t out_count;
+} mem_slice_t;
+
+// One table's slices, which are consecutive
+typedef struct {
+    kv_table_t *table;
+    mem_pending_t *p;
+    mem_slice_t *slices;
+    size_t count;
+    kv_pair_t *merged;
+    size_t capacity;
+} mem_apply_table_t;
+
+typedef struct {
+    mem_slice_t *slices;
+    size_t count;
+    atomic_size_t next;
+    void (*fn)(mem_slice_t *s);
+} mem_apply_run_t;
+
+static void locate_slice(mem_slice_t *s) {
+    kv_table_t *table = s->table;
+    for (size_t j = s->lo; j < s->hi; j++) {
+        mem_write_t *w = slot_write(s->mtxn, s->p, j);
+        size_t idx = (size_t)find_insert_pos(table, w->key, w->key_size);
+        bool exists = idx < table->count &&
+                      compare_keys(w->key, w->key_size,
+                                   table->pairs[idx].key, table->pairs[idx].key_size) == 0;
+        s->pos[j] = idx;
+        if (exists == (w->val != NULL)) continue;
+        if (s->structural < MERGE_THRESHOLD) s->structural_at[s->structural] = j;
+        s->structural++;
+    }
+}
+
+// Replace the values of keys already in the table. Inserts and deletes are
+// left to apply_structural(), which runs after every slice is done.
+static void replace_slice(mem_slice_t *s) {
+    kv_table_t *table = s->table;
+    for (size_t j = s->lo; j < s->hi; j++) {
+        mem_write_t *w = slot_write(s->mtxn, s->p, j);
+        if (!w->val || s->pos[j] >= table->count) continue;
+        kv_pair_t *pair = &table->pairs[s->pos[j]];
+        if (compare_keys(w->key, w->key_size, pair->key, pair->key_size) != 0 ||
+            !write_applies(w, pair)) {
+            continue;
+        }
+        retire(s->record, pair->val);
+        pair->val = w->val;
+        pair->val_size = w->val_size;
+        w->val = NULL;
+    }
+}
+
+static void merge_slice(mem_slice_t *s) {
+    kv_table_t *table = s->table;
+    kv_pair_t *merged = s->out;
+    size_t i = s->tlo, j = s->lo, n = 0;
+    while (i < s->thi || j < s->hi) {
+        if (j == s->hi) {
+            merged[n++] = table->pairs[i++];
+            continue;
+        }
+        mem_write_t *w = slot_write(s->mtxn, s->p, j);
+        kv_pair_t *pair = i < s->thi ? &table->pairs[i] : NULL;
+        int cmp = pair ? compare_keys(w->key, w->key_size, pair->key, pair->key_size) : -1;
+        if (cmp > 0) {
+            merged[n++] = table->pairs[i++];
+            continue;
+        }
+        j++;
+        if (cmp == 0) {
+            i++;
+            if (!write_applies(w, pair)) {
+                merged[n++] = *pair;
+                continue;
+            }
+            retire(s->record, pair->val);
+            if (!w->val) {
+                retire(s->record, pair->key);
+                continue;
+            }
+            merged[n] = *pair;
+        } else {
+            if (!w->val) continue;
+            merged[n].key = w->key;
+            merged[n].key_size = w->key_size;
+            w->key = NULL;
+        }
+        merged[n].val = w->val;
+        merged[n++].val_size = w->val_size;
+        w->val = NULL;
+    }
+    s->out_count = n;
+}
+
+static void apply_slice(mem_slice_t *s) {
+    if (s->out) merge_slice(s);
+    else replace_slice(s);
+}
+
+// Insert or delete one key in place
+static int apply_structural(kv_table_t *table, mem_write_t *w, mem_commit_t *c) {
+    size_t idx = (size_t)find_insert_pos(table, w->key, w->key_size);
+    kv_pair_t *pair = &table->pairs[idx];
+    if (!w->val) {
+        retire(c, pair->key);
+        retire(c, pair->val);
+        memmove(pair, pair + 1, (table->count - idx - 1) * sizeof(kv_pair_t));
+        table->count--;
+        return KVSTORE_OK;
+    }
+    if (table->count >= table->capacity) {
+        size_t cap = table->capacity ? table->capacity * 2 : 16;
+        kv_pair_t *grown = (kv_pair_t*)realloc(table->pairs, cap * sizeof(kv_pair_t));
+        if (!grown) return KVSTORE_ERROR;
+        table->pairs = grown;
+        table->capacity = cap;
+    }
+    pair = &table->pairs[idx];
+    memmove(pair + 1, pair, (table->count - idx) * sizeof(kv_pair_t));
+    table->count++;
+    pair->key = w->key;
+    pair->key_size = w->key_size;
+    pair->val = w->val;
+    pair->val_size = w->val_size;
+    w->key = NULL;
+    w->val = NULL;
+    return KVSTORE_OK;
+}
+
+static void* apply_worker(void *arg) {
+    mem_apply_run_t *run = (mem_apply_run_t*)arg;
+    size_t i;
+    while ((i = atomic_fetch_add(&run->next, 1)) < run->count) run->fn(&run->slices[i]);
+    return NULL;
+}
+
+// Run fn over every slice on up to nthreads threads, the caller's
+// included. Workers take slices as they finish, so a thread that fails to
+// start just leaves more for the others.
+static void run_slices(mem_slice_t *slices, size_t count, size_t nthreads,
+                       void (*fn)(mem_slice_t *s)) {
+    mem_apply_run_t run = { .slices = slices, .count = count, .fn = fn };
+    atomic_init(&run.next, 0);
+
+    if (nthreads > count) nthreads = count;
+    pthread_t *threads = nthreads > 1 ? (pthread_t*)calloc(nthreads, sizeof(pthread_t)) : NULL;
+    size_t started = 0;
+    for (size_t i = 1; threads && i < nthreads; i++) {
+        if (pthread_create(&threads[started], NULL, apply_worker, &run) == 0) started++;
+    }
+    apply_worker(&run);
+    for (size_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+static bool has_put(mem_txn_t *mtxn, mem_pending_t *p) {
+    for (size_t j = 0; j < p->count; j++) {
+        if (slot_write(mtxn, p, j)->val) return true;
+    }
+    return false;
+}
+
+// Apply every table's write-set: coalesced writes only, skipping deletes
+// of keys never committed and puts of the value already there. Ownership
+// of keys and values moves from the log to the tables. The caller holds
+// the latches of the tables written exclusively, or dir_lock exclusively
+// if the commit creates or removes tables.
+//
+// A commit of at least parallel_min_writes writes is cut into about
+// apply_threads slices, by table and then by key range within a table, so
+// one large table (like "", which holds every generated index) still
+// spreads across the workers.
+static int apply_write_sets(mem_txn_t *mtxn, mem_commit_t *c) {
+    mem_db_t *db = mtxn->db;
+    mem_apply_table_t *tables = (mem_apply_table_t*)calloc(mtxn->pending_count ? mtxn->pending_count : 1,
+                                                           sizeof(mem_apply_table_t));
+    if (!tables) return KVSTORE_ERROR;
+
+    // Drops and new tables first, while only this thread runs
+    size_t ntables = 0, total = 0;
+    int rc = KVSTORE_OK;
+    for (size_t i = 0; i < mtxn->pending_count; i++) {
+        mem_pending_t *p = &mtxn->pending[i];
+        kv_table_t *table = find_table(db, p->name);
+        if (p->dropped && p->count == 0) {
+            if (table) {
+                discard_pairs(table, c);
+                remove_table(db, table);
+            }
+            continue;
+        }
+        if (table) {
+            table->version++;
+            if (p->dropped) discard_pairs(table, c);
+        } else if (has_put(mtxn, p)) {
+            // Deletes alone never create a table
+            table = get_or_create_table(db, p->name);
+            if (!table) {
+                rc = KVSTORE_ERROR;
+                break;
+            }
+        }
+        if (!table || p->count == 0) continue;
+        tables[ntables].table = table;
+        tables[ntables++].p = p;
+        total += p->count;
+    }
+
+    size_t nthreads = db->apply_threads ? db->apply_threads : 1;
+    if (total < db->parallel_min_writes) nthreads = 1;
+    size_t per_slice = total / nthreads + 1;
+    size_t nslices = 0;
+    for (size_t t = 0; t < ntables; t++) {
+        nslices += (tables[t].p->count + per_slice - 1) / per_slice;
+    }
+    mem_slice_t *slices = (mem_slice_t*)calloc(nslices ? nslices : 1, sizeof(mem_slice_t));
+    size_t *pos = (size_t*)malloc((total ? total : 1) * sizeof(size_t));
+    if (rc != KVSTORE_OK || !slices || !pos) {
+        free(tables);
+        free(slices);
+        free(pos);
+        return KVSTORE_ERROR;
+    }
+
+    mem_slice_t *s = slices;
+    size_t *table_pos = pos;
+    for (size_t t = 0; t < ntables; t++) {
+        mem_pending_t *p = tables[t].p;
+        tables[t].slices = s;
+        for (size_t lo = 0; lo < p->count; lo += per_slice, s++) {
+            s->mtxn = mtxn;
+            s->p = p;
+            s->table = tables[t].table;
+            s->record = c;
+            s->pos = table_pos;
+            s->lo = lo;
+            s->hi = lo + per_slice < p->count ? lo + per_slice : p->count;
+        }
+        tables[t].count = (size_t)(s - tables[t].slices);
+        table_pos += p->count;
+    }
+    run_slices(slices, nslices, nthreads, locate_slice);
+
+    // Tables with many inserts and deletes get merged: each slice writes
+    // its part at the most it can be preceded by, and the parts are closed
+    // up once all are done
+    for (size_t t = 0; t < ntables && rc == KVSTORE_OK; t++) {
+        mem_apply_table_t *at = &tables[t];
+        size_t structural = 0;
+        for (size_t k = 0; k < at->count; k++) structural += at->slices[k].structural;
+        if (structural <= MERGE_THRESHOLD) continue;
+
+        at->capacity = at->table->count + at->p->count;
+        at->merged = (kv_pair_t*)malloc(at->capacity * sizeof(kv_pair_t));
+        if (!at->merged) {
+            rc = KVSTORE_ERROR;
+            break;
+        }
+        for (size_t k = 0; k < at->count; k++) {
+            mem_slice_t *sl = &at->slices[k];
+            sl->tlo = k == 0 ? 0 : sl->pos[sl->lo];
+            sl->thi = k + 1 == at->count ? at->table->count : sl[1].pos[sl[1].lo];
+            sl->out = at->merged + sl->tlo + sl->lo;
+        }
+    }
+    if (rc == KVSTORE_OK) run_slices(slices, nslices, nthreads, apply_slice);
+
+    for (size_t t = 0; t < ntables; t++) {
+        mem_apply_table_t *at = &tables[t];
+        kv_table_t *table = at->table;
+        if (rc != KVSTORE_OK) {
+            free(at->merged);
+            continue;
+        }
+        if (at->merged) {
+            size_t n = 0;
+            for (size_t k = 0; k < at->count; k++) {
+                memmove(at->merged + n, at->slices[k].out,
+                        at->slices[k].out_count * sizeof(kv_pair_t));
+                n += at->slices[k].out_count;
+            }
+            free(table->pairs);
+            table->pairs = at->merged;
+            table->count = n;
+            table->capacity = at->capacity;
+            continue;
+        }
+        for (size_t k = 0; k < at->count && rc == KVSTORE_OK; k++) {
+            mem_slice_t *sl = &at->slices[k];
+            for (size_t n = 0; n < sl->structural && rc == KVSTORE_OK; n++) {
+                rc = apply_structural(table, slot_write(mtxn, sl->p, sl->structural_at[n]), c);
+            }
+        }
+    }
+
+    free(tables);
+    free(slices);
+    free(pos);
+    return rc;
+}
+
+// ------------------------
+// Read sets and validation
+// ------------------------
+
+static mem_read_set_t* find_read_set(mem_txn_t *mtxn, const char *name) {
+    for (size_t i = 0; i < mtxn->read_set_count; i++) {
+        if (strcmp(mtxn->read_sets[i].name, name) == 0) return &mtxn->read_sets[i];
+    }
+    return NULL;
+}
+
+static mem_read_set_t* get_or_create_read_set(mem_txn_t *mtxn, const char *name) {
+    mem_read_set_t *rs = find_read_set(mtxn, name);
+    if (rs) return rs;
+
+    if (mtxn->read_set_count == mtxn->read_set_capacity) {
+        size_t cap = mtxn->read_set_capacity ? mtxn->read_set_capacity * 2 : 8;
+        mem_read_set_t *grown = (mem_read_set_t*)realloc(mtxn->read_sets, cap * sizeof(*grown));
+        if (!grown) return NULL;
+        mtxn->read_sets = grown;
+        mtxn->read_set_capacity = cap;
+    }
+    rs = &mtxn->read_sets[mtxn->read_set_count];
+    memset(rs, 0, sizeof(*rs));
+    rs->name = strdup(name);
+    if (!rs->name) return NULL;
+    mtxn->read_set_count++;
+    return rs;
+}
+
+// Copy a key into read_keys; NO_KEY if out of memory
+static size_t copy_read_key(mem_txn_t *mtxn, const void *key, size_t size) {
+    if (mtxn->read_keys_size + size > mtxn->read_keys_capacity) {
+        size_t cap = mtxn->read_keys_capacity ? mtxn->read_keys_capacity * 2 : 1024;
+        while (cap < mtxn->read_keys_size + size) cap *= 2;
+        char *grown = (char*)realloc(mtxn->read_keys, cap);
+        if (!grown) return NO_KEY;
+        mtxn->read_keys = grown;
+        mtxn->read_keys_capacity = cap;
+    }
+    size_t off = mtxn->read_keys_size;
+    memcpy(mtxn->read_keys + off, key, size);
+    mtxn->read_keys_size += size;
+    return off;
+}
+
+// Record a read of [start, end] of a table (NULL = unbounded; the same
+// pointer for a single key). Sets *set and *read to where it went, if
+// given; a read that can't be recorded fails the commit instead.
+static void record_read(mem_txn_t *mtxn, const char *table_name,
+                        const void *start, size_t start_size,
+                        const void *end, size_t end_size, size_t *set, size_t *read) {
+    if (set) *set = NO_KEY;
+    if (mtxn->read_only) return;
+
+    mem_read_set_t *rs = get_or_create_read_set(mtxn, table_name);
+    if (rs && rs->count == rs->capacity) {
+        size_t cap = rs->capacity ? rs->capacity * 2 : 16;
+        mem_read_t *grown = (mem_read_t*)realloc(rs->reads, cap * sizeof(*grown));
+        if (grown) {
+            rs->reads = grown;
+            rs->capacity = cap;
+        } else {
+            rs = NULL;
+        }
+    }
+    if (!rs) {
+        mtxn->read_failed = true;
+        return;
+    }
+
+    mem_read_t r = { NO_KEY, 0, NO_KEY, 0 };
+    if (start) {
+        r.start = copy_read_key(mtxn, start, start_size);
+        r.start_size = start_size;
+    }
+    if (end == start) {
+        r.end = r.start;
+        r.end_size = r.start_size;
+    } else if (end) {
+        r.end = copy_read_key(mtxn, end, end_size);
+        r.end_size = end_size;
+    }
+    if ((start && r.start == NO_KEY) || (end && r.end == NO_KEY)) {
+        mtxn->read_failed = true;
+        return;
+    }
+    if (set) {
+        *set = (size_t)(rs - mtxn->read_sets);
+        *read = rs->count;
+    }
+    rs->reads[rs->count++] = r;
+}
+
+static void free_read_sets(mem_txn_t *mtxn) {
+    for (size_t i = 0; i < mtxn->read_set_count; i++) {
+        free(mtxn->read_sets[i].name);
+        free(mtxn->read_sets[i].reads);
+    }
+    free(mtxn->read_sets);
+    free(mtxn->read_keys);
+}
+
+// Whether a commit wrote into anything the transaction read
+static bool reads_conflict(mem_txn_t *mtxn, mem_commit_t *c) {
+    for (size_t t = 0; t < c->table_count; t++) {
+        mem_commit_table_t *ct = &c->tables[t];
+        mem_read_set_t *rs = find_read_set(mtxn, ct->name);
+        if (!rs || rs->count == 0) continue;
+        if (ct->dropped) return true;
+
+        for (size_t i = 0; i < rs->count; i++) {
+            mem_read_t *r = &rs->reads[i];
+            size_t lo = 0, hi = ct->count;
+            if (r->start != NO_KEY) {
+                const char *start = mtxn->read_keys + r->start;
+                while (lo < hi) {
+                    size_t mid = lo + (hi - lo) / 2;
+                    if (compare_keys(ct->keys[mid].data, ct->keys[mid].size,
+                                     start, r->start_size) < 0) lo = mid + 1;
+                    else hi = mid;
+                }
+            }
+            if (lo == ct->count) continue;
+            if (r->end == NO_KEY ||
+                compare_keys(ct->keys[lo].data, ct->keys[lo].size,
+                             mtxn->read_keys + r->end, r->end_size) <= 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void free_commit(mem_commit_t *c) {
+    for (size_t i = 0; i < c->table_count; i++) {
+        free(c->tables[i].name);
+        free(c->tables[i].keys);
+    }
+    free(c->tables);
+    for (size_t i = 0; i < c->retired_count; i++) free(c->retired[i]);
+    free(c->retired);
+    free(c);
+}
+
+// Record of the keys this commit writes, with room for everything it
+// replaces (so applying it can't fail for want of that room)
+static mem_commit_t* commit_record(mem_txn_t *mtxn) {
+    mem_commit_t *c = (mem_commit_t*)calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->tables = (mem_commit_table_t*)calloc(mtxn->pending_count ? mtxn->pending_count : 1,
+                                            sizeof(*c->tables));
+    size_t retire_max = 0;
+    for (size_t i = 0; c->tables && i < mtxn->pending_count; i++) {
+        mem_pending_t *p = &mtxn->pending[i];
+        mem_commit_table_t *ct = &c->tables[c->table_count];
+        kv_table_t *table = find_table(mtxn->db, p->name);
+        retire_max += 2 * p->count + (p->dropped && table ? 2 * table->count : 0);
+
+        size_t bytes = 0;
+        for (size_t j = 0; j < p->count; j++) bytes += slot_write(mtxn, p, j)->key_size;
+        ct->name = strdup(p->name);
+        ct->keys = (kvstore_val_t*)malloc(p->count * sizeof(kvstore_val_t) + bytes + 1);
+        if (!ct->name || !ct->keys) {
+            free(ct->name);
+            free(ct->keys);
+            free_commit(c);
+            return NULL;
+        }
+        char *data = (char*)(ct->keys + p->count);
+        for (size_t j = 0; j < p->count; j++) {
+            mem_write_t *w = slot_write(mtxn, p, j);
+            memcpy(data, w->key, w->key_size);
+            ct->keys[j].data = data;
+            ct->keys[j].size = w->key_size;
+            data += w->key_size;
+        }
+        ct->count = p->count;
+        ct->dropped = p->dropped;
+        c->table_count++;
+    }
+    c->retired = (void**)malloc((retire_max ? retire_max : 1) * sizeof(void*));
+    if (!c->tables || !c->retired) {
+        free_commit(c);
+        return NULL;
+    }
+    return c;
+}
+
+// Unregister a transaction and free the commit records no open
+// transaction began before. Call with txn_lock held.
+static void end_txn(mem_txn_t *mtxn) {
+    mem_db_t *db = mtxn->db;
+    if (mtxn->prev_active) mtxn->prev_active->next_active = mtxn->next_active;
+    else db->active = mtxn->next_active;
+    if (mtxn->next_active) mtxn->next_active->prev_active = mtxn->prev_active;
+    db->active_count--;
+
+    uint64_t oldest = db->seq;
+    for (mem_txn_t *t = db->active; t; t = t->next_active) {
+        if (t->begin_seq < oldest) oldest = t->begin_seq;
+    }
+    while (db->commits && db->commits->seq <= oldest) {
+        mem_commit_t *c = db->commits;
+        db->commits = c->next;
+        free_commit(c);
+    }
+    if (!db->commits) db->commits_tail = NULL;
+}
+
+// A table a commit latches: exclusively if it writes it, shared if it
+// only read it (so no other commit changes it between validation and
+// apply)
+typedef struct {
+    kv_table_t *table;
+    bool write;
+} mem_latch_t;
+
+static int compare_latches(const void *a, const void *b) {
+    return strcmp(((const mem_latch_t*)a)->table->name, ((const mem_latch_t*)b)->table->name);
+}
+
+// Whether applying the write-set creates or removes a table
+static bool commit_changes_dir(mem_txn_t *mtxn) {
+    for (size_t i = 0; i < mtxn->pending_count; i++) {
+        mem_pending_t *p = &mtxn->pending[i];
+        bool exists = find_table(mtxn->db, p->name) != NULL;
+        if (exists ? p->dropped && p->count == 0 : p->count > 0) return true;
+    }
+    return false;
+}
+
+// Latch the tables the transaction read or writes, in name order so that
+// concurrent commits can't deadlock. Call with dir_lock held shared.
+static mem_latch_t* latch_tables(mem_txn_t *mtxn, size_t *count) {
+    size_t max = mtxn->pending_count + mtxn->read_set_count;
+    mem_latch_t *latches = (mem_latch_t*)malloc((max ? max : 1) * sizeof(mem_latch_t));
+    if (!latches) return NULL;
+
+    size_t n = 0;
+    for (size_t i = 0; i < mtxn->pending_count; i++) {
+        kv_table_t *table = find_table(mtxn->db, mtxn->pending[i].name);
+        if (table) latches[n++] = (mem_latch_t){ table, true };
+    }
+    for (size_t i = 0; i < mtxn->read_set_count; i++) {
+        if (find_pending(mtxn, mtxn->read_sets[i].name)) continue;
+        kv_table_t *table = find_table(mtxn->db, mtxn->read_sets[i].name);
+        if (table) latches[n++] = (mem_latch_t){ table, false };
+    }
+    qsort(latches, n, sizeof(mem_latch_t), compare_latches);
+
+    for (size_t i = 0; i < n; i++) {
+        if (latches[i].write) pthread_rwlock_wrlock(&latches[i].table->latch);
+        else pthread_rwlock_rdlock(&latches[i].table->latch);
+    }
+    *count = n;
+    return latches;
+}
+
+static void unlatch_tables(mem_latch_t *latches, size_t count) {
+    for (size_t i = count; i-- > 0;) pthread_rwlock_unlock(&latches[i].table->latch);
+    free(latches);
+}
+
 // ------------------------
 // Backend operations
 // ------------------------
@@ -129,6 +1148,10 @@ static int mem_open(kvstore_t *db, const char *path) {
 
     mem_db_t *mdb = (mem_db_t*)calloc(1, sizeof(mem_db_t));
     if (!mdb) return KVSTORE_ERROR;
+    pthread_rwlock_init(&mdb->dir_lock, NULL);
+    pthread_mutex_init(&mdb->txn_lock, NULL);
+    mdb->apply_threads = 1;
+    mdb->parallel_min_writes = PARALLEL_MIN_WRITES;
 
     db->backend_handle = mdb;
     return KVSTORE_OK;
@@ -140,15 +1163,20 @@ static void mem_close(kvstore_t *db) {
 
     // Free all tables
     for (size_t i = 0; i < mdb->table_count; i++) {
-        kv_table_t *table = &mdb->tables[i];
-        for (size_t j = 0; j < table->count; j++) {
-            free(table->pairs[j].key);
-            free(table->pairs[j].val);
-        }
-        free(table->pairs);
+        kv_table_t *table = mdb->tables[i];
+        free_table_pairs(table);
+        pthread_rwlock_destroy(&table->latch);
         free(table->name);
+        free(table);
     }
     free(mdb->tables);
+    while (mdb->commits) {
+        mem_commit_t *c = mdb->commits;
+        mdb->commits = c->next;
+        free_commit(c);
+    }
+    pthread_rwlock_destroy(&mdb->dir_lock);
+    pthread_mutex_destroy(&mdb->txn_lock);
     free(mdb);
 
     db->backend_handle = NULL;
@@ -158,8 +1186,18 @@ static int mem_txn_begin(kvstore_t *db, kvstore_txn_t *txn, bool read_only) {
     mem_txn_t *mtxn = (mem_txn_t*)calloc(1, sizeof(mem_txn_t));
     if (!mtxn) return KVSTORE_ERROR;
 
-    mtxn->db = (mem_db_t*)db->backend_handle;
+    mem_db_t *mdb = (mem_db_t*)db->backend_handle;
+    mtxn->db = mdb;
     mtxn->committed = false;
+    mtxn->read_only = read_only;
+
+    pthread_mutex_lock(&mdb->txn_lock);
+    mtxn->begin_seq = mdb->seq;
+    mtxn->next_active = mdb->active;
+    if (mdb->active) mdb->active->prev_active = mtxn;
+    mdb->active = mtxn;
+    mdb->active_count++;
+    pthread_mutex_unlock(&mdb->txn_lock);
 
     txn->backend_txn = mtxn;
     txn->read_only = read_only;
@@ -167,24 +1205,90 @@ static int mem_txn_begin(kvstore_t *db, kvstore_txn_t *txn, bool read_only) {
     return KVSTORE_OK;
 }
 
+// Validate, then apply, holding the latches of every table involved
+// throughout, so no other commit to them can slip in between. Commits to
+// disjoint tables run in parallel. Creating or removing a table takes
+// dir_lock exclusively instead, which covers every table.
 static int mem_txn_commit(kvstore_txn_t *txn) {
     mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
     if (!mtxn) return KVSTORE_ERROR;
+    mem_db_t *db = mtxn->db;
+
+    int rc = KVSTORE_OK;
+    if (mtxn->pending_count == 0) {
+        // Nothing to validate: reads alone are never out of date
+        pthread_mutex_lock(&db->txn_lock);
+        end_txn(mtxn);
+        pthread_mutex_unlock(&db->txn_lock);
+    } else {
+        pthread_rwlock_rdlock(&db->dir_lock);
+        bool exclusive = commit_changes_dir(mtxn);
+        if (exclusive) {
+            pthread_rwlock_unlock(&db->dir_lock);
+            pthread_rwlock_wrlock(&db->dir_lock);
+        }
+        mem_latch_t *latches = NULL;
+        size_t nlatches = 0;
+        if (!exclusive) {
+            latches = latch_tables(mtxn, &nlatches);
+            if (!latches) rc = KVSTORE_ERROR;
+        }
 
-    mtxn->committed = true;
+        pthread_mutex_lock(&db->txn_lock);
+        if (mtxn->read_failed) rc = KVSTORE_ERROR;
+        for (mem_commit_t *c = db->commits; rc == KVSTORE_OK && c; c = c->next) {
+            if (c->seq > mtxn->begin_seq && reads_conflict(mtxn, c)) rc = KVSTORE_CONFLICT;
+        }
+        bool others = db->active_count > 1;
+        pthread_mutex_unlock(&db->txn_lock);
+
+        // Other open transactions may validate against this commit, or hold
+        // pointers to what it replaces
+        mem_commit_t *record = NULL;
+        if (rc == KVSTORE_OK && others) {
+            record = commit_record(mtxn);
+            if (!record) rc = KVSTORE_ERROR;
+        }
+
+        bool applied = rc == KVSTORE_OK;
+        if (applied) rc = apply_write_sets(mtxn, record);
+
+        pthread_mutex_lock(&db->txn_lock);
+        if (applied) {
+            db->seq++;
+            if (record) {
+                record->seq = db->seq;
+                if (db->commits_tail) db->commits_tail->next = record;
+                else db->commits = record;
+                db->commits_tail = record;
+            }
+        }
+        end_txn(mtxn);
+        pthread_mutex_unlock(&db->txn_lock);
+        if (latches) unlatch_tables(latches, nlatches);
+        pthread_rwlock_unlock(&db->dir_lock);
+    }
+
+    mtxn->committed = rc == KVSTORE_OK;
+    free_write_set(mtxn);
+    free_read_sets(mtxn);
     free(mtxn);
     txn->backend_txn = NULL;
 
-    return KVSTORE_OK;
+    return rc;
 }
 
 static void mem_txn_abort(kvstore_txn_t *txn) {
     mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
     if (!mtxn) return;
 
-    // Simple implementation: can't rollback (changes already applied)
-    // Real implementation would buffer changes
+    pthread_mutex_lock(&mtxn->db->txn_lock);
+    end_txn(mtxn);
+    pthread_mutex_unlock(&mtxn->db->txn_lock);
 
+    // Nothing reached the tables: drop the write-set
+    free_write_set(mtxn);
+    free_read_sets(mtxn);
     free(mtxn);
     txn->backend_txn = NULL;
 }
@@ -194,46 +1298,7 @@ static int mem_put(kvstore_txn_t *txn, const char *table_name,
     mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
     if (!mtxn) return KVSTORE_ERROR;
 
-    kv_table_t *table = get_or_create_table(mtxn->db, table_name);
-
-    // Find existing or insertion point
-    ssize_t idx = find_insert_pos(table, key->data, key->size);
-    bool exists = (idx >= 0 && idx < (ssize_t)table->count &&
-                   compare_keys(key->data, key->size,
-                               table->pairs[idx].key, table->pairs[idx].key_size) == 0);
-
-    if (exists) {
-        // Update existing
-        free(table->pairs[idx].val);
-        table->pairs[idx].val = malloc(val->size);
-        memcpy(table->pairs[idx].val, val->data, val->size);
-        table->pairs[idx].val_size = val->size;
-    } else {
-        // Insert new
-        if (table->count >= table->capacity) {
-            table->capacity = table->capacity ? table->capacity * 2 : 16;
-            table->pairs = (kv_pair_t*)realloc(table->pairs,
-                                               table->capacity * sizeof(kv_pair_t));
-        }
-
-        // Shift elements
-        for (ssize_t i = table->count; i > idx; i--) {
-            table->pairs[i] = table->pairs[i-1];
-        }
-
-        // Insert at position
-        table->pairs[idx].key = malloc(key->size);
-        memcpy(table->pairs[idx].key, key->data, key->size);
-        table->pairs[idx].key_size = key->size;
-
-        table->pairs[idx].val = malloc(val->size);
-        memcpy(table->pairs[idx].val, val->data, val->size);
-        table->pairs[idx].val_size = val->size;
-
-        table->count++;
-    }
-
-    return KVSTORE_OK;
+    return buffer_write(mtxn, table_name, key, val, 0) ? KVSTORE_OK : KVSTORE_ERROR;
 }
 
 static int mem_get(kvstore_txn_t *txn, const char *table_name,
@@ -241,16 +1306,29 @@ static int mem_get(kvstore_txn_t *txn, const char *table_name,
     mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
     if (!mtxn) return KVSTORE_ERROR;
 
-    kv_table_t *table = find_table(mtxn->db, table_name);
-    if (!table) return KVSTORE_NOTFOUND;
-
-    ssize_t idx = find_key_index(table, key->data, key->size);
-    if (idx < 0) return KVSTORE_NOTFOUND;
+    mem_pending_t *p = find_pending(mtxn, table_name);
+    mem_write_t *w = pending_write(mtxn, p, key->data, key->size);
+    if (w) {
+        if (!w->val) return KVSTORE_NOTFOUND;
+        val_out->data = w->val;
+        val_out->size = w->val_size;
+        return KVSTORE_OK;
+    }
 
-    val_out->data = table->pairs[idx].val;
-    val_out->size = table->pairs[idx].val_size;
+    // Values stay valid until the transaction ends, even if a concurrent
+    // commit replaces them
+    kv_table_t *table = read_table(mtxn->db, table_name);
+    kv_pair_t *pair = committed_pair(p, table, key->data, key->size);
+    if (pair) {
+        val_out->data = pair->val;
+        val_out->size = pair->val_size;
+    }
+    read_done(mtxn->db, table);
+    if (!(p && p->dropped)) {
+        record_read(mtxn, table_name, key->data, key->size, key->data, key->size, NULL, NULL);
+    }
 
-    return KVSTORE_OK;
+    return pair ? KVSTORE_OK : KVSTORE_NOTFOUND;
 }
 
 static int mem_del(kvstore_txn_t *txn, const char *table_name,
@@ -258,24 +1336,133 @@ static int mem_del(kvstore_txn_t *txn, const char *table_name,
     mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
     if (!mtxn) return KVSTORE_ERROR;
 
-    kv_table_t *table = find_table(mtxn->db, table_name);
-    if (!table) return KVSTORE_NOTFOUND;
+    mem_pending_t *p = find_pending(mtxn, table_name);
+    mem_write_t *w = pending_write(mtxn, p, key->data, key->size);
+    bool exists;
+    if (w) {
+        exists = w->val != NULL;
+    } else {
+        kv_table_t *table = read_table(mtxn->db, table_name);
+        exists = committed_pair(p, table, key->data, key->size) != NULL;
+        read_done(mtxn->db, table);
+        if (!(p && p->dropped)) {
+            record_read(mtxn, table_name, key->data, key->size, key->data, key->size, NULL, NULL);
+        }
+    }
+    if (!exists) return KVSTORE_NOTFOUND;
+
+    return buffer_write(mtxn, table_name, key, NULL, 0) ? KVSTORE_OK : KVSTORE_ERROR;
+}
+
+// ------------------------
+// Cursors
+// ------------------------
 
-    ssize_t idx = find_key_index(table, key->data, key->size);
-    if (idx < 0) return KVSTORE_NOTFOUND;
+// Cursors merge the table's committed keys with the transaction's write-set,
+// which wins on equal keys; buffered deletes hide keys. They re-seek from
+// their current key after the transaction's own writes or a commit to the
+// table, and record the range they covered, from the start key to where
+// they stopped. Each operation holds the table's latch via cursor_lock().
 
-    // Free memory
-    free(table->pairs[idx].key);
-    free(table->pairs[idx].val);
+static mem_pending_t* cursor_pending(mem_cursor_t *mcur) {
+    return mcur->pending == NO_PENDING ? NULL : &mcur->txn->pending[mcur->pending];
+}
 
-    // Shift elements
-    for (size_t i = idx; i < table->count - 1; i++) {
-        table->pairs[i] = table->pairs[i+1];
+static kv_table_t* cursor_table(mem_cursor_t *mcur) {
+    mem_pending_t *p = cursor_pending(mcur);
+    return p && p->dropped ? NULL : mcur->table;
+}
+
+// Move to the first visible key at or after the current positions
+static void cursor_settle(kvstore_cursor_t *cur) {
+    mem_cursor_t *mcur = (mem_cursor_t*)cur->backend_cursor;
+    kv_table_t *table = cursor_table(mcur);
+    mem_pending_t *p = cursor_pending(mcur);
+
+    for (;;) {
+        kv_pair_t *pair = table && mcur->index < table->count ? &table->pairs[mcur->index] : NULL;
+        mem_write_t *w = p && mcur->pindex < p->count ? slot_write(mcur->txn, p, mcur->pindex) : NULL;
+        if (!pair && !w) {
+            cur->valid = false;
+            return;
+        }
+
+        int cmp = !w ? 1 : !pair ? -1 :
+                  compare_keys(w->key, w->key_size, pair->key, pair->key_size);
+        if (cmp <= 0 && !w->val) {
+            // Buffered delete
+            mcur->pindex++;
+            if (cmp == 0) mcur->index++;
+            continue;
+        }
+
+        mcur->from_pending = cmp <= 0;
+        mcur->shadows = cmp == 0;
+        const void *key = mcur->from_pending ? w->key : pair->key;
+        size_t key_size = mcur->from_pending ? w->key_size : pair->key_size;
+        if (key_size > mcur->key_capacity) {
+            void *grown = realloc(mcur->key, key_size);
+            if (!grown) {
+                cur->valid = false;
+                return;
+            }
+            mcur->key = grown;
+            mcur->key_capacity = key_size;
+        }
+        memcpy(mcur->key, key, key_size);
+        mcur->key_size = key_size;
+        cur->valid = true;
+        return;
     }
+}
 
-    table->count--;
+// Position at the first key at or after (after: past) the current key,
+// once writes may have moved the write-set under the cursor
+static void cursor_reseek(kvstore_cursor_t *cur, bool after) {
+    mem_cursor_t *mcur = (mem_cursor_t*)cur->backend_cursor;
+    mcur->version = mcur->txn->version;
+    mcur->table_version = mcur->table ? mcur->table->version : 0;
+    if (mcur->pending == NO_PENDING) {
+        mem_pending_t *p = find_pending(mcur->txn, cur->table);
+        if (p) mcur->pending = (size_t)(p - mcur->txn->pending);
+    }
 
-    return KVSTORE_OK;
+    kv_table_t *table = cursor_table(mcur);
+    if (table) {
+        mcur->index = after ? find_after(table, mcur->key, mcur->key_size)
+                            : (size_t)find_insert_pos(table, mcur->key, mcur->key_size);
+    }
+    mem_pending_t *p = cursor_pending(mcur);
+    if (p) {
+        bool found;
+        mcur->pindex = pending_search(mcur->txn, p, mcur->key, mcur->key_size, &found);
+        if (found && after) mcur->pindex++;
+    }
+    cursor_settle(cur);
+}
+
+// Latch the cursor's table shared, looking it up again if tables were
+// created or removed since
+static void cursor_lock(kvstore_cursor_t *cur) {
+    mem_cursor_t *mcur = (mem_cursor_t*)cur->backend_cursor;
+    mem_db_t *db = mcur->txn->db;
+    pthread_rwlock_rdlock(&db->dir_lock);
+    if (mcur->dir_version != db->dir_version) {
+        mcur->dir_version = db->dir_version;
+        mcur->table = find_table(db, cur->table);
+        mcur->table_version = MOVED;
+    }
+    if (mcur->table) pthread_rwlock_rdlock(&mcur->table->latch);
+}
+
+static void cursor_unlock(kvstore_cursor_t *cur) {
+    mem_cursor_t *mcur = (mem_cursor_t*)cur->backend_cursor;
+    read_done(mcur->txn->db, mcur->table);
+}
+
+static bool cursor_stale(mem_cursor_t *mcur) {
+    return mcur->version != mcur->txn->version ||
+           mcur->table_version != (mcur->table ? mcur->table->version : 0);
 }
 
 static int mem_cursor_open(kvstore_txn_t *txn, kvstore_cursor_t *cur,
@@ -283,22 +1470,43 @@ static int mem_cursor_open(kvstore_txn_t *txn, kvstore_cursor_t *cur,
     mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
     if (!mtxn) return KVSTORE_ERROR;
 
-    kv_table_t *table = find_table(mtxn->db, table_name);
-    if (!table) return KVSTORE_NOTFOUND;
-
-    mem_cursor_t *mcur = (mem_cursor_t*)calloc(1, sizeof(mem_cursor_t));
+    // A missing table is a read too: a concurrent commit may create it
+    size_t read_set, read;
+    record_read(mtxn, table_name, start_key ? start_key->data : NULL,
+                start_key ? start_key->size : 0, NULL, 0, &read_set, &read);
+
+    kv_table_t *table = read_table(mtxn->db, table_name);
+    mem_pending_t *p = find_pending(mtxn, table_name);
+    mem_cursor_t *mcur = table || p ? (mem_cursor_t*)calloc(1, sizeof(mem_cursor_t)) : NULL;
+    char *name = mcur ? strdup(table_name) : NULL;
+    if (!name) {
+        read_done(mtxn->db, table);
+        free(mcur);
+        return table || p ? KVSTORE_ERROR : KVSTORE_NOTFOUND;
+    }
+    mcur->txn = mtxn;
     mcur->table = table;
+    mcur->pending = p ? (size_t)(p - mtxn->pending) : NO_PENDING;
+    mcur->version = mtxn->version;
+    mcur->dir_version = mtxn->db->dir_version;
+    mcur->table_version = table ? table->version : 0;
+    mcur->read_set = read_set;
+    mcur->read = read;
+
+    cur->backend_cursor = mcur;
+    cur->table = name;
 
     if (start_key) {
         // Find first key >= start_key
-        mcur->index = (size_t)find_insert_pos(table, start_key->data, start_key->size);
-    } else {
-        mcur->index = 0;
+        kv_table_t *visible = cursor_table(mcur);
+        if (visible) mcur->index = (size_t)find_insert_pos(visible, start_key->data, start_key->size);
+        if (p) {
+            bool found;
+            mcur->pindex = pending_search(mtxn, p, start_key->data, start_key->size, &found);
+        }
     }
-
-    cur->backend_cursor = mcur;
-    cur->table = strdup(table_name);
-    cur->valid = (mcur->index < table->count);
+    cursor_settle(cur);
+    read_done(mtxn->db, table);
 
     return KVSTORE_OK;
 }
@@ -306,20 +1514,36 @@ static int mem_cursor_open(kvstore_txn_t *txn, kvstore_cursor_t *cur,
 static int mem_cursor_get(kvstore_cursor_t *cur,
                           kvstore_val_t *key_out, kvstore_val_t *val_out) {
     mem_cursor_t *mcur = (mem_cursor_t*)cur->backend_cursor;
-    if (!mcur || !cur->valid) return KVSTORE_ERROR;
+    if (!mcur) return KVSTORE_ERROR;
 
-    if (mcur->index >= mcur->table->count) return KVSTORE_NOTFOUND;
+    cursor_lock(cur);
+    if (cur->valid && cursor_stale(mcur)) cursor_reseek(cur, false);
+    if (!cur->valid) {
+        cursor_unlock(cur);
+        return KVSTORE_NOTFOUND;
+    }
 
-    kv_pair_t *pair = &mcur->table->pairs[mcur->index];
+    const void *key, *val;
+    size_t key_size, val_size;
+    if (mcur->from_pending) {
+        mem_write_t *w = slot_write(mcur->txn, cursor_pending(mcur), mcur->pindex);
+        key = w->key, key_size = w->key_size;
+        val = w->val, val_size = w->val_size;
+    } else {
+        kv_pair_t *pair = &mcur->table->pairs[mcur->index];
+        key = pair->key, key_size = pair->key_size;
+        val = pair->val, val_size = pair->val_size;
+    }
+    cursor_unlock(cur);
 
     if (key_out) {
-        key_out->data = pair->key;
-        key_out->size = pair->key_size;
+        key_out->data = (void*)key;
+        key_out->size = key_size;
     }
 
     if (val_out) {
-        val_out->data = pair->val;
-        val_out->size = pair->val_size;
+        val_out->data = (void*)val;
+        val_out->size = val_size;
     }
 
     return KVSTORE_OK;
@@ -328,16 +1552,37 @@ static int mem_cursor_get(kvstore_cursor_t *cur,
 static int mem_cursor_next(kvstore_cursor_t *cur) {
     mem_cursor_t *mcur = (mem_cursor_t*)cur->backend_cursor;
     if (!mcur) return KVSTORE_ERROR;
+    if (!cur->valid) return KVSTORE_NOTFOUND;
 
-    mcur->index++;
-    cur->valid = (mcur->index < mcur->table->count);
+    cursor_lock(cur);
+    if (cursor_stale(mcur)) {
+        cursor_reseek(cur, true);
+    } else {
+        if (mcur->from_pending) mcur->pindex++;
+        if (!mcur->from_pending || mcur->shadows) mcur->index++;
+        cursor_settle(cur);
+    }
+    cursor_unlock(cur);
 
     return cur->valid ? KVSTORE_OK : KVSTORE_NOTFOUND;
 }
 
 static void mem_cursor_close(kvstore_cursor_t *cur) {
-    if (cur->backend_cursor) {
-        free(cur->backend_cursor);
+    mem_cursor_t *mcur = (mem_cursor_t*)cur->backend_cursor;
+    if (mcur) {
+        // The range read ends at the key the cursor stopped on; one that ran
+        // off the end covered the rest of the table
+        if (mcur->read_set != NO_KEY && cur->valid) {
+            mem_txn_t *mtxn = mcur->txn;
+            size_t off = copy_read_key(mtxn, mcur->key, mcur->key_size);
+            mem_read_t *r = &mtxn->read_sets[mcur->read_set].reads[mcur->read];
+            if (off != NO_KEY) {
+                r->end = off;
+                r->end_size = mcur->key_size;
+            }
+        }
+        free(mcur->key);
+        free(mcur);
         cur->backend_cursor = NULL;
     }
     if (cur->table) {
@@ -347,6 +1592,196 @@ static void mem_cursor_close(kvstore_cursor_t *cur) {
     cur->valid = false;
 }
 
+// ------------------------
+// Optional operations
+// ------------------------
+
+// Forget the table's buffered writes and drop its committed keys at commit
+// (which frees the arrays instead of shifting them once per key)
+static int mem_drop_table(kvstore_txn_t *txn, const char *table_name) {
+    mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
+    if (!mtxn) return KVSTORE_ERROR;
+
+    // Whether there is anything to drop depends on the whole table
+    mem_pending_t *p = find_pending(mtxn, table_name);
+    bool exists = false;
+    if (!(p && p->dropped)) {
+        kv_table_t *table = read_table(mtxn->db, table_name);
+        exists = table != NULL;
+        read_done(mtxn->db, table);
+        record_read(mtxn, table_name, NULL, 0, NULL, 0, NULL, NULL);
+    }
+    for (size_t i = 0; !exists && p && i < p->count; i++) {
+        exists = slot_write(mtxn, p, i)->val != NULL;
+    }
+    if (!exists) return KVSTORE_NOTFOUND;
+
+    // Move the write-set aside, so a rollback can restore it
+    p = get_or_create_pending(mtxn, table_name);
+    mem_dropped_t *d = p ? (mem_dropped_t*)malloc(sizeof(*d)) : NULL;
+    mem_write_t *w = d ? log_append(mtxn) : NULL;
+    if (!w) {
+        free(d);
+        return KVSTORE_ERROR;
+    }
+    d->slots = p->slots;
+    d->count = p->count;
+    d->capacity = p->capacity;
+    d->dropped = p->dropped;
+    w->pending = (size_t)(p - mtxn->pending);
+    w->prev = NO_WRITE;
+    w->val = d;
+    p->slots = NULL;
+    p->count = p->capacity = 0;
+    p->dropped = true;
+    mtxn->issued++;
+    mtxn->version++;
+    return KVSTORE_OK;
+}
+
+// Apply the operator to the buffered value itself: no copy, and no
+// reallocation except to grow it for an append. The first merge to a
+// committed key, or to one last written before a savepoint, copies its
+// value into the write-set.
+static int mem_merge(kvstore_txn_t *txn, const char *table_name,
+                     kvstore_val_t *key, const kvstore_merge_t *op) {
+    mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
+    if (!mtxn) return KVSTORE_ERROR;
+
+    size_t extra = op->kind == KVSTORE_MERGE_APPEND ? op->data.size : 0;
+    mem_pending_t *p = find_pending(mtxn, table_name);
+    mem_write_t *w = pending_write(mtxn, p, key->data, key->size);
+    if (w && (size_t)(w - mtxn->log) < savepoint_mark(mtxn)) {
+        if (!w->val) return KVSTORE_NOTFOUND;
+        kvstore_val_t val = { w->val, w->val_size };
+        w = buffer_write(mtxn, table_name, key, &val, extra);
+        if (!w) return KVSTORE_ERROR;
+    } else if (w) {
+        if (!w->val) return KVSTORE_NOTFOUND;
+        if (extra) {
+            void *grown = realloc(w->val, w->val_size + extra);
+            if (!grown) return KVSTORE_ERROR;
+            w->val = grown;
+        }
+        mtxn->issued++;
+    } else {
+        kv_table_t *table = read_table(mtxn->db, table_name);
+        kv_pair_t *pair = committed_pair(p, table, key->data, key->size);
+        kvstore_val_t val = { pair ? pair->val : NULL, pair ? pair->val_size : 0 };
+        w = pair ? buffer_write(mtxn, table_name, key, &val, extra) : NULL;
+        read_done(mtxn->db, table);
+        if (!(p && p->dropped)) {
+            record_read(mtxn, table_name, key->data, key->size, key->data, key->size, NULL, NULL);
+        }
+        if (!pair) return KVSTORE_NOTFOUND;
+        if (!w) return KVSTORE_ERROR;
+    }
+
+    size_t size = kvstore_merge_apply(op, w->val, w->val_size);
+    if (!size) return KVSTORE_ERROR;
+    w->val_size = size;
+
+    return KVSTORE_OK;
+}
+
+// Split at evenly spaced positions of the committed keys within
+// [start, end); buffered writes don't move the split points
+static int mem_split_points(kvstore_txn_t *txn, const char *table_name,
+                            kvstore_val_t *start, kvstore_val_t *end,
+                            kvstore_val_t *splits_out, size_t *nsplits) {
+    mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
+    if (!mtxn) return KVSTORE_ERROR;
+
+    size_t max = *nsplits;
+    *nsplits = 0;
+
+    kv_table_t *table = read_table(mtxn->db, table_name);
+    if (!table) {
+        read_done(mtxn->db, table);
+        return KVSTORE_NOTFOUND;
+    }
+
+    size_t lo = start ? (size_t)find_insert_pos(table, start->data, start->size) : 0;
+    size_t hi = end ? (size_t)find_insert_pos(table, end->data, end->size) : table->count;
+    if (hi < lo) hi = lo;
+
+    size_t n = hi - lo;
+    size_t prev = lo;
+    for (size_t k = 1; k <= max; k++) {
+        size_t idx = lo + n * k / (max + 1);
+        if (idx <= prev || idx >= hi) continue;
+        splits_out[*nsplits].data = table->pairs[idx].key;
+        splits_out[*nsplits].size = table->pairs[idx].key_size;
+        (*nsplits)++;
+        prev = idx;
+    }
+    read_done(mtxn->db, table);
+
+    return KVSTORE_OK;
+}
+
+// Count what commit would apply, as apply_write_sets() decides it
+static int mem_txn_stats(kvstore_txn_t *txn, kvstore_txn_stats_t *out) {
+    mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
+    if (!mtxn) return KVSTORE_ERROR;
+
+    memset(out, 0, sizeof(*out));
+    out->issued = mtxn->issued;
+    for (size_t i = 0; i < mtxn->pending_count; i++) {
+        mem_pending_t *p = &mtxn->pending[i];
+        kv_table_t *latched = read_table(mtxn->db, p->name), *table = latched;
+        if (p->dropped && table) {
+            out->applied += table->count;
+            table = NULL;
+        }
+        out->buffered += p->count;
+        for (size_t j = 0; j < p->count; j++) {
+            mem_write_t *w = slot_write(mtxn, p, j);
+            ssize_t idx = table ? find_key_index(table, w->key, w->key_size) : -1;
+            if (write_applies(w, idx < 0 ? NULL : &table->pairs[idx])) out->applied++;
+        }
+        read_done(mtxn->db, latched);
+    }
+
+    return KVSTORE_OK;
+}
+
+// Savepoints: a marker on the log. Only writes after it are undone, so the
+// cost of a rollback is the number of writes it discards.
+static int mem_savepoint(kvstore_txn_t *txn, size_t *id) {
+    mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
+    if (!mtxn) return KVSTORE_ERROR;
+
+    if (mtxn->savepoint_count == mtxn->savepoint_capacity) {
+        size_t cap = mtxn->savepoint_capacity ? mtxn->savepoint_capacity * 2 : 8;
+        size_t *grown = (size_t*)realloc(mtxn->savepoints, cap * sizeof(size_t));
+        if (!grown) return KVSTORE_ERROR;
+        mtxn->savepoints = grown;
+        mtxn->savepoint_capacity = cap;
+    }
+    *id = mtxn->savepoint_count;
+    mtxn->savepoints[mtxn->savepoint_count++] = mtxn->log_count;
+    return KVSTORE_OK;
+}
+
+static int mem_rollback_to(kvstore_txn_t *txn, size_t id) {
+    mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
+    if (!mtxn || id >= mtxn->savepoint_count) return KVSTORE_ERROR;
+
+    mtxn->savepoint_count = id + 1;
+    rollback_log(mtxn, mtxn->savepoints[id]);
+    return KVSTORE_OK;
+}
+
+// Writes since the savepoint stay, and may again be changed in place
+static int mem_release(kvstore_txn_t *txn, size_t id) {
+    mem_txn_t *mtxn = (mem_txn_t*)txn->backend_txn;
+    if (!mtxn || id >= mtxn->savepoint_count) return KVSTORE_ERROR;
+
+    mtxn->savepoint_count = id;
+    return KVSTORE_OK;
+}
+
 // ------------------------
 // Ops vtable
 // ------------------------
@@ -364,8 +1799,25 @@ static const struct kvstore_ops mem_ops = {
     .cursor_get = mem_cursor_get,
     .cursor_next = mem_cursor_next,
     .cursor_close = mem_cursor_close,
+    .split_points = mem_split_points,
+    .drop_table = mem_drop_table,
+    .merge = mem_merge,
+    .txn_stats = mem_txn_stats,
+    .savepoint = mem_savepoint,
+    .rollback_to = mem_rollback_to,
+    .release = mem_release,
 };
 
 const struct kvstore_ops* kvstore_mem_ops(void) {
     return &mem_ops;
 }
+
+kvstore_t* kvstore_open_mem_opts(const kvstore_mem_opts_t *opts) {
+    kvstore_t *db = kvstore_open(":memory:", &mem_ops);
+    if (!db || !opts) return db;
+
+    mem_db_t *mdb = (mem_db_t*)db->backend_handle;
+    mdb->apply_threads = opts->apply_threads ? opts->apply_threads : 1;
+    if (opts->parallel_min_writes) mdb->parallel_min_writes = opts->parallel_min_writes;
+    return db;
+}
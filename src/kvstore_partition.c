@@ -0,0 +1,281 @@
+// Time-bucket partitions: bucket tables, their registry and cursors that
+// stitch buckets together in time order
+
+#include "../include/kvstore_backend.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ------------------------
+// Bucket ranges and names
+// ------------------------
+
+// Registry entries in table "": BUCKET_REGISTRY + table name ->
+// start:8 end:8 (big-endian int64_t seconds). Names sort in time order.
+#define BUCKET_REGISTRY "kv_bucket:"
+#define BUCKET_PREFIX_MAX 48
+
+// Days since 1970-01-01 of a Gregorian date, and back
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void civil_from_days(int64_t z, int64_t *y, unsigned *m, unsigned *d) {
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b < 0) ? q - 1 : q;
+}
+
+static int bucket_range(int64_t sec, int64_t width, int64_t *start, int64_t *end) {
+    if (width == KVSTORE_BUCKET_MONTH) {
+        int64_t y;
+        unsigned m, d;
+        civil_from_days(floor_div(sec, 86400), &y, &m, &d);
+        *start = days_from_civil(y, m, 1) * 86400;
+        *end = days_from_civil(m == 12 ? y + 1 : y, m == 12 ? 1 : m + 1, 1) * 86400;
+        return KVSTORE_OK;
+    }
+    if (width < 0) return KVSTORE_ERROR;
+    *start = floor_div(sec, width) * width;
+    *end = *start + width;
+    return KVSTORE_OK;
+}
+
+static int bucket_name(const char *table_prefix, int64_t start, char *name) {
+    int64_t y;
+    unsigned m, d;
+    int64_t days = floor_div(start, 86400);
+    int64_t secs = start - days * 86400;
+    civil_from_days(days, &y, &m, &d);
+    if (y < 0 || y > 9999 || strlen(table_prefix) > BUCKET_PREFIX_MAX) return KVSTORE_ERROR;
+
+    snprintf(name, KVSTORE_BUCKET_NAME_MAX, "%s%04d%02u%02u%02u%02u%02u", table_prefix,
+             (int)y, m, d, (unsigned)(secs / 3600), (unsigned)(secs / 60 % 60),
+             (unsigned)(secs % 60));
+    return KVSTORE_OK;
+}
+
+// Registry key for a bucket table (route cleared: the registry is in "")
+static kvstore_val_t registry_key(const char *table, char *buf) {
+    size_t len = strlen(BUCKET_REGISTRY), name_len = strlen(table);
+    memcpy(buf, BUCKET_REGISTRY, len);
+    memcpy(buf + len, table, name_len);
+    return (kvstore_val_t){ buf, len + name_len };
+}
+
+int kvstore_bucket_table(kvstore_txn_t *txn, const char *table_prefix,
+                         int64_t sec, int64_t width, bool create, char *name_out) {
+    int64_t range[2];
+    if (bucket_range(sec, width, &range[0], &range[1]) != KVSTORE_OK ||
+        bucket_name(table_prefix, range[0], name_out) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+    if (!create) return KVSTORE_OK;
+
+    char buf[sizeof(BUCKET_REGISTRY) + KVSTORE_BUCKET_NAME_MAX];
+    kvstore_val_t key = registry_key(name_out, buf), val;
+    const char *saved = kvstore_txn_route(txn, NULL);
+    int rc = kvstore_txn_get(txn, "", &key, &val);
+    if (rc == KVSTORE_NOTFOUND) {
+        char enc[16], *p = enc;
+        SER_WRITE_U64(p, range[0]);
+        SER_WRITE_U64(p, range[1]);
+        val = (kvstore_val_t){ enc, sizeof(enc) };
+        rc = kvstore_txn_put(txn, "", &key, &val);
+    }
+    kvstore_txn_route(txn, saved);
+    return rc;
+}
+
+// ------------------------
+// Bucket registry
+// ------------------------
+
+typedef struct {
+    char table[KVSTORE_BUCKET_NAME_MAX];
+    int64_t start, end;
+} bucket_t;
+
+// Registered buckets of table_prefix in time order (malloc'd)
+static int bucket_list(kvstore_txn_t *txn, const char *table_prefix,
+                       bucket_t **out, size_t *n) {
+    char buf[sizeof(BUCKET_REGISTRY) + KVSTORE_BUCKET_NAME_MAX];
+    if (strlen(table_prefix) > BUCKET_PREFIX_MAX) return KVSTORE_ERROR;
+    kvstore_val_t start = registry_key(table_prefix, buf);
+    size_t reg_len = strlen(BUCKET_REGISTRY);
+
+    const char *saved = kvstore_txn_route(txn, NULL);
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+    bucket_t *list = NULL;
+    size_t count = 0, cap = 0;
+    int rc = KVSTORE_OK;
+
+    kvstore_val_t k, v;
+    while (cur && kvstore_cursor_get(cur, &k, &v) == KVSTORE_OK &&
+           k.size >= start.size && memcmp(k.data, start.data, start.size) == 0) {
+        // Skip buckets of longer prefixes ("msg@" vs "msg@old")
+        if (k.size != start.size + 14) {
+            kvstore_cursor_next(cur);
+            continue;
+        }
+        if (v.size != 16) {
+            rc = KVSTORE_ERROR;
+            break;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            bucket_t *grown = (bucket_t*)realloc(list, cap * sizeof(bucket_t));
+            if (!grown) {
+                rc = KVSTORE_ERROR;
+                break;
+            }
+            list = grown;
+        }
+        bucket_t *b = &list[count++];
+        memcpy(b->table, (char*)k.data + reg_len, k.size - reg_len);
+        b->table[k.size - reg_len] = '\0';
+        char *p = (char*)v.data;
+        uint64_t u;
+        SER_READ_U64(p, u);
+        b->start = (int64_t)u;
+        SER_READ_U64(p, u);
+        b->end = (int64_t)u;
+        kvstore_cursor_next(cur);
+    }
+    if (cur) kvstore_cursor_close(cur);
+    kvstore_txn_route(txn, saved);
+
+    if (rc != KVSTORE_OK) {
+        free(list);
+        return rc;
+    }
+    *out = list;
+    *n = count;
+    return KVSTORE_OK;
+}
+
+int kvstore_bucket_each(kvstore_txn_t *txn, const char *table_prefix,
+                        int (*fn)(const char *table, int64_t start, int64_t end, void *arg),
+                        void *arg) {
+    bucket_t *list;
+    size_t n;
+    int rc = bucket_list(txn, table_prefix, &list, &n);
+    if (rc != KVSTORE_OK) return rc;
+
+    for (size_t i = 0; rc == KVSTORE_OK && i < n; i++) {
+        rc = fn(list[i].table, list[i].start, list[i].end, arg);
+    }
+    free(list);
+    if (rc == KVSTORE_OK && n == 0) return KVSTORE_NOTFOUND;
+    return rc;
+}
+
+int kvstore_bucket_drop_before(kvstore_txn_t *txn, const char *table_prefix,
+                               int64_t sec, size_t *dropped) {
+    bucket_t *list;
+    size_t n, count = 0;
+    int rc = bucket_list(txn, table_prefix, &list, &n);
+    if (rc != KVSTORE_OK) return rc;
+
+    const char *saved = kvstore_txn_route(txn, NULL);
+    for (size_t i = 0; rc == KVSTORE_OK && i < n && list[i].end <= sec; i++) {
+        rc = kvstore_txn_drop_table(txn, list[i].table);
+        if (rc == KVSTORE_NOTFOUND) rc = KVSTORE_OK;   // Registered but never written
+
+        char buf[sizeof(BUCKET_REGISTRY) + KVSTORE_BUCKET_NAME_MAX];
+        kvstore_val_t key = registry_key(list[i].table, buf);
+        if (rc == KVSTORE_OK) rc = kvstore_txn_del(txn, "", &key);
+        if (rc == KVSTORE_OK) count++;
+    }
+    kvstore_txn_route(txn, saved);
+
+    free(list);
+    if (dropped) *dropped = count;
+    return rc;
+}
+
+// ------------------------
+// Stitched cursor
+// ------------------------
+
+struct kvstore_bucket_cursor {
+    kvstore_txn_t *txn;
+    bucket_t *buckets;
+    size_t nbuckets;
+    size_t next;            // Next bucket to open
+    kvstore_cursor_t *cur;  // On a matching key, or NULL past the end
+    kvstore_val_t prefix;
+};
+
+// Move to the first matching key at or after the current position
+static void bucket_cursor_settle(kvstore_bucket_cursor_t *c) {
+    for (;;) {
+        kvstore_val_t k;
+        if (c->cur) {
+            if (kvstore_cursor_get(c->cur, &k, NULL) == KVSTORE_OK && k.size >= c->prefix.size &&
+                memcmp(k.data, c->prefix.data, c->prefix.size) == 0) {
+                return;
+            }
+            kvstore_cursor_close(c->cur);
+            c->cur = NULL;
+        }
+        if (c->next == c->nbuckets) return;
+        c->cur = kvstore_cursor_open(c->txn, c->buckets[c->next++].table, &c->prefix);
+    }
+}
+
+kvstore_bucket_cursor_t* kvstore_bucket_cursor_open(kvstore_txn_t *txn, const char *table_prefix,
+                                                    const void *key_prefix, size_t key_prefix_len) {
+    kvstore_bucket_cursor_t *c = (kvstore_bucket_cursor_t*)calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->txn = txn;
+    c->prefix.data = malloc(key_prefix_len ? key_prefix_len : 1);
+    c->prefix.size = key_prefix_len;
+    if (!c->prefix.data ||
+        bucket_list(txn, table_prefix, &c->buckets, &c->nbuckets) != KVSTORE_OK) {
+        free(c->prefix.data);
+        free(c);
+        return NULL;
+    }
+    if (key_prefix_len) memcpy(c->prefix.data, key_prefix, key_prefix_len);
+
+    bucket_cursor_settle(c);
+    return c;
+}
+
+int kvstore_bucket_cursor_get(kvstore_bucket_cursor_t *cur, kvstore_val_t *key_out,
+                              kvstore_val_t *val_out) {
+    if (!cur->cur) return KVSTORE_NOTFOUND;
+    return kvstore_cursor_get(cur->cur, key_out, val_out);
+}
+
+int kvstore_bucket_cursor_next(kvstore_bucket_cursor_t *cur) {
+    if (!cur->cur) return KVSTORE_NOTFOUND;
+    kvstore_cursor_next(cur->cur);
+    bucket_cursor_settle(cur);
+    return cur->cur ? KVSTORE_OK : KVSTORE_NOTFOUND;
+}
+
+void kvstore_bucket_cursor_close(kvstore_bucket_cursor_t *cur) {
+    if (!cur) return;
+    if (cur->cur) kvstore_cursor_close(cur->cur);
+    free(cur->buckets);
+    free(cur->prefix.data);
+    free(cur);
+}
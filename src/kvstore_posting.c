@@ -0,0 +1,690 @@
+// Posting-list index storage: per element, chunks of bit-packed primary keys
+
+#include "../include/kvstore_backend.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// ------------------------
+// Chunk format
+// ------------------------
+
+// Each element's primary keys live in chunks, in key order:
+//   key:   prefix + element + bound (8 bytes big-endian)
+//   value: header, packed blocks, pending ops
+// A chunk holds the keys above the previous chunk's bound and at most its
+// own; the last chunk's bound is UINT64_MAX. Primary keys are the
+// serialized pk bytes read as one big-endian integer (so at most 8 bytes),
+// which keeps integer order equal to key order.
+//
+// Packed blocks hold 128 deltas from the previous key, bit-packed into
+// four interleaved 32-bit lanes so four values unpack per SIMD instruction,
+// with patched exceptions for the few deltas wider than the block's width:
+//   [width:1][nexc:1][width * 16 bytes][nexc * (index:1, high bits:8)]
+//
+// Inserts and removals append a pending op without touching the packed
+// data. Readers apply pending ops as they decode; once POSTING_PENDING_MAX
+// pile up (or removals outnumber the packed keys) the writer re-encodes the
+// chunk, splitting off full chunks of POSTING_CHUNK_MAX keys.
+
+#define POSTING_BLOCK 128
+#define POSTING_PENDING_MAX 64
+#define POSTING_CHUNK_MAX 4096
+#define POSTING_VERSION 2
+
+// Header: version:1 pk_len:1 pending:2 count:4 first:8 packed_len:4,
+// big-endian like the pending ops' and exceptions' integers
+#define POSTING_HEADER 20
+#define POSTING_OP_SIZE 9   // op:1 pk:8
+
+enum { POSTING_OP_REMOVE = 0, POSTING_OP_ADD = 1 };
+
+typedef struct {
+    uint8_t pk_len;
+    uint16_t pending;
+    uint32_t count;         // Keys in the packed blocks
+    uint64_t first;
+    uint32_t packed_len;
+} posting_header_t;
+
+static int header_read(const char *val, size_t len, posting_header_t *h) {
+    if (len < POSTING_HEADER || (uint8_t)val[0] != POSTING_VERSION) return KVSTORE_ERROR;
+    h->pk_len = (uint8_t)val[1];
+    const char *p = val + 2;
+    SER_READ_U16(p, h->pending);
+    SER_READ_U32(p, h->count);
+    SER_READ_U64(p, h->first);
+    SER_READ_U32(p, h->packed_len);
+    if (len != POSTING_HEADER + (size_t)h->packed_len + (size_t)h->pending * POSTING_OP_SIZE) {
+        return KVSTORE_ERROR;
+    }
+    return KVSTORE_OK;
+}
+
+static void header_write(char *val, const posting_header_t *h) {
+    val[0] = (char)POSTING_VERSION;
+    val[1] = (char)h->pk_len;
+    char *p = val + 2;
+    SER_WRITE_U16(p, h->pending);
+    SER_WRITE_U32(p, h->count);
+    SER_WRITE_U64(p, h->first);
+    SER_WRITE_U32(p, h->packed_len);
+}
+
+static uint64_t pk_to_int(const char *pk, size_t len) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; i++) v = (v << 8) | (uint8_t)pk[i];
+    return v;
+}
+
+static void pk_from_int(uint64_t v, char *pk, size_t len) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Hot in scans: one byte swap instead of a byte loop
+    if (len) {
+        uint64_t be = __builtin_bswap64(v << (64 - 8 * len));
+        memcpy(pk, &be, len);
+    }
+#else
+    for (size_t i = len; i-- > 0; v >>= 8) pk[i] = (char)(v & 0xff);
+#endif
+}
+
+// ------------------------
+// Block packing
+// ------------------------
+
+static unsigned bit_width(uint64_t v) {
+    return v ? 64u - (unsigned)__builtin_clzll(v) : 0u;
+}
+
+// Encode up to POSTING_BLOCK deltas; returns bytes written
+static size_t block_encode(const uint64_t *deltas, size_t n, char *out) {
+    // Pick the width minimizing lanes plus exceptions
+    size_t hist[65] = {0};
+    for (size_t i = 0; i < n; i++) hist[bit_width(deltas[i])]++;
+
+    unsigned width = 32;
+    size_t nexc = 0;
+    for (unsigned w = 33; w <= 64; w++) nexc += hist[w];
+    size_t best = 16 * 32 + nexc * 9;
+    size_t above = nexc;
+    for (unsigned w = 32; w-- > 0; ) {
+        above += hist[w + 1];
+        size_t cost = 16 * (size_t)w + above * 9;
+        if (cost <= best) {
+            best = cost;
+            width = w;
+            nexc = above;
+        }
+    }
+
+    out[0] = (char)width;
+    out[1] = (char)nexc;
+    uint32_t lanes[4 * 32];
+    memset(lanes, 0, 16 * (size_t)width);
+    char *exc = out + 2 + 16 * (size_t)width;
+
+    uint32_t mask = width == 32 ? UINT32_MAX : (1u << width) - 1;
+    for (size_t i = 0; i < n; i++) {
+        if (bit_width(deltas[i]) > width) {
+            uint64_t high = deltas[i] >> width;
+            *exc++ = (char)i;
+            SER_WRITE_U64(exc, high);
+        }
+        if (!width) continue;
+
+        // Value i is the (i / 4)th of lane i % 4
+        uint32_t v = (uint32_t)deltas[i] & mask;
+        size_t lane = i & 3, bit = (i >> 2) * width;
+        size_t word = bit >> 5, shift = bit & 31;
+        lanes[word * 4 + lane] |= v << shift;
+        if (shift + width > 32) lanes[(word + 1) * 4 + lane] |= v >> (32 - shift);
+    }
+    memcpy(out + 2, lanes, 16 * (size_t)width);
+    return (size_t)(exc - out);
+}
+
+// Unpack all 128 lane values of a block
+static void block_unpack(const char *in, unsigned width, uint32_t *out) {
+    if (!width) {
+        memset(out, 0, POSTING_BLOCK * sizeof(*out));
+        return;
+    }
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi32(width == 32 ? -1 : (int)((1u << width) - 1));
+    __m128i cur = _mm_loadu_si128((const __m128i*)in);
+    unsigned shift = 0, word = 0;
+    for (unsigned k = 0; k < 32; k++) {
+        __m128i v = _mm_srl_epi32(cur, _mm_cvtsi32_si128((int)shift));
+        shift += width;
+        if (shift >= 32) {
+            shift -= 32;
+            if (++word < width) {
+                cur = _mm_loadu_si128((const __m128i*)(in + 16 * word));
+                if (shift) {
+                    v = _mm_or_si128(v, _mm_sll_epi32(cur, _mm_cvtsi32_si128((int)(width - shift))));
+                }
+            }
+        }
+        _mm_storeu_si128((__m128i*)(out + 4 * k), _mm_and_si128(v, mask));
+    }
+#else
+    uint32_t mask = width == 32 ? UINT32_MAX : (1u << width) - 1;
+    uint32_t cur[4], next[4];
+    memcpy(cur, in, 16);
+    unsigned shift = 0, word = 0;
+    for (unsigned k = 0; k < 32; k++) {
+        uint32_t v[4];
+        for (int l = 0; l < 4; l++) v[l] = cur[l] >> shift;
+        shift += width;
+        if (shift >= 32) {
+            shift -= 32;
+            if (++word < width) {
+                memcpy(next, in + 16 * word, 16);
+                for (int l = 0; l < 4; l++) {
+                    if (shift) v[l] |= next[l] << (width - shift);
+                    cur[l] = next[l];
+                }
+            }
+        }
+        for (int l = 0; l < 4; l++) out[4 * k + l] = v[l] & mask;
+    }
+#endif
+}
+
+// Decode n keys of one block onto out, continuing from *prev
+static const char* block_decode(const char *in, const char *end, size_t n,
+                                uint64_t *prev, uint64_t *out) {
+    if (end - in < 2) return NULL;
+    unsigned width = (uint8_t)in[0];
+    size_t nexc = (uint8_t)in[1];
+    if (width > 32 || (size_t)(end - in) < 2 + 16 * (size_t)width + nexc * 9) return NULL;
+
+    uint32_t lanes[POSTING_BLOCK];
+    block_unpack(in + 2, width, lanes);
+    for (size_t i = 0; i < n; i++) out[i] = lanes[i];
+
+    const char *exc = in + 2 + 16 * (size_t)width;
+    for (size_t e = 0; e < nexc; e++, exc += 9) {
+        size_t i = (uint8_t)exc[0];
+        const char *hp = exc + 1;
+        uint64_t high;
+        SER_READ_U64(hp, high);
+        if (i < n) out[i] |= high << width;
+    }
+
+    uint64_t v = *prev;
+    for (size_t i = 0; i < n; i++) {
+        v += out[i];
+        out[i] = v;
+    }
+    *prev = v;
+    return exc;
+}
+
+// ------------------------
+// Chunk decode / encode
+// ------------------------
+
+// Growable key array
+typedef struct {
+    uint64_t *v;
+    size_t n, cap;
+} u64_vec_t;
+
+static int vec_reserve(u64_vec_t *a, size_t n) {
+    if (n <= a->cap) return KVSTORE_OK;
+    size_t cap = a->cap ? a->cap : 256;
+    while (cap < n) cap *= 2;
+    uint64_t *v = (uint64_t*)realloc(a->v, cap * sizeof(*v));
+    if (!v) return KVSTORE_ERROR;
+    a->v = v;
+    a->cap = cap;
+    return KVSTORE_OK;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Index of the first key >= x
+static size_t lower_bound(const uint64_t *v, size_t n, uint64_t x) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (v[mid] < x) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static bool sorted_has(const uint64_t *v, size_t n, uint64_t x) {
+    size_t i = lower_bound(v, n, x);
+    return i < n && v[i] == x;
+}
+
+// Fold pending ops (last op per key wins) over the packed keys in out
+static int apply_pending(const char *ops, size_t nops, u64_vec_t *out, u64_vec_t *tmp) {
+    uint64_t adds[POSTING_PENDING_MAX + 1], dels[POSTING_PENDING_MAX + 1];
+    size_t nadds = 0, ndels = 0;
+    if (nops > POSTING_PENDING_MAX + 1) return KVSTORE_ERROR;
+
+    for (size_t i = 0; i < nops; i++, ops += POSTING_OP_SIZE) {
+        const char *p = ops + 1;
+        uint64_t pk;
+        SER_READ_U64(p, pk);
+        uint64_t *from = ops[0] == POSTING_OP_ADD ? dels : adds;
+        size_t *nfrom = ops[0] == POSTING_OP_ADD ? &ndels : &nadds;
+        uint64_t *to = ops[0] == POSTING_OP_ADD ? adds : dels;
+        size_t *nto = ops[0] == POSTING_OP_ADD ? &nadds : &ndels;
+
+        for (size_t j = 0; j < *nfrom; j++) {
+            if (from[j] == pk) {
+                from[j] = from[--*nfrom];
+                break;
+            }
+        }
+        bool present = false;
+        for (size_t j = 0; j < *nto && !present; j++) present = to[j] == pk;
+        if (!present) to[(*nto)++] = pk;
+    }
+    if (!nadds && !ndels) return KVSTORE_OK;
+    qsort(adds, nadds, sizeof(*adds), compare_u64);
+    qsort(dels, ndels, sizeof(*dels), compare_u64);
+
+    // out = (out - dels) + adds
+    if (vec_reserve(tmp, out->n + nadds) != KVSTORE_OK) return KVSTORE_ERROR;
+    size_t i = 0, j = 0, n = 0;
+    while (i < out->n || j < nadds) {
+        uint64_t v;
+        if (j >= nadds || (i < out->n && out->v[i] < adds[j])) {
+            v = out->v[i++];
+            if (sorted_has(dels, ndels, v)) continue;
+        } else {
+            v = adds[j++];
+            if (i < out->n && out->v[i] == v) i++;
+        }
+        tmp->v[n++] = v;
+    }
+    tmp->n = n;
+
+    u64_vec_t swap = *out;
+    *out = *tmp;
+    *tmp = swap;
+    return KVSTORE_OK;
+}
+
+// Decode a chunk's keys, pending ops applied, into out
+static int chunk_decode(const char *val, size_t len, size_t pk_len,
+                        u64_vec_t *out, u64_vec_t *tmp) {
+    posting_header_t h;
+    if (header_read(val, len, &h) != KVSTORE_OK || h.pk_len != pk_len) return KVSTORE_ERROR;
+
+    out->n = 0;
+    if (vec_reserve(out, (size_t)h.count + POSTING_BLOCK) != KVSTORE_OK) return KVSTORE_ERROR;
+
+    const char *p = val + POSTING_HEADER;
+    const char *end = p + h.packed_len;
+    uint64_t prev = h.first;
+    for (size_t done = 0; done < h.count; done += POSTING_BLOCK) {
+        size_t n = h.count - done < POSTING_BLOCK ? h.count - done : POSTING_BLOCK;
+        p = block_decode(p, end, n, &prev, out->v + done);
+        if (!p) return KVSTORE_ERROR;
+    }
+    out->n = h.count;
+
+    return apply_pending(end, h.pending, out, tmp);
+}
+
+// Encode n sorted keys as a chunk value with no pending ops (malloc'd)
+static char* chunk_encode(const uint64_t *pks, size_t n, size_t pk_len, size_t *len_out) {
+    size_t nblocks = (n + POSTING_BLOCK - 1) / POSTING_BLOCK;
+    char *val = (char*)malloc(POSTING_HEADER + nblocks * (2 + 16 * 32 + POSTING_BLOCK * 9));
+    if (!val) return NULL;
+
+    char *p = val + POSTING_HEADER;
+    uint64_t prev = n ? pks[0] : 0;
+    uint64_t deltas[POSTING_BLOCK];
+    for (size_t done = 0; done < n; done += POSTING_BLOCK) {
+        size_t m = n - done < POSTING_BLOCK ? n - done : POSTING_BLOCK;
+        for (size_t i = 0; i < m; i++) {
+            deltas[i] = pks[done + i] - prev;
+            prev = pks[done + i];
+        }
+        p += block_encode(deltas, m, p);
+    }
+
+    posting_header_t h = { (uint8_t)pk_len, 0, (uint32_t)n, n ? pks[0] : 0,
+                           (uint32_t)(p - val - POSTING_HEADER) };
+    header_write(val, &h);
+    *len_out = (size_t)(p - val);
+    return val;
+}
+
+// ------------------------
+// Chunk maintenance
+// ------------------------
+
+// Chunk key buffer: prefix + element + bound
+typedef struct {
+    char *buf;
+    size_t base_len;    // prefix + element
+} chunk_key_t;
+
+static int chunk_key_init(chunk_key_t *k, const char *prefix, const char *elem, size_t elem_len) {
+    size_t prefix_len = strlen(prefix);
+    k->buf = (char*)malloc(prefix_len + elem_len + 8);
+    if (!k->buf) return KVSTORE_ERROR;
+    memcpy(k->buf, prefix, prefix_len);
+    memcpy(k->buf + prefix_len, elem, elem_len);
+    k->base_len = prefix_len + elem_len;
+    return KVSTORE_OK;
+}
+
+static kvstore_val_t chunk_key(chunk_key_t *k, uint64_t bound) {
+    pk_from_int(bound, k->buf + k->base_len, 8);
+    return (kvstore_val_t){ k->buf, k->base_len + 8 };
+}
+
+static bool is_chunk_key(const chunk_key_t *k, const kvstore_val_t *key) {
+    return key->size == k->base_len + 8 && memcmp(key->data, k->buf, k->base_len) == 0;
+}
+
+// Rewrite a chunk from its merged keys, splitting off full chunks in front
+static int chunk_rewrite(kvstore_txn_t *txn, chunk_key_t *k, uint64_t bound,
+                         const uint64_t *pks, size_t n, size_t pk_len) {
+    kvstore_val_t key = chunk_key(k, bound);
+    if (!n) {
+        int rc = kvstore_txn_del(txn, "", &key);
+        return rc == KVSTORE_NOTFOUND ? KVSTORE_OK : rc;
+    }
+
+    while (n) {
+        size_t m = n > POSTING_CHUNK_MAX ? POSTING_CHUNK_MAX : n;
+        size_t len;
+        char *val = chunk_encode(pks, m, pk_len, &len);
+        if (!val) return KVSTORE_ERROR;
+
+        key = chunk_key(k, m == n ? bound : pks[m - 1]);
+        kvstore_val_t v = { val, len };
+        int rc = kvstore_txn_put(txn, "", &key, &v);
+        free(val);
+        if (rc != KVSTORE_OK) return rc;
+        pks += m;
+        n -= m;
+    }
+    return KVSTORE_OK;
+}
+
+// Append one op to the chunk covering pk, re-encoding once enough pile up
+static int posting_op(kvstore_txn_t *txn, const char *prefix,
+                      const char *elem, size_t elem_len,
+                      const char *pk, size_t pk_len, uint8_t op) {
+    if (pk_len > 8) return KVSTORE_ERROR;
+    uint64_t v = pk_to_int(pk, pk_len);
+
+    chunk_key_t k;
+    if (chunk_key_init(&k, prefix, elem, elem_len) != KVSTORE_OK) return KVSTORE_ERROR;
+
+    // First chunk whose bound is >= pk
+    kvstore_val_t seek = chunk_key(&k, v);
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &seek);
+    kvstore_val_t key, val;
+    uint64_t bound = UINT64_MAX;
+    char *next = NULL;
+    size_t next_len = 0;
+    posting_header_t h = { (uint8_t)pk_len, 0, 0, 0, 0 };
+    int rc = KVSTORE_OK;
+
+    if (cur && kvstore_cursor_get(cur, &key, &val) == KVSTORE_OK && is_chunk_key(&k, &key)) {
+        bound = pk_to_int((const char*)key.data + k.base_len, 8);
+        rc = header_read((const char*)val.data, val.size, &h);
+        if (rc == KVSTORE_OK && h.pk_len != pk_len) rc = KVSTORE_ERROR;
+        if (rc == KVSTORE_OK) {
+            // Copy: val may be backend storage that the put below replaces
+            next_len = val.size + POSTING_OP_SIZE;
+            next = (char*)malloc(next_len);
+            if (next) memcpy(next, val.data, val.size);
+        }
+    } else if (op == POSTING_OP_ADD) {
+        // No chunk covers pk: start the open-ended last one
+        next_len = POSTING_HEADER + POSTING_OP_SIZE;
+        next = (char*)malloc(next_len);
+    } else {
+        rc = KVSTORE_NOTFOUND;
+    }
+    if (cur) kvstore_cursor_close(cur);
+    if (rc == KVSTORE_OK && !next) rc = KVSTORE_ERROR;
+
+    if (rc == KVSTORE_OK) {
+        char *o = next + next_len - POSTING_OP_SIZE;
+        *o++ = (char)op;
+        SER_WRITE_U64(o, v);
+        h.pending++;
+        header_write(next, &h);
+
+        // Small chunks also merge on removal, so emptied ones go away
+        if (h.pending > POSTING_PENDING_MAX ||
+            (op == POSTING_OP_REMOVE && h.pending >= h.count)) {
+            u64_vec_t pks = {0}, tmp = {0};
+            rc = chunk_decode(next, next_len, pk_len, &pks, &tmp);
+            if (rc == KVSTORE_OK) rc = chunk_rewrite(txn, &k, bound, pks.v, pks.n, pk_len);
+            free(pks.v);
+            free(tmp.v);
+        } else {
+            kvstore_val_t chunk = chunk_key(&k, bound);
+            kvstore_val_t nv = { next, next_len };
+            rc = kvstore_txn_put(txn, "", &chunk, &nv);
+        }
+    }
+
+    free(next);
+    free(k.buf);
+    return rc == KVSTORE_NOTFOUND ? KVSTORE_OK : rc;
+}
+
+// ------------------------
+// Public interface
+// ------------------------
+
+typedef struct {
+    kvstore_txn_t *txn;
+    const char *prefix;
+    const char *pk, *old_pk;
+    size_t pk_len, old_pk_len;
+} posting_apply_t;
+
+static int posting_apply_elem(const char *elem, size_t elem_len, bool add, void *arg) {
+    posting_apply_t *a = (posting_apply_t*)arg;
+    if (add) {
+        return posting_op(a->txn, a->prefix, elem, elem_len, a->pk, a->pk_len, POSTING_OP_ADD);
+    }
+    return posting_op(a->txn, a->prefix, elem, elem_len, a->old_pk, a->old_pk_len,
+                      POSTING_OP_REMOVE);
+}
+
+int kvstore_posting_apply(kvstore_txn_t *txn, const char *prefix,
+                          const char *cur, size_t cur_len,
+                          const char *old, size_t old_len,
+                          const char *pk, size_t pk_len,
+                          const char *old_pk, size_t old_pk_len) {
+    bool moved = !old_pk || old_pk_len != pk_len || memcmp(old_pk, pk, pk_len) != 0;
+    posting_apply_t a = { txn, prefix, pk, old_pk, pk_len, old_pk_len };
+    return kvstore_elems_diff(cur, cur_len, old, old_len, moved, posting_apply_elem, &a);
+}
+
+int kvstore_posting_scan(kvstore_txn_t *txn, const char *prefix,
+                         const char *key, size_t key_len, size_t pk_len,
+                         int (*fn)(kvstore_val_t *pk, void *arg), void *arg) {
+    if (pk_len > 8) return KVSTORE_ERROR;
+
+    chunk_key_t k;
+    if (chunk_key_init(&k, prefix, key, key_len) != KVSTORE_OK) return KVSTORE_ERROR;
+
+    kvstore_val_t start = { k.buf, k.base_len };
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+    u64_vec_t pks = {0}, tmp = {0};
+    char pk_buf[8];
+    kvstore_val_t pk = { pk_buf, pk_len };
+    bool found = false;
+    int rc = KVSTORE_OK;
+
+    kvstore_val_t ck, cv;
+    while (cur && rc == KVSTORE_OK && kvstore_cursor_get(cur, &ck, &cv) == KVSTORE_OK &&
+           is_chunk_key(&k, &ck)) {
+        rc = chunk_decode((const char*)cv.data, cv.size, pk_len, &pks, &tmp);
+        for (size_t i = 0; rc == KVSTORE_OK && i < pks.n; i++) {
+            found = true;
+            pk_from_int(pks.v[i], pk_buf, pk_len);
+            rc = fn(&pk, arg);
+        }
+        if (rc == KVSTORE_OK) kvstore_cursor_next(cur);
+    }
+
+    if (cur) kvstore_cursor_close(cur);
+    free(pks.v);
+    free(tmp.v);
+    free(k.buf);
+    if (rc == KVSTORE_OK && !found) return KVSTORE_NOTFOUND;
+    return rc;
+}
+
+// ------------------------
+// Full-text search
+// ------------------------
+
+// Keys in a[] also in b[], kept in a[]; returns how many
+static size_t intersect_sorted(uint64_t *a, size_t na, const uint64_t *b, size_t nb) {
+    size_t n = 0;
+    if (nb / 8 > na) {
+        // Few candidates against a long list: binary search each
+        size_t base = 0;
+        for (size_t i = 0; i < na; i++) {
+            base += lower_bound(b + base, nb - base, a[i]);
+            if (base < nb && b[base] == a[i]) a[n++] = a[i];
+        }
+        return n;
+    }
+    for (size_t i = 0, j = 0; i < na && j < nb; ) {
+        if (a[i] < b[j]) i++;
+        else if (a[i] > b[j]) j++;
+        else {
+            a[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+// Collect the sorted keys of one query term into out: the posting list of
+// term + NUL, or the union of every list under the term as a prefix. With a
+// filter, chunks holding none of its keys are skipped without decoding.
+static int term_collect(kvstore_txn_t *txn, const char *prefix,
+                        const char *term, size_t term_len, bool is_prefix,
+                        size_t pk_len, const u64_vec_t *filter,
+                        u64_vec_t *out, u64_vec_t *pks, u64_vec_t *tmp) {
+    chunk_key_t k;
+    char elem[KVSTORE_TERM_MAX + 1];
+    memcpy(elem, term, term_len);
+    elem[term_len] = '\0';
+    if (chunk_key_init(&k, prefix, elem, is_prefix ? term_len : term_len + 1) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+
+    kvstore_val_t start = { k.buf, k.base_len };
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, "", &start);
+    bool sorted = true;
+    uint64_t lo = 0;    // Smallest key the next chunk can hold
+    int rc = cur ? KVSTORE_OK : KVSTORE_ERROR;
+    out->n = 0;
+
+    kvstore_val_t ck, cv;
+    while (rc == KVSTORE_OK && kvstore_cursor_get(cur, &ck, &cv) == KVSTORE_OK) {
+        if (is_prefix ? ck.size <= k.base_len + 8 || memcmp(ck.data, k.buf, k.base_len) != 0
+                      : !is_chunk_key(&k, &ck)) {
+            break;
+        }
+        uint64_t bound = pk_to_int((const char*)ck.data + ck.size - 8, 8);
+
+        size_t i = filter ? lower_bound(filter->v, filter->n, lo) : 0;
+        if (!filter || (i < filter->n && filter->v[i] <= bound)) {
+            rc = chunk_decode((const char*)cv.data, cv.size, pk_len, pks, tmp);
+            if (rc == KVSTORE_OK) rc = vec_reserve(out, out->n + pks->n);
+            if (rc == KVSTORE_OK && pks->n) {
+                if (out->n && pks->v[0] <= out->v[out->n - 1]) sorted = false;
+                memcpy(out->v + out->n, pks->v, pks->n * sizeof(uint64_t));
+                out->n += pks->n;
+            }
+        }
+        // The last chunk of each element is bounded by UINT64_MAX
+        lo = bound == UINT64_MAX ? 0 : bound + 1;
+        kvstore_cursor_next(cur);
+    }
+
+    // Several terms matched the prefix: merge their lists
+    if (rc == KVSTORE_OK && !sorted) {
+        qsort(out->v, out->n, sizeof(uint64_t), compare_u64);
+        size_t n = 0;
+        for (size_t i = 0; i < out->n; i++) {
+            if (!n || out->v[i] != out->v[n - 1]) out->v[n++] = out->v[i];
+        }
+        out->n = n;
+    }
+
+    if (cur) kvstore_cursor_close(cur);
+    free(k.buf);
+    return rc;
+}
+
+int kvstore_text_search(kvstore_txn_t *txn, const char *prefix,
+                        const char *query, size_t pk_len,
+                        int (*fn)(kvstore_val_t *pk, void *arg), void *arg) {
+    if (pk_len > 8) return KVSTORE_ERROR;
+
+    u64_vec_t result = {0}, keys = {0}, pks = {0}, tmp = {0};
+    bool first = true;
+    int rc = KVSTORE_OK;
+
+    // Exact terms first: their lists are usually shorter and filter the
+    // chunks decoded for prefix terms
+    for (int pass = 0; pass < 2 && rc == KVSTORE_OK && (first || result.n); pass++) {
+        const char *p = query ? query : "";
+        char term[KVSTORE_TERM_MAX];
+        size_t len;
+        while (rc == KVSTORE_OK && (first || result.n) &&
+               (len = kvstore_next_term(&p, term)) > 0) {
+            bool is_prefix = *p == '*';
+            if (is_prefix != (pass == 1)) continue;
+
+            rc = term_collect(txn, prefix, term, len, is_prefix, pk_len,
+                              first ? NULL : &result, &keys, &pks, &tmp);
+            if (rc != KVSTORE_OK) break;
+            if (first) {
+                u64_vec_t swap = result;
+                result = keys;
+                keys = swap;
+                first = false;
+            } else {
+                result.n = intersect_sorted(result.v, result.n, keys.v, keys.n);
+            }
+        }
+    }
+
+    char pk_buf[8];
+    kvstore_val_t pk = { pk_buf, pk_len };
+    for (size_t i = 0; rc == KVSTORE_OK && i < result.n; i++) {
+        pk_from_int(result.v[i], pk_buf, pk_len);
+        rc = fn(&pk, arg);
+    }
+    if (rc == KVSTORE_OK && !result.n) rc = KVSTORE_NOTFOUND;
+
+    free(result.v);
+    free(keys.v);
+    free(pks.v);
+    free(tmp.v);
+    return rc;
+}
@@ -0,0 +1,590 @@
+// Log-shipping replication: primary wrapper backend and follower applier
+
+#define _POSIX_C_SOURCE 200809L
+#include "../include/kvstore_repl.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#define REPL_DEFAULT_BATCH  256
+#define REPL_READ_CHUNK     (64 * 1024)
+
+// ------------------------
+// Helpers
+// ------------------------
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return KVSTORE_ERROR;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return KVSTORE_OK;
+}
+
+// ------------------------
+// Primary: wrapper backend
+// ------------------------
+
+// commit_lock is held from the inner commit to the frame's write, so frames
+// get their seq, and reach the fd, in commit order
+typedef struct {
+    kvstore_t *inner;
+    int fd;
+    pthread_mutex_t commit_lock;
+    uint64_t seq;
+} repl_primary_t;
+
+// Frame position at a savepoint, to cut the frame back to on rollback
+typedef struct {
+    size_t len;
+    uint32_t ops;
+} repl_mark_t;
+
+typedef struct {
+    kvstore_txn_t *inner;
+    char *log;          // Frame being built: header space + ops
+    size_t len;
+    size_t cap;
+    uint32_t ops;
+    repl_mark_t *marks; // By savepoint id
+    size_t mark_count;
+    size_t mark_cap;
+} repl_txn_t;
+
+static int log_reserve(repl_txn_t *rtxn, size_t extra) {
+    if (rtxn->len + extra <= rtxn->cap) return KVSTORE_OK;
+
+    size_t cap = rtxn->cap ? rtxn->cap : 4096;
+    while (cap < rtxn->len + extra) cap *= 2;
+
+    char *log = (char*)realloc(rtxn->log, cap);
+    if (!log) return KVSTORE_ERROR;
+    rtxn->log = log;
+    rtxn->cap = cap;
+    return KVSTORE_OK;
+}
+
+// Whether the op header has room for the table name's and key's lengths,
+// and the value's (NULL for a delete)
+static bool op_fits(const char *table, kvstore_val_t *key, kvstore_val_t *val) {
+    return strlen(table) <= UINT16_MAX && key->size <= UINT32_MAX &&
+           (!val || val->size <= UINT32_MAX);
+}
+
+// Make room for an op before applying it to the inner transaction, so a
+// write that reached the inner store always makes it into the frame too
+static int log_reserve_op(repl_txn_t *rtxn, const char *table,
+                          kvstore_val_t *key, kvstore_val_t *val) {
+    if (!op_fits(table, key, val)) return KVSTORE_ERROR;
+    return log_reserve(rtxn, KVSTORE_REPL_OP_HDR + strlen(table) + key->size +
+                             (val ? val->size : 0));
+}
+
+static void log_append(repl_txn_t *rtxn, uint8_t type, const char *table,
+                       kvstore_val_t *key, kvstore_val_t *val) {
+    size_t table_len = strlen(table);
+    size_t val_len = val ? val->size : 0;
+
+    char *p = rtxn->log + rtxn->len;
+    SER_WRITE_U8(p, type);
+    SER_WRITE_U16(p, table_len);
+    SER_WRITE_U32(p, key->size);
+    SER_WRITE_U32(p, val_len);
+    memcpy(p, table, table_len); p += table_len;
+    memcpy(p, key->data, key->size); p += key->size;
+    if (val_len) { memcpy(p, val->data, val_len); p += val_len; }
+
+    rtxn->len = (size_t)(p - rtxn->log);
+    rtxn->ops++;
+}
+
+static void repl_close(kvstore_t *db) {
+    repl_primary_t *rp = (repl_primary_t*)db->backend_handle;
+    if (rp) pthread_mutex_destroy(&rp->commit_lock);
+    free(rp);
+    db->backend_handle = NULL;
+}
+
+static int repl_txn_begin(kvstore_t *db, kvstore_txn_t *txn, bool read_only) {
+    repl_primary_t *rp = (repl_primary_t*)db->backend_handle;
+
+    repl_txn_t *rtxn = (repl_txn_t*)calloc(1, sizeof(repl_txn_t));
+    if (!rtxn) return KVSTORE_ERROR;
+
+    rtxn->inner = kvstore_txn_begin(rp->inner, read_only);
+    if (!rtxn->inner) {
+        free(rtxn);
+        return KVSTORE_ERROR;
+    }
+
+    // Leave room for the frame header, filled in at commit
+    rtxn->len = KVSTORE_REPL_FRAME_HDR;
+
+    txn->backend_txn = rtxn;
+    return KVSTORE_OK;
+}
+
+static void repl_txn_free(kvstore_txn_t *txn) {
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    free(rtxn->log);
+    free(rtxn->marks);
+    free(rtxn);
+    txn->backend_txn = NULL;
+}
+
+static int repl_txn_commit(kvstore_txn_t *txn) {
+    repl_primary_t *rp = (repl_primary_t*)txn->db->backend_handle;
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    if (!rtxn) return KVSTORE_ERROR;
+
+    // Commit locally first so the follower never sees writes the primary lost
+    rtxn->inner->durability = txn->durability;
+    pthread_mutex_lock(&rp->commit_lock);
+    int rc = kvstore_txn_commit_seq(rtxn->inner, &txn->commit_seq);
+    rtxn->inner = NULL;
+
+    if (rc == KVSTORE_OK && rtxn->ops > 0) {
+        char *p = rtxn->log;
+        SER_WRITE_U32(p, rtxn->len - 4);
+        SER_WRITE_U64(p, ++rp->seq);
+        SER_WRITE_U64(p, now_ns());
+        SER_WRITE_U32(p, rtxn->ops);
+
+        // The local commit has happened; an error here means the stream is
+        // broken and the follower must be re-seeded
+        rc = write_all(rp->fd, rtxn->log, rtxn->len);
+    }
+    pthread_mutex_unlock(&rp->commit_lock);
+
+    repl_txn_free(txn);
+    return rc;
+}
+
+static void repl_txn_abort(kvstore_txn_t *txn) {
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    if (!rtxn) return;
+
+    kvstore_txn_abort(rtxn->inner);
+    repl_txn_free(txn);
+}
+
+static int repl_put(kvstore_txn_t *txn, const char *table,
+                    kvstore_val_t *key, kvstore_val_t *val) {
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    if (!rtxn || log_reserve_op(rtxn, table, key, val) != KVSTORE_OK) return KVSTORE_ERROR;
+
+    int rc = kvstore_txn_put(rtxn->inner, table, key, val);
+    if (rc != KVSTORE_OK) return rc;
+
+    log_append(rtxn, KVSTORE_REPL_OP_PUT, table, key, val);
+    return KVSTORE_OK;
+}
+
+static int repl_get(kvstore_txn_t *txn, const char *table,
+                    kvstore_val_t *key, kvstore_val_t *val_out) {
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    if (!rtxn) return KVSTORE_ERROR;
+
+    return kvstore_txn_get(rtxn->inner, table, key, val_out);
+}
+
+static int repl_del(kvstore_txn_t *txn, const char *table,
+                    kvstore_val_t *key) {
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    if (!rtxn || log_reserve_op(rtxn, table, key, NULL) != KVSTORE_OK) return KVSTORE_ERROR;
+
+    int rc = kvstore_txn_del(rtxn->inner, table, key);
+    if (rc != KVSTORE_OK) return rc;
+
+    log_append(rtxn, KVSTORE_REPL_OP_DEL, table, key, NULL);
+    return KVSTORE_OK;
+}
+
+static int repl_cursor_open(kvstore_txn_t *txn, kvstore_cursor_t *cur,
+                            const char *table, kvstore_val_t *start_key) {
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    if (!rtxn) return KVSTORE_ERROR;
+
+    kvstore_cursor_t *inner = kvstore_cursor_open(rtxn->inner, table, start_key);
+    if (!inner) return KVSTORE_NOTFOUND;
+
+    cur->backend_cursor = inner;
+    cur->valid = inner->valid;
+    return KVSTORE_OK;
+}
+
+static int repl_cursor_get(kvstore_cursor_t *cur,
+                           kvstore_val_t *key_out, kvstore_val_t *val_out) {
+    return kvstore_cursor_get((kvstore_cursor_t*)cur->backend_cursor, key_out, val_out);
+}
+
+static int repl_cursor_next(kvstore_cursor_t *cur) {
+    kvstore_cursor_t *inner = (kvstore_cursor_t*)cur->backend_cursor;
+    int rc = kvstore_cursor_next(inner);
+    cur->valid = inner->valid;
+    return rc;
+}
+
+static int repl_cursor_bound(kvstore_cursor_t *cur, kvstore_val_t *end) {
+    return kvstore_cursor_set_end((kvstore_cursor_t*)cur->backend_cursor, end);
+}
+
+static void repl_cursor_close(kvstore_cursor_t *cur) {
+    kvstore_cursor_close((kvstore_cursor_t*)cur->backend_cursor);
+    cur->backend_cursor = NULL;
+    cur->valid = false;
+}
+
+static int repl_split_points(kvstore_txn_t *txn, const char *table,
+                             kvstore_val_t *start, kvstore_val_t *end,
+                             kvstore_val_t *splits_out, size_t *nsplits) {
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    if (!rtxn) return KVSTORE_ERROR;
+    return kvstore_txn_split_points(rtxn->inner, table, start, end, splits_out, nsplits);
+}
+
+static int repl_savepoint(kvstore_txn_t *txn, size_t *id) {
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    if (!rtxn) return KVSTORE_ERROR;
+
+    kvstore_savepoint_t sp;
+    int rc = kvstore_txn_savepoint(rtxn->inner, &sp);
+    if (rc != KVSTORE_OK) return rc;
+    if (sp.id >= rtxn->mark_cap) {
+        size_t cap = rtxn->mark_cap ? rtxn->mark_cap * 2 : 8;
+        while (cap <= sp.id) cap *= 2;
+        repl_mark_t *marks = (repl_mark_t*)realloc(rtxn->marks, cap * sizeof(repl_mark_t));
+        if (!marks) {
+            kvstore_txn_release(rtxn->inner, &sp);
+            return KVSTORE_ERROR;
+        }
+        rtxn->marks = marks;
+        rtxn->mark_cap = cap;
+    }
+    rtxn->marks[sp.id] = (repl_mark_t){ rtxn->len, rtxn->ops };
+    rtxn->mark_count = sp.id + 1;
+    *id = sp.id;
+    return KVSTORE_OK;
+}
+
+static int repl_rollback_to(kvstore_txn_t *txn, size_t id) {
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    if (!rtxn || id >= rtxn->mark_count) return KVSTORE_ERROR;
+
+    kvstore_savepoint_t sp = { id };
+    int rc = kvstore_txn_rollback_to(rtxn->inner, &sp);
+    if (rc != KVSTORE_OK) return rc;
+    rtxn->len = rtxn->marks[id].len;
+    rtxn->ops = rtxn->marks[id].ops;
+    rtxn->mark_count = id + 1;
+    return KVSTORE_OK;
+}
+
+static int repl_release(kvstore_txn_t *txn, size_t id) {
+    repl_txn_t *rtxn = (repl_txn_t*)txn->backend_txn;
+    if (!rtxn || id >= rtxn->mark_count) return KVSTORE_ERROR;
+
+    kvstore_savepoint_t sp = { id };
+    int rc = kvstore_txn_release(rtxn->inner, &sp);
+    if (rc != KVSTORE_OK) return rc;
+    rtxn->mark_count = id;
+    return KVSTORE_OK;
+}
+
+static int repl_wait_durable(kvstore_t *db, uint64_t seq) {
+    return kvstore_wait_durable(((repl_primary_t*)db->backend_handle)->inner, seq);
+}
+
+static const struct kvstore_ops repl_primary_ops = {
+    .close = repl_close,
+    .txn_begin = repl_txn_begin,
+    .txn_commit = repl_txn_commit,
+    .txn_abort = repl_txn_abort,
+    .put = repl_put,
+    .get = repl_get,
+    .del = repl_del,
+    .cursor_open = repl_cursor_open,
+    .cursor_get = repl_cursor_get,
+    .cursor_next = repl_cursor_next,
+    .cursor_close = repl_cursor_close,
+    .cursor_bound = repl_cursor_bound,
+    .split_points = repl_split_points,
+    .wait_durable = repl_wait_durable,
+    .savepoint = repl_savepoint,
+    .rollback_to = repl_rollback_to,
+    .release = repl_release,
+};
+
+kvstore_t* kvstore_repl_primary_open(kvstore_t *inner, int fd) {
+    if (!inner || fd < 0) return NULL;
+
+    kvstore_t *db = (kvstore_t*)calloc(1, sizeof(kvstore_t));
+    repl_primary_t *rp = (repl_primary_t*)calloc(1, sizeof(repl_primary_t));
+    if (!db || !rp) {
+        free(db);
+        free(rp);
+        return NULL;
+    }
+
+    rp->inner = inner;
+    rp->fd = fd;
+    pthread_mutex_init(&rp->commit_lock, NULL);
+
+    db->backend_handle = rp;
+    db->ops = &repl_primary_ops;
+    return db;
+}
+
+uint64_t kvstore_repl_primary_seq(kvstore_t *db) {
+    if (!db || db->ops != &repl_primary_ops) return 0;
+    repl_primary_t *rp = (repl_primary_t*)db->backend_handle;
+    pthread_mutex_lock(&rp->commit_lock);
+    uint64_t seq = rp->seq;
+    pthread_mutex_unlock(&rp->commit_lock);
+    return seq;
+}
+
+// ------------------------
+// Follower
+// ------------------------
+
+struct kvstore_repl_follower {
+    kvstore_t *db;
+    int fd;
+    size_t max_batch;
+    bool eof;
+
+    // Receive buffer: bytes [off, len) are unparsed
+    char *buf;
+    size_t off;
+    size_t len;
+    size_t cap;
+
+    // NUL-terminated copy of the current op's table name
+    char *table;
+    size_t table_cap;
+
+    kvstore_repl_stats_t stats;
+};
+
+kvstore_repl_follower_t* kvstore_repl_follower_new(kvstore_t *db, int fd,
+                                                   size_t max_batch) {
+    if (!db || fd < 0) return NULL;
+
+    kvstore_repl_follower_t *f = (kvstore_repl_follower_t*)calloc(1, sizeof(*f));
+    if (!f) return NULL;
+
+    f->db = db;
+    f->fd = fd;
+    f->max_batch = max_batch ? max_batch : REPL_DEFAULT_BATCH;
+    return f;
+}
+
+void kvstore_repl_follower_free(kvstore_repl_follower_t *f) {
+    if (!f) return;
+    free(f->buf);
+    free(f->table);
+    free(f);
+}
+
+// Read whatever is available into the receive buffer
+static int follower_fill(kvstore_repl_follower_t *f) {
+    // Compact consumed bytes before growing
+    if (f->off > 0) {
+        memmove(f->buf, f->buf + f->off, f->len - f->off);
+        f->len -= f->off;
+        f->off = 0;
+    }
+
+    if (f->cap - f->len < REPL_READ_CHUNK) {
+        size_t cap = f->cap ? f->cap * 2 : 2 * REPL_READ_CHUNK;
+        char *buf = (char*)realloc(f->buf, cap);
+        if (!buf) return KVSTORE_ERROR;
+        f->buf = buf;
+        f->cap = cap;
+    }
+
+    for (;;) {
+        ssize_t n = read(f->fd, f->buf + f->len, f->cap - f->len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return KVSTORE_ERROR;
+        }
+        if (n == 0) f->eof = true;
+        f->len += (size_t)n;
+        return KVSTORE_OK;
+    }
+}
+
+// Length of the complete frame at p, or 0 if more bytes are needed
+static size_t frame_complete(const char *p, size_t avail) {
+    if (avail < KVSTORE_REPL_FRAME_HDR) return 0;
+
+    uint32_t frame_len;
+    SER_READ_U32(p, frame_len);
+    if (avail < 4 + (size_t)frame_len) return 0;
+    return 4 + (size_t)frame_len;
+}
+
+static int apply_frame(kvstore_repl_follower_t *f, kvstore_txn_t *txn,
+                       char *p, size_t frame_sz,
+                       uint64_t *seq, uint64_t *commit_ns, uint32_t *op_count) {
+    char *end = p + frame_sz;
+    uint32_t frame_len;
+
+    if (frame_sz < KVSTORE_REPL_FRAME_HDR) return KVSTORE_ERROR;
+
+    SER_READ_U32(p, frame_len);
+    SER_READ_U64(p, *seq);
+    SER_READ_U64(p, *commit_ns);
+    SER_READ_U32(p, *op_count);
+    (void)frame_len;
+
+    for (uint32_t i = 0; i < *op_count; i++) {
+        if ((size_t)(end - p) < KVSTORE_REPL_OP_HDR) return KVSTORE_ERROR;
+
+        uint8_t type;
+        uint16_t table_len;
+        uint32_t key_len, val_len;
+        SER_READ_U8(p, type);
+        SER_READ_U16(p, table_len);
+        SER_READ_U32(p, key_len);
+        SER_READ_U32(p, val_len);
+
+        if ((size_t)(end - p) < (size_t)table_len + key_len + val_len) return KVSTORE_ERROR;
+
+        if (f->table_cap < (size_t)table_len + 1) {
+            char *table = (char*)realloc(f->table, (size_t)table_len + 1);
+            if (!table) return KVSTORE_ERROR;
+            f->table = table;
+            f->table_cap = (size_t)table_len + 1;
+        }
+        char *table = f->table;
+        memcpy(table, p, table_len);
+        table[table_len] = '\0';
+        p += table_len;
+
+        kvstore_val_t key = { p, key_len };
+        p += key_len;
+        kvstore_val_t val = { p, val_len };
+        p += val_len;
+
+        int rc;
+        if (type == KVSTORE_REPL_OP_PUT) {
+            rc = kvstore_txn_put(txn, table, &key, &val);
+        } else if (type == KVSTORE_REPL_OP_DEL) {
+            // Deleting an absent key is not a divergence: the primary
+            // reported the delete only because it succeeded there
+            rc = kvstore_txn_del(txn, table, &key);
+            if (rc == KVSTORE_NOTFOUND) rc = KVSTORE_OK;
+        } else {
+            rc = KVSTORE_ERROR;
+        }
+        if (rc != KVSTORE_OK) return rc;
+    }
+
+    return p == end ? KVSTORE_OK : KVSTORE_ERROR;
+}
+
+// Apply up to max_batch complete frames in one follower transaction. The
+// frames are consumed only once it commits, so a failed batch is retried
+// from its first frame rather than skipped.
+static int follower_apply_batch(kvstore_repl_follower_t *f, size_t *applied) {
+    *applied = 0;
+    if (!frame_complete(f->buf + f->off, f->len - f->off)) return KVSTORE_OK;
+
+    kvstore_txn_t *txn = kvstore_txn_begin(f->db, false);
+    if (!txn) return KVSTORE_ERROR;
+
+    uint64_t oldest_commit_ns = 0;
+    uint64_t last_seq = f->stats.applied_seq;
+    uint64_t ops = 0, bytes = 0;
+    size_t n = 0, off = f->off;
+    size_t frame_sz;
+
+    while (n < f->max_batch &&
+           (frame_sz = frame_complete(f->buf + off, f->len - off)) > 0) {
+        uint64_t seq, commit_ns;
+        uint32_t op_count;
+
+        if (apply_frame(f, txn, f->buf + off, frame_sz,
+                        &seq, &commit_ns, &op_count) != KVSTORE_OK) {
+            kvstore_txn_abort(txn);
+            return KVSTORE_ERROR;
+        }
+
+        if (n == 0) oldest_commit_ns = commit_ns;
+        last_seq = seq;
+        ops += op_count;
+        bytes += frame_sz;
+        off += frame_sz;
+        n++;
+    }
+
+    if (kvstore_txn_commit(txn) != KVSTORE_OK) return KVSTORE_ERROR;
+    f->off = off;
+    f->stats.received_seq = last_seq;
+
+    uint64_t now = now_ns();
+    f->stats.lag_ns = now > oldest_commit_ns ? now - oldest_commit_ns : 0;
+    if (f->stats.lag_ns > f->stats.max_lag_ns) f->stats.max_lag_ns = f->stats.lag_ns;
+    f->stats.applied_seq = last_seq;
+    f->stats.applied_commits += n;
+    f->stats.applied_ops += ops;
+    f->stats.applied_bytes += bytes;
+    f->stats.batches++;
+
+    *applied = n;
+    return KVSTORE_OK;
+}
+
+int kvstore_repl_follower_poll(kvstore_repl_follower_t *f, int timeout_ms,
+                               size_t *applied) {
+    if (!f) return KVSTORE_ERROR;
+    if (applied) *applied = 0;
+
+    if (!f->eof) {
+        struct pollfd pfd = { .fd = f->fd, .events = POLLIN };
+        int pr = poll(&pfd, 1, timeout_ms);
+        if (pr < 0 && errno != EINTR) return KVSTORE_ERROR;
+        if (pr > 0 && follower_fill(f) != KVSTORE_OK) return KVSTORE_ERROR;
+    }
+
+    size_t n;
+    do {
+        if (follower_apply_batch(f, &n) != KVSTORE_OK) return KVSTORE_ERROR;
+        if (applied) *applied += n;
+    } while (n > 0);
+
+    if (f->eof) {
+        // A truncated trailing frame means the primary died mid-write
+        return f->off == f->len ? KVSTORE_NOTFOUND : KVSTORE_ERROR;
+    }
+    return KVSTORE_OK;
+}
+
+int kvstore_repl_follower_run(kvstore_repl_follower_t *f) {
+    int rc;
+    while ((rc = kvstore_repl_follower_poll(f, -1, NULL)) == KVSTORE_OK) {
+    }
+    return rc == KVSTORE_NOTFOUND ? KVSTORE_OK : rc;
+}
+
+void kvstore_repl_follower_stats(kvstore_repl_follower_t *f,
+                                 kvstore_repl_stats_t *stats) {
+    if (!f || !stats) return;
+    *stats = f->stats;
+}
@@ -0,0 +1,728 @@
+// Hash-partitioned sharding wrapper backend
+
+#define _POSIX_C_SOURCE 200809L
+#include "../include/kvstore_shard.h"
+#include <pthread.h>
+#include <string.h>
+
+// ------------------------
+// Data structures
+// ------------------------
+
+typedef struct {
+    kvstore_t **shards;
+    size_t nshards;
+    kvstore_shard_opts_t opts;
+} shard_db_t;
+
+// Buffered write; table, key and value bytes live in the shard's arena
+typedef struct {
+    uint8_t is_del;
+    const char *table;  // NUL-terminated
+    const char *key;
+    size_t key_size;
+    const char *val;
+    size_t val_size;
+    uint64_t hash;
+} shard_op_t;
+
+// Arena chunks never move or get reused before the transaction ends, so a
+// buffered value handed out by get stays valid until commit or abort
+typedef struct shard_chunk {
+    struct shard_chunk *next;
+    size_t len;
+    size_t cap;
+    char data[];
+} shard_chunk_t;
+
+typedef struct {
+    kvstore_txn_t *inner;       // Begun on first access
+
+    // Pending writes in issue order
+    shard_op_t *ops;
+    size_t nops;
+    size_t ops_cap;
+
+    shard_chunk_t *arena;       // Newest chunk first
+
+    // Open-addressed index: latest op (index + 1) per (table, key), 0 = empty
+    size_t *slots;
+    size_t slot_cap;
+    size_t slot_used;
+
+    int rc;                     // Result of a threaded apply
+    bool commit;                // Threaded apply also commits the inner txn
+} shard_part_t;
+
+typedef struct {
+    shard_part_t *parts;
+    bool read_only;
+
+    // Inner savepoint ids, nshards per savepoint, by savepoint id
+    size_t *marks;
+    size_t mark_count;
+    size_t mark_cap;
+} shard_txn_t;
+
+typedef struct {
+    kvstore_cursor_t **curs;    // One per shard, NULL when exhausted
+    size_t current;             // Shard holding the smallest key
+} shard_cursor_t;
+
+// ------------------------
+// Routing
+// ------------------------
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+#define FNV_OFFSET 1469598103934665603ull
+
+static size_t route(shard_db_t *sdb, const char *table, const kvstore_val_t *key) {
+    if (sdb->nshards == 1) return 0;
+
+    kvstore_val_t slice;
+    if (sdb->opts.route_key) {
+        sdb->opts.route_key(table, key, &slice, sdb->opts.route_arg);
+    } else {
+        const char *p = (const char*)key->data;
+        const char *colon = (const char*)memchr(p, ':', key->size);
+        size_t skip = colon ? (size_t)(colon - p) + 1 : 0;
+        size_t len = key->size - skip;
+        if (sdb->opts.route_len && sdb->opts.route_len < len) len = sdb->opts.route_len;
+        slice.data = (void*)(p + skip);
+        slice.size = len;
+    }
+
+    return (size_t)(fnv1a(FNV_OFFSET, slice.data, slice.size) % sdb->nshards);
+}
+
+// ------------------------
+// Pending write buffer
+// ------------------------
+
+static uint64_t op_hash(const char *table, const kvstore_val_t *key) {
+    uint64_t h = fnv1a(FNV_OFFSET, table, strlen(table) + 1);
+    return fnv1a(h, key->data, key->size);
+}
+
+static bool op_matches(shard_op_t *op, uint64_t hash,
+                       const char *table, const kvstore_val_t *key) {
+    return op->hash == hash && op->key_size == key->size &&
+           memcmp(op->key, key->data, key->size) == 0 &&
+           strcmp(op->table, table) == 0;
+}
+
+// Slot holding the latest op for (table, key), or the empty slot to use
+static size_t *find_slot(shard_part_t *part, uint64_t hash,
+                         const char *table, const kvstore_val_t *key) {
+    size_t mask = part->slot_cap - 1;
+    for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+        size_t *slot = &part->slots[i];
+        if (*slot == 0 || op_matches(&part->ops[*slot - 1], hash, table, key)) {
+            return slot;
+        }
+    }
+}
+
+static int grow_slots(shard_part_t *part) {
+    size_t cap = part->slot_cap ? part->slot_cap * 2 : 64;
+    size_t *slots = (size_t*)calloc(cap, sizeof(size_t));
+    if (!slots) return KVSTORE_ERROR;
+
+    // Reinsert the latest op of each key
+    size_t mask = cap - 1;
+    for (size_t i = 0; i < part->slot_cap; i++) {
+        size_t idx = part->slots[i];
+        if (!idx) continue;
+        size_t j = (size_t)part->ops[idx - 1].hash & mask;
+        while (slots[j]) j = (j + 1) & mask;
+        slots[j] = idx;
+    }
+
+    free(part->slots);
+    part->slots = slots;
+    part->slot_cap = cap;
+    return KVSTORE_OK;
+}
+
+static int arena_append(shard_part_t *part, const void *data, size_t size,
+                        const char **out) {
+    shard_chunk_t *chunk = part->arena;
+    if (!chunk || chunk->cap - chunk->len < size) {
+        size_t cap = chunk ? chunk->cap * 2 : 4096;
+        if (cap < size) cap = size;
+        chunk = (shard_chunk_t*)malloc(sizeof(shard_chunk_t) + cap);
+        if (!chunk) return KVSTORE_ERROR;
+        chunk->next = part->arena;
+        chunk->len = 0;
+        chunk->cap = cap;
+        part->arena = chunk;
+    }
+    *out = chunk->data + chunk->len;
+    if (size) memcpy(chunk->data + chunk->len, data, size);
+    chunk->len += size;
+    return KVSTORE_OK;
+}
+
+static shard_op_t* pending_lookup(shard_part_t *part, const char *table,
+                                  const kvstore_val_t *key) {
+    if (!part->slot_used) return NULL;
+    size_t *slot = find_slot(part, op_hash(table, key), table, key);
+    return *slot ? &part->ops[*slot - 1] : NULL;
+}
+
+static int pending_add(shard_part_t *part, bool is_del, const char *table,
+                       const kvstore_val_t *key, const kvstore_val_t *val) {
+    if (part->nops >= part->ops_cap) {
+        size_t cap = part->ops_cap ? part->ops_cap * 2 : 64;
+        shard_op_t *ops = (shard_op_t*)realloc(part->ops, cap * sizeof(shard_op_t));
+        if (!ops) return KVSTORE_ERROR;
+        part->ops = ops;
+        part->ops_cap = cap;
+    }
+    if ((part->slot_used + 1) * 2 > part->slot_cap && grow_slots(part) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+
+    shard_op_t op = { .is_del = is_del, .hash = op_hash(table, key) };
+    if (arena_append(part, table, strlen(table) + 1, &op.table) != KVSTORE_OK ||
+        arena_append(part, key->data, key->size, &op.key) != KVSTORE_OK) {
+        return KVSTORE_ERROR;
+    }
+    op.key_size = key->size;
+    if (val) {
+        if (arena_append(part, val->data, val->size, &op.val) != KVSTORE_OK) {
+            return KVSTORE_ERROR;
+        }
+        op.val_size = val->size;
+    }
+
+    size_t *slot = find_slot(part, op.hash, table, key);
+    if (!*slot) part->slot_used++;
+    part->ops[part->nops++] = op;
+    *slot = part->nops;
+    return KVSTORE_OK;
+}
+
+// The arena is kept: values read from it may still be in use
+static void pending_clear(shard_part_t *part) {
+    part->nops = 0;
+    part->slot_used = 0;
+    if (part->slots) memset(part->slots, 0, part->slot_cap * sizeof(size_t));
+}
+
+static void part_free(shard_part_t *part) {
+    free(part->ops);
+    while (part->arena) {
+        shard_chunk_t *next = part->arena->next;
+        free(part->arena);
+        part->arena = next;
+    }
+    free(part->slots);
+}
+
+// ------------------------
+// Applying buffered writes
+// ------------------------
+
+static kvstore_txn_t* part_txn(shard_db_t *sdb, shard_txn_t *stxn, size_t i) {
+    shard_part_t *part = &stxn->parts[i];
+    if (!part->inner) part->inner = kvstore_txn_begin(sdb->shards[i], stxn->read_only);
+    return part->inner;
+}
+
+static int part_apply(shard_part_t *part) {
+    for (size_t i = 0; i < part->nops; i++) {
+        shard_op_t *op = &part->ops[i];
+        const char *table = op->table;
+        kvstore_val_t key = { (void*)op->key, op->key_size };
+        int rc;
+
+        if (op->is_del) {
+            rc = kvstore_txn_del(part->inner, table, &key);
+            if (rc == KVSTORE_NOTFOUND) rc = KVSTORE_OK;
+        } else {
+            kvstore_val_t val = { (void*)op->val, op->val_size };
+            rc = kvstore_txn_put(part->inner, table, &key, &val);
+        }
+        if (rc != KVSTORE_OK) return rc;
+    }
+
+    pending_clear(part);
+    return KVSTORE_OK;
+}
+
+static void* part_worker(void *arg) {
+    shard_part_t *part = (shard_part_t*)arg;
+
+    part->rc = part_apply(part);
+    if (part->commit) {
+        if (part->rc == KVSTORE_OK) {
+            part->rc = kvstore_txn_commit(part->inner);
+        } else {
+            kvstore_txn_abort(part->inner);
+        }
+        part->inner = NULL;
+    }
+    return NULL;
+}
+
+// Apply pending writes on every shard that has any (and commit every begun
+// inner transaction if commit is set), fanning out to one thread per shard.
+static int apply_all(shard_db_t *sdb, shard_txn_t *stxn, bool commit) {
+    size_t touched = 0;
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        shard_part_t *part = &stxn->parts[i];
+        if (part->nops && !part_txn(sdb, stxn, i)) return KVSTORE_ERROR;
+        part->commit = commit;
+        part->rc = KVSTORE_OK;
+        if (part->nops || (commit && part->inner)) touched++;
+    }
+
+    size_t min_shards = sdb->opts.parallel_min_shards ? sdb->opts.parallel_min_shards : 2;
+    pthread_t *threads = NULL;
+    bool *started = NULL;
+    if (touched >= min_shards) {
+        threads = (pthread_t*)calloc(sdb->nshards, sizeof(pthread_t));
+        started = (bool*)calloc(sdb->nshards, sizeof(bool));
+    }
+
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        shard_part_t *part = &stxn->parts[i];
+        if (!part->inner) continue;
+
+        // Inline fallback when threading is off or thread creation fails
+        if (!threads || !started ||
+            pthread_create(&threads[i], NULL, part_worker, part) != 0) {
+            part_worker(part);
+        } else {
+            started[i] = true;
+        }
+    }
+
+    int rc = KVSTORE_OK;
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        if (started && started[i]) pthread_join(threads[i], NULL);
+        if (stxn->parts[i].rc != KVSTORE_OK) rc = stxn->parts[i].rc;
+    }
+
+    free(threads);
+    free(started);
+    return rc;
+}
+
+static bool has_pending(shard_db_t *sdb, shard_txn_t *stxn) {
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        if (stxn->parts[i].nops) return true;
+    }
+    return false;
+}
+
+// ------------------------
+// Backend operations
+// ------------------------
+
+static void shard_close(kvstore_t *db) {
+    shard_db_t *sdb = (shard_db_t*)db->backend_handle;
+    if (!sdb) return;
+    free(sdb->shards);
+    free(sdb);
+    db->backend_handle = NULL;
+}
+
+static int shard_txn_begin(kvstore_t *db, kvstore_txn_t *txn, bool read_only) {
+    shard_db_t *sdb = (shard_db_t*)db->backend_handle;
+
+    shard_txn_t *stxn = (shard_txn_t*)calloc(1, sizeof(shard_txn_t));
+    if (!stxn) return KVSTORE_ERROR;
+
+    stxn->parts = (shard_part_t*)calloc(sdb->nshards, sizeof(shard_part_t));
+    if (!stxn->parts) {
+        free(stxn);
+        return KVSTORE_ERROR;
+    }
+    stxn->read_only = read_only;
+
+    txn->backend_txn = stxn;
+    return KVSTORE_OK;
+}
+
+static void shard_txn_free(shard_db_t *sdb, kvstore_txn_t *txn) {
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    for (size_t i = 0; i < sdb->nshards; i++) part_free(&stxn->parts[i]);
+    free(stxn->parts);
+    free(stxn->marks);
+    free(stxn);
+    txn->backend_txn = NULL;
+}
+
+static int shard_txn_commit(kvstore_txn_t *txn) {
+    shard_db_t *sdb = (shard_db_t*)txn->db->backend_handle;
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    if (!stxn) return KVSTORE_ERROR;
+
+    int rc = apply_all(sdb, stxn, true);
+
+    // Shards that failed before their worker ran still hold a transaction
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        if (stxn->parts[i].inner) kvstore_txn_abort(stxn->parts[i].inner);
+    }
+
+    shard_txn_free(sdb, txn);
+    return rc;
+}
+
+static void shard_txn_abort(kvstore_txn_t *txn) {
+    shard_db_t *sdb = (shard_db_t*)txn->db->backend_handle;
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    if (!stxn) return;
+
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        if (stxn->parts[i].inner) kvstore_txn_abort(stxn->parts[i].inner);
+    }
+    shard_txn_free(sdb, txn);
+}
+
+static int shard_get(kvstore_txn_t *txn, const char *table,
+                     kvstore_val_t *key, kvstore_val_t *val_out) {
+    shard_db_t *sdb = (shard_db_t*)txn->db->backend_handle;
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    if (!stxn) return KVSTORE_ERROR;
+
+    size_t i = route(sdb, table, key);
+    shard_part_t *part = &stxn->parts[i];
+
+    // Read our own buffered writes first
+    shard_op_t *op = pending_lookup(part, table, key);
+    if (op) {
+        if (op->is_del) return KVSTORE_NOTFOUND;
+        val_out->data = (void*)op->val;
+        val_out->size = op->val_size;
+        return KVSTORE_OK;
+    }
+
+    kvstore_txn_t *inner = part_txn(sdb, stxn, i);
+    if (!inner) return KVSTORE_ERROR;
+    return kvstore_txn_get(inner, table, key, val_out);
+}
+
+static int shard_put(kvstore_txn_t *txn, const char *table,
+                     kvstore_val_t *key, kvstore_val_t *val) {
+    shard_db_t *sdb = (shard_db_t*)txn->db->backend_handle;
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    if (!stxn) return KVSTORE_ERROR;
+
+    return pending_add(&stxn->parts[route(sdb, table, key)], false, table, key, val);
+}
+
+static int shard_del(kvstore_txn_t *txn, const char *table,
+                     kvstore_val_t *key) {
+    shard_db_t *sdb = (shard_db_t*)txn->db->backend_handle;
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    if (!stxn) return KVSTORE_ERROR;
+
+    // Report NOTFOUND like an unbuffered backend would
+    kvstore_val_t existing;
+    int rc = shard_get(txn, table, key, &existing);
+    if (rc != KVSTORE_OK) return rc;
+
+    return pending_add(&stxn->parts[route(sdb, table, key)], true, table, key, NULL);
+}
+
+// ------------------------
+// Merged cursor
+// ------------------------
+
+static void cursor_pick(shard_db_t *sdb, shard_cursor_t *scur, kvstore_cursor_t *cur) {
+    kvstore_val_t best = {0};
+    bool found = false;
+
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        kvstore_val_t k;
+        if (!scur->curs[i] || kvstore_cursor_get(scur->curs[i], &k, NULL) != KVSTORE_OK) {
+            continue;
+        }
+
+        size_t min = k.size < best.size ? k.size : best.size;
+        int cmp = found ? memcmp(k.data, best.data, min) : -1;
+        if (!found || cmp < 0 || (cmp == 0 && k.size < best.size)) {
+            best = k;
+            scur->current = i;
+            found = true;
+        }
+    }
+
+    cur->valid = found;
+}
+
+static int shard_cursor_open(kvstore_txn_t *txn, kvstore_cursor_t *cur,
+                             const char *table, kvstore_val_t *start_key) {
+    shard_db_t *sdb = (shard_db_t*)txn->db->backend_handle;
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    if (!stxn) return KVSTORE_ERROR;
+
+    // Buffered writes must be visible to the scan
+    if (has_pending(sdb, stxn)) {
+        int rc = apply_all(sdb, stxn, false);
+        if (rc != KVSTORE_OK) return rc;
+    }
+
+    shard_cursor_t *scur = (shard_cursor_t*)calloc(1, sizeof(shard_cursor_t));
+    if (!scur) return KVSTORE_ERROR;
+    scur->curs = (kvstore_cursor_t**)calloc(sdb->nshards, sizeof(kvstore_cursor_t*));
+    if (!scur->curs) {
+        free(scur);
+        return KVSTORE_ERROR;
+    }
+
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        kvstore_txn_t *inner = part_txn(sdb, stxn, i);
+        // A shard without the table simply contributes nothing
+        if (inner) scur->curs[i] = kvstore_cursor_open(inner, table, start_key);
+    }
+
+    cur->backend_cursor = scur;
+    cursor_pick(sdb, scur, cur);
+    return KVSTORE_OK;
+}
+
+static int shard_cursor_get(kvstore_cursor_t *cur,
+                            kvstore_val_t *key_out, kvstore_val_t *val_out) {
+    shard_cursor_t *scur = (shard_cursor_t*)cur->backend_cursor;
+    if (!scur || !cur->valid) return KVSTORE_ERROR;
+    return kvstore_cursor_get(scur->curs[scur->current], key_out, val_out);
+}
+
+static int shard_cursor_next(kvstore_cursor_t *cur) {
+    shard_db_t *sdb = (shard_db_t*)cur->txn->db->backend_handle;
+    shard_cursor_t *scur = (shard_cursor_t*)cur->backend_cursor;
+    if (!scur) return KVSTORE_ERROR;
+    if (!cur->valid) return KVSTORE_NOTFOUND;
+
+    kvstore_cursor_next(scur->curs[scur->current]);
+    cursor_pick(sdb, scur, cur);
+
+    return cur->valid ? KVSTORE_OK : KVSTORE_NOTFOUND;
+}
+
+// Each shard's cursor stops at end too, so none reads ahead past it
+static int shard_cursor_bound(kvstore_cursor_t *cur, kvstore_val_t *end) {
+    shard_db_t *sdb = (shard_db_t*)cur->txn->db->backend_handle;
+    shard_cursor_t *scur = (shard_cursor_t*)cur->backend_cursor;
+    if (!scur) return KVSTORE_ERROR;
+
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        if (scur->curs[i] && kvstore_cursor_set_end(scur->curs[i], end) != KVSTORE_OK) {
+            return KVSTORE_ERROR;
+        }
+    }
+    cursor_pick(sdb, scur, cur);
+    return KVSTORE_OK;
+}
+
+static void shard_cursor_close(kvstore_cursor_t *cur) {
+    shard_db_t *sdb = (shard_db_t*)cur->txn->db->backend_handle;
+    shard_cursor_t *scur = (shard_cursor_t*)cur->backend_cursor;
+    if (scur) {
+        for (size_t i = 0; i < sdb->nshards; i++) kvstore_cursor_close(scur->curs[i]);
+        free(scur->curs);
+        free(scur);
+        cur->backend_cursor = NULL;
+    }
+    cur->valid = false;
+}
+
+static int compare_split(const void *a, const void *b) {
+    const kvstore_val_t *x = (const kvstore_val_t*)a;
+    const kvstore_val_t *y = (const kvstore_val_t*)b;
+    size_t min = x->size < y->size ? x->size : y->size;
+    int cmp = memcmp(x->data, y->data, min);
+    if (cmp != 0) return cmp;
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+// Union of every shard's split points, thinned to the requested count.
+// Also applies buffered writes and begins every inner transaction, so the
+// cursors a parallel scan then opens concurrently only read shared state.
+static int shard_split_points(kvstore_txn_t *txn, const char *table,
+                              kvstore_val_t *start, kvstore_val_t *end,
+                              kvstore_val_t *splits_out, size_t *nsplits) {
+    shard_db_t *sdb = (shard_db_t*)txn->db->backend_handle;
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    if (!stxn) return KVSTORE_ERROR;
+
+    size_t max = *nsplits;
+    *nsplits = 0;
+
+    if (has_pending(sdb, stxn)) {
+        int rc = apply_all(sdb, stxn, false);
+        if (rc != KVSTORE_OK) return rc;
+    }
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        if (!part_txn(sdb, stxn, i)) return KVSTORE_ERROR;
+    }
+    if (max == 0) return KVSTORE_OK;
+
+    kvstore_val_t *all = (kvstore_val_t*)calloc(sdb->nshards * max, sizeof(kvstore_val_t));
+    if (!all) return KVSTORE_ERROR;
+
+    size_t n = 0;
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        size_t got = max;
+        if (kvstore_txn_split_points(stxn->parts[i].inner, table, start, end,
+                                     all + n, &got) == KVSTORE_OK) {
+            n += got;
+        }
+    }
+    qsort(all, n, sizeof(kvstore_val_t), compare_split);
+
+    for (size_t k = 1; k <= max && n; k++) {
+        kvstore_val_t *pick = &all[n * k / (max + 1)];
+        if (*nsplits && compare_split(pick, &splits_out[*nsplits - 1]) <= 0) continue;
+        splits_out[(*nsplits)++] = *pick;
+    }
+
+    free(all);
+    return KVSTORE_OK;
+}
+
+// ------------------------
+// Savepoints
+// ------------------------
+
+// Buffered writes are applied first, so the inner savepoints alone mark
+// the position; a buffer mark would go stale once a cursor applies it.
+// Every shard gets a savepoint so ids line up however the txn goes on.
+static int shard_savepoint(kvstore_txn_t *txn, size_t *id) {
+    shard_db_t *sdb = (shard_db_t*)txn->db->backend_handle;
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    if (!stxn) return KVSTORE_ERROR;
+
+    if (has_pending(sdb, stxn)) {
+        int rc = apply_all(sdb, stxn, false);
+        if (rc != KVSTORE_OK) return rc;
+    }
+    if (stxn->mark_count >= stxn->mark_cap) {
+        size_t cap = stxn->mark_cap ? stxn->mark_cap * 2 : 8;
+        size_t *marks = (size_t*)realloc(stxn->marks, cap * sdb->nshards * sizeof(size_t));
+        if (!marks) return KVSTORE_ERROR;
+        stxn->marks = marks;
+        stxn->mark_cap = cap;
+    }
+
+    size_t *ids = &stxn->marks[stxn->mark_count * sdb->nshards];
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        kvstore_txn_t *inner = part_txn(sdb, stxn, i);
+        kvstore_savepoint_t sp;
+        int rc = inner ? kvstore_txn_savepoint(inner, &sp) : KVSTORE_ERROR;
+        if (rc != KVSTORE_OK) {
+            while (i-- > 0) {
+                sp.id = ids[i];
+                kvstore_txn_release(stxn->parts[i].inner, &sp);
+            }
+            return rc;
+        }
+        ids[i] = sp.id;
+    }
+
+    *id = stxn->mark_count++;
+    return KVSTORE_OK;
+}
+
+static int shard_rollback_to(kvstore_txn_t *txn, size_t id) {
+    shard_db_t *sdb = (shard_db_t*)txn->db->backend_handle;
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    if (!stxn || id >= stxn->mark_count) return KVSTORE_ERROR;
+
+    // Anything still buffered was written after the savepoint
+    int rc = KVSTORE_OK;
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        shard_part_t *part = &stxn->parts[i];
+        pending_clear(part);
+
+        kvstore_savepoint_t sp = { stxn->marks[id * sdb->nshards + i] };
+        int prc = kvstore_txn_rollback_to(part->inner, &sp);
+        if (prc != KVSTORE_OK) rc = prc;
+    }
+    stxn->mark_count = id + 1;
+    return rc;
+}
+
+static int shard_release(kvstore_txn_t *txn, size_t id) {
+    shard_db_t *sdb = (shard_db_t*)txn->db->backend_handle;
+    shard_txn_t *stxn = (shard_txn_t*)txn->backend_txn;
+    if (!stxn || id >= stxn->mark_count) return KVSTORE_ERROR;
+
+    int rc = KVSTORE_OK;
+    for (size_t i = 0; i < sdb->nshards; i++) {
+        kvstore_savepoint_t sp = { stxn->marks[id * sdb->nshards + i] };
+        int prc = kvstore_txn_release(stxn->parts[i].inner, &sp);
+        if (prc != KVSTORE_OK) rc = prc;
+    }
+    stxn->mark_count = id;
+    return rc;
+}
+
+// ------------------------
+// Ops vtable
+// ------------------------
+
+static const struct kvstore_ops shard_ops = {
+    .close = shard_close,
+    .txn_begin = shard_txn_begin,
+    .txn_commit = shard_txn_commit,
+    .txn_abort = shard_txn_abort,
+    .put = shard_put,
+    .get = shard_get,
+    .del = shard_del,
+    .cursor_open = shard_cursor_open,
+    .cursor_get = shard_cursor_get,
+    .cursor_next = shard_cursor_next,
+    .cursor_close = shard_cursor_close,
+    .cursor_bound = shard_cursor_bound,
+    .split_points = shard_split_points,
+    .savepoint = shard_savepoint,
+    .rollback_to = shard_rollback_to,
+    .release = shard_release,
+};
+
+kvstore_t* kvstore_shard_open(kvstore_t **shards, size_t nshards,
+                              const kvstore_shard_opts_t *opts) {
+    if (!shards || nshards == 0) return NULL;
+
+    kvstore_t *db = (kvstore_t*)calloc(1, sizeof(kvstore_t));
+    shard_db_t *sdb = (shard_db_t*)calloc(1, sizeof(shard_db_t));
+    kvstore_t **copy = (kvstore_t**)calloc(nshards, sizeof(kvstore_t*));
+    if (!db || !sdb || !copy) {
+        free(db);
+        free(sdb);
+        free(copy);
+        return NULL;
+    }
+
+    memcpy(copy, shards, nshards * sizeof(kvstore_t*));
+    sdb->shards = copy;
+    sdb->nshards = nshards;
+    if (opts) {
+        sdb->opts = *opts;
+    } else {
+        sdb->opts = (kvstore_shard_opts_t)KVSTORE_SHARD_OPTS_INIT;
+    }
+
+    db->backend_handle = sdb;
+    db->ops = &shard_ops;
+    return db;
+}
+
+size_t kvstore_shard_route(kvstore_t *db, const char *table,
+                           const kvstore_val_t *key) {
+    if (!db || db->ops != &shard_ops) return 0;
+    return route((shard_db_t*)db->backend_handle, table, key);
+}
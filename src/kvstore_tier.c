@@ -0,0 +1,1039 @@
+// Tiered storage wrapper backend
+//
+// The hot store holds the newest version of any key it has, over the cold
+// store's: its values carry a tag byte, and a delete is a tagged value that
+// hides the cold store's key. So data can move either way without readers
+// seeing a change. Moving a range out copies it to the cold store, commits,
+// then drops what hasn't been written since from the hot store; copying one
+// in adds the cold store's keys the hot store lacks. Only moves write to
+// the cold store.
+
+#define _POSIX_C_SOURCE 200809L
+#include "../include/kvstore_tier.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#define TIER_HOT_BYTES  ((size_t)64 << 20)
+#define TIER_IDLE_MS    30000
+#define TIER_INTERVAL   100
+#define TIER_PROMOTE    2
+#define TIER_BATCH      1024    // Keys a move commits at once
+
+// The tag that starts every value in the hot store
+#define TAG_PUT     0
+#define TAG_DEL     1
+
+// ------------------------
+// Data structures
+// ------------------------
+
+// The keys of a table that begin with prefix and name it as their range
+typedef struct tier_range {
+    struct tier_range *next;    // Hash chain
+    uint64_t hash;
+    uint64_t used_ms;           // Last get, write or scan
+    uint64_t bytes;             // In the hot store, estimated
+    unsigned cold_gets;         // Gets the cold store answered
+    unsigned pins;              // Open transactions that used it
+    bool resident;              // Every key is in the hot store
+    bool promote;               // To be copied in
+    size_t table_len;
+    size_t prefix_len;
+    char name[];                // Table, NUL, prefix
+} tier_range_t;
+
+// lock guards the ranges, the hot byte count and the move counters. Gets
+// and cursors hold move_lock shared while they read; a move holds it
+// exclusively while it drops keys from the hot store, so no reader sees a
+// key in neither store, or trusts a resident range that just lost keys.
+// Ranges are freed only under move_lock exclusively too, and never while
+// a transaction pins them, so readers and transactions can keep pointers
+// to them.
+typedef struct {
+    kvstore_t *hot;
+    kvstore_t *cold;
+    kvstore_tier_opts_t opts;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        // Wakes the migration thread
+    tier_range_t **buckets;
+    size_t nbuckets;
+    size_t nranges;
+    uint64_t hot_bytes;
+    uint64_t promotions;
+    uint64_t demotions;
+    uint64_t keys_promoted;
+    uint64_t keys_demoted;
+    uint64_t migration_errors;
+    bool stop;
+
+    pthread_rwlock_t move_lock;
+    pthread_mutex_t work_lock;  // One round of moves at a time
+    pthread_t thread;
+
+    _Atomic uint64_t gets;
+    _Atomic uint64_t hot_gets;
+} tier_db_t;
+
+typedef struct {
+    kvstore_txn_t *hot;
+    kvstore_txn_t *cold;        // Read-only
+    char *buf;                  // A value being tagged
+    size_t cap;
+    struct tier_range **pinned; // Ranges it used, kept where they are
+    size_t npinned;
+    size_t pinned_cap;
+} tier_txn_t;
+
+typedef struct {
+    kvstore_cursor_t *hot;      // NULL: no such table in that store
+    kvstore_cursor_t *cold;
+    bool from_hot;              // Which one holds the current key
+    tier_txn_t *txn;
+    char *table;
+    char *range;                // Prefix of the last range passed through
+    size_t range_len;
+    size_t range_cap;
+} tier_cursor_t;
+
+// A batch of a range's keys and tagged values, copied out of a store
+typedef struct {
+    size_t key_off;
+    size_t key_size;
+    size_t val_off;
+    size_t val_size;
+} tier_entry_t;
+
+typedef struct {
+    tier_entry_t *entries;
+    size_t count;
+    char *arena;
+    size_t len;
+    size_t cap;
+    char *last;                 // Key the last batch ended on
+    size_t last_size;
+    bool started;
+    bool done;
+} tier_batch_t;
+
+// ------------------------
+// Ranges
+// ------------------------
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+#define FNV_OFFSET 1469598103934665603ull
+
+// Length of the prefix of key that names its range
+static size_t range_prefix(tier_db_t *tdb, const char *table, const kvstore_val_t *key) {
+    size_t len;
+    if (tdb->opts.range_len) {
+        len = tdb->opts.range_len(table, key, tdb->opts.range_arg);
+    } else {
+        const char *p = (const char*)key->data;
+        const char *colon = (const char*)memchr(p, ':', key->size);
+        len = (colon ? (size_t)(colon - p) + 1 : 0) + tdb->opts.prefix_len;
+    }
+    return len < key->size ? len : key->size;
+}
+
+static int range_grow(tier_db_t *tdb) {
+    size_t cap = tdb->nbuckets * 2;
+    tier_range_t **buckets = (tier_range_t**)calloc(cap, sizeof(tier_range_t*));
+    if (!buckets) return KVSTORE_ERROR;
+
+    for (size_t i = 0; i < tdb->nbuckets; i++) {
+        for (tier_range_t *r = tdb->buckets[i], *next; r; r = next) {
+            next = r->next;
+            tier_range_t **bucket = &buckets[r->hash & (cap - 1)];
+            r->next = *bucket;
+            *bucket = r;
+        }
+    }
+    free(tdb->buckets);
+    tdb->buckets = buckets;
+    tdb->nbuckets = cap;
+    return KVSTORE_OK;
+}
+
+// Under lock: the range of table named by prefix, created if create is
+// set (NULL if it can't be)
+static tier_range_t* range_find(tier_db_t *tdb, const char *table, const void *prefix,
+                                size_t len, bool create) {
+    size_t table_len = strlen(table);
+    uint64_t hash = fnv1a(fnv1a(FNV_OFFSET, table, table_len + 1), prefix, len);
+    for (tier_range_t *r = tdb->buckets[hash & (tdb->nbuckets - 1)]; r; r = r->next) {
+        if (r->hash == hash && r->prefix_len == len && r->table_len == table_len &&
+            memcmp(r->name, table, table_len) == 0 &&
+            memcmp(r->name + table_len + 1, prefix, len) == 0) {
+            return r;
+        }
+    }
+    if (!create) return NULL;
+
+    if (tdb->nranges >= tdb->nbuckets && range_grow(tdb) != KVSTORE_OK) return NULL;
+    tier_range_t *r = (tier_range_t*)calloc(1, sizeof(tier_range_t) + table_len + 1 + len);
+    if (!r) return NULL;
+    r->hash = hash;
+    r->table_len = table_len;
+    r->prefix_len = len;
+    memcpy(r->name, table, table_len + 1);
+    if (len) memcpy(r->name + table_len + 1, prefix, len);
+
+    tier_range_t **bucket = &tdb->buckets[hash & (tdb->nbuckets - 1)];
+    r->next = *bucket;
+    *bucket = r;
+    tdb->nranges++;
+    return r;
+}
+
+// Under lock: keep r where it is until ttxn ends. A move would commit to
+// keys ttxn read, so it couldn't commit itself. Transactions use few
+// ranges, so the list is searched; one that can't grow leaves r free to
+// move, which is only a conflict more.
+static void range_pin(tier_txn_t *ttxn, tier_range_t *r) {
+    for (size_t i = ttxn->npinned; i-- > 0;) {
+        if (ttxn->pinned[i] == r) return;
+    }
+    if (ttxn->npinned == ttxn->pinned_cap) {
+        size_t cap = ttxn->pinned_cap ? ttxn->pinned_cap * 2 : 8;
+        tier_range_t **pinned = (tier_range_t**)realloc(ttxn->pinned, cap * sizeof(tier_range_t*));
+        if (!pinned) return;
+        ttxn->pinned = pinned;
+        ttxn->pinned_cap = cap;
+    }
+    ttxn->pinned[ttxn->npinned++] = r;
+    r->pins++;
+}
+
+// A write of bytes to key's range
+static void range_written(tier_db_t *tdb, tier_txn_t *ttxn, const char *table,
+                          const kvstore_val_t *key, uint64_t bytes) {
+    size_t len = range_prefix(tdb, table, key);
+    pthread_mutex_lock(&tdb->lock);
+    tier_range_t *r = range_find(tdb, table, key->data, len, true);
+    if (r) {
+        range_pin(ttxn, r);
+        r->used_ms = now_ms();
+        r->bytes += bytes;
+        tdb->hot_bytes += bytes;
+    }
+    if (tdb->hot_bytes > tdb->opts.hot_bytes) pthread_cond_signal(&tdb->cond);
+    pthread_mutex_unlock(&tdb->lock);
+}
+
+static void range_free_all(tier_db_t *tdb) {
+    for (size_t i = 0; i < tdb->nbuckets; i++) {
+        for (tier_range_t *r = tdb->buckets[i], *next; r; r = next) {
+            next = r->next;
+            free(r);
+        }
+    }
+    free(tdb->buckets);
+}
+
+// ------------------------
+// Moves
+// ------------------------
+
+static int batch_append(tier_batch_t *b, const void *data, size_t size, size_t *off) {
+    if (b->len + size > b->cap) {
+        size_t cap = b->cap ? b->cap : 65536;
+        while (cap < b->len + size) cap *= 2;
+        char *arena = (char*)realloc(b->arena, cap);
+        if (!arena) return KVSTORE_ERROR;
+        b->arena = arena;
+        b->cap = cap;
+    }
+    *off = b->len;
+    if (size) memcpy(b->arena + b->len, data, size);
+    b->len += size;
+    return KVSTORE_OK;
+}
+
+static void batch_free(tier_batch_t *b) {
+    free(b->entries);
+    free(b->arena);
+    free(b->last);
+}
+
+static int compare_keys(const kvstore_val_t *x, const kvstore_val_t *y) {
+    size_t min = x->size < y->size ? x->size : y->size;
+    int cmp = memcmp(x->data, y->data, min);
+    if (cmp != 0) return cmp;
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+// Up to TIER_BATCH more of range r's keys from txn, after those of the last
+// batch. Keys that begin with its prefix but name another range are passed
+// over. Values from the cold store get a TAG_PUT, so entries are always as
+// the hot store holds them.
+static int batch_fill(tier_db_t *tdb, kvstore_txn_t *txn, tier_range_t *r,
+                      bool tag, tier_batch_t *b) {
+    const char *table = r->name;
+    kvstore_val_t prefix = { r->name + r->table_len + 1, r->prefix_len };
+    kvstore_val_t start = b->started ? (kvstore_val_t){ b->last, b->last_size } : prefix;
+    b->count = 0;
+    b->len = 0;
+    if (!b->entries) {
+        b->entries = (tier_entry_t*)malloc(TIER_BATCH * sizeof(tier_entry_t));
+        if (!b->entries) return KVSTORE_ERROR;
+    }
+
+    // A store without the table has none of the range
+    kvstore_cursor_t *cur = kvstore_cursor_open(txn, table, &start);
+    if (!cur) {
+        b->done = true;
+        return KVSTORE_OK;
+    }
+
+    // Stop the cursor, and what it reads ahead, at the prefix's end: the
+    // prefix with its last byte below 0xff raised by one, the rest dropped
+    int rc = KVSTORE_OK;
+    char *end = (char*)malloc(prefix.size ? prefix.size : 1);
+    size_t end_size = prefix.size;
+    if (end) memcpy(end, prefix.data, prefix.size);
+    while (end && end_size && (unsigned char)end[end_size - 1] == 0xff) end_size--;
+    if (end && end_size) {
+        end[end_size - 1]++;
+        kvstore_val_t bound = { end, end_size };
+        rc = kvstore_cursor_set_end(cur, &bound);
+    }
+
+    kvstore_val_t k, v;
+    bool more = false;
+    while (rc == KVSTORE_OK && (rc = kvstore_cursor_get(cur, &k, &v)) == KVSTORE_OK) {
+        if (k.size < prefix.size || memcmp(k.data, prefix.data, prefix.size) != 0) break;
+        if (b->count == TIER_BATCH) {
+            more = true;
+            break;
+        }
+        kvstore_val_t last = { b->last, b->last_size };
+        bool seen = b->started && compare_keys(&k, &last) == 0;
+        if (!seen && range_prefix(tdb, table, &k) == prefix.size) {
+            tier_entry_t *e = &b->entries[b->count];
+            char tag_put = TAG_PUT;
+            size_t off;
+            if (batch_append(b, k.data, k.size, &e->key_off) != KVSTORE_OK ||
+                (tag && batch_append(b, &tag_put, 1, &e->val_off) != KVSTORE_OK) ||
+                batch_append(b, v.data, v.size, tag ? &off : &e->val_off) != KVSTORE_OK) {
+                rc = KVSTORE_ERROR;
+                break;
+            }
+            e->key_size = k.size;
+            e->val_size = v.size + (tag ? 1 : 0);
+            b->count++;
+        }
+        // A read that fails mustn't pass for the range's end
+        if (kvstore_cursor_next(cur) == KVSTORE_ERROR) rc = KVSTORE_ERROR;
+    }
+    if (rc == KVSTORE_NOTFOUND) rc = KVSTORE_OK;
+    kvstore_cursor_close(cur);
+    free(end);
+    if (rc != KVSTORE_OK) return rc;
+
+    // The next batch starts from the last key taken
+    if (b->count) {
+        tier_entry_t *e = &b->entries[b->count - 1];
+        char *last = (char*)realloc(b->last, e->key_size ? e->key_size : 1);
+        if (!last) return KVSTORE_ERROR;
+        memcpy(last, b->arena + e->key_off, e->key_size);
+        b->last = last;
+        b->last_size = e->key_size;
+        b->started = true;
+    }
+    b->done = !more;
+    return KVSTORE_OK;
+}
+
+// Copy range r into the hot store, where the hot store doesn't have its
+// keys already. It is then resident: its misses are misses.
+static int range_promote(tier_db_t *tdb, tier_range_t *r) {
+    tier_batch_t b = {0};
+    uint64_t bytes = 0, keys = 0;
+    int rc = KVSTORE_OK;
+    while (rc == KVSTORE_OK && !b.done) {
+        kvstore_txn_t *cold = kvstore_txn_begin(tdb->cold, true);
+        rc = cold ? batch_fill(tdb, cold, r, true, &b) : KVSTORE_ERROR;
+        if (cold) kvstore_txn_abort(cold);
+        if (rc != KVSTORE_OK || b.count == 0) break;
+
+        kvstore_txn_t *hot = kvstore_txn_begin(tdb->hot, false);
+        if (!hot) {
+            rc = KVSTORE_ERROR;
+            break;
+        }
+        uint64_t batch_bytes = 0, batch_keys = 0;
+        for (size_t i = 0; rc == KVSTORE_OK && i < b.count; i++) {
+            tier_entry_t *e = &b.entries[i];
+            kvstore_val_t k = { b.arena + e->key_off, e->key_size }, v;
+            rc = kvstore_txn_get(hot, r->name, &k, &v);
+            if (rc != KVSTORE_NOTFOUND) continue;
+            v = (kvstore_val_t){ b.arena + e->val_off, e->val_size };
+            rc = kvstore_txn_put(hot, r->name, &k, &v);
+            batch_bytes += k.size + v.size - 1;
+            batch_keys++;
+        }
+        rc = rc == KVSTORE_OK ? kvstore_txn_commit(hot) : (kvstore_txn_abort(hot), rc);
+        if (rc == KVSTORE_OK) {
+            bytes += batch_bytes;
+            keys += batch_keys;
+        }
+    }
+    batch_free(&b);
+
+    pthread_mutex_lock(&tdb->lock);
+    r->bytes += bytes;
+    tdb->hot_bytes += bytes;
+    tdb->keys_promoted += keys;
+    if (rc == KVSTORE_OK) {
+        r->resident = true;
+        r->promote = false;
+        r->cold_gets = 0;
+        tdb->promotions++;
+    } else if (rc != KVSTORE_CONFLICT) {
+        // Still queued: tried again next round, as after a writer's
+        // commit to one of its keys got in first
+        tdb->migration_errors++;
+    }
+    pthread_mutex_unlock(&tdb->lock);
+    return rc == KVSTORE_CONFLICT ? KVSTORE_OK : rc;
+}
+
+// Move range r out to the cold store
+static int range_demote(tier_db_t *tdb, tier_range_t *r) {
+    pthread_mutex_lock(&tdb->lock);
+    r->resident = false;
+    uint64_t before = r->bytes;
+    pthread_mutex_unlock(&tdb->lock);
+
+    tier_batch_t b = {0};
+    uint64_t kept = 0, moved = 0, keys = 0;
+    int rc = KVSTORE_OK;
+    while (rc == KVSTORE_OK && !b.done) {
+        kvstore_txn_t *hot = kvstore_txn_begin(tdb->hot, true);
+        rc = hot ? batch_fill(tdb, hot, r, false, &b) : KVSTORE_ERROR;
+        if (hot) kvstore_txn_abort(hot);
+        if (rc != KVSTORE_OK || b.count == 0) break;
+
+        // Into the cold store first: until the hot store drops them, its
+        // copies hide these
+        kvstore_txn_t *cold = kvstore_txn_begin(tdb->cold, false);
+        rc = cold ? KVSTORE_OK : KVSTORE_ERROR;
+        for (size_t i = 0; rc == KVSTORE_OK && i < b.count; i++) {
+            tier_entry_t *e = &b.entries[i];
+            kvstore_val_t k = { b.arena + e->key_off, e->key_size };
+            if (b.arena[e->val_off] == TAG_DEL) {
+                rc = kvstore_txn_del(cold, r->name, &k);
+                if (rc == KVSTORE_NOTFOUND) rc = KVSTORE_OK;
+            } else {
+                kvstore_val_t v = { b.arena + e->val_off + 1, e->val_size - 1 };
+                rc = kvstore_txn_put(cold, r->name, &k, &v);
+            }
+        }
+        if (cold) rc = rc == KVSTORE_OK ? kvstore_txn_commit(cold) : (kvstore_txn_abort(cold), rc);
+        if (rc != KVSTORE_OK) break;
+
+        // Then out of the hot store, but for keys written since. If that
+        // conflicts with a writer they all stay, still correct, for the
+        // next move.
+        pthread_rwlock_wrlock(&tdb->move_lock);
+        hot = kvstore_txn_begin(tdb->hot, false);
+        uint64_t batch_bytes = 0, batch_moved = 0, batch_keys = 0;
+        int hrc = hot ? KVSTORE_OK : KVSTORE_ERROR;
+        for (size_t i = 0; hrc == KVSTORE_OK && i < b.count; i++) {
+            tier_entry_t *e = &b.entries[i];
+            kvstore_val_t k = { b.arena + e->key_off, e->key_size }, v;
+            uint64_t bytes = k.size + e->val_size - 1;
+            batch_bytes += bytes;
+            if (kvstore_txn_get(hot, r->name, &k, &v) != KVSTORE_OK || v.size != e->val_size ||
+                memcmp(v.data, b.arena + e->val_off, v.size) != 0) {
+                continue;
+            }
+            hrc = kvstore_txn_del(hot, r->name, &k);
+            batch_moved += bytes;
+            batch_keys++;
+        }
+        if (hot) hrc = hrc == KVSTORE_OK ? kvstore_txn_commit(hot) : (kvstore_txn_abort(hot), hrc);
+        pthread_rwlock_unlock(&tdb->move_lock);
+        if (hrc == KVSTORE_OK) {
+            kept += batch_bytes - batch_moved;
+            moved += batch_moved;
+            keys += batch_keys;
+        } else {
+            kept += batch_bytes;
+        }
+    }
+    batch_free(&b);
+
+    // Done, the range holds what was kept and what was written meanwhile;
+    // otherwise it holds what it did less what moved out
+    pthread_mutex_lock(&tdb->lock);
+    uint64_t after = rc == KVSTORE_OK ? kept + (r->bytes - before) :
+                     r->bytes > moved ? r->bytes - moved : 0;
+    tdb->hot_bytes = tdb->hot_bytes - r->bytes + after;
+    r->bytes = after;
+    tdb->keys_demoted += keys;
+    if (rc == KVSTORE_OK) tdb->demotions++;
+    else tdb->migration_errors++;
+    pthread_mutex_unlock(&tdb->lock);
+    return rc;
+}
+
+static int compare_used(const void *a, const void *b) {
+    const tier_range_t *x = *(tier_range_t *const*)a;
+    const tier_range_t *y = *(tier_range_t *const*)b;
+    return (x->used_ms > y->used_ms) - (x->used_ms < y->used_ms);
+}
+
+// One round: copy in the ranges queued for it, then move out those idle
+// for idle_ms and, while the hot store holds more than hot_bytes, the
+// least recently used, down to an eighth below it so one more write
+// doesn't start another round. all moves out every range instead.
+static int tier_migrate(tier_db_t *tdb, bool all) {
+    pthread_mutex_lock(&tdb->work_lock);
+    int rc = KVSTORE_OK;
+
+    pthread_mutex_lock(&tdb->lock);
+    size_t cap = tdb->nranges ? tdb->nranges : 1;
+    tier_range_t **list = (tier_range_t**)malloc(cap * sizeof(tier_range_t*));
+    size_t n = 0;
+    for (size_t i = 0; list && !all && i < tdb->nbuckets; i++) {
+        for (tier_range_t *r = tdb->buckets[i]; r; r = r->next) {
+            if (r->promote) list[n++] = r;
+        }
+    }
+    if (list) qsort(list, n, sizeof(tier_range_t*), compare_used);
+    pthread_mutex_unlock(&tdb->lock);
+    if (!list) {
+        pthread_mutex_unlock(&tdb->work_lock);
+        return KVSTORE_ERROR;
+    }
+
+    // The most recently used first, until the hot store is an eighth over
+    // hot_bytes: what they push out goes below, and a round's moves stay
+    // bounded. Those left start counting cold gets again.
+    uint64_t limit = tdb->opts.hot_bytes + tdb->opts.hot_bytes / 8;
+    for (size_t i = n; i-- > 0;) {
+        pthread_mutex_lock(&tdb->lock);
+        bool full = tdb->hot_bytes >= limit, pinned = list[i]->pins > 0;
+        if (full) {
+            list[i]->promote = false;
+            list[i]->cold_gets = 0;
+        }
+        pthread_mutex_unlock(&tdb->lock);
+        if (!full && !pinned && range_promote(tdb, list[i]) != KVSTORE_OK) rc = KVSTORE_ERROR;
+    }
+
+    // Gets and writes may have added ranges meanwhile
+    pthread_mutex_lock(&tdb->lock);
+    if (tdb->nranges > cap) {
+        tier_range_t **grown = (tier_range_t**)realloc(list, tdb->nranges * sizeof(tier_range_t*));
+        if (!grown) {
+            pthread_mutex_unlock(&tdb->lock);
+            free(list);
+            pthread_mutex_unlock(&tdb->work_lock);
+            return KVSTORE_ERROR;
+        }
+        list = grown;
+    }
+    uint64_t now = now_ms(), left = tdb->hot_bytes;
+    size_t out = 0, lru = tdb->nranges;
+    for (size_t i = 0; i < tdb->nbuckets; i++) {
+        for (tier_range_t *r = tdb->buckets[i]; r; r = r->next) {
+            if ((!r->bytes && !r->resident) || (r->pins && !all)) continue;
+            if (all || now - r->used_ms >= tdb->opts.idle_ms) {
+                list[out++] = r;
+                left -= r->bytes < left ? r->bytes : left;
+            } else {
+                list[--lru] = r;
+            }
+        }
+    }
+    if (left > tdb->opts.hot_bytes) {
+        qsort(list + lru, tdb->nranges - lru, sizeof(tier_range_t*), compare_used);
+        uint64_t target = tdb->opts.hot_bytes - tdb->opts.hot_bytes / 8;
+        for (size_t i = lru; i < tdb->nranges && left > target; i++) {
+            left -= list[i]->bytes < left ? list[i]->bytes : left;
+            list[out++] = list[i];
+        }
+    }
+    pthread_mutex_unlock(&tdb->lock);
+    for (size_t i = 0; i < out; i++) {
+        if (range_demote(tdb, list[i]) != KVSTORE_OK) rc = KVSTORE_ERROR;
+    }
+    free(list);
+
+    // Forget ranges with nothing in the hot store once they go idle
+    pthread_rwlock_wrlock(&tdb->move_lock);
+    pthread_mutex_lock(&tdb->lock);
+    now = now_ms();
+    for (size_t i = 0; i < tdb->nbuckets; i++) {
+        for (tier_range_t **p = &tdb->buckets[i], *r; (r = *p);) {
+            if (r->bytes || r->resident || r->promote || r->pins ||
+                now - r->used_ms < tdb->opts.idle_ms) {
+                p = &r->next;
+                continue;
+            }
+            *p = r->next;
+            free(r);
+            tdb->nranges--;
+        }
+    }
+    pthread_mutex_unlock(&tdb->lock);
+    pthread_rwlock_unlock(&tdb->move_lock);
+
+    pthread_mutex_unlock(&tdb->work_lock);
+    return rc;
+}
+
+static void* mover_main(void *arg) {
+    tier_db_t *tdb = (tier_db_t*)arg;
+
+    pthread_mutex_lock(&tdb->lock);
+    while (!tdb->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t ns = (uint64_t)deadline.tv_nsec + (uint64_t)tdb->opts.interval_ms * 1000000ull;
+        deadline.tv_sec += (time_t)(ns / 1000000000ull);
+        deadline.tv_nsec = (long)(ns % 1000000000ull);
+        pthread_cond_timedwait(&tdb->cond, &tdb->lock, &deadline);
+        if (tdb->stop) break;
+
+        pthread_mutex_unlock(&tdb->lock);
+        tier_migrate(tdb, false);
+        pthread_mutex_lock(&tdb->lock);
+    }
+    pthread_mutex_unlock(&tdb->lock);
+    return NULL;
+}
+
+// ------------------------
+// Backend operations
+// ------------------------
+
+static void tier_close(kvstore_t *db) {
+    tier_db_t *tdb = (tier_db_t*)db->backend_handle;
+    if (!tdb) return;
+
+    pthread_mutex_lock(&tdb->lock);
+    tdb->stop = true;
+    pthread_cond_signal(&tdb->cond);
+    pthread_mutex_unlock(&tdb->lock);
+    pthread_join(tdb->thread, NULL);
+
+    tier_migrate(tdb, true);
+    range_free_all(tdb);
+    pthread_mutex_destroy(&tdb->lock);
+    pthread_cond_destroy(&tdb->cond);
+    pthread_rwlock_destroy(&tdb->move_lock);
+    pthread_mutex_destroy(&tdb->work_lock);
+    free(tdb);
+    db->backend_handle = NULL;
+}
+
+static int tier_txn_begin(kvstore_t *db, kvstore_txn_t *txn, bool read_only) {
+    tier_db_t *tdb = (tier_db_t*)db->backend_handle;
+
+    tier_txn_t *ttxn = (tier_txn_t*)calloc(1, sizeof(tier_txn_t));
+    if (!ttxn) return KVSTORE_ERROR;
+    // Both begin here, before any move_lock is taken
+    ttxn->hot = kvstore_txn_begin(tdb->hot, read_only);
+    ttxn->cold = ttxn->hot ? kvstore_txn_begin(tdb->cold, true) : NULL;
+    if (!ttxn->cold) {
+        if (ttxn->hot) kvstore_txn_abort(ttxn->hot);
+        free(ttxn);
+        return KVSTORE_ERROR;
+    }
+
+    txn->backend_txn = ttxn;
+    return KVSTORE_OK;
+}
+
+static void tier_txn_free(kvstore_txn_t *txn) {
+    tier_db_t *tdb = (tier_db_t*)txn->db->backend_handle;
+    tier_txn_t *ttxn = (tier_txn_t*)txn->backend_txn;
+    if (ttxn->hot) kvstore_txn_abort(ttxn->hot);
+    if (ttxn->cold) kvstore_txn_abort(ttxn->cold);
+    pthread_mutex_lock(&tdb->lock);
+    for (size_t i = 0; i < ttxn->npinned; i++) ttxn->pinned[i]->pins--;
+    pthread_mutex_unlock(&tdb->lock);
+    free(ttxn->pinned);
+    free(ttxn->buf);
+    free(ttxn);
+    txn->backend_txn = NULL;
+}
+
+static int tier_txn_commit(kvstore_txn_t *txn) {
+    tier_txn_t *ttxn = (tier_txn_t*)txn->backend_txn;
+    if (!ttxn) return KVSTORE_ERROR;
+
+    // Writes only reach the hot store
+    ttxn->hot->durability = txn->durability;
+    int rc = kvstore_txn_commit(ttxn->hot);
+    ttxn->hot = NULL;
+    tier_txn_free(txn);
+    return rc;
+}
+
+static void tier_txn_abort(kvstore_txn_t *txn) {
+    if (txn->backend_txn) tier_txn_free(txn);
+}
+
+// Under move_lock shared
+static int get_locked(tier_db_t *tdb, tier_txn_t *ttxn, const char *table,
+                      kvstore_val_t *key, kvstore_val_t *val_out) {
+    tdb->gets++;
+    size_t len = range_prefix(tdb, table, key);
+    pthread_mutex_lock(&tdb->lock);
+    tier_range_t *r = range_find(tdb, table, key->data, len, true);
+    bool resident = false;
+    if (r) {
+        range_pin(ttxn, r);
+        r->used_ms = now_ms();
+        resident = r->resident;
+    }
+    pthread_mutex_unlock(&tdb->lock);
+
+    kvstore_val_t v;
+    int rc = kvstore_txn_get(ttxn->hot, table, key, &v);
+    if (rc == KVSTORE_OK) {
+        tdb->hot_gets++;
+        if (v.size == 0 || ((const char*)v.data)[0] != TAG_PUT) return KVSTORE_NOTFOUND;
+        val_out->data = (char*)v.data + 1;
+        val_out->size = v.size - 1;
+        return KVSTORE_OK;
+    }
+    if (rc != KVSTORE_NOTFOUND) return rc;
+    if (resident) {
+        tdb->hot_gets++;
+        return KVSTORE_NOTFOUND;
+    }
+
+    rc = kvstore_txn_get(ttxn->cold, table, key, val_out);
+    if (rc == KVSTORE_OK && r) {
+        pthread_mutex_lock(&tdb->lock);
+        if (++r->cold_gets >= tdb->opts.promote_gets && !r->promote) {
+            r->promote = true;
+            pthread_cond_signal(&tdb->cond);
+        }
+        pthread_mutex_unlock(&tdb->lock);
+    }
+    return rc;
+}
+
+static int tier_get(kvstore_txn_t *txn, const char *table,
+                    kvstore_val_t *key, kvstore_val_t *val_out) {
+    tier_db_t *tdb = (tier_db_t*)txn->db->backend_handle;
+    tier_txn_t *ttxn = (tier_txn_t*)txn->backend_txn;
+    if (!ttxn) return KVSTORE_ERROR;
+
+    pthread_rwlock_rdlock(&tdb->move_lock);
+    int rc = get_locked(tdb, ttxn, table, key, val_out);
+    pthread_rwlock_unlock(&tdb->move_lock);
+    return rc;
+}
+
+// Put val, or a delete (NULL), tagged, into the hot store
+static int hot_put(tier_db_t *tdb, tier_txn_t *ttxn, const char *table,
+                   kvstore_val_t *key, kvstore_val_t *val) {
+    size_t size = val ? val->size : 0;
+    if (size + 1 > ttxn->cap) {
+        size_t cap = ttxn->cap ? ttxn->cap : 256;
+        while (cap < size + 1) cap *= 2;
+        char *buf = (char*)realloc(ttxn->buf, cap);
+        if (!buf) return KVSTORE_ERROR;
+        ttxn->buf = buf;
+        ttxn->cap = cap;
+    }
+    ttxn->buf[0] = val ? TAG_PUT : TAG_DEL;
+    if (size) memcpy(ttxn->buf + 1, val->data, size);
+
+    kvstore_val_t tagged = { ttxn->buf, size + 1 };
+    int rc = kvstore_txn_put(ttxn->hot, table, key, &tagged);
+    if (rc == KVSTORE_OK) range_written(tdb, ttxn, table, key, key->size + size);
+    return rc;
+}
+
+static int tier_put(kvstore_txn_t *txn, const char *table,
+                    kvstore_val_t *key, kvstore_val_t *val) {
+    tier_db_t *tdb = (tier_db_t*)txn->db->backend_handle;
+    tier_txn_t *ttxn = (tier_txn_t*)txn->backend_txn;
+    if (!ttxn) return KVSTORE_ERROR;
+
+    return hot_put(tdb, ttxn, table, key, val);
+}
+
+// Always a tagged delete, even of a key only the hot store has: a move
+// may be copying it to the cold store
+static int tier_del(kvstore_txn_t *txn, const char *table,
+                    kvstore_val_t *key) {
+    tier_db_t *tdb = (tier_db_t*)txn->db->backend_handle;
+    tier_txn_t *ttxn = (tier_txn_t*)txn->backend_txn;
+    if (!ttxn) return KVSTORE_ERROR;
+
+    kvstore_val_t existing;
+    int rc = tier_get(txn, table, key, &existing);
+    if (rc != KVSTORE_OK) return rc;
+
+    return hot_put(tdb, ttxn, table, key, NULL);
+}
+
+// ------------------------
+// Merged cursor
+// ------------------------
+
+// A scan keeps the ranges it passes through from going idle, but doesn't
+// copy any in: one scan of an archive shouldn't pull it into memory
+static void cursor_used(tier_db_t *tdb, tier_cursor_t *tcur, const kvstore_val_t *key) {
+    size_t len = range_prefix(tdb, tcur->table, key);
+    if (len == tcur->range_len && memcmp(key->data, tcur->range, len) == 0) return;
+
+    if (len > tcur->range_cap) {
+        char *range = (char*)realloc(tcur->range, len);
+        if (!range) return;
+        tcur->range = range;
+        tcur->range_cap = len;
+    }
+    memcpy(tcur->range, key->data, len);
+    tcur->range_len = len;
+
+    pthread_mutex_lock(&tdb->lock);
+    tier_range_t *r = range_find(tdb, tcur->table, key->data, len, false);
+    if (r) {
+        range_pin(tcur->txn, r);
+        r->used_ms = now_ms();
+    }
+    pthread_mutex_unlock(&tdb->lock);
+}
+
+// Settle on the lesser of the two stores' keys, the hot store's when they
+// are equal, passing over the hot store's deletes and the keys they hide
+static void cursor_pick(tier_db_t *tdb, kvstore_cursor_t *cur) {
+    tier_cursor_t *tcur = (tier_cursor_t*)cur->backend_cursor;
+    kvstore_val_t hk, hv, ck;
+
+    for (;;) {
+        bool hot = tcur->hot && kvstore_cursor_get(tcur->hot, &hk, &hv) == KVSTORE_OK;
+        bool cold = tcur->cold && kvstore_cursor_get(tcur->cold, &ck, NULL) == KVSTORE_OK;
+        if (!hot && !cold) {
+            cur->valid = false;
+            return;
+        }
+
+        int cmp = !hot ? 1 : !cold ? -1 : compare_keys(&hk, &ck);
+        if (cmp > 0) {
+            tcur->from_hot = false;
+            break;
+        }
+        if (cmp == 0) kvstore_cursor_next(tcur->cold);
+        if (hv.size && ((const char*)hv.data)[0] == TAG_PUT) {
+            tcur->from_hot = true;
+            break;
+        }
+        kvstore_cursor_next(tcur->hot);
+    }
+
+    cur->valid = true;
+    cursor_used(tdb, tcur, tcur->from_hot ? &hk : &ck);
+}
+
+static void cursor_free(tier_db_t *tdb, tier_cursor_t *tcur) {
+    kvstore_cursor_close(tcur->hot);
+    kvstore_cursor_close(tcur->cold);
+    free(tcur->table);
+    free(tcur->range);
+    free(tcur);
+    pthread_rwlock_unlock(&tdb->move_lock);
+}
+
+// The cursor holds move_lock shared until it closes
+static int tier_cursor_open(kvstore_txn_t *txn, kvstore_cursor_t *cur,
+                            const char *table, kvstore_val_t *start_key) {
+    tier_db_t *tdb = (tier_db_t*)txn->db->backend_handle;
+    tier_txn_t *ttxn = (tier_txn_t*)txn->backend_txn;
+    if (!ttxn) return KVSTORE_ERROR;
+
+    pthread_rwlock_rdlock(&tdb->move_lock);
+    tier_cursor_t *tcur = (tier_cursor_t*)calloc(1, sizeof(tier_cursor_t));
+    if (!tcur) {
+        pthread_rwlock_unlock(&tdb->move_lock);
+        return KVSTORE_ERROR;
+    }
+    tcur->txn = ttxn;
+    tcur->table = strdup(table);
+    if (!tcur->table) {
+        cursor_free(tdb, tcur);
+        return KVSTORE_ERROR;
+    }
+
+    // A store without the table simply contributes nothing
+    tcur->hot = kvstore_cursor_open(ttxn->hot, table, start_key);
+    tcur->cold = kvstore_cursor_open(ttxn->cold, table, start_key);
+
+    cur->backend_cursor = tcur;
+    cursor_pick(tdb, cur);
+    return KVSTORE_OK;
+}
+
+static int tier_cursor_get(kvstore_cursor_t *cur,
+                           kvstore_val_t *key_out, kvstore_val_t *val_out) {
+    tier_cursor_t *tcur = (tier_cursor_t*)cur->backend_cursor;
+    if (!tcur) return KVSTORE_ERROR;
+    if (!cur->valid) return KVSTORE_NOTFOUND;
+    if (!tcur->from_hot) return kvstore_cursor_get(tcur->cold, key_out, val_out);
+
+    kvstore_val_t v;
+    int rc = kvstore_cursor_get(tcur->hot, key_out, &v);
+    if (rc == KVSTORE_OK && val_out) {
+        val_out->data = (char*)v.data + 1;
+        val_out->size = v.size - 1;
+    }
+    return rc;
+}
+
+static int tier_cursor_next(kvstore_cursor_t *cur) {
+    tier_db_t *tdb = (tier_db_t*)cur->txn->db->backend_handle;
+    tier_cursor_t *tcur = (tier_cursor_t*)cur->backend_cursor;
+    if (!tcur) return KVSTORE_ERROR;
+    if (!cur->valid) return KVSTORE_NOTFOUND;
+
+    kvstore_cursor_next(tcur->from_hot ? tcur->hot : tcur->cold);
+    cursor_pick(tdb, cur);
+
+    return cur->valid ? KVSTORE_OK : KVSTORE_NOTFOUND;
+}
+
+// Both stores' cursors stop at end, so neither reads ahead past it
+static int tier_cursor_bound(kvstore_cursor_t *cur, kvstore_val_t *end) {
+    tier_db_t *tdb = (tier_db_t*)cur->txn->db->backend_handle;
+    tier_cursor_t *tcur = (tier_cursor_t*)cur->backend_cursor;
+    if (!tcur) return KVSTORE_ERROR;
+
+    if ((tcur->hot && kvstore_cursor_set_end(tcur->hot, end) != KVSTORE_OK) ||
+        (tcur->cold && kvstore_cursor_set_end(tcur->cold, end) != KVSTORE_OK)) {
+        return KVSTORE_ERROR;
+    }
+    cursor_pick(tdb, cur);
+    return KVSTORE_OK;
+}
+
+static void tier_cursor_close(kvstore_cursor_t *cur) {
+    tier_db_t *tdb = (tier_db_t*)cur->txn->db->backend_handle;
+    tier_cursor_t *tcur = (tier_cursor_t*)cur->backend_cursor;
+    if (tcur) {
+        cursor_free(tdb, tcur);
+        cur->backend_cursor = NULL;
+    }
+    cur->valid = false;
+}
+
+// ------------------------
+// Ops vtable
+// ------------------------
+
+static const struct kvstore_ops tier_ops = {
+    .close = tier_close,
+    .txn_begin = tier_txn_begin,
+    .txn_commit = tier_txn_commit,
+    .txn_abort = tier_txn_abort,
+    .put = tier_put,
+    .get = tier_get,
+    .del = tier_del,
+    .cursor_open = tier_cursor_open,
+    .cursor_get = tier_cursor_get,
+    .cursor_next = tier_cursor_next,
+    .cursor_close = tier_cursor_close,
+    .cursor_bound = tier_cursor_bound,
+};
+
+kvstore_t* kvstore_tier_open(kvstore_t *hot, kvstore_t *cold,
+                             const kvstore_tier_opts_t *opts) {
+    if (!hot || !cold) return NULL;
+
+    kvstore_t *db = (kvstore_t*)calloc(1, sizeof(kvstore_t));
+    tier_db_t *tdb = (tier_db_t*)calloc(1, sizeof(tier_db_t));
+    tier_range_t **buckets = (tier_range_t**)calloc(256, sizeof(tier_range_t*));
+    if (!db || !tdb || !buckets) {
+        free(db);
+        free(tdb);
+        free(buckets);
+        return NULL;
+    }
+
+    tdb->hot = hot;
+    tdb->cold = cold;
+    if (opts) {
+        tdb->opts = *opts;
+    } else {
+        tdb->opts = (kvstore_tier_opts_t)KVSTORE_TIER_OPTS_INIT;
+    }
+    if (!tdb->opts.hot_bytes) tdb->opts.hot_bytes = TIER_HOT_BYTES;
+    if (!tdb->opts.idle_ms) tdb->opts.idle_ms = TIER_IDLE_MS;
+    if (!tdb->opts.interval_ms) tdb->opts.interval_ms = TIER_INTERVAL;
+    if (!tdb->opts.promote_gets) tdb->opts.promote_gets = TIER_PROMOTE;
+    tdb->buckets = buckets;
+    tdb->nbuckets = 256;
+
+    pthread_mutex_init(&tdb->lock, NULL);
+    pthread_cond_init(&tdb->cond, NULL);
+    pthread_rwlock_init(&tdb->move_lock, NULL);
+    pthread_mutex_init(&tdb->work_lock, NULL);
+    if (pthread_create(&tdb->thread, NULL, mover_main, tdb) != 0) {
+        pthread_mutex_destroy(&tdb->lock);
+        pthread_cond_destroy(&tdb->cond);
+        pthread_rwlock_destroy(&tdb->move_lock);
+        pthread_mutex_destroy(&tdb->work_lock);
+        free(buckets);
+        free(tdb);
+        free(db);
+        return NULL;
+    }
+
+    db->backend_handle = tdb;
+    db->ops = &tier_ops;
+    return db;
+}
+
+int kvstore_tier_flush(kvstore_t *db) {
+    if (!db || db->ops != &tier_ops) return KVSTORE_ERROR;
+    return tier_migrate((tier_db_t*)db->backend_handle, true);
+}
+
+int kvstore_tier_stats(kvstore_t *db, kvstore_tier_stats_t *out) {
+    if (!db || db->ops != &tier_ops || !out) return KVSTORE_ERROR;
+    tier_db_t *tdb = (tier_db_t*)db->backend_handle;
+
+    memset(out, 0, sizeof(*out));
+    out->gets = tdb->gets;
+    out->hot_gets = tdb->hot_gets;
+
+    pthread_mutex_lock(&tdb->lock);
+    out->promotions = tdb->promotions;
+    out->demotions = tdb->demotions;
+    out->keys_promoted = tdb->keys_promoted;
+    out->keys_demoted = tdb->keys_demoted;
+    out->migration_errors = tdb->migration_errors;
+    out->hot_bytes = tdb->hot_bytes;
+    out->ranges = tdb->nranges;
+    for (size_t i = 0; i < tdb->nbuckets; i++) {
+        for (tier_range_t *r = tdb->buckets[i]; r; r = r->next) out->resident_ranges += r->resident;
+    }
+    pthread_mutex_unlock(&tdb->lock);
+    return KVSTORE_OK;
+}